@@ -80,9 +80,92 @@ namespace ScreenRecorderLib {
 	public:
 		property int FrameNumber;
 		property INT64 Timestamp;
-		FrameRecordedEventArgs(int frameNumber, INT64 timestamp) {
+		/// <summary>
+		/// The frames waiting to be encoded, right after this one was queued.
+		/// </summary>
+		property int QueuedFrames;
+		/// <summary>
+		/// The frames dropped so far because the queue of frames waiting to be encoded was full.
+		/// </summary>
+		property int DroppedFrames;
+		FrameRecordedEventArgs(int frameNumber, INT64 timestamp, int queuedFrames, int droppedFrames) {
 			FrameNumber = frameNumber;
 			Timestamp = timestamp;
+			QueuedFrames = queuedFrames;
+			DroppedFrames = droppedFrames;
+		}
+	};
+
+	public ref class ChunkWrittenEventArgs :System::EventArgs {
+	public:
+		/// <summary>
+		/// The segment file the chunk is in, counting from 1. Always 1, unless the recording is split into segments.
+		/// </summary>
+		property int SegmentNumber;
+		/// <summary>
+		/// The sequence number of the chunk in the file, counting from 1.
+		/// </summary>
+		property int SequenceNumber;
+		/// <summary>
+		/// Where the chunk is in the file, and its size in bytes. Everything up to the end of the chunk is written to the file when the event is raised.
+		/// </summary>
+		property INT64 Offset;
+		property INT64 Size;
+		/// <summary>
+		/// The time in the recording the chunk starts at, and how long it lasts.
+		/// </summary>
+		property TimeSpan StartTime;
+		property TimeSpan Duration;
+		/// <summary>
+		/// Whether the chunk starts a fragment, which starts with a keyframe a player can join the stream at.
+		/// </summary>
+		property bool IsFragmentStart;
+		ChunkWrittenEventArgs(int segmentNumber, int sequenceNumber, INT64 offset, INT64 size, TimeSpan startTime, TimeSpan duration, bool isFragmentStart) {
+			SegmentNumber = segmentNumber;
+			SequenceNumber = sequenceNumber;
+			Offset = offset;
+			Size = size;
+			StartTime = startTime;
+			Duration = duration;
+			IsFragmentStart = isFragmentStart;
+		}
+	};
+
+	public ref class SegmentWrittenEventArgs :System::EventArgs {
+	public:
+		/// <summary>
+		/// The number of the segment, counting from 1.
+		/// </summary>
+		property int SegmentNumber;
+		/// <summary>
+		/// The file of the segment, a complete MP4 file of its own.
+		/// </summary>
+		property String^ FilePath;
+		/// <summary>
+		/// The time in the recording the segment starts at, and how long it lasts. A segment starts where the one before ended.
+		/// </summary>
+		property TimeSpan StartTime;
+		property TimeSpan Duration;
+		/// <summary>
+		/// The size of the file in bytes.
+		/// </summary>
+		property INT64 Size;
+		/// <summary>
+		/// How long ending the segment and opening the file of the next one held up the encoder. For the last segment, how long finishing the file took.
+		/// </summary>
+		property TimeSpan SwitchTime;
+		/// <summary>
+		/// Frames left out of the segment. Only the first segment can leave out frames, those before the first keyframe.
+		/// </summary>
+		property int DroppedFrames;
+		SegmentWrittenEventArgs(int segmentNumber, String^ filePath, TimeSpan startTime, TimeSpan duration, INT64 size, TimeSpan switchTime, int droppedFrames) {
+			SegmentNumber = segmentNumber;
+			FilePath = filePath;
+			StartTime = startTime;
+			Duration = duration;
+			Size = size;
+			SwitchTime = switchTime;
+			DroppedFrames = droppedFrames;
 		}
 	};
 }
\ No newline at end of file
@@ -47,13 +47,64 @@ namespace ScreenRecorderLib {
 
 	};
 
+	public enum class AudioTrackLayout {
+		///<summary>All audio devices are mixed to a single track.</summary>
+		Mixed = (int)AudioTrackLayoutInternal::Mixed,
+		///<summary>Each audio device is written to a track of its own, and nothing is mixed.</summary>
+		Separate = (int)AudioTrackLayoutInternal::Separate,
+		///<summary>The mixed track first, for players that only play one track, followed by a track for each audio device.</summary>
+		MixedAndSeparate = (int)AudioTrackLayoutInternal::MixedAndSeparate
+	};
+
+	public enum class AudioCaptureWakeMode {
+		///<summary>Collect captured audio on a timer, at the interval set in CaptureWakeIntervalMillis. A longer interval means fewer wakeups and more latency.</summary>
+		Timer = (int)AudioCaptureWakeModeInternal::Timer,
+		///<summary>Collect captured audio as soon as the device signals a packet is ready. Used for input devices only, output devices are captured on the timer.</summary>
+		Event = (int)AudioCaptureWakeModeInternal::Event
+	};
+
+	public enum class VideoColorConversionMode {
+		///<summary>Convert the captured frames on the GPU when the video processor supports it, otherwise on the CPU.</summary>
+		Auto = (int)VideoColorConversionModeInternal::Auto,
+		///<summary>Convert the captured frames on the CPU, on several threads. Takes the frames off the GPU, but avoids the per frame cost of the video processor in software.</summary>
+		Cpu = (int)VideoColorConversionModeInternal::Cpu,
+		///<summary>Convert the captured frames with the Media Foundation video processor.</summary>
+		MediaTransform = (int)VideoColorConversionModeInternal::MediaTransform
+	};
+
+	public enum class VideoColorMatrix {
+		///<summary>The standard definition matrix.</summary>
+		BT601 = (int)VideoColorMatrixInternal::BT601,
+		///<summary>The high definition matrix.</summary>
+		BT709 = (int)VideoColorMatrixInternal::BT709
+	};
+
+	public enum class FrameQueueFullPolicy {
+		///<summary>Wait for the encoder to make room in the queue. No frame is lost, but the capture is held up while the encoder catches up.</summary>
+		Block = (int)FrameQueueFullPolicyInternal::Block,
+		///<summary>Drop the oldest frame in the queue to make room for the new one. The video keeps up with the screen, at the cost of skipped frames.</summary>
+		DropOldest = (int)FrameQueueFullPolicyInternal::DropOldest,
+		///<summary>Drop the new frame, and show the last queued frame for longer.</summary>
+		DropNewest = (int)FrameQueueFullPolicyInternal::DropNewest
+	};
+
+	public enum class Mp4Muxer {
+		///<summary>The Media Foundation MPEG-4 sinks. Writes a fragmented or a regular mp4, as set by IsFragmentedMp4Enabled.</summary>
+		MediaFoundation = (int)Mp4MuxerInternal::MediaFoundation,
+		///<summary>The built in fragmented mp4 muxer. Writes fragments of FragmentDurationMillis, each starting on a keyframe, through a write buffer of MuxerWriteBufferSize bytes.</summary>
+		Native = (int)Mp4MuxerInternal::Native
+	};
+
 	public enum class RecorderMode {
 		///<summary>Record to mp4 container in H.264/AVC or H.265/HEVC format. </summary>
 		Video = (int)RecorderModeInternal::Video,
 		///<summary>Record a slideshow of pictures. </summary>
 		Slideshow = (int)RecorderModeInternal::Slideshow,
 		///<summary>Create a single screenshot.</summary>
-		Screenshot = (int)RecorderModeInternal::Screenshot
+		Screenshot = (int)RecorderModeInternal::Screenshot,
+		///<summary>Record only audio, to an uncompressed 16 bit PCM WAV file. No screen is captured, and the recording sources are ignored. Audio must be enabled.
+		///A WAV file holds a single track, so with a track per audio device only the first track is written.</summary>
+		Audio = (int)RecorderModeInternal::Audio
 	};
 
 	public ref class SourceOptions : public INotifyPropertyChanged {
@@ -237,6 +288,24 @@ namespace ScreenRecorderLib {
 		bool _isHardwareEncodingEnabled;
 		bool _isMp4FastStartEnabled;
 		bool _isFragmentedMp4Enabled;
+		bool _isFullRangeColorEnabled;
+		VideoColorConversionMode _colorConversionMode;
+		VideoColorMatrix _colorMatrix;
+		int _frameQueueLength;
+		FrameQueueFullPolicy _frameQueueFullPolicy;
+		bool _isUnchangedFrameSkippingEnabled;
+		int _maxUnchangedFrameDurationMillis;
+		ScreenRecorderLib::Mp4Muxer _mp4Muxer;
+		int _fragmentDurationMillis;
+		int _muxerWriteBufferSize;
+		int _chunkDurationMillis;
+		int _segmentDurationMillis;
+		Int64 _segmentSizeBytes;
+		bool _isCrashSafeEnabled;
+		int _crashSafeSyncIntervalMillis;
+		bool _isInstantReplayEnabled;
+		int _instantReplayDurationMillis;
+		Int64 _instantReplayMaxMemoryBytes;
 		IVideoEncoder^ _encoder = gcnew H264VideoEncoder();
 	public:
 		VideoEncoderOptions() {
@@ -249,6 +318,24 @@ namespace ScreenRecorderLib {
 			IsHardwareEncodingEnabled = true;
 			IsMp4FastStartEnabled = false;
 			IsFragmentedMp4Enabled = true;
+			ColorConversionMode = VideoColorConversionMode::Auto;
+			ColorMatrix = VideoColorMatrix::BT709;
+			IsFullRangeColorEnabled = false;
+			FrameQueueLength = 4;
+			FrameQueueFullPolicy = ScreenRecorderLib::FrameQueueFullPolicy::Block;
+			IsUnchangedFrameSkippingEnabled = false;
+			MaxUnchangedFrameDurationMillis = 1000;
+			Mp4Muxer = ScreenRecorderLib::Mp4Muxer::MediaFoundation;
+			FragmentDurationMillis = 1000;
+			MuxerWriteBufferSize = 1024 * 1024;
+			ChunkDurationMillis = 0;
+			SegmentDurationMillis = 0;
+			SegmentSizeBytes = 0;
+			IsCrashSafeEnabled = false;
+			CrashSafeSyncIntervalMillis = 1000;
+			IsInstantReplayEnabled = false;
+			InstantReplayDurationMillis = 60000;
+			InstantReplayMaxMemoryBytes = 256 * 1024 * 1024;
 			Encoder = gcnew H264VideoEncoder();
 		}
 		virtual event PropertyChangedEventHandler^ PropertyChanged;
@@ -365,6 +452,234 @@ namespace ScreenRecorderLib {
 			}
 		}
 		/// <summary>
+		/// Where the captured frames are converted to the YUV format of the encoder. Default is Auto.
+		/// </summary>
+		property VideoColorConversionMode ColorConversionMode {
+			VideoColorConversionMode get() {
+				return _colorConversionMode;
+			}
+			void set(VideoColorConversionMode value) {
+				_colorConversionMode = value;
+				OnPropertyChanged("ColorConversionMode");
+			}
+		}
+		/// <summary>
+		/// The color matrix of the encoded video. Default is BT709.
+		/// </summary>
+		property VideoColorMatrix ColorMatrix {
+			VideoColorMatrix get() {
+				return _colorMatrix;
+			}
+			void set(VideoColorMatrix value) {
+				_colorMatrix = value;
+				OnPropertyChanged("ColorMatrix");
+			}
+		}
+		/// <summary>
+		/// Encode the video with the full 0-255 range instead of the 16-235 range most players expect. Default is false.
+		/// </summary>
+		property bool IsFullRangeColorEnabled {
+			bool get() {
+				return _isFullRangeColorEnabled;
+			}
+			void set(bool value) {
+				_isFullRangeColorEnabled = value;
+				OnPropertyChanged("IsFullRangeColorEnabled");
+			}
+		}
+		/// <summary>
+		/// The number of captured frames that can wait to be encoded, so a slow frame in the encoder does not hold up the capture. 0 encodes each frame on the capture thread. Default is 4.
+		/// </summary>
+		property int FrameQueueLength {
+			int get() {
+				return _frameQueueLength;
+			}
+			void set(int value) {
+				_frameQueueLength = value;
+				OnPropertyChanged("FrameQueueLength");
+			}
+		}
+		/// <summary>
+		/// What to do with a captured frame when the queue of frames waiting to be encoded is full. Default is Block.
+		/// </summary>
+		property ScreenRecorderLib::FrameQueueFullPolicy FrameQueueFullPolicy {
+			ScreenRecorderLib::FrameQueueFullPolicy get() {
+				return _frameQueueFullPolicy;
+			}
+			void set(ScreenRecorderLib::FrameQueueFullPolicy value) {
+				_frameQueueFullPolicy = value;
+				OnPropertyChanged("FrameQueueFullPolicy");
+			}
+		}
+		/// <summary>
+		/// Leave frames where nothing on screen changed out of the video, and show the frame before for longer. Saves encoding and file size when the screen is static,
+		/// but the video no longer has a constant frame rate, even with IsFixedFramerate. Default is false.
+		/// </summary>
+		property bool IsUnchangedFrameSkippingEnabled {
+			bool get() {
+				return _isUnchangedFrameSkippingEnabled;
+			}
+			void set(bool value) {
+				_isUnchangedFrameSkippingEnabled = value;
+				OnPropertyChanged("IsUnchangedFrameSkippingEnabled");
+			}
+		}
+		/// <summary>
+		/// The longest a frame is shown for while nothing changes, before it is written again. Keeps a steady cadence of frames, and of keyframes, in a static video, so it stays seekable. Default is 1000.
+		/// </summary>
+		property int MaxUnchangedFrameDurationMillis {
+			int get() {
+				return _maxUnchangedFrameDurationMillis;
+			}
+			void set(int value) {
+				_maxUnchangedFrameDurationMillis = value;
+				OnPropertyChanged("MaxUnchangedFrameDurationMillis");
+			}
+		}
+		/// <summary>
+		/// The muxer that writes the mp4 file. Default is MediaFoundation.
+		/// </summary>
+		property ScreenRecorderLib::Mp4Muxer Mp4Muxer {
+			ScreenRecorderLib::Mp4Muxer get() {
+				return _mp4Muxer;
+			}
+			void set(ScreenRecorderLib::Mp4Muxer value) {
+				_mp4Muxer = value;
+				OnPropertyChanged("Mp4Muxer");
+			}
+		}
+		/// <summary>
+		/// The duration of a fragment written by the Native muxer. The encoder is set to a keyframe interval of this duration, so a fragment is cut on every keyframe.
+		/// Shorter fragments lose less of the recording if it is cut off, longer fragments have less overhead. Default is 1000.
+		/// </summary>
+		property int FragmentDurationMillis {
+			int get() {
+				return _fragmentDurationMillis;
+			}
+			void set(int value) {
+				_fragmentDurationMillis = value;
+				OnPropertyChanged("FragmentDurationMillis");
+			}
+		}
+		/// <summary>
+		/// The size in bytes of the buffer the Native muxer collects writes to the file in. A buffer that holds a fragment writes it with a single write. 0 writes every box as it is made. Default is 1048576.
+		/// </summary>
+		property int MuxerWriteBufferSize {
+			int get() {
+				return _muxerWriteBufferSize;
+			}
+			void set(int value) {
+				_muxerWriteBufferSize = value;
+				OnPropertyChanged("MuxerWriteBufferSize");
+			}
+		}
+		/// <summary>
+		/// The duration of the chunks the Native muxer writes each fragment in, as low latency CMAF chunks. A chunk is written to the file as soon as it is complete,
+		/// so a live consumer gets the video within a chunk duration of it being recorded, instead of a fragment duration. Only the first chunk of a fragment starts on a keyframe.
+		/// Recorder.OnChunkWritten is raised for every chunk. 0 writes a fragment at a time. Default is 0.
+		/// </summary>
+		property int ChunkDurationMillis {
+			int get() {
+				return _chunkDurationMillis;
+			}
+			void set(int value) {
+				_chunkDurationMillis = value;
+				OnPropertyChanged("ChunkDurationMillis");
+			}
+		}
+		/// <summary>
+		/// Splits a recording with the Native muxer into files of this duration, e.g. "Recording.mp4", "Recording-002.mp4" and so on. Each file is complete and plays on its own,
+		/// and each starts where the one before ended. A file ends on the first keyframe after it is due, so it may last longer by up to a fragment.
+		/// Recorder.OnSegmentWritten is raised for every file. Only applies to recordings to a file path. 0 for no limit. Default is 0.
+		/// </summary>
+		property int SegmentDurationMillis {
+			int get() {
+				return _segmentDurationMillis;
+			}
+			void set(int value) {
+				_segmentDurationMillis = value;
+				OnPropertyChanged("SegmentDurationMillis");
+			}
+		}
+		/// <summary>
+		/// Splits a recording with the Native muxer into files of this size in bytes, as SegmentDurationMillis does by duration. A file may grow larger by up to a fragment.
+		/// If both are set, a file ends on whichever limit comes first. 0 for no limit. Default is 0.
+		/// </summary>
+		property Int64 SegmentSizeBytes {
+			Int64 get() {
+				return _segmentSizeBytes;
+			}
+			void set(Int64 value) {
+				_segmentSizeBytes = value;
+				OnPropertyChanged("SegmentSizeBytes");
+			}
+		}
+		/// <summary>
+		/// Makes a recording with the Native muxer survive a crash of the application or the system. The file is committed to disk every CrashSafeSyncIntervalMillis,
+		/// and a journal of what was written is kept next to it, as "Recording.mp4.journal", until the recording is finished. A file that was not finished
+		/// is made playable again, up to the last part that reached the disk, with Recorder.RecoverRecording. Default is false.
+		/// </summary>
+		property bool IsCrashSafeEnabled {
+			bool get() {
+				return _isCrashSafeEnabled;
+			}
+			void set(bool value) {
+				_isCrashSafeEnabled = value;
+				OnPropertyChanged("IsCrashSafeEnabled");
+			}
+		}
+		/// <summary>
+		/// The recording time between commits of a crash safe recording to disk, which is at most what a power loss can take. A commit waits for the disk,
+		/// so shorter intervals cost more. 0 commits every chunk, or every fragment. Default is 1000.
+		/// </summary>
+		property int CrashSafeSyncIntervalMillis {
+			int get() {
+				return _crashSafeSyncIntervalMillis;
+			}
+			void set(int value) {
+				_crashSafeSyncIntervalMillis = value;
+				OnPropertyChanged("CrashSafeSyncIntervalMillis");
+			}
+		}
+		/// <summary>
+		/// Keeps the last InstantReplayDurationMillis of a recording with the Native muxer in memory, as it was encoded, so it can be saved to a file with Recorder.SaveReplay
+		/// while the recording goes on, e.g. for an instant replay. The recording is written as usual. Default is false.
+		/// </summary>
+		property bool IsInstantReplayEnabled {
+			bool get() {
+				return _isInstantReplayEnabled;
+			}
+			void set(bool value) {
+				_isInstantReplayEnabled = value;
+				OnPropertyChanged("IsInstantReplayEnabled");
+			}
+		}
+		/// <summary>
+		/// How much of the recording the instant replay keeps. A replay starts on a keyframe, so it may last longer by up to the time between keyframes. Default is 60000.
+		/// </summary>
+		property int InstantReplayDurationMillis {
+			int get() {
+				return _instantReplayDurationMillis;
+			}
+			void set(int value) {
+				_instantReplayDurationMillis = value;
+				OnPropertyChanged("InstantReplayDurationMillis");
+			}
+		}
+		/// <summary>
+		/// The memory the instant replay takes, in bytes, reserved when the recording starts. If InstantReplayDurationMillis of the video does not fit, a shorter replay is kept.
+		/// Default is 256 MB, a minute of video at up to about 30 Mbps.
+		/// </summary>
+		property Int64 InstantReplayMaxMemoryBytes {
+			Int64 get() {
+				return _instantReplayMaxMemoryBytes;
+			}
+			void set(Int64 value) {
+				_instantReplayMaxMemoryBytes = value;
+				OnPropertyChanged("InstantReplayMaxMemoryBytes");
+			}
+		}
+		/// <summary>
 		/// Set the video encoder to use. Current supported encoders are H264VideoEncoder and H265VideoEncoder.
 		/// </summary>
 		property IVideoEncoder^ Encoder {
@@ -451,6 +766,9 @@ namespace ScreenRecorderLib {
 		Nullable<float> _outputVolume;
 		Nullable<bool> _isInputDeviceEnabled;
 		Nullable<bool> _isOutputDeviceEnabled;
+		String^ _audioInputDevice;
+		String^ _audioOutputDevice;
+		List<String^>^ _additionalAudioInputDevices;
 	public:
 		DynamicAudioOptions() {
 
@@ -513,6 +831,44 @@ namespace ScreenRecorderLib {
 				OnPropertyChanged("OutputVolume");
 			}
 		}
+		/// <summary>
+		///Audio device to capture system audio from via loopback capture. Pass null or empty string to select system default.
+		/// Can be changed while recording, without a gap in the audio.
+		/// </summary>
+		property String^ AudioOutputDevice {
+			String^ get() {
+				return _audioOutputDevice;
+			}
+			void set(String^ value) {
+				_audioOutputDevice = value;
+				OnPropertyChanged("AudioOutputDevice");
+			}
+		}
+		/// <summary>
+		///Audio input device (e.g. microphone) to capture audio from. Pass null or empty string to select system default.
+		/// Can be changed while recording, without a gap in the audio.
+		/// </summary>
+		property String^ AudioInputDevice {
+			String^ get() {
+				return _audioInputDevice;
+			}
+			void set(String^ value) {
+				_audioInputDevice = value;
+				OnPropertyChanged("AudioInputDevice");
+			}
+		}
+		/// <summary>
+		///More audio input devices (e.g. microphones) to capture audio from and mix with the other devices. They are enabled with IsInputDeviceEnabled, and use the InputVolume.
+		/// </summary>
+		property List<String^>^ AdditionalAudioInputDevices {
+			List<String^>^ get() {
+				return _additionalAudioInputDevices;
+			}
+			void set(List<String^>^ value) {
+				_additionalAudioInputDevices = value;
+				OnPropertyChanged("AdditionalAudioInputDevices");
+			}
+		}
 	};
 
 	public ref class AudioOptions :DynamicAudioOptions {
@@ -520,8 +876,12 @@ namespace ScreenRecorderLib {
 		Nullable<bool> _isAudioEnabled;
 		Nullable<AudioBitrate> _bitrate;
 		Nullable<AudioChannels> _channels;
-		String^ _audioInputDevice;
-		String^ _audioOutputDevice;
+		Nullable<bool> _isLimiterEnabled;
+		Nullable<int> _limiterLookaheadMillis;
+		Nullable<AudioTrackLayout> _trackLayout;
+		Nullable<int> _captureBufferMillis;
+		Nullable<AudioCaptureWakeMode> _captureWakeMode;
+		Nullable<int> _captureWakeIntervalMillis;
 
 	public:
 		AudioOptions() :DynamicAudioOptions() {
@@ -564,30 +924,78 @@ namespace ScreenRecorderLib {
 			}
 		}
 		/// <summary>
-		///Audio device to capture system audio from via loopback capture. Pass null or empty string to select system default.
+		/// Keep loud mixed audio under full scale with a lookahead limiter, instead of clipping it. Enabled by default.
 		/// </summary>
-		property String^ AudioOutputDevice {
-			String^ get() {
-				return _audioOutputDevice;
+		property Nullable<bool> IsLimiterEnabled {
+			Nullable<bool> get() {
+				return _isLimiterEnabled;
 			}
-			void set(String^ value) {
-				_audioOutputDevice = value;
-				OnPropertyChanged("AudioOutputDevice");
+			void set(Nullable<bool> value) {
+				_isLimiterEnabled = value;
+				OnPropertyChanged("IsLimiterEnabled");
 			}
 		}
 		/// <summary>
-		///Audio input device (e.g. microphone) to capture audio from. Pass null or empty string to select system default.
+		/// How far ahead the limiter looks for peaks, in milliseconds. The audio is delayed by as much. Between 0 and 20, default is 5.
 		/// </summary>
-		property String^ AudioInputDevice {
-			String^ get() {
-				return _audioInputDevice;
+		property Nullable<int> LimiterLookaheadMillis {
+			Nullable<int> get() {
+				return _limiterLookaheadMillis;
 			}
-			void set(String^ value) {
-				_audioInputDevice = value;
-				OnPropertyChanged("AudioInputDevice");
+			void set(Nullable<int> value) {
+				_limiterLookaheadMillis = value;
+				OnPropertyChanged("LimiterLookaheadMillis");
+			}
+		}
+		/// <summary>
+		/// How the audio devices are laid out in audio tracks, e.g. to record system audio and the microphone to separate tracks that can be balanced afterwards.
+		/// The tracks are created for the devices enabled when the recording starts. A device disabled while recording is written as silence. Default is Mixed.
+		/// </summary>
+		property Nullable<AudioTrackLayout> TrackLayout {
+			Nullable<AudioTrackLayout> get() {
+				return _trackLayout;
+			}
+			void set(Nullable<AudioTrackLayout> value) {
+				_trackLayout = value;
+				OnPropertyChanged("TrackLayout");
+			}
+		}
+		/// <summary>
+		/// The size of the audio device capture buffer, in milliseconds. Audio is lost if it is not collected in this time. Default is 200.
+		/// </summary>
+		property Nullable<int> CaptureBufferMillis {
+			Nullable<int> get() {
+				return _captureBufferMillis;
+			}
+			void set(Nullable<int> value) {
+				_captureBufferMillis = value;
+				OnPropertyChanged("CaptureBufferMillis");
+			}
+		}
+		/// <summary>
+		/// How captured audio is collected from the devices. Event gives input devices the lowest latency. Default is Event.
+		/// </summary>
+		property Nullable<AudioCaptureWakeMode> CaptureWakeMode {
+			Nullable<AudioCaptureWakeMode> get() {
+				return _captureWakeMode;
+			}
+			void set(Nullable<AudioCaptureWakeMode> value) {
+				_captureWakeMode = value;
+				OnPropertyChanged("CaptureWakeMode");
+			}
+		}
+		/// <summary>
+		/// The time between wakeups of devices captured on the timer, in milliseconds. Raise it to save power, at the cost of latency. 0 is half the device period, typically 5 ms, and the default.
+		/// </summary>
+		property Nullable<int> CaptureWakeIntervalMillis {
+			Nullable<int> get() {
+				return _captureWakeIntervalMillis;
+			}
+			void set(Nullable<int> value) {
+				_captureWakeIntervalMillis = value;
+				OnPropertyChanged("CaptureWakeIntervalMillis");
 			}
 		}
-
 
 	};
 
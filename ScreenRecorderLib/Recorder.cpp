@@ -3,6 +3,9 @@
 #include <msclr\marshal.h>
 #include <msclr\marshal_cppstd.h>
 #include "ManagedIStream.h"
+#include "../ScreenRecorderLibNative/Mp4Recovery.h"
+#include <Shlwapi.h>
+#pragma comment(lib, "Shlwapi.lib")
 using namespace ScreenRecorderLib;
 using namespace nlohmann;
 
@@ -57,6 +60,24 @@ void Recorder::SetOptions(RecorderOptions^ options) {
 			encoderOptions->SetFastStartEnabled(options->VideoEncoderOptions->IsMp4FastStartEnabled);
 			encoderOptions->SetHardwareEncodingEnabled(options->VideoEncoderOptions->IsHardwareEncodingEnabled);
 			encoderOptions->SetFragmentedMp4Enabled(options->VideoEncoderOptions->IsFragmentedMp4Enabled);
+			encoderOptions->SetColorConversionMode(static_cast<VideoColorConversionModeInternal>(options->VideoEncoderOptions->ColorConversionMode));
+			encoderOptions->SetColorMatrix(static_cast<VideoColorMatrixInternal>(options->VideoEncoderOptions->ColorMatrix));
+			encoderOptions->SetFullRangeColorEnabled(options->VideoEncoderOptions->IsFullRangeColorEnabled);
+			encoderOptions->SetFrameQueueLength((std::max)(0, options->VideoEncoderOptions->FrameQueueLength));
+			encoderOptions->SetFrameQueueFullPolicy(static_cast<FrameQueueFullPolicyInternal>(options->VideoEncoderOptions->FrameQueueFullPolicy));
+			encoderOptions->SetUnchangedFrameSkippingEnabled(options->VideoEncoderOptions->IsUnchangedFrameSkippingEnabled);
+			encoderOptions->SetMaxUnchangedFrameDurationMillis((std::max)(0, options->VideoEncoderOptions->MaxUnchangedFrameDurationMillis));
+			encoderOptions->SetMp4Muxer(static_cast<Mp4MuxerInternal>(options->VideoEncoderOptions->Mp4Muxer));
+			encoderOptions->SetFragmentDurationMillis((std::max)(0, options->VideoEncoderOptions->FragmentDurationMillis));
+			encoderOptions->SetMuxerWriteBufferSize((std::max)(0, options->VideoEncoderOptions->MuxerWriteBufferSize));
+			encoderOptions->SetChunkDurationMillis((std::max)(0, options->VideoEncoderOptions->ChunkDurationMillis));
+			encoderOptions->SetSegmentDurationMillis((std::max)(0, options->VideoEncoderOptions->SegmentDurationMillis));
+			encoderOptions->SetSegmentSize((std::max)((Int64)0, options->VideoEncoderOptions->SegmentSizeBytes));
+			encoderOptions->SetCrashSafeEnabled(options->VideoEncoderOptions->IsCrashSafeEnabled);
+			encoderOptions->SetCrashSafeSyncIntervalMillis((std::max)(0, options->VideoEncoderOptions->CrashSafeSyncIntervalMillis));
+			encoderOptions->SetInstantReplayEnabled(options->VideoEncoderOptions->IsInstantReplayEnabled);
+			encoderOptions->SetInstantReplayDurationMillis((std::max)(0, options->VideoEncoderOptions->InstantReplayDurationMillis));
+			encoderOptions->SetInstantReplayMaxMemory((std::max)((Int64)0, options->VideoEncoderOptions->InstantReplayMaxMemoryBytes));
 			m_Rec->SetEncoderOptions(encoderOptions);
 		}
 		if (options->SnapshotOptions) {
@@ -121,12 +142,37 @@ void Recorder::SetOptions(RecorderOptions^ options) {
 			if (options->AudioOptions->Channels.HasValue) {
 				audioOptions->SetAudioChannels((UINT32)options->AudioOptions->Channels.Value);
 			}
+			if (options->AudioOptions->IsLimiterEnabled.HasValue) {
+				audioOptions->SetLimiterEnabled(options->AudioOptions->IsLimiterEnabled.Value);
+			}
+			if (options->AudioOptions->LimiterLookaheadMillis.HasValue) {
+				audioOptions->SetLimiterLookaheadMillis((UINT32)Math::Max(0, options->AudioOptions->LimiterLookaheadMillis.Value));
+			}
+			if (options->AudioOptions->TrackLayout.HasValue) {
+				audioOptions->SetAudioTrackLayout(static_cast<AudioTrackLayoutInternal>(options->AudioOptions->TrackLayout.Value));
+			}
+			if (options->AudioOptions->CaptureBufferMillis.HasValue) {
+				audioOptions->SetCaptureBufferMillis((UINT32)Math::Max(0, options->AudioOptions->CaptureBufferMillis.Value));
+			}
+			if (options->AudioOptions->CaptureWakeMode.HasValue) {
+				audioOptions->SetCaptureWakeMode(static_cast<AudioCaptureWakeModeInternal>(options->AudioOptions->CaptureWakeMode.Value));
+			}
+			if (options->AudioOptions->CaptureWakeIntervalMillis.HasValue) {
+				audioOptions->SetCaptureWakeIntervalMillis((UINT32)Math::Max(0, options->AudioOptions->CaptureWakeIntervalMillis.Value));
+			}
 			if (options->AudioOptions->AudioOutputDevice != nullptr) {
 				audioOptions->SetOutputDevice(msclr::interop::marshal_as<std::wstring>(options->AudioOptions->AudioOutputDevice));
 			}
 			if (options->AudioOptions->AudioInputDevice != nullptr) {
 				audioOptions->SetInputDevice(msclr::interop::marshal_as<std::wstring>(options->AudioOptions->AudioInputDevice));
 			}
+			if (options->AudioOptions->AdditionalAudioInputDevices != nullptr) {
+				std::vector<std::wstring> devices;
+				for each (String ^ device in options->AudioOptions->AdditionalAudioInputDevices) {
+					devices.push_back(device == nullptr ? L"" : msclr::interop::marshal_as<std::wstring>(device));
+				}
+				audioOptions->SetAdditionalInputDevices(devices);
+			}
 			if (options->AudioOptions->InputVolume.HasValue) {
 				audioOptions->SetInputVolume(options->AudioOptions->InputVolume.Value);
 			}
@@ -193,6 +239,19 @@ void Recorder::SetDynamicOptions(DynamicOptions^ options)
 		if (options->AudioOptions->OutputVolume.HasValue) {
 			m_Rec->GetAudioOptions()->SetOutputVolume(options->AudioOptions->OutputVolume.Value);
 		}
+		if (options->AudioOptions->AudioOutputDevice != nullptr) {
+			m_Rec->GetAudioOptions()->SetOutputDevice(msclr::interop::marshal_as<std::wstring>(options->AudioOptions->AudioOutputDevice));
+		}
+		if (options->AudioOptions->AudioInputDevice != nullptr) {
+			m_Rec->GetAudioOptions()->SetInputDevice(msclr::interop::marshal_as<std::wstring>(options->AudioOptions->AudioInputDevice));
+		}
+		if (options->AudioOptions->AdditionalAudioInputDevices != nullptr) {
+			std::vector<std::wstring> devices;
+			for each (String ^ device in options->AudioOptions->AdditionalAudioInputDevices) {
+				devices.push_back(device == nullptr ? L"" : msclr::interop::marshal_as<std::wstring>(device));
+			}
+			m_Rec->GetAudioOptions()->SetAdditionalInputDevices(devices);
+		}
 	}
 	if (options->MouseOptions) {
 		if (options->MouseOptions->IsMouseClicksDetected.HasValue) {
@@ -530,6 +589,43 @@ OutputDimensions^ Recorder::GetOutputDimensionsForRecordingSources(IEnumerable<R
 	return outputDimensions;
 }
 
+RecoveryResult^ Recorder::RecoverRecording(String^ filePath, String^ recoveredFilePath)
+{
+	RecoveryResult^ result = gcnew RecoveryResult();
+	std::wstring inputPath = msclr::interop::marshal_as<std::wstring>(filePath);
+	std::wstring outputPath = msclr::interop::marshal_as<std::wstring>(recoveredFilePath);
+	std::wstring journalPath = inputPath + L".journal";
+	CComPtr<IStream> pInput = nullptr;
+	CComPtr<IStream> pJournal = nullptr;
+	CComPtr<IStream> pOutput = nullptr;
+	MP4_RECOVERY_RESULT recovery{};
+	//The recording is read while it may still be open, e.g. by a process that hangs.
+	HRESULT hr = _wcsicmp(inputPath.c_str(), outputPath.c_str()) == 0 ? E_INVALIDARG : S_OK;
+	if (SUCCEEDED(hr)) {
+		hr = SHCreateStreamOnFileEx(inputPath.c_str(), STGM_READ | STGM_SHARE_DENY_NONE, FILE_ATTRIBUTE_NORMAL, FALSE, nullptr, &pInput);
+	}
+	if (SUCCEEDED(hr) && PathFileExistsW(journalPath.c_str())
+		&& FAILED(SHCreateStreamOnFileEx(journalPath.c_str(), STGM_READ | STGM_SHARE_DENY_NONE, FILE_ATTRIBUTE_NORMAL, FALSE, nullptr, &pJournal))) {
+		pJournal = nullptr;
+	}
+	if (SUCCEEDED(hr)) {
+		hr = SHCreateStreamOnFileEx(outputPath.c_str(), STGM_WRITE | STGM_SHARE_DENY_WRITE | STGM_CREATE, FILE_ATTRIBUTE_NORMAL, TRUE, nullptr, &pOutput);
+	}
+	if (SUCCEEDED(hr)) {
+		hr = RecoverFragmentedMp4(pInput, pJournal, pOutput, &recovery);
+	}
+	result->IsSuccessful = SUCCEEDED(hr);
+	if (FAILED(hr)) {
+		result->Error = Marshal::GetExceptionForHR(hr)->Message;
+	}
+	result->IsJournalUsed = recovery.IsJournalUsed;
+	result->IsComplete = recovery.IsComplete;
+	result->Size = recovery.RecoveredBytes;
+	result->Chunks = (int)recovery.Chunks;
+	result->Duration = TimeSpan::FromTicks(recovery.Duration);
+	return result;
+}
+
 List<VideoCaptureFormat^>^ ScreenRecorderLib::Recorder::GetSupportedVideoCaptureFormatsForDevice(String^ DevicePath)
 {
 	MeasureExecutionTime measure(L"GetSupportedVideoCaptureFormatsForDevice");
@@ -603,6 +699,34 @@ void Recorder::Stop() {
 	m_Rec->EndRecording();
 }
 
+ReplaySaveResult^ Recorder::SaveReplay(String^ filePath) {
+	std::wstring stdPathString = msclr::interop::marshal_as<std::wstring>(filePath);
+	REPLAY_SAVE_RESULT save{};
+	HRESULT hr = m_Rec->SaveReplay(stdPathString, nullptr, &save);
+	return CreateReplaySaveResult(hr, save);
+}
+
+ReplaySaveResult^ Recorder::SaveReplay(System::IO::Stream^ stream) {
+	CComPtr<IStream> pStream;
+	pStream.Attach(new ManagedIStream(stream));
+	REPLAY_SAVE_RESULT save{};
+	HRESULT hr = m_Rec->SaveReplay(L"", pStream, &save);
+	return CreateReplaySaveResult(hr, save);
+}
+
+ReplaySaveResult^ Recorder::CreateReplaySaveResult(HRESULT hr, const REPLAY_SAVE_RESULT &save) {
+	ReplaySaveResult^ result = gcnew ReplaySaveResult();
+	result->IsSuccessful = SUCCEEDED(hr);
+	if (FAILED(hr)) {
+		result->Error = Marshal::GetExceptionForHR(hr)->Message;
+	}
+	result->IsTruncated = save.IsTruncated;
+	result->Size = save.Bytes;
+	result->Duration = TimeSpan::FromTicks(save.Duration);
+	result->StartTime = TimeSpan::FromTicks(save.StartPos);
+	return result;
+}
+
 void Recorder::SetupCallbacks() {
 	CreateErrorCallback();
 	CreateCompletionCallback();
@@ -611,6 +735,8 @@ void Recorder::SetupCallbacks() {
 	CreateFrameNumberCallback();
 	CreateAudioVolumeCallback();
 	CreateRawFrameUpdateCallback();
+	CreateChunkWrittenCallback();
+	CreateSegmentWrittenCallback();
 }
 
 void Recorder::ClearCallbacks() {
@@ -628,6 +754,10 @@ void Recorder::ClearCallbacks() {
 		_audioVolumeDelegateGcHandler.Free();
 	if (_rawFrameUpdateDelegateGcHandler.IsAllocated)
 		_rawFrameUpdateDelegateGcHandler.Free();
+	if (_chunkWrittenDelegateGcHandler.IsAllocated)
+		_chunkWrittenDelegateGcHandler.Free();
+	if (_segmentWrittenDelegateGcHandler.IsAllocated)
+		_segmentWrittenDelegateGcHandler.Free();
 }
 
 HRESULT Recorder::CreateNativeRecordingSource(_In_ RecordingSourceBase^ managedSource, _Out_ RECORDING_SOURCE* pNativeSource)
@@ -956,6 +1086,20 @@ void Recorder::CreateFrameNumberCallback() {
 	CallbackFrameNumberChangedFunction cb = static_cast<CallbackFrameNumberChangedFunction>(ip.ToPointer());
 	m_Rec->RecordingFrameNumberChangedCallback = cb;
 }
+void Recorder::CreateChunkWrittenCallback() {
+	InternalChunkWrittenCallbackDelegate^ fp = gcnew InternalChunkWrittenCallbackDelegate(this, &Recorder::ChunkWritten);
+	_chunkWrittenDelegateGcHandler = GCHandle::Alloc(fp);
+	IntPtr ip = Marshal::GetFunctionPointerForDelegate(fp);
+	CallbackChunkWrittenFunction cb = static_cast<CallbackChunkWrittenFunction>(ip.ToPointer());
+	m_Rec->RecordingChunkWrittenCallback = cb;
+}
+void Recorder::CreateSegmentWrittenCallback() {
+	InternalSegmentWrittenCallbackDelegate^ fp = gcnew InternalSegmentWrittenCallbackDelegate(this, &Recorder::SegmentWritten);
+	_segmentWrittenDelegateGcHandler = GCHandle::Alloc(fp);
+	IntPtr ip = Marshal::GetFunctionPointerForDelegate(fp);
+	CallbackSegmentWrittenFunction cb = static_cast<CallbackSegmentWrittenFunction>(ip.ToPointer());
+	m_Rec->RecordingSegmentWrittenCallback = cb;
+}
 void Recorder::EventComplete(std::wstring path, fifo_map<std::wstring, int> delays)
 {
 	ClearCallbacks();
@@ -993,9 +1137,9 @@ void ScreenRecorderLib::Recorder::EventSnapshotCreated(std::wstring str)
 	OnSnapshotSaved(this, gcnew SnapshotSavedEventArgs(gcnew String(str.c_str())));
 }
 
-void Recorder::FrameNumberChanged(int newFrameNumber, INT64 timestamp)
+void Recorder::FrameNumberChanged(int newFrameNumber, INT64 timestamp, int queuedFrames, int droppedFrames)
 {
-	OnFrameRecorded(this, gcnew FrameRecordedEventArgs(newFrameNumber, timestamp));
+	OnFrameRecorded(this, gcnew FrameRecordedEventArgs(newFrameNumber, timestamp, queuedFrames, droppedFrames));
 	CurrentFrameNumber = newFrameNumber;
 }
 
@@ -1009,6 +1153,16 @@ void Recorder::RawFrameUpdateChanged(BYTE data[], long width, long height)
 	OnRawFrameUpdate(this, gcnew RawFrameUpdateEventArgs(data, width, height));
 }
 
+void Recorder::ChunkWritten(UINT32 segmentNumber, UINT32 sequenceNumber, UINT64 offset, UINT64 bytes, INT64 startPos, INT64 duration, bool isFragmentStart)
+{
+	OnChunkWritten(this, gcnew ChunkWrittenEventArgs((int)segmentNumber, (int)sequenceNumber, (INT64)offset, (INT64)bytes, TimeSpan::FromTicks(startPos), TimeSpan::FromTicks(duration), isFragmentStart));
+}
+
+void Recorder::SegmentWritten(UINT32 segmentNumber, std::wstring path, INT64 startPos, INT64 duration, UINT64 bytes, INT64 switchDuration, UINT64 droppedSamples)
+{
+	OnSegmentWritten(this, gcnew SegmentWrittenEventArgs((int)segmentNumber, gcnew String(path.c_str()), TimeSpan::FromTicks(startPos), TimeSpan::FromTicks(duration), (INT64)bytes, TimeSpan::FromTicks(switchDuration), (int)droppedSamples));
+}
+
 bool Recorder::CheckMultiMonitorMultiGraphicsCompatability()
 {
 	IDXGIFactory* pdxFactory;
@@ -21,9 +21,11 @@ delegate void InternalStatusCallbackDelegate(int status);
 delegate void InternalCompletionCallbackDelegate(std::wstring path, nlohmann::fifo_map<std::wstring, int>);
 delegate void InternalErrorCallbackDelegate(std::wstring error, std::wstring path);
 delegate void InternalSnapshotCallbackDelegate(std::wstring path);
-delegate void InternalFrameNumberCallbackDelegate(int newFrameNumber, INT64 timestamp);
+delegate void InternalFrameNumberCallbackDelegate(int newFrameNumber, INT64 timestamp, int queuedFrames, int droppedFrames);
 delegate void InternalAudioVolumeCallbackDelegate(int volume);
 delegate void RawFrameUpdateCallbackDelegate(BYTE data[], long width, long height);
+delegate void InternalChunkWrittenCallbackDelegate(UINT32 segmentNumber, UINT32 sequenceNumber, UINT64 offset, UINT64 bytes, INT64 startPos, INT64 duration, bool isFragmentStart);
+delegate void InternalSegmentWrittenCallbackDelegate(UINT32 segmentNumber, std::wstring path, INT64 startPos, INT64 duration, UINT64 bytes, INT64 switchDuration, UINT64 droppedSamples);
 
 namespace ScreenRecorderLib {
 
@@ -46,6 +48,57 @@ namespace ScreenRecorderLib {
 		property List<SourceCoordinates^>^ OutputCoordinates;
 	};
 
+	/// <summary>
+	/// The outcome of Recorder.RecoverRecording.
+	/// </summary>
+	public ref class RecoveryResult {
+	public:
+		property bool IsSuccessful;
+		/// <summary>
+		/// Why the recording could not be recovered, if it was not.
+		/// </summary>
+		property String^ Error;
+		/// <summary>
+		/// Whether the journal of the recording was found and used, so every part of the recovered file was checked against what was written.
+		/// </summary>
+		property bool IsJournalUsed;
+		/// <summary>
+		/// Whether the recording was finished, so the recovered file is a copy of it and nothing was lost.
+		/// </summary>
+		property bool IsComplete;
+		/// <summary>
+		/// The size of the recovered file in bytes, how many chunks, or fragments, it holds, and how long it lasts.
+		/// </summary>
+		property INT64 Size;
+		property int Chunks;
+		property TimeSpan Duration;
+	};
+
+	/// <summary>
+	/// The outcome of Recorder.SaveReplay.
+	/// </summary>
+	public ref class ReplaySaveResult {
+	public:
+		property bool IsSuccessful;
+		/// <summary>
+		/// Why the replay could not be saved, if it was not.
+		/// </summary>
+		property String^ Error;
+		/// <summary>
+		/// Whether the save ended early, because the recording needed the memory of what it had still to copy. The file holds what was saved up to there.
+		/// </summary>
+		property bool IsTruncated;
+		/// <summary>
+		/// The size of the saved file in bytes, and how long it lasts.
+		/// </summary>
+		property INT64 Size;
+		property TimeSpan Duration;
+		/// <summary>
+		/// Where the replay starts in the recording.
+		/// </summary>
+		property TimeSpan StartTime;
+	};
+
 	public enum class AudioDeviceSource
 	{
 		OutputDevices,
@@ -65,13 +118,17 @@ namespace ScreenRecorderLib {
 		void CreateFrameNumberCallback();
 		void CreateAudioVolumeCallback();
 		void CreateRawFrameUpdateCallback();
+		void CreateChunkWrittenCallback();
+		void CreateSegmentWrittenCallback();
 		void EventComplete(std::wstring path, nlohmann::fifo_map<std::wstring, int> delays);
 		void EventFailed(std::wstring error, std::wstring path);
 		void EventStatusChanged(int status);
 		void EventSnapshotCreated(std::wstring str);
-		void FrameNumberChanged(int newFrameNumber, INT64 timestamp);
+		void FrameNumberChanged(int newFrameNumber, INT64 timestamp, int queuedFrames, int droppedFrames);
 		void AudioVolumeChanged(int volume);
 		void RawFrameUpdateChanged(BYTE data[], long width, long height);
+		void ChunkWritten(UINT32 segmentNumber, UINT32 sequenceNumber, UINT64 offset, UINT64 bytes, INT64 startPos, INT64 duration, bool isFragmentStart);
+		void SegmentWritten(UINT32 segmentNumber, std::wstring path, INT64 startPos, INT64 duration, UINT64 bytes, INT64 switchDuration, UINT64 droppedSamples);
 		void SetupCallbacks();
 		void ClearCallbacks();
 		static HRESULT CreateNativeRecordingSource(_In_ RecordingSourceBase^ managedSource, _Out_ RECORDING_SOURCE* pNativeSource);
@@ -80,6 +137,7 @@ namespace ScreenRecorderLib {
 		static std::vector<RECORDING_SOURCE> CreateRecordingSourceList(_In_ IEnumerable<RecordingSourceBase^>^ options);
 		static std::vector<RECORDING_OVERLAY> CreateOverlayList(_In_ IEnumerable<RecordingOverlayBase^>^ managedOverlays);
 		static Guid FromNativeGuid(_In_ const GUID& guid);
+		static ReplaySaveResult^ CreateReplaySaveResult(_In_ HRESULT hr, _In_ const REPLAY_SAVE_RESULT &save);
 
 		int _currentFrameNumber;
 		RecorderStatus _status;
@@ -92,6 +150,8 @@ namespace ScreenRecorderLib {
 		GCHandle _frameNumberDelegateGcHandler;
 		GCHandle _audioVolumeDelegateGcHandler;
 		GCHandle _rawFrameUpdateDelegateGcHandler;
+		GCHandle _chunkWrittenDelegateGcHandler;
+		GCHandle _segmentWrittenDelegateGcHandler;
 
 	internal:
 		void SetDynamicOptions(DynamicOptions^ options);
@@ -122,6 +182,15 @@ namespace ScreenRecorderLib {
 		void Pause();
 		void Resume();
 		void Stop();
+		/// <summary>
+		/// Saves the last VideoEncoderOptions.InstantReplayDurationMillis of the recording to a new file at filePath, while the recording goes on.
+		/// The replay of a recording can still be saved once it has ended, until the next one starts. Requires VideoEncoderOptions.IsInstantReplayEnabled and the Native muxer.
+		/// </summary>
+		ReplaySaveResult^ SaveReplay(String^ filePath);
+		/// <summary>
+		/// Saves the last VideoEncoderOptions.InstantReplayDurationMillis of the recording to stream, while the recording goes on. The stream is written from its current position.
+		/// </summary>
+		ReplaySaveResult^ SaveReplay(System::IO::Stream^ stream);
 		void SetOptions(RecorderOptions^ options);
 		void SetHwnd(IntPtr handle);
 		/// <summary>
@@ -140,6 +209,11 @@ namespace ScreenRecorderLib {
 		static List<RecordableDisplay^>^ GetDisplays();
 		static OutputDimensions^ GetOutputDimensionsForRecordingSources(IEnumerable<RecordingSourceBase^>^ recordingSources);
 		static List<VideoCaptureFormat^>^ GetSupportedVideoCaptureFormatsForDevice(String^ DevicePath);
+		/// <summary>
+		/// Rebuilds a playable file at recoveredFilePath from a recording by the Native muxer that was cut off, e.g. by a crash, with everything that reached the disk.
+		/// The journal of a recording with VideoEncoderOptions.IsCrashSafeEnabled, filePath + ".journal", is used if it is there. A finished recording is copied as it is.
+		/// </summary>
+		static RecoveryResult^ RecoverRecording(String^ filePath, String^ recoveredFilePath);
 		event EventHandler<RecordingCompleteEventArgs^>^ OnRecordingComplete;
 		event EventHandler<RecordingFailedEventArgs^>^ OnRecordingFailed;
 		event EventHandler<RecordingStatusEventArgs^>^ OnStatusChanged;
@@ -147,6 +221,17 @@ namespace ScreenRecorderLib {
 		event EventHandler<FrameRecordedEventArgs^>^ OnFrameRecorded;
 		event EventHandler<AudioRecordingVolumeEventArgs^>^ OnAudioVolumeChanged;
 		event EventHandler<RawFrameUpdateEventArgs^>^ OnRawFrameUpdate;
+		/// <summary>
+		/// Raised for every chunk the Native muxer writes to the output, when VideoEncoderOptions.ChunkDurationMillis is set, or for every fragment if not.
+		/// Raised on the encoder thread, which waits for the handlers to return.
+		/// </summary>
+		event EventHandler<ChunkWrittenEventArgs^>^ OnChunkWritten;
+		/// <summary>
+		/// Raised for every segment file the Native muxer completes, when VideoEncoderOptions.SegmentDurationMillis or SegmentSizeBytes is set.
+		/// The file is closed when the event is raised, except for the last one, which is closed when the recording completes.
+		/// Raised on the encoder thread, which waits for the handlers to return.
+		/// </summary>
+		event EventHandler<SegmentWrittenEventArgs^>^ OnSegmentWritten;
 	};
 
 	public ref class DynamicOptionsBuilder {
@@ -0,0 +1,93 @@
+#include "AudioLimiterBenchmark.h"
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "../ScreenRecorderLibNative/AudioSampleConverter.h"
+
+namespace {
+	const double Pi = 3.14159265358979323846;
+
+	std::vector<float> GenerateSignal(_In_ const AUDIO_LIMITER_BENCHMARK_OPTIONS &options, _In_ size_t frames)
+	{
+		std::vector<float> samples(frames * options.Channels);
+		const double quietAmplitude = 0.25;
+		const double loudAmplitude = 2.0;
+		for (size_t frame = 0; frame < frames; frame++) {
+			double seconds = (double)frame / options.SampleRate;
+			double amplitude = quietAmplitude;
+			if (options.Signal == AudioLimiterBenchmarkSignal::Loud) {
+				amplitude = loudAmplitude;
+			}
+			else if (options.Signal == AudioLimiterBenchmarkSignal::Bursts && fmod(seconds, 2.0) >= 1.5) {
+				amplitude = loudAmplitude;
+			}
+			for (UINT32 channel = 0; channel < options.Channels; channel++) {
+				double frequency = 440.0 * (channel + 1);
+				samples[frame * options.Channels + channel] = (float)(amplitude * sin(2 * Pi * frequency * seconds));
+			}
+		}
+		return samples;
+	}
+
+	const char *GetSignalName(_In_ AudioLimiterBenchmarkSignal signal)
+	{
+		switch (signal)
+		{
+		case AudioLimiterBenchmarkSignal::Loud:
+			return "loud";
+		case AudioLimiterBenchmarkSignal::Bursts:
+			return "bursts";
+		default:
+			return "quiet";
+		}
+	}
+}
+
+HRESULT RunAudioLimiterBenchmark(_In_ const AUDIO_LIMITER_BENCHMARK_OPTIONS &options, _Out_ AUDIO_LIMITER_BENCHMARK_RESULT *pResult)
+{
+	*pResult = AUDIO_LIMITER_BENCHMARK_RESULT{};
+	if (options.Seconds <= 0 || options.SampleRate == 0 || options.Channels == 0 || options.BlockFrames == 0) {
+		return E_INVALIDARG;
+	}
+	size_t blockSamples = (size_t)options.BlockFrames * options.Channels;
+	size_t blocks = (size_t)(options.Seconds * options.SampleRate / options.BlockFrames);
+	if (blocks == 0) {
+		return E_INVALIDARG;
+	}
+	std::vector<float> input = GenerateSignal(options, blocks * options.BlockFrames);
+	std::vector<float> limited(blockSamples);
+	std::vector<int16_t> output(blockSamples);
+
+	AudioSampleConverter converter;
+	converter.Initialize(true, options.Simd);
+	auto start = std::chrono::steady_clock::now();
+	for (size_t block = 0; block < blocks; block++) {
+		pResult->ClippedSamples += converter.ConvertToInt16(&input[block * blockSamples], output.data(), blockSamples);
+	}
+	pResult->ConvertNanosPerSample = ElapsedNanos(start) / (double)(blocks * blockSamples);
+
+	AudioLimiter limiter;
+	HRESULT hr = limiter.Initialize(options.SampleRate, options.Channels, AUDIO_LIMITER_OPTIONS{}, options.Simd);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	start = std::chrono::steady_clock::now();
+	for (size_t block = 0; block < blocks; block++) {
+		limiter.Process(&input[block * blockSamples], limited.data(), blockSamples);
+		pResult->ClippedSamplesAfterLimiter += converter.ConvertToInt16(limited.data(), output.data(), blockSamples);
+	}
+	pResult->LimitAndConvertNanosPerSample = ElapsedNanos(start) / (double)(blocks * blockSamples);
+	pResult->Stats = limiter.GetStats();
+	return S_OK;
+}
+
+void PrintAudioLimiterBenchmarkResult(_In_ const AUDIO_LIMITER_BENCHMARK_OPTIONS &options, _In_ const AUDIO_LIMITER_BENCHMARK_RESULT &result)
+{
+	printf("Audio limiter, %s signal, %u Hz, %u channels, %u frame blocks, %.0f seconds\n",
+		GetSignalName(options.Signal), options.SampleRate, options.Channels, options.BlockFrames, options.Seconds);
+	printf("  Convert only                  %8.3f ns/sample, %llu clipped samples\n", result.ConvertNanosPerSample, (unsigned long long)result.ClippedSamples);
+	printf("  Limit and convert             %8.3f ns/sample, %llu clipped samples\n", result.LimitAndConvertNanosPerSample, (unsigned long long)result.ClippedSamplesAfterLimiter);
+	printf("  Limiter                       %llu of %llu frames limited, %.2f dB max gain reduction, %.2f max input peak\n",
+		(unsigned long long)result.Stats.LimitedFrames, (unsigned long long)result.Stats.Frames, result.Stats.MaxGainReductionDb, result.Stats.MaxInputPeak);
+}
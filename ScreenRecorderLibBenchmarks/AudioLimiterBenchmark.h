@@ -0,0 +1,42 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include "Benchmark.h"
+#include "../ScreenRecorderLibNative/AudioLimiter.h"
+
+enum class AudioLimiterBenchmarkSignal {
+	//A -12 dBFS tone that never reaches the ceiling, so the limiter stays on its pass through path.
+	Quiet,
+	//A tone 6 dB over full scale, so every frame is limited.
+	Loud,
+	//The quiet tone with a half second burst over full scale every two seconds.
+	Bursts
+};
+
+struct AUDIO_LIMITER_BENCHMARK_OPTIONS {
+	AudioLimiterBenchmarkSignal Signal = AudioLimiterBenchmarkSignal::Quiet;
+	double Seconds = 60;
+	UINT32 SampleRate = 48000;
+	UINT32 Channels = 2;
+	//Frames per block, one video frame at 30 fps.
+	UINT32 BlockFrames = 1600;
+	SimdLevel Simd = SimdLevel::Auto;
+};
+
+struct AUDIO_LIMITER_BENCHMARK_RESULT {
+	//Nanoseconds per sample for converting the mix to 16 bit, hard clipping anything over full scale. This was the only step before the limiter.
+	double ConvertNanosPerSample;
+	//Nanoseconds per sample for limiting the mix and then converting it.
+	double LimitAndConvertNanosPerSample;
+	//Samples clipped by the converter without the limiter.
+	UINT64 ClippedSamples;
+	//Samples clipped by the converter after the limiter. Should be zero.
+	UINT64 ClippedSamplesAfterLimiter;
+	AUDIO_LIMITER_STATS Stats;
+};
+
+/// <summary>
+/// Measures the per sample cost of the lookahead limiter against converting the mix directly, on a generated signal.
+/// </summary>
+HRESULT RunAudioLimiterBenchmark(_In_ const AUDIO_LIMITER_BENCHMARK_OPTIONS &options, _Out_ AUDIO_LIMITER_BENCHMARK_RESULT *pResult);
+void PrintAudioLimiterBenchmarkResult(_In_ const AUDIO_LIMITER_BENCHMARK_OPTIONS &options, _In_ const AUDIO_LIMITER_BENCHMARK_RESULT &result);
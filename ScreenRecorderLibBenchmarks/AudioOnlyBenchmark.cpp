@@ -0,0 +1,311 @@
+#include "AudioOnlyBenchmark.h"
+#include "MemoryStream.h"
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "../ScreenRecorderLibNative/AudioCaptureStream.h"
+#include "../ScreenRecorderLibNative/AudioGraph.h"
+#include "../ScreenRecorderLibNative/AudioLimiter.h"
+#include "../ScreenRecorderLibNative/AudioPacketizer.h"
+#include "../ScreenRecorderLibNative/AudioSampleConverter.h"
+#include "../ScreenRecorderLibNative/SimulatedAudioSource.h"
+#include "../ScreenRecorderLibNative/WavWriter.h"
+
+namespace {
+	const UINT64 HundredNanosPerSecond = 10000000;
+	//Shared mode device period. The capture thread wakes up twice per period.
+	const UINT64 DevicePeriod100Nanos = 100000;
+	const UINT64 FnvOffsetBasis = 14695981039346656037ULL;
+	const UINT64 FnvPrime = 1099511628211ULL;
+
+	/// <summary>
+	/// One simulated capture device and its capture stream, feeding a node of the audio graph.
+	/// </summary>
+	struct SIMULATED_DEVICE : public IAudioGraphSource {
+		SyntheticAudioSource Source;
+		AudioCaptureStream Stream;
+		UINT32 NodeId = 0;
+
+		void ReadAudio(_In_ UINT64 duration100Nanos, _Inout_ std::vector<BYTE> &buffer, _Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters, _Out_ bool *pIsSilent) override
+		{
+			Stream.Read(duration100Nanos, buffer, pCounters, pIsSilent);
+		}
+	};
+
+	/// <summary>
+	/// Releases the output stream on every way out of the benchmark.
+	/// </summary>
+	struct STREAM_HOLDER {
+		MemoryStream *pStream = nullptr;
+		~STREAM_HOLDER()
+		{
+			if (pStream) {
+				pStream->Release();
+			}
+		}
+	};
+
+	UINT64 HashBytes(_In_ UINT64 hash, _In_reads_bytes_(cbData) const BYTE *pData, _In_ size_t cbData)
+	{
+		for (size_t i = 0; i < cbData; i++) {
+			hash = (hash ^ pData[i]) * FnvPrime;
+		}
+		return hash;
+	}
+
+	UINT16 ReadUInt16(_In_reads_bytes_(2) const BYTE *pData)
+	{
+		return (UINT16)(pData[0] | (pData[1] << 8));
+	}
+
+	UINT32 ReadUInt32(_In_reads_bytes_(4) const BYTE *pData)
+	{
+		return (UINT32)pData[0] | ((UINT32)pData[1] << 8) | ((UINT32)pData[2] << 16) | ((UINT32)pData[3] << 24);
+	}
+
+	HRESULT CreateDevice(_In_ const SIMULATED_CAPTURE_OPTIONS &captureOptions, _In_ SyntheticAudioSignal signal, _In_ float amplitude, _In_ const AUDIO_ONLY_BENCHMARK_OPTIONS &options, _Out_ std::unique_ptr<SIMULATED_DEVICE> &pDevice)
+	{
+		pDevice = std::make_unique<SIMULATED_DEVICE>();
+		HRESULT hr = pDevice->Source.Initialize(captureOptions, signal, amplitude);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		return pDevice->Stream.Initialize(captureOptions.SampleRate, captureOptions.Channels, options.SampleRate, options.Channels, true, true);
+	}
+}
+
+HRESULT RunAudioOnlyBenchmark(_In_ const AUDIO_ONLY_BENCHMARK_OPTIONS &options, _Out_ AUDIO_ONLY_BENCHMARK_RESULT *pResult)
+{
+	*pResult = AUDIO_ONLY_BENCHMARK_RESULT{};
+	if (options.SampleRate == 0 || options.Channels == 0 || options.Seconds <= 0) {
+		return E_INVALIDARG;
+	}
+	STREAM_HOLDER output;
+	//Everything a recording sets up before the first audio is written counts as startup.
+	auto startupStart = std::chrono::steady_clock::now();
+	UINT64 startupAllocations = GetHeapAllocationCount();
+	UINT64 startupBytes = GetHeapAllocatedBytes();
+
+	std::vector<std::unique_ptr<SIMULATED_DEVICE>> devices(2);
+	SIMULATED_CAPTURE_OPTIONS outputDeviceOptions;
+	outputDeviceOptions.SampleRate = 44100;
+	outputDeviceOptions.Channels = 2;
+	outputDeviceOptions.PacketDuration100Nanos = DevicePeriod100Nanos;
+	outputDeviceOptions.DriftPpm = 80;
+	outputDeviceOptions.Seed = 1;
+	HRESULT hr = CreateDevice(outputDeviceOptions, SyntheticAudioSignal::Sine, 0.5f, options, devices[0]);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	SIMULATED_CAPTURE_OPTIONS inputDeviceOptions;
+	inputDeviceOptions.SampleRate = 48000;
+	inputDeviceOptions.Channels = 1;
+	inputDeviceOptions.PacketDuration100Nanos = DevicePeriod100Nanos;
+	inputDeviceOptions.DriftPpm = -50;
+	inputDeviceOptions.Seed = 2;
+	hr = CreateDevice(inputDeviceOptions, SyntheticAudioSignal::Noise, 0.1f, options, devices[1]);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	AudioGraph graph;
+	hr = graph.Initialize(options.SampleRate, options.Channels, options.Simd);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	for (auto &pDevice : devices) {
+		hr = graph.AddSource(pDevice.get(), options.SampleRate, options.Channels, AUDIO_GRAPH_SOURCE_OPTIONS{}, &pDevice->NodeId);
+		if (FAILED(hr)) {
+			return hr;
+		}
+	}
+	AudioSampleConverter converter;
+	converter.Initialize(true, options.Simd);
+	AudioLimiter limiter;
+	if (options.IsLimiterEnabled) {
+		hr = limiter.Initialize(options.SampleRate, options.Channels, AUDIO_LIMITER_OPTIONS{}, options.Simd);
+		if (FAILED(hr)) {
+			return hr;
+		}
+	}
+	const UINT32 blockAlign = options.Channels * sizeof(int16_t);
+	AudioPacketizer packetizer;
+	hr = packetizer.Initialize(options.SampleRate, blockAlign);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	std::vector<BYTE> packetData(packetizer.GetPacketBytes());
+	std::vector<BYTE> limitedData;
+	std::vector<BYTE> encoderData;
+	hr = MemoryStream::CreateInstance(&output.pStream);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	WavWriter wavWriter;
+	hr = wavWriter.Initialize(output.pStream, options.SampleRate, options.Channels, 16);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	pResult->StartupNanos = ElapsedNanos(startupStart);
+	pResult->StartupHeapAllocations = GetHeapAllocationCount() - startupAllocations;
+	pResult->StartupHeapBytes = GetHeapAllocatedBytes() - startupBytes;
+
+	UINT64 writtenHash = FnvOffsetBasis;
+	auto writePacket = [&](const AUDIO_ENCODER_PACKET &packet) {
+		DWORD cbData = packet.Frames * blockAlign;
+		writtenHash = HashBytes(writtenHash, packetData.data(), cbData);
+		return wavWriter.Write(packetData.data(), cbData);
+	};
+	//The same steps as AudioManager::GrabAudioTracks for the mixed track, followed by AudioWriter::WriteTrackAudio.
+	auto writeAudio = [&](UINT64 now, UINT64 duration) -> HRESULT {
+		AUDIO_GRAPH_OUTPUT mix;
+		HRESULT passHr = graph.Process(duration, &mix);
+		if (FAILED(passHr)) {
+			return passHr;
+		}
+		size_t sampleCount = mix.SampleCount;
+		bool isSilent = mix.IsSilent;
+		if (sampleCount > 0) {
+			const float *pSamples = mix.pSamples;
+			if (options.IsLimiterEnabled) {
+				if (isSilent && limiter.IsIdle()) {
+					limiter.SkipSilence(sampleCount);
+				}
+				else {
+					ResizeAudioBuffer(limitedData, sampleCount * sizeof(float), nullptr);
+					float *pLimited = reinterpret_cast<float *>(limitedData.data());
+					limiter.Process(isSilent ? nullptr : pSamples, pLimited, sampleCount);
+					pSamples = pLimited;
+					isSilent = false;
+				}
+			}
+			size_t cbData = sampleCount / options.Channels * blockAlign;
+			if (isSilent) {
+				packetizer.WriteSilence(cbData);
+			}
+			else {
+				ResizeAudioBuffer(encoderData, sampleCount * sizeof(int16_t), nullptr);
+				converter.ConvertToInt16(pSamples, reinterpret_cast<int16_t *>(encoderData.data()), sampleCount);
+				packetizer.Write(encoderData.data(), cbData);
+			}
+		}
+		packetizer.WriteSilenceUntil((INT64)now, packetizer.GetPacketFrames());
+		AUDIO_ENCODER_PACKET packet;
+		while (packetizer.ReadPacket(packetData.data(), &packet)) {
+			passHr = writePacket(packet);
+			if (FAILED(passHr)) {
+				return passHr;
+			}
+		}
+		return S_OK;
+	};
+	auto capture = [&](UINT64 now) -> HRESULT {
+		for (auto &pDevice : devices) {
+			pDevice->Source.AdvanceClock(now - pDevice->Source.GetClock());
+			HRESULT captureHr = pDevice->Stream.ReadPackets(&pDevice->Source);
+			if (FAILED(captureHr)) {
+				return captureHr;
+			}
+		}
+		return S_OK;
+	};
+
+	const UINT64 endTime = (UINT64)(options.Seconds * HundredNanosPerSecond);
+	const UINT64 warmupTime = (UINT64)(options.WarmupSeconds * HundredNanosPerSecond);
+	const UINT64 captureInterval = DevicePeriod100Nanos / 2;
+	//The audio writer wakes up once per packet.
+	const UINT64 audioPassInterval = (UINT64)packetizer.GetPacketFrames() * HundredNanosPerSecond / options.SampleRate;
+	UINT64 nextCapture = captureInterval;
+	UINT64 nextAudioPass = audioPassInterval;
+	UINT64 lastAudioPass = 0;
+	bool isWarm = false;
+	UINT64 warmHeapAllocations = 0;
+	double processingNanos = 0;
+	while (true) {
+		UINT64 now = (std::min)(nextCapture, nextAudioPass);
+		//The recording is stopped at the end time, and the writer takes what is left, as StopWriting does.
+		bool isFinal = now >= endTime;
+		if (isFinal) {
+			now = endTime;
+		}
+		auto start = std::chrono::steady_clock::now();
+		if (now == nextCapture || isFinal) {
+			hr = capture(now);
+			if (FAILED(hr)) {
+				return hr;
+			}
+			nextCapture += captureInterval;
+		}
+		if (now == nextAudioPass || isFinal) {
+			hr = writeAudio(now, now - lastAudioPass);
+			if (FAILED(hr)) {
+				return hr;
+			}
+			lastAudioPass = now;
+			nextAudioPass += audioPassInterval;
+		}
+		if (isFinal) {
+			AUDIO_ENCODER_PACKET packet;
+			if (packetizer.ReadPartialPacket(packetData.data(), &packet)) {
+				hr = writePacket(packet);
+				if (FAILED(hr)) {
+					return hr;
+				}
+			}
+			hr = wavWriter.Finalize();
+			processingNanos += ElapsedNanos(start);
+			if (hr != S_OK) {
+				return FAILED(hr) ? hr : E_UNEXPECTED;
+			}
+			break;
+		}
+		processingNanos += ElapsedNanos(start);
+		if (!isWarm && now >= warmupTime) {
+			isWarm = true;
+			warmHeapAllocations = GetHeapAllocationCount();
+		}
+	}
+	pResult->SteadyStateHeapAllocations = isWarm ? GetHeapAllocationCount() - warmHeapAllocations : 0;
+	pResult->NanosPerAudioSecond = processingNanos / options.Seconds;
+	pResult->CpuPercent = pResult->NanosPerAudioSecond / 1e9 * 100;
+	pResult->WrittenFrames = wavWriter.GetWrittenFrames();
+	pResult->LengthErrorMillis = ((double)pResult->WrittenFrames / options.SampleRate - options.Seconds) * 1000;
+
+	//Read the file back, the way a player would.
+	LARGE_INTEGER start{};
+	hr = output.pStream->Seek(start, STREAM_SEEK_SET, nullptr);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	std::vector<BYTE> file;
+	BYTE chunk[65536];
+	ULONG read = 0;
+	do {
+		hr = output.pStream->Read(chunk, sizeof(chunk), &read);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		file.insert(file.end(), chunk, chunk + read);
+	} while (read > 0);
+	const BYTE *pHeader = file.data();
+	UINT64 dataBytes = (UINT64)pResult->WrittenFrames * blockAlign;
+	pResult->IsHeaderValid = file.size() >= WavWriter::HeaderBytes
+		&& memcmp(pHeader, "RIFF", 4) == 0 && ReadUInt32(pHeader + 4) == file.size() - 8 && memcmp(pHeader + 8, "WAVE", 4) == 0
+		&& memcmp(pHeader + 12, "fmt ", 4) == 0 && ReadUInt32(pHeader + 16) == 16 && ReadUInt16(pHeader + 20) == 1
+		&& ReadUInt16(pHeader + 22) == options.Channels && ReadUInt32(pHeader + 24) == options.SampleRate
+		&& ReadUInt32(pHeader + 28) == options.SampleRate * blockAlign && ReadUInt16(pHeader + 32) == blockAlign && ReadUInt16(pHeader + 34) == 16
+		&& memcmp(pHeader + 36, "data", 4) == 0 && ReadUInt32(pHeader + 40) == dataBytes && file.size() == WavWriter::HeaderBytes + dataBytes;
+	pResult->IsDataIntact = pResult->IsHeaderValid && HashBytes(FnvOffsetBasis, pHeader + WavWriter::HeaderBytes, (size_t)dataBytes) == writtenHash;
+	return S_OK;
+}
+
+void PrintAudioOnlyBenchmarkResult(_In_ const AUDIO_ONLY_BENCHMARK_OPTIONS &options, _In_ const AUDIO_ONLY_BENCHMARK_RESULT &result)
+{
+	printf("Audio only recording to WAV: %.0f s, %u Hz %u ch, output and input device%s\n", options.Seconds, options.SampleRate, options.Channels, options.IsLimiterEnabled ? "" : ", no limiter");
+	printf("  startup          %.1f us, %llu allocations, %.1f KB\n",
+		result.StartupNanos / 1000, (unsigned long long)result.StartupHeapAllocations, (double)result.StartupHeapBytes / 1024);
+	printf("  processing       %.3f ms per second of audio, %.3f%% of one core in real time\n", result.NanosPerAudioSecond / 1000000, result.CpuPercent);
+	printf("  allocations      %llu after warm up\n", (unsigned long long)result.SteadyStateHeapAllocations);
+	printf("  file             %llu frames, %.3f ms from the recording length, header %s, data %s\n", (unsigned long long)result.WrittenFrames, result.LengthErrorMillis,
+		result.IsHeaderValid ? "valid" : "INVALID", result.IsDataIntact ? "intact" : "CORRUPT");
+}
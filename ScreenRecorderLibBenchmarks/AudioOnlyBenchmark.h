@@ -0,0 +1,45 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include "Benchmark.h"
+#include "../ScreenRecorderLibNative/Simd.util.h"
+
+struct AUDIO_ONLY_BENCHMARK_OPTIONS {
+	//Simulated recording length. The simulation runs as fast as the pipeline allows, not in real time.
+	double Seconds = 60;
+	//The WAV file format.
+	UINT32 SampleRate = 48000;
+	UINT32 Channels = 2;
+	//Run the mix through the lookahead limiter before converting it, as AudioManager does by default.
+	bool IsLimiterEnabled = true;
+	//Measurements made before this much audio was written are left out of the steady state allocation count.
+	double WarmupSeconds = 1;
+	SimdLevel Simd = SimdLevel::Auto;
+};
+
+struct AUDIO_ONLY_BENCHMARK_RESULT {
+	//Time and heap use from nothing to a started recording: the devices, capture streams, graph, limiter, packetizer and WAV header.
+	double StartupNanos;
+	UINT64 StartupHeapAllocations;
+	UINT64 StartupHeapBytes;
+	//Time spent capturing, mixing, converting and writing, per second of audio.
+	double NanosPerAudioSecond;
+	//The same as a share of one core, for a recording running in real time.
+	double CpuPercent;
+	UINT64 SteadyStateHeapAllocations;
+	UINT64 WrittenFrames;
+	//How far the length of the WAV file is from the simulated recording length, in milliseconds.
+	double LengthErrorMillis;
+	//The WAV file read back has a valid header, with the sizes of the audio written.
+	bool IsHeaderValid;
+	//The audio read back from the WAV file is the audio handed to the writer.
+	bool IsDataIntact;
+};
+
+/// <summary>
+/// Runs an audio only recording against simulated devices: a 44.1 kHz stereo tone running 80 ppm fast and a 48 kHz mono noise source running 50 ppm slow,
+/// captured, mixed, limited and converted in the same steps as AudioManager, cut into packets on the AudioWriter schedule and written with WavWriter to a
+/// memory stream. None of the video pipeline is involved, so the figures are the whole cost of the recording. The WAV file is read back and checked.
+/// </summary>
+HRESULT RunAudioOnlyBenchmark(_In_ const AUDIO_ONLY_BENCHMARK_OPTIONS &options, _Out_ AUDIO_ONLY_BENCHMARK_RESULT *pResult);
+void PrintAudioOnlyBenchmarkResult(_In_ const AUDIO_ONLY_BENCHMARK_OPTIONS &options, _In_ const AUDIO_ONLY_BENCHMARK_RESULT &result);
@@ -0,0 +1,147 @@
+#include "AudioOptionsBenchmark.h"
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Benchmark.h"
+#include "../ScreenRecorderLibNative/AudioGraph.h"
+
+namespace {
+	/// <summary>
+	/// The dynamic audio options, laid out and guarded like AUDIO_OPTIONS.
+	/// </summary>
+	class BenchmarkAudioOptions
+	{
+	public:
+		BenchmarkAudioOptions(_In_ UINT32 devices) :
+			m_Devices(devices, L"{0.0.1.00000000}.{5a4e8f2c-3b7d-4c1e-9f60-2d8b7a1c4e93}")
+		{
+		}
+		bool IsAudioEnabled() { return m_IsAudioEnabled; }
+		bool IsOutputDeviceEnabled() { return m_IsOutputDeviceEnabled; }
+		bool IsInputDeviceEnabled() { return m_IsInputDeviceEnabled; }
+		float GetOutputVolume() { return m_OutputVolume; }
+		float GetInputVolume() { return m_InputVolume; }
+		std::vector<std::wstring> GetDevices() { std::lock_guard<std::mutex> lock(m_DeviceMutex); return m_Devices; }
+		UINT64 GetChangeVersion() const { return m_ChangeVersion.load(std::memory_order_acquire); }
+	private:
+		bool m_IsAudioEnabled = true;
+		bool m_IsOutputDeviceEnabled = true;
+		bool m_IsInputDeviceEnabled = true;
+		float m_OutputVolume = 1.0f;
+		float m_InputVolume = 0.8f;
+		std::mutex m_DeviceMutex;
+		std::vector<std::wstring> m_Devices;
+		std::atomic<UINT64> m_ChangeVersion{ 0 };
+	};
+
+	class SilentGraphSource : public IAudioGraphSource
+	{
+	public:
+		void ReadAudio(_In_ UINT64 /*duration100Nanos*/, _Inout_ std::vector<BYTE> &/*buffer*/, _Inout_opt_ AUDIO_BUFFER_COUNTERS * /*pCounters*/, _Out_ bool *pIsSilent) override
+		{
+			*pIsSilent = true;
+		}
+	};
+
+	struct BENCHMARK_DEVICE {
+		SilentGraphSource Source;
+		std::atomic<bool> IsCapturing{ true };
+		std::wstring Device;
+		UINT32 NodeId = 0;
+	};
+
+	enum class OptionsApplyMode {
+		Reconfigure,
+		ReconfigureWithDevices,
+		VersionCheck
+	};
+
+	//Keeps the compiler from optimizing the timed loops away.
+	volatile UINT64 g_Sink;
+
+	void ConfigureDevices(_In_ BenchmarkAudioOptions &options, _Inout_ AudioGraph &graph, _Inout_ std::vector<std::unique_ptr<BENCHMARK_DEVICE>> &devices, _In_ bool isDeviceNameChecked)
+	{
+		std::vector<std::wstring> deviceNames;
+		if (isDeviceNameChecked) {
+			deviceNames = options.GetDevices();
+		}
+		for (size_t i = 0; i < devices.size(); i++) {
+			BENCHMARK_DEVICE &device = *devices[i];
+			bool isEnabled = options.IsAudioEnabled() && (i == 0 ? options.IsOutputDeviceEnabled() : options.IsInputDeviceEnabled());
+			float volume = i == 0 ? options.GetOutputVolume() : options.GetInputVolume();
+			if (isEnabled && !device.IsCapturing) {
+				g_Sink = g_Sink + 1;
+			}
+			if (isDeviceNameChecked && deviceNames[i] != device.Device) {
+				g_Sink = g_Sink + 1;
+			}
+			graph.SetSourceGain(device.NodeId, volume);
+			graph.SetSourceMuted(device.NodeId, volume == 0.0f);
+		}
+	}
+
+	double TimeFrames(_In_ UINT64 frames, _In_ BenchmarkAudioOptions &options, _Inout_ AudioGraph &graph, _Inout_ std::vector<std::unique_ptr<BENCHMARK_DEVICE>> &devices, _In_ OptionsApplyMode mode)
+	{
+		std::atomic<UINT64> deviceChangeCount{ 0 };
+		UINT64 appliedVersion = options.GetChangeVersion();
+		UINT64 appliedDeviceChangeCount = 0;
+		bool hasPendingCaptures = false;
+		auto start = std::chrono::steady_clock::now();
+		for (UINT64 frame = 0; frame < frames; frame++) {
+			if (mode == OptionsApplyMode::Reconfigure) {
+				ConfigureDevices(options, graph, devices, false);
+			}
+			else if (mode == OptionsApplyMode::ReconfigureWithDevices) {
+				ConfigureDevices(options, graph, devices, true);
+			}
+			else if (options.GetChangeVersion() != appliedVersion
+				|| deviceChangeCount.load(std::memory_order_acquire) != appliedDeviceChangeCount
+				|| hasPendingCaptures) {
+				ConfigureDevices(options, graph, devices, true);
+			}
+		}
+		return ElapsedNanos(start) / (double)frames;
+	}
+}
+
+HRESULT RunAudioOptionsBenchmark(_In_ const AUDIO_OPTIONS_BENCHMARK_OPTIONS &options, _Out_ AUDIO_OPTIONS_BENCHMARK_RESULT *pResult)
+{
+	*pResult = AUDIO_OPTIONS_BENCHMARK_RESULT{};
+	if (options.Frames == 0 || options.Devices == 0) {
+		return E_INVALIDARG;
+	}
+	AudioGraph graph;
+	HRESULT hr = graph.Initialize(48000, 2);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	BenchmarkAudioOptions audioOptions(options.Devices);
+	std::vector<std::wstring> deviceNames = audioOptions.GetDevices();
+	std::vector<std::unique_ptr<BENCHMARK_DEVICE>> devices;
+	for (UINT32 i = 0; i < options.Devices; i++) {
+		auto pDevice = std::make_unique<BENCHMARK_DEVICE>();
+		pDevice->Device = deviceNames[i];
+		hr = graph.AddSource(&pDevice->Source, 48000, 2, AUDIO_GRAPH_SOURCE_OPTIONS{}, &pDevice->NodeId);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		devices.push_back(std::move(pDevice));
+	}
+	//A short run first, so caches and the branch predictor are warm for all three.
+	TimeFrames(options.Frames / 10 + 1, audioOptions, graph, devices, OptionsApplyMode::ReconfigureWithDevices);
+	pResult->ReconfigureNanosPerFrame = TimeFrames(options.Frames, audioOptions, graph, devices, OptionsApplyMode::Reconfigure);
+	pResult->ReconfigureWithDevicesNanosPerFrame = TimeFrames(options.Frames, audioOptions, graph, devices, OptionsApplyMode::ReconfigureWithDevices);
+	pResult->VersionCheckNanosPerFrame = TimeFrames(options.Frames, audioOptions, graph, devices, OptionsApplyMode::VersionCheck);
+	return S_OK;
+}
+
+void PrintAudioOptionsBenchmarkResult(_In_ const AUDIO_OPTIONS_BENCHMARK_OPTIONS &options, _In_ const AUDIO_OPTIONS_BENCHMARK_RESULT &result)
+{
+	printf("Dynamic audio options, %u devices, %llu frames\n", options.Devices, (unsigned long long)options.Frames);
+	printf("  Reconfigure every frame       %8.2f ns/frame\n", result.ReconfigureNanosPerFrame);
+	printf("  ... including device names    %8.2f ns/frame\n", result.ReconfigureWithDevicesNanosPerFrame);
+	printf("  Version check                 %8.2f ns/frame\n", result.VersionCheckNanosPerFrame);
+}
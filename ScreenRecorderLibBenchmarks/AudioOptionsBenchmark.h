@@ -0,0 +1,27 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+
+struct AUDIO_OPTIONS_BENCHMARK_OPTIONS {
+	//Number of video frames to time. Nothing changes in between, as in almost every frame of a real recording.
+	UINT64 Frames = 1000000;
+	//Number of capture devices configured per frame, each with its node in the audio graph.
+	UINT32 Devices = 2;
+};
+
+struct AUDIO_OPTIONS_BENCHMARK_RESULT {
+	//Nanoseconds per frame spent reconfiguring every device on every frame, as GrabAudioFrame used to: reading the enabled flags and volumes,
+	//checking the capture runs, and setting the gain and mute of each node.
+	double ReconfigureNanosPerFrame;
+	//The same, plus copying and comparing the device names, which polling would need to follow device changes.
+	double ReconfigureWithDevicesNanosPerFrame;
+	//Nanoseconds per frame spent comparing the option version and device change count, as GrabAudioFrame does now.
+	double VersionCheckNanosPerFrame;
+};
+
+/// <summary>
+/// Measures the per frame cost of applying dynamic audio options. Models the AudioManager checks on top of a real AudioGraph, with options guarded
+/// like AUDIO_OPTIONS, since that needs the Windows headers.
+/// </summary>
+HRESULT RunAudioOptionsBenchmark(_In_ const AUDIO_OPTIONS_BENCHMARK_OPTIONS &options, _Out_ AUDIO_OPTIONS_BENCHMARK_RESULT *pResult);
+void PrintAudioOptionsBenchmarkResult(_In_ const AUDIO_OPTIONS_BENCHMARK_OPTIONS &options, _In_ const AUDIO_OPTIONS_BENCHMARK_RESULT &result);
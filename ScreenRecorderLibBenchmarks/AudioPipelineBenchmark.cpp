@@ -0,0 +1,441 @@
+#include "AudioPipelineBenchmark.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "../ScreenRecorderLibNative/AudioCaptureStream.h"
+#include "../ScreenRecorderLibNative/AudioGraph.h"
+#include "../ScreenRecorderLibNative/AudioLimiter.h"
+#include "../ScreenRecorderLibNative/AudioPacketizer.h"
+#include "../ScreenRecorderLibNative/AudioSampleConverter.h"
+#include "../ScreenRecorderLibNative/SimulatedAudioSource.h"
+
+namespace {
+	const UINT64 HundredNanosPerSecond = 10000000;
+	//Shared mode device period. The capture thread wakes up twice per period.
+	const UINT64 DevicePeriod100Nanos = 100000;
+	const double OutputDeviceDriftPpm = 80;
+	const double InputDeviceDriftPpm = -50;
+
+	/// <summary>
+	/// One simulated capture device and its capture stream, the same pair LoopbackCapture holds, feeding a node of the audio graph.
+	/// </summary>
+	struct SIMULATED_DEVICE : public IAudioGraphSource {
+		std::unique_ptr<SimulatedAudioSource> Source;
+		AudioCaptureStream Stream;
+		AUDIO_GRAPH_SOURCE_OPTIONS NodeOptions;
+		UINT32 NodeId = 0;
+
+		void ReadAudio(_In_ UINT64 duration100Nanos, _Inout_ std::vector<BYTE> &buffer, _Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters, _Out_ bool *pIsSilent) override
+		{
+			//The simulated clock stands in for the performance counter the packets are timestamped with.
+			Stream.MeasureLatency(Source->GetClock());
+			Stream.Read(duration100Nanos, buffer, pCounters, pIsSilent);
+		}
+	};
+
+	/// <summary>
+	/// The output and input device pair AudioManager records by default.
+	/// </summary>
+	HRESULT CreateDefaultDevices(_In_ const AUDIO_PIPELINE_BENCHMARK_OPTIONS &options, _Inout_ std::vector<std::unique_ptr<SIMULATED_DEVICE>> &devices)
+	{
+		SIMULATED_CAPTURE_OPTIONS outputOptions;
+		outputOptions.SampleRate = 44100;
+		outputOptions.Channels = 2;
+		outputOptions.PacketDuration100Nanos = DevicePeriod100Nanos;
+		outputOptions.DriftPpm = OutputDeviceDriftPpm;
+		outputOptions.Jitter100Nanos = 30000;
+		outputOptions.Seed = 1;
+		outputOptions.PauseInterval100Nanos = (UINT64)(options.PauseIntervalSeconds * HundredNanosPerSecond);
+		outputOptions.Pause100Nanos = (UINT64)options.PauseMillis * 10000;
+		auto pOutput = std::make_unique<SIMULATED_DEVICE>();
+		HRESULT hr;
+		if (!options.WavPath.empty()) {
+			auto pSource = std::make_unique<WavFileAudioSource>();
+			hr = pSource->Initialize(options.WavPath, outputOptions);
+			pOutput->Source = std::move(pSource);
+		}
+		else {
+			auto pSource = std::make_unique<SyntheticAudioSource>();
+			hr = pSource->Initialize(outputOptions, options.IsSilent ? SyntheticAudioSignal::Silence : SyntheticAudioSignal::Sine, 0.5f, 440.0f);
+			pOutput->Source = std::move(pSource);
+		}
+		if (FAILED(hr)) {
+			fprintf(stderr, "Failed to create the simulated output device: hr = 0x%08x\n", (unsigned)hr);
+			return hr;
+		}
+		devices.push_back(std::move(pOutput));
+
+		SIMULATED_CAPTURE_OPTIONS inputOptions;
+		inputOptions.SampleRate = 48000;
+		inputOptions.Channels = 1;
+		inputOptions.PacketDuration100Nanos = DevicePeriod100Nanos;
+		inputOptions.DriftPpm = InputDeviceDriftPpm;
+		inputOptions.Jitter100Nanos = 10000;
+		inputOptions.Seed = 2;
+		inputOptions.PauseInterval100Nanos = outputOptions.PauseInterval100Nanos;
+		inputOptions.Pause100Nanos = outputOptions.Pause100Nanos;
+		auto pInput = std::make_unique<SIMULATED_DEVICE>();
+		auto pInputSource = std::make_unique<SyntheticAudioSource>();
+		hr = pInputSource->Initialize(inputOptions, options.IsSilent ? SyntheticAudioSignal::Silence : SyntheticAudioSignal::Noise, 0.1f);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		pInput->Source = std::move(pInputSource);
+		pInput->NodeOptions.Gain = 0.8f;
+		devices.push_back(std::move(pInput));
+		return S_OK;
+	}
+
+	/// <summary>
+	/// A mix of devices with different formats, clocks and node settings, for measuring how the graph scales with the number of sources.
+	/// </summary>
+	HRESULT CreateSyntheticDevices(_In_ const AUDIO_PIPELINE_BENCHMARK_OPTIONS &options, _Inout_ std::vector<std::unique_ptr<SIMULATED_DEVICE>> &devices)
+	{
+		const UINT32 sampleRates[] = { 48000, 44100, 32000, 16000 };
+		for (UINT32 i = 0; i < options.SourceCount; i++) {
+			SIMULATED_CAPTURE_OPTIONS sourceOptions;
+			sourceOptions.SampleRate = sampleRates[i % 4];
+			sourceOptions.Channels = i % 2 == 0 ? 2 : 1;
+			sourceOptions.PacketDuration100Nanos = DevicePeriod100Nanos;
+			//Devices read in their own format have no drift compensation, so they run on the media clock.
+			sourceOptions.DriftPpm = i % 4 == 3 ? 0 : (double)((int)(i * 37 % 101) - 50);
+			sourceOptions.Jitter100Nanos = 10000 + 10000 * (i % 3);
+			sourceOptions.Seed = i + 1;
+			sourceOptions.PauseInterval100Nanos = (UINT64)(options.PauseIntervalSeconds * HundredNanosPerSecond);
+			sourceOptions.Pause100Nanos = (UINT64)options.PauseMillis * 10000;
+			auto pDevice = std::make_unique<SIMULATED_DEVICE>();
+			auto pSource = std::make_unique<SyntheticAudioSource>();
+			SyntheticAudioSignal signal = options.IsSilent ? SyntheticAudioSignal::Silence : (i % 2 == 0 ? SyntheticAudioSignal::Sine : SyntheticAudioSignal::Noise);
+			HRESULT hr = pSource->Initialize(sourceOptions, signal, 0.5f, 220.0f * (i + 1));
+			if (FAILED(hr)) {
+				return hr;
+			}
+			pDevice->Source = std::move(pSource);
+			pDevice->NodeOptions.Gain = 1.0f / sqrtf((float)options.SourceCount);
+			pDevice->NodeOptions.IsMuted = i % 7 == 6;
+			pDevice->NodeOptions.Delay100Nanos = i % 5 == 4 ? 300000 : 0;
+			devices.push_back(std::move(pDevice));
+		}
+		return S_OK;
+	}
+}
+
+HRESULT RunAudioPipelineBenchmark(_In_ const AUDIO_PIPELINE_BENCHMARK_OPTIONS &options, _Out_ AUDIO_PIPELINE_BENCHMARK_RESULT *pResult)
+{
+	*pResult = AUDIO_PIPELINE_BENCHMARK_RESULT{};
+	if (options.FramesPerSecond == 0 || options.SampleRate == 0 || options.Channels == 0 || options.Seconds <= 0) {
+		return E_INVALIDARG;
+	}
+	//The same wake interval and drift compensation target as LoopbackCapture.
+	const UINT64 captureInterval = options.IsCaptureEventDriven ? DevicePeriod100Nanos
+		: options.CaptureWakeIntervalMillis > 0 ? (UINT64)options.CaptureWakeIntervalMillis * 10000 : DevicePeriod100Nanos / 2;
+	const UINT32 targetBufferMillis = AudioCaptureStream::GetTargetBufferMillis(DevicePeriod100Nanos, options.IsCaptureEventDriven ? 0 : captureInterval);
+	std::vector<std::unique_ptr<SIMULATED_DEVICE>> devices;
+	HRESULT hr = options.SourceCount > 0 ? CreateSyntheticDevices(options, devices) : CreateDefaultDevices(options, devices);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	AudioGraph graph;
+	hr = graph.Initialize(options.SampleRate, options.Channels, options.Simd);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	for (size_t i = 0; i < devices.size(); i++) {
+		SIMULATED_DEVICE &device = *devices[i];
+		//Every fourth synthetic device is read in its own format, so the graph node adapts it instead of the capture stream.
+		bool isStreamResampling = options.SourceCount == 0 || i % 4 != 3;
+		hr = device.Stream.Initialize(device.Source->GetSampleRate(), device.Source->GetChannels(), options.SampleRate, options.Channels, isStreamResampling, isStreamResampling, targetBufferMillis);
+		if (FAILED(hr)) {
+			fprintf(stderr, "Failed to initialize an audio capture stream: hr = 0x%08x\n", (unsigned)hr);
+			return hr;
+		}
+		hr = graph.AddSource(&device, device.Stream.GetOutputSampleRate(), device.Stream.GetOutputChannels(), device.NodeOptions, &device.NodeId);
+		if (FAILED(hr)) {
+			fprintf(stderr, "Failed to add a source to the audio graph: hr = 0x%08x\n", (unsigned)hr);
+			return hr;
+		}
+	}
+	AudioSampleConverter converter;
+	converter.Initialize(true, options.Simd);
+	AudioLimiter limiter;
+	if (options.IsLimiterEnabled) {
+		hr = limiter.Initialize(options.SampleRate, options.Channels, AUDIO_LIMITER_OPTIONS{}, options.Simd);
+		if (FAILED(hr)) {
+			fprintf(stderr, "Failed to initialize the limiter: hr = 0x%08x\n", (unsigned)hr);
+			return hr;
+		}
+	}
+	std::vector<BYTE> limitedData;
+	std::vector<BYTE> encoderData;
+	AUDIO_BUFFER_COUNTERS counters{};
+
+	std::vector<double> frameNanos;
+	std::vector<double> sliceErrors;
+	//One measurement per audio pass, which is a video frame, or a packet on the audio writer schedule.
+	double passesPerSecond = options.IsAudioWrittenPerVideoFrame ? options.FramesPerSecond : (double)options.SampleRate / AudioPacketizer::DefaultPacketFrames;
+	size_t expectedPasses = (size_t)(options.Seconds * passesPerSecond) + 1;
+	frameNanos.reserve(expectedPasses);
+	sliceErrors.reserve(expectedPasses);
+	double processingNanos = 0;
+	double captureNanos = 0;
+	UINT64 capturedSamples = 0;
+	UINT64 outputSamples = 0;
+	UINT64 clippedSamples = 0;
+	bool isWarm = false;
+	UINT64 warmHeapAllocations = 0;
+	UINT64 warmBufferAllocations = 0;
+
+	//The encoder input. Audio is cut into packets like AudioWriter does, unless it is written per video frame.
+	const bool isAudioWriterThread = !options.IsAudioWrittenPerVideoFrame;
+	const UINT32 encoderBlockAlign = options.Channels * sizeof(int16_t);
+	AudioPacketizer packetizer;
+	hr = packetizer.Initialize(options.SampleRate, encoderBlockAlign);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	std::vector<BYTE> packetData(packetizer.GetPacketBytes());
+	INT64 totalDiff = 0;
+	UINT64 audioWrites = 0;
+	UINT64 writtenFrames = 0;
+	UINT32 minWriteFrames = UINT32_MAX;
+	UINT32 maxWriteFrames = 0;
+	UINT64 lastWriteTime = 0;
+	UINT64 maxWriteInterval = 0;
+	INT64 nextTimestamp = 0;
+	UINT64 timestampGaps = 0;
+	auto writeAudio = [&](UINT64 now, INT64 timestamp, INT64 duration, UINT32 frames) {
+		if (audioWrites > 0) {
+			maxWriteInterval = (std::max)(maxWriteInterval, now - lastWriteTime);
+			if (timestamp != nextTimestamp) {
+				timestampGaps++;
+			}
+		}
+		lastWriteTime = now;
+		nextTimestamp = timestamp + duration;
+		audioWrites++;
+		writtenFrames += frames;
+		minWriteFrames = (std::min)(minWriteFrames, frames);
+		maxWriteFrames = (std::max)(maxWriteFrames, frames);
+	};
+
+	const UINT64 endTime = (UINT64)(options.Seconds * HundredNanosPerSecond);
+	const UINT64 stallInterval = (UINT64)(options.StallIntervalSeconds * HundredNanosPerSecond);
+	auto frameTime = [&](UINT64 index) { return index * HundredNanosPerSecond / options.FramesPerSecond; };
+	//An event driven capture wakes up when the first device has a packet ready.
+	auto nextPacketReadyTime = [&]() {
+		UINT64 readyTime = UINT64_MAX;
+		for (auto &pDevice : devices) {
+			readyTime = (std::min)(readyTime, pDevice->Source->GetNextPacketReadyTime());
+		}
+		return readyTime;
+	};
+	UINT64 nextCapture = options.IsCaptureEventDriven ? nextPacketReadyTime() : captureInterval;
+	UINT64 captureWakeups = 0;
+	UINT64 frameIndex = 1;
+	UINT64 nextFrame = frameTime(frameIndex);
+	UINT64 lastFrame = 0;
+	UINT64 videoFrames = 0;
+	UINT64 nextStall = stallInterval;
+	//The audio writer wakes up once per packet.
+	const UINT64 audioPassInterval = (UINT64)packetizer.GetPacketFrames() * HundredNanosPerSecond / options.SampleRate;
+	UINT64 nextAudioPass = isAudioWriterThread ? audioPassInterval : UINT64_MAX;
+	UINT64 lastAudioPass = 0;
+
+	while (true) {
+		UINT64 now = (std::min)((std::min)(nextCapture, nextFrame), nextAudioPass);
+		if (now > endTime) {
+			break;
+		}
+		for (auto &pDevice : devices) {
+			pDevice->Source->AdvanceClock(now - pDevice->Source->GetClock());
+		}
+		if (now == nextCapture) {
+			for (auto &pDevice : devices) {
+				//Each device has a capture thread of its own. Event driven, it only wakes up for its own packets.
+				if (options.IsCaptureEventDriven && pDevice->Source->GetNextPacketReadyTime() > now) {
+					continue;
+				}
+				captureWakeups++;
+				AUDIO_CAPTURE_PASS pass;
+				auto start = std::chrono::steady_clock::now();
+				hr = pDevice->Stream.ReadPackets(pDevice->Source.get(), &pass);
+				captureNanos += ElapsedNanos(start);
+				if (FAILED(hr)) {
+					fprintf(stderr, "Reading packets failed: hr = 0x%08x\n", (unsigned)hr);
+					return hr;
+				}
+				capturedSamples += (UINT64)pass.Frames * pDevice->Source->GetChannels();
+			}
+			nextCapture = options.IsCaptureEventDriven ? nextPacketReadyTime() : nextCapture + captureInterval;
+		}
+		bool isVideoFrame = now == nextFrame;
+		bool isAudioPass = isAudioWriterThread ? now == nextAudioPass : isVideoFrame;
+		if (isVideoFrame) {
+			videoFrames++;
+			lastFrame = now;
+			//Frames due while the recorder was stalled are skipped, and the next frame covers the whole time since the last one.
+			while (frameTime(frameIndex) <= lastFrame) {
+				frameIndex++;
+			}
+			nextFrame = frameTime(frameIndex);
+			if (stallInterval > 0 && options.StallMillis > 0 && nextFrame >= nextStall) {
+				nextFrame += (UINT64)options.StallMillis * 10000;
+				nextStall += stallInterval;
+			}
+		}
+		if (!isAudioPass) {
+			continue;
+		}
+		UINT64 duration = now - lastAudioPass;
+		auto start = std::chrono::steady_clock::now();
+		//The same steps as AudioManager::GrabAudioFrame, minus the pooled media buffer.
+		AUDIO_GRAPH_OUTPUT mix;
+		hr = graph.Process(duration, &mix, &counters);
+		if (FAILED(hr)) {
+			fprintf(stderr, "Processing the audio graph failed: hr = 0x%08x\n", (unsigned)hr);
+			return hr;
+		}
+		size_t sampleCount = mix.SampleCount;
+		bool isSilent = mix.IsSilent;
+		if (sampleCount > 0) {
+			const float *pSamples = mix.pSamples;
+			if (options.IsLimiterEnabled) {
+				if (isSilent && limiter.IsIdle()) {
+					limiter.SkipSilence(sampleCount);
+				}
+				else {
+					ResizeAudioBuffer(limitedData, sampleCount * sizeof(float), &counters);
+					float *pLimited = reinterpret_cast<float *>(limitedData.data());
+					limiter.Process(isSilent ? nullptr : pSamples, pLimited, sampleCount);
+					pSamples = pLimited;
+					isSilent = false;
+				}
+			}
+			if (isSilent) {
+				counters.SilentFrames++;
+			}
+			else {
+				ResizeAudioBuffer(encoderData, sampleCount * sizeof(int16_t), &counters);
+				clippedSamples += converter.ConvertToInt16(pSamples, reinterpret_cast<int16_t *>(encoderData.data()), sampleCount);
+			}
+			counters.Frames++;
+		}
+		UINT32 frames = (UINT32)(sampleCount / options.Channels);
+		if (isAudioWriterThread) {
+			//The same steps as AudioWriter::WriteRecordedAudio.
+			if (frames > 0) {
+				if (isSilent) {
+					packetizer.WriteSilence((size_t)frames * encoderBlockAlign);
+				}
+				else {
+					packetizer.Write(encoderData.data(), (size_t)frames * encoderBlockAlign);
+				}
+			}
+			packetizer.WriteSilenceUntil((INT64)now, packetizer.GetPacketFrames());
+			AUDIO_ENCODER_PACKET packet;
+			while (packetizer.ReadPacket(packetData.data(), &packet)) {
+				writeAudio(now, packet.Timestamp100Nanos, packet.Duration100Nanos, packet.Frames);
+			}
+		}
+		else if (frames > 0) {
+			//The timestamps RecordingManager gave audio written per video frame: the frame start, moved by the rounded length of the audio before it.
+			INT64 audioDuration = (INT64)((UINT64)frames * HundredNanosPerSecond / options.SampleRate);
+			writeAudio(now, (INT64)lastAudioPass + totalDiff, audioDuration, frames);
+			totalDiff += audioDuration - (INT64)duration;
+		}
+		double elapsed = ElapsedNanos(start);
+		processingNanos += elapsed;
+		outputSamples += sampleCount;
+		counters.AudioHundredNanos += duration;
+
+		double expectedFrames = (double)duration * options.SampleRate / HundredNanosPerSecond;
+		double deliveredFrames = (double)sampleCount / options.Channels;
+		if (isWarm) {
+			frameNanos.push_back(elapsed);
+			sliceErrors.push_back(deliveredFrames - expectedFrames);
+		}
+		else if ((double)outputSamples / options.Channels / options.SampleRate >= options.WarmupSeconds) {
+			isWarm = true;
+			warmHeapAllocations = GetHeapAllocationCount();
+			warmBufferAllocations = counters.Allocations;
+		}
+
+		lastAudioPass = now;
+		if (isAudioWriterThread) {
+			nextAudioPass += audioPassInterval;
+		}
+	}
+
+	pResult->VideoFrames = videoFrames;
+	pResult->OutputSamples = outputSamples;
+	pResult->NanosPerSample = outputSamples > 0 ? processingNanos / outputSamples : 0;
+	pResult->CaptureNanosPerSample = capturedSamples > 0 ? captureNanos / capturedSamples : 0;
+	pResult->FrameNanos = ComputeBenchmarkStats(frameNanos);
+	pResult->SliceErrorFrames = ComputeBenchmarkStats(sliceErrors);
+	pResult->FinalOffsetMillis = ((double)outputSamples / options.Channels / options.SampleRate - (double)lastAudioPass / HundredNanosPerSecond) * 1000;
+	INT64 writtenEnd = isAudioWriterThread ? packetizer.GetFrameTime(packetizer.GetWrittenFrames()) : nextTimestamp;
+	pResult->WrittenOffsetMillis = ((double)writtenEnd - (double)lastAudioPass) / 10000;
+	counters.ProcessingHundredNanos = (UINT64)(processingNanos / 100);
+	pResult->Counters = counters;
+	pResult->SteadyStateBufferAllocations = isWarm ? counters.Allocations - warmBufferAllocations : 0;
+	pResult->SteadyStateHeapAllocations = isWarm ? GetHeapAllocationCount() - warmHeapAllocations : 0;
+	pResult->ClippedSamples = clippedSamples;
+	pResult->LimitedFrames = limiter.GetStats().LimitedFrames;
+	pResult->AudioWrites = audioWrites;
+	pResult->MinWriteFrames = audioWrites > 0 ? minWriteFrames : 0;
+	pResult->MaxWriteFrames = maxWriteFrames;
+	pResult->MaxWriteIntervalMillis = (double)maxWriteInterval / 10000;
+	pResult->TimestampErrorMillis = ((double)nextTimestamp - (double)writtenFrames * HundredNanosPerSecond / options.SampleRate) / 10000;
+	pResult->TimestampGaps = timestampGaps;
+	pResult->Sources = devices.size();
+	pResult->CaptureWakeupsPerSecond = lastAudioPass > 0 ? (double)captureWakeups / devices.size() * HundredNanosPerSecond / lastAudioPass : 0;
+	UINT64 latencyCount = 0;
+	for (auto &pDevice : devices) {
+		pResult->LostFrames += pDevice->Source->GetLostFrames();
+		pResult->ResyncFrames += pDevice->Stream.GetResyncFrames();
+		AUDIO_LATENCY_STATS latency = pDevice->Stream.GetLatencyStats();
+		pResult->AverageLatencyMillis += latency.AverageMillis * latency.Count;
+		pResult->MaxLatencyMillis = (std::max)(pResult->MaxLatencyMillis, latency.MaxMillis);
+		latencyCount += latency.Count;
+	}
+	pResult->AverageLatencyMillis = latencyCount > 0 ? pResult->AverageLatencyMillis / latencyCount : 0;
+	if (options.SourceCount == 0) {
+		pResult->OutputDeviceDrift = devices[0]->Stream.GetDriftStats();
+		pResult->InputDeviceDrift = devices[1]->Stream.GetDriftStats();
+		pResult->OutputDeviceLatency = devices[0]->Stream.GetLatencyStats();
+		pResult->InputDeviceLatency = devices[1]->Stream.GetLatencyStats();
+	}
+	return S_OK;
+}
+
+void PrintAudioPipelineBenchmarkResult(_In_ const AUDIO_PIPELINE_BENCHMARK_OPTIONS &options, _In_ const AUDIO_PIPELINE_BENCHMARK_RESULT &result)
+{
+	const AUDIO_BUFFER_COUNTERS &counters = result.Counters;
+	printf("Audio pipeline: %.0f s at %u fps, %u Hz %u ch, %zu sources%s%s%s\n", options.Seconds, options.FramesPerSecond, options.SampleRate, options.Channels, result.Sources,
+		options.IsSilent ? ", silent" : "", options.WavPath.empty() ? "" : ", WAV output device", options.IsAudioWrittenPerVideoFrame ? ", audio written per video frame" : "");
+	printf("  processing       %.2f ns/sample (%.2f per source), capture %.2f ns/sample, %.3f ms per second of audio\n",
+		result.NanosPerSample, result.Sources > 0 ? result.NanosPerSample / result.Sources : 0, result.CaptureNanosPerSample, result.NanosPerSample * options.SampleRate * options.Channels / 1000000);
+	printf("  frame time (us)  mean %.2f, p50 %.2f, p99 %.2f, max %.2f, stddev %.2f\n",
+		result.FrameNanos.Mean / 1000, result.FrameNanos.P50 / 1000, result.FrameNanos.P99 / 1000, result.FrameNanos.Max / 1000, result.FrameNanos.StdDev / 1000);
+	printf("  slice error      mean %.2f, min %.2f, max %.2f, stddev %.2f frames\n",
+		result.SliceErrorFrames.Mean, result.SliceErrorFrames.Min, result.SliceErrorFrames.Max, result.SliceErrorFrames.StdDev);
+	printf("  a/v offset       %.2f ms at the end, %.2f ms on the encoder timestamps\n", result.FinalOffsetMillis, result.WrittenOffsetMillis);
+	printf("  audio writes     %llu of %u to %u frames, at most %.1f ms apart, %llu timestamp gaps, timestamps %.4f ms off at the end\n",
+		(unsigned long long)result.AudioWrites, result.MinWriteFrames, result.MaxWriteFrames, result.MaxWriteIntervalMillis, (unsigned long long)result.TimestampGaps, result.TimestampErrorMillis);
+	printf("  allocations      %llu total, %llu after warm up (%llu heap)\n",
+		(unsigned long long)counters.Allocations, (unsigned long long)result.SteadyStateBufferAllocations, (unsigned long long)result.SteadyStateHeapAllocations);
+	printf("  copies           %.2f per frame, %.0f bytes per frame\n",
+		counters.Frames > 0 ? (double)counters.Copies / counters.Frames : 0, counters.Frames > 0 ? (double)counters.BytesCopied / counters.Frames : 0);
+	printf("  frames           %llu (%llu silent), %llu clipped samples, %llu limited frames, %llu frames lost, %llu frames dropped to resync\n",
+		(unsigned long long)counters.Frames, (unsigned long long)counters.SilentFrames, (unsigned long long)result.ClippedSamples, (unsigned long long)result.LimitedFrames,
+		(unsigned long long)result.LostFrames, (unsigned long long)result.ResyncFrames);
+	printf("  capture latency  %.1f ms average, %.1f ms max, %.0f wakeups per second\n", result.AverageLatencyMillis, result.MaxLatencyMillis, result.CaptureWakeupsPerSecond);
+	if (options.SourceCount > 0) {
+		return;
+	}
+	printf("  drift estimate   output device %.1f ppm (simulated %.0f), input device %.1f ppm (simulated %.0f)\n",
+		result.OutputDeviceDrift.DriftPpm, OutputDeviceDriftPpm, result.InputDeviceDrift.DriftPpm, InputDeviceDriftPpm);
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <string>
+#include "Benchmark.h"
+#include "../ScreenRecorderLibNative/AudioBufferCounters.h"
+#include "../ScreenRecorderLibNative/AudioCaptureStream.h"
+#include "../ScreenRecorderLibNative/AudioDriftEstimator.h"
+#include "../ScreenRecorderLibNative/Simd.util.h"
+
+struct AUDIO_PIPELINE_BENCHMARK_OPTIONS {
+	//Simulated recording length. The simulation runs as fast as the pipeline allows, not in real time.
+	double Seconds = 60;
+	//Video frame rate. Audio is only sliced at this rate if IsAudioWrittenPerVideoFrame is set.
+	UINT32 FramesPerSecond = 30;
+	//The encoder format.
+	UINT32 SampleRate = 48000;
+	UINT32 Channels = 2;
+	//If set, the output device plays this WAV file instead of a generated tone.
+	std::wstring WavPath;
+	//Both devices deliver silent packets, as when nothing is playing and the microphone is muted.
+	bool IsSilent = false;
+	//Every StallIntervalSeconds, one video frame comes StallMillis late, as if the recorder thread was blocked.
+	double StallIntervalSeconds = 0;
+	UINT32 StallMillis = 0;
+	//After every PauseIntervalSeconds of audio, all devices stop delivering packets for PauseMillis, as a loopback device does while nothing plays.
+	double PauseIntervalSeconds = 0;
+	UINT32 PauseMillis = 0;
+	//Measurements made before this much audio was produced are left out of the steady state figures.
+	double WarmupSeconds = 1;
+	SimdLevel Simd = SimdLevel::Auto;
+	//If set, this many synthetic devices with mixed formats, clocks, delays and mutes are recorded instead of the output and input device pair.
+	UINT32 SourceCount = 0;
+	//Run the mix through the lookahead limiter before converting it, as AudioManager does by default.
+	bool IsLimiterEnabled = true;
+	//Take and write the audio once per video frame, as RecordingManager did before audio got its own writer thread.
+	//Otherwise audio is taken on the AudioWriter schedule and written in fixed size packets, whatever the video does.
+	bool IsAudioWrittenPerVideoFrame = false;
+	//Wake the capture when a device has a packet ready, as LoopbackCapture does for input devices in event mode. Otherwise the capture wakes on a timer.
+	bool IsCaptureEventDriven = false;
+	//Time between timer wakeups of the capture, as in AUDIO_CAPTURE_TIMING. 0 for half the device period.
+	UINT32 CaptureWakeIntervalMillis = 0;
+};
+
+struct AUDIO_PIPELINE_BENCHMARK_RESULT {
+	size_t Sources;
+	UINT64 VideoFrames;
+	UINT64 OutputSamples;
+	//Time spent per output sample (one sample per channel) on slicing, resampling, mixing, metering and converting, in nanoseconds. Grows linearly with the sources.
+	double NanosPerSample;
+	//Time spent per captured sample on queuing device packets, in nanoseconds.
+	double CaptureNanosPerSample;
+	//Time spent on each pass taking audio, i.e. each video frame or each audio writer pass, in nanoseconds.
+	BENCHMARK_STATS FrameNanos;
+	//How far the audio delivered on each pass differs from the time since the last one, in output frames.
+	BENCHMARK_STATS SliceErrorFrames;
+	//Audio delivered minus simulated time at the end of the run, in milliseconds. Grows without bound if drift compensation fails.
+	double FinalOffsetMillis;
+	//The end of the audio on the clock of the encoder timestamps minus simulated time at the end of the run, in milliseconds.
+	//All audio written from then on plays this much late against the video, so it must stay within a packet also when less audio is delivered than time passes.
+	double WrittenOffsetMillis;
+	AUDIO_BUFFER_COUNTERS Counters;
+	//Allocations after warm up, as counted by the pipeline, and as counted by the heap.
+	UINT64 SteadyStateBufferAllocations;
+	UINT64 SteadyStateHeapAllocations;
+	UINT64 ClippedSamples;
+	UINT64 LimitedFrames;
+	UINT64 LostFrames;
+	UINT64 ResyncFrames;
+	//The chunks of audio handed to the encoder, and their length in frames.
+	UINT64 AudioWrites;
+	UINT32 MinWriteFrames;
+	UINT32 MaxWriteFrames;
+	//The longest simulated time between two audio writes, in milliseconds. Shows a video stall if audio waits for video.
+	double MaxWriteIntervalMillis;
+	//How far the end of the last audio timestamp is from the time of the samples written, in milliseconds. Rounding on each write adds up here.
+	double TimestampErrorMillis;
+	//Writes whose timestamp does not start where the previous write ended.
+	UINT64 TimestampGaps;
+	AUDIO_DRIFT_STATS OutputDeviceDrift;
+	AUDIO_DRIFT_STATS InputDeviceDrift;
+	//How often the capture thread of each device woke up to queue packets, per simulated second.
+	double CaptureWakeupsPerSecond;
+	//The time from the capture of audio to its mixing, over all devices.
+	double AverageLatencyMillis;
+	double MaxLatencyMillis;
+	AUDIO_LATENCY_STATS OutputDeviceLatency;
+	AUDIO_LATENCY_STATS InputDeviceLatency;
+};
+
+/// <summary>
+/// Runs simulated output and input devices through the capture, resampling, drift compensation, mixing, metering and conversion stages,
+/// in the same order and at the same cadence as a recording: packets are queued every half device period, or as set by the capture wake options,
+/// and read on every audio writer pass, or every video frame if IsAudioWrittenPerVideoFrame is set.
+/// The output device is a 44.1 kHz stereo tone running 80 ppm fast with 3 ms of packet jitter, the input device a 48 kHz mono noise source running 50 ppm slow,
+/// so both resampling paths and drift compensation are exercised. With SourceCount set, that many synthetic devices are mixed instead.
+/// </summary>
+HRESULT RunAudioPipelineBenchmark(_In_ const AUDIO_PIPELINE_BENCHMARK_OPTIONS &options, _Out_ AUDIO_PIPELINE_BENCHMARK_RESULT *pResult);
+void PrintAudioPipelineBenchmarkResult(_In_ const AUDIO_PIPELINE_BENCHMARK_OPTIONS &options, _In_ const AUDIO_PIPELINE_BENCHMARK_RESULT &result);
@@ -0,0 +1,239 @@
+#include "AudioTracksBenchmark.h"
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "../ScreenRecorderLibNative/AudioGraph.h"
+#include "../ScreenRecorderLibNative/AudioLimiter.h"
+#include "../ScreenRecorderLibNative/AudioSampleConverter.h"
+
+namespace {
+	const double Pi = 3.14159265358979323846;
+	const UINT64 HundredNanosPerSecond = 10000000;
+	//Float sums in a different order differ in the last bits.
+	const float MismatchTolerance = 1e-5f;
+
+	/// <summary>
+	/// A source that loops one second of a tone, delivering exactly the frames due for the time read so far, like a capture without drift.
+	/// </summary>
+	class LoopingToneSource : public IAudioGraphSource
+	{
+	public:
+		LoopingToneSource(_In_ UINT32 sampleRate, _In_ UINT32 channels, _In_ double frequency, _In_ double amplitude) :
+			m_SampleRate(sampleRate),
+			m_Channels(channels),
+			m_Samples((size_t)sampleRate * channels),
+			m_Time(0),
+			m_Frames(0)
+		{
+			for (size_t frame = 0; frame < sampleRate; frame++) {
+				for (UINT32 channel = 0; channel < channels; channel++) {
+					m_Samples[frame * channels + channel] = (float)(amplitude * sin(2 * Pi * frequency * (channel + 1) * frame / sampleRate));
+				}
+			}
+		}
+
+		inline float GetSample(_In_ UINT64 frame, _In_ UINT32 channel) const { return m_Samples[(size_t)(frame % m_SampleRate) * m_Channels + channel]; }
+
+		void ReadAudio(_In_ UINT64 duration100Nanos, _Inout_ std::vector<BYTE> &buffer, _Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters, _Out_ bool *pIsSilent) override
+		{
+			*pIsSilent = false;
+			m_Time += duration100Nanos;
+			UINT64 endFrame = m_Time * m_SampleRate / HundredNanosPerSecond;
+			size_t frameBytes = m_Channels * sizeof(float);
+			size_t offset = buffer.size();
+			ResizeAudioBuffer(buffer, offset + (size_t)(endFrame - m_Frames) * frameBytes, pCounters);
+			BYTE *pDest = buffer.data() + offset;
+			while (m_Frames < endFrame) {
+				size_t loopFrame = (size_t)(m_Frames % m_SampleRate);
+				size_t frames = (size_t)(std::min)(endFrame - m_Frames, (UINT64)(m_SampleRate - loopFrame));
+				memcpy(pDest, &m_Samples[loopFrame * m_Channels], frames * frameBytes);
+				pDest += frames * frameBytes;
+				m_Frames += frames;
+			}
+		}
+	private:
+		UINT32 m_SampleRate;
+		UINT32 m_Channels;
+		std::vector<float> m_Samples;
+		UINT64 m_Time;
+		UINT64 m_Frames;
+	};
+
+	struct BENCHMARK_TRACK {
+		//The index of the source written to the track, or -1 for the mix.
+		int Source = -1;
+		AudioLimiter Limiter;
+		std::vector<float> LimitedSamples;
+		std::vector<int16_t> EncoderSamples;
+	};
+
+	const char *GetLayoutName(_In_ AudioTracksBenchmarkLayout layout)
+	{
+		switch (layout)
+		{
+		case AudioTracksBenchmarkLayout::Separate:
+			return "separate";
+		case AudioTracksBenchmarkLayout::MixedAndSeparate:
+			return "mixed and separate";
+		default:
+			return "mixed";
+		}
+	}
+
+	float GetSourceGain(_In_ size_t source)
+	{
+		return source % 2 == 0 ? 1.0f : 0.5f;
+	}
+}
+
+HRESULT RunAudioTracksBenchmark(_In_ const AUDIO_TRACKS_BENCHMARK_OPTIONS &options, _Out_ AUDIO_TRACKS_BENCHMARK_RESULT *pResult)
+{
+	*pResult = AUDIO_TRACKS_BENCHMARK_RESULT{};
+	if (options.Sources == 0 || options.Seconds <= 0 || options.SampleRate == 0 || options.Channels == 0 || options.BlockFrames == 0) {
+		return E_INVALIDARG;
+	}
+	size_t blocks = (size_t)(options.Seconds * options.SampleRate / options.BlockFrames);
+	if (blocks <= options.WarmupBlocks) {
+		return E_INVALIDARG;
+	}
+	AudioGraph graph;
+	HRESULT hr = graph.Initialize(options.SampleRate, options.Channels, options.Simd);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	std::vector<std::unique_ptr<LoopingToneSource>> sources;
+	std::vector<UINT32> nodeIds;
+	for (UINT32 i = 0; i < options.Sources; i++) {
+		//Quiet enough that the mix of all sources stays under full scale.
+		sources.push_back(std::make_unique<LoopingToneSource>(options.SampleRate, options.Channels, 220.0 * (i + 1), 0.5 / options.Sources));
+		AUDIO_GRAPH_SOURCE_OPTIONS sourceOptions;
+		sourceOptions.Gain = GetSourceGain(i);
+		UINT32 id;
+		hr = graph.AddSource(sources.back().get(), options.SampleRate, options.Channels, sourceOptions, &id);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		nodeIds.push_back(id);
+	}
+
+	bool isMixed = options.Layout != AudioTracksBenchmarkLayout::Separate;
+	bool isSeparate = options.Layout != AudioTracksBenchmarkLayout::Mixed;
+	std::vector<BENCHMARK_TRACK> tracks(isMixed ? 1 : 0);
+	if (isSeparate) {
+		for (UINT32 i = 0; i < options.Sources; i++) {
+			tracks.emplace_back();
+			tracks.back().Source = (int)i;
+		}
+	}
+	//A pass can deliver a frame more or less than a block, as the sources round to whole frames.
+	size_t maxSamples = ((size_t)options.BlockFrames + 1) * options.Channels;
+	for (BENCHMARK_TRACK &track : tracks) {
+		if (options.IsLimiterEnabled) {
+			hr = track.Limiter.Initialize(options.SampleRate, options.Channels, AUDIO_LIMITER_OPTIONS{}, options.Simd);
+			if (FAILED(hr)) {
+				return hr;
+			}
+		}
+		track.LimitedSamples.resize(maxSamples);
+		track.EncoderSamples.resize(maxSamples);
+	}
+	AudioSampleConverter converter;
+	converter.Initialize(true, options.Simd);
+	std::vector<AUDIO_GRAPH_OUTPUT> sourceOutputs(options.Sources);
+	std::vector<const float *> trackSamples(tracks.size());
+	std::vector<float> expectedMix(maxSamples);
+
+	const UINT64 blockDuration = (UINT64)options.BlockFrames * HundredNanosPerSecond / options.SampleRate;
+	const UINT64 blockDurationRemainder = (UINT64)options.BlockFrames * HundredNanosPerSecond % options.SampleRate;
+	UINT64 durationRemainder = 0;
+	double graphNanos = 0;
+	double convertNanos = 0;
+	UINT64 outputFrames = 0;
+	UINT64 warmHeapAllocations = 0;
+	for (size_t block = 0; block < blocks; block++) {
+		if (block == options.WarmupBlocks) {
+			warmHeapAllocations = GetHeapAllocationCount();
+		}
+		//Exactly one block of audio per pass, carrying the rounding over.
+		UINT64 duration = blockDuration;
+		durationRemainder += blockDurationRemainder;
+		if (durationRemainder >= options.SampleRate) {
+			duration++;
+			durationRemainder -= options.SampleRate;
+		}
+		auto start = std::chrono::steady_clock::now();
+		AUDIO_GRAPH_OUTPUT mix{};
+		if (!isSeparate) {
+			hr = graph.Process(duration, &mix);
+		}
+		else {
+			hr = graph.ProcessSources(duration, nodeIds.data(), nodeIds.size(), sourceOutputs.data(), isMixed ? &mix : nullptr);
+		}
+		graphNanos += ElapsedNanos(start);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		size_t sampleCount = isMixed ? mix.SampleCount : sourceOutputs[0].SampleCount;
+		if (sampleCount == 0) {
+			continue;
+		}
+		if (sampleCount > maxSamples) {
+			return E_UNEXPECTED;
+		}
+
+		//The same steps as AudioManager::ConvertTrackAudio, for every track.
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < tracks.size(); i++) {
+			BENCHMARK_TRACK &track = tracks[i];
+			const float *pSamples = track.Source < 0 ? mix.pSamples : sourceOutputs[track.Source].pSamples;
+			trackSamples[i] = pSamples;
+			if (options.IsLimiterEnabled) {
+				track.Limiter.Process(pSamples, track.LimitedSamples.data(), sampleCount);
+				pSamples = track.LimitedSamples.data();
+			}
+			converter.ConvertToInt16(pSamples, track.EncoderSamples.data(), sampleCount);
+		}
+		convertNanos += ElapsedNanos(start);
+
+		//The audio the graph handed each track is checked against the sources, untimed. The limiter delays it by its lookahead, so it is checked before limiting.
+		size_t frames = sampleCount / options.Channels;
+		for (size_t frame = 0; frame < frames; frame++) {
+			for (UINT32 channel = 0; channel < options.Channels; channel++) {
+				float sum = 0;
+				for (size_t source = 0; source < sources.size(); source++) {
+					sum += GetSourceGain(source) * sources[source]->GetSample(outputFrames + frame, channel);
+				}
+				expectedMix[frame * options.Channels + channel] = sum;
+			}
+		}
+		for (size_t i = 0; i < tracks.size(); i++) {
+			const BENCHMARK_TRACK &track = tracks[i];
+			for (size_t frame = 0; frame < frames; frame++) {
+				for (UINT32 channel = 0; channel < options.Channels; channel++) {
+					size_t sample = frame * options.Channels + channel;
+					float expected = track.Source < 0 ? expectedMix[sample] : GetSourceGain(track.Source) * sources[track.Source]->GetSample(outputFrames + frame, channel);
+					if (fabs(trackSamples[i][sample] - expected) > MismatchTolerance) {
+						(track.Source < 0 ? pResult->MixMismatchSamples : pResult->TrackMismatchSamples)++;
+					}
+				}
+			}
+		}
+		outputFrames += frames;
+	}
+	pResult->SteadyStateHeapAllocations = GetHeapAllocationCount() - warmHeapAllocations;
+	pResult->Tracks = (UINT32)tracks.size();
+	pResult->GraphNanosPerFrame = outputFrames > 0 ? graphNanos / outputFrames : 0;
+	pResult->ConvertNanosPerFrame = outputFrames > 0 ? convertNanos / outputFrames : 0;
+	return S_OK;
+}
+
+void PrintAudioTracksBenchmarkResult(_In_ const AUDIO_TRACKS_BENCHMARK_OPTIONS &options, _In_ const AUDIO_TRACKS_BENCHMARK_RESULT &result)
+{
+	printf("  %2u sources  %-20s %2u tracks   graph %7.2f ns/frame   %s %7.2f ns/frame   total %7.2f ns/frame   %llu allocations, %llu track and %llu mix mismatches\n",
+		options.Sources, GetLayoutName(options.Layout), result.Tracks, result.GraphNanosPerFrame, options.IsLimiterEnabled ? "limit+convert" : "convert      ", result.ConvertNanosPerFrame,
+		result.GraphNanosPerFrame + result.ConvertNanosPerFrame, (unsigned long long)result.SteadyStateHeapAllocations,
+		(unsigned long long)result.TrackMismatchSamples, (unsigned long long)result.MixMismatchSamples);
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include "Benchmark.h"
+#include "../ScreenRecorderLibNative/Simd.util.h"
+
+enum class AudioTracksBenchmarkLayout {
+	//All sources mixed to one track, as AudioManager does by default.
+	Mixed,
+	//A track per source, and nothing mixed.
+	Separate,
+	//The mixed track, followed by a track per source.
+	MixedAndSeparate
+};
+
+struct AUDIO_TRACKS_BENCHMARK_OPTIONS {
+	AudioTracksBenchmarkLayout Layout = AudioTracksBenchmarkLayout::Mixed;
+	//Sources recorded. Every other source is at half gain, so both the pass through and the gain path of a separate track are taken.
+	UINT32 Sources = 2;
+	double Seconds = 60;
+	UINT32 SampleRate = 48000;
+	UINT32 Channels = 2;
+	//Frames per pass, one audio writer packet.
+	UINT32 BlockFrames = 1024;
+	//Run each track through its own lookahead limiter before converting it, as AudioManager does by default.
+	bool IsLimiterEnabled = true;
+	//Passes left out of the allocation count, while the buffers grow to the block size.
+	UINT32 WarmupBlocks = 16;
+	SimdLevel Simd = SimdLevel::Auto;
+};
+
+struct AUDIO_TRACKS_BENCHMARK_RESULT {
+	UINT32 Tracks;
+	//Nanoseconds per output frame spent in the audio graph, i.e. reading, lining up and mixing or handing out the sources.
+	double GraphNanosPerFrame;
+	//Nanoseconds per output frame spent limiting and converting all tracks to 16 bit.
+	double ConvertNanosPerFrame;
+	//Heap allocations after warm up.
+	UINT64 SteadyStateHeapAllocations;
+	//Samples of a separate track that differ from its source with the gain applied, and samples of the mixed track that differ from the sum of the sources.
+	UINT64 TrackMismatchSamples;
+	UINT64 MixMismatchSamples;
+};
+
+/// <summary>
+/// Runs generated tones through an audio graph laid out as one mixed track, a track per source, or both, followed by the per track limiter and
+/// conversion, the same steps as AudioManager::GrabAudioTracks. Checks every track against the expected signal.
+/// </summary>
+HRESULT RunAudioTracksBenchmark(_In_ const AUDIO_TRACKS_BENCHMARK_OPTIONS &options, _Out_ AUDIO_TRACKS_BENCHMARK_RESULT *pResult);
+void PrintAudioTracksBenchmarkResult(_In_ const AUDIO_TRACKS_BENCHMARK_OPTIONS &options, _In_ const AUDIO_TRACKS_BENCHMARK_RESULT &result);
@@ -0,0 +1,104 @@
+#include "Benchmark.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+
+namespace {
+	std::atomic<uint64_t> HeapAllocationCount{ 0 };
+	std::atomic<uint64_t> HeapAllocatedBytes{ 0 };
+}
+
+void *operator new(std::size_t size)
+{
+	HeapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+	HeapAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	void *p = std::malloc(size ? size : 1);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+	HeapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+	HeapAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	return std::malloc(size ? size : 1);
+}
+
+void *operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &tag) noexcept
+{
+	return operator new(size, tag);
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+	std::free(p);
+}
+
+uint64_t GetHeapAllocationCount()
+{
+	return HeapAllocationCount.load(std::memory_order_relaxed);
+}
+
+uint64_t GetHeapAllocatedBytes()
+{
+	return HeapAllocatedBytes.load(std::memory_order_relaxed);
+}
+
+BENCHMARK_STATS ComputeBenchmarkStats(std::vector<double> &values)
+{
+	BENCHMARK_STATS stats{};
+	stats.Count = values.size();
+	if (values.empty()) {
+		return stats;
+	}
+	std::sort(values.begin(), values.end());
+	double sum = 0;
+	for (double value : values) {
+		sum += value;
+	}
+	stats.Mean = sum / values.size();
+	double sumOfSquares = 0;
+	for (double value : values) {
+		sumOfSquares += (value - stats.Mean) * (value - stats.Mean);
+	}
+	stats.StdDev = std::sqrt(sumOfSquares / values.size());
+	stats.Min = values.front();
+	stats.P50 = values[values.size() / 2];
+	stats.P99 = values[(std::min)(values.size() - 1, values.size() * 99 / 100)];
+	stats.Max = values.back();
+	return stats;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// <summary>
+/// Summary of a series of measurements, such as the time spent on each frame.
+/// </summary>
+struct BENCHMARK_STATS {
+	size_t Count;
+	double Mean;
+	double StdDev;
+	double Min;
+	double P50;
+	double P99;
+	double Max;
+};
+
+/// <summary>
+/// Computes the summary of a series of measurements. The series is sorted in place.
+/// </summary>
+BENCHMARK_STATS ComputeBenchmarkStats(std::vector<double> &values);
+
+/// <summary>
+/// The number of heap allocations made by the process so far, counted by the replaced global operator new of the benchmark executable.
+/// Allocations made by the benchmarked code while it should be running allocation free show up here, even if they bypass its own counters.
+/// </summary>
+uint64_t GetHeapAllocationCount();
+
+/// <summary>
+/// The number of bytes requested from the replaced global operator new so far. Memory freed again is not subtracted.
+/// </summary>
+uint64_t GetHeapAllocatedBytes();
+
+/// <summary>
+/// Nanoseconds elapsed since start.
+/// </summary>
+inline double ElapsedNanos(std::chrono::steady_clock::time_point start)
+{
+	return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
@@ -0,0 +1,359 @@
+#include "ChunkLatencyBenchmark.h"
+#include "MemoryStream.h"
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+	const INT64 HundredNanosPerSecond = 10000000;
+
+	/// <summary>
+	/// Releases the output stream on every way out of the benchmark.
+	/// </summary>
+	struct STREAM_HOLDER {
+		MemoryStream *pStream = nullptr;
+		~STREAM_HOLDER()
+		{
+			if (pStream) {
+				pStream->Release();
+			}
+		}
+	};
+
+	struct WRITTEN_CHUNK {
+		MP4_MUXER_CHUNK Chunk;
+		//When the muxer reported the chunk, on the recording clock.
+		INT64 WrittenPos;
+	};
+
+	/// <summary>
+	/// The chunks reported by the muxer on the thread writing the samples, waiting for the consumer.
+	/// </summary>
+	class ChunkQueue {
+	public:
+		void Push(_In_ const WRITTEN_CHUNK &chunk)
+		{
+			{
+				std::scoped_lock lock(m_Mutex);
+				m_Chunks.push_back(chunk);
+			}
+			m_Condition.notify_one();
+		}
+		void Close()
+		{
+			{
+				std::scoped_lock lock(m_Mutex);
+				m_IsClosed = true;
+			}
+			m_Condition.notify_one();
+		}
+		/// <summary>
+		/// Waits for the next chunk. Returns false once the queue is closed and empty.
+		/// </summary>
+		bool Pop(_Out_ WRITTEN_CHUNK *pChunk)
+		{
+			std::unique_lock lock(m_Mutex);
+			m_Condition.wait(lock, [&] { return !m_Chunks.empty() || m_IsClosed; });
+			if (m_Chunks.empty()) {
+				return false;
+			}
+			*pChunk = m_Chunks.front();
+			m_Chunks.pop_front();
+			return true;
+		}
+	private:
+		std::mutex m_Mutex;
+		std::condition_variable m_Condition;
+		std::deque<WRITTEN_CHUNK> m_Chunks;
+		bool m_IsClosed = false;
+	};
+
+	UINT32 ReadU32(_In_ const BYTE *p)
+	{
+		return ((UINT32)p[0] << 24) | ((UINT32)p[1] << 16) | ((UINT32)p[2] << 8) | p[3];
+	}
+
+	UINT64 ReadU64(_In_ const BYTE *p)
+	{
+		return ((UINT64)ReadU32(p) << 32) | ReadU32(p + 4);
+	}
+
+	/// <summary>
+	/// Finds the next box of the given type in [*pPos, end), and returns its body. Advances *pPos past it.
+	/// </summary>
+	bool FindBox(_In_ const BYTE *pData, _Inout_ size_t *pPos, _In_ size_t end, _In_ const char *type, _Out_ size_t *pBody, _Out_ size_t *pBodyEnd)
+	{
+		while (*pPos + 8 <= end) {
+			size_t size = ReadU32(pData + *pPos);
+			size_t header = 8;
+			if (size == 1 && *pPos + 16 <= end) {
+				size = (size_t)ReadU64(pData + *pPos + 8);
+				header = 16;
+			}
+			if (size < header || *pPos + size > end) {
+				return false;
+			}
+			size_t box = *pPos;
+			*pPos += size;
+			if (memcmp(pData + box + 4, type, 4) == 0) {
+				*pBody = box + header;
+				*pBodyEnd = box + size;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/// <summary>
+	/// Reads the timescale of every track, by track id, from the moov of the init segment.
+	/// </summary>
+	bool ReadTimescales(_In_ const BYTE *pData, _In_ size_t size, _Out_ std::vector<UINT32> *pTimescales)
+	{
+		pTimescales->clear();
+		size_t pos = 0, moov, moovEnd;
+		if (!FindBox(pData, &pos, size, "moov", &moov, &moovEnd)) {
+			return false;
+		}
+		size_t trak, trakEnd;
+		while (FindBox(pData, &moov, moovEnd, "trak", &trak, &trakEnd)) {
+			size_t tkhd, tkhdEnd, mdia, mdiaEnd, mdhd, mdhdEnd;
+			size_t tkhdPos = trak, mdiaPos = trak;
+			if (!FindBox(pData, &tkhdPos, trakEnd, "tkhd", &tkhd, &tkhdEnd) || !FindBox(pData, &mdiaPos, trakEnd, "mdia", &mdia, &mdiaEnd)
+				|| !FindBox(pData, &mdia, mdiaEnd, "mdhd", &mdhd, &mdhdEnd)) {
+				return false;
+			}
+			UINT32 trackId = ReadU32(pData + tkhd + 4 + (pData[tkhd] == 1 ? 16 : 8));
+			UINT32 timescale = ReadU32(pData + mdhd + 4 + (pData[mdhd] == 1 ? 16 : 8));
+			if (trackId == 0 || timescale == 0) {
+				return false;
+			}
+			if (pTimescales->size() <= trackId) {
+				pTimescales->resize(trackId + 1);
+			}
+			(*pTimescales)[trackId] = timescale;
+		}
+		return !pTimescales->empty();
+	}
+
+	/// <summary>
+	/// Reads the moof of a chunk as a consumer would, to learn the decode time of every sample in it, and checks it continues the chunk before.
+	/// </summary>
+	class ChunkReader {
+	public:
+		ChunkReader(_In_ size_t maxSamples)
+		{
+			m_LatencyMillis.reserve(maxSamples);
+		}
+		bool ReadInitSegment(_In_ const BYTE *pData, _In_ size_t size)
+		{
+			m_NextOffset = size;
+			if (!ReadTimescales(pData, size, &m_Timescales)) {
+				return false;
+			}
+			m_NextDecodeTimes.assign(m_Timescales.size(), -1);
+			return true;
+		}
+		/// <summary>
+		/// Reads a chunk, which the consumer has as of receivedPos on the recording clock. Returns false if it does not continue the chunks before.
+		/// </summary>
+		bool ReadChunk(_In_ const BYTE *pData, _In_ const MP4_MUXER_CHUNK &chunk, _In_ INT64 receivedPos)
+		{
+			bool isValid = chunk.Offset == m_NextOffset && chunk.SequenceNumber == m_NextSequenceNumber;
+			m_NextOffset = chunk.Offset + chunk.Bytes;
+			m_NextSequenceNumber = chunk.SequenceNumber + 1;
+			size_t pos = (size_t)chunk.Offset, end = (size_t)(chunk.Offset + chunk.Bytes);
+			size_t moof, moofEnd, mdat, mdatEnd;
+			if (!FindBox(pData, &pos, end, "moof", &moof, &moofEnd) || !FindBox(pData, &pos, end, "mdat", &mdat, &mdatEnd) || pos != end) {
+				return false;
+			}
+			size_t traf, trafEnd;
+			while (FindBox(pData, &moof, moofEnd, "traf", &traf, &trafEnd)) {
+				size_t tfhd, tfhdEnd, tfdt, tfdtEnd, trun, trunEnd;
+				size_t tfhdPos = traf, tfdtPos = traf, trunPos = traf;
+				if (!FindBox(pData, &tfhdPos, trafEnd, "tfhd", &tfhd, &tfhdEnd) || !FindBox(pData, &tfdtPos, trafEnd, "tfdt", &tfdt, &tfdtEnd)
+					|| !FindBox(pData, &trunPos, trafEnd, "trun", &trun, &trunEnd)) {
+					return false;
+				}
+				UINT32 tfhdFlags = ReadU32(pData + tfhd) & 0xFFFFFF;
+				UINT32 trackId = ReadU32(pData + tfhd + 4);
+				if (trackId >= m_Timescales.size() || m_Timescales[trackId] == 0) {
+					return false;
+				}
+				//The default sample duration comes after the base data offset and the sample description index, if they are there.
+				size_t defaultsPos = tfhd + 8 + ((tfhdFlags & 0x01) ? 8 : 0) + ((tfhdFlags & 0x02) ? 4 : 0);
+				UINT32 defaultDuration = (tfhdFlags & 0x08) ? ReadU32(pData + defaultsPos) : 0;
+				INT64 decodeTime = pData[tfdt] == 1 ? (INT64)ReadU64(pData + tfdt + 4) : ReadU32(pData + tfdt + 4);
+				if (m_NextDecodeTimes[trackId] >= 0 && decodeTime != m_NextDecodeTimes[trackId]) {
+					isValid = false;
+				}
+				UINT32 trunFlags = ReadU32(pData + trun) & 0xFFFFFF;
+				UINT32 sampleCount = ReadU32(pData + trun + 4);
+				size_t samplePos = trun + 8 + ((trunFlags & 0x01) ? 4 : 0) + ((trunFlags & 0x04) ? 4 : 0);
+				size_t sampleFieldBytes = 4 * (((trunFlags & 0x100) ? 1 : 0) + ((trunFlags & 0x200) ? 1 : 0) + ((trunFlags & 0x400) ? 1 : 0) + ((trunFlags & 0x800) ? 1 : 0));
+				if (samplePos + sampleFieldBytes * sampleCount > trunEnd) {
+					return false;
+				}
+				UINT32 timescale = m_Timescales[trackId];
+				for (UINT32 i = 0; i < sampleCount; i++) {
+					INT64 startPos = decodeTime * HundredNanosPerSecond / timescale;
+					m_LatencyMillis.push_back((receivedPos - startPos) / 10000.0);
+					decodeTime += (trunFlags & 0x100) ? ReadU32(pData + samplePos) : defaultDuration;
+					samplePos += sampleFieldBytes;
+				}
+				m_NextDecodeTimes[trackId] = decodeTime;
+			}
+			return isValid;
+		}
+		std::vector<double> &GetLatencyMillis() { return m_LatencyMillis; }
+	private:
+		std::vector<UINT32> m_Timescales;
+		std::vector<INT64> m_NextDecodeTimes;
+		std::vector<double> m_LatencyMillis;
+		UINT64 m_NextOffset = 0;
+		UINT32 m_NextSequenceNumber = 1;
+	};
+
+	INT64 Elapsed100Nanos(_In_ std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / 100;
+	}
+
+	/// <summary>
+	/// When an access unit is ready to be muxed: a video frame when it is captured, an audio packet when its last sample is.
+	/// </summary>
+	INT64 GetReadyPos(_In_ const ENCODED_STREAM &stream, _In_ const ENCODED_ACCESS_UNIT &unit)
+	{
+		return stream.Track.Codec == Mp4Codec::AAC ? unit.StartPos + unit.Duration : unit.StartPos;
+	}
+
+	/// <summary>
+	/// The number of access units of the stream that are ready within the recording length.
+	/// </summary>
+	size_t CountUnits(_In_opt_ const ENCODED_STREAM *pStream, _In_ INT64 endPos)
+	{
+		size_t count = 0;
+		while (pStream && count < pStream->Units.size() && GetReadyPos(*pStream, pStream->Units[count]) <= endPos) {
+			count++;
+		}
+		return count;
+	}
+}
+
+HRESULT RunChunkLatencyBenchmark(_In_ const CHUNK_LATENCY_BENCHMARK_OPTIONS &options, _Out_ CHUNK_LATENCY_BENCHMARK_RESULT *pResult)
+{
+	*pResult = CHUNK_LATENCY_BENCHMARK_RESULT{};
+	if (!options.pVideo || options.Seconds <= 0) {
+		return E_INVALIDARG;
+	}
+	STREAM_HOLDER output;
+	HRESULT hr = MemoryStream::CreateInstance(&output.pStream);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	//The memory is committed up front, so it does not move while the consumer reads the chunks straight out of it.
+	ULARGE_INTEGER expectedSize;
+	expectedSize.QuadPart = options.pVideo->Data.size() + (options.pAudio ? options.pAudio->Data.size() : 0) + 16 * 1024 * 1024;
+	hr = output.pStream->SetSize(expectedSize);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	const BYTE *pFile = output.pStream->GetData();
+
+	const INT64 endPos = (INT64)(options.Seconds * HundredNanosPerSecond);
+	const ENCODED_STREAM *streams[] = { options.pVideo, options.pAudio };
+	const size_t unitCounts[] = { CountUnits(options.pVideo, endPos), CountUnits(options.pAudio, endPos) };
+	ChunkQueue queue;
+	ChunkReader reader(unitCounts[0] + unitCounts[1]);
+	std::vector<double> deliveryMicros;
+	deliveryMicros.reserve(unitCounts[0] + 16);
+	auto start = std::chrono::steady_clock::now();
+
+	MP4_MUXER_OPTIONS muxerOptions = options.Muxer;
+	muxerOptions.OnChunkWritten = [&](const MP4_MUXER_CHUNK &chunk) {
+		queue.Push(WRITTEN_CHUNK{ chunk, Elapsed100Nanos(start) });
+	};
+	FragmentedMp4Muxer muxer;
+	hr = muxer.Initialize(output.pStream, muxerOptions);
+	UINT32 trackIndexes[2] = {};
+	for (int i = 0; i < 2 && SUCCEEDED(hr); i++) {
+		if (streams[i]) {
+			hr = muxer.AddTrack(streams[i]->Track, &trackIndexes[i]);
+		}
+	}
+	if (FAILED(hr)) {
+		return hr;
+	}
+
+	//The consumer reads every chunk as soon as it is reported, as a server pushing it to viewers would.
+	std::thread consumer([&]() {
+		WRITTEN_CHUNK written;
+		bool hasInitSegment = false;
+		while (queue.Pop(&written)) {
+			if (!hasInitSegment) {
+				hasInitSegment = true;
+				if (!reader.ReadInitSegment(pFile, (size_t)written.Chunk.Offset)) {
+					pResult->ChunkErrors++;
+				}
+			}
+			if (!reader.ReadChunk(pFile, written.Chunk, Elapsed100Nanos(start))) {
+				pResult->ChunkErrors++;
+			}
+			deliveryMicros.push_back((Elapsed100Nanos(start) - written.WrittenPos) / 10.0);
+			pResult->Chunks++;
+			pResult->FragmentStartChunks += written.Chunk.IsFragmentStart ? 1 : 0;
+			pResult->MaxChunkDurationMillis = (std::max)(pResult->MaxChunkDurationMillis, written.Chunk.Duration / 10000.0);
+		}
+	});
+
+	//Hands the access units over when they are ready, by the recording clock.
+	size_t next[2] = {};
+	while (SUCCEEDED(hr) && (next[0] < unitCounts[0] || next[1] < unitCounts[1])) {
+		int s = 0;
+		if (next[0] >= unitCounts[0]) {
+			s = 1;
+		}
+		else if (next[1] < unitCounts[1] && GetReadyPos(*streams[1], streams[1]->Units[next[1]]) < GetReadyPos(*streams[0], streams[0]->Units[next[0]])) {
+			s = 1;
+		}
+		const ENCODED_ACCESS_UNIT &accessUnit = streams[s]->Units[next[s]++];
+		std::this_thread::sleep_until(start + std::chrono::nanoseconds(GetReadyPos(*streams[s], accessUnit) * 100));
+		MP4_MUXER_SAMPLE sample;
+		sample.pData = streams[s]->Data.data() + accessUnit.Offset;
+		sample.Size = accessUnit.Size;
+		sample.StartPos = accessUnit.StartPos;
+		sample.DecodePos = accessUnit.StartPos;
+		sample.Duration = accessUnit.Duration;
+		sample.IsKeyFrame = accessUnit.IsKeyFrame;
+		hr = muxer.WriteSample(trackIndexes[s], sample);
+	}
+	if (SUCCEEDED(hr)) {
+		hr = muxer.Finalize();
+	}
+	queue.Close();
+	consumer.join();
+	if (FAILED(hr)) {
+		return hr;
+	}
+	MP4_MUXER_STATS stats = muxer.GetStats();
+	pResult->MuxedSamples = stats.Samples;
+	pResult->ReceivedSamples = reader.GetLatencyMillis().size();
+	pResult->SampleLatencyMillis = ComputeBenchmarkStats(reader.GetLatencyMillis());
+	pResult->DeliveryMicros = ComputeBenchmarkStats(deliveryMicros);
+	CheckFragmentedMp4(pFile, (size_t)stats.Writer.BytesWritten, &pResult->Check);
+	return S_OK;
+}
+
+void PrintChunkLatencyBenchmarkResult(_In_ const CHUNK_LATENCY_BENCHMARK_OPTIONS &options, _In_ const CHUNK_LATENCY_BENCHMARK_RESULT &result)
+{
+	printf("  %5.0f ms   %5.0f ms   %6llu / %-5llu  %6.1f ms     %6.1f / %6.1f / %6.1f ms     %6.1f / %7.1f us   %7llu / %-7llu  %s\n",
+		options.Muxer.FragmentDuration100Nanos / 10000.0, options.Muxer.ChunkDuration100Nanos / 10000.0,
+		(unsigned long long)result.Chunks, (unsigned long long)result.FragmentStartChunks, result.MaxChunkDurationMillis,
+		result.SampleLatencyMillis.P50, result.SampleLatencyMillis.P99, result.SampleLatencyMillis.Max,
+		result.DeliveryMicros.P50, result.DeliveryMicros.Max,
+		(unsigned long long)result.ReceivedSamples, (unsigned long long)result.MuxedSamples,
+		result.Check.Errors.empty() && result.ChunkErrors == 0 && result.ReceivedSamples == result.MuxedSamples ? "ok" : "FAILED");
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include "Benchmark.h"
+#include "EncodedStreams.h"
+#include "Mp4Checker.h"
+
+struct CHUNK_LATENCY_BENCHMARK_OPTIONS {
+	//The streams to mux, as the encoders would deliver them, paced by the clock. The video is needed, as chunks are cut on video frames.
+	const ENCODED_STREAM *pVideo = nullptr;
+	const ENCODED_STREAM *pAudio = nullptr;
+	//The fragment and chunk durations. OnChunkWritten is set by the benchmark.
+	MP4_MUXER_OPTIONS Muxer;
+	//Recording length. Runs in real time, as the samples are handed to the muxer when they would be captured.
+	double Seconds = 5;
+};
+
+struct CHUNK_LATENCY_BENCHMARK_RESULT {
+	UINT64 Chunks;
+	UINT64 FragmentStartChunks;
+	//The samples the consumer read out of the chunks, and the samples muxed. Should be equal.
+	UINT64 ReceivedSamples;
+	UINT64 MuxedSamples;
+	//The longest chunk, in milliseconds.
+	double MaxChunkDurationMillis;
+	//From the time a sample was captured to the consumer having read the chunk it is in, in milliseconds. This is the glass to consumer latency the muxer adds.
+	BENCHMARK_STATS SampleLatencyMillis;
+	//From the muxer reporting a chunk to the consumer having read it, in microseconds.
+	BENCHMARK_STATS DeliveryMicros;
+	//Chunks that do not follow the one before in the stream, with the next sequence number, or with decode times that continue each track. Should be zero.
+	UINT64 ChunkErrors;
+	//The file read back, box by box.
+	MP4_CHECK_RESULT Check;
+};
+
+/// <summary>
+/// Hands encoded streams to FragmentedMp4Muxer at the pace they would be captured, and reads every chunk the muxer reports on a consumer thread,
+/// as a live streaming server would, straight from the memory the muxer writes to. Reports how long after capture each sample reaches the consumer,
+/// and checks that the chunks tile the file and that the file is a conforming fragmented MP4.
+/// </summary>
+HRESULT RunChunkLatencyBenchmark(_In_ const CHUNK_LATENCY_BENCHMARK_OPTIONS &options, _Out_ CHUNK_LATENCY_BENCHMARK_RESULT *pResult);
+void PrintChunkLatencyBenchmarkResult(_In_ const CHUNK_LATENCY_BENCHMARK_OPTIONS &options, _In_ const CHUNK_LATENCY_BENCHMARK_RESULT &result);
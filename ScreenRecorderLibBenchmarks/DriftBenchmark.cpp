@@ -0,0 +1,102 @@
+#include "DriftBenchmark.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "../ScreenRecorderLibNative/SimulatedAudioSource.h"
+
+namespace {
+	const UINT64 HundredNanosPerSecond = 10000000;
+	//Shared mode device period. The capture thread wakes up twice per period.
+	const UINT64 DevicePeriod100Nanos = 100000;
+}
+
+HRESULT RunDriftBenchmark(_In_ const DRIFT_BENCHMARK_OPTIONS &options, _Out_ DRIFT_BENCHMARK_RESULT *pResult)
+{
+	*pResult = DRIFT_BENCHMARK_RESULT{};
+	if (options.Seconds <= 0 || options.FramesPerSecond == 0) {
+		return E_INVALIDARG;
+	}
+	SIMULATED_CAPTURE_OPTIONS deviceOptions;
+	deviceOptions.SampleRate = options.InputSampleRate;
+	deviceOptions.Channels = options.Channels;
+	deviceOptions.PacketDuration100Nanos = DevicePeriod100Nanos;
+	deviceOptions.DriftPpm = options.DriftPpm;
+	deviceOptions.Jitter100Nanos = options.Jitter100Nanos;
+	SyntheticAudioSource source;
+	HRESULT hr = source.Initialize(deviceOptions, SyntheticAudioSignal::Sine, 0.5f, 440.0f);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	AudioCaptureStream stream;
+	hr = stream.Initialize(options.InputSampleRate, options.Channels, options.OutputSampleRate, options.Channels, true, true, options.TargetBufferMillis);
+	if (FAILED(hr)) {
+		return hr;
+	}
+
+	const UINT64 endTime = (UINT64)(options.Seconds * HundredNanosPerSecond);
+	const UINT64 captureInterval = DevicePeriod100Nanos / 2;
+	const double targetMillis = options.TargetBufferMillis;
+	UINT64 nextCapture = captureInterval;
+	UINT64 frameNumber = 1;
+	UINT64 nextRead = HundredNanosPerSecond / options.FramesPerSecond;
+	UINT64 lastRead = 0;
+	UINT64 outputFrames = 0;
+	std::vector<BYTE> buffer;
+	pResult->MinBufferedMillis = targetMillis;
+	pResult->MaxBufferedMillis = 0;
+	pResult->ConvergenceSeconds = 0;
+	bool hasRead = false;
+	while (true) {
+		UINT64 now = (std::min)((std::min)(nextCapture, nextRead), endTime);
+		if (now == nextCapture) {
+			source.AdvanceClock(now - source.GetClock());
+			hr = stream.ReadPackets(&source);
+			if (FAILED(hr)) {
+				return hr;
+			}
+			nextCapture += captureInterval;
+		}
+		if (now == nextRead || now == endTime) {
+			buffer.clear();
+			stream.Read(now - lastRead, buffer);
+			outputFrames += buffer.size() / (options.Channels * sizeof(float));
+			lastRead = now;
+			frameNumber++;
+			nextRead = frameNumber * HundredNanosPerSecond / options.FramesPerSecond;
+
+			AUDIO_DRIFT_STATS stats = stream.GetDriftStats();
+			double seconds = (double)now / HundredNanosPerSecond;
+			double bufferedMillis = stats.BufferedSeconds * 1000;
+			//The fill starts from an empty buffer, so it is only taken once the first read found audio.
+			if (hasRead) {
+				pResult->MinBufferedMillis = (std::min)(pResult->MinBufferedMillis, bufferedMillis);
+				pResult->MaxBufferedMillis = (std::max)(pResult->MaxBufferedMillis, bufferedMillis);
+			}
+			hasRead = hasRead || outputFrames > 0;
+			if (seconds >= options.Seconds / 2) {
+				pResult->SettledFillErrorMillis = (std::max)(pResult->SettledFillErrorMillis, fabs(bufferedMillis - targetMillis));
+			}
+			if (fabs(stats.DriftPpm - options.DriftPpm) > options.TolerancePpm) {
+				pResult->ConvergenceSeconds = seconds;
+			}
+			//The audio read lags the media time by what is kept buffered and the resampler delay, and falls further behind only if the buffer runs dry.
+			double offsetMillis = (seconds - (double)outputFrames / options.OutputSampleRate) * 1000;
+			pResult->MaxOffsetMillis = (std::max)(pResult->MaxOffsetMillis, fabs(offsetMillis));
+			pResult->FinalOffsetMillis = offsetMillis;
+			pResult->FinalDriftPpm = stats.DriftPpm;
+		}
+		if (now == endTime) {
+			break;
+		}
+	}
+	pResult->ResyncFrames = stream.GetResyncFrames();
+	return S_OK;
+}
+
+void PrintDriftBenchmarkResult(_In_ const DRIFT_BENCHMARK_OPTIONS &options, _In_ const DRIFT_BENCHMARK_RESULT &result)
+{
+	printf("  %+6.0f ppm  %5u -> %-5u Hz  %4.1f ms jitter   estimate %+7.1f ppm, within %.0f ppm after %6.1f s   fill %5.1f to %5.1f ms, %5.2f ms off target when settled   offset %6.2f ms max, %6.2f ms at end   %llu resync frames\n",
+		options.DriftPpm, options.InputSampleRate, options.OutputSampleRate, options.Jitter100Nanos / 10000.0, result.FinalDriftPpm, options.TolerancePpm, result.ConvergenceSeconds,
+		result.MinBufferedMillis, result.MaxBufferedMillis, result.SettledFillErrorMillis, result.MaxOffsetMillis, result.FinalOffsetMillis, (unsigned long long)result.ResyncFrames);
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include "Benchmark.h"
+#include "../ScreenRecorderLibNative/AudioCaptureStream.h"
+
+struct DRIFT_BENCHMARK_OPTIONS {
+	//How much faster the device clock runs than the media clock, in parts per million.
+	double DriftPpm = 500;
+	UINT32 InputSampleRate = 48000;
+	UINT32 OutputSampleRate = 48000;
+	UINT32 Channels = 2;
+	UINT64 Jitter100Nanos = 0;
+	//Simulated recording length, and the video frame rate the audio is read at.
+	double Seconds = 600;
+	UINT32 FramesPerSecond = 30;
+	UINT32 TargetBufferMillis = AudioCaptureStream::DefaultTargetBufferMillis;
+	//The drift estimate counts as converged once it stays this close to the drift.
+	double TolerancePpm = 25;
+};
+
+struct DRIFT_BENCHMARK_RESULT {
+	double FinalDriftPpm;
+	//When the drift estimate last came within the tolerance, to stay there until the end. The length of the recording if it never did.
+	double ConvergenceSeconds;
+	//The smoothed buffer fill the estimator steers, over the whole recording, and its largest distance from the target over the second half.
+	double MinBufferedMillis;
+	double MaxBufferedMillis;
+	double SettledFillErrorMillis;
+	//How far the audio read ends up from the media time it was read for, at most and at the end. Grows if the buffer runs dry.
+	double MaxOffsetMillis;
+	double FinalOffsetMillis;
+	UINT64 ResyncFrames;
+};
+
+/// <summary>
+/// Captures a simulated device whose clock runs off the media clock, through an AudioCaptureStream with drift compensation, as LoopbackCapture does,
+/// and reads it at the video frame rate. Tracks how the drift estimate converges and where the buffer fill and the audio timeline go.
+/// </summary>
+HRESULT RunDriftBenchmark(_In_ const DRIFT_BENCHMARK_OPTIONS &options, _Out_ DRIFT_BENCHMARK_RESULT *pResult);
+void PrintDriftBenchmarkResult(_In_ const DRIFT_BENCHMARK_OPTIONS &options, _In_ const DRIFT_BENCHMARK_RESULT &result);
@@ -0,0 +1,404 @@
+#include "EncodedStreams.h"
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+namespace {
+	const INT64 HundredNanosPerSecond = 10000000;
+	const UINT32 AacFrameSamples = 1024;
+	const UINT32 AdtsSampleRates[] = { 96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350 };
+
+	//The parameter sets of a 1920x1080 encode by x264 and x265.
+	const BYTE H264Sps[] = { 0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40, 0x78, 0x02, 0x27, 0xe5, 0x84, 0x00, 0x00, 0x03, 0x00, 0x04, 0x00, 0x00, 0x03, 0x00, 0xf0, 0x3c, 0x60, 0xc6, 0x58 };
+	const BYTE H264Pps[] = { 0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0 };
+	const BYTE HevcVps[] = { 0x40, 0x01, 0x0c, 0x01, 0xff, 0xff, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00, 0x90, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x78, 0x95, 0x98, 0x09 };
+	const BYTE HevcSps[] = { 0x42, 0x01, 0x01, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00, 0x90, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x78, 0xa0, 0x03, 0xc0, 0x80, 0x10, 0xe5, 0x96, 0x56, 0x69, 0x24, 0xca, 0xe6, 0x80, 0x80, 0x00, 0x00, 0x03, 0x00, 0x80, 0x00, 0x00, 0x0f, 0x04 };
+	const BYTE HevcPps[] = { 0x44, 0x01, 0xc1, 0x72, 0xb4, 0x62, 0x40 };
+	const BYTE StartCode[] = { 0x00, 0x00, 0x00, 0x01 };
+
+	/// <summary>
+	/// Fills with pseudo random bytes that are never 0, so the filler can not contain a start code.
+	/// </summary>
+	class FillerGenerator {
+	public:
+		void Append(_Inout_ std::vector<BYTE> &data, _In_ size_t count)
+		{
+			for (size_t i = 0; i < count; i++) {
+				m_State = m_State * 6364136223846793005ULL + 1442695040888963407ULL;
+				data.push_back((BYTE)((m_State >> 56) % 255 + 1));
+			}
+		}
+	private:
+		UINT64 m_State = 1;
+	};
+
+	void AppendNalUnit(_Inout_ std::vector<BYTE> &data, _In_reads_bytes_(size) const BYTE *pNal, _In_ size_t size)
+	{
+		data.insert(data.end(), StartCode, StartCode + sizeof(StartCode));
+		data.insert(data.end(), pNal, pNal + size);
+	}
+
+	INT64 FrameStartPos(_In_ UINT64 frame, _In_ UINT32 framesPerSecond)
+	{
+		return (INT64)(frame * HundredNanosPerSecond / framesPerSecond);
+	}
+
+	HRESULT ReadFile(_In_ const std::wstring &path, _Out_ std::vector<BYTE> *pData)
+	{
+		std::ifstream file(std::filesystem::path(path), std::ios::binary);
+		if (!file) {
+			return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+		}
+		pData->assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		return S_OK;
+	}
+
+	/// <summary>
+	/// Reads the frame size from the SPS, after its Exp-Golomb fields. Only what the benchmark streams use is handled: no scaling lists, and frame cropping.
+	/// </summary>
+	class SpsReader {
+	public:
+		SpsReader(_In_reads_bytes_(size) const BYTE *pNal, _In_ size_t size)
+		{
+			int zeros = 0;
+			for (size_t i = 0; i < size; i++) {
+				if (zeros >= 2 && pNal[i] == 3) {
+					zeros = 0;
+					continue;
+				}
+				zeros = pNal[i] == 0 ? zeros + 1 : 0;
+				m_Rbsp.push_back(pNal[i]);
+			}
+		}
+		UINT32 Bit()
+		{
+			if (m_Bit >= m_Rbsp.size() * 8) {
+				return 0;
+			}
+			UINT32 bit = (m_Rbsp[m_Bit / 8] >> (7 - m_Bit % 8)) & 1;
+			m_Bit++;
+			return bit;
+		}
+		UINT32 Bits(_In_ int count)
+		{
+			UINT32 value = 0;
+			for (int i = 0; i < count; i++) {
+				value = (value << 1) | Bit();
+			}
+			return value;
+		}
+		UINT32 Golomb()
+		{
+			int zeros = 0;
+			while (Bit() == 0 && zeros < 31 && m_Bit < m_Rbsp.size() * 8) {
+				zeros++;
+			}
+			return ((1u << zeros) - 1) + Bits(zeros);
+		}
+		void Seek(_In_ size_t bit) { m_Bit = bit; }
+		const std::vector<BYTE> &GetRbsp() const { return m_Rbsp; }
+	private:
+		std::vector<BYTE> m_Rbsp;
+		size_t m_Bit = 0;
+	};
+
+	void ReadH264FrameSize(_In_reads_bytes_(size) const BYTE *pSps, _In_ size_t size, _Out_ UINT32 *pWidth, _Out_ UINT32 *pHeight)
+	{
+		SpsReader reader(pSps, size);
+		BYTE profile = reader.GetRbsp().size() > 1 ? reader.GetRbsp()[1] : 0;
+		reader.Seek(32);
+		reader.Golomb();
+		UINT32 chromaFormat = 1;
+		if (profile == 100 || profile == 110 || profile == 122 || profile == 244 || profile == 44 || profile == 83 || profile == 86 || profile == 118 || profile == 128) {
+			chromaFormat = reader.Golomb();
+			if (chromaFormat == 3) {
+				reader.Bit();
+			}
+			reader.Golomb();
+			reader.Golomb();
+			reader.Bit();
+			reader.Bit();
+		}
+		reader.Golomb();
+		UINT32 pocType = reader.Golomb();
+		if (pocType == 0) {
+			reader.Golomb();
+		}
+		else if (pocType == 1) {
+			reader.Bit();
+			reader.Golomb();
+			reader.Golomb();
+			UINT32 cycle = reader.Golomb();
+			for (UINT32 i = 0; i < cycle; i++) {
+				reader.Golomb();
+			}
+		}
+		reader.Golomb();
+		reader.Bit();
+		UINT32 widthInMbs = reader.Golomb() + 1;
+		UINT32 heightInMapUnits = reader.Golomb() + 1;
+		UINT32 frameMbsOnly = reader.Bit();
+		if (!frameMbsOnly) {
+			reader.Bit();
+		}
+		reader.Bit();
+		UINT32 cropLeft = 0, cropRight = 0, cropTop = 0, cropBottom = 0;
+		if (reader.Bit()) {
+			cropLeft = reader.Golomb();
+			cropRight = reader.Golomb();
+			cropTop = reader.Golomb();
+			cropBottom = reader.Golomb();
+		}
+		UINT32 cropUnitX = chromaFormat == 0 || chromaFormat == 3 ? 1 : 2;
+		UINT32 cropUnitY = (chromaFormat == 1 ? 2 : 1) * (2 - frameMbsOnly);
+		*pWidth = widthInMbs * 16 - cropUnitX * (cropLeft + cropRight);
+		*pHeight = heightInMapUnits * 16 * (2 - frameMbsOnly) - cropUnitY * (cropTop + cropBottom);
+	}
+
+	void ReadHevcFrameSize(_In_reads_bytes_(size) const BYTE *pSps, _In_ size_t size, _Out_ UINT32 *pWidth, _Out_ UINT32 *pHeight)
+	{
+		SpsReader reader(pSps, size);
+		UINT32 maxSubLayersMinus1 = reader.GetRbsp().size() > 2 ? (reader.GetRbsp()[2] >> 1) & 7 : 0;
+		reader.Seek(15 * 8);
+		UINT32 skipBits = 0;
+		bool isProfilePresent[8] = {};
+		bool isLevelPresent[8] = {};
+		for (UINT32 i = 0; i < maxSubLayersMinus1; i++) {
+			isProfilePresent[i] = reader.Bit() != 0;
+			isLevelPresent[i] = reader.Bit() != 0;
+		}
+		if (maxSubLayersMinus1 > 0) {
+			skipBits += 2 * (8 - maxSubLayersMinus1);
+		}
+		for (UINT32 i = 0; i < maxSubLayersMinus1; i++) {
+			skipBits += (isProfilePresent[i] ? 88 : 0) + (isLevelPresent[i] ? 8 : 0);
+		}
+		for (UINT32 i = 0; i < skipBits; i++) {
+			reader.Bit();
+		}
+		reader.Golomb();
+		UINT32 chromaFormat = reader.Golomb();
+		if (chromaFormat == 3) {
+			reader.Bit();
+		}
+		UINT32 width = reader.Golomb();
+		UINT32 height = reader.Golomb();
+		if (reader.Bit()) {
+			UINT32 unitX = chromaFormat == 1 || chromaFormat == 2 ? 2 : 1;
+			UINT32 unitY = chromaFormat == 1 ? 2 : 1;
+			UINT32 left = reader.Golomb(), right = reader.Golomb(), top = reader.Golomb(), bottom = reader.Golomb();
+			width -= unitX * (left + right);
+			height -= unitY * (top + bottom);
+		}
+		*pWidth = width;
+		*pHeight = height;
+	}
+}
+
+HRESULT CreateSyntheticVideoStream(_In_ Mp4Codec codec, _In_ UINT32 framesPerSecond, _In_ UINT32 keyFrameInterval, _In_ UINT32 bitrate, _In_ double seconds, _Out_ ENCODED_STREAM *pStream)
+{
+	*pStream = ENCODED_STREAM{};
+	if (codec == Mp4Codec::AAC || framesPerSecond == 0 || keyFrameInterval == 0 || seconds <= 0) {
+		return E_INVALIDARG;
+	}
+	pStream->Track.Codec = codec;
+	pStream->Track.Width = 1920;
+	pStream->Track.Height = 1080;
+	pStream->Track.Bitrate = bitrate;
+	UINT64 frameCount = (UINT64)(seconds * framesPerSecond);
+	//Keyframes take a few times the bytes of the frames in between, as with a screen that barely changes.
+	const UINT32 KeyFrameWeight = 8;
+	UINT64 bytesPerInterval = (UINT64)bitrate / 8 * keyFrameInterval / framesPerSecond;
+	UINT32 frameBytes = (UINT32)(std::max)(bytesPerInterval / (keyFrameInterval - 1 + KeyFrameWeight), (UINT64)16);
+	pStream->Data.reserve((size_t)(frameCount * (frameBytes + 64) + bytesPerInterval));
+	pStream->Units.reserve((size_t)frameCount);
+	FillerGenerator filler;
+	bool isHevc = codec == Mp4Codec::HEVC;
+	for (UINT64 frame = 0; frame < frameCount; frame++) {
+		ENCODED_ACCESS_UNIT unit;
+		unit.Offset = pStream->Data.size();
+		unit.IsKeyFrame = frame % keyFrameInterval == 0;
+		unit.StartPos = FrameStartPos(frame, framesPerSecond);
+		unit.Duration = FrameStartPos(frame + 1, framesPerSecond) - unit.StartPos;
+		//An access unit delimiter, then the parameter sets in front of a keyframe, and a single slice.
+		if (isHevc) {
+			const BYTE aud[] = { 35 << 1, 0x01, 0x50 };
+			AppendNalUnit(pStream->Data, aud, sizeof(aud));
+			if (unit.IsKeyFrame) {
+				AppendNalUnit(pStream->Data, HevcVps, sizeof(HevcVps));
+				AppendNalUnit(pStream->Data, HevcSps, sizeof(HevcSps));
+				AppendNalUnit(pStream->Data, HevcPps, sizeof(HevcPps));
+			}
+			//IDR_W_RADL or TRAIL_R, with the first slice segment flag set.
+			const BYTE slice[] = { (BYTE)((unit.IsKeyFrame ? 19 : 1) << 1), 0x01, 0x80 };
+			AppendNalUnit(pStream->Data, slice, sizeof(slice));
+		}
+		else {
+			const BYTE aud[] = { 0x09, 0xF0 };
+			AppendNalUnit(pStream->Data, aud, sizeof(aud));
+			if (unit.IsKeyFrame) {
+				AppendNalUnit(pStream->Data, H264Sps, sizeof(H264Sps));
+				AppendNalUnit(pStream->Data, H264Pps, sizeof(H264Pps));
+			}
+			const BYTE slice[] = { (BYTE)(unit.IsKeyFrame ? 0x65 : 0x41), 0x88 };
+			AppendNalUnit(pStream->Data, slice, sizeof(slice));
+		}
+		filler.Append(pStream->Data, unit.IsKeyFrame ? (size_t)frameBytes * KeyFrameWeight : frameBytes);
+		unit.Size = (UINT32)(pStream->Data.size() - unit.Offset);
+		pStream->Units.push_back(unit);
+	}
+	return S_OK;
+}
+
+HRESULT CreateSyntheticAudioStream(_In_ UINT32 sampleRate, _In_ UINT32 channels, _In_ UINT32 bitrate, _In_ double seconds, _Out_ ENCODED_STREAM *pStream)
+{
+	*pStream = ENCODED_STREAM{};
+	if (sampleRate == 0 || channels == 0 || seconds <= 0) {
+		return E_INVALIDARG;
+	}
+	pStream->Track.Codec = Mp4Codec::AAC;
+	pStream->Track.SampleRate = sampleRate;
+	pStream->Track.Channels = channels;
+	pStream->Track.Bitrate = bitrate;
+	UINT64 frameCount = (UINT64)(seconds * sampleRate / AacFrameSamples);
+	UINT32 frameBytes = (UINT32)(std::max)((UINT64)bitrate / 8 * AacFrameSamples / sampleRate, (UINT64)8);
+	pStream->Data.reserve((size_t)(frameCount * frameBytes));
+	pStream->Units.reserve((size_t)frameCount);
+	FillerGenerator filler;
+	for (UINT64 frame = 0; frame < frameCount; frame++) {
+		ENCODED_ACCESS_UNIT unit;
+		unit.Offset = pStream->Data.size();
+		unit.Size = frameBytes;
+		unit.IsKeyFrame = true;
+		unit.StartPos = (INT64)(frame * AacFrameSamples * HundredNanosPerSecond / sampleRate);
+		unit.Duration = (INT64)((frame + 1) * AacFrameSamples * HundredNanosPerSecond / sampleRate) - unit.StartPos;
+		filler.Append(pStream->Data, frameBytes);
+		pStream->Units.push_back(unit);
+	}
+	return S_OK;
+}
+
+HRESULT ReadAnnexBStream(_In_ const std::wstring &path, _In_ Mp4Codec codec, _In_ UINT32 framesPerSecond, _Out_ ENCODED_STREAM *pStream)
+{
+	*pStream = ENCODED_STREAM{};
+	if (codec == Mp4Codec::AAC || framesPerSecond == 0) {
+		return E_INVALIDARG;
+	}
+	HRESULT hr = ReadFile(path, &pStream->Data);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	pStream->Track.Codec = codec;
+	bool isHevc = codec == Mp4Codec::HEVC;
+	const std::vector<BYTE> &data = pStream->Data;
+	//Splits the stream where an access unit starts: at a delimiter, parameter set or SEI after the slices of a picture, or at the first slice of the next picture.
+	bool hasSlice = false;
+	bool isKeyFrame = false;
+	size_t unitStart = 0;
+	auto EndUnit = [&](size_t end) {
+		if (hasSlice) {
+			UINT64 frame = pStream->Units.size();
+			ENCODED_ACCESS_UNIT unit;
+			unit.Offset = unitStart;
+			unit.Size = (UINT32)(end - unitStart);
+			unit.IsKeyFrame = isKeyFrame;
+			unit.StartPos = FrameStartPos(frame, framesPerSecond);
+			unit.Duration = FrameStartPos(frame + 1, framesPerSecond) - unit.StartPos;
+			pStream->Units.push_back(unit);
+			unitStart = end;
+		}
+		hasSlice = false;
+		isKeyFrame = false;
+	};
+	size_t i = 0;
+	while (i + 3 < data.size()) {
+		if (!(data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)) {
+			i++;
+			continue;
+		}
+		size_t startCode = i > 0 && data[i - 1] == 0 ? i - 1 : i;
+		const BYTE *pNal = &data[i + 3];
+		size_t remaining = data.size() - (i + 3);
+		BYTE type = isHevc ? (pNal[0] >> 1) & 0x3F : pNal[0] & 0x1F;
+		bool isSlice = isHevc ? type < 32 : type >= 1 && type <= 5;
+		bool isFirstSlice = isSlice && remaining > (size_t)(isHevc ? 2 : 1) && (pNal[isHevc ? 2 : 1] & 0x80) != 0;
+		bool isUnitHeader = isHevc ? type >= 32 && type <= 39 : type >= 6 && type <= 9;
+		if ((isUnitHeader || isFirstSlice) && hasSlice) {
+			EndUnit(startCode);
+		}
+		if (pStream->Units.empty() && !hasSlice && unitStart > startCode) {
+			unitStart = startCode;
+		}
+		if (isSlice) {
+			hasSlice = true;
+			isKeyFrame |= isHevc ? type >= 16 && type <= 23 : type == 5;
+		}
+		if (!pStream->Track.Width && type == (isHevc ? 33 : 7)) {
+			if (isHevc) {
+				ReadHevcFrameSize(pNal, remaining, &pStream->Track.Width, &pStream->Track.Height);
+			}
+			else {
+				ReadH264FrameSize(pNal, remaining, &pStream->Track.Width, &pStream->Track.Height);
+			}
+		}
+		i += 3;
+	}
+	EndUnit(data.size());
+	if (pStream->Units.empty() || pStream->Track.Width == 0 || pStream->Track.Height == 0) {
+		return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+	}
+	return S_OK;
+}
+
+HRESULT ReadAdtsStream(_In_ const std::wstring &path, _Out_ ENCODED_STREAM *pStream)
+{
+	*pStream = ENCODED_STREAM{};
+	std::vector<BYTE> file;
+	HRESULT hr = ReadFile(path, &file);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	pStream->Track.Codec = Mp4Codec::AAC;
+	pStream->Data.reserve(file.size());
+	size_t position = 0;
+	while (position + 7 <= file.size()) {
+		const BYTE *pHeader = &file[position];
+		if (pHeader[0] != 0xFF || (pHeader[1] & 0xF0) != 0xF0) {
+			return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+		}
+		bool hasCrc = (pHeader[1] & 1) == 0;
+		UINT32 objectType = (pHeader[2] >> 6) + 1;
+		UINT32 frequencyIndex = (pHeader[2] >> 2) & 0xF;
+		UINT32 channels = ((pHeader[2] & 1) << 2) | (pHeader[3] >> 6);
+		UINT32 frameLength = ((pHeader[3] & 3) << 11) | (pHeader[4] << 3) | (pHeader[5] >> 5);
+		UINT32 headerLength = hasCrc ? 9 : 7;
+		if (frequencyIndex >= ARRAYSIZE(AdtsSampleRates) || frameLength <= headerLength || position + frameLength > file.size()) {
+			return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+		}
+		if (pStream->Units.empty()) {
+			pStream->Track.SampleRate = AdtsSampleRates[frequencyIndex];
+			pStream->Track.Channels = channels == 7 ? 8 : channels;
+			//The AudioSpecificConfig of the stream, from the object type, sample rate and channels in the header.
+			pStream->Track.CodecPrivateData = { (BYTE)((objectType << 3) | (frequencyIndex >> 1)), (BYTE)(((frequencyIndex & 1) << 7) | (channels << 3)) };
+		}
+		UINT64 frame = pStream->Units.size();
+		ENCODED_ACCESS_UNIT unit;
+		unit.Offset = pStream->Data.size();
+		unit.Size = frameLength - headerLength;
+		unit.IsKeyFrame = true;
+		unit.StartPos = (INT64)(frame * AacFrameSamples * HundredNanosPerSecond / pStream->Track.SampleRate);
+		unit.Duration = (INT64)((frame + 1) * AacFrameSamples * HundredNanosPerSecond / pStream->Track.SampleRate) - unit.StartPos;
+		pStream->Data.insert(pStream->Data.end(), pHeader + headerLength, pHeader + frameLength);
+		pStream->Units.push_back(unit);
+		position += frameLength;
+	}
+	if (pStream->Units.empty()) {
+		return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+	}
+	return S_OK;
+}
+
+INT64 GetStreamEndPos(_In_ const ENCODED_STREAM &stream)
+{
+	return stream.Units.empty() ? 0 : stream.Units.back().StartPos + stream.Units.back().Duration;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include <string>
+#include <vector>
+#include "../ScreenRecorderLibNative/FragmentedMp4Muxer.h"
+
+struct ENCODED_ACCESS_UNIT {
+	//Where the access unit is in ENCODED_STREAM::Data.
+	size_t Offset;
+	UINT32 Size;
+	//The presentation time and duration, in 100 nanosecond units. The streams have no reordered frames, so this is the decode time too.
+	INT64 StartPos;
+	INT64 Duration;
+	bool IsKeyFrame;
+};
+
+/// <summary>
+/// An elementary stream split into access units, as an encoder delivers them: Annex B for video, raw AAC for audio.
+/// </summary>
+struct ENCODED_STREAM {
+	MP4_MUXER_TRACK Track;
+	std::vector<BYTE> Data;
+	std::vector<ENCODED_ACCESS_UNIT> Units;
+};
+
+/// <summary>
+/// Makes a video stream of the given bitrate, with a keyframe every keyFrameInterval frames. The parameter sets are those of a real 1080p encode,
+/// in front of every keyframe as the Media Foundation encoders put them. The slices are filler of the right NAL types, so the stream can be muxed but not decoded.
+/// </summary>
+HRESULT CreateSyntheticVideoStream(_In_ Mp4Codec codec, _In_ UINT32 framesPerSecond, _In_ UINT32 keyFrameInterval, _In_ UINT32 bitrate, _In_ double seconds, _Out_ ENCODED_STREAM *pStream);
+/// <summary>
+/// Makes an AAC stream of frames of 1024 samples, of filler of the given bitrate.
+/// </summary>
+HRESULT CreateSyntheticAudioStream(_In_ UINT32 sampleRate, _In_ UINT32 channels, _In_ UINT32 bitrate, _In_ double seconds, _Out_ ENCODED_STREAM *pStream);
+/// <summary>
+/// Reads an H.264 or HEVC elementary stream in Annex B format, e.g. a .h264 or .hevc file written by ffmpeg, and splits it into access units.
+/// The frames must be in presentation order, i.e. encoded without B-frames, and are timed at the given frame rate. The frame size is read from the SPS.
+/// </summary>
+HRESULT ReadAnnexBStream(_In_ const std::wstring &path, _In_ Mp4Codec codec, _In_ UINT32 framesPerSecond, _Out_ ENCODED_STREAM *pStream);
+/// <summary>
+/// Reads an AAC stream in ADTS format, e.g. an .aac file, into raw access units of 1024 samples.
+/// </summary>
+HRESULT ReadAdtsStream(_In_ const std::wstring &path, _Out_ ENCODED_STREAM *pStream);
+/// <summary>
+/// The time the last access unit of the stream ends, in 100 nanosecond units.
+/// </summary>
+INT64 GetStreamEndPos(_In_ const ENCODED_STREAM &stream);
@@ -0,0 +1,186 @@
+#include "FrameQueueBenchmark.h"
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace {
+	const INT64 HundredNanosPerSecond = 10000000;
+
+	struct WRITTEN_FRAME {
+		//The frame number of the capture, from the payload of the slot.
+		UINT64 FrameNumber;
+		INT64 StartPos;
+		INT64 Duration;
+	};
+
+	/// <summary>
+	/// Stands in for the encoder: takes its time on a frame, and stalls on the first frame of each stall interval.
+	/// </summary>
+	class SimulatedEncoder {
+	public:
+		SimulatedEncoder(_In_ const FRAME_QUEUE_BENCHMARK_OPTIONS &options, _In_ size_t maxFrames) :
+			m_Options(options),
+			m_NextStall100Nanos((INT64)(options.StallIntervalSeconds * HundredNanosPerSecond))
+		{
+			m_Written.reserve(maxFrames);
+		}
+		void Encode(_In_ UINT64 frameNumber, _In_ INT64 startPos, _In_ INT64 duration)
+		{
+			double millis = m_Options.EncodeMillis;
+			if (m_Options.StallMillis > 0 && m_Options.StallIntervalSeconds > 0 && startPos >= m_NextStall100Nanos) {
+				millis = m_Options.StallMillis;
+				m_NextStall100Nanos += (INT64)(m_Options.StallIntervalSeconds * HundredNanosPerSecond);
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds((INT64)(millis * 1000)));
+			m_Written.push_back(WRITTEN_FRAME{ frameNumber, startPos, duration });
+		}
+		const std::vector<WRITTEN_FRAME> &GetWritten() const { return m_Written; }
+	private:
+		const FRAME_QUEUE_BENCHMARK_OPTIONS &m_Options;
+		INT64 m_NextStall100Nanos;
+		std::vector<WRITTEN_FRAME> m_Written;
+	};
+
+	INT64 Elapsed100Nanos(_In_ std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / 100;
+	}
+
+	const char *GetPolicyName(_In_ FrameQueueFullPolicy policy)
+	{
+		switch (policy)
+		{
+		case FrameQueueFullPolicy::DropOldest:
+			return "drop oldest";
+		case FrameQueueFullPolicy::DropNewest:
+			return "drop newest";
+		default:
+			return "block";
+		}
+	}
+}
+
+HRESULT RunFrameQueueBenchmark(_In_ const FRAME_QUEUE_BENCHMARK_OPTIONS &options, _Out_ FRAME_QUEUE_BENCHMARK_RESULT *pResult)
+{
+	*pResult = FRAME_QUEUE_BENCHMARK_RESULT{};
+	if (options.FramesPerSecond == 0 || options.Seconds <= 0) {
+		return E_INVALIDARG;
+	}
+	const INT64 frameInterval100Nanos = HundredNanosPerSecond / options.FramesPerSecond;
+	const UINT64 frameCount = (UINT64)(options.Seconds * options.FramesPerSecond);
+	SimulatedEncoder encoder(options, (size_t)frameCount);
+	std::vector<double> handOverMillis;
+	std::vector<double> captureIntervalMillis;
+	handOverMillis.reserve((size_t)frameCount);
+	captureIntervalMillis.reserve((size_t)frameCount);
+
+	//The pooled frames, here just the number of the frame copied into each slot.
+	VideoFrameQueue queue;
+	std::vector<UINT64> slots;
+	std::thread writer;
+	std::atomic<bool> isStopping(false);
+	if (options.QueueLength > 0) {
+		HRESULT hr = queue.Initialize(options.QueueLength, options.Policy);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		slots.resize(queue.GetSlotCount());
+		writer = std::thread([&]() {
+			VIDEO_FRAME_QUEUE_ENTRY entry;
+			while (true) {
+				if (!queue.Pop(100, &entry)) {
+					if (isStopping) {
+						break;
+					}
+					continue;
+				}
+				encoder.Encode(slots[entry.Slot], entry.StartPos, entry.Duration);
+				queue.ReleaseSlot(entry.Slot);
+			}
+		});
+	}
+
+	//Paced like RecordingManager::StartRecorderLoop: a frame is taken once its interval has passed, and lasts from the end of the last frame until now.
+	auto start = std::chrono::steady_clock::now();
+	INT64 lastFrameStartPos = 0;
+	INT64 lastCapture = 0;
+	UINT64 warmHeapAllocations = 0;
+	for (UINT64 frame = 0; frame < frameCount; frame++) {
+		if (frame == options.WarmupFrames) {
+			warmHeapAllocations = GetHeapAllocationCount();
+		}
+		INT64 now = Elapsed100Nanos(start);
+		INT64 wait = lastFrameStartPos + frameInterval100Nanos - now;
+		if (wait > 0) {
+			std::this_thread::sleep_for(std::chrono::nanoseconds(wait * 100));
+			now = Elapsed100Nanos(start);
+		}
+		if (frame > 0) {
+			captureIntervalMillis.push_back((double)(now - lastCapture) / 10000);
+		}
+		lastCapture = now;
+		INT64 duration = frame == 0 ? frameInterval100Nanos : now - lastFrameStartPos;
+		auto handOverStart = std::chrono::steady_clock::now();
+		if (options.QueueLength == 0) {
+			encoder.Encode(frame, lastFrameStartPos, duration);
+		}
+		else {
+			UINT32 slot;
+			HRESULT hr = queue.AcquireSlot(lastFrameStartPos, duration, &slot);
+			if (FAILED(hr)) {
+				isStopping = true;
+				queue.Stop();
+				writer.join();
+				return hr;
+			}
+			if (hr == S_OK) {
+				slots[slot] = frame;
+				queue.Push(VIDEO_FRAME_QUEUE_ENTRY{ slot, lastFrameStartPos, duration });
+			}
+		}
+		handOverMillis.push_back(ElapsedNanos(handOverStart) / 1e6);
+		lastFrameStartPos += duration;
+	}
+	pResult->SteadyStateHeapAllocations = GetHeapAllocationCount() - warmHeapAllocations;
+	if (writer.joinable()) {
+		isStopping = true;
+		queue.Stop();
+		writer.join();
+		VIDEO_FRAME_QUEUE_STATS stats = queue.GetStats();
+		pResult->DroppedFrames = stats.DroppedOldestFrames + stats.DroppedNewestFrames;
+		pResult->MaxDepth = stats.MaxDepth;
+	}
+
+	const std::vector<WRITTEN_FRAME> &written = encoder.GetWritten();
+	INT64 expectedStartPos = 0;
+	for (size_t i = 0; i < written.size(); i++) {
+		if (written[i].StartPos != expectedStartPos
+			|| written[i].Duration <= 0
+			|| (i > 0 && written[i].FrameNumber <= written[i - 1].FrameNumber)) {
+			pResult->TimelineErrors++;
+		}
+		expectedStartPos = written[i].StartPos + written[i].Duration;
+	}
+	pResult->TimelineEndErrorMillis = (double)(expectedStartPos - lastFrameStartPos) / 10000;
+	pResult->CapturedFrames = frameCount;
+	pResult->WrittenFrames = written.size();
+	pResult->HandOverMillis = ComputeBenchmarkStats(handOverMillis);
+	pResult->CaptureIntervalMillis = ComputeBenchmarkStats(captureIntervalMillis);
+	return S_OK;
+}
+
+void PrintFrameQueueBenchmarkResult(_In_ const FRAME_QUEUE_BENCHMARK_OPTIONS &options, _In_ const FRAME_QUEUE_BENCHMARK_RESULT &result)
+{
+	char name[32];
+	if (options.QueueLength == 0) {
+		snprintf(name, sizeof(name), "capture thread");
+	}
+	else {
+		snprintf(name, sizeof(name), "%u frames, %s", options.QueueLength, GetPolicyName(options.Policy));
+	}
+	printf("  %-24s  %6llu / %-6llu  %7llu   %4u      %7.2f / %7.2f ms     %6.2f / %7.2f ms   %6llu   %7.2f ms   %llu\n",
+		name, (unsigned long long)result.WrittenFrames, (unsigned long long)result.CapturedFrames, (unsigned long long)result.DroppedFrames, result.MaxDepth,
+		result.HandOverMillis.P99, result.HandOverMillis.Max, result.CaptureIntervalMillis.P99, result.CaptureIntervalMillis.Max,
+		(unsigned long long)result.TimelineErrors, result.TimelineEndErrorMillis, (unsigned long long)result.SteadyStateHeapAllocations);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include "Benchmark.h"
+#include "../ScreenRecorderLibNative/VideoFrameQueue.h"
+
+struct FRAME_QUEUE_BENCHMARK_OPTIONS {
+	//Recording length. Runs in real time, as the capture and the encoder are paced by the clock.
+	double Seconds = 4;
+	UINT32 FramesPerSecond = 60;
+	//Frames that can wait to be encoded. 0 encodes on the capture thread, as the recorder did before the writer thread.
+	UINT32 QueueLength = 4;
+	FrameQueueFullPolicy Policy = FrameQueueFullPolicy::Block;
+	//The time the encoder takes for a frame, and for one frame every StallIntervalSeconds.
+	double EncodeMillis = 6;
+	double StallMillis = 150;
+	double StallIntervalSeconds = 1;
+	//Frames captured before the allocation count is taken.
+	UINT32 WarmupFrames = 10;
+};
+
+struct FRAME_QUEUE_BENCHMARK_RESULT {
+	UINT64 CapturedFrames;
+	UINT64 WrittenFrames;
+	UINT64 DroppedFrames;
+	UINT32 MaxDepth;
+	//The time the capture thread spent handing over each frame, in milliseconds.
+	BENCHMARK_STATS HandOverMillis;
+	//The time between two captures, in milliseconds. Should stay at the frame interval, a longer one is a stutter in the video.
+	BENCHMARK_STATS CaptureIntervalMillis;
+	//Written frames that do not start where the frame before ended, or come out of capture order. Should be zero.
+	UINT64 TimelineErrors;
+	//How far the end of the last written frame is from the end of the last captured frame, in milliseconds. Should be zero.
+	double TimelineEndErrorMillis;
+	UINT64 SteadyStateHeapAllocations;
+};
+
+/// <summary>
+/// Captures frames at a fixed rate and hands them to a simulated encoder that takes a few milliseconds per frame and stalls now and then,
+/// through a VideoFrameQueue and a writer thread as VideoFrameWriter does, or on the capture thread. Paces the capture like the recorder loop,
+/// which gives the next frame the time a late one took, and checks that the frames written make up a timeline with no gaps.
+/// </summary>
+HRESULT RunFrameQueueBenchmark(_In_ const FRAME_QUEUE_BENCHMARK_OPTIONS &options, _Out_ FRAME_QUEUE_BENCHMARK_RESULT *pResult);
+void PrintFrameQueueBenchmarkResult(_In_ const FRAME_QUEUE_BENCHMARK_OPTIONS &options, _In_ const FRAME_QUEUE_BENCHMARK_RESULT &result);
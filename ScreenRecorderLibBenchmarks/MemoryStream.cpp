@@ -0,0 +1,216 @@
+#include "MemoryStream.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+HRESULT MemoryStream::CreateInstance(_Outptr_ MemoryStream **ppStream)
+{
+	if (!ppStream) {
+		return E_POINTER;
+	}
+	*ppStream = new (std::nothrow) MemoryStream();
+	return *ppStream ? S_OK : E_OUTOFMEMORY;
+}
+
+HRESULT MemoryStream::CreateInstance(_In_reads_bytes_(size) const BYTE *pData, _In_ size_t size, _Outptr_ MemoryStream **ppStream)
+{
+	HRESULT hr = CreateInstance(ppStream);
+	if (SUCCEEDED(hr) && size > 0) {
+		hr = (*ppStream)->Write(pData, (ULONG)size, nullptr);
+		if (FAILED(hr)) {
+			(*ppStream)->Release();
+			*ppStream = nullptr;
+		}
+	}
+	return hr;
+}
+
+MemoryStream::MemoryStream() :
+	m_RefCount(1),
+	m_pData(nullptr),
+	m_Size(0),
+	m_Capacity(0),
+	m_Position(0)
+{
+}
+
+MemoryStream::~MemoryStream()
+{
+	free(m_pData);
+}
+
+HRESULT MemoryStream::Reserve(_In_ UINT64 size)
+{
+	if (size <= m_Capacity) {
+		return S_OK;
+	}
+	if (size > SIZE_MAX / 2) {
+		return STG_E_MEDIUMFULL;
+	}
+	size_t capacity = (std::max)((size_t)size, m_Capacity * 2);
+	BYTE *pData = static_cast<BYTE *>(realloc(m_pData, capacity));
+	if (!pData) {
+		return STG_E_MEDIUMFULL;
+	}
+	m_pData = pData;
+	m_Capacity = capacity;
+	return S_OK;
+}
+
+STDMETHODIMP MemoryStream::Read(_Out_writes_bytes_(cb) void *pv, ULONG cb, _Out_opt_ ULONG *pcbRead)
+{
+	size_t read = m_Position < m_Size ? (std::min)((size_t)cb, m_Size - m_Position) : 0;
+	if (read > 0) {
+		memcpy(pv, m_pData + m_Position, read);
+		m_Position += read;
+	}
+	if (pcbRead) {
+		*pcbRead = (ULONG)read;
+	}
+	return S_OK;
+}
+
+STDMETHODIMP MemoryStream::Write(_In_reads_bytes_(cb) const void *pv, ULONG cb, _Out_opt_ ULONG *pcbWritten)
+{
+	HRESULT hr = Reserve((UINT64)m_Position + cb);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	//Writing past the end after a seek leaves zeros in between, as a file does.
+	if (m_Position > m_Size) {
+		memset(m_pData + m_Size, 0, m_Position - m_Size);
+	}
+	memcpy(m_pData + m_Position, pv, cb);
+	m_Position += cb;
+	m_Size = (std::max)(m_Size, m_Position);
+	if (pcbWritten) {
+		*pcbWritten = cb;
+	}
+	return S_OK;
+}
+
+STDMETHODIMP MemoryStream::Seek(LARGE_INTEGER dlibMove, DWORD dwOrigin, _Out_opt_ ULARGE_INTEGER *plibNewPosition)
+{
+	INT64 origin;
+	switch (dwOrigin) {
+	case STREAM_SEEK_SET:
+		origin = 0;
+		break;
+	case STREAM_SEEK_CUR:
+		origin = (INT64)m_Position;
+		break;
+	case STREAM_SEEK_END:
+		origin = (INT64)m_Size;
+		break;
+	default:
+		return STG_E_INVALIDFUNCTION;
+	}
+	INT64 position = origin + dlibMove.QuadPart;
+	if (position < 0) {
+		return STG_E_INVALIDFUNCTION;
+	}
+	m_Position = (size_t)position;
+	if (plibNewPosition) {
+		plibNewPosition->QuadPart = (UINT64)position;
+	}
+	return S_OK;
+}
+
+STDMETHODIMP MemoryStream::SetSize(ULARGE_INTEGER libNewSize)
+{
+	HRESULT hr = Reserve(libNewSize.QuadPart);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	size_t size = (size_t)libNewSize.QuadPart;
+	if (size > m_Size) {
+		memset(m_pData + m_Size, 0, size - m_Size);
+	}
+	m_Size = size;
+	return S_OK;
+}
+
+STDMETHODIMP MemoryStream::CopyTo(_In_ IStream *pstm, ULARGE_INTEGER cb, _Out_opt_ ULARGE_INTEGER *pcbRead, _Out_opt_ ULARGE_INTEGER *pcbWritten)
+{
+	size_t bytes = m_Position < m_Size ? (size_t)(std::min)((UINT64)(m_Size - m_Position), cb.QuadPart) : 0;
+	ULONG written = 0;
+	HRESULT hr = bytes > 0 ? pstm->Write(m_pData + m_Position, (ULONG)bytes, &written) : S_OK;
+	m_Position += bytes;
+	if (pcbRead) {
+		pcbRead->QuadPart = bytes;
+	}
+	if (pcbWritten) {
+		pcbWritten->QuadPart = written;
+	}
+	return hr;
+}
+
+STDMETHODIMP MemoryStream::Commit(DWORD /*grfCommitFlags*/)
+{
+	return S_OK;
+}
+
+STDMETHODIMP MemoryStream::Revert()
+{
+	return S_OK;
+}
+
+STDMETHODIMP MemoryStream::LockRegion(ULARGE_INTEGER /*libOffset*/, ULARGE_INTEGER /*cb*/, DWORD /*dwLockType*/)
+{
+	return STG_E_INVALIDFUNCTION;
+}
+
+STDMETHODIMP MemoryStream::UnlockRegion(ULARGE_INTEGER /*libOffset*/, ULARGE_INTEGER /*cb*/, DWORD /*dwLockType*/)
+{
+	return STG_E_INVALIDFUNCTION;
+}
+
+STDMETHODIMP MemoryStream::Stat(_Out_ STATSTG *pstatstg, DWORD /*grfStatFlag*/)
+{
+	if (!pstatstg) {
+		return E_POINTER;
+	}
+	memset(pstatstg, 0, sizeof(STATSTG));
+	pstatstg->type = STGTY_STREAM;
+	pstatstg->cbSize.QuadPart = m_Size;
+	pstatstg->grfMode = STGM_READWRITE;
+	return S_OK;
+}
+
+STDMETHODIMP MemoryStream::Clone(_Outptr_ IStream **ppstm)
+{
+	if (!ppstm) {
+		return E_POINTER;
+	}
+	*ppstm = nullptr;
+	return E_NOTIMPL;
+}
+
+STDMETHODIMP MemoryStream::QueryInterface(REFIID riid, void **ppv)
+{
+	if (!ppv) {
+		return E_POINTER;
+	}
+	if (riid == IID_IUnknown || riid == IID_ISequentialStream || riid == IID_IStream) {
+		*ppv = static_cast<IStream *>(this);
+		AddRef();
+		return S_OK;
+	}
+	*ppv = nullptr;
+	return E_NOINTERFACE;
+}
+
+STDMETHODIMP_(ULONG) MemoryStream::AddRef()
+{
+	return ++m_RefCount;
+}
+
+STDMETHODIMP_(ULONG) MemoryStream::Release()
+{
+	ULONG refCount = --m_RefCount;
+	if (refCount == 0) {
+		delete this;
+	}
+	return refCount;
+}
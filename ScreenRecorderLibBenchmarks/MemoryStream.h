@@ -0,0 +1,52 @@
+#pragma once
+#include <windows.h>
+#include <objidl.h>
+#include <sal.h>
+#include <atomic>
+
+/// <summary>
+/// IStream over a growable block of memory, for the outputs the benchmarks mux into and read back.
+/// The memory only moves when a write or SetSize grows it, so once it is sized up front, GetData can be read while writing goes on.
+/// It is taken with realloc instead of operator new, so like a file, it does not count as heap allocations of the code writing to it.
+/// </summary>
+class MemoryStream : public IStream
+{
+public:
+	static HRESULT CreateInstance(_Outptr_ MemoryStream **ppStream);
+	/// <summary>
+	/// Creates a stream holding a copy of the bytes, positioned at their end.
+	/// </summary>
+	static HRESULT CreateInstance(_In_reads_bytes_(size) const BYTE *pData, _In_ size_t size, _Outptr_ MemoryStream **ppStream);
+
+	// IStream methods
+	STDMETHODIMP Read(_Out_writes_bytes_(cb) void *pv, ULONG cb, _Out_opt_ ULONG *pcbRead);
+	STDMETHODIMP Write(_In_reads_bytes_(cb) const void *pv, ULONG cb, _Out_opt_ ULONG *pcbWritten);
+	STDMETHODIMP Seek(LARGE_INTEGER dlibMove, DWORD dwOrigin, _Out_opt_ ULARGE_INTEGER *plibNewPosition);
+	STDMETHODIMP SetSize(ULARGE_INTEGER libNewSize);
+	STDMETHODIMP CopyTo(_In_ IStream *pstm, ULARGE_INTEGER cb, _Out_opt_ ULARGE_INTEGER *pcbRead, _Out_opt_ ULARGE_INTEGER *pcbWritten);
+	STDMETHODIMP Commit(DWORD grfCommitFlags);
+	STDMETHODIMP Revert();
+	STDMETHODIMP LockRegion(ULARGE_INTEGER libOffset, ULARGE_INTEGER cb, DWORD dwLockType);
+	STDMETHODIMP UnlockRegion(ULARGE_INTEGER libOffset, ULARGE_INTEGER cb, DWORD dwLockType);
+	STDMETHODIMP Stat(_Out_ STATSTG *pstatstg, DWORD grfStatFlag);
+	STDMETHODIMP Clone(_Outptr_ IStream **ppstm);
+
+	// IUnknown methods
+	STDMETHODIMP QueryInterface(REFIID riid, void **ppv);
+	STDMETHODIMP_(ULONG) AddRef();
+	STDMETHODIMP_(ULONG) Release();
+
+	inline const BYTE *GetData() const { return m_pData; }
+	inline size_t GetSize() const { return m_Size; }
+private:
+	MemoryStream();
+	virtual ~MemoryStream();
+
+	HRESULT Reserve(_In_ UINT64 size);
+
+	std::atomic<ULONG> m_RefCount;
+	BYTE *m_pData;
+	size_t m_Size;
+	size_t m_Capacity;
+	size_t m_Position;
+};
@@ -0,0 +1,218 @@
+#include "MixerBenchmark.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace {
+	//Samples after the end of each output, which the mixer must leave alone.
+	const size_t GuardSamples = 16;
+	const double Int16ClipHigh = 32767.5;
+	const double Int16ClipLow = -32768.5;
+	//Gains given to the inputs in turn. Mixing eight of them clips often, so the clip counts are checked too.
+	const float Gains[] = { 1.0f, 0.5f, 0.75f, 1.25f, 0.25f, 2.0f, 0.1f, 1.0f };
+
+	enum class MixOutput {
+		Separate,
+		InPlaceOfFirst,
+		InPlaceOfLast
+	};
+
+	/// <summary>
+	/// What the check of a mix needs to know about the sample type: random samples, and how the mix computed in double ends up in it.
+	/// </summary>
+	template <typename T>
+	struct MixSampleTraits;
+
+	template <>
+	struct MixSampleTraits<float> {
+		static constexpr float Guard = 12345.0f;
+		static float Generate(_In_ uint32_t random) { return ((int32_t)random / 2147483648.0f) * 0.8f; }
+		static bool IsClipped(_In_ double value) { return value > 1.0 || value < -1.0; }
+		//Summing in another order, or with fused multiply adds, changes the last bits, in proportion to the size of the terms summed.
+		static bool IsClose(_In_ double value, _In_ double expected, _In_ double magnitude) { return fabs(value - expected) <= 1e-6 * magnitude + 1e-9; }
+	};
+
+	template <>
+	struct MixSampleTraits<int16_t> {
+		static constexpr int16_t Guard = 12345;
+		static int16_t Generate(_In_ uint32_t random) { return (int16_t)(random >> 16); }
+		static bool IsClipped(_In_ double value) { return value >= Int16ClipHigh || value < Int16ClipLow; }
+		//A sum that lands close to halfway can round either way.
+		static bool IsClose(_In_ double value, _In_ double expected, _In_ double /*magnitude*/) { return fabs(value - (std::min)((std::max)(std::nearbyint(expected), -32768.0), 32767.0)) <= 1; }
+	};
+
+	uint32_t NextRandom(_Inout_ uint32_t &random)
+	{
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		return random;
+	}
+
+	template <typename T>
+	void GenerateSamples(_Inout_ uint32_t &random, _Inout_ std::vector<T> &samples)
+	{
+		for (T &sample : samples) {
+			sample = MixSampleTraits<T>::Generate(NextRandom(random));
+		}
+	}
+
+	/// <summary>
+	/// Mixes random inputs at the level and with the scalar code, and compares both to the mix computed in double.
+	/// The last input can be cut short and, with eight inputs, the second left empty, to check what is mixed past the end of an input.
+	/// </summary>
+	template <typename T>
+	void CheckMix(_In_ SimdLevel level, _In_ UINT32 inputCount, _In_ size_t sampleCount, _In_ MixOutput output, _In_ bool isLastInputShort, _Inout_ uint32_t &random, _Inout_ MIXER_BENCHMARK_RESULT *pResult)
+	{
+		typedef MixSampleTraits<T> Traits;
+		std::vector<std::vector<T>> samples(inputCount);
+		std::vector<AUDIO_MIX_INPUT<T>> inputs(inputCount);
+		for (UINT32 s = 0; s < inputCount; s++) {
+			size_t length = sampleCount;
+			if (isLastInputShort && s == inputCount - 1) {
+				length = sampleCount / 3;
+			}
+			else if (isLastInputShort && inputCount >= 8 && s == 1) {
+				length = 0;
+			}
+			samples[s].resize(sampleCount + GuardSamples);
+			GenerateSamples(random, samples[s]);
+			std::fill(samples[s].begin() + sampleCount, samples[s].end(), Traits::Guard);
+			inputs[s] = AUDIO_MIX_INPUT<T>{ length > 0 ? samples[s].data() : nullptr, length, Gains[s % ARRAYSIZE(Gains)] };
+		}
+
+		std::vector<double> reference(sampleCount);
+		std::vector<double> magnitude(sampleCount);
+		size_t referenceClipped = 0;
+		for (size_t i = 0; i < sampleCount; i++) {
+			for (UINT32 s = 0; s < inputCount; s++) {
+				if (i < inputs[s].SampleCount) {
+					double term = (double)inputs[s].pSamples[i] * inputs[s].Gain;
+					reference[i] += term;
+					magnitude[i] += fabs(term);
+				}
+			}
+			referenceClipped += Traits::IsClipped(reference[i]) ? 1 : 0;
+		}
+
+		std::vector<T> scalarOutput(sampleCount + GuardSamples, Traits::Guard);
+		size_t scalarClipped = AudioMixer::Mix(inputs.data(), inputCount, scalarOutput.data(), sampleCount, SimdLevel::Scalar);
+		std::vector<T> separateOutput(sampleCount + GuardSamples, Traits::Guard);
+		T *pOutput = separateOutput.data();
+		if (output == MixOutput::InPlaceOfFirst) {
+			pOutput = samples.front().data();
+		}
+		else if (output == MixOutput::InPlaceOfLast) {
+			pOutput = samples.back().data();
+		}
+		size_t clipped = AudioMixer::Mix(inputs.data(), inputCount, pOutput, sampleCount, level);
+
+		pResult->CheckedMixes++;
+		if (clipped != scalarClipped || scalarClipped != referenceClipped) {
+			pResult->ClipCountMismatches++;
+		}
+		for (size_t i = 0; i < sampleCount; i++) {
+			if (!Traits::IsClose(pOutput[i], scalarOutput[i], magnitude[i])) {
+				pResult->MismatchSamples++;
+			}
+			if (!Traits::IsClose(pOutput[i], reference[i], magnitude[i])) {
+				pResult->ReferenceMismatchSamples++;
+			}
+		}
+		for (size_t i = sampleCount; i < sampleCount + GuardSamples; i++) {
+			if (pOutput[i] != Traits::Guard || scalarOutput[i] != Traits::Guard) {
+				pResult->OverrunSamples++;
+			}
+		}
+	}
+
+	template <typename T>
+	void TimeMixes(_In_ const MIXER_BENCHMARK_OPTIONS &options, _In_ SimdLevel level, _In_ const std::vector<AUDIO_MIX_INPUT<T>> &inputs, _Inout_ std::vector<T> &output,
+		_Inout_ std::vector<double> &callNanos, _Out_ UINT64 *pHeapAllocations)
+	{
+		callNanos.clear();
+		UINT64 warmHeapAllocations = 0;
+		for (UINT32 i = 0; i < options.WarmupIterations + options.Iterations; i++) {
+			if (i == options.WarmupIterations) {
+				warmHeapAllocations = GetHeapAllocationCount();
+			}
+			auto start = std::chrono::steady_clock::now();
+			AudioMixer::Mix(inputs.data(), inputs.size(), output.data(), output.size(), level);
+			double nanos = ElapsedNanos(start);
+			if (i >= options.WarmupIterations) {
+				callNanos.push_back(nanos);
+			}
+		}
+		*pHeapAllocations = GetHeapAllocationCount() - warmHeapAllocations;
+	}
+
+	template <typename T>
+	void RunMixerBenchmark(_In_ const MIXER_BENCHMARK_OPTIONS &options, _Out_ MIXER_BENCHMARK_RESULT *pResult)
+	{
+		uint32_t random = options.InputCount * 2654435761u + 1;
+		const size_t sampleCounts[] = { 0, 1, 3, 7, 8, 15, 16, 17, 31, 33, options.SampleCount, options.SampleCount + 1, options.SampleCount + 7, options.SampleCount + 15 };
+		for (size_t sampleCount : sampleCounts) {
+			for (MixOutput output : { MixOutput::Separate, MixOutput::InPlaceOfFirst, MixOutput::InPlaceOfLast }) {
+				CheckMix<T>(options.Simd, options.InputCount, sampleCount, output, false, random, pResult);
+			}
+			//With the last input cut short, the output goes in place of the first.
+			CheckMix<T>(options.Simd, options.InputCount, sampleCount, MixOutput::Separate, true, random, pResult);
+			CheckMix<T>(options.Simd, options.InputCount, sampleCount, MixOutput::InPlaceOfFirst, true, random, pResult);
+		}
+
+		std::vector<std::vector<T>> samples(options.InputCount, std::vector<T>(options.SampleCount));
+		std::vector<AUDIO_MIX_INPUT<T>> inputs(options.InputCount);
+		for (UINT32 s = 0; s < options.InputCount; s++) {
+			GenerateSamples(random, samples[s]);
+			inputs[s] = AUDIO_MIX_INPUT<T>{ samples[s].data(), samples[s].size(), Gains[s % ARRAYSIZE(Gains)] };
+		}
+		std::vector<T> output(options.SampleCount);
+		std::vector<double> callNanos;
+		callNanos.reserve(options.Iterations);
+		UINT64 heapAllocations;
+		TimeMixes(options, SimdLevel::Scalar, inputs, output, callNanos, &heapAllocations);
+		pResult->ScalarNanosPerSample = ComputeBenchmarkStats(callNanos).Mean / options.SampleCount;
+		TimeMixes(options, options.Simd, inputs, output, callNanos, &pResult->SteadyStateHeapAllocations);
+		pResult->CallNanos = ComputeBenchmarkStats(callNanos);
+		pResult->NanosPerSample = pResult->CallNanos.Mean / options.SampleCount;
+		pResult->Speedup = pResult->NanosPerSample > 0 ? pResult->ScalarNanosPerSample / pResult->NanosPerSample : 0;
+	}
+
+	const char *GetSimdName(_In_ SimdLevel level)
+	{
+		switch (level)
+		{
+		case SimdLevel::AVX2:
+			return "avx2";
+		case SimdLevel::SSE2:
+			return "sse2";
+		default:
+			return "scalar";
+		}
+	}
+}
+
+HRESULT RunMixerBenchmark(_In_ const MIXER_BENCHMARK_OPTIONS &options, _Out_ MIXER_BENCHMARK_RESULT *pResult)
+{
+	*pResult = MIXER_BENCHMARK_RESULT{};
+	if (options.InputCount == 0 || options.SampleCount == 0 || options.Iterations == 0) {
+		return E_INVALIDARG;
+	}
+	if (options.IsFloat) {
+		RunMixerBenchmark<float>(options, pResult);
+	}
+	else {
+		RunMixerBenchmark<int16_t>(options, pResult);
+	}
+	pResult->Simd = ResolveSimdLevel(options.Simd);
+	return S_OK;
+}
+
+void PrintMixerBenchmarkResult(_In_ const MIXER_BENCHMARK_OPTIONS &options, _In_ const MIXER_BENCHMARK_RESULT &result)
+{
+	printf("  %-5s  %u %-6s  %-6s  %8.0f ns mean  %8.0f ns p99  %6.3f ns/sample  %5.2fx scalar   %llu allocations   %u mixes checked, %llu / %llu mismatches, %llu clip counts, %llu overruns\n",
+		options.IsFloat ? "float" : "int16", options.InputCount, options.InputCount == 1 ? "input" : "inputs", GetSimdName(result.Simd), result.CallNanos.Mean, result.CallNanos.P99, result.NanosPerSample, result.Speedup,
+		(unsigned long long)result.SteadyStateHeapAllocations, result.CheckedMixes, (unsigned long long)result.MismatchSamples,
+		(unsigned long long)result.ReferenceMismatchSamples, (unsigned long long)result.ClipCountMismatches, (unsigned long long)result.OverrunSamples);
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include "Benchmark.h"
+#include "../ScreenRecorderLibNative/AudioMixer.h"
+
+struct MIXER_BENCHMARK_OPTIONS {
+	UINT32 InputCount = 2;
+	//Mix float inputs, or 16 bit integer inputs.
+	bool IsFloat = true;
+	SimdLevel Simd = SimdLevel::Auto;
+	//Samples per call, 10 ms of 48 kHz stereo.
+	UINT32 SampleCount = 960;
+	//Calls timed, after the warm up calls.
+	UINT32 Iterations = 5000;
+	UINT32 WarmupIterations = 100;
+};
+
+struct MIXER_BENCHMARK_RESULT {
+	SimdLevel Simd;
+	BENCHMARK_STATS CallNanos;
+	double NanosPerSample;
+	//The same mix with the scalar code, and how many times faster the SIMD level is.
+	double ScalarNanosPerSample;
+	double Speedup;
+	UINT64 SteadyStateHeapAllocations;
+	//Mixes checked: lengths that leave a partial vector, inputs shorter than the output, and the output in place of an input.
+	UINT32 CheckedMixes;
+	//Samples that differ from the scalar code by more than rounding, or from the mix computed in double. Should be zero.
+	UINT64 MismatchSamples;
+	UINT64 ReferenceMismatchSamples;
+	//Mixes that count a different number of clipped samples than the scalar code. Should be zero.
+	UINT64 ClipCountMismatches;
+	//Samples written past the end of the output. Should be zero.
+	UINT64 OverrunSamples;
+};
+
+/// <summary>
+/// Checks AudioMixer at one SIMD level against the scalar code and against the mix computed in double, on lengths that leave the tail of a vector
+/// to the scalar code, inputs shorter than the output and the output written over an input, then times it mixing 10 ms blocks.
+/// </summary>
+HRESULT RunMixerBenchmark(_In_ const MIXER_BENCHMARK_OPTIONS &options, _Out_ MIXER_BENCHMARK_RESULT *pResult);
+void PrintMixerBenchmarkResult(_In_ const MIXER_BENCHMARK_OPTIONS &options, _In_ const MIXER_BENCHMARK_RESULT &result);
@@ -0,0 +1,613 @@
+#include "Mp4Checker.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <set>
+
+namespace {
+	const UINT32 TfhdBaseDataOffsetPresent = 0x000001;
+	const UINT32 TfhdDefaultSampleDurationPresent = 0x000008;
+	const UINT32 TfhdDefaultSampleSizePresent = 0x000010;
+	const UINT32 TfhdDefaultSampleFlagsPresent = 0x000020;
+	const UINT32 TfhdDefaultBaseIsMoof = 0x020000;
+	const UINT32 TrunDataOffsetPresent = 0x000001;
+	const UINT32 TrunFirstSampleFlagsPresent = 0x000004;
+	const UINT32 TrunSampleDurationPresent = 0x000100;
+	const UINT32 TrunSampleSizePresent = 0x000200;
+	const UINT32 TrunSampleFlagsPresent = 0x000400;
+	const UINT32 TrunSampleCompositionTimeOffsetsPresent = 0x000800;
+	const UINT32 SampleIsNonSync = 0x00010000;
+	const UINT64 FnvPrime = 1099511628211ULL;
+
+	struct BOX {
+		char Type[5];
+		//Where the box and its payload start, and where it ends, as offsets in the file.
+		size_t Start;
+		size_t PayloadStart;
+		size_t End;
+	};
+
+	struct TRACK_STATE {
+		MP4_CHECKED_TRACK Result;
+		bool HasTrex;
+		UINT32 NalLengthSize;
+		UINT32 DefaultDuration;
+		UINT32 DefaultSize;
+		UINT32 DefaultFlags;
+		std::set<INT64> FragmentTimes;
+		//The moof boxes the track starts on a sync sample in, where a player can join.
+		std::set<size_t> SyncMoofOffsets;
+	};
+
+	UINT32 ReadU32(_In_ const BYTE *p)
+	{
+		return ((UINT32)p[0] << 24) | ((UINT32)p[1] << 16) | ((UINT32)p[2] << 8) | p[3];
+	}
+
+	UINT64 ReadU64(_In_ const BYTE *p)
+	{
+		return ((UINT64)ReadU32(p) << 32) | ReadU32(p + 4);
+	}
+
+	UINT64 Hash(_In_ UINT64 hash, _In_reads_bytes_(size) const BYTE *pData, _In_ size_t size)
+	{
+		for (size_t i = 0; i < size; i++) {
+			hash = (hash ^ pData[i]) * FnvPrime;
+		}
+		return hash;
+	}
+
+	class Checker {
+	public:
+		Checker(_In_reads_bytes_(size) const BYTE *pData, _In_ size_t size, _Inout_ MP4_CHECK_RESULT *pResult) :
+			m_pData(pData),
+			m_Size(size),
+			m_pResult(pResult)
+		{
+		}
+
+		void Check()
+		{
+			std::vector<BOX> boxes = ReadBoxes(0, m_Size);
+			size_t index = 0;
+			if (index >= boxes.size() || !IsType(boxes[index], "ftyp")) {
+				Error("the file does not start with an ftyp box");
+				return;
+			}
+			index++;
+			if (index >= boxes.size() || !IsType(boxes[index], "moov")) {
+				Error("the ftyp box is not followed by a moov box");
+				return;
+			}
+			CheckMoov(boxes[index++]);
+			UINT32 sequenceNumber = 0;
+			while (index < boxes.size() && IsType(boxes[index], "moof")) {
+				const BOX &moof = boxes[index++];
+				if (index >= boxes.size() || !IsType(boxes[index], "mdat")) {
+					Error("moof at %zu is not followed by an mdat box", moof.Start);
+					return;
+				}
+				const BOX &mdat = boxes[index++];
+				CheckFragment(moof, mdat, &sequenceNumber);
+				m_MoofOffsets.insert(moof.Start);
+				m_pResult->Fragments++;
+				m_pResult->MaxFragmentBytes = (std::max)(m_pResult->MaxFragmentBytes, (UINT64)(mdat.End - moof.Start));
+			}
+			if (index < boxes.size() && IsType(boxes[index], "mfra")) {
+				CheckMfra(boxes[index++]);
+			}
+			if (index < boxes.size()) {
+				Error("unexpected %s box at %zu", boxes[index].Type, boxes[index].Start);
+			}
+			for (const TRACK_STATE &track : m_Tracks) {
+				m_pResult->Tracks.push_back(track.Result);
+			}
+		}
+
+	private:
+		const BYTE *m_pData;
+		size_t m_Size;
+		MP4_CHECK_RESULT *m_pResult;
+		std::vector<TRACK_STATE> m_Tracks;
+		std::set<size_t> m_MoofOffsets;
+
+		template <typename... Args>
+		void Error(_In_z_ const char *format, Args... args)
+		{
+			//Past the first few, errors are usually consequences of the first.
+			if (m_pResult->Errors.size() >= 20) {
+				return;
+			}
+			char message[256];
+			snprintf(message, sizeof(message), format, args...);
+			m_pResult->Errors.push_back(message);
+		}
+
+		static bool IsType(_In_ const BOX &box, _In_z_ const char *type)
+		{
+			return memcmp(box.Type, type, 4) == 0;
+		}
+
+		std::vector<BOX> ReadBoxes(_In_ size_t start, _In_ size_t end)
+		{
+			std::vector<BOX> boxes;
+			size_t position = start;
+			while (position < end) {
+				if (end - position < 8) {
+					Error("%zu trailing bytes at %zu", end - position, position);
+					break;
+				}
+				BOX box;
+				memcpy(box.Type, m_pData + position + 4, 4);
+				box.Type[4] = 0;
+				box.Start = position;
+				UINT64 size = ReadU32(m_pData + position);
+				box.PayloadStart = position + 8;
+				if (size == 1) {
+					if (end - position < 16) {
+						Error("%s box at %zu is cut off", box.Type, position);
+						break;
+					}
+					size = ReadU64(m_pData + position + 8);
+					box.PayloadStart += 8;
+				}
+				else if (size == 0) {
+					size = end - position;
+				}
+				if (size < box.PayloadStart - position || size > end - position) {
+					Error("%s box at %zu has an invalid size of %llu", box.Type, position, (unsigned long long)size);
+					break;
+				}
+				box.End = position + (size_t)size;
+				boxes.push_back(box);
+				position = box.End;
+			}
+			return boxes;
+		}
+
+		const BOX *FindChild(_In_ const std::vector<BOX> &boxes, _In_z_ const char *type)
+		{
+			for (const BOX &box : boxes) {
+				if (IsType(box, type)) {
+					return &box;
+				}
+			}
+			return nullptr;
+		}
+
+		/// <summary>
+		/// Follows a path of box types, e.g. mdia, minf, stbl, down from parent.
+		/// </summary>
+		bool FindPath(_In_ const BOX &parent, _In_ const std::vector<const char *> &path, _Out_ BOX *pBox)
+		{
+			BOX box = parent;
+			for (const char *type : path) {
+				std::vector<BOX> children = ReadBoxes(box.PayloadStart, box.End);
+				const BOX *pChild = FindChild(children, type);
+				if (!pChild) {
+					return false;
+				}
+				box = *pChild;
+			}
+			*pBox = box;
+			return true;
+		}
+
+		TRACK_STATE *FindTrack(_In_ UINT32 trackId)
+		{
+			for (TRACK_STATE &track : m_Tracks) {
+				if (track.Result.TrackId == trackId) {
+					return &track;
+				}
+			}
+			return nullptr;
+		}
+
+		void CheckMoov(_In_ const BOX &moov)
+		{
+			std::vector<BOX> children = ReadBoxes(moov.PayloadStart, moov.End);
+			if (!FindChild(children, "mvhd")) {
+				Error("the moov has no mvhd box");
+			}
+			for (const BOX &trak : children) {
+				if (!IsType(trak, "trak")) {
+					continue;
+				}
+				TRACK_STATE track{};
+				track.Result.PayloadHash = PayloadHashSeed;
+				BOX box;
+				if (!FindPath(trak, { "tkhd" }, &box) || box.End - box.PayloadStart < 24) {
+					Error("a trak has no tkhd box");
+					continue;
+				}
+				BYTE version = m_pData[box.PayloadStart];
+				track.Result.TrackId = ReadU32(m_pData + box.PayloadStart + (version == 1 ? 20 : 12));
+				if (FindPath(trak, { "mdia", "mdhd" }, &box) && box.End - box.PayloadStart >= 24) {
+					version = m_pData[box.PayloadStart];
+					track.Result.Timescale = ReadU32(m_pData + box.PayloadStart + (version == 1 ? 20 : 12));
+				}
+				if (track.Result.Timescale == 0) {
+					Error("track %u has no timescale", track.Result.TrackId);
+				}
+				if (FindPath(trak, { "mdia", "hdlr" }, &box) && box.End - box.PayloadStart >= 12) {
+					track.Result.IsVideo = memcmp(m_pData + box.PayloadStart + 8, "vide", 4) == 0;
+				}
+				else {
+					Error("track %u has no hdlr box", track.Result.TrackId);
+				}
+				if (!FindPath(trak, { "mdia", "minf", "dinf", "dref" }, &box)) {
+					Error("track %u has no data reference", track.Result.TrackId);
+				}
+				CheckSampleEntry(trak, &track);
+				m_Tracks.push_back(track);
+			}
+			if (m_Tracks.empty()) {
+				Error("the moov has no tracks");
+			}
+			const BOX *pMvex = FindChild(children, "mvex");
+			if (!pMvex) {
+				Error("the moov has no mvex box, so the file is not fragmented");
+				return;
+			}
+			for (const BOX &trex : ReadBoxes(pMvex->PayloadStart, pMvex->End)) {
+				if (!IsType(trex, "trex") || trex.End - trex.PayloadStart < 24) {
+					continue;
+				}
+				TRACK_STATE *pTrack = FindTrack(ReadU32(m_pData + trex.PayloadStart + 4));
+				if (pTrack) {
+					pTrack->HasTrex = true;
+					pTrack->DefaultDuration = ReadU32(m_pData + trex.PayloadStart + 12);
+					pTrack->DefaultSize = ReadU32(m_pData + trex.PayloadStart + 16);
+					pTrack->DefaultFlags = ReadU32(m_pData + trex.PayloadStart + 20);
+				}
+			}
+			for (const TRACK_STATE &track : m_Tracks) {
+				if (!track.HasTrex) {
+					Error("track %u has no trex box", track.Result.TrackId);
+				}
+			}
+		}
+
+		void CheckSampleEntry(_In_ const BOX &trak, _Inout_ TRACK_STATE *pTrack)
+		{
+			BOX stsd;
+			if (!FindPath(trak, { "mdia", "minf", "stbl", "stsd" }, &stsd) || stsd.End - stsd.PayloadStart < 8 || ReadU32(m_pData + stsd.PayloadStart + 4) != 1) {
+				Error("track %u has no single sample entry", pTrack->Result.TrackId);
+				return;
+			}
+			std::vector<BOX> entries = ReadBoxes(stsd.PayloadStart + 8, stsd.End);
+			if (entries.size() != 1) {
+				return;
+			}
+			const BOX &entry = entries[0];
+			//The fields of a visual sample entry take 78 bytes in front of its child boxes, those of an audio sample entry 28.
+			size_t fieldBytes = pTrack->Result.IsVideo ? 78 : 28;
+			if (entry.End - entry.PayloadStart < fieldBytes) {
+				Error("the sample entry of track %u is cut off", pTrack->Result.TrackId);
+				return;
+			}
+			std::vector<BOX> children = ReadBoxes(entry.PayloadStart + fieldBytes, entry.End);
+			const BOX *pConfig = nullptr;
+			if (IsType(entry, "avc1")) {
+				pConfig = FindChild(children, "avcC");
+				if (pConfig && pConfig->End - pConfig->PayloadStart >= 7) {
+					pTrack->NalLengthSize = (m_pData[pConfig->PayloadStart + 4] & 3) + 1;
+					//At least one SPS and one PPS.
+					const BYTE *p = m_pData + pConfig->PayloadStart;
+					if ((p[5] & 0x1F) == 0) {
+						Error("the avcC of track %u has no SPS", pTrack->Result.TrackId);
+					}
+				}
+			}
+			else if (IsType(entry, "hvc1") || IsType(entry, "hev1")) {
+				pConfig = FindChild(children, "hvcC");
+				if (pConfig && pConfig->End - pConfig->PayloadStart >= 23) {
+					pTrack->NalLengthSize = (m_pData[pConfig->PayloadStart + 21] & 3) + 1;
+					if (IsType(entry, "hvc1") && m_pData[pConfig->PayloadStart + 22] < 3) {
+						Error("the hvcC of track %u lacks a VPS, SPS or PPS array", pTrack->Result.TrackId);
+					}
+				}
+			}
+			else if (IsType(entry, "mp4a")) {
+				pConfig = FindChild(children, "esds");
+			}
+			else {
+				Error("track %u has an unknown sample entry %s", pTrack->Result.TrackId, entry.Type);
+				return;
+			}
+			if (!pConfig) {
+				Error("the %s sample entry of track %u has no decoder configuration", entry.Type, pTrack->Result.TrackId);
+			}
+		}
+
+		void CheckFragment(_In_ const BOX &moof, _In_ const BOX &mdat, _Inout_ UINT32 *pSequenceNumber)
+		{
+			std::vector<BOX> children = ReadBoxes(moof.PayloadStart, moof.End);
+			const BOX *pMfhd = FindChild(children, "mfhd");
+			if (!pMfhd || pMfhd->End - pMfhd->PayloadStart < 8) {
+				Error("moof at %zu has no mfhd box", moof.Start);
+			}
+			else {
+				UINT32 sequenceNumber = ReadU32(m_pData + pMfhd->PayloadStart + 4);
+				if (sequenceNumber != *pSequenceNumber + 1) {
+					Error("moof at %zu has sequence number %u after %u", moof.Start, sequenceNumber, *pSequenceNumber);
+				}
+				*pSequenceNumber = sequenceNumber;
+			}
+			//The byte ranges of the track runs, which must cover the mdat payload without gaps or overlap.
+			std::vector<std::pair<size_t, size_t>> runs;
+			for (const BOX &traf : children) {
+				if (IsType(traf, "traf")) {
+					CheckTrackFragment(moof, mdat, traf, &runs);
+				}
+			}
+			std::sort(runs.begin(), runs.end());
+			size_t position = mdat.PayloadStart;
+			for (const auto &run : runs) {
+				if (run.first != position) {
+					Error("the track runs of moof at %zu leave a gap or overlap at %zu", moof.Start, (std::min)(run.first, position));
+					return;
+				}
+				position = run.second;
+			}
+			if (position != mdat.End) {
+				Error("the track runs of moof at %zu cover %zu of the %zu bytes of the mdat", moof.Start, position - mdat.PayloadStart, mdat.End - mdat.PayloadStart);
+			}
+		}
+
+		void CheckTrackFragment(_In_ const BOX &moof, _In_ const BOX &mdat, _In_ const BOX &traf, _Inout_ std::vector<std::pair<size_t, size_t>> *pRuns)
+		{
+			std::vector<BOX> children = ReadBoxes(traf.PayloadStart, traf.End);
+			const BOX *pTfhd = FindChild(children, "tfhd");
+			if (!pTfhd || pTfhd->End - pTfhd->PayloadStart < 8) {
+				Error("a traf in moof at %zu has no tfhd box", moof.Start);
+				return;
+			}
+			const BYTE *p = m_pData + pTfhd->PayloadStart;
+			UINT32 tfhdFlags = ReadU32(p) & 0xFFFFFF;
+			TRACK_STATE *pTrack = FindTrack(ReadU32(p + 4));
+			if (!pTrack) {
+				Error("a traf in moof at %zu is for unknown track %u", moof.Start, ReadU32(p + 4));
+				return;
+			}
+			size_t field = 8;
+			UINT64 baseDataOffset = moof.Start;
+			if (tfhdFlags & TfhdBaseDataOffsetPresent) {
+				baseDataOffset = ReadU64(p + field);
+				field += 8;
+			}
+			else if (!(tfhdFlags & TfhdDefaultBaseIsMoof)) {
+				Error("the traf of track %u in moof at %zu has neither a base data offset nor default-base-is-moof", pTrack->Result.TrackId, moof.Start);
+			}
+			//The sample description index.
+			if (tfhdFlags & 0x000002) {
+				field += 4;
+			}
+			UINT32 defaultDuration = pTrack->DefaultDuration;
+			UINT32 defaultSize = pTrack->DefaultSize;
+			UINT32 defaultFlags = pTrack->DefaultFlags;
+			if (tfhdFlags & TfhdDefaultSampleDurationPresent) {
+				defaultDuration = ReadU32(p + field);
+				field += 4;
+			}
+			if (tfhdFlags & TfhdDefaultSampleSizePresent) {
+				defaultSize = ReadU32(p + field);
+				field += 4;
+			}
+			if (tfhdFlags & TfhdDefaultSampleFlagsPresent) {
+				defaultFlags = ReadU32(p + field);
+				field += 4;
+			}
+
+			const BOX *pTfdt = FindChild(children, "tfdt");
+			if (!pTfdt) {
+				Error("the traf of track %u in moof at %zu has no tfdt box", pTrack->Result.TrackId, moof.Start);
+				return;
+			}
+			INT64 decodeTime = m_pData[pTfdt->PayloadStart] == 1 ? (INT64)ReadU64(m_pData + pTfdt->PayloadStart + 4) : ReadU32(m_pData + pTfdt->PayloadStart + 4);
+			//A track may start after time 0, e.g. in a segment, and goes on without a gap from there.
+			if (pTrack->Result.Samples == 0 && pTrack->FragmentTimes.empty()) {
+				pTrack->Result.StartDecodeTime = decodeTime;
+				pTrack->Result.EndDecodeTime = decodeTime;
+			}
+			if (decodeTime != pTrack->Result.EndDecodeTime) {
+				Error("track %u resumes at %lld in moof at %zu, where the fragment before ended at %lld", pTrack->Result.TrackId, (long long)decodeTime, moof.Start, (long long)pTrack->Result.EndDecodeTime);
+			}
+			pTrack->FragmentTimes.insert(decodeTime);
+
+			bool isFirstSample = true;
+			for (const BOX &trun : children) {
+				if (!IsType(trun, "trun")) {
+					continue;
+				}
+				p = m_pData + trun.PayloadStart;
+				UINT32 trunFlags = ReadU32(p) & 0xFFFFFF;
+				UINT32 sampleCount = ReadU32(p + 4);
+				field = 8;
+				size_t dataPosition = (size_t)baseDataOffset;
+				if (trunFlags & TrunDataOffsetPresent) {
+					dataPosition += (INT32)ReadU32(p + field);
+					field += 4;
+				}
+				else {
+					Error("a trun of track %u in moof at %zu has no data offset", pTrack->Result.TrackId, moof.Start);
+				}
+				UINT32 firstSampleFlags = defaultFlags;
+				bool hasFirstSampleFlags = (trunFlags & TrunFirstSampleFlagsPresent) != 0;
+				if (hasFirstSampleFlags) {
+					firstSampleFlags = ReadU32(p + field);
+					field += 4;
+				}
+				size_t sampleBytes = 4 * (((trunFlags & TrunSampleDurationPresent) ? 1 : 0) + ((trunFlags & TrunSampleSizePresent) ? 1 : 0)
+					+ ((trunFlags & TrunSampleFlagsPresent) ? 1 : 0) + ((trunFlags & TrunSampleCompositionTimeOffsetsPresent) ? 1 : 0));
+				if (trun.PayloadStart + field + sampleBytes * sampleCount > trun.End) {
+					Error("a trun of track %u in moof at %zu is cut off", pTrack->Result.TrackId, moof.Start);
+					return;
+				}
+				size_t runStart = dataPosition;
+				for (UINT32 i = 0; i < sampleCount; i++) {
+					UINT32 duration = defaultDuration, size = defaultSize, flags = i == 0 && hasFirstSampleFlags ? firstSampleFlags : defaultFlags;
+					if (trunFlags & TrunSampleDurationPresent) {
+						duration = ReadU32(p + field);
+						field += 4;
+					}
+					if (trunFlags & TrunSampleSizePresent) {
+						size = ReadU32(p + field);
+						field += 4;
+					}
+					if (trunFlags & TrunSampleFlagsPresent) {
+						flags = ReadU32(p + field);
+						field += 4;
+					}
+					if (trunFlags & TrunSampleCompositionTimeOffsetsPresent) {
+						field += 4;
+					}
+					if (dataPosition < mdat.PayloadStart || dataPosition + size > mdat.End) {
+						Error("sample %u of track %u in moof at %zu lies outside the mdat", i, pTrack->Result.TrackId, moof.Start);
+						return;
+					}
+					bool isSync = (flags & SampleIsNonSync) == 0;
+					//Chunks of a fragment may start anywhere, but the track must start where it can be decoded, and the index may only point at sync samples.
+					if (isFirstSample && isSync) {
+						pTrack->SyncMoofOffsets.insert(moof.Start);
+					}
+					if (isFirstSample && pTrack->Result.Samples == 0 && pTrack->Result.IsVideo && !isSync) {
+						Error("track %u does not start on a sync sample, in moof at %zu", pTrack->Result.TrackId, moof.Start);
+					}
+					if (pTrack->Result.IsVideo) {
+						CheckNalUnits(*pTrack, m_pData + dataPosition, size, moof.Start);
+					}
+					pTrack->Result.PayloadHash = Hash(pTrack->Result.PayloadHash, m_pData + dataPosition, size);
+					pTrack->Result.Samples++;
+					pTrack->Result.SyncSamples += isSync ? 1 : 0;
+					decodeTime += duration;
+					dataPosition += size;
+					isFirstSample = false;
+				}
+				pRuns->push_back({ runStart, dataPosition });
+			}
+			pTrack->Result.EndDecodeTime = decodeTime;
+		}
+
+		void CheckNalUnits(_In_ const TRACK_STATE &track, _In_reads_bytes_(size) const BYTE *pSample, _In_ size_t size, _In_ size_t moofStart)
+		{
+			size_t position = 0;
+			UINT32 lengthSize = track.NalLengthSize ? track.NalLengthSize : 4;
+			while (position < size) {
+				if (size - position < lengthSize) {
+					Error("a sample of track %u in moof at %zu ends in a cut off NAL unit length", track.Result.TrackId, moofStart);
+					return;
+				}
+				size_t length = 0;
+				for (UINT32 i = 0; i < lengthSize; i++) {
+					length = (length << 8) | pSample[position + i];
+				}
+				position += lengthSize;
+				if (length == 0 || length > size - position) {
+					Error("a sample of track %u in moof at %zu has a NAL unit of invalid length %zu", track.Result.TrackId, moofStart, length);
+					return;
+				}
+				position += length;
+			}
+		}
+
+		void CheckMfra(_In_ const BOX &mfra)
+		{
+			m_pResult->HasRandomAccessIndex = true;
+			if (mfra.End != m_Size) {
+				Error("the mfra box is not at the end of the file");
+			}
+			std::vector<BOX> children = ReadBoxes(mfra.PayloadStart, mfra.End);
+			if (children.empty() || !IsType(children.back(), "mfro") || children.back().End - children.back().PayloadStart < 8) {
+				Error("the mfra box does not end with an mfro box");
+			}
+			else if (ReadU32(m_pData + children.back().PayloadStart + 4) != mfra.End - mfra.Start) {
+				Error("the mfro box gives an mfra size of %u, not %zu", ReadU32(m_pData + children.back().PayloadStart + 4), mfra.End - mfra.Start);
+			}
+			for (const BOX &tfra : children) {
+				if (!IsType(tfra, "tfra")) {
+					continue;
+				}
+				const BYTE *p = m_pData + tfra.PayloadStart;
+				BYTE version = p[0];
+				TRACK_STATE *pTrack = FindTrack(ReadU32(p + 4));
+				if (!pTrack) {
+					Error("the tfra is for unknown track %u", ReadU32(p + 4));
+					continue;
+				}
+				UINT32 sizes = ReadU32(p + 8);
+				size_t numberBytes = ((sizes >> 4) & 3) + ((sizes >> 2) & 3) + (sizes & 3) + 3;
+				size_t entryBytes = (version == 1 ? 16 : 8) + numberBytes;
+				UINT32 entries = ReadU32(p + 12);
+				if (tfra.PayloadStart + 16 + entryBytes * entries > tfra.End) {
+					Error("the tfra of track %u is cut off", pTrack->Result.TrackId);
+					continue;
+				}
+				for (UINT32 i = 0; i < entries; i++) {
+					const BYTE *pEntry = p + 16 + entryBytes * i;
+					INT64 time = version == 1 ? (INT64)ReadU64(pEntry) : ReadU32(pEntry);
+					UINT64 moofOffset = version == 1 ? ReadU64(pEntry + 8) : ReadU32(pEntry + 4);
+					if (m_MoofOffsets.count((size_t)moofOffset) == 0) {
+						Error("tfra entry %u of track %u points at %llu, which is not a moof", i, pTrack->Result.TrackId, (unsigned long long)moofOffset);
+					}
+					if (pTrack->FragmentTimes.count(time) == 0) {
+						Error("tfra entry %u of track %u is at %lld, where no fragment starts", i, pTrack->Result.TrackId, (long long)time);
+					}
+					if (pTrack->SyncMoofOffsets.count((size_t)moofOffset) == 0) {
+						Error("tfra entry %u of track %u points at moof %llu, where the track does not start on a sync sample", i, pTrack->Result.TrackId, (unsigned long long)moofOffset);
+					}
+				}
+				m_pResult->RandomAccessEntries += entries;
+			}
+		}
+	};
+}
+
+void CheckFragmentedMp4(_In_reads_bytes_(size) const BYTE *pData, _In_ size_t size, _Out_ MP4_CHECK_RESULT *pResult)
+{
+	*pResult = MP4_CHECK_RESULT{};
+	Checker checker(pData, size, pResult);
+	checker.Check();
+}
+
+UINT64 HashAccessUnit(_In_ UINT64 hash, _In_ Mp4Codec codec, _In_reads_bytes_(size) const BYTE *pData, _In_ size_t size)
+{
+	if (codec == Mp4Codec::AAC) {
+		return Hash(hash, pData, size);
+	}
+	bool isHevc = codec == Mp4Codec::HEVC;
+	//Splits at every start code, and hashes each NAL unit the muxer keeps behind the 4 byte length it writes in place of the start code.
+	size_t i = 0;
+	size_t nalStart = 0;
+	bool hasNal = false;
+	auto HashNal = [&](size_t end) {
+		while (end > nalStart && pData[end - 1] == 0) {
+			end--;
+		}
+		if (!hasNal || end == nalStart) {
+			return;
+		}
+		BYTE type = isHevc ? (pData[nalStart] >> 1) & 0x3F : pData[nalStart] & 0x1F;
+		bool isDropped = isHevc ? type >= 32 && type <= 35 : type >= 7 && type <= 9;
+		if (isDropped) {
+			return;
+		}
+		size_t nalSize = end - nalStart;
+		BYTE length[4] = { (BYTE)(nalSize >> 24), (BYTE)(nalSize >> 16), (BYTE)(nalSize >> 8), (BYTE)nalSize };
+		hash = Hash(hash, length, 4);
+		hash = Hash(hash, pData + nalStart, nalSize);
+	};
+	while (i + 2 < size) {
+		if (pData[i] == 0 && pData[i + 1] == 0 && pData[i + 2] == 1) {
+			HashNal(i);
+			nalStart = i + 3;
+			hasNal = true;
+			i += 3;
+		}
+		else {
+			i++;
+		}
+	}
+	HashNal(size);
+	return hash;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include <string>
+#include <vector>
+#include "../ScreenRecorderLibNative/FragmentedMp4Muxer.h"
+
+struct MP4_CHECKED_TRACK {
+	UINT32 TrackId;
+	bool IsVideo;
+	UINT32 Timescale;
+	UINT64 Samples;
+	UINT64 SyncSamples;
+	//The decode time the first fragment of the track starts at, and the last one ends at, in its timescale.
+	INT64 StartDecodeTime;
+	INT64 EndDecodeTime;
+	//A hash of the sample payloads in order, comparable with HashAccessUnits. For video, of the NAL units without their length prefixes.
+	UINT64 PayloadHash;
+};
+
+struct MP4_CHECK_RESULT {
+	//The moof and mdat pairs, i.e. fragments, or chunks of fragments.
+	UINT64 Fragments;
+	//The bytes of the largest moof and mdat together.
+	UINT64 MaxFragmentBytes;
+	std::vector<MP4_CHECKED_TRACK> Tracks;
+	bool HasRandomAccessIndex;
+	UINT64 RandomAccessEntries;
+	//What makes the file nonconforming, or inconsistent with what the muxer promises. Empty if the file is fine.
+	std::vector<std::string> Errors;
+};
+
+/// <summary>
+/// Walks a fragmented MP4 file box by box and checks what a player relies on: an ftyp, then a moov with a sample entry and a trex for every track,
+/// then moof and mdat pairs with consecutive sequence numbers and decode times that continue where the fragment before ended,
+/// track runs that tile the mdat exactly, length prefixed NAL units that tile each video sample, video that starts on a sync sample,
+/// and an mfra that is found through its mfro and points at moof boxes that start on sync samples.
+/// </summary>
+void CheckFragmentedMp4(_In_reads_bytes_(size) const BYTE *pData, _In_ size_t size, _Out_ MP4_CHECK_RESULT *pResult);
+/// <summary>
+/// Continues hash with the payload of access units as the muxer writes them: raw for audio, and for video the NAL units of the Annex B input
+/// without access unit delimiters and parameter sets.
+/// </summary>
+UINT64 HashAccessUnit(_In_ UINT64 hash, _In_ Mp4Codec codec, _In_reads_bytes_(size) const BYTE *pData, _In_ size_t size);
+const UINT64 PayloadHashSeed = 14695981039346656037ULL;
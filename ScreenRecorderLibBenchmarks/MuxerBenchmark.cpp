@@ -0,0 +1,197 @@
+#include "MuxerBenchmark.h"
+#include "MemoryStream.h"
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace {
+	const INT64 HundredNanosPerSecond = 10000000;
+
+	/// <summary>
+	/// Releases the output stream on every way out of the benchmark.
+	/// </summary>
+	struct STREAM_HOLDER {
+		MemoryStream *pStream = nullptr;
+		~STREAM_HOLDER()
+		{
+			if (pStream) {
+				pStream->Release();
+			}
+		}
+	};
+
+	const char *GetCodecName(_In_ Mp4Codec codec)
+	{
+		switch (codec) {
+		case Mp4Codec::H264:
+			return "h264";
+		case Mp4Codec::HEVC:
+			return "hevc";
+		default:
+			return "aac";
+		}
+	}
+
+	/// <summary>
+	/// Reads the first size bytes of the stream, which may be larger, as it was sized up front.
+	/// </summary>
+	HRESULT ReadStream(_In_ IStream *pStream, _In_ UINT64 size, _Out_ std::vector<BYTE> *pData)
+	{
+		LARGE_INTEGER zero{};
+		HRESULT hr = pStream->Seek(zero, STREAM_SEEK_SET, nullptr);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		pData->resize((size_t)size);
+		ULONG read = 0;
+		hr = pStream->Read(pData->data(), (ULONG)pData->size(), &read);
+		if (SUCCEEDED(hr) && read != pData->size()) {
+			hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+		}
+		return hr;
+	}
+
+	/// <summary>
+	/// Compares a track read back with the stream it was muxed from.
+	/// </summary>
+	void CompareTrack(_In_ const ENCODED_STREAM &stream, _In_ const MP4_CHECKED_TRACK &track, _Inout_ MUXER_BENCHMARK_RESULT *pResult)
+	{
+		UINT64 hash = PayloadHashSeed;
+		for (const ENCODED_ACCESS_UNIT &unit : stream.Units) {
+			hash = HashAccessUnit(hash, stream.Track.Codec, stream.Data.data() + unit.Offset, unit.Size);
+		}
+		if (hash != track.PayloadHash || track.Samples != stream.Units.size()) {
+			pResult->IsPayloadIntact = false;
+		}
+		if (track.Timescale > 0) {
+			double endMillis = (double)track.EndDecodeTime * 1000 / track.Timescale;
+			double expectedMillis = (double)GetStreamEndPos(stream) * 1000 / HundredNanosPerSecond;
+			pResult->MaxDurationErrorMillis = (std::max)(pResult->MaxDurationErrorMillis, fabs(endMillis - expectedMillis));
+		}
+	}
+}
+
+HRESULT RunMuxerBenchmark(_In_ const MUXER_BENCHMARK_OPTIONS &options, _Out_ MUXER_BENCHMARK_RESULT *pResult)
+{
+	*pResult = MUXER_BENCHMARK_RESULT{};
+	if (!options.pVideo && !options.pAudio) {
+		return E_INVALIDARG;
+	}
+	STREAM_HOLDER output;
+	HRESULT hr = MemoryStream::CreateInstance(&output.pStream);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	//The memory for the whole file is committed up front, so the throughput is that of the muxer, not of a growing memory stream.
+	ULARGE_INTEGER expectedSize;
+	expectedSize.QuadPart = (options.pVideo ? options.pVideo->Data.size() : 0) + (options.pAudio ? options.pAudio->Data.size() : 0) + 16 * 1024 * 1024;
+	hr = output.pStream->SetSize(expectedSize);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	FragmentedMp4Muxer muxer;
+	hr = muxer.Initialize(output.pStream, options.Muxer);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	const ENCODED_STREAM *streams[] = { options.pVideo, options.pAudio };
+	UINT32 trackIndexes[2] = {};
+	for (int i = 0; i < 2; i++) {
+		if (streams[i]) {
+			hr = muxer.AddTrack(streams[i]->Track, &trackIndexes[i]);
+			if (FAILED(hr)) {
+				return hr;
+			}
+		}
+	}
+	size_t totalUnits = (options.pVideo ? options.pVideo->Units.size() : 0) + (options.pAudio ? options.pAudio->Units.size() : 0);
+	std::vector<double> writeSampleNanos;
+	writeSampleNanos.reserve(totalUnits);
+
+	//Hands the access units over in the order the encoders deliver them, by time, video first.
+	size_t next[2] = {};
+	UINT64 allocationsAtWarmup = 0;
+	bool isWarmedUp = false;
+	for (size_t unit = 0; unit < totalUnits; unit++) {
+		int s = 0;
+		if (!streams[0] || next[0] >= streams[0]->Units.size()) {
+			s = 1;
+		}
+		else if (streams[1] && next[1] < streams[1]->Units.size() && streams[1]->Units[next[1]].StartPos < streams[0]->Units[next[0]].StartPos) {
+			s = 1;
+		}
+		const ENCODED_ACCESS_UNIT &accessUnit = streams[s]->Units[next[s]++];
+		MP4_MUXER_SAMPLE sample;
+		sample.pData = streams[s]->Data.data() + accessUnit.Offset;
+		sample.Size = accessUnit.Size;
+		sample.StartPos = accessUnit.StartPos;
+		sample.DecodePos = accessUnit.StartPos;
+		sample.Duration = accessUnit.Duration;
+		sample.IsKeyFrame = accessUnit.IsKeyFrame;
+		auto start = std::chrono::steady_clock::now();
+		hr = muxer.WriteSample(trackIndexes[s], sample);
+		double nanos = ElapsedNanos(start);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		pResult->MuxNanos += nanos;
+		writeSampleNanos.push_back(nanos);
+		if (!isWarmedUp && muxer.GetStats().Fragments >= options.WarmupFragments) {
+			isWarmedUp = true;
+			allocationsAtWarmup = GetHeapAllocationCount();
+		}
+	}
+	//Finalize writes the last fragment and the index once, when the recording is over, so it does not count towards the steady state.
+	if (isWarmedUp) {
+		pResult->SteadyStateHeapAllocations = GetHeapAllocationCount() - allocationsAtWarmup;
+	}
+	MP4_MUXER_STATS recordingStats = muxer.GetStats();
+	pResult->StreamWritesPerFragment = recordingStats.Fragments > 0 ? (double)recordingStats.Writer.StreamWrites / recordingStats.Fragments : 0;
+	auto start = std::chrono::steady_clock::now();
+	hr = muxer.Finalize();
+	pResult->MuxNanos += ElapsedNanos(start);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	pResult->Stats = muxer.GetStats();
+	pResult->Bytes = pResult->Stats.Writer.BytesWritten;
+	pResult->MegabytesPerSecond = pResult->MuxNanos > 0 ? pResult->Bytes / 1e6 / (pResult->MuxNanos / 1e9) : 0;
+	INT64 mediaEndPos = (std::max)(options.pVideo ? GetStreamEndPos(*options.pVideo) : 0, options.pAudio ? GetStreamEndPos(*options.pAudio) : 0);
+	pResult->RealtimeFactor = pResult->MuxNanos > 0 ? (double)mediaEndPos / HundredNanosPerSecond / (pResult->MuxNanos / 1e9) : 0;
+	pResult->WriteSampleNanos = ComputeBenchmarkStats(writeSampleNanos);
+
+	std::vector<BYTE> file;
+	hr = ReadStream(output.pStream, pResult->Bytes, &file);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	CheckFragmentedMp4(file.data(), file.size(), &pResult->Check);
+	pResult->IsPayloadIntact = pResult->Check.Tracks.size() == (size_t)((options.pVideo ? 1 : 0) + (options.pAudio ? 1 : 0));
+	size_t checkedTrack = 0;
+	for (const ENCODED_STREAM *pStream : streams) {
+		if (pStream && checkedTrack < pResult->Check.Tracks.size()) {
+			CompareTrack(*pStream, pResult->Check.Tracks[checkedTrack++], pResult);
+		}
+	}
+	if (!options.OutputPath.empty()) {
+		std::ofstream outputFile(std::filesystem::path(options.OutputPath), std::ios::binary);
+		outputFile.write(reinterpret_cast<const char *>(file.data()), file.size());
+		if (!outputFile) {
+			return HRESULT_FROM_WIN32(ERROR_WRITE_FAULT);
+		}
+	}
+	return S_OK;
+}
+
+void PrintMuxerBenchmarkResult(_In_ const MUXER_BENCHMARK_OPTIONS &options, _In_ const MUXER_BENCHMARK_RESULT &result)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%s%s%s", options.pVideo ? GetCodecName(options.pVideo->Track.Codec) : "", options.pVideo && options.pAudio ? "+" : "", options.pAudio ? "aac" : "");
+	printf("  %-9s  %5.0f ms  %5u KB   %8.1f MB/s  %7.0fx   %6llu  %6.1f ms   %7.2f     %7.1f / %7.1f us   %6llu   %s\n",
+		name, options.Muxer.FragmentDuration100Nanos / 10000.0, options.Muxer.WriteBufferBytes / 1024, result.MegabytesPerSecond, result.RealtimeFactor,
+		(unsigned long long)result.Stats.Fragments, result.Stats.MaxFragmentDuration100Nanos / 10000.0, result.StreamWritesPerFragment,
+		result.WriteSampleNanos.P99 / 1000, result.WriteSampleNanos.Max / 1000, (unsigned long long)result.SteadyStateHeapAllocations,
+		result.Check.Errors.empty() && result.IsPayloadIntact ? "ok" : "FAILED");
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include <string>
+#include "Benchmark.h"
+#include "EncodedStreams.h"
+#include "Mp4Checker.h"
+
+struct MUXER_BENCHMARK_OPTIONS {
+	//The streams to mux, as the encoders would deliver them. Either may be null, but not both.
+	const ENCODED_STREAM *pVideo = nullptr;
+	const ENCODED_STREAM *pAudio = nullptr;
+	MP4_MUXER_OPTIONS Muxer;
+	//Fragments written before allocations are counted, while the sample buffers grow to the size of a fragment.
+	UINT32 WarmupFragments = 2;
+	//Write the muxed file here, if not empty, to check it with other tools.
+	std::wstring OutputPath;
+};
+
+struct MUXER_BENCHMARK_RESULT {
+	UINT64 Bytes;
+	//The time spent in the muxer, and the bytes it wrote per second of that time.
+	double MuxNanos;
+	double MegabytesPerSecond;
+	//Seconds of media muxed per second of time spent.
+	double RealtimeFactor;
+	//The time of a WriteSample call. The slow ones are those that cut a fragment and write it out.
+	BENCHMARK_STATS WriteSampleNanos;
+	MP4_MUXER_STATS Stats;
+	//The stream writes per fragment cut while recording, the init segment included, but not what Finalize writes.
+	double StreamWritesPerFragment;
+	UINT64 SteadyStateHeapAllocations;
+	//The file read back, box by box.
+	MP4_CHECK_RESULT Check;
+	//Every access unit is in the file, in order and unchanged but for the start codes and in-band parameter sets.
+	bool IsPayloadIntact;
+	//How far the end of each track is from the end of its stream, in milliseconds. The largest of the tracks.
+	double MaxDurationErrorMillis;
+};
+
+/// <summary>
+/// Muxes encoded streams with FragmentedMp4Muxer into a memory stream, as fast as it goes, interleaved by time as the encoders deliver them.
+/// Reports the throughput, the cost of cutting fragments and the writes it takes, and checks the file read back for conformance and for the payload.
+/// </summary>
+HRESULT RunMuxerBenchmark(_In_ const MUXER_BENCHMARK_OPTIONS &options, _Out_ MUXER_BENCHMARK_RESULT *pResult);
+void PrintMuxerBenchmarkResult(_In_ const MUXER_BENCHMARK_OPTIONS &options, _In_ const MUXER_BENCHMARK_RESULT &result);
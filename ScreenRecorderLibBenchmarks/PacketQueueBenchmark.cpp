@@ -0,0 +1,437 @@
+#include "PacketQueueBenchmark.h"
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include "../ScreenRecorderLibNative/AudioCaptureStream.h"
+#include "../ScreenRecorderLibNative/AudioPacketQueue.h"
+
+namespace {
+	//One mono float frame per millisecond, so positions, frames and milliseconds are the same numbers.
+	const UINT32 SampleRate = 1000;
+	const UINT32 BlockAlign = sizeof(float);
+	const UINT64 FrameHundredNanos = 10000000 / SampleRate;
+	const UINT64 QpcBase = 12345678;
+	//What silent packets hold. It must never be read back.
+	const float SilentPacketGarbage = 9999.0f;
+	const size_t MaxReportedErrors = 16;
+
+	/// <summary>
+	/// The frames a read should return. Each frame of audio holds its device position plus one, so silence, which is zero, tells from any of them.
+	/// </summary>
+	class ExpectedFrames {
+	public:
+		ExpectedFrames &Audio(_In_ UINT64 position, _In_ size_t frames)
+		{
+			for (size_t i = 0; i < frames; i++) {
+				Frames.push_back((float)(position + i + 1));
+			}
+			return *this;
+		}
+		ExpectedFrames &Silence(_In_ size_t frames)
+		{
+			Frames.insert(Frames.end(), frames, 0.0f);
+			return *this;
+		}
+		std::vector<float> Frames;
+	};
+
+	void FillPacket(_In_ UINT64 position, _In_ UINT32 frames, _In_ bool isSilent, _Inout_ std::vector<float> &packet)
+	{
+		packet.resize(frames);
+		for (UINT32 i = 0; i < frames; i++) {
+			packet[i] = isSilent ? SilentPacketGarbage : (float)(position + i + 1);
+		}
+	}
+
+	/// <summary>
+	/// Runs the steps of one case, and records every step that does not turn out as expected.
+	/// </summary>
+	class CaseChecker {
+	public:
+		CaseChecker(_In_ const char *name, _Inout_ PACKET_QUEUE_BENCHMARK_RESULT *pResult) :
+			m_Name(name),
+			m_pResult(pResult),
+			m_Step(0)
+		{
+			pResult->Cases++;
+		}
+		void BeginStep()
+		{
+			m_Step++;
+			m_pResult->Checks++;
+		}
+		void Fail(_In_ const char *format, ...)
+		{
+			if (m_pResult->Errors.size() >= MaxReportedErrors) {
+				return;
+			}
+			char message[256];
+			va_list args;
+			va_start(args, format);
+			vsnprintf(message, sizeof(message), format, args);
+			va_end(args);
+			char prefix[96];
+			snprintf(prefix, sizeof(prefix), "%s, step %u: ", m_Name, m_Step);
+			m_pResult->Errors.push_back(std::string(prefix) + message);
+		}
+		void CheckFrames(_In_ const float *pFrames, _In_ size_t frames, _In_ bool isSilent, _In_ const ExpectedFrames &expected, _In_ bool isExpectedSilent)
+		{
+			if (frames != expected.Frames.size()) {
+				Fail("read %zu frames, expected %zu", frames, expected.Frames.size());
+				return;
+			}
+			for (size_t i = 0; i < frames; i++) {
+				if (pFrames[i] != expected.Frames[i]) {
+					Fail("frame %zu is %.0f, expected %.0f", i, pFrames[i], expected.Frames[i]);
+					return;
+				}
+			}
+			if (isSilent != isExpectedSilent) {
+				Fail("read is %s, expected %s", isSilent ? "silent" : "not silent", isExpectedSilent ? "silent" : "not silent");
+			}
+		}
+	private:
+		const char *m_Name;
+		PACKET_QUEUE_BENCHMARK_RESULT *m_pResult;
+		UINT32 m_Step;
+	};
+
+	/// <summary>
+	/// Steps of a case played straight into an AudioPacketQueue, the way AudioCaptureStream writes and reads it.
+	/// </summary>
+	class QueueScript : public CaseChecker {
+	public:
+		QueueScript(_In_ const char *name, _Inout_ PACKET_QUEUE_BENCHMARK_RESULT *pResult, _In_ size_t capacityFrames = 1000, _In_ size_t maxPackets = 16) :
+			CaseChecker(name, pResult)
+		{
+			HRESULT hr = m_Queue.Initialize(SampleRate, BlockAlign, capacityFrames, maxPackets);
+			if (FAILED(hr)) {
+				Fail("initialize failed, hr = 0x%08x", (unsigned)hr);
+			}
+		}
+		void Write(_In_ UINT64 position, _In_ UINT32 frames, _In_ bool isSilent = false, _In_ bool isQueued = true)
+		{
+			BeginStep();
+			FillPacket(position, frames, isSilent, m_Packet);
+			bool result = m_Queue.Write(reinterpret_cast<const BYTE *>(m_Packet.data()), frames, position, QpcBase + position * FrameHundredNanos, isSilent);
+			if (result != isQueued) {
+				Fail("packet at %llu was %s", (unsigned long long)position, result ? "queued, expected it dropped" : "dropped, expected it queued");
+			}
+		}
+		void Read(_In_ size_t frames, _In_ const ExpectedFrames &expected, _In_ bool isExpectedSilent = false)
+		{
+			BeginStep();
+			//Room for more than asked for, so a read past the frames asked for shows up.
+			m_Output.assign(frames + 16, -1.0f);
+			bool isSilent = !isExpectedSilent;
+			size_t read = m_Queue.Read(reinterpret_cast<BYTE *>(m_Output.data()), frames, &isSilent);
+			CheckFrames(m_Output.data(), read, isSilent, expected, isExpectedSilent);
+			for (size_t i = frames; i < m_Output.size(); i++) {
+				if (m_Output[i] != -1.0f) {
+					Fail("frame %zu was written past the %zu frames read", i, frames);
+					break;
+				}
+			}
+		}
+		void Skip(_In_ size_t frames, _In_ size_t expectedSkipped)
+		{
+			BeginStep();
+			size_t skipped = m_Queue.Skip(frames);
+			if (skipped != expectedSkipped) {
+				Fail("skipped %zu frames, expected %zu", skipped, expectedSkipped);
+			}
+		}
+		void Clear()
+		{
+			BeginStep();
+			m_Queue.Clear();
+		}
+		void CheckAvailable(_In_ size_t expectedFrames)
+		{
+			BeginStep();
+			size_t available = m_Queue.GetAvailableFrames();
+			if (available != expectedFrames) {
+				Fail("%zu frames available, expected %zu", available, expectedFrames);
+			}
+		}
+		//Every packet is stamped on the same clock, so the next frame read, also one in a gap, is stamped with its own position.
+		void CheckTimestamp(_In_ UINT64 position)
+		{
+			BeginStep();
+			UINT64 qpcPosition;
+			if (!m_Queue.GetReadTimestamp(&qpcPosition)) {
+				Fail("no timestamp, expected the one of position %llu", (unsigned long long)position);
+			}
+			else if (qpcPosition != QpcBase + position * FrameHundredNanos) {
+				Fail("timestamp is of position %.2f, expected %llu", ((double)qpcPosition - QpcBase) / FrameHundredNanos, (unsigned long long)position);
+			}
+		}
+		void CheckNoTimestamp()
+		{
+			BeginStep();
+			UINT64 qpcPosition;
+			if (m_Queue.GetReadTimestamp(&qpcPosition)) {
+				Fail("timestamp of an empty queue");
+			}
+		}
+		void CheckCounters(_In_ UINT64 gapFrames, _In_ UINT64 droppedPackets, _In_ UINT64 droppedFrames)
+		{
+			BeginStep();
+			if (m_Queue.GetGapFrames() != gapFrames || m_Queue.GetDroppedPacketCount() != droppedPackets || m_Queue.GetDroppedFrames() != droppedFrames) {
+				Fail("%llu gap frames, %llu packets and %llu frames dropped, expected %llu, %llu and %llu",
+					(unsigned long long)m_Queue.GetGapFrames(), (unsigned long long)m_Queue.GetDroppedPacketCount(), (unsigned long long)m_Queue.GetDroppedFrames(),
+					(unsigned long long)gapFrames, (unsigned long long)droppedPackets, (unsigned long long)droppedFrames);
+			}
+		}
+	private:
+		AudioPacketQueue m_Queue;
+		std::vector<float> m_Packet;
+		std::vector<float> m_Output;
+	};
+
+	struct SCRIPTED_PACKET {
+		UINT64 Position;
+		UINT32 Frames;
+		DWORD Flags;
+	};
+
+	/// <summary>
+	/// A capture source that hands out a fixed list of packets, with the flags a WASAPI device sets.
+	/// </summary>
+	class ScriptedAudioSource : public IAudioCaptureSource {
+	public:
+		explicit ScriptedAudioSource(_In_ const std::vector<SCRIPTED_PACKET> &packets) :
+			m_Packets(packets),
+			m_Next(0)
+		{
+		}
+		UINT32 GetSampleRate() override { return SampleRate; }
+		UINT32 GetChannels() override { return 1; }
+		HRESULT GetNextPacketSize(_Out_ UINT32 *pNumFramesInNextPacket) override
+		{
+			*pNumFramesInNextPacket = m_Next < m_Packets.size() ? m_Packets[m_Next].Frames : 0;
+			return S_OK;
+		}
+		HRESULT GetBuffer(_Outptr_ BYTE **ppData, _Out_ UINT32 *pNumFramesToRead, _Out_ DWORD *pdwFlags, _Out_opt_ UINT64 *pu64DevicePosition, _Out_opt_ UINT64 *pu64QPCPosition) override
+		{
+			if (m_Next >= m_Packets.size()) {
+				return E_UNEXPECTED;
+			}
+			const SCRIPTED_PACKET &packet = m_Packets[m_Next];
+			FillPacket(packet.Position, packet.Frames, (packet.Flags & AUDIO_CAPTURE_FLAG_SILENT) != 0, m_Data);
+			*ppData = reinterpret_cast<BYTE *>(m_Data.data());
+			*pNumFramesToRead = packet.Frames;
+			*pdwFlags = packet.Flags;
+			if (pu64DevicePosition) {
+				*pu64DevicePosition = packet.Position;
+			}
+			if (pu64QPCPosition) {
+				*pu64QPCPosition = QpcBase + packet.Position * FrameHundredNanos;
+			}
+			return S_OK;
+		}
+		HRESULT ReleaseBuffer(_In_ UINT32 /*numFramesRead*/) override
+		{
+			m_Next++;
+			return S_OK;
+		}
+	private:
+		std::vector<SCRIPTED_PACKET> m_Packets;
+		size_t m_Next;
+		std::vector<float> m_Data;
+	};
+
+	void RunQueueCases(_Inout_ PACKET_QUEUE_BENCHMARK_RESULT *pResult)
+	{
+		{
+			QueueScript script("contiguous", pResult);
+			script.CheckNoTimestamp();
+			script.Write(0, 100);
+			script.Write(100, 100);
+			script.CheckAvailable(200);
+			script.CheckTimestamp(0);
+			script.Read(150, ExpectedFrames().Audio(0, 150));
+			script.CheckTimestamp(150);
+			script.Read(100, ExpectedFrames().Audio(150, 50));
+			script.Read(100, ExpectedFrames(), true);
+			script.CheckCounters(0, 0, 0);
+		}
+		{
+			QueueScript script("gap", pResult);
+			script.Write(0, 100);
+			script.Write(150, 100);
+			script.CheckAvailable(250);
+			script.Read(120, ExpectedFrames().Audio(0, 100).Silence(20));
+			script.CheckTimestamp(120);
+			script.Read(130, ExpectedFrames().Silence(30).Audio(150, 100));
+			script.CheckCounters(50, 0, 0);
+		}
+		{
+			//Longer than the queue holds, as if the silence had been written to a full buffer.
+			QueueScript script("gap longer than the capacity", pResult);
+			script.Write(0, 100);
+			script.Write(5000, 100);
+			script.Read(1300, ExpectedFrames().Audio(0, 100).Silence(1000).Audio(5000, 100));
+			script.CheckCounters(1000, 0, 0);
+		}
+		{
+			QueueScript script("overlap", pResult);
+			script.Write(0, 100);
+			script.Write(80, 100);
+			script.Write(100, 20);
+			script.Write(180, 20);
+			script.CheckAvailable(200);
+			script.Read(250, ExpectedFrames().Audio(0, 200));
+			script.CheckCounters(0, 0, 0);
+		}
+		{
+			QueueScript script("overlap with audio already read", pResult);
+			script.Write(0, 100);
+			script.Read(100, ExpectedFrames().Audio(0, 100));
+			script.Write(50, 100);
+			script.CheckAvailable(50);
+			script.CheckTimestamp(100);
+			script.Read(100, ExpectedFrames().Audio(100, 50));
+		}
+		{
+			//The queue keeps the order packets came in, so one that arrives less than a packet behind the read position is dropped as an overlap.
+			QueueScript script("out of order", pResult);
+			script.Write(0, 100);
+			script.Write(150, 50);
+			script.Write(100, 50);
+			script.Read(200, ExpectedFrames().Audio(0, 100).Silence(50).Audio(150, 50));
+			script.Read(100, ExpectedFrames(), true);
+			script.CheckCounters(50, 0, 0);
+		}
+		{
+			QueueScript script("device reset", pResult);
+			script.Write(5000, 100);
+			script.Read(100, ExpectedFrames().Audio(5000, 100));
+			script.Write(0, 100);
+			script.CheckTimestamp(0);
+			script.Read(100, ExpectedFrames().Audio(0, 100));
+			script.CheckCounters(0, 0, 0);
+		}
+		{
+			//A stream restarted early in a recording goes back by less than the queue holds, and must not be dropped as an overlap.
+			QueueScript script("device reset within the capacity", pResult);
+			script.Write(0, 100);
+			script.Write(100, 100);
+			script.Write(200, 100);
+			script.Read(300, ExpectedFrames().Audio(0, 300));
+			script.Write(0, 100);
+			script.Write(100, 100);
+			script.CheckAvailable(200);
+			script.CheckTimestamp(0);
+			script.Read(200, ExpectedFrames().Audio(0, 200));
+			script.CheckCounters(0, 0, 0);
+		}
+		{
+			QueueScript script("silent packets", pResult);
+			script.Write(0, 50, true);
+			script.Write(80, 20, true);
+			script.Read(100, ExpectedFrames().Silence(100), true);
+			script.Write(100, 100, true);
+			script.Write(200, 100);
+			script.Read(150, ExpectedFrames().Silence(100).Audio(200, 50));
+			script.Read(50, ExpectedFrames().Audio(250, 50));
+			script.CheckCounters(30, 0, 0);
+		}
+		{
+			//The payload is rounded up to 1024 frames. Silent packets take none of it, and still fit.
+			QueueScript script("full payload", pResult);
+			for (UINT64 position = 0; position < 1000; position += 100) {
+				script.Write(position, 100);
+			}
+			script.Write(1000, 100, false, false);
+			script.Write(1100, 100, true);
+			script.Read(1200, ExpectedFrames().Audio(0, 1000).Silence(200));
+			script.Write(1200, 100);
+			script.Read(100, ExpectedFrames().Audio(1200, 100));
+			script.CheckCounters(100, 1, 100);
+		}
+		{
+			QueueScript script("full packet list", pResult, 1000, 4);
+			for (UINT64 position = 0; position < 40; position += 10) {
+				script.Write(position, 10);
+			}
+			script.Write(40, 10, false, false);
+			script.Read(40, ExpectedFrames().Audio(0, 40));
+			script.Write(50, 10);
+			script.Read(40, ExpectedFrames().Silence(10).Audio(50, 10));
+			script.CheckCounters(10, 1, 10);
+		}
+		{
+			QueueScript script("skip", pResult);
+			script.Write(0, 100);
+			script.Write(150, 100);
+			script.Skip(120, 120);
+			script.CheckTimestamp(120);
+			script.Read(130, ExpectedFrames().Silence(30).Audio(150, 100));
+			script.Skip(10, 0);
+			script.CheckCounters(30, 0, 0);
+		}
+		{
+			QueueScript script("clear", pResult);
+			script.Write(0, 100);
+			script.Read(30, ExpectedFrames().Audio(0, 30));
+			script.Write(100, 100);
+			script.Clear();
+			script.CheckAvailable(0);
+			script.CheckNoTimestamp();
+			script.Write(500, 100);
+			script.Read(100, ExpectedFrames().Audio(500, 100));
+			script.CheckCounters(0, 0, 0);
+		}
+	}
+
+	/// <summary>
+	/// Packets through AudioCaptureStream, which counts the frames a discontinuity flag reports as missing, and queues silent packets as silence whatever they hold.
+	/// </summary>
+	void RunStreamCase(_Inout_ PACKET_QUEUE_BENCHMARK_RESULT *pResult)
+	{
+		CaseChecker checker("discontinuity flags", pResult);
+		//The first packet of a stream commonly reports a spurious discontinuity, and a flag may come without a gap.
+		//A gap without the flag, e.g. from a dropped packet, is not counted as missing, but is still filled.
+		ScriptedAudioSource source({
+			{ 0, 100, AUDIO_CAPTURE_FLAG_DATA_DISCONTINUITY },
+			{ 100, 100, 0 },
+			{ 300, 100, AUDIO_CAPTURE_FLAG_DATA_DISCONTINUITY },
+			{ 400, 100, AUDIO_CAPTURE_FLAG_DATA_DISCONTINUITY },
+			{ 500, 100, AUDIO_CAPTURE_FLAG_SILENT },
+			{ 650, 50, 0 } });
+		AudioCaptureStream stream;
+		checker.BeginStep();
+		HRESULT hr = stream.Initialize(SampleRate, 1, SampleRate, 1, false, false);
+		if (FAILED(hr)) {
+			checker.Fail("initialize failed, hr = 0x%08x", (unsigned)hr);
+			return;
+		}
+		checker.BeginStep();
+		AUDIO_CAPTURE_PASS pass;
+		hr = stream.ReadPackets(&source, &pass);
+		if (FAILED(hr) || pass.Packets != 6 || pass.Frames != 550 || pass.MissingFrames != 100 || pass.DroppedFrames != 0) {
+			checker.Fail("hr = 0x%08x, %u packets, %u frames, %llu missing and %u dropped, expected 6, 550, 100 and 0", (unsigned)hr, pass.Packets, pass.Frames,
+				(unsigned long long)pass.MissingFrames, pass.DroppedFrames);
+		}
+		checker.BeginStep();
+		std::vector<BYTE> buffer;
+		bool isSilent = true;
+		stream.Read(700 * FrameHundredNanos, buffer, nullptr, &isSilent);
+		checker.CheckFrames(reinterpret_cast<const float *>(buffer.data()), buffer.size() / BlockAlign, isSilent,
+			ExpectedFrames().Audio(0, 200).Silence(100).Audio(300, 200).Silence(150).Audio(650, 50), false);
+	}
+}
+
+HRESULT RunPacketQueueBenchmark(_Out_ PACKET_QUEUE_BENCHMARK_RESULT *pResult)
+{
+	*pResult = PACKET_QUEUE_BENCHMARK_RESULT{};
+	RunQueueCases(pResult);
+	RunStreamCase(pResult);
+	return S_OK;
+}
+
+void PrintPacketQueueBenchmarkResult(_In_ const PACKET_QUEUE_BENCHMARK_RESULT &result)
+{
+	printf("  %u cases, %u steps checked, %zu failed\n", result.Cases, result.Checks, result.Errors.size());
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include <string>
+#include <vector>
+
+struct PACKET_QUEUE_BENCHMARK_RESULT {
+	UINT32 Cases;
+	UINT32 Checks;
+	//What the scripts found different from what they expected, prefixed with the case. Should be empty.
+	std::vector<std::string> Errors;
+};
+
+/// <summary>
+/// Plays scripted packet sequences into AudioPacketQueue, and into AudioCaptureStream for the packet flags of the capture source,
+/// and checks what is read back frame by frame: gaps and overlaps in the device positions, packets out of order, device resets,
+/// dropped and silent packets, discontinuity flags, and the timestamps and counters along the way.
+/// </summary>
+HRESULT RunPacketQueueBenchmark(_Out_ PACKET_QUEUE_BENCHMARK_RESULT *pResult);
+void PrintPacketQueueBenchmarkResult(_In_ const PACKET_QUEUE_BENCHMARK_RESULT &result);
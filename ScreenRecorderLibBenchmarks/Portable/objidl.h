@@ -0,0 +1,59 @@
+#pragma once
+//IStream as declared by the Windows SDK, for the portable code that writes to and reads from streams.
+#include <windows.h>
+
+#define STREAM_SEEK_SET 0
+#define STREAM_SEEK_CUR 1
+#define STREAM_SEEK_END 2
+#define STGC_DEFAULT 0
+#define STGTY_STREAM 2
+#define STGM_READ 0x00000000L
+#define STGM_WRITE 0x00000001L
+#define STGM_READWRITE 0x00000002L
+
+typedef struct tagSTATSTG {
+	wchar_t *pwcsName;
+	DWORD type;
+	ULARGE_INTEGER cbSize;
+	INT64 mtime;
+	INT64 ctime;
+	INT64 atime;
+	DWORD grfMode;
+	DWORD grfLocksSupported;
+	GUID clsid;
+	DWORD grfStateBits;
+	DWORD reserved;
+} STATSTG;
+
+inline constexpr IID IID_IUnknown = { 0x00000000, 0x0000, 0x0000, { 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46 } };
+inline constexpr IID IID_ISequentialStream = { 0x0c733a30, 0x2a1c, 0x11ce, { 0xad, 0xe5, 0x00, 0xaa, 0x00, 0x44, 0x77, 0x3d } };
+inline constexpr IID IID_IStream = { 0x0000000c, 0x0000, 0x0000, { 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46 } };
+
+struct IUnknown {
+	virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObject) = 0;
+	virtual ULONG STDMETHODCALLTYPE AddRef() = 0;
+	virtual ULONG STDMETHODCALLTYPE Release() = 0;
+protected:
+	~IUnknown() = default;
+};
+
+struct ISequentialStream : public IUnknown {
+	virtual HRESULT STDMETHODCALLTYPE Read(void *pv, ULONG cb, ULONG *pcbRead) = 0;
+	virtual HRESULT STDMETHODCALLTYPE Write(const void *pv, ULONG cb, ULONG *pcbWritten) = 0;
+protected:
+	~ISequentialStream() = default;
+};
+
+struct IStream : public ISequentialStream {
+	virtual HRESULT STDMETHODCALLTYPE Seek(LARGE_INTEGER dlibMove, DWORD dwOrigin, ULARGE_INTEGER *plibNewPosition) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetSize(ULARGE_INTEGER libNewSize) = 0;
+	virtual HRESULT STDMETHODCALLTYPE CopyTo(IStream *pstm, ULARGE_INTEGER cb, ULARGE_INTEGER *pcbRead, ULARGE_INTEGER *pcbWritten) = 0;
+	virtual HRESULT STDMETHODCALLTYPE Commit(DWORD grfCommitFlags) = 0;
+	virtual HRESULT STDMETHODCALLTYPE Revert() = 0;
+	virtual HRESULT STDMETHODCALLTYPE LockRegion(ULARGE_INTEGER libOffset, ULARGE_INTEGER cb, DWORD dwLockType) = 0;
+	virtual HRESULT STDMETHODCALLTYPE UnlockRegion(ULARGE_INTEGER libOffset, ULARGE_INTEGER cb, DWORD dwLockType) = 0;
+	virtual HRESULT STDMETHODCALLTYPE Stat(STATSTG *pstatstg, DWORD grfStatFlag) = 0;
+	virtual HRESULT STDMETHODCALLTYPE Clone(IStream **ppstm) = 0;
+protected:
+	~IStream() = default;
+};
@@ -0,0 +1,94 @@
+#pragma once
+//Stands in for the Windows SDK when the portable part of the native library and the benchmarks are built on Linux, with the CMake build in the root of the repository.
+//Holds only the types, macros and error codes that code uses. Nothing here is included when building on Windows.
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <sal.h>
+
+typedef unsigned char BYTE;
+typedef int BOOL;
+typedef int16_t INT16;
+typedef uint16_t UINT16;
+typedef int32_t INT32;
+typedef uint32_t UINT32;
+typedef int64_t INT64;
+typedef uint64_t UINT64;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef uint32_t DWORD;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef int32_t HRESULT;
+
+#define TRUE 1
+#define FALSE 0
+
+#define MAXUINT32 ((UINT32)~((UINT32)0))
+#define MAXINT32 ((INT32)(MAXUINT32 >> 1))
+#define MAXUINT64 ((UINT64)~((UINT64)0))
+#define MAXINT64 ((INT64)(MAXUINT64 >> 1))
+#define ARRAYSIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+typedef union _LARGE_INTEGER {
+	struct {
+		DWORD LowPart;
+		LONG HighPart;
+	};
+	LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+typedef union _ULARGE_INTEGER {
+	struct {
+		DWORD LowPart;
+		DWORD HighPart;
+	};
+	ULONGLONG QuadPart;
+} ULARGE_INTEGER;
+
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+#define HRESULT_FROM_WIN32(x) ((HRESULT)(x) <= 0 ? ((HRESULT)(x)) : ((HRESULT)(((x) & 0x0000FFFF) | (7 << 16) | 0x80000000)))
+
+#define S_OK ((HRESULT)0L)
+#define S_FALSE ((HRESULT)1L)
+#define E_NOTIMPL ((HRESULT)0x80004001L)
+#define E_NOINTERFACE ((HRESULT)0x80004002L)
+#define E_POINTER ((HRESULT)0x80004003L)
+#define E_ABORT ((HRESULT)0x80004004L)
+#define E_FAIL ((HRESULT)0x80004005L)
+#define E_UNEXPECTED ((HRESULT)0x8000FFFFL)
+#define E_OUTOFMEMORY ((HRESULT)0x8007000EL)
+#define E_INVALIDARG ((HRESULT)0x80070057L)
+#define E_NOT_VALID_STATE ((HRESULT)0x8007139FL)
+#define STG_E_INVALIDFUNCTION ((HRESULT)0x80030001L)
+#define STG_E_MEDIUMFULL ((HRESULT)0x80030070L)
+
+#define ERROR_FILE_NOT_FOUND 2L
+#define ERROR_INVALID_DATA 13L
+#define ERROR_WRITE_FAULT 29L
+#define ERROR_HANDLE_EOF 38L
+#define ERROR_FILE_TOO_LARGE 223L
+
+#define STDMETHODCALLTYPE
+#define STDMETHODIMP HRESULT STDMETHODCALLTYPE
+#define STDMETHODIMP_(type) type STDMETHODCALLTYPE
+#define UNREFERENCED_PARAMETER(P) (void)(P)
+
+typedef struct _GUID {
+	UINT32 Data1;
+	UINT16 Data2;
+	UINT16 Data3;
+	BYTE Data4[8];
+} GUID;
+typedef GUID IID;
+typedef const IID &REFIID;
+
+inline bool operator==(const GUID &a, const GUID &b)
+{
+	return memcmp(&a, &b, sizeof(GUID)) == 0;
+}
+inline bool operator!=(const GUID &a, const GUID &b)
+{
+	return !(a == b);
+}
@@ -0,0 +1,351 @@
+#include "RecoveryBenchmark.h"
+#include "../ScreenRecorderLibNative/Mp4Recovery.h"
+#include "MemoryStream.h"
+#include <cstdio>
+#include <vector>
+
+namespace {
+	const size_t MaxReportedErrors = 8;
+
+	/// <summary>
+	/// Releases the streams on every way out of the benchmark.
+	/// </summary>
+	struct STREAM_HOLDER {
+		MemoryStream *pStream = nullptr;
+		~STREAM_HOLDER()
+		{
+			if (pStream) {
+				pStream->Release();
+			}
+		}
+	};
+
+	enum class RecoveryDamage {
+		//The output is cut off, and the journal is whole.
+		Truncated,
+		//The journal is cut off too, at a random byte, possibly in the middle of a record.
+		TornJournal,
+		//The output keeps its size, with zeros from the cut on, as a file is left when its size reached the disk and its data did not.
+		ZeroFilledTail,
+		//The output is cut off, and there is no journal to check it against.
+		NoJournal
+	};
+
+	const char *GetDamageName(_In_ RecoveryDamage damage)
+	{
+		switch (damage) {
+		case RecoveryDamage::Truncated:
+			return "truncated";
+		case RecoveryDamage::TornJournal:
+			return "torn journal";
+		case RecoveryDamage::ZeroFilledTail:
+			return "zero filled tail";
+		default:
+			return "no journal";
+		}
+	}
+
+	HRESULT ReadStream(_In_ IStream *pStream, _In_ UINT64 size, _Out_ std::vector<BYTE> *pData)
+	{
+		LARGE_INTEGER zero{};
+		HRESULT hr = pStream->Seek(zero, STREAM_SEEK_SET, nullptr);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		pData->resize((size_t)size);
+		ULONG read = 0;
+		hr = pStream->Read(pData->data(), (ULONG)pData->size(), &read);
+		if (SUCCEEDED(hr) && read != pData->size()) {
+			hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+		}
+		return hr;
+	}
+
+	/// <summary>
+	/// What the recoveries are checked against: the output as it was written, and its parts as the muxer reported them.
+	/// </summary>
+	struct RECOVERY_CONTEXT {
+		const ENCODED_STREAM *Streams[2];
+		//The hash of the first n access units of each stream, at n.
+		std::vector<UINT64> PrefixHashes[2];
+		std::vector<BYTE> Output;
+		std::vector<BYTE> Journal;
+		std::vector<MP4_MUXER_CHUNK> Chunks;
+		UINT64 InitBytes;
+		IStream *pRecovered;
+		std::vector<BYTE> Recovered;
+		double RecoveryNanos;
+		UINT64 RecoveryInputBytes;
+	};
+
+	/// <summary>
+	/// Whether the bytes at offset are as they were written in damaged, which holds the output up to the cut, and zeros after if isZeroFilled.
+	/// </summary>
+	bool IsIntact(_In_ const RECOVERY_CONTEXT &context, _In_ UINT64 offset, _In_ UINT64 bytes, _In_ UINT64 cut, _In_ bool isZeroFilled)
+	{
+		if (offset + bytes <= cut) {
+			return true;
+		}
+		if (!isZeroFilled) {
+			return false;
+		}
+		for (UINT64 i = (std::max)(offset, cut); i < offset + bytes; i++) {
+			if (context.Output[(size_t)i] != 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void AddError(_Inout_ RECOVERY_BENCHMARK_RESULT *pResult, _In_ RecoveryDamage damage, _In_ UINT64 cut, _In_ const std::string &error)
+	{
+		if (pResult->Errors.size() < MaxReportedErrors) {
+			pResult->Errors.push_back(std::string(GetDamageName(damage)) + " at " + std::to_string(cut) + ": " + error);
+		}
+	}
+
+	/// <summary>
+	/// Damages the output as a crash at cut would, recovers it, and checks the recovered file.
+	/// </summary>
+	HRESULT RecoverAndCheck(_Inout_ RECOVERY_CONTEXT &context, _In_ RecoveryDamage damage, _In_ UINT64 cut, _In_ UINT64 journalCut, _Inout_ RECOVERY_BENCHMARK_RESULT *pResult)
+	{
+		bool isZeroFilled = damage == RecoveryDamage::ZeroFilledTail;
+		std::vector<BYTE> damaged(context.Output.begin(), context.Output.begin() + (size_t)cut);
+		if (isZeroFilled) {
+			damaged.resize(context.Output.size(), 0);
+		}
+		STREAM_HOLDER input;
+		STREAM_HOLDER journal;
+		HRESULT hr = MemoryStream::CreateInstance(damaged.data(), damaged.size(), &input.pStream);
+		if (SUCCEEDED(hr) && damage != RecoveryDamage::NoJournal) {
+			hr = MemoryStream::CreateInstance(context.Journal.data(), damage == RecoveryDamage::TornJournal ? (size_t)journalCut : context.Journal.size(), &journal.pStream);
+		}
+		if (FAILED(hr)) {
+			return hr;
+		}
+
+		//The chunks a recovery should keep: those intact on disk, up to the first that is not, and with a journal, up to the last whole record.
+		UINT64 expectedChunks = 0;
+		while (expectedChunks < context.Chunks.size() && IsIntact(context, context.Chunks[(size_t)expectedChunks].Offset, context.Chunks[(size_t)expectedChunks].Bytes, cut, isZeroFilled)) {
+			expectedChunks++;
+		}
+		UINT64 journalRecords = damage == RecoveryDamage::TornJournal ? journalCut / Mp4JournalRecordBytes : context.Journal.size() / Mp4JournalRecordBytes;
+		bool isJournalUsed = damage != RecoveryDamage::NoJournal && journalRecords > 0;
+		if (isJournalUsed) {
+			expectedChunks = (std::min)(expectedChunks, journalRecords - 1);
+		}
+		UINT64 indexOffset = context.Chunks.empty() ? context.InitBytes : context.Chunks.back().Offset + context.Chunks.back().Bytes;
+		bool isExpectedComplete = expectedChunks == context.Chunks.size() && IsIntact(context, indexOffset, context.Output.size() - indexOffset, cut, isZeroFilled)
+			&& (!isJournalUsed || journalRecords == context.Chunks.size() + 2);
+		bool isInitIntact = IsIntact(context, 0, context.InitBytes, cut, isZeroFilled);
+
+		MP4_RECOVERY_RESULT recovery;
+		auto start = std::chrono::steady_clock::now();
+		hr = RecoverFragmentedMp4(input.pStream, journal.pStream, context.pRecovered, &recovery);
+		context.RecoveryNanos += ElapsedNanos(start);
+		context.RecoveryInputBytes += damaged.size();
+		pResult->Recoveries++;
+		if (!isInitIntact) {
+			if (hr != HRESULT_FROM_WIN32(ERROR_INVALID_DATA)) {
+				pResult->WrongChunkCounts++;
+				AddError(pResult, damage, cut, "an output without its init segment was recovered");
+			}
+			return S_OK;
+		}
+		if (FAILED(hr)) {
+			pResult->WrongChunkCounts++;
+			AddError(pResult, damage, cut, "the recovery failed with hr = " + std::to_string((unsigned)hr));
+			return S_OK;
+		}
+		if (recovery.Chunks != expectedChunks || recovery.IsComplete != isExpectedComplete || recovery.IsJournalUsed != isJournalUsed) {
+			pResult->WrongChunkCounts++;
+			AddError(pResult, damage, cut, "recovered " + std::to_string(recovery.Chunks) + " chunks of " + std::to_string(expectedChunks)
+				+ (recovery.IsComplete ? ", complete" : "") + (recovery.IsJournalUsed ? ", with the journal" : ""));
+		}
+
+		hr = ReadStream(context.pRecovered, recovery.RecoveredBytes, &context.Recovered);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		MP4_CHECK_RESULT check;
+		CheckFragmentedMp4(context.Recovered.data(), context.Recovered.size(), &check);
+		bool isDamaged = !check.Errors.empty() || check.Fragments != recovery.Chunks || !check.HasRandomAccessIndex;
+		for (size_t s = 0, checkedTrack = 0; s < 2; s++) {
+			if (!context.Streams[s]) {
+				continue;
+			}
+			if (checkedTrack >= check.Tracks.size()) {
+				isDamaged = true;
+				break;
+			}
+			const MP4_CHECKED_TRACK &track = check.Tracks[checkedTrack++];
+			if (track.Samples >= context.PrefixHashes[s].size() || track.PayloadHash != context.PrefixHashes[s][(size_t)track.Samples]) {
+				isDamaged = true;
+			}
+		}
+		if (isDamaged) {
+			pResult->DamagedOutputs++;
+			AddError(pResult, damage, cut, check.Errors.empty() ? "the recovered tracks are not the start of the streams" : check.Errors.front());
+		}
+		return S_OK;
+	}
+}
+
+HRESULT RunRecoveryBenchmark(_In_ const RECOVERY_BENCHMARK_OPTIONS &options, _Out_ RECOVERY_BENCHMARK_RESULT *pResult)
+{
+	*pResult = RECOVERY_BENCHMARK_RESULT{};
+	if (!options.pVideo) {
+		return E_INVALIDARG;
+	}
+	STREAM_HOLDER output;
+	STREAM_HOLDER journal;
+	STREAM_HOLDER recovered;
+	HRESULT hr = MemoryStream::CreateInstance(&output.pStream);
+	if (SUCCEEDED(hr)) {
+		hr = MemoryStream::CreateInstance(&journal.pStream);
+	}
+	if (SUCCEEDED(hr)) {
+		hr = MemoryStream::CreateInstance(&recovered.pStream);
+	}
+	if (FAILED(hr)) {
+		return hr;
+	}
+	RECOVERY_CONTEXT context{};
+	context.Streams[0] = options.pVideo;
+	context.Streams[1] = options.pAudio;
+	context.pRecovered = recovered.pStream;
+	MP4_MUXER_OPTIONS muxerOptions = options.Muxer;
+	muxerOptions.OnChunkWritten = [&](const MP4_MUXER_CHUNK &chunk) {
+		context.Chunks.push_back(chunk);
+	};
+	if (options.IsJournalEnabled) {
+		muxerOptions.OpenJournalStream = [&](UINT32 /*segmentNumber*/, IStream **ppStream) {
+			*ppStream = journal.pStream;
+			return S_OK;
+		};
+	}
+	FragmentedMp4Muxer muxer;
+	hr = muxer.Initialize(output.pStream, muxerOptions);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	UINT32 trackIndexes[2] = {};
+	for (int i = 0; i < 2; i++) {
+		if (context.Streams[i]) {
+			hr = muxer.AddTrack(context.Streams[i]->Track, &trackIndexes[i]);
+			if (FAILED(hr)) {
+				return hr;
+			}
+		}
+	}
+
+	//Hands the access units over in the order the encoders deliver them, by time, video first.
+	const ENCODED_STREAM *const *inputs = context.Streams;
+	size_t totalUnits = inputs[0]->Units.size() + (inputs[1] ? inputs[1]->Units.size() : 0);
+	size_t next[2] = {};
+	auto start = std::chrono::steady_clock::now();
+	for (size_t unit = 0; unit < totalUnits; unit++) {
+		int s = 0;
+		if (next[0] >= inputs[0]->Units.size()) {
+			s = 1;
+		}
+		else if (inputs[1] && next[1] < inputs[1]->Units.size() && inputs[1]->Units[next[1]].StartPos < inputs[0]->Units[next[0]].StartPos) {
+			s = 1;
+		}
+		const ENCODED_ACCESS_UNIT &accessUnit = inputs[s]->Units[next[s]++];
+		MP4_MUXER_SAMPLE sample;
+		sample.pData = inputs[s]->Data.data() + accessUnit.Offset;
+		sample.Size = accessUnit.Size;
+		sample.StartPos = accessUnit.StartPos;
+		sample.DecodePos = accessUnit.StartPos;
+		sample.Duration = accessUnit.Duration;
+		sample.IsKeyFrame = accessUnit.IsKeyFrame;
+		hr = muxer.WriteSample(trackIndexes[s], sample);
+		if (FAILED(hr)) {
+			return hr;
+		}
+	}
+	hr = muxer.Finalize();
+	if (FAILED(hr)) {
+		return hr;
+	}
+	pResult->MuxMillis = ElapsedNanos(start) / 1e6;
+	MP4_MUXER_STATS stats = muxer.GetStats();
+	pResult->OutputBytes = stats.Writer.BytesWritten;
+	pResult->Chunks = stats.Chunks;
+	pResult->Commits = stats.Writer.Commits;
+	pResult->JournalBytes = stats.JournalBytes;
+	if (options.Truncations == 0 || context.Chunks.empty()) {
+		return S_OK;
+	}
+
+	hr = ReadStream(output.pStream, stats.Writer.BytesWritten, &context.Output);
+	if (SUCCEEDED(hr)) {
+		hr = ReadStream(journal.pStream, stats.JournalBytes, &context.Journal);
+	}
+	if (FAILED(hr)) {
+		return hr;
+	}
+	context.InitBytes = context.Chunks.front().Offset;
+	for (int s = 0; s < 2; s++) {
+		if (inputs[s]) {
+			UINT64 hash = PayloadHashSeed;
+			context.PrefixHashes[s].push_back(hash);
+			for (const ENCODED_ACCESS_UNIT &accessUnit : inputs[s]->Units) {
+				hash = HashAccessUnit(hash, inputs[s]->Track.Codec, inputs[s]->Data.data() + accessUnit.Offset, accessUnit.Size);
+				context.PrefixHashes[s].push_back(hash);
+			}
+		}
+	}
+
+	//The whole output, and one cut off in its init segment, then cuts anywhere after the init segment.
+	uint32_t random = options.Seed * 2654435761u + 1;
+	std::vector<RecoveryDamage> damages = { RecoveryDamage::NoJournal };
+	if (options.IsJournalEnabled) {
+		damages = { RecoveryDamage::Truncated, RecoveryDamage::TornJournal, RecoveryDamage::ZeroFilledTail, RecoveryDamage::NoJournal };
+	}
+	UINT64 outputBytes = context.Output.size();
+	for (UINT32 i = 0; i < options.Truncations + 2; i++) {
+		UINT64 cut = outputBytes;
+		if (i == 1) {
+			cut = context.InitBytes / 2;
+		}
+		else if (i > 1) {
+			random ^= random << 13;
+			random ^= random >> 17;
+			random ^= random << 5;
+			cut = context.InitBytes + (UINT64)random % (outputBytes - context.InitBytes);
+		}
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		UINT64 journalCut = (UINT64)random % (context.Journal.size() + 1);
+		for (RecoveryDamage damage : damages) {
+			hr = RecoverAndCheck(context, damage, cut, journalCut, pResult);
+			if (FAILED(hr)) {
+				return hr;
+			}
+		}
+	}
+	pResult->RecoveryMBPerSecond = context.RecoveryNanos > 0 ? context.RecoveryInputBytes / (1024.0 * 1024.0) / (context.RecoveryNanos / 1e9) : 0;
+	return S_OK;
+}
+
+void PrintRecoveryBenchmarkResult(_In_ const RECOVERY_BENCHMARK_OPTIONS &options, _In_ const RECOVERY_BENCHMARK_RESULT &result)
+{
+	char interval[32];
+	if (options.Muxer.CommitInterval100Nanos < 0) {
+		snprintf(interval, sizeof(interval), "never");
+	}
+	else if (options.Muxer.CommitInterval100Nanos == 0) {
+		snprintf(interval, sizeof(interval), "chunk");
+	}
+	else {
+		snprintf(interval, sizeof(interval), "%.0f ms", options.Muxer.CommitInterval100Nanos / 10000.0);
+	}
+	printf("  %-7s  %-7s  %6llu   %6llu   %7.1f KB  %6.3f %%   %7.1f ms    %6llu     %4llu / %-4llu   %7.0f MB/s   %s\n",
+		interval, options.IsJournalEnabled ? "yes" : "no", (unsigned long long)result.Chunks, (unsigned long long)result.Commits, result.JournalBytes / 1024.0,
+		result.OutputBytes > 0 ? 100.0 * result.JournalBytes / result.OutputBytes : 0.0, result.MuxMillis, (unsigned long long)result.Recoveries,
+		(unsigned long long)result.WrongChunkCounts, (unsigned long long)result.DamagedOutputs, result.RecoveryMBPerSecond,
+		result.WrongChunkCounts == 0 && result.DamagedOutputs == 0 ? "ok" : "FAILED");
+}
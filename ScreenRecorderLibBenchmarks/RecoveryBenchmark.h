@@ -0,0 +1,47 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include <string>
+#include "Benchmark.h"
+#include "EncodedStreams.h"
+#include "Mp4Checker.h"
+
+struct RECOVERY_BENCHMARK_OPTIONS {
+	//The streams to mux, as the encoders would deliver them.
+	const ENCODED_STREAM *pVideo = nullptr;
+	const ENCODED_STREAM *pAudio = nullptr;
+	//The fragments, chunks and commit interval of the crash safe output.
+	MP4_MUXER_OPTIONS Muxer;
+	bool IsJournalEnabled = true;
+	//The outputs cut off at random offsets to recover, each with every kind of damage. 0 only measures what the crash safe mode costs.
+	UINT32 Truncations = 100;
+	UINT32 Seed = 1;
+};
+
+struct RECOVERY_BENCHMARK_RESULT {
+	UINT64 OutputBytes;
+	UINT64 Chunks;
+	//What the crash safe mode adds: the commits, which each wait for the disk in a file, and the bytes of the journal.
+	UINT64 Commits;
+	UINT64 JournalBytes;
+	//The time the muxer took for the whole recording, Finalize included.
+	double MuxMillis;
+	UINT64 Recoveries;
+	//Recoveries that kept more or fewer chunks than reached the disk intact, or failed. Should be zero.
+	UINT64 WrongChunkCounts;
+	//Recoveries whose file the checker finds fault with, or whose tracks do not hold the start of the streams unchanged. Should be zero.
+	UINT64 DamagedOutputs;
+	//How fast RecoverFragmentedMp4 went, over the bytes of all inputs.
+	double RecoveryMBPerSecond;
+	//The first few faults found, with the damage and the offset of the cut in front.
+	std::vector<std::string> Errors;
+};
+
+/// <summary>
+/// Muxes encoded streams with FragmentedMp4Muxer into a crash safe output in memory, with a recovery journal, and reports the cost of the commits and the journal.
+/// Then cuts the output off at random offsets, as a crash would, and recovers it with RecoverFragmentedMp4: with the journal, with the journal torn at a random record,
+/// with the tail zero filled as a power loss leaves a file, and with no journal. Checks that each recovered file is conforming,
+/// holds the start of the streams unchanged, and keeps exactly the chunks that reached the disk intact.
+/// </summary>
+HRESULT RunRecoveryBenchmark(_In_ const RECOVERY_BENCHMARK_OPTIONS &options, _Out_ RECOVERY_BENCHMARK_RESULT *pResult);
+void PrintRecoveryBenchmarkResult(_In_ const RECOVERY_BENCHMARK_OPTIONS &options, _In_ const RECOVERY_BENCHMARK_RESULT &result);
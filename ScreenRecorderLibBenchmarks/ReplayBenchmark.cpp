@@ -0,0 +1,328 @@
+#include "ReplayBenchmark.h"
+#include "MemoryStream.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+	const INT64 HundredNanosPerSecond = 10000000;
+	const size_t MaxReportedErrors = 8;
+
+	/// <summary>
+	/// A save of the window, and the file it made.
+	/// </summary>
+	struct SAVED_REPLAY {
+		//Where the streams were when the save was asked for.
+		INT64 RequestPos;
+		HRESULT Result;
+		REPLAY_SAVE_RESULT Save;
+		MemoryStream *pStream;
+		double Millis;
+	};
+
+	/// <summary>
+	/// Releases the streams of the saves on every way out of the benchmark.
+	/// </summary>
+	struct SAVED_REPLAYS {
+		std::vector<SAVED_REPLAY> Saves;
+		~SAVED_REPLAYS()
+		{
+			for (SAVED_REPLAY &save : Saves) {
+				if (save.pStream) {
+					save.pStream->Release();
+				}
+			}
+		}
+	};
+
+	/// <summary>
+	/// Converts a time to the timescale of a track, rounded as the muxer does.
+	/// </summary>
+	INT64 ToTimescale(_In_ INT64 time100Nanos, _In_ UINT32 timescale)
+	{
+		return (time100Nanos * timescale + HundredNanosPerSecond / 2) / HundredNanosPerSecond;
+	}
+
+	HRESULT ReadStream(_In_ IStream *pStream, _In_ UINT64 size, _Out_ std::vector<BYTE> *pData)
+	{
+		LARGE_INTEGER zero{};
+		HRESULT hr = pStream->Seek(zero, STREAM_SEEK_SET, nullptr);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		pData->resize((size_t)size);
+		ULONG read = 0;
+		hr = pStream->Read(pData->data(), (ULONG)pData->size(), &read);
+		if (SUCCEEDED(hr) && read != pData->size()) {
+			hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+		}
+		return hr;
+	}
+
+	void AddError(_Inout_ REPLAY_BENCHMARK_RESULT *pResult, _In_ const SAVED_REPLAY &save, _In_ const std::string &error)
+	{
+		if (pResult->Errors.size() < MaxReportedErrors) {
+			char prefix[64];
+			snprintf(prefix, sizeof(prefix), "save at %.1f s: ", (double)save.RequestPos / HundredNanosPerSecond);
+			pResult->Errors.push_back(prefix + error);
+		}
+	}
+
+	/// <summary>
+	/// Finds the access unit of a stream a track of a saved file starts with, from where the track starts in the file and where time 0 of the file is in the stream.
+	/// Returns the number of access units if there is none.
+	/// </summary>
+	size_t FindFirstUnit(_In_ const ENCODED_STREAM &stream, _In_ const MP4_CHECKED_TRACK &track, _In_ INT64 originPos)
+	{
+		INT64 approximatePos = originPos + track.StartDecodeTime * HundredNanosPerSecond / track.Timescale - HundredNanosPerSecond / track.Timescale;
+		auto it = std::lower_bound(stream.Units.begin(), stream.Units.end(), approximatePos, [](const ENCODED_ACCESS_UNIT &unit, INT64 pos) { return unit.StartPos < pos; });
+		for (; it != stream.Units.end() && ToTimescale(it->StartPos - originPos, track.Timescale) <= track.StartDecodeTime; it++) {
+			if (ToTimescale(it->StartPos - originPos, track.Timescale) == track.StartDecodeTime) {
+				return it - stream.Units.begin();
+			}
+		}
+		return stream.Units.size();
+	}
+
+	/// <summary>
+	/// Checks a saved file: that it is conforming, and each track is a run of access units of its stream, the video starting on a keyframe. Returns false if not.
+	/// </summary>
+	bool CheckSavedReplay(_In_ const REPLAY_BENCHMARK_OPTIONS &options, _In_ const SAVED_REPLAY &save, _Inout_ REPLAY_BENCHMARK_RESULT *pResult)
+	{
+		if (FAILED(save.Result)) {
+			char error[64];
+			snprintf(error, sizeof(error), "failed, hr = 0x%08x", (unsigned)save.Result);
+			AddError(pResult, save, error);
+			return false;
+		}
+		std::vector<BYTE> file;
+		if (FAILED(ReadStream(save.pStream, save.Save.Bytes, &file))) {
+			AddError(pResult, save, "the file can not be read back");
+			return false;
+		}
+		MP4_CHECK_RESULT check;
+		CheckFragmentedMp4(file.data(), file.size(), &check);
+		for (const std::string &error : check.Errors) {
+			AddError(pResult, save, error);
+		}
+		bool isIntact = check.Errors.empty();
+		const ENCODED_STREAM *inputs[] = { options.pVideo, options.pAudio };
+		size_t checkedTrack = 0;
+		for (int s = 0; s < 2; s++) {
+			if (!inputs[s]) {
+				continue;
+			}
+			if (checkedTrack >= check.Tracks.size() || check.Tracks[checkedTrack].Samples == 0) {
+				AddError(pResult, save, "a track is missing");
+				return false;
+			}
+			const MP4_CHECKED_TRACK &track = check.Tracks[checkedTrack++];
+			const ENCODED_STREAM &stream = *inputs[s];
+			size_t firstUnit = FindFirstUnit(stream, track, save.Save.StartPos);
+			if (firstUnit + track.Samples > stream.Units.size()) {
+				AddError(pResult, save, "a track does not start on an access unit of its stream");
+				isIntact = false;
+				continue;
+			}
+			if (track.IsVideo && !stream.Units[firstUnit].IsKeyFrame) {
+				AddError(pResult, save, "the video does not start on a keyframe");
+				isIntact = false;
+			}
+			UINT64 hash = PayloadHashSeed;
+			for (size_t i = firstUnit; i < firstUnit + track.Samples; i++) {
+				hash = HashAccessUnit(hash, stream.Track.Codec, stream.Data.data() + stream.Units[i].Offset, stream.Units[i].Size);
+			}
+			if (hash != track.PayloadHash) {
+				AddError(pResult, save, "a track is not a run of access units of its stream");
+				isIntact = false;
+			}
+		}
+		return isIntact;
+	}
+}
+
+HRESULT RunReplayBenchmark(_In_ const REPLAY_BENCHMARK_OPTIONS &options, _Out_ REPLAY_BENCHMARK_RESULT *pResult)
+{
+	*pResult = REPLAY_BENCHMARK_RESULT{};
+	if (!options.pVideo) {
+		return E_INVALIDARG;
+	}
+	ReplayBuffer buffer;
+	UINT64 heapBytesBefore = GetHeapAllocatedBytes();
+	HRESULT hr = buffer.Initialize(options.Buffer);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	pResult->HeapBytes = GetHeapAllocatedBytes() - heapBytesBefore;
+	const ENCODED_STREAM *inputs[] = { options.pVideo, options.pAudio };
+	UINT32 trackIndexes[2] = {};
+	for (int i = 0; i < 2; i++) {
+		if (inputs[i]) {
+			hr = buffer.AddTrack(inputs[i]->Track, &trackIndexes[i]);
+			if (FAILED(hr)) {
+				return hr;
+			}
+		}
+	}
+	size_t totalUnits = options.pVideo->Units.size() + (options.pAudio ? options.pAudio->Units.size() : 0);
+	std::vector<double> writeSampleMicros;
+	writeSampleMicros.reserve(totalUnits);
+
+	//The saves run on a thread of their own, as a save asked for by the application would, one after the other.
+	SAVED_REPLAYS saved;
+	saved.Saves.reserve(options.SavePositions.size());
+	std::mutex saveMutex;
+	std::condition_variable saveRequested;
+	size_t requestedSaves = 0;
+	bool isStopping = false;
+	std::atomic<bool> isSaving{ false };
+	std::thread saver([&]() {
+		for (size_t save = 0;; save++) {
+			{
+				std::unique_lock<std::mutex> lock(saveMutex);
+				saveRequested.wait(lock, [&]() { return requestedSaves > save || isStopping; });
+				if (requestedSaves <= save) {
+					return;
+				}
+			}
+			SAVED_REPLAY savedReplay{};
+			savedReplay.RequestPos = options.SavePositions[save];
+			savedReplay.Result = MemoryStream::CreateInstance(&savedReplay.pStream);
+			isSaving = true;
+			auto start = std::chrono::steady_clock::now();
+			if (SUCCEEDED(savedReplay.Result)) {
+				savedReplay.Result = buffer.Save(savedReplay.pStream, options.Muxer, &savedReplay.Save);
+			}
+			savedReplay.Millis = ElapsedNanos(start) / 1e6;
+			isSaving = false;
+			std::lock_guard<std::mutex> lock(saveMutex);
+			saved.Saves.push_back(savedReplay);
+		}
+	});
+
+	//Hands the access units over in the order the encoders deliver them, by time, video first, at the pace of the recording sped up.
+	auto runStart = std::chrono::steady_clock::now();
+	size_t nextSave = 0;
+	UINT64 warmHeapAllocations = 0;
+	bool isWarm = false;
+	bool isCountingAllocations = true;
+	double writeNanos = 0;
+	UINT64 writtenBytes = 0;
+	size_t next[2] = {};
+	for (size_t unit = 0; unit < totalUnits && SUCCEEDED(hr); unit++) {
+		int s = 0;
+		if (next[0] >= inputs[0]->Units.size()) {
+			s = 1;
+		}
+		else if (inputs[1] && next[1] < inputs[1]->Units.size() && inputs[1]->Units[next[1]].StartPos < inputs[0]->Units[next[0]].StartPos) {
+			s = 1;
+		}
+		const ENCODED_ACCESS_UNIT &accessUnit = inputs[s]->Units[next[s]++];
+		if (options.Speed > 0) {
+			std::this_thread::sleep_until(runStart + std::chrono::nanoseconds((INT64)(accessUnit.StartPos * 100 / options.Speed)));
+		}
+		if (!isWarm && accessUnit.StartPos >= HundredNanosPerSecond) {
+			isWarm = true;
+			warmHeapAllocations = GetHeapAllocationCount();
+		}
+		while (nextSave < options.SavePositions.size() && accessUnit.StartPos >= options.SavePositions[nextSave]) {
+			if (isCountingAllocations && isWarm) {
+				pResult->SteadyStateHeapAllocations = GetHeapAllocationCount() - warmHeapAllocations;
+			}
+			isCountingAllocations = false;
+			std::lock_guard<std::mutex> lock(saveMutex);
+			requestedSaves = ++nextSave;
+			saveRequested.notify_one();
+		}
+		MP4_MUXER_SAMPLE sample;
+		sample.pData = inputs[s]->Data.data() + accessUnit.Offset;
+		sample.Size = accessUnit.Size;
+		sample.StartPos = accessUnit.StartPos;
+		sample.DecodePos = accessUnit.StartPos;
+		sample.Duration = accessUnit.Duration;
+		sample.IsKeyFrame = accessUnit.IsKeyFrame;
+		bool isDuringSave = isSaving;
+		auto start = std::chrono::steady_clock::now();
+		hr = buffer.WriteSample(trackIndexes[s], sample);
+		double nanos = ElapsedNanos(start);
+		isDuringSave = isDuringSave || isSaving;
+		writeNanos += nanos;
+		writtenBytes += accessUnit.Size;
+		writeSampleMicros.push_back(nanos / 1000);
+		if (isDuringSave) {
+			pResult->MaxWriteSampleMicrosDuringSave = (std::max)(pResult->MaxWriteSampleMicrosDuringSave, nanos / 1000);
+		}
+		REPLAY_BUFFER_STATS stats = buffer.GetStats();
+		pResult->MaxWindowBytes = (std::max)(pResult->MaxWindowBytes, stats.Bytes);
+		//A save keeps the window from being shortened for its duration, until it has copied it out.
+		if (!isDuringSave && !isSaving) {
+			pResult->MaxWindowSeconds = (std::max)(pResult->MaxWindowSeconds, (double)stats.Duration / HundredNanosPerSecond);
+		}
+	}
+	if (isCountingAllocations && isWarm) {
+		pResult->SteadyStateHeapAllocations = GetHeapAllocationCount() - warmHeapAllocations;
+	}
+	{
+		std::lock_guard<std::mutex> lock(saveMutex);
+		isStopping = true;
+		saveRequested.notify_one();
+	}
+	saver.join();
+	if (FAILED(hr)) {
+		return hr;
+	}
+
+	REPLAY_BUFFER_STATS stats = buffer.GetStats();
+	pResult->Samples = totalUnits;
+	pResult->InsertMBPerSecond = writeNanos > 0 ? writtenBytes / (1024.0 * 1024.0) / (writeNanos / 1e9) : 0;
+	pResult->WriteSampleMicros = ComputeBenchmarkStats(writeSampleMicros);
+	pResult->MemoryBytes = stats.MemoryBytes;
+	pResult->EvictedSamples = stats.EvictedSamples;
+	pResult->DroppedSamples = stats.DroppedSamples;
+	pResult->Saves = stats.Saves;
+	pResult->TruncatedSaves = stats.TruncatedSaves;
+	pResult->MaxSaveBatchBytes = stats.MaxSaveBatchBytes;
+	double saveMillis = 0;
+	UINT64 savedBytes = 0;
+	pResult->MinSavedSeconds = 1e9;
+	for (const SAVED_REPLAY &save : saved.Saves) {
+		if (!CheckSavedReplay(options, save, pResult)) {
+			pResult->DamagedSaves++;
+			continue;
+		}
+		double savedSeconds = (double)save.Save.Duration / HundredNanosPerSecond;
+		if (!save.Save.IsTruncated) {
+			pResult->MinSavedSeconds = (std::min)(pResult->MinSavedSeconds, savedSeconds);
+		}
+		pResult->MaxSavedSeconds = (std::max)(pResult->MaxSavedSeconds, savedSeconds);
+		pResult->MaxSaveMillis = (std::max)(pResult->MaxSaveMillis, save.Millis);
+		saveMillis += save.Millis;
+		savedBytes += save.Save.Bytes;
+	}
+	if (pResult->MinSavedSeconds > pResult->MaxSavedSeconds) {
+		pResult->MinSavedSeconds = 0;
+	}
+	pResult->SaveMBPerSecond = saveMillis > 0 ? savedBytes / (1024.0 * 1024.0) / (saveMillis / 1000) : 0;
+	return S_OK;
+}
+
+void PrintReplayBenchmarkResult(_In_ const REPLAY_BENCHMARK_OPTIONS &options, _In_ const REPLAY_BENCHMARK_RESULT &result)
+{
+	char speed[16];
+	if (options.Speed > 0) {
+		snprintf(speed, sizeof(speed), "%.0fx", options.Speed);
+	}
+	else {
+		snprintf(speed, sizeof(speed), "max");
+	}
+	printf("  %4.0f s  %5.0f MB  %5s  %8.0f MB/s  %6.1f / %7.1f us  %7.1f us   %4llu  %6.1f / %6.1f MB  %5.1f s   %2llu / %-2llu  %5.1f / %5.1f s  %6.0f MB/s  %6.1f ms  %s\n",
+		(double)options.Buffer.Duration100Nanos / HundredNanosPerSecond, options.Buffer.MaxBytes / (1024.0 * 1024.0), speed,
+		result.InsertMBPerSecond, result.WriteSampleMicros.P99, result.WriteSampleMicros.Max, result.MaxWriteSampleMicrosDuringSave,
+		(unsigned long long)result.SteadyStateHeapAllocations, result.MaxWindowBytes / (1024.0 * 1024.0), result.MemoryBytes / (1024.0 * 1024.0),
+		result.MaxWindowSeconds, (unsigned long long)result.Saves, (unsigned long long)result.TruncatedSaves, result.MinSavedSeconds, result.MaxSavedSeconds,
+		result.SaveMBPerSecond, result.MaxSaveMillis, result.Errors.empty() && result.DamagedSaves == 0 ? "ok" : "FAILED");
+}
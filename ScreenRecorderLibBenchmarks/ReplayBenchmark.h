@@ -0,0 +1,60 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include <string>
+#include <vector>
+#include "Benchmark.h"
+#include "EncodedStreams.h"
+#include "Mp4Checker.h"
+#include "../ScreenRecorderLibNative/ReplayBuffer.h"
+
+struct REPLAY_BENCHMARK_OPTIONS {
+	//The streams to keep, as the encoders would deliver them.
+	const ENCODED_STREAM *pVideo = nullptr;
+	const ENCODED_STREAM *pAudio = nullptr;
+	REPLAY_BUFFER_OPTIONS Buffer;
+	//The fragments of the saved files.
+	MP4_MUXER_OPTIONS Muxer;
+	//How many times faster than real time the access units are handed over. 0 hands them over as fast as the buffer takes them.
+	double Speed = 50;
+	//When, on the timeline of the streams, to save the window, on a thread of its own while the access units go on being written, in 100 nanosecond units.
+	std::vector<INT64> SavePositions;
+};
+
+struct REPLAY_BENCHMARK_RESULT {
+	UINT64 Samples;
+	//How fast WriteSample copies access units in, over the time spent in it, and how long a call takes, overall and the longest while a save was going on.
+	double InsertMBPerSecond;
+	BENCHMARK_STATS WriteSampleMicros;
+	double MaxWriteSampleMicrosDuringSave;
+	//Heap allocations made while writing, from the first second on until the first save. Should be zero.
+	UINT64 SteadyStateHeapAllocations;
+	//The memory the buffer took, by its own count and by the heap, and the most bytes and the longest window it held while no save was going on.
+	UINT64 MemoryBytes;
+	UINT64 HeapBytes;
+	UINT64 MaxWindowBytes;
+	double MaxWindowSeconds;
+	UINT64 EvictedSamples;
+	UINT64 DroppedSamples;
+	UINT64 Saves;
+	UINT64 TruncatedSaves;
+	//The most bytes a save copied out at once, while writing waited.
+	UINT64 MaxSaveBatchBytes;
+	//The shortest window saved whole, the longest saved, how fast the saves went, over the bytes of the files, and the longest one.
+	double MinSavedSeconds;
+	double MaxSavedSeconds;
+	double SaveMBPerSecond;
+	double MaxSaveMillis;
+	//Saved files the checker finds fault with, that do not start on a keyframe, or whose tracks are not a run of access units of the streams unchanged. Should be zero.
+	UINT64 DamagedSaves;
+	//The first few faults found.
+	std::vector<std::string> Errors;
+};
+
+/// <summary>
+/// Writes encoded streams into a ReplayBuffer, paced at a multiple of real time, and saves its window at the given positions on another thread while writing goes on.
+/// Reports the cost of a write, and how long a save holds one up, the heap allocations of writing, the memory the buffer takes, and how fast a save goes.
+/// Checks that every saved file is conforming, starts on a keyframe, lasts as long as the window should, and holds a run of access units of each stream unchanged.
+/// </summary>
+HRESULT RunReplayBenchmark(_In_ const REPLAY_BENCHMARK_OPTIONS &options, _Out_ REPLAY_BENCHMARK_RESULT *pResult);
+void PrintReplayBenchmarkResult(_In_ const REPLAY_BENCHMARK_OPTIONS &options, _In_ const REPLAY_BENCHMARK_RESULT &result);
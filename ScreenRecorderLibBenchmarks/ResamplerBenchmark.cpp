@@ -0,0 +1,154 @@
+#include "ResamplerBenchmark.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace {
+	const double Pi = 3.14159265358979323846;
+	//-6 dBFS, so the filter overshoot on the tone stays within full scale.
+	const double ToneAmplitude = 0.5;
+	const double SnrToneHz = 1000;
+
+	struct TONE_FIT {
+		double GainDb;
+		double SnrDb;
+	};
+
+	/// <summary>
+	/// Feeds the frames through the resampler in chunks, and appends what comes out.
+	/// </summary>
+	void Resample(_Inout_ AudioResampler &resampler, _In_ const std::vector<float> &input, _In_ size_t chunkFrames, _Inout_ std::vector<float> &chunkOutput, _Inout_ std::vector<float> &output)
+	{
+		const UINT32 inputChannels = resampler.GetInputChannels();
+		const UINT32 outputChannels = resampler.GetOutputChannels();
+		size_t inputFrames = input.size() / inputChannels;
+		for (size_t frame = 0; frame < inputFrames; frame += chunkFrames) {
+			size_t frames = (std::min)(chunkFrames, inputFrames - frame);
+			size_t written = resampler.Process(input.data() + frame * inputChannels, frames, chunkOutput.data(), chunkOutput.size() / outputChannels);
+			output.insert(output.end(), chunkOutput.begin(), chunkOutput.begin() + written * outputChannels);
+		}
+	}
+
+	/// <summary>
+	/// Resamples a tone, and fits a sine and a cosine of it to the first channel of the output by least squares.
+	/// The fit gives the gain at the tone, and what is left over after taking it out is the noise, aliasing and distortion.
+	/// </summary>
+	TONE_FIT MeasureTone(_Inout_ AudioResampler &resampler, _In_ const RESAMPLER_BENCHMARK_OPTIONS &options, _In_ double frequency, _In_ size_t chunkFrames,
+		_Inout_ std::vector<float> &chunkOutput, _Inout_ std::vector<float> &input, _Inout_ std::vector<float> &output)
+	{
+		resampler.Reset();
+		size_t inputFrames = (size_t)(options.ToneSeconds * options.InputSampleRate);
+		input.resize(inputFrames * options.Channels);
+		for (size_t frame = 0; frame < inputFrames; frame++) {
+			float value = (float)(ToneAmplitude * sin(2 * Pi * frequency * frame / options.InputSampleRate));
+			std::fill(input.begin() + frame * options.Channels, input.begin() + (frame + 1) * options.Channels, value);
+		}
+		output.clear();
+		Resample(resampler, input, chunkFrames, chunkOutput, output);
+
+		//The start of the output is filtered with the silence the history is primed with.
+		size_t outputFrames = output.size() / options.Channels;
+		size_t settleFrames = (size_t)(2.0 * resampler.GetLatencyFrames() * options.OutputSampleRate / options.InputSampleRate) + 1;
+		double ss = 0, cc = 0, sc = 0, ys = 0, yc = 0;
+		for (size_t n = settleFrames; n < outputFrames; n++) {
+			double angle = 2 * Pi * frequency * n / options.OutputSampleRate;
+			double s = sin(angle);
+			double c = cos(angle);
+			double y = output[n * options.Channels];
+			ss += s * s;
+			cc += c * c;
+			sc += s * c;
+			ys += y * s;
+			yc += y * c;
+		}
+		double determinant = ss * cc - sc * sc;
+		double a = (ys * cc - yc * sc) / determinant;
+		double b = (yc * ss - ys * sc) / determinant;
+		double residual = 0;
+		for (size_t n = settleFrames; n < outputFrames; n++) {
+			double angle = 2 * Pi * frequency * n / options.OutputSampleRate;
+			double error = output[n * options.Channels] - a * sin(angle) - b * cos(angle);
+			residual += error * error;
+		}
+		size_t count = outputFrames > settleFrames ? outputFrames - settleFrames : 1;
+		double signalPower = (a * a + b * b) / 2;
+		double noisePower = (std::max)(residual / count, 1e-30);
+		return TONE_FIT{ 20 * log10(sqrt(a * a + b * b) / ToneAmplitude), 10 * log10(signalPower / noisePower) };
+	}
+}
+
+HRESULT RunResamplerBenchmark(_In_ const RESAMPLER_BENCHMARK_OPTIONS &options, _Out_ RESAMPLER_BENCHMARK_RESULT *pResult)
+{
+	*pResult = RESAMPLER_BENCHMARK_RESULT{};
+	if (options.InputSampleRate == 0 || options.OutputSampleRate == 0 || options.Channels == 0 || options.ChunkMillis == 0 || options.SweepTones < 2
+		|| options.ToneSeconds <= 0 || options.TimedSeconds <= 0) {
+		return E_INVALIDARG;
+	}
+	AudioResampler resampler;
+	HRESULT hr = resampler.Initialize(options.InputSampleRate, options.Channels, options.OutputSampleRate, options.Channels, options.Quality, options.Simd);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	pResult->Taps = resampler.GetLatencyFrames() * 2;
+	size_t chunkFrames = (std::max)((size_t)options.InputSampleRate * options.ChunkMillis / 1000, (size_t)1);
+	std::vector<float> chunkOutput(resampler.GetMaxOutputFrames(chunkFrames) * options.Channels);
+	std::vector<float> input;
+	std::vector<float> output;
+
+	pResult->SnrDb = MeasureTone(resampler, options, SnrToneHz, chunkFrames, chunkOutput, input, output).SnrDb;
+	//Log spaced from 20 Hz to the passband edge.
+	pResult->PassbandEdgeHz = options.PassbandFraction * (std::min)(options.InputSampleRate, options.OutputSampleRate) / 2;
+	double minGainDb = 0;
+	double maxGainDb = 0;
+	for (UINT32 tone = 0; tone < options.SweepTones; tone++) {
+		double frequency = 20 * pow(pResult->PassbandEdgeHz / 20, (double)tone / (options.SweepTones - 1));
+		TONE_FIT fit = MeasureTone(resampler, options, frequency, chunkFrames, chunkOutput, input, output);
+		if (tone == 0 || fit.GainDb < minGainDb) {
+			minGainDb = fit.GainDb;
+		}
+		if (tone == 0 || fit.GainDb > maxGainDb) {
+			maxGainDb = fit.GainDb;
+		}
+		if (tone == 0 || fit.SnrDb < pResult->MinSnrDb) {
+			pResult->MinSnrDb = fit.SnrDb;
+			pResult->MinSnrHz = frequency;
+		}
+	}
+	pResult->PassbandRippleDb = maxGainDb - minGainDb;
+
+	//Two tones, so the timing does not depend on what the signal is.
+	resampler.Reset();
+	size_t timedFrames = (size_t)(options.TimedSeconds * options.InputSampleRate);
+	input.resize(timedFrames * options.Channels);
+	for (size_t frame = 0; frame < timedFrames; frame++) {
+		double time = (double)frame / options.InputSampleRate;
+		float value = (float)(0.3 * sin(2 * Pi * 440 * time) + 0.2 * sin(2 * Pi * 5000 * time));
+		std::fill(input.begin() + frame * options.Channels, input.begin() + (frame + 1) * options.Channels, value);
+	}
+	std::vector<double> chunkNanos;
+	chunkNanos.reserve(timedFrames / chunkFrames + 1);
+	UINT64 outputFrames = 0;
+	UINT64 warmHeapAllocations = GetHeapAllocationCount();
+	for (size_t frame = 0; frame < timedFrames; frame += chunkFrames) {
+		size_t frames = (std::min)(chunkFrames, timedFrames - frame);
+		auto start = std::chrono::steady_clock::now();
+		outputFrames += resampler.Process(input.data() + frame * options.Channels, frames, chunkOutput.data(), chunkOutput.size() / options.Channels);
+		chunkNanos.push_back(ElapsedNanos(start));
+	}
+	pResult->SteadyStateHeapAllocations = GetHeapAllocationCount() - warmHeapAllocations;
+	pResult->ChunkNanos = ComputeBenchmarkStats(chunkNanos);
+	double totalSeconds = pResult->ChunkNanos.Mean * pResult->ChunkNanos.Count / 1e9;
+	pResult->OutputFramesPerSecond = totalSeconds > 0 ? outputFrames / totalSeconds : 0;
+	pResult->RealtimeFactor = totalSeconds > 0 ? options.TimedSeconds / totalSeconds : 0;
+	return S_OK;
+}
+
+void PrintResamplerBenchmarkResult(_In_ const RESAMPLER_BENCHMARK_OPTIONS &options, _In_ const RESAMPLER_BENCHMARK_RESULT &result)
+{
+	const char *qualities[] = { "low", "medium", "high" };
+	printf("  %5u -> %-5u Hz  %u ch  %-6s  %3u taps   SNR %6.1f dB at 1 kHz, %6.1f dB at %5.0f Hz   ripple %7.4f dB to %5.0f Hz   %7.0f ns p99 per chunk  %6.1f Mframes/s  %7.0fx realtime   %llu allocations\n",
+		options.InputSampleRate, options.OutputSampleRate, options.Channels, qualities[(int)options.Quality], result.Taps,
+		result.SnrDb, result.MinSnrDb, result.MinSnrHz, result.PassbandRippleDb, result.PassbandEdgeHz,
+		result.ChunkNanos.P99, result.OutputFramesPerSecond / 1e6, result.RealtimeFactor, (unsigned long long)result.SteadyStateHeapAllocations);
+}
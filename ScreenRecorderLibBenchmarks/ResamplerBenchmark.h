@@ -0,0 +1,45 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include "Benchmark.h"
+#include "../ScreenRecorderLibNative/AudioResampler.h"
+
+struct RESAMPLER_BENCHMARK_OPTIONS {
+	UINT32 InputSampleRate = 44100;
+	UINT32 OutputSampleRate = 48000;
+	UINT32 Channels = 2;
+	AudioResamplerQuality Quality = AudioResamplerQuality::Medium;
+	SimdLevel Simd = SimdLevel::Auto;
+	//Input fed per call, 10 ms as the capture delivers it.
+	UINT32 ChunkMillis = 10;
+	//Tones swept from 20 Hz up to this fraction of the lower Nyquist frequency, for the passband ripple and the worst SNR.
+	double PassbandFraction = 0.5;
+	UINT32 SweepTones = 12;
+	//Input resampled per tone, and timed for the frame rate.
+	double ToneSeconds = 0.5;
+	double TimedSeconds = 20;
+};
+
+struct RESAMPLER_BENCHMARK_RESULT {
+	UINT32 Taps;
+	//Power of a 1 kHz tone at -6 dBFS against everything else in the output, in dB.
+	double SnrDb;
+	//The worst SNR of the tones swept, and the tone it was found on.
+	double MinSnrDb;
+	double MinSnrHz;
+	//The difference between the highest and the lowest gain over the tones swept, in dB.
+	double PassbandRippleDb;
+	double PassbandEdgeHz;
+	BENCHMARK_STATS ChunkNanos;
+	//Output frames produced per second of processing, and how many times faster than real time that is.
+	double OutputFramesPerSecond;
+	double RealtimeFactor;
+	UINT64 SteadyStateHeapAllocations;
+};
+
+/// <summary>
+/// Resamples sine tones in capture sized chunks, fits a sine of the tone to the output, and reports the SNR and passband ripple against it,
+/// then times resampling a steady signal.
+/// </summary>
+HRESULT RunResamplerBenchmark(_In_ const RESAMPLER_BENCHMARK_OPTIONS &options, _Out_ RESAMPLER_BENCHMARK_RESULT *pResult);
+void PrintResamplerBenchmarkResult(_In_ const RESAMPLER_BENCHMARK_OPTIONS &options, _In_ const RESAMPLER_BENCHMARK_RESULT &result);
@@ -0,0 +1,211 @@
+#include "RingBufferBenchmark.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../ScreenRecorderLibNative/AudioRingBuffer.h"
+
+namespace {
+	/// <summary>
+	/// The queue LoopbackCapture had before the ring buffer: the capture thread appends under a mutex, and the reader copies from the front and erases it.
+	/// It grows without limit, so it never drops audio.
+	/// </summary>
+	class LockedVectorBuffer {
+	public:
+		explicit LockedVectorBuffer(_In_ size_t capacityBytes) :
+			m_Capacity(capacityBytes)
+		{
+		}
+		size_t Write(_In_reads_bytes_(cbData) const BYTE *pData, _In_ size_t cbData)
+		{
+			const std::lock_guard<std::mutex> lock(m_Mutex);
+			if (m_Bytes.size() == 0) {
+				m_Bytes.reserve(cbData);
+			}
+			m_Bytes.insert(m_Bytes.end(), pData, pData + cbData);
+			return cbData;
+		}
+		size_t Read(_Out_writes_bytes_(cbData) BYTE *pDest, _In_ size_t cbData)
+		{
+			std::vector<BYTE> bytes;
+			{
+				const std::lock_guard<std::mutex> lock(m_Mutex);
+				size_t byteCount = (std::min)(cbData, m_Bytes.size());
+				bytes = std::vector<BYTE>(m_Bytes.begin(), m_Bytes.begin() + byteCount);
+				m_Bytes.erase(m_Bytes.begin(), m_Bytes.begin() + byteCount);
+			}
+			if (!bytes.empty()) {
+				memcpy(pDest, bytes.data(), bytes.size());
+			}
+			return bytes.size();
+		}
+		//The capacity only holds back a producer that waits for room.
+		size_t GetFreeBytes()
+		{
+			const std::lock_guard<std::mutex> lock(m_Mutex);
+			return m_Bytes.size() < m_Capacity ? m_Capacity - m_Bytes.size() : 0;
+		}
+		UINT64 GetOverflowBytes() const { return 0; }
+	private:
+		std::mutex m_Mutex;
+		std::vector<BYTE> m_Bytes;
+		size_t m_Capacity;
+	};
+
+	void WaitUntil(_In_ std::chrono::steady_clock::time_point start, _In_ double nanos)
+	{
+		while (ElapsedNanos(start) < nanos) {
+			std::this_thread::yield();
+		}
+	}
+
+	//Every 8 bytes of a frame hold the number of the frame, so a frame read out of order or torn shows up.
+	void FillFrames(_In_ UINT64 firstFrame, _In_ UINT32 frameCount, _In_ UINT32 blockAlign, _Out_writes_bytes_(frameCount *blockAlign) BYTE *pDest)
+	{
+		for (UINT32 frame = 0; frame < frameCount; frame++) {
+			UINT64 number = firstFrame + frame;
+			for (UINT32 offset = 0; offset < blockAlign; offset += sizeof(UINT64)) {
+				memcpy(pDest + (size_t)frame * blockAlign + offset, &number, sizeof(UINT64));
+			}
+		}
+	}
+
+	template <typename TBuffer>
+	void RunProducerAndConsumer(_In_ const RING_BUFFER_BENCHMARK_OPTIONS &options, _Inout_ TBuffer &buffer, _Out_ RING_BUFFER_BENCHMARK_RESULT *pResult)
+	{
+		const UINT64 packetCount = (UINT64)(options.Seconds * options.SampleRate / options.PacketFrames);
+		const size_t packetBytes = (size_t)options.PacketFrames * options.BlockAlign;
+		const size_t readBytes = (size_t)options.ReadFrames * options.BlockAlign;
+		const double packetNanos = 1e9 * options.PacketFrames / options.SampleRate / options.Speed;
+		const double readNanos = 1e9 * options.ReadFrames / options.SampleRate / options.Speed;
+		std::vector<BYTE> packet(packetBytes);
+		std::vector<BYTE> readBuffer(readBytes);
+		std::vector<double> writeTimes;
+		std::vector<double> readTimes;
+		writeTimes.reserve((size_t)packetCount);
+		readTimes.reserve((size_t)(packetCount * options.PacketFrames / options.ReadFrames) * 4 + 1024);
+		std::atomic<bool> isProducerDone(false);
+		std::atomic<UINT64> warmHeapAllocations(0);
+		UINT64 writtenBytes = 0;
+		UINT64 readByteCount = 0;
+		UINT64 receivedFrames = 0;
+		UINT64 orderErrors = 0;
+
+		auto start = std::chrono::steady_clock::now();
+		std::thread consumer([&]() {
+			UINT64 nextFrame = 0;
+			for (UINT64 read = 0;; read++) {
+				if (options.Speed > 0) {
+					WaitUntil(start, read * readNanos);
+				}
+				bool isDone = isProducerDone;
+				auto readStart = std::chrono::steady_clock::now();
+				size_t byteCount = buffer.Read(readBuffer.data(), readBytes);
+				double nanos = ElapsedNanos(readStart);
+				if (byteCount == 0) {
+					if (isDone) {
+						break;
+					}
+					if (options.Speed == 0) {
+						std::this_thread::yield();
+					}
+					continue;
+				}
+				if (readTimes.size() < readTimes.capacity()) {
+					readTimes.push_back(nanos);
+				}
+				readByteCount += byteCount;
+				for (size_t frame = 0; frame < byteCount / options.BlockAlign; frame++) {
+					const BYTE *pFrame = readBuffer.data() + frame * options.BlockAlign;
+					UINT64 number;
+					memcpy(&number, pFrame, sizeof(UINT64));
+					bool isTorn = false;
+					for (UINT32 offset = sizeof(UINT64); offset < options.BlockAlign; offset += sizeof(UINT64)) {
+						isTorn = isTorn || memcmp(pFrame, pFrame + offset, sizeof(UINT64)) != 0;
+					}
+					if (isTorn || number < nextFrame) {
+						orderErrors++;
+					}
+					nextFrame = number + 1;
+					receivedFrames++;
+				}
+			}
+		});
+
+		for (UINT64 packetNumber = 0; packetNumber < packetCount; packetNumber++) {
+			if (packetNumber == options.WarmupPackets) {
+				warmHeapAllocations = GetHeapAllocationCount();
+			}
+			if (options.Speed > 0) {
+				WaitUntil(start, packetNumber * packetNanos);
+			}
+			FillFrames(packetNumber * options.PacketFrames, options.PacketFrames, options.BlockAlign, packet.data());
+			while (options.IsProducerWaiting && buffer.GetFreeBytes() < packetBytes) {
+				std::this_thread::yield();
+			}
+			auto writeStart = std::chrono::steady_clock::now();
+			buffer.Write(packet.data(), packetBytes);
+			writeTimes.push_back(ElapsedNanos(writeStart));
+			writtenBytes += packetBytes;
+		}
+		isProducerDone = true;
+		consumer.join();
+		double elapsedNanos = ElapsedNanos(start);
+		pResult->SteadyStateHeapAllocations = packetCount > options.WarmupPackets ? GetHeapAllocationCount() - warmHeapAllocations : 0;
+
+		pResult->WrittenBytes = writtenBytes;
+		pResult->ReadBytes = readByteCount;
+		pResult->MegabytesPerSecond = elapsedNanos > 0 ? readByteCount / (elapsedNanos / 1e9) / 1e6 : 0;
+		pResult->WriteNanos = ComputeBenchmarkStats(writeTimes);
+		pResult->ReadNanos = ComputeBenchmarkStats(readTimes);
+		pResult->OverflowBytes = buffer.GetOverflowBytes();
+		pResult->MissingFrames = packetCount * options.PacketFrames - receivedFrames;
+		pResult->OrderErrors = orderErrors;
+	}
+}
+
+HRESULT RunRingBufferBenchmark(_In_ const RING_BUFFER_BENCHMARK_OPTIONS &options, _Out_ RING_BUFFER_BENCHMARK_RESULT *pResult)
+{
+	*pResult = RING_BUFFER_BENCHMARK_RESULT{};
+	if (options.Seconds <= 0 || options.SampleRate == 0 || options.PacketFrames == 0 || options.ReadFrames == 0
+		|| options.BlockAlign == 0 || options.BlockAlign % sizeof(UINT64) != 0 || options.Speed < 0) {
+		return E_INVALIDARG;
+	}
+	size_t capacityBytes = (size_t)((UINT64)options.SampleRate * options.CapacityMillis / 1000) * options.BlockAlign;
+	if (capacityBytes < (size_t)options.PacketFrames * options.BlockAlign) {
+		return E_INVALIDARG;
+	}
+	if (options.IsLockedVector) {
+		LockedVectorBuffer buffer(capacityBytes);
+		RunProducerAndConsumer(options, buffer, pResult);
+	}
+	else {
+		AudioRingBuffer buffer;
+		HRESULT hr = buffer.Initialize(capacityBytes, options.BlockAlign);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		RunProducerAndConsumer(options, buffer, pResult);
+	}
+	return S_OK;
+}
+
+void PrintRingBufferBenchmarkResult(_In_ const RING_BUFFER_BENCHMARK_OPTIONS &options, _In_ const RING_BUFFER_BENCHMARK_RESULT &result)
+{
+	char name[48];
+	char pace[16];
+	if (options.Speed > 0) {
+		snprintf(pace, sizeof(pace), "%.0fx", options.Speed);
+	}
+	else {
+		snprintf(pace, sizeof(pace), "unpaced");
+	}
+	snprintf(name, sizeof(name), "%s, %s, %s", options.IsLockedVector ? "locked vector" : "ring", pace, options.IsProducerWaiting ? "waits" : "drops");
+	printf("  %-30s  %9.1f MB/s   %6.0f / %8.0f ns   %7.0f / %9.0f ns   %10llu / %-10llu   %6llu   %llu\n",
+		name, result.MegabytesPerSecond, result.WriteNanos.P99, result.WriteNanos.Max, result.ReadNanos.P99, result.ReadNanos.Max,
+		(unsigned long long)(result.OverflowBytes / options.BlockAlign), (unsigned long long)result.MissingFrames,
+		(unsigned long long)result.OrderErrors, (unsigned long long)result.SteadyStateHeapAllocations);
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include "Benchmark.h"
+
+struct RING_BUFFER_BENCHMARK_OPTIONS {
+	//Queue through a vector under a mutex, read from the front and erased, as LoopbackCapture did before the ring buffer.
+	bool IsLockedVector = false;
+	//Audio pushed through. 48 kHz stereo float in 10 ms packets, read 1600 frames at a time as at 30 fps.
+	double Seconds = 600;
+	UINT32 SampleRate = 48000;
+	UINT32 BlockAlign = 8;
+	UINT32 PacketFrames = 480;
+	UINT32 ReadFrames = 1600;
+	UINT32 CapacityMillis = 1000;
+	//How many times faster than real time the producer writes packets and the consumer reads. 0 runs both as fast as they can.
+	double Speed = 0;
+	//Wait for room when the buffer is full, instead of dropping what does not fit as the capture thread does.
+	bool IsProducerWaiting = true;
+	//Packets written before the allocation count is taken.
+	UINT32 WarmupPackets = 100;
+};
+
+struct RING_BUFFER_BENCHMARK_RESULT {
+	UINT64 WrittenBytes;
+	UINT64 ReadBytes;
+	double MegabytesPerSecond;
+	//The time each write and each read that returned audio took, in nanoseconds.
+	BENCHMARK_STATS WriteNanos;
+	BENCHMARK_STATS ReadNanos;
+	//Bytes the buffer counted as dropped, and the frames written that never came out. Should match.
+	UINT64 OverflowBytes;
+	UINT64 MissingFrames;
+	//Frames read out of order or mixed up with another frame. Should be zero.
+	UINT64 OrderErrors;
+	UINT64 SteadyStateHeapAllocations;
+};
+
+/// <summary>
+/// Pushes numbered audio frames from a producer thread standing in for the capture thread to a consumer thread standing in for the recorder,
+/// through the AudioRingBuffer or the locked vector it replaced. Times every write and read, and checks that each frame comes out once and in order,
+/// and that every frame missing was counted as overflow.
+/// </summary>
+HRESULT RunRingBufferBenchmark(_In_ const RING_BUFFER_BENCHMARK_OPTIONS &options, _Out_ RING_BUFFER_BENCHMARK_RESULT *pResult);
+void PrintRingBufferBenchmarkResult(_In_ const RING_BUFFER_BENCHMARK_OPTIONS &options, _In_ const RING_BUFFER_BENCHMARK_RESULT &result);
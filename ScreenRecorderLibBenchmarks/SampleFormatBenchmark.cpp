@@ -0,0 +1,163 @@
+#include "SampleFormatBenchmark.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include "../ScreenRecorderLibNative/AudioLevelMeter.h"
+#include "../ScreenRecorderLibNative/AudioMixer.h"
+#include "../ScreenRecorderLibNative/AudioSampleConverter.h"
+
+namespace {
+	const double Pi = 3.14159265358979323846;
+	//Input generated per source, and played in a loop.
+	const size_t LoopBlocks = 100;
+	const size_t WarmupBlocks = 10;
+
+	/// <summary>
+	/// One captured source, with the state each path keeps for it.
+	/// </summary>
+	struct SAMPLE_FORMAT_SOURCE {
+		std::vector<int16_t> Int16Input;
+		std::vector<float> FloatInput;
+		AudioResampler Int16Resampler;
+		AudioResampler FloatResampler;
+		AudioLevelMeter Int16Meter;
+		AudioLevelMeter FloatMeter;
+		std::vector<int16_t> Int16Resampled;
+		std::vector<float> FloatResampled;
+	};
+
+	template <typename T>
+	size_t ResampleBlock(_In_ const SAMPLE_FORMAT_BENCHMARK_OPTIONS &options, _Inout_ AudioResampler &resampler, _In_ const T *pInput, _In_ size_t inputFrames, _Inout_ std::vector<T> &output)
+	{
+		if (options.InputSampleRate == options.OutputSampleRate) {
+			std::copy(pInput, pInput + inputFrames * options.Channels, output.begin());
+			return inputFrames;
+		}
+		return resampler.Process(pInput, inputFrames, output.data(), output.size() / options.Channels);
+	}
+}
+
+HRESULT RunSampleFormatBenchmark(_In_ const SAMPLE_FORMAT_BENCHMARK_OPTIONS &options, _Out_ SAMPLE_FORMAT_BENCHMARK_RESULT *pResult)
+{
+	*pResult = SAMPLE_FORMAT_BENCHMARK_RESULT{};
+	if (options.SourceCount == 0 || options.InputSampleRate == 0 || options.OutputSampleRate == 0 || options.Channels == 0 || options.BlockMillis == 0 || options.Seconds <= 0) {
+		return E_INVALIDARG;
+	}
+	const size_t blockFrames = (std::max)((size_t)options.InputSampleRate * options.BlockMillis / 1000, (size_t)1);
+	const size_t blocks = (size_t)(options.Seconds * 1000 / options.BlockMillis);
+	if (blocks == 0) {
+		return E_INVALIDARG;
+	}
+	std::vector<std::unique_ptr<SAMPLE_FORMAT_SOURCE>> sources;
+	std::vector<AUDIO_MIX_INPUT<int16_t>> int16Inputs(options.SourceCount);
+	std::vector<AUDIO_MIX_INPUT<float>> floatInputs(options.SourceCount);
+	for (UINT32 i = 0; i < options.SourceCount; i++) {
+		std::unique_ptr<SAMPLE_FORMAT_SOURCE> source(new SAMPLE_FORMAT_SOURCE());
+		HRESULT hr = source->Int16Resampler.Initialize(options.InputSampleRate, options.Channels, options.OutputSampleRate, options.Channels, options.Quality, options.Simd);
+		if (SUCCEEDED(hr)) {
+			hr = source->FloatResampler.Initialize(options.InputSampleRate, options.Channels, options.OutputSampleRate, options.Channels, options.Quality, options.Simd);
+		}
+		if (FAILED(hr)) {
+			return hr;
+		}
+		source->Int16Meter.Initialize(options.OutputSampleRate, options.Channels, options.Simd);
+		source->FloatMeter.Initialize(options.OutputSampleRate, options.Channels, options.Simd);
+		//A tone per source at -6 dBFS, so the mix of more than two sources at unity gain goes over full scale.
+		size_t loopFrames = blockFrames * LoopBlocks;
+		source->FloatInput.resize(loopFrames * options.Channels);
+		source->Int16Input.resize(loopFrames * options.Channels);
+		double frequency = 220.0 * (i + 1);
+		for (size_t frame = 0; frame < loopFrames; frame++) {
+			float value = (float)(0.5 * sin(2 * Pi * frequency * frame / options.InputSampleRate));
+			for (UINT32 channel = 0; channel < options.Channels; channel++) {
+				source->FloatInput[frame * options.Channels + channel] = value;
+				//What the audio engine delivered when the format was coerced to 16 bit.
+				source->Int16Input[frame * options.Channels + channel] = (int16_t)lrint(value * 32767.0);
+			}
+		}
+		size_t maxOutputFrames = (std::max)(source->FloatResampler.GetMaxOutputFrames(blockFrames), blockFrames);
+		source->Int16Resampled.resize(maxOutputFrames * options.Channels);
+		source->FloatResampled.resize(maxOutputFrames * options.Channels);
+		sources.push_back(std::move(source));
+	}
+	size_t maxOutputSamples = sources[0]->FloatResampled.size();
+	std::vector<int16_t> int16Mix(maxOutputSamples);
+	std::vector<float> floatMix(maxOutputSamples);
+	std::vector<int16_t> floatOutput(maxOutputSamples);
+	AudioSampleConverter converter;
+	converter.Initialize(true, options.Simd);
+	//A single source at unity gain is converted straight from the resampler output, as AudioGraph does.
+	const bool isFloatMixSkipped = options.SourceCount == 1 && options.Gain == 1.0f;
+
+	std::vector<double> int16Nanos;
+	std::vector<double> floatNanos;
+	int16Nanos.reserve(blocks);
+	floatNanos.reserve(blocks);
+	UINT64 outputFrames = 0;
+	UINT64 warmHeapAllocations = 0;
+	for (size_t block = 0; block < WarmupBlocks + blocks; block++) {
+		if (block == WarmupBlocks) {
+			pResult->Int16.ClippedSamples = 0;
+			pResult->Float.ClippedSamples = 0;
+			warmHeapAllocations = GetHeapAllocationCount();
+		}
+		size_t inputOffset = (block % LoopBlocks) * blockFrames * options.Channels;
+
+		auto start = std::chrono::steady_clock::now();
+		size_t int16Samples = 0;
+		for (UINT32 i = 0; i < options.SourceCount; i++) {
+			SAMPLE_FORMAT_SOURCE &source = *sources[i];
+			size_t frames = ResampleBlock(options, source.Int16Resampler, source.Int16Input.data() + inputOffset, blockFrames, source.Int16Resampled);
+			int16Samples = (std::max)(int16Samples, frames * options.Channels);
+			source.Int16Meter.Process(source.Int16Resampled.data(), frames * options.Channels);
+			int16Inputs[i] = AUDIO_MIX_INPUT<int16_t>{ source.Int16Resampled.data(), frames * options.Channels, options.Gain };
+		}
+		size_t int16Clipped = AudioMixer::Mix(int16Inputs.data(), int16Inputs.size(), int16Mix.data(), int16Samples, options.Simd);
+		double int16BlockNanos = ElapsedNanos(start);
+
+		start = std::chrono::steady_clock::now();
+		size_t floatSamples = 0;
+		for (UINT32 i = 0; i < options.SourceCount; i++) {
+			SAMPLE_FORMAT_SOURCE &source = *sources[i];
+			size_t frames = ResampleBlock(options, source.FloatResampler, source.FloatInput.data() + inputOffset, blockFrames, source.FloatResampled);
+			floatSamples = (std::max)(floatSamples, frames * options.Channels);
+			source.FloatMeter.Process(source.FloatResampled.data(), frames * options.Channels);
+			floatInputs[i] = AUDIO_MIX_INPUT<float>{ source.FloatResampled.data(), frames * options.Channels, options.Gain };
+		}
+		const float *pMix = sources[0]->FloatResampled.data();
+		if (!isFloatMixSkipped) {
+			AudioMixer::Mix(floatInputs.data(), floatInputs.size(), floatMix.data(), floatSamples, options.Simd);
+			pMix = floatMix.data();
+		}
+		size_t floatClipped = converter.ConvertToInt16(pMix, floatOutput.data(), floatSamples);
+		double floatBlockNanos = ElapsedNanos(start);
+
+		pResult->Int16.ClippedSamples += int16Clipped;
+		pResult->Float.ClippedSamples += floatClipped;
+		if (block >= WarmupBlocks) {
+			int16Nanos.push_back(int16BlockNanos);
+			floatNanos.push_back(floatBlockNanos);
+			outputFrames += floatSamples / options.Channels;
+		}
+	}
+	pResult->SteadyStateHeapAllocations = GetHeapAllocationCount() - warmHeapAllocations;
+	pResult->Int16.BlockNanos = ComputeBenchmarkStats(int16Nanos);
+	pResult->Float.BlockNanos = ComputeBenchmarkStats(floatNanos);
+	double audioSeconds = (double)outputFrames / options.OutputSampleRate;
+	for (SAMPLE_FORMAT_PATH_RESULT *pPath : { &pResult->Int16, &pResult->Float }) {
+		pPath->MillisPerSecond = audioSeconds > 0 ? pPath->BlockNanos.Mean * pPath->BlockNanos.Count / 1e6 / audioSeconds : 0;
+	}
+	pResult->Speedup = pResult->Float.MillisPerSecond > 0 ? pResult->Int16.MillisPerSecond / pResult->Float.MillisPerSecond : 0;
+	return S_OK;
+}
+
+void PrintSampleFormatBenchmarkResult(_In_ const SAMPLE_FORMAT_BENCHMARK_OPTIONS &options, _In_ const SAMPLE_FORMAT_BENCHMARK_RESULT &result)
+{
+	printf("  %u %-7s  %5u -> %-5u Hz  gain %.2f   16 bit %6.3f ms/s, %7.0f ns p99 per block, %7llu clipped   float %6.3f ms/s, %7.0f ns p99 per block, %7llu clipped   %5.2fx   %llu allocations\n",
+		options.SourceCount, options.SourceCount == 1 ? "source" : "sources", options.InputSampleRate, options.OutputSampleRate, options.Gain,
+		result.Int16.MillisPerSecond, result.Int16.BlockNanos.P99, (unsigned long long)result.Int16.ClippedSamples,
+		result.Float.MillisPerSecond, result.Float.BlockNanos.P99, (unsigned long long)result.Float.ClippedSamples,
+		result.Speedup, (unsigned long long)result.SteadyStateHeapAllocations);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include "Benchmark.h"
+#include "../ScreenRecorderLibNative/AudioResampler.h"
+
+struct SAMPLE_FORMAT_BENCHMARK_OPTIONS {
+	UINT32 SourceCount = 2;
+	UINT32 InputSampleRate = 44100;
+	UINT32 OutputSampleRate = 48000;
+	UINT32 Channels = 2;
+	//Gain of each source in the mix. Gains other than 1.0 make a single source go through the mix too.
+	float Gain = 0.8f;
+	AudioResamplerQuality Quality = AudioResamplerQuality::Medium;
+	SimdLevel Simd = SimdLevel::Auto;
+	//Audio processed per block, 10 ms as the capture delivers it.
+	UINT32 BlockMillis = 10;
+	double Seconds = 20;
+};
+
+struct SAMPLE_FORMAT_PATH_RESULT {
+	BENCHMARK_STATS BlockNanos;
+	//CPU time spent per second of audio produced.
+	double MillisPerSecond;
+	//Output samples saturated to the 16 bit range, at the mix for the 16 bit path and at the final conversion for the float path.
+	UINT64 ClippedSamples;
+};
+
+struct SAMPLE_FORMAT_BENCHMARK_RESULT {
+	//Capture coerced to 16 bit, resampled, metered and mixed in 16 bit, ready for the encoder.
+	SAMPLE_FORMAT_PATH_RESULT Int16;
+	//Capture in float, resampled, metered and mixed in float, and converted once to 16 bit with dither for the encoder.
+	SAMPLE_FORMAT_PATH_RESULT Float;
+	//How many times the CPU time of the float path the 16 bit path takes.
+	double Speedup;
+	UINT64 SteadyStateHeapAllocations;
+};
+
+/// <summary>
+/// Times the audio path from the captured packets of each source to the 16 bit samples handed to the encoder, once the way it was done in 16 bit,
+/// and once in float with a single conversion at the end, on the same generated tones. The blocks of the two paths alternate, so both see the same machine state.
+/// </summary>
+HRESULT RunSampleFormatBenchmark(_In_ const SAMPLE_FORMAT_BENCHMARK_OPTIONS &options, _Out_ SAMPLE_FORMAT_BENCHMARK_RESULT *pResult);
+void PrintSampleFormatBenchmarkResult(_In_ const SAMPLE_FORMAT_BENCHMARK_OPTIONS &options, _In_ const SAMPLE_FORMAT_BENCHMARK_RESULT &result);
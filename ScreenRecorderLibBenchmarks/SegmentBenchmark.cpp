@@ -0,0 +1,231 @@
+#include "SegmentBenchmark.h"
+#include "MemoryStream.h"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace {
+	const INT64 HundredNanosPerSecond = 10000000;
+
+	/// <summary>
+	/// Releases the streams of the segments on every way out of the benchmark.
+	/// </summary>
+	struct SEGMENT_STREAMS {
+		std::vector<IStream *> Streams;
+		~SEGMENT_STREAMS()
+		{
+			for (IStream *pStream : Streams) {
+				pStream->Release();
+			}
+		}
+		HRESULT Add(_Outptr_ IStream **ppStream)
+		{
+			MemoryStream *pStream = nullptr;
+			HRESULT hr = MemoryStream::CreateInstance(&pStream);
+			if (SUCCEEDED(hr)) {
+				Streams.push_back(pStream);
+				*ppStream = pStream;
+			}
+			return hr;
+		}
+	};
+
+	/// <summary>
+	/// Converts a time to the timescale of a track, rounded as the muxer does.
+	/// </summary>
+	INT64 ToTimescale(_In_ INT64 time100Nanos, _In_ UINT32 timescale)
+	{
+		return (time100Nanos * timescale + HundredNanosPerSecond / 2) / HundredNanosPerSecond;
+	}
+
+	HRESULT ReadStream(_In_ IStream *pStream, _In_ UINT64 size, _Out_ std::vector<BYTE> *pData)
+	{
+		LARGE_INTEGER zero{};
+		HRESULT hr = pStream->Seek(zero, STREAM_SEEK_SET, nullptr);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		pData->resize((size_t)size);
+		ULONG read = 0;
+		hr = pStream->Read(pData->data(), (ULONG)pData->size(), &read);
+		if (SUCCEEDED(hr) && read != pData->size()) {
+			hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+		}
+		return hr;
+	}
+
+	/// <summary>
+	/// Where a stream is up to as the segments are read back in order.
+	/// </summary>
+	struct STREAM_CURSOR {
+		size_t NextUnit;
+		//The end of the track in the segment before, in its timescale on the timeline of the recording.
+		INT64 EndDecodeTime;
+		bool HasEnded;
+	};
+
+	/// <summary>
+	/// Checks a track of a segment against the stream it was muxed from: that it holds the next access units of the stream, and starts where the segment before ended.
+	/// </summary>
+	void CompareTrack(_In_ const ENCODED_STREAM &stream, _In_ const MP4_CHECKED_TRACK &track, _In_ const MP4_MUXER_SEGMENT &segment, _Inout_ STREAM_CURSOR *pCursor, _Inout_ SEGMENT_BENCHMARK_RESULT *pResult)
+	{
+		if (track.Samples == 0) {
+			return;
+		}
+		UINT64 hash = PayloadHashSeed;
+		size_t endUnit = (std::min)(pCursor->NextUnit + (size_t)track.Samples, stream.Units.size());
+		for (size_t i = pCursor->NextUnit; i < endUnit; i++) {
+			hash = HashAccessUnit(hash, stream.Track.Codec, stream.Data.data() + stream.Units[i].Offset, stream.Units[i].Size);
+		}
+		if (hash != track.PayloadHash || endUnit - pCursor->NextUnit != track.Samples) {
+			pResult->IsPayloadIntact = false;
+		}
+		pCursor->NextUnit = endUnit;
+		INT64 originDecodeTime = ToTimescale(segment.StartPos, track.Timescale);
+		if (pCursor->HasEnded && originDecodeTime + track.StartDecodeTime != pCursor->EndDecodeTime) {
+			pResult->GapsOrOverlaps++;
+		}
+		pCursor->EndDecodeTime = originDecodeTime + track.EndDecodeTime;
+		pCursor->HasEnded = true;
+	}
+}
+
+HRESULT RunSegmentBenchmark(_In_ const SEGMENT_BENCHMARK_OPTIONS &options, _Out_ SEGMENT_BENCHMARK_RESULT *pResult)
+{
+	*pResult = SEGMENT_BENCHMARK_RESULT{};
+	if (!options.pVideo) {
+		return E_INVALIDARG;
+	}
+	SEGMENT_STREAMS streams;
+	IStream *pFirstStream = nullptr;
+	HRESULT hr = streams.Add(&pFirstStream);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	std::vector<MP4_MUXER_SEGMENT> segments;
+	segments.reserve(1024);
+	MP4_MUXER_OPTIONS muxerOptions = options.Muxer;
+	muxerOptions.OpenSegmentStream = [&](UINT32 /*segmentNumber*/, IStream **ppStream) {
+		return streams.Add(ppStream);
+	};
+	muxerOptions.OnSegmentWritten = [&](const MP4_MUXER_SEGMENT &segment) {
+		segments.push_back(segment);
+	};
+	FragmentedMp4Muxer muxer;
+	hr = muxer.Initialize(pFirstStream, muxerOptions);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	const ENCODED_STREAM *inputs[] = { options.pVideo, options.pAudio };
+	UINT32 trackIndexes[2] = {};
+	for (int i = 0; i < 2; i++) {
+		if (inputs[i]) {
+			hr = muxer.AddTrack(inputs[i]->Track, &trackIndexes[i]);
+			if (FAILED(hr)) {
+				return hr;
+			}
+		}
+	}
+	size_t totalUnits = options.pVideo->Units.size() + (options.pAudio ? options.pAudio->Units.size() : 0);
+	std::vector<double> writeSampleMicros;
+	writeSampleMicros.reserve(totalUnits);
+
+	//Hands the access units over in the order the encoders deliver them, by time, video first.
+	size_t next[2] = {};
+	for (size_t unit = 0; unit < totalUnits; unit++) {
+		int s = 0;
+		if (next[0] >= inputs[0]->Units.size()) {
+			s = 1;
+		}
+		else if (inputs[1] && next[1] < inputs[1]->Units.size() && inputs[1]->Units[next[1]].StartPos < inputs[0]->Units[next[0]].StartPos) {
+			s = 1;
+		}
+		const ENCODED_ACCESS_UNIT &accessUnit = inputs[s]->Units[next[s]++];
+		MP4_MUXER_SAMPLE sample;
+		sample.pData = inputs[s]->Data.data() + accessUnit.Offset;
+		sample.Size = accessUnit.Size;
+		sample.StartPos = accessUnit.StartPos;
+		sample.DecodePos = accessUnit.StartPos;
+		sample.Duration = accessUnit.Duration;
+		sample.IsKeyFrame = accessUnit.IsKeyFrame;
+		size_t segmentsBefore = segments.size();
+		auto start = std::chrono::steady_clock::now();
+		hr = muxer.WriteSample(trackIndexes[s], sample);
+		double nanos = ElapsedNanos(start);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		if (segments.size() == segmentsBefore) {
+			writeSampleMicros.push_back(nanos / 1000);
+		}
+	}
+	hr = muxer.Finalize();
+	if (FAILED(hr)) {
+		return hr;
+	}
+	MP4_MUXER_STATS stats = muxer.GetStats();
+	std::vector<double> switchMicros;
+	for (size_t i = 0; i + 1 < segments.size(); i++) {
+		switchMicros.push_back(segments[i].SwitchDuration100Nanos / 10.0);
+	}
+	pResult->Segments = segments.size();
+	pResult->SwitchMicros = ComputeBenchmarkStats(switchMicros);
+	pResult->WriteSampleMicros = ComputeBenchmarkStats(writeSampleMicros);
+	pResult->DroppedSamples = stats.DroppedSamples;
+	pResult->IsPayloadIntact = segments.size() == streams.Streams.size() && stats.Segments == segments.size();
+
+	STREAM_CURSOR cursors[2] = {};
+	for (size_t i = 0; i < segments.size() && i < streams.Streams.size(); i++) {
+		const MP4_MUXER_SEGMENT &segment = segments[i];
+		pResult->MaxSegmentSeconds = (std::max)(pResult->MaxSegmentSeconds, (double)segment.Duration / HundredNanosPerSecond);
+		pResult->MaxSegmentBytes = (std::max)(pResult->MaxSegmentBytes, segment.Bytes);
+		std::vector<BYTE> file;
+		hr = ReadStream(streams.Streams[i], segment.Bytes, &file);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		MP4_CHECK_RESULT check;
+		CheckFragmentedMp4(file.data(), file.size(), &check);
+		for (const std::string &error : check.Errors) {
+			pResult->Errors.push_back("segment " + std::to_string(segment.Number) + ": " + error);
+		}
+		size_t checkedTrack = 0;
+		for (int s = 0; s < 2; s++) {
+			if (inputs[s] && checkedTrack < check.Tracks.size()) {
+				CompareTrack(*inputs[s], check.Tracks[checkedTrack++], segment, &cursors[s], pResult);
+			}
+		}
+		if (!options.OutputFolder.empty()) {
+			wchar_t name[32];
+			swprintf(name, sizeof(name) / sizeof(name[0]), L"segment-%03u.mp4", segment.Number);
+			std::ofstream outputFile(std::filesystem::path(options.OutputFolder) / name, std::ios::binary);
+			outputFile.write(reinterpret_cast<const char *>(file.data()), file.size());
+			if (!outputFile) {
+				return HRESULT_FROM_WIN32(ERROR_WRITE_FAULT);
+			}
+		}
+	}
+	for (int s = 0; s < 2; s++) {
+		if (inputs[s]) {
+			pResult->MissingSamples += inputs[s]->Units.size() - cursors[s].NextUnit;
+		}
+	}
+	return S_OK;
+}
+
+void PrintSegmentBenchmarkResult(_In_ const SEGMENT_BENCHMARK_OPTIONS &options, _In_ const SEGMENT_BENCHMARK_RESULT &result)
+{
+	char limit[32];
+	if (options.Muxer.SegmentDuration100Nanos > 0) {
+		snprintf(limit, sizeof(limit), "%.0f s", (double)options.Muxer.SegmentDuration100Nanos / HundredNanosPerSecond);
+	}
+	else {
+		snprintf(limit, sizeof(limit), "%llu MB", (unsigned long long)(options.Muxer.SegmentBytes / (1024 * 1024)));
+	}
+	printf("  %-7s  %5.0f ms  %5.0f ms   %5llu   %7.1f s  %7.1f MB    %7.1f / %7.1f us     %6.1f / %7.1f us     %4llu / %-4llu  %4llu   %s\n",
+		limit, options.Muxer.FragmentDuration100Nanos / 10000.0, options.Muxer.ChunkDuration100Nanos / 10000.0, (unsigned long long)result.Segments,
+		result.MaxSegmentSeconds, result.MaxSegmentBytes / (1024.0 * 1024.0), result.SwitchMicros.P50, result.SwitchMicros.Max,
+		result.WriteSampleMicros.P99, result.WriteSampleMicros.Max, (unsigned long long)result.DroppedSamples, (unsigned long long)result.MissingSamples,
+		(unsigned long long)result.GapsOrOverlaps, result.Errors.empty() && result.IsPayloadIntact ? "ok" : "FAILED");
+}
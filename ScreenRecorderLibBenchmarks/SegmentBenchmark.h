@@ -0,0 +1,45 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include <string>
+#include "Benchmark.h"
+#include "EncodedStreams.h"
+#include "Mp4Checker.h"
+
+struct SEGMENT_BENCHMARK_OPTIONS {
+	//The streams to mux, as the encoders would deliver them. The video is needed, as segments are cut on its keyframes.
+	const ENCODED_STREAM *pVideo = nullptr;
+	const ENCODED_STREAM *pAudio = nullptr;
+	//The fragment, and the segment duration or size.
+	MP4_MUXER_OPTIONS Muxer;
+	//Write the segments into this folder, if not empty, to check them with other tools.
+	std::wstring OutputFolder;
+};
+
+struct SEGMENT_BENCHMARK_RESULT {
+	UINT64 Segments;
+	//The longest and the largest segment.
+	double MaxSegmentSeconds;
+	UINT64 MaxSegmentBytes;
+	//The time the muxer was held up by ending a segment and starting the next, in microseconds. Finalize is left out.
+	BENCHMARK_STATS SwitchMicros;
+	//The time of the WriteSample calls that did not switch segments, in microseconds, to compare the switches with.
+	BENCHMARK_STATS WriteSampleMicros;
+	//Samples the muxer left out, and samples of the streams that are in no segment. Should both be zero.
+	UINT64 DroppedSamples;
+	UINT64 MissingSamples;
+	//Tracks of a segment that do not start where they ended in the segment before, on the timeline of the recording. Should be zero.
+	UINT64 GapsOrOverlaps;
+	//Every access unit is in exactly one segment, in order and unchanged.
+	bool IsPayloadIntact;
+	//What the checker found wrong with any segment, with the number of the segment in front. Covers segments that do not start on a keyframe.
+	std::vector<std::string> Errors;
+};
+
+/// <summary>
+/// Muxes encoded streams with FragmentedMp4Muxer into segments of a set duration or size, each a memory stream of its own, as fast as it goes.
+/// Reports how long the switches from one segment to the next hold up the muxer, and checks every segment for conformance,
+/// and that the segments together hold every access unit once, with no gap or overlap between them.
+/// </summary>
+HRESULT RunSegmentBenchmark(_In_ const SEGMENT_BENCHMARK_OPTIONS &options, _Out_ SEGMENT_BENCHMARK_RESULT *pResult);
+void PrintSegmentBenchmarkResult(_In_ const SEGMENT_BENCHMARK_OPTIONS &options, _In_ const SEGMENT_BENCHMARK_RESULT &result);
@@ -0,0 +1,87 @@
+#include "UnchangedFramesBenchmark.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "../ScreenRecorderLibNative/UnchangedFrameFilter.h"
+#include "../ScreenRecorderLibNative/VideoColorConverter.h"
+
+namespace {
+	const INT64 HundredNanosPerSecond = 10000000;
+}
+
+HRESULT RunUnchangedFramesBenchmark(_In_ const UNCHANGED_FRAMES_BENCHMARK_OPTIONS &options, _Out_ UNCHANGED_FRAMES_BENCHMARK_RESULT *pResult)
+{
+	*pResult = UNCHANGED_FRAMES_BENCHMARK_RESULT{};
+	if (options.FramesPerSecond == 0 || options.Seconds <= 0 || options.PeriodSeconds <= 0) {
+		return E_INVALIDARG;
+	}
+	VIDEO_COLOR_CONVERTER_OPTIONS converterOptions;
+	converterOptions.Threads = 1;
+	VideoColorConverter converter;
+	HRESULT hr = converter.Initialize(options.Width, options.Height, converterOptions, options.Simd);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	const UINT32 stride = options.Width * 4;
+	std::vector<BYTE> image((size_t)stride * options.Height, 0x80);
+	std::vector<BYTE> frame(converter.GetFrameBytes());
+
+	UnchangedFrameFilter filter;
+	filter.Initialize(options.IsSkippingEnabled, (INT64)options.MaxUnchangedFrameDurationMillis * HundredNanosPerSecond / 1000);
+	const INT64 frameInterval100Nanos = HundredNanosPerSecond / options.FramesPerSecond;
+	const UINT64 frameCount = (UINT64)(options.Seconds * options.FramesPerSecond);
+	INT64 lastFrameStartPos = 0;
+	INT64 lastWrittenStartPos = -1;
+	double convertNanos = 0;
+	for (UINT64 i = 0; i < frameCount; i++) {
+		double seconds = (double)i / options.FramesPerSecond;
+		bool isChanged = fmod(seconds, options.PeriodSeconds) < options.ActiveSeconds;
+		if (isChanged) {
+			//Something on screen moves, so the frame differs from the one before.
+			image[(size_t)(i * 4099) % image.size()]++;
+		}
+		//Each frame lasts from the end of the frame before, as in RecordingManager::StartRecorderLoop.
+		if (filter.ShouldSkipFrame(isChanged, lastFrameStartPos, frameInterval100Nanos)) {
+			if (isChanged) {
+				pResult->MissedChangedFrames++;
+			}
+			pResult->SkippedFrames++;
+		}
+		else {
+			if (lastFrameStartPos <= lastWrittenStartPos) {
+				pResult->TimelineErrors++;
+			}
+			lastWrittenStartPos = lastFrameStartPos;
+			auto start = std::chrono::steady_clock::now();
+			hr = converter.Convert(image.data(), stride, frame.data());
+			convertNanos += ElapsedNanos(start);
+			if (FAILED(hr)) {
+				return hr;
+			}
+			pResult->WrittenFrames++;
+		}
+		lastFrameStartPos += frameInterval100Nanos;
+	}
+	pResult->CapturedFrames = frameCount;
+	pResult->ConvertMillisPerSecond = convertNanos / 1e6 / options.Seconds;
+	pResult->EncoderBytesPerSecond = (double)pResult->WrittenFrames * converter.GetFrameBytes() / options.Seconds;
+	//The last frame written is shown until the end of the recording.
+	INT64 maxFrameDuration = (std::max)(filter.GetStats().MaxFrameDuration100Nanos, lastFrameStartPos - lastWrittenStartPos);
+	pResult->MaxFrameDurationMillis = (double)maxFrameDuration / 10000;
+	return S_OK;
+}
+
+void PrintUnchangedFramesBenchmarkResult(_In_ const UNCHANGED_FRAMES_BENCHMARK_OPTIONS &options, _In_ const UNCHANGED_FRAMES_BENCHMARK_RESULT &result)
+{
+	char name[48];
+	if (options.IsSkippingEnabled) {
+		snprintf(name, sizeof(name), "skip, up to %u ms", options.MaxUnchangedFrameDurationMillis);
+	}
+	else {
+		snprintf(name, sizeof(name), "constant frame rate");
+	}
+	printf("  %-22s  %6llu / %-6llu  %8.2f ms/s   %7.1f MB/s   %8.1f ms      %llu / %llu\n",
+		name, (unsigned long long)result.WrittenFrames, (unsigned long long)result.CapturedFrames, result.ConvertMillisPerSecond,
+		result.EncoderBytesPerSecond / 1e6, result.MaxFrameDurationMillis, (unsigned long long)result.MissedChangedFrames, (unsigned long long)result.TimelineErrors);
+}
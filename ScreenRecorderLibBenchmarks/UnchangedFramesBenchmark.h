@@ -0,0 +1,42 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include "Benchmark.h"
+#include "../ScreenRecorderLibNative/Simd.util.h"
+
+struct UNCHANGED_FRAMES_BENCHMARK_OPTIONS {
+	//Simulated recording length. The simulation runs as fast as the conversion allows, not in real time.
+	double Seconds = 60;
+	UINT32 FramesPerSecond = 30;
+	UINT32 Width = 1920;
+	UINT32 Height = 1080;
+	//The screen changes for ActiveSeconds at the start of every period of PeriodSeconds, and is static for the rest, like a kiosk showing a page at a time.
+	double PeriodSeconds = 10;
+	double ActiveSeconds = 1;
+	//Leave unchanged frames out, and the longest a frame is shown for before it is written again.
+	bool IsSkippingEnabled = true;
+	UINT32 MaxUnchangedFrameDurationMillis = 1000;
+	SimdLevel Simd = SimdLevel::Auto;
+};
+
+struct UNCHANGED_FRAMES_BENCHMARK_RESULT {
+	UINT64 CapturedFrames;
+	UINT64 WrittenFrames;
+	UINT64 SkippedFrames;
+	//The time spent converting the written frames to NV12, the first step of encoding a frame, per second of video.
+	double ConvertMillisPerSecond;
+	//The bytes of NV12 handed to the encoder per second of video.
+	double EncoderBytesPerSecond;
+	//The longest time a written frame was shown for, in milliseconds.
+	double MaxFrameDurationMillis;
+	//Frames with changes that were not written, and written frames out of order. Should be zero.
+	UINT64 MissedChangedFrames;
+	UINT64 TimelineErrors;
+};
+
+/// <summary>
+/// Paces frames like the recorder loop on a screen that changes now and then, and writes the ones UnchangedFrameFilter lets through,
+/// converting each to NV12 as the encoder input. Checks that every changed frame is written and that no frame is shown for longer than allowed.
+/// </summary>
+HRESULT RunUnchangedFramesBenchmark(_In_ const UNCHANGED_FRAMES_BENCHMARK_OPTIONS &options, _Out_ UNCHANGED_FRAMES_BENCHMARK_RESULT *pResult);
+void PrintUnchangedFramesBenchmarkResult(_In_ const UNCHANGED_FRAMES_BENCHMARK_OPTIONS &options, _In_ const UNCHANGED_FRAMES_BENCHMARK_RESULT &result);
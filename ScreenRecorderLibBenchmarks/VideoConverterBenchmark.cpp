@@ -0,0 +1,199 @@
+#include "VideoConverterBenchmark.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace {
+	//Rows of the generated image are padded like the rows of a mapped texture, so the stride is exercised.
+	const UINT32 RowPaddingBytes = 64;
+
+	/// <summary>
+	/// A stand in for a desktop: a background gradient, windows of flat color with dark text like stripes, and blocks of fully saturated colors.
+	/// </summary>
+	std::vector<BYTE> GenerateImage(_In_ UINT32 width, _In_ UINT32 height, _In_ UINT32 stride)
+	{
+		std::vector<BYTE> image((size_t)stride * height);
+		uint32_t random = 0x12345678;
+		static const BYTE saturated[6][3] = { { 0, 0, 255 }, { 0, 255, 0 }, { 255, 0, 0 }, { 255, 255, 255 }, { 0, 0, 0 }, { 255, 0, 255 } };
+		for (UINT32 y = 0; y < height; y++) {
+			BYTE *pRow = image.data() + (size_t)y * stride;
+			for (UINT32 x = 0; x < width; x++) {
+				BYTE *pPixel = pRow + 4 * x;
+				random ^= random << 13;
+				random ^= random >> 17;
+				random ^= random << 5;
+				UINT32 windowX = x % 480;
+				UINT32 windowY = y % 360;
+				if (windowX >= 40 && windowX < 440 && windowY >= 30 && windowY < 330) {
+					bool isText = (windowY / 4) % 4 == 0 && (random & 3) != 0;
+					BYTE value = isText ? (BYTE)(random >> 24 & 0x3F) : 236;
+					pPixel[0] = value;
+					pPixel[1] = value;
+					pPixel[2] = isText ? value : 242;
+				}
+				else if (windowY >= 330) {
+					memcpy(pPixel, saturated[(x / 80) % 6], 3);
+				}
+				else {
+					pPixel[0] = (BYTE)(255 * x / width);
+					pPixel[1] = (BYTE)(255 * y / height);
+					pPixel[2] = (BYTE)(128 + (random >> 28));
+				}
+				pPixel[3] = 255;
+			}
+		}
+		return image;
+	}
+
+	int RoundAndClamp(_In_ double value)
+	{
+		return (std::min)((std::max)((int)floor(value + 0.5), 0), 255);
+	}
+
+	/// <summary>
+	/// The largest difference between the converted frame and the conversion done in floating point from the definition of the color matrix.
+	/// </summary>
+	int ComputeMaxReferenceError(_In_ const VIDEO_CONVERTER_BENCHMARK_OPTIONS &options, _In_ const BYTE *pImage, _In_ UINT32 stride, _In_ const BYTE *pFrame)
+	{
+		const UINT32 width = options.Width;
+		const UINT32 height = options.Height;
+		const bool isFullRange = options.Converter.IsFullRange;
+		const bool isInterleaved = options.Converter.Layout == VideoPlaneLayout::NV12;
+		double kr = options.Converter.Matrix == VideoColorMatrix::BT601 ? 0.299 : 0.2126;
+		double kb = options.Converter.Matrix == VideoColorMatrix::BT601 ? 0.114 : 0.0722;
+		double kg = 1 - kr - kb;
+		double lumaScale = isFullRange ? 1.0 : 219.0 / 255.0;
+		double chromaScale = isFullRange ? 1.0 : 224.0 / 255.0;
+		double lumaOffset = isFullRange ? 0 : 16;
+		UINT32 chromaWidth = (width + 1) / 2;
+		UINT32 chromaHeight = (height + 1) / 2;
+		const BYTE *pUPlane = pFrame + (size_t)width * height;
+		const BYTE *pVPlane = isInterleaved ? pUPlane + 1 : pUPlane + (size_t)chromaWidth * chromaHeight;
+		UINT32 chromaStep = isInterleaved ? 2 : 1;
+		int maxError = 0;
+		for (UINT32 y = 0; y < height; y++) {
+			for (UINT32 x = 0; x < width; x++) {
+				const BYTE *pPixel = pImage + (size_t)y * stride + 4 * x;
+				int expected = RoundAndClamp(lumaOffset + lumaScale * (kb * pPixel[0] + kg * pPixel[1] + kr * pPixel[2]));
+				maxError = (std::max)(maxError, abs(expected - pFrame[(size_t)y * width + x]));
+			}
+		}
+		for (UINT32 y = 0; y < chromaHeight; y++) {
+			for (UINT32 x = 0; x < chromaWidth; x++) {
+				double b = 0, g = 0, r = 0;
+				for (UINT32 row = 2 * y; row < 2 * y + 2; row++) {
+					for (UINT32 column = 2 * x; column < 2 * x + 2; column++) {
+						const BYTE *pPixel = pImage + (size_t)(std::min)(row, height - 1) * stride + 4 * (std::min)(column, width - 1);
+						b += pPixel[0] / 4.0;
+						g += pPixel[1] / 4.0;
+						r += pPixel[2] / 4.0;
+					}
+				}
+				double luma = kb * b + kg * g + kr * r;
+				int expectedU = RoundAndClamp(128 + chromaScale * (b - luma) / (2 * (1 - kb)));
+				int expectedV = RoundAndClamp(128 + chromaScale * (r - luma) / (2 * (1 - kr)));
+				size_t chroma = (size_t)y * chromaWidth * chromaStep + (size_t)x * chromaStep;
+				maxError = (std::max)(maxError, abs(expectedU - pUPlane[chroma]));
+				maxError = (std::max)(maxError, abs(expectedV - pVPlane[chroma]));
+			}
+		}
+		return maxError;
+	}
+
+	const char *GetSimdName(_In_ SimdLevel level)
+	{
+		switch (level)
+		{
+		case SimdLevel::AVX2:
+			return "avx2";
+		case SimdLevel::SSE2:
+			return "sse2";
+		default:
+			return "scalar";
+		}
+	}
+}
+
+HRESULT RunVideoConverterBenchmark(_In_ const VIDEO_CONVERTER_BENCHMARK_OPTIONS &options, _Out_ VIDEO_CONVERTER_BENCHMARK_RESULT *pResult)
+{
+	*pResult = VIDEO_CONVERTER_BENCHMARK_RESULT{};
+	if (options.Width == 0 || options.Height == 0 || options.Frames == 0) {
+		return E_INVALIDARG;
+	}
+	const UINT32 stride = options.Width * 4 + RowPaddingBytes;
+	std::vector<BYTE> image = GenerateImage(options.Width, options.Height, stride);
+
+	VideoColorConverter converter;
+	HRESULT hr = converter.Initialize(options.Width, options.Height, options.Converter, options.Simd);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	VIDEO_COLOR_CONVERTER_OPTIONS referenceOptions = options.Converter;
+	referenceOptions.Threads = 1;
+	VideoColorConverter referenceConverter;
+	hr = referenceConverter.Initialize(options.Width, options.Height, referenceOptions, SimdLevel::Scalar);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	std::vector<BYTE> reference(converter.GetFrameBytes());
+	hr = referenceConverter.Convert(image.data(), stride, reference.data());
+	if (FAILED(hr)) {
+		return hr;
+	}
+
+	std::vector<BYTE> frame(converter.GetFrameBytes());
+	std::vector<double> frameNanos;
+	frameNanos.reserve(options.Frames);
+	UINT64 warmHeapAllocations = 0;
+	for (UINT32 i = 0; i < options.WarmupFrames + options.Frames; i++) {
+		if (i == options.WarmupFrames) {
+			warmHeapAllocations = GetHeapAllocationCount();
+		}
+		auto start = std::chrono::steady_clock::now();
+		hr = converter.Convert(image.data(), stride, frame.data());
+		double nanos = ElapsedNanos(start);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		if (i >= options.WarmupFrames) {
+			frameNanos.push_back(nanos);
+		}
+	}
+	pResult->SteadyStateHeapAllocations = GetHeapAllocationCount() - warmHeapAllocations;
+	for (size_t i = 0; i < frame.size(); i++) {
+		if (frame[i] != reference[i]) {
+			pResult->MismatchBytes++;
+		}
+	}
+	pResult->MaxReferenceError = ComputeMaxReferenceError(options, image.data(), stride, frame.data());
+
+	//The same conversion into memory fresh from the heap for every frame, which has to be faulted in page by page.
+	double allocatingNanos = 0;
+	for (UINT32 i = 0; i < options.Frames; i++) {
+		auto start = std::chrono::steady_clock::now();
+		std::unique_ptr<BYTE[]> buffer(new BYTE[converter.GetFrameBytes()]);
+		hr = converter.Convert(image.data(), stride, buffer.get());
+		buffer.reset();
+		allocatingNanos += ElapsedNanos(start);
+		if (FAILED(hr)) {
+			return hr;
+		}
+	}
+	pResult->AllocatingNanosPerFrame = allocatingNanos / options.Frames;
+	pResult->FrameNanos = ComputeBenchmarkStats(frameNanos);
+	pResult->MegapixelsPerSecond = pResult->FrameNanos.Mean > 0 ? (double)options.Width * options.Height / pResult->FrameNanos.Mean * 1000 : 0;
+	pResult->Threads = converter.GetThreadCount();
+	pResult->Simd = converter.GetSimdLevel();
+	return S_OK;
+}
+
+void PrintVideoConverterBenchmarkResult(_In_ const VIDEO_CONVERTER_BENCHMARK_OPTIONS &options, _In_ const VIDEO_CONVERTER_BENCHMARK_RESULT &result)
+{
+	printf("  %4ux%-4u  %s %s %-7s  %-6s  %u threads   %7.3f ms mean  %7.3f ms p99  %7.0f Mpx/s   %7.3f ms allocating   %llu allocations, %llu mismatches, max error %d\n",
+		options.Width, options.Height, options.Converter.Layout == VideoPlaneLayout::NV12 ? "NV12" : "I420", options.Converter.Matrix == VideoColorMatrix::BT601 ? "BT.601" : "BT.709",
+		options.Converter.IsFullRange ? "full" : "limited", GetSimdName(result.Simd), result.Threads, result.FrameNanos.Mean / 1e6, result.FrameNanos.P99 / 1e6,
+		result.MegapixelsPerSecond, result.AllocatingNanosPerFrame / 1e6, (unsigned long long)result.SteadyStateHeapAllocations, (unsigned long long)result.MismatchBytes, result.MaxReferenceError);
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include "Benchmark.h"
+#include "../ScreenRecorderLibNative/VideoColorConverter.h"
+
+struct VIDEO_CONVERTER_BENCHMARK_OPTIONS {
+	UINT32 Width = 1920;
+	UINT32 Height = 1080;
+	//Frames timed, after the warm up frames.
+	UINT32 Frames = 60;
+	UINT32 WarmupFrames = 3;
+	VIDEO_COLOR_CONVERTER_OPTIONS Converter;
+	SimdLevel Simd = SimdLevel::Auto;
+};
+
+struct VIDEO_CONVERTER_BENCHMARK_RESULT {
+	//Time to convert a frame into a buffer reused from frame to frame, as the pooled buffers of the recorder are.
+	BENCHMARK_STATS FrameNanos;
+	//The mean time to convert a frame into a newly allocated buffer, as with a fresh media buffer for every frame.
+	double AllocatingNanosPerFrame;
+	double MegapixelsPerSecond;
+	UINT32 Threads;
+	SimdLevel Simd;
+	UINT64 SteadyStateHeapAllocations;
+	//Bytes that differ from the output of the scalar code on one thread. Should be zero.
+	UINT64 MismatchBytes;
+	//The largest difference from the conversion done in floating point, in code values.
+	int MaxReferenceError;
+};
+
+/// <summary>
+/// Converts a generated BGRA desktop image with gradients, text like detail and saturated colors to YUV, the step between capture and the encoder,
+/// and checks the output against the scalar code and against the conversion computed in floating point.
+/// </summary>
+HRESULT RunVideoConverterBenchmark(_In_ const VIDEO_CONVERTER_BENCHMARK_OPTIONS &options, _Out_ VIDEO_CONVERTER_BENCHMARK_RESULT *pResult);
+void PrintVideoConverterBenchmarkResult(_In_ const VIDEO_CONVERTER_BENCHMARK_OPTIONS &options, _In_ const VIDEO_CONVERTER_BENCHMARK_RESULT &result);
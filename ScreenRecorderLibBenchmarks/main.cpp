@@ -0,0 +1,1251 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "AudioLimiterBenchmark.h"
+#include "AudioOnlyBenchmark.h"
+#include "AudioOptionsBenchmark.h"
+#include "AudioPipelineBenchmark.h"
+#include "AudioTracksBenchmark.h"
+#include "DriftBenchmark.h"
+#include "PacketQueueBenchmark.h"
+#include "SampleFormatBenchmark.h"
+#include "FrameQueueBenchmark.h"
+#include "MixerBenchmark.h"
+#include "MuxerBenchmark.h"
+#include "ChunkLatencyBenchmark.h"
+#include "RecoveryBenchmark.h"
+#include "ReplayBenchmark.h"
+#include "ResamplerBenchmark.h"
+#include "RingBufferBenchmark.h"
+#include "SegmentBenchmark.h"
+#include "UnchangedFramesBenchmark.h"
+#include "VideoConverterBenchmark.h"
+#include "../ScreenRecorderLibNative/AudioPacketizer.h"
+
+namespace {
+	void PrintUsage()
+	{
+		printf("Usage: ScreenRecorderLibBenchmarks [audio|graph|options|limiter|writer|tracks|audioonly|latency|convert|queue|unchanged|mux|chunks|segments|recovery|replay|ring|mix|resample|drift|packets|format] [options]\n");
+		printf("  audio                          Record the default output and input device pair. This is the default.\n");
+		printf("  graph                          Record 1, 4 and 16 synthetic devices, and report how the cost scales.\n");
+		printf("  options                        Time applying dynamic audio options per frame, reconfiguring every frame and checking versions.\n");
+		printf("  limiter                        Time the lookahead limiter against converting the mix directly, on quiet, loud and bursty signals.\n");
+		printf("  writer                         Record at 30 fps, with video stalls, with pauses in the audio and at 1 fps, writing audio per video frame and on the audio writer thread.\n");
+		printf("  tracks                         Record 2 and 4 sources to one mixed track, a track per source, and both, and check every track.\n");
+		printf("  audioonly                      Record the output and input device pair to a WAV file with nothing of the video pipeline, and check the file.\n");
+		printf("  latency                        Record with event driven capture and with timer wakeups 5 to 50 ms apart, and report capture to mix latency.\n");
+		printf("  convert                        Convert 1080p, 1440p and 4K BGRA frames to NV12 at every SIMD level, on one thread and striped over threads.\n");
+		printf("  queue                          Capture at 60 fps into an encoder that stalls, on the capture thread and through the frame queue with each policy.\n");
+		printf("  unchanged                      Record a screen that is static most of the time, writing every frame and leaving out unchanged frames.\n");
+		printf("  mux                            Mux encoded video and AAC to fragmented MP4 with 0, 64 KB and 1 MB write buffers and 250 ms to 2 s fragments, and check the file.\n");
+		printf("  chunks                         Mux at the pace of capture in 1 s fragments, whole and in 500 to 100 ms chunks, and report capture to consumer latency.\n");
+		printf("  segments                       Mux into 10 s and 4 MB segments, and report how long the switches hold up the muxer.\n");
+		printf("  recovery                       Mux crash safe outputs with commits every chunk to never, then cut them off at random offsets and recover them.\n");
+		printf("  replay                         Keep the last 10 and 60 s of encoded video and AAC in memory under 16 to 256 MB caps, and save the window while writing goes on.\n");
+		printf("  ring                           Push numbered audio frames from a producer thread to a consumer through the ring buffer and the locked vector it replaced.\n");
+		printf("  mix                            Check the mixer at every SIMD level on 1, 2 and 8 inputs, odd lengths and in place, and time mixing 10 ms blocks.\n");
+		printf("  resample                       Resample sine tones between common rates at each quality, and report SNR, passband ripple and frames per second.\n");
+		printf("  drift                          Capture devices running 500 ppm fast and slow against the media clock, and check the drift estimate converges and the buffer stays in bounds.\n");
+		printf("  packets                        Play scripted packet sequences with gaps, overlaps, reordering and discontinuity flags into the packet queue, and check what is read back.\n");
+		printf("  format                         Time the audio path from capture to the encoder in 16 bit as it was and in float, for 1 to 4 sources, in CPU time per second of audio.\n");
+		printf("  --sources <n>                  Record n synthetic devices instead of the output and input device pair.\n");
+		printf("  --seconds <n>                  Simulated recording length. Default 60.\n");
+		printf("  --fps <n>                      Video frame rate the audio is sliced at. Default 30.\n");
+		printf("  --wav <path>                   Play a WAV file on the simulated output device instead of a tone.\n");
+		printf("  --silent                       Simulate idle devices that only deliver silent packets.\n");
+		printf("  --stall <ms> <interval s>      Delay one video frame by ms every interval seconds.\n");
+		printf("  --audio-per-frame              Take and write audio once per video frame, instead of in packets on the audio writer schedule.\n");
+		printf("  --no-limiter                   Convert the mix directly, without the lookahead limiter.\n");
+		printf("  --simd <scalar|sse2|avx2>      Limit the SIMD level. Default is the best supported.\n");
+		printf("  --threads <n>                  Threads converting a video frame, for the striped runs of convert. Default picks from the cores.\n");
+		printf("  --h264 <path>, --hevc <path>   Mux an Annex B elementary stream encoded without B-frames at --fps, instead of synthetic H.264 and HEVC.\n");
+		printf("  --aac <path>                   Mux an ADTS stream instead of synthetic AAC.\n");
+		printf("  --out <path>                   Write the file muxed with 1 s fragments and a 1 MB buffer here, with the codec added to the name if there are several.\n");
+		printf("  --max-ns-per-sample <n>        Fail if processing takes longer than this per sample.\n");
+		printf("  --max-allocations <n>          Fail if more than n allocations happen after warm up. Default 0.\n");
+		printf("  --max-offset-ms <n>            Fail if audio ends up further than this from the video clock. Default 100.\n");
+	}
+
+	bool ParseSimdLevel(const char *value, SimdLevel *pLevel)
+	{
+		if (strcmp(value, "scalar") == 0) {
+			*pLevel = SimdLevel::Scalar;
+		}
+		else if (strcmp(value, "sse2") == 0) {
+			*pLevel = SimdLevel::SSE2;
+		}
+		else if (strcmp(value, "avx2") == 0) {
+			*pLevel = SimdLevel::AVX2;
+		}
+		else if (strcmp(value, "auto") == 0) {
+			*pLevel = SimdLevel::Auto;
+		}
+		else {
+			return false;
+		}
+		return true;
+	}
+}
+
+/// <summary>
+/// Runs the headless benchmarks. Needs no audio or video hardware, and exits with a nonzero code if a regression limit is exceeded, so it can run on CI.
+/// </summary>
+int main(int argc, char *argv[])
+{
+	AUDIO_PIPELINE_BENCHMARK_OPTIONS audioOptions;
+	bool isGraphBenchmark = false;
+	bool isOptionsBenchmark = false;
+	bool isLimiterBenchmark = false;
+	bool isWriterBenchmark = false;
+	bool isTracksBenchmark = false;
+	bool isAudioOnlyBenchmark = false;
+	bool isLatencyBenchmark = false;
+	bool isConvertBenchmark = false;
+	bool isQueueBenchmark = false;
+	bool isUnchangedBenchmark = false;
+	bool isMuxBenchmark = false;
+	bool isChunksBenchmark = false;
+	bool isSegmentsBenchmark = false;
+	bool isRecoveryBenchmark = false;
+	bool isReplayBenchmark = false;
+	bool isRingBenchmark = false;
+	bool isMixBenchmark = false;
+	bool isResampleBenchmark = false;
+	bool isDriftBenchmark = false;
+	bool isPacketQueueBenchmark = false;
+	bool isSampleFormatBenchmark = false;
+	std::wstring h264Path;
+	std::wstring hevcPath;
+	std::wstring aacPath;
+	std::wstring muxOutputPath;
+	UINT32 convertThreads = 0;
+	double maxNanosPerSample = 0;
+	UINT64 maxAllocations = 0;
+	double maxOffsetMillis = 100;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "audio") {
+			continue;
+		}
+		else if (arg == "graph") {
+			isGraphBenchmark = true;
+		}
+		else if (arg == "options") {
+			isOptionsBenchmark = true;
+		}
+		else if (arg == "limiter") {
+			isLimiterBenchmark = true;
+		}
+		else if (arg == "writer") {
+			isWriterBenchmark = true;
+		}
+		else if (arg == "tracks") {
+			isTracksBenchmark = true;
+		}
+		else if (arg == "audioonly") {
+			isAudioOnlyBenchmark = true;
+		}
+		else if (arg == "latency") {
+			isLatencyBenchmark = true;
+		}
+		else if (arg == "convert") {
+			isConvertBenchmark = true;
+		}
+		else if (arg == "queue") {
+			isQueueBenchmark = true;
+		}
+		else if (arg == "unchanged") {
+			isUnchangedBenchmark = true;
+		}
+		else if (arg == "mux") {
+			isMuxBenchmark = true;
+		}
+		else if (arg == "chunks") {
+			isChunksBenchmark = true;
+		}
+		else if (arg == "segments") {
+			isSegmentsBenchmark = true;
+		}
+		else if (arg == "recovery") {
+			isRecoveryBenchmark = true;
+		}
+		else if (arg == "replay") {
+			isReplayBenchmark = true;
+		}
+		else if (arg == "ring") {
+			isRingBenchmark = true;
+		}
+		else if (arg == "mix") {
+			isMixBenchmark = true;
+		}
+		else if (arg == "resample") {
+			isResampleBenchmark = true;
+		}
+		else if (arg == "drift") {
+			isDriftBenchmark = true;
+		}
+		else if (arg == "packets") {
+			isPacketQueueBenchmark = true;
+		}
+		else if (arg == "format") {
+			isSampleFormatBenchmark = true;
+		}
+		else if (arg == "--sources" && hasValue) {
+			audioOptions.SourceCount = (UINT32)atoi(argv[++i]);
+		}
+		else if (arg == "--seconds" && hasValue) {
+			audioOptions.Seconds = atof(argv[++i]);
+		}
+		else if (arg == "--fps" && hasValue) {
+			audioOptions.FramesPerSecond = (UINT32)atoi(argv[++i]);
+		}
+		else if (arg == "--wav" && hasValue) {
+			audioOptions.WavPath = std::filesystem::path(argv[++i]).wstring();
+		}
+		else if (arg == "--h264" && hasValue) {
+			h264Path = std::filesystem::path(argv[++i]).wstring();
+		}
+		else if (arg == "--hevc" && hasValue) {
+			hevcPath = std::filesystem::path(argv[++i]).wstring();
+		}
+		else if (arg == "--aac" && hasValue) {
+			aacPath = std::filesystem::path(argv[++i]).wstring();
+		}
+		else if (arg == "--out" && hasValue) {
+			muxOutputPath = std::filesystem::path(argv[++i]).wstring();
+		}
+		else if (arg == "--silent") {
+			audioOptions.IsSilent = true;
+		}
+		else if (arg == "--audio-per-frame") {
+			audioOptions.IsAudioWrittenPerVideoFrame = true;
+		}
+		else if (arg == "--no-limiter") {
+			audioOptions.IsLimiterEnabled = false;
+		}
+		else if (arg == "--stall" && i + 2 < argc) {
+			audioOptions.StallMillis = (UINT32)atoi(argv[++i]);
+			audioOptions.StallIntervalSeconds = atof(argv[++i]);
+		}
+		else if (arg == "--simd" && hasValue && ParseSimdLevel(argv[i + 1], &audioOptions.Simd)) {
+			i++;
+		}
+		else if (arg == "--threads" && hasValue) {
+			convertThreads = (UINT32)atoi(argv[++i]);
+		}
+		else if (arg == "--max-ns-per-sample" && hasValue) {
+			maxNanosPerSample = atof(argv[++i]);
+		}
+		else if (arg == "--max-allocations" && hasValue) {
+			maxAllocations = (UINT64)atoll(argv[++i]);
+		}
+		else if (arg == "--max-offset-ms" && hasValue) {
+			maxOffsetMillis = atof(argv[++i]);
+		}
+		else {
+			PrintUsage();
+			return 2;
+		}
+	}
+
+	if (isOptionsBenchmark) {
+		for (UINT32 devices : { 2, 16 }) {
+			AUDIO_OPTIONS_BENCHMARK_OPTIONS optionsBenchmarkOptions;
+			optionsBenchmarkOptions.Devices = devices;
+			AUDIO_OPTIONS_BENCHMARK_RESULT result;
+			HRESULT hr = RunAudioOptionsBenchmark(optionsBenchmarkOptions, &result);
+			if (FAILED(hr)) {
+				fprintf(stderr, "Audio options benchmark failed: hr = 0x%08x\n", (unsigned)hr);
+				return 1;
+			}
+			PrintAudioOptionsBenchmarkResult(optionsBenchmarkOptions, result);
+		}
+		return 0;
+	}
+
+	if (isLimiterBenchmark) {
+		int exitCode = 0;
+		for (AudioLimiterBenchmarkSignal signal : { AudioLimiterBenchmarkSignal::Quiet, AudioLimiterBenchmarkSignal::Loud, AudioLimiterBenchmarkSignal::Bursts }) {
+			AUDIO_LIMITER_BENCHMARK_OPTIONS limiterOptions;
+			limiterOptions.Signal = signal;
+			limiterOptions.Seconds = audioOptions.Seconds;
+			limiterOptions.Simd = audioOptions.Simd;
+			AUDIO_LIMITER_BENCHMARK_RESULT result;
+			HRESULT hr = RunAudioLimiterBenchmark(limiterOptions, &result);
+			if (FAILED(hr)) {
+				fprintf(stderr, "Audio limiter benchmark failed: hr = 0x%08x\n", (unsigned)hr);
+				return 1;
+			}
+			PrintAudioLimiterBenchmarkResult(limiterOptions, result);
+			if (maxNanosPerSample > 0 && result.LimitAndConvertNanosPerSample > maxNanosPerSample) {
+				fprintf(stderr, "FAIL: %.2f ns/sample exceeds the limit of %.2f\n", result.LimitAndConvertNanosPerSample, maxNanosPerSample);
+				exitCode = 1;
+			}
+			if (result.ClippedSamplesAfterLimiter > 0) {
+				fprintf(stderr, "FAIL: %llu samples clipped after the limiter\n", (unsigned long long)result.ClippedSamplesAfterLimiter);
+				exitCode = 1;
+			}
+		}
+		return exitCode;
+	}
+
+	if (isAudioOnlyBenchmark) {
+		AUDIO_ONLY_BENCHMARK_OPTIONS audioOnlyOptions;
+		audioOnlyOptions.Seconds = audioOptions.Seconds;
+		audioOnlyOptions.SampleRate = audioOptions.SampleRate;
+		audioOnlyOptions.Channels = audioOptions.Channels;
+		audioOnlyOptions.IsLimiterEnabled = audioOptions.IsLimiterEnabled;
+		audioOnlyOptions.Simd = audioOptions.Simd;
+		AUDIO_ONLY_BENCHMARK_RESULT result;
+		HRESULT hr = RunAudioOnlyBenchmark(audioOnlyOptions, &result);
+		if (FAILED(hr)) {
+			fprintf(stderr, "Audio only benchmark failed: hr = 0x%08x\n", (unsigned)hr);
+			return 1;
+		}
+		PrintAudioOnlyBenchmarkResult(audioOnlyOptions, result);
+		int exitCode = 0;
+		if (!result.IsHeaderValid || !result.IsDataIntact) {
+			fprintf(stderr, "FAIL: the WAV file read back has %s\n", result.IsHeaderValid ? "other audio than was written" : "an invalid header");
+			exitCode = 1;
+		}
+		if (result.SteadyStateHeapAllocations > maxAllocations) {
+			fprintf(stderr, "FAIL: %llu heap allocations after warm up exceed the limit of %llu\n", (unsigned long long)result.SteadyStateHeapAllocations, (unsigned long long)maxAllocations);
+			exitCode = 1;
+		}
+		if (fabs(result.LengthErrorMillis) > maxOffsetMillis) {
+			fprintf(stderr, "FAIL: the WAV file is %.2f ms off the recording length, the limit is %.2f ms\n", result.LengthErrorMillis, maxOffsetMillis);
+			exitCode = 1;
+		}
+		return exitCode;
+	}
+
+	if (isLatencyBenchmark) {
+		struct LATENCY_CASE {
+			const char *Name;
+			bool IsEventDriven;
+			UINT32 WakeIntervalMillis;
+		};
+		const LATENCY_CASE cases[] = {
+			{ "event", true, 0 },
+			{ "timer, 5 ms", false, 0 },
+			{ "timer, 10 ms", false, 10 },
+			{ "timer, 20 ms", false, 20 },
+			{ "timer, 50 ms", false, 50 }
+		};
+		int exitCode = 0;
+		printf("Capture latency    wakeups/s   output avg / max (ms)   input avg / max (ms)   resync frames   a/v offset\n");
+		for (const LATENCY_CASE &latencyCase : cases) {
+			AUDIO_PIPELINE_BENCHMARK_OPTIONS latencyOptions = audioOptions;
+			latencyOptions.SourceCount = 0;
+			latencyOptions.IsCaptureEventDriven = latencyCase.IsEventDriven;
+			latencyOptions.CaptureWakeIntervalMillis = latencyCase.WakeIntervalMillis;
+			AUDIO_PIPELINE_BENCHMARK_RESULT result;
+			HRESULT hr = RunAudioPipelineBenchmark(latencyOptions, &result);
+			if (FAILED(hr)) {
+				fprintf(stderr, "Audio pipeline benchmark failed: hr = 0x%08x\n", (unsigned)hr);
+				return 1;
+			}
+			printf("  %-14s  %9.0f   %8.1f / %6.1f       %8.1f / %6.1f      %13llu   %7.2f ms\n",
+				latencyCase.Name, result.CaptureWakeupsPerSecond, result.OutputDeviceLatency.AverageMillis, result.OutputDeviceLatency.MaxMillis,
+				result.InputDeviceLatency.AverageMillis, result.InputDeviceLatency.MaxMillis, (unsigned long long)result.ResyncFrames, result.FinalOffsetMillis);
+			//Whatever the wake strategy, the drift compensation must bridge the time between wakeups without dropping audio or drifting off.
+			if (result.OutputDeviceLatency.Count == 0 || result.InputDeviceLatency.Count == 0) {
+				fprintf(stderr, "FAIL: %s: no latency measured\n", latencyCase.Name);
+				exitCode = 1;
+			}
+			if (result.ResyncFrames > 0) {
+				fprintf(stderr, "FAIL: %s: %llu frames dropped to resync\n", latencyCase.Name, (unsigned long long)result.ResyncFrames);
+				exitCode = 1;
+			}
+			//A read more than a millisecond short means the buffer ran dry before the capture woke up again.
+			if (result.SliceErrorFrames.Min < -(double)latencyOptions.SampleRate / 1000) {
+				fprintf(stderr, "FAIL: %s: a read came %.0f frames short\n", latencyCase.Name, -result.SliceErrorFrames.Min);
+				exitCode = 1;
+			}
+			if (fabs(result.FinalOffsetMillis) > maxOffsetMillis) {
+				fprintf(stderr, "FAIL: %s: audio ended %.2f ms from the video clock, the limit is %.2f ms\n", latencyCase.Name, result.FinalOffsetMillis, maxOffsetMillis);
+				exitCode = 1;
+			}
+		}
+		return exitCode;
+	}
+
+	if (isConvertBenchmark) {
+		SimdLevel maxLevel = ResolveSimdLevel(audioOptions.Simd);
+		std::vector<VIDEO_CONVERTER_BENCHMARK_OPTIONS> cases;
+		const UINT32 sizes[][2] = { { 1920, 1080 }, { 2560, 1440 }, { 3840, 2160 } };
+		for (const auto &size : sizes) {
+			VIDEO_CONVERTER_BENCHMARK_OPTIONS convertOptions;
+			convertOptions.Width = size[0];
+			convertOptions.Height = size[1];
+			convertOptions.Converter.Threads = 1;
+			for (SimdLevel level : { SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2 }) {
+				if ((int)level <= (int)maxLevel) {
+					convertOptions.Simd = level;
+					cases.push_back(convertOptions);
+				}
+			}
+			convertOptions.Simd = maxLevel;
+			convertOptions.Converter.Threads = convertThreads;
+			cases.push_back(convertOptions);
+		}
+		//The other layout, matrix and range, and a size that leaves odd rows, columns and partial vectors to the scalar code.
+		VIDEO_CONVERTER_BENCHMARK_OPTIONS i420Options;
+		i420Options.Converter.Layout = VideoPlaneLayout::I420;
+		i420Options.Converter.Matrix = VideoColorMatrix::BT601;
+		i420Options.Converter.IsFullRange = true;
+		i420Options.Converter.Threads = convertThreads;
+		i420Options.Simd = maxLevel;
+		cases.push_back(i420Options);
+		VIDEO_CONVERTER_BENCHMARK_OPTIONS oddOptions;
+		oddOptions.Width = 1365;
+		oddOptions.Height = 767;
+		oddOptions.Converter.Threads = convertThreads;
+		oddOptions.Simd = maxLevel;
+		cases.push_back(oddOptions);
+
+		int exitCode = 0;
+		printf("Video color conversion, BGRA to YUV 4:2:0\n");
+		for (const VIDEO_CONVERTER_BENCHMARK_OPTIONS &convertOptions : cases) {
+			VIDEO_CONVERTER_BENCHMARK_RESULT result;
+			HRESULT hr = RunVideoConverterBenchmark(convertOptions, &result);
+			if (FAILED(hr)) {
+				fprintf(stderr, "Video converter benchmark failed: hr = 0x%08x\n", (unsigned)hr);
+				return 1;
+			}
+			PrintVideoConverterBenchmarkResult(convertOptions, result);
+			if (result.MismatchBytes > 0) {
+				fprintf(stderr, "FAIL: %llu bytes differ from the scalar conversion\n", (unsigned long long)result.MismatchBytes);
+				exitCode = 1;
+			}
+			//The fixed point math may round the other way, but never by more than one code value.
+			if (result.MaxReferenceError > 1) {
+				fprintf(stderr, "FAIL: the conversion is %d code values off the floating point reference\n", result.MaxReferenceError);
+				exitCode = 1;
+			}
+			if (result.SteadyStateHeapAllocations > maxAllocations) {
+				fprintf(stderr, "FAIL: %llu heap allocations after warm up exceed the limit of %llu\n", (unsigned long long)result.SteadyStateHeapAllocations, (unsigned long long)maxAllocations);
+				exitCode = 1;
+			}
+		}
+		return exitCode;
+	}
+
+	if (isQueueBenchmark) {
+		std::vector<FRAME_QUEUE_BENCHMARK_OPTIONS> cases;
+		FRAME_QUEUE_BENCHMARK_OPTIONS queueOptions;
+		queueOptions.QueueLength = 0;
+		cases.push_back(queueOptions);
+		queueOptions.QueueLength = 4;
+		for (FrameQueueFullPolicy policy : { FrameQueueFullPolicy::Block, FrameQueueFullPolicy::DropOldest, FrameQueueFullPolicy::DropNewest }) {
+			queueOptions.Policy = policy;
+			cases.push_back(queueOptions);
+		}
+		int exitCode = 0;
+		printf("Frame queue, %u fps, %.0f ms per frame, %.0f ms stall every %.0f s\n", queueOptions.FramesPerSecond, queueOptions.EncodeMillis, queueOptions.StallMillis, queueOptions.StallIntervalSeconds);
+		printf("  encoder on                written/captured   dropped   max depth   hand over p99 / max   capture interval p99 / max   timeline errors / end   allocations\n");
+		for (const FRAME_QUEUE_BENCHMARK_OPTIONS &options : cases) {
+			FRAME_QUEUE_BENCHMARK_RESULT result;
+			HRESULT hr = RunFrameQueueBenchmark(options, &result);
+			if (FAILED(hr)) {
+				fprintf(stderr, "Frame queue benchmark failed: hr = 0x%08x\n", (unsigned)hr);
+				return 1;
+			}
+			PrintFrameQueueBenchmarkResult(options, result);
+			if (result.TimelineErrors > 0 || result.TimelineEndErrorMillis != 0) {
+				fprintf(stderr, "FAIL: %llu frames are off the timeline, which ends %.2f ms off\n", (unsigned long long)result.TimelineErrors, result.TimelineEndErrorMillis);
+				exitCode = 1;
+			}
+			if (options.QueueLength > 0 && options.Policy == FrameQueueFullPolicy::Block && result.DroppedFrames > 0) {
+				fprintf(stderr, "FAIL: %llu frames dropped while blocking\n", (unsigned long long)result.DroppedFrames);
+				exitCode = 1;
+			}
+			if (result.WrittenFrames + result.DroppedFrames != result.CapturedFrames) {
+				fprintf(stderr, "FAIL: %llu frames captured, but %llu written and %llu dropped\n", (unsigned long long)result.CapturedFrames, (unsigned long long)result.WrittenFrames, (unsigned long long)result.DroppedFrames);
+				exitCode = 1;
+			}
+			if (result.SteadyStateHeapAllocations > maxAllocations) {
+				fprintf(stderr, "FAIL: %llu heap allocations after warm up exceed the limit of %llu\n", (unsigned long long)result.SteadyStateHeapAllocations, (unsigned long long)maxAllocations);
+				exitCode = 1;
+			}
+		}
+		return exitCode;
+	}
+
+	if (isUnchangedBenchmark) {
+		std::vector<UNCHANGED_FRAMES_BENCHMARK_OPTIONS> cases;
+		UNCHANGED_FRAMES_BENCHMARK_OPTIONS unchangedOptions;
+		unchangedOptions.Seconds = audioOptions.Seconds;
+		unchangedOptions.Simd = audioOptions.Simd;
+		unchangedOptions.IsSkippingEnabled = false;
+		cases.push_back(unchangedOptions);
+		unchangedOptions.IsSkippingEnabled = true;
+		for (UINT32 maxDurationMillis : { 250, 1000, 4000 }) {
+			unchangedOptions.MaxUnchangedFrameDurationMillis = maxDurationMillis;
+			cases.push_back(unchangedOptions);
+		}
+		int exitCode = 0;
+		printf("Unchanged frames, %ux%u at %u fps, changing for %.0f s out of every %.0f s\n", unchangedOptions.Width, unchangedOptions.Height, unchangedOptions.FramesPerSecond, unchangedOptions.ActiveSeconds, unchangedOptions.PeriodSeconds);
+		printf("  mode                    written/captured   conversion     to encoder     longest frame   missed changes / timeline errors\n");
+		for (const UNCHANGED_FRAMES_BENCHMARK_OPTIONS &options : cases) {
+			UNCHANGED_FRAMES_BENCHMARK_RESULT result;
+			HRESULT hr = RunUnchangedFramesBenchmark(options, &result);
+			if (FAILED(hr)) {
+				fprintf(stderr, "Unchanged frames benchmark failed: hr = 0x%08x\n", (unsigned)hr);
+				return 1;
+			}
+			PrintUnchangedFramesBenchmarkResult(options, result);
+			if (result.MissedChangedFrames > 0 || result.TimelineErrors > 0) {
+				fprintf(stderr, "FAIL: %llu changed frames were not written, %llu frames are out of order\n", (unsigned long long)result.MissedChangedFrames, (unsigned long long)result.TimelineErrors);
+				exitCode = 1;
+			}
+			double maxDurationMillis = options.IsSkippingEnabled ? options.MaxUnchangedFrameDurationMillis : 1000.0 / options.FramesPerSecond;
+			if (result.MaxFrameDurationMillis > maxDurationMillis + 0.01) {
+				fprintf(stderr, "FAIL: a frame was shown for %.1f ms, the limit is %.1f ms\n", result.MaxFrameDurationMillis, maxDurationMillis);
+				exitCode = 1;
+			}
+		}
+		return exitCode;
+	}
+
+	if (isMuxBenchmark) {
+		struct VIDEO_INPUT {
+			Mp4Codec Codec;
+			std::wstring Path;
+		};
+		std::vector<VIDEO_INPUT> videoInputs;
+		if (!h264Path.empty()) {
+			videoInputs.push_back({ Mp4Codec::H264, h264Path });
+		}
+		if (!hevcPath.empty()) {
+			videoInputs.push_back({ Mp4Codec::HEVC, hevcPath });
+		}
+		if (videoInputs.empty()) {
+			videoInputs = { { Mp4Codec::H264, L"" }, { Mp4Codec::HEVC, L"" } };
+		}
+		ENCODED_STREAM audio;
+		HRESULT hr = aacPath.empty() ? CreateSyntheticAudioStream(48000, 2, 192000, audioOptions.Seconds, &audio) : ReadAdtsStream(aacPath, &audio);
+		if (FAILED(hr)) {
+			fprintf(stderr, "Reading the AAC stream failed: hr = 0x%08x\n", (unsigned)hr);
+			return 1;
+		}
+		int exitCode = 0;
+		printf("Fragmented MP4 muxing, %u fps\n", audioOptions.FramesPerSecond);
+		printf("  tracks     fragment  buffer         write      realtime  fragments  longest  writes/frag   sample p99 / max       allocations\n");
+		for (const VIDEO_INPUT &videoInput : videoInputs) {
+			for (UINT32 fragmentMillis : { 250, 1000, 2000 }) {
+				//Synthetic video has a keyframe per fragment, as the recorder sets the GOP of the encoder for the native muxer. A file has the GOP it was encoded with.
+				ENCODED_STREAM video;
+				if (videoInput.Path.empty()) {
+					UINT32 keyFrameInterval = (std::max)((audioOptions.FramesPerSecond * fragmentMillis + 999) / 1000, 1u);
+					hr = CreateSyntheticVideoStream(videoInput.Codec, audioOptions.FramesPerSecond, keyFrameInterval, 8000000, audioOptions.Seconds, &video);
+				}
+				else {
+					hr = ReadAnnexBStream(videoInput.Path, videoInput.Codec, audioOptions.FramesPerSecond, &video);
+				}
+				if (FAILED(hr)) {
+					fprintf(stderr, "Reading the video stream failed: hr = 0x%08x\n", (unsigned)hr);
+					return 1;
+				}
+				for (UINT32 bufferBytes : { 0, 64 * 1024, 1024 * 1024 }) {
+					MUXER_BENCHMARK_OPTIONS muxOptions;
+					muxOptions.pVideo = &video;
+					muxOptions.pAudio = &audio;
+					muxOptions.Muxer.FragmentDuration100Nanos = (INT64)fragmentMillis * 10000;
+					muxOptions.Muxer.WriteBufferBytes = bufferBytes;
+					if (!muxOutputPath.empty() && fragmentMillis == 1000 && bufferBytes == 1024 * 1024) {
+						std::filesystem::path outputPath(muxOutputPath);
+						if (videoInputs.size() > 1) {
+							outputPath.replace_filename(outputPath.stem().wstring() + (videoInput.Codec == Mp4Codec::HEVC ? L"-hevc" : L"-h264") + outputPath.extension().wstring());
+						}
+						muxOptions.OutputPath = outputPath.wstring();
+					}
+					MUXER_BENCHMARK_RESULT result;
+					hr = RunMuxerBenchmark(muxOptions, &result);
+					if (FAILED(hr)) {
+						fprintf(stderr, "Muxer benchmark failed: hr = 0x%08x\n", (unsigned)hr);
+						return 1;
+					}
+					PrintMuxerBenchmarkResult(muxOptions, result);
+					for (const std::string &error : result.Check.Errors) {
+						fprintf(stderr, "FAIL: %s\n", error.c_str());
+						exitCode = 1;
+					}
+					if (!result.IsPayloadIntact) {
+						fprintf(stderr, "FAIL: the samples read back are not the access units muxed\n");
+						exitCode = 1;
+					}
+					//Each track lasts as long as its stream, give or take the rounding of 100 nanosecond times to the sample rate of audio.
+					if (result.MaxDurationErrorMillis > 0.01) {
+						fprintf(stderr, "FAIL: a track ends %.2f ms off the end of its stream\n", result.MaxDurationErrorMillis);
+						exitCode = 1;
+					}
+					//With a buffer, a fragment goes out in one write, or a few if it is bigger than the buffer.
+					if (bufferBytes > 0 && result.Stats.MaxFragmentBytes <= bufferBytes && result.StreamWritesPerFragment > 1.1) {
+						fprintf(stderr, "FAIL: %.2f stream writes per fragment, with fragments that fit the buffer\n", result.StreamWritesPerFragment);
+						exitCode = 1;
+					}
+					if (result.SteadyStateHeapAllocations > maxAllocations) {
+						fprintf(stderr, "FAIL: %llu heap allocations after warm up exceed the limit of %llu\n", (unsigned long long)result.SteadyStateHeapAllocations, (unsigned long long)maxAllocations);
+						exitCode = 1;
+					}
+				}
+			}
+		}
+		return exitCode;
+	}
+
+	if (isChunksBenchmark) {
+		CHUNK_LATENCY_BENCHMARK_OPTIONS chunkOptions;
+		const UINT32 fragmentMillis = 1000;
+		UINT32 keyFrameInterval = (std::max)((audioOptions.FramesPerSecond * fragmentMillis + 999) / 1000, 1u);
+		ENCODED_STREAM video;
+		ENCODED_STREAM audio;
+		HRESULT hr = CreateSyntheticVideoStream(Mp4Codec::H264, audioOptions.FramesPerSecond, keyFrameInterval, 8000000, chunkOptions.Seconds + 1, &video);
+		if (SUCCEEDED(hr)) {
+			hr = CreateSyntheticAudioStream(48000, 2, 192000, chunkOptions.Seconds + 1, &audio);
+		}
+		if (FAILED(hr)) {
+			fprintf(stderr, "Creating the streams failed: hr = 0x%08x\n", (unsigned)hr);
+			return 1;
+		}
+		chunkOptions.pVideo = &video;
+		chunkOptions.pAudio = &audio;
+		chunkOptions.Muxer.FragmentDuration100Nanos = (INT64)fragmentMillis * 10000;
+		int exitCode = 0;
+		printf("Fragmented MP4 chunks, h264+aac at %u fps, %.0f seconds in real time\n", audioOptions.FramesPerSecond, chunkOptions.Seconds);
+		printf("  fragment   chunk      chunks / starts  longest       latency p50 / p99 / max        delivery p50 / max    received / muxed\n");
+		for (UINT32 chunkMillis : { 0, 500, 200, 100 }) {
+			chunkOptions.Muxer.ChunkDuration100Nanos = (INT64)chunkMillis * 10000;
+			CHUNK_LATENCY_BENCHMARK_RESULT result;
+			hr = RunChunkLatencyBenchmark(chunkOptions, &result);
+			if (FAILED(hr)) {
+				fprintf(stderr, "Chunk latency benchmark failed: hr = 0x%08x\n", (unsigned)hr);
+				return 1;
+			}
+			PrintChunkLatencyBenchmarkResult(chunkOptions, result);
+			for (const std::string &error : result.Check.Errors) {
+				fprintf(stderr, "FAIL: %s\n", error.c_str());
+				exitCode = 1;
+			}
+			if (result.ChunkErrors > 0 || result.ReceivedSamples != result.MuxedSamples) {
+				fprintf(stderr, "FAIL: %llu chunks do not follow the one before, %llu of %llu samples received\n", (unsigned long long)result.ChunkErrors, (unsigned long long)result.ReceivedSamples, (unsigned long long)result.MuxedSamples);
+				exitCode = 1;
+			}
+			//A sample waits at most for its chunk to fill, and for the video frame that cuts it. Audio is ready a packet after it starts, and the consumer needs a moment to wake up.
+			double maxLatencyMillis = (chunkMillis > 0 ? chunkMillis : fragmentMillis) + 1000.0 / audioOptions.FramesPerSecond + 1024 * 1000.0 / 48000 + 25;
+			if (result.SampleLatencyMillis.Max > maxLatencyMillis) {
+				fprintf(stderr, "FAIL: a sample reached the consumer %.1f ms after capture, the limit is %.1f ms\n", result.SampleLatencyMillis.Max, maxLatencyMillis);
+				exitCode = 1;
+			}
+		}
+		return exitCode;
+	}
+
+	if (isSegmentsBenchmark) {
+		const UINT32 fragmentMillis = 1000;
+		UINT32 keyFrameInterval = (std::max)((audioOptions.FramesPerSecond * fragmentMillis + 999) / 1000, 1u);
+		ENCODED_STREAM video;
+		ENCODED_STREAM audio;
+		HRESULT hr = CreateSyntheticVideoStream(Mp4Codec::H264, audioOptions.FramesPerSecond, keyFrameInterval, 8000000, audioOptions.Seconds, &video);
+		if (SUCCEEDED(hr)) {
+			hr = CreateSyntheticAudioStream(48000, 2, 192000, audioOptions.Seconds, &audio);
+		}
+		if (FAILED(hr)) {
+			fprintf(stderr, "Creating the streams failed: hr = 0x%08x\n", (unsigned)hr);
+			return 1;
+		}
+		struct SEGMENT_CASE {
+			UINT32 SegmentMillis;
+			UINT64 SegmentBytes;
+			UINT32 ChunkMillis;
+		};
+		const SEGMENT_CASE cases[] = { { 10000, 0, 0 }, { 0, 4 * 1024 * 1024, 0 }, { 10000, 0, 200 } };
+		int exitCode = 0;
+		printf("Fragmented MP4 segments, h264+aac at %u fps, %.0f seconds\n", audioOptions.FramesPerSecond, audioOptions.Seconds);
+		printf("  segment  fragment  chunk      segments  longest    largest       switch p50 / max        sample p99 / max     dropped/missing  gaps\n");
+		for (const SEGMENT_CASE &segmentCase : cases) {
+			SEGMENT_BENCHMARK_OPTIONS segmentOptions;
+			segmentOptions.pVideo = &video;
+			segmentOptions.pAudio = &audio;
+			segmentOptions.Muxer.FragmentDuration100Nanos = (INT64)fragmentMillis * 10000;
+			segmentOptions.Muxer.ChunkDuration100Nanos = (INT64)segmentCase.ChunkMillis * 10000;
+			segmentOptions.Muxer.SegmentDuration100Nanos = (INT64)segmentCase.SegmentMillis * 10000;
+			segmentOptions.Muxer.SegmentBytes = segmentCase.SegmentBytes;
+			segmentOptions.Muxer.WriteBufferBytes = 1024 * 1024;
+			SEGMENT_BENCHMARK_RESULT result;
+			hr = RunSegmentBenchmark(segmentOptions, &result);
+			if (FAILED(hr)) {
+				fprintf(stderr, "Segment benchmark failed: hr = 0x%08x\n", (unsigned)hr);
+				return 1;
+			}
+			PrintSegmentBenchmarkResult(segmentOptions, result);
+			for (const std::string &error : result.Errors) {
+				fprintf(stderr, "FAIL: %s\n", error.c_str());
+				exitCode = 1;
+			}
+			if (!result.IsPayloadIntact || result.DroppedSamples > 0 || result.MissingSamples > 0) {
+				fprintf(stderr, "FAIL: the segments do not hold every access unit once, %llu dropped, %llu missing\n", (unsigned long long)result.DroppedSamples, (unsigned long long)result.MissingSamples);
+				exitCode = 1;
+			}
+			if (result.GapsOrOverlaps > 0) {
+				fprintf(stderr, "FAIL: %llu tracks do not start where they ended in the segment before\n", (unsigned long long)result.GapsOrOverlaps);
+				exitCode = 1;
+			}
+			if (result.Segments < 2) {
+				fprintf(stderr, "FAIL: the recording was not split into segments\n");
+				exitCode = 1;
+			}
+			//A switch that takes longer than a frame would hold up the encoder, and frames would be dropped in a recording.
+			double frameMicros = 1e6 / audioOptions.FramesPerSecond;
+			if (result.SwitchMicros.Max > frameMicros) {
+				fprintf(stderr, "FAIL: a segment switch took %.1f us, longer than a frame of %.1f us\n", result.SwitchMicros.Max, frameMicros);
+				exitCode = 1;
+			}
+		}
+		return exitCode;
+	}
+
+	if (isRecoveryBenchmark) {
+		const UINT32 fragmentMillis = 1000;
+		const UINT32 chunkMillis = 250;
+		//Every recovery copies up to the whole output, so the outputs are kept short enough for hundreds of them.
+		double seconds = (std::min)(audioOptions.Seconds, 20.0);
+		UINT32 keyFrameInterval = (std::max)((audioOptions.FramesPerSecond * fragmentMillis + 999) / 1000, 1u);
+		ENCODED_STREAM video;
+		ENCODED_STREAM audio;
+		HRESULT hr = CreateSyntheticVideoStream(Mp4Codec::H264, audioOptions.FramesPerSecond, keyFrameInterval, 8000000, seconds, &video);
+		if (SUCCEEDED(hr)) {
+			hr = CreateSyntheticAudioStream(48000, 2, 192000, seconds, &audio);
+		}
+		if (FAILED(hr)) {
+			fprintf(stderr, "Creating the streams failed: hr = 0x%08x\n", (unsigned)hr);
+			return 1;
+		}
+		struct RECOVERY_CASE {
+			INT32 CommitMillis;
+			bool IsJournalEnabled;
+			UINT32 Truncations;
+		};
+		const RECOVERY_CASE cases[] = { { -1, false, 100 }, { -1, true, 0 }, { 0, true, 0 }, { 1000, true, 100 }, { 5000, true, 0 } };
+		int exitCode = 0;
+		printf("Crash safe fragmented MP4, h264+aac at %u fps in %u ms chunks, %.0f seconds\n", audioOptions.FramesPerSecond, chunkMillis, seconds);
+		printf("  commit   journal  chunks  commits   journal / output       mux     recoveries  wrong/damaged     recovery\n");
+		for (const RECOVERY_CASE &recoveryCase : cases) {
+			RECOVERY_BENCHMARK_OPTIONS recoveryOptions;
+			recoveryOptions.pVideo = &video;
+			recoveryOptions.pAudio = &audio;
+			recoveryOptions.Muxer.FragmentDuration100Nanos = (INT64)fragmentMillis * 10000;
+			recoveryOptions.Muxer.ChunkDuration100Nanos = (INT64)chunkMillis * 10000;
+			recoveryOptions.Muxer.CommitInterval100Nanos = recoveryCase.CommitMillis < 0 ? -1 : (INT64)recoveryCase.CommitMillis * 10000;
+			recoveryOptions.IsJournalEnabled = recoveryCase.IsJournalEnabled;
+			recoveryOptions.Truncations = recoveryCase.Truncations;
+			RECOVERY_BENCHMARK_RESULT result;
+			hr = RunRecoveryBenchmark(recoveryOptions, &result);
+			if (FAILED(hr)) {
+				fprintf(stderr, "Recovery benchmark failed: hr = 0x%08x\n", (unsigned)hr);
+				return 1;
+			}
+			PrintRecoveryBenchmarkResult(recoveryOptions, result);
+			for (const std::string &error : result.Errors) {
+				fprintf(stderr, "FAIL: %s\n", error.c_str());
+				exitCode = 1;
+			}
+			if (result.WrongChunkCounts > 0 || result.DamagedOutputs > 0) {
+				fprintf(stderr, "FAIL: %llu recoveries kept the wrong chunks, %llu recovered files are damaged\n", (unsigned long long)result.WrongChunkCounts, (unsigned long long)result.DamagedOutputs);
+				exitCode = 1;
+			}
+			//The journal is a record per chunk, besides the init segment and the index, and nothing more.
+			UINT64 expectedJournalBytes = recoveryCase.IsJournalEnabled ? (result.Chunks + 2) * Mp4JournalRecordBytes : 0;
+			if (result.JournalBytes != expectedJournalBytes) {
+				fprintf(stderr, "FAIL: the journal has %llu bytes, not %llu\n", (unsigned long long)result.JournalBytes, (unsigned long long)expectedJournalBytes);
+				exitCode = 1;
+			}
+			//A commit per interval of recording time at most, besides the one at the end.
+			UINT64 maxCommits = recoveryCase.CommitMillis < 0 ? 0 : recoveryCase.CommitMillis == 0 ? result.Chunks + 1 : (UINT64)(seconds * 1000 / recoveryCase.CommitMillis) + 2;
+			if (result.Commits > maxCommits) {
+				fprintf(stderr, "FAIL: %llu commits, more than the %llu the interval allows\n", (unsigned long long)result.Commits, (unsigned long long)maxCommits);
+				exitCode = 1;
+			}
+		}
+		return exitCode;
+	}
+
+	if (isReplayBenchmark) {
+		const UINT32 fragmentMillis = 1000;
+		const INT64 gopDuration = 2 * 10000000LL;
+		//Long enough to fill the longest window twice over.
+		const double seconds = 150;
+		UINT32 keyFrameInterval = (std::max)(audioOptions.FramesPerSecond * 2, 1u);
+		ENCODED_STREAM video;
+		ENCODED_STREAM audio;
+		HRESULT hr = CreateSyntheticVideoStream(Mp4Codec::H264, audioOptions.FramesPerSecond, keyFrameInterval, 8000000, seconds, &video);
+		if (SUCCEEDED(hr)) {
+			hr = CreateSyntheticAudioStream(48000, 2, 192000, seconds, &audio);
+		}
+		if (FAILED(hr)) {
+			fprintf(stderr, "Creating the streams failed: hr = 0x%08x\n", (unsigned)hr);
+			return 1;
+		}
+		struct REPLAY_CASE {
+			UINT32 WindowSeconds;
+			UINT32 CapMegabytes;
+			double Speed;
+			//Whether the cap cuts the window short. Where it does not, it holds the whole run, so the ring never runs out of room.
+			bool IsWindowBoundByCap;
+		};
+		const REPLAY_CASE cases[] = { { 60, 256, 50, false }, { 10, 192, 50, false }, { 60, 32, 50, true }, { 10, 16, 50, true }, { 60, 64, 0, true } };
+		double streamBytesPerSecond = (video.Data.size() + audio.Data.size()) / seconds;
+		UINT64 maxSaveBatchBytes = 1024 * 1024;
+		for (const ENCODED_STREAM *pStream : { &video, &audio }) {
+			for (const ENCODED_ACCESS_UNIT &unit : pStream->Units) {
+				maxSaveBatchBytes = (std::max)(maxSaveBatchBytes, 1024 * 1024 + (UINT64)unit.Size);
+			}
+		}
+		double frameSeconds = 1.0 / audioOptions.FramesPerSecond;
+		int exitCode = 0;
+		printf("Instant replay buffer, h264 at 8 Mbps, %u fps, a keyframe every 2 s, and aac, %.0f seconds, saved at 75, 110 and 149 s\n", audioOptions.FramesPerSecond, seconds);
+		printf("  window  cap       speed  insert         write p99 / max       during save  allocs  window / memory      longest  saves/trunc  saved min / max   save         longest\n");
+		for (const REPLAY_CASE &replayCase : cases) {
+			REPLAY_BENCHMARK_OPTIONS replayOptions;
+			replayOptions.pVideo = &video;
+			replayOptions.pAudio = &audio;
+			replayOptions.Buffer.Duration100Nanos = (INT64)replayCase.WindowSeconds * 10000000;
+			replayOptions.Buffer.MaxBytes = (UINT64)replayCase.CapMegabytes * 1024 * 1024;
+			replayOptions.Muxer.FragmentDuration100Nanos = (INT64)fragmentMillis * 10000;
+			replayOptions.Speed = replayCase.Speed;
+			replayOptions.SavePositions = { 75 * 10000000LL, 110 * 10000000LL, 149 * 10000000LL };
+			REPLAY_BENCHMARK_RESULT result;
+			hr = RunReplayBenchmark(replayOptions, &result);
+			if (FAILED(hr)) {
+				fprintf(stderr, "Replay benchmark failed: hr = 0x%08x\n", (unsigned)hr);
+				return 1;
+			}
+			PrintReplayBenchmarkResult(replayOptions, result);
+			for (const std::string &error : result.Errors) {
+				fprintf(stderr, "FAIL: %s\n", error.c_str());
+				exitCode = 1;
+			}
+			if (result.DamagedSaves > 0 || result.Saves != replayOptions.SavePositions.size()) {
+				fprintf(stderr, "FAIL: %llu of %llu saves are damaged, of %zu asked for\n", (unsigned long long)result.DamagedSaves, (unsigned long long)result.Saves, replayOptions.SavePositions.size());
+				exitCode = 1;
+			}
+			if (result.SteadyStateHeapAllocations > maxAllocations) {
+				fprintf(stderr, "FAIL: %llu heap allocations while writing samples after warm up\n", (unsigned long long)result.SteadyStateHeapAllocations);
+				exitCode = 1;
+			}
+			//Everything the buffer holds is allocated up front, within the cap, and nothing past it.
+			if (result.MemoryBytes > replayOptions.Buffer.MaxBytes || result.HeapBytes > replayOptions.Buffer.MaxBytes || result.MaxWindowBytes > result.MemoryBytes) {
+				fprintf(stderr, "FAIL: the buffer took %llu bytes, %llu by the heap, and held %llu, over the cap of %llu\n", (unsigned long long)result.MemoryBytes,
+					(unsigned long long)result.HeapBytes, (unsigned long long)result.MaxWindowBytes, (unsigned long long)replayOptions.Buffer.MaxBytes);
+				exitCode = 1;
+			}
+			//The window is let go a group of pictures at a time, so it lasts up to a group of pictures longer than asked, and no less unless the cap cuts it short.
+			double windowSeconds = replayCase.WindowSeconds;
+			double maxWindowSeconds = windowSeconds + (double)gopDuration / 10000000 + frameSeconds;
+			if (result.MaxWindowSeconds > maxWindowSeconds || result.MaxSavedSeconds > maxWindowSeconds) {
+				fprintf(stderr, "FAIL: the window lasted up to %.2f s, and a save %.2f s, longer than %.2f s\n", result.MaxWindowSeconds, result.MaxSavedSeconds, maxWindowSeconds);
+				exitCode = 1;
+			}
+			if (!replayCase.IsWindowBoundByCap && result.MinSavedSeconds < windowSeconds) {
+				fprintf(stderr, "FAIL: a save lasted %.2f s, shorter than the window of %.0f s\n", result.MinSavedSeconds, windowSeconds);
+				exitCode = 1;
+			}
+			if (replayCase.IsWindowBoundByCap && result.MinSavedSeconds < replayOptions.Buffer.MaxBytes / streamBytesPerSecond / 2 - (double)gopDuration / 10000000) {
+				fprintf(stderr, "FAIL: a save lasted %.2f s, much shorter than the cap holds\n", result.MinSavedSeconds);
+				exitCode = 1;
+			}
+			//A save is only cut short to make room in a full ring, so whether it is there depends on how fast it copies, which is not checked.
+			//A ring that never runs out of room cuts none short, however slow the saves are.
+			if (!replayCase.IsWindowBoundByCap && result.TruncatedSaves > 0) {
+				fprintf(stderr, "FAIL: %llu saves were cut short\n", (unsigned long long)result.TruncatedSaves);
+				exitCode = 1;
+			}
+			//A save holds up writing for a batch copy at most, of a megabyte and the sample that runs past it, which is checked by its size, as how long it takes depends on the load.
+			if (result.MaxSaveBatchBytes > maxSaveBatchBytes) {
+				fprintf(stderr, "FAIL: a save copied %llu bytes at once while writing waited, more than %llu\n", (unsigned long long)result.MaxSaveBatchBytes, (unsigned long long)maxSaveBatchBytes);
+				exitCode = 1;
+			}
+		}
+		return exitCode;
+	}
+
+	if (isTracksBenchmark) {
+		int exitCode = 0;
+		printf("Audio tracks, %u Hz, %u channels, %.0f seconds\n", audioOptions.SampleRate, audioOptions.Channels, audioOptions.Seconds);
+		for (UINT32 sources : { 2, 4 }) {
+			for (AudioTracksBenchmarkLayout layout : { AudioTracksBenchmarkLayout::Mixed, AudioTracksBenchmarkLayout::Separate, AudioTracksBenchmarkLayout::MixedAndSeparate }) {
+				AUDIO_TRACKS_BENCHMARK_OPTIONS tracksOptions;
+				tracksOptions.Layout = layout;
+				tracksOptions.Sources = sources;
+				tracksOptions.Seconds = audioOptions.Seconds;
+				tracksOptions.SampleRate = audioOptions.SampleRate;
+				tracksOptions.Channels = audioOptions.Channels;
+				tracksOptions.IsLimiterEnabled = audioOptions.IsLimiterEnabled;
+				tracksOptions.Simd = audioOptions.Simd;
+				AUDIO_TRACKS_BENCHMARK_RESULT result;
+				HRESULT hr = RunAudioTracksBenchmark(tracksOptions, &result);
+				if (FAILED(hr)) {
+					fprintf(stderr, "Audio tracks benchmark failed: hr = 0x%08x\n", (unsigned)hr);
+					return 1;
+				}
+				PrintAudioTracksBenchmarkResult(tracksOptions, result);
+				if (result.TrackMismatchSamples > 0 || result.MixMismatchSamples > 0) {
+					fprintf(stderr, "FAIL: %llu track and %llu mix samples differ from the sources\n", (unsigned long long)result.TrackMismatchSamples, (unsigned long long)result.MixMismatchSamples);
+					exitCode = 1;
+				}
+				if (result.SteadyStateHeapAllocations > maxAllocations) {
+					fprintf(stderr, "FAIL: %llu heap allocations after warm up exceed the limit of %llu\n", (unsigned long long)result.SteadyStateHeapAllocations, (unsigned long long)maxAllocations);
+					exitCode = 1;
+				}
+			}
+		}
+		return exitCode;
+	}
+
+	if (isWriterBenchmark) {
+		struct WRITER_CASE {
+			const char *Name;
+			UINT32 FramesPerSecond;
+			UINT32 StallMillis;
+			double StallIntervalSeconds;
+			UINT32 PauseMillis;
+			double PauseIntervalSeconds;
+		};
+		const WRITER_CASE cases[] = {
+			{ "30 fps", 30, 0, 0, 0, 0 },
+			{ "30 fps, 500 ms stalls", 30, 500, 2, 0, 0 },
+			//The devices deliver nothing for a while, as a loopback device while nothing plays, so less audio arrives than time passes.
+			{ "30 fps, 300 ms audio pauses", 30, 0, 0, 300, 2 },
+			{ "1 fps", 1, 0, 0, 0, 0 }
+		};
+		int exitCode = 0;
+		printf("Audio writes                    mode               writes   frames per write   max interval   timestamp gaps   timestamp error   a/v offset\n");
+		for (const WRITER_CASE &writerCase : cases) {
+			for (bool isAudioWrittenPerVideoFrame : { true, false }) {
+				AUDIO_PIPELINE_BENCHMARK_OPTIONS writerOptions = audioOptions;
+				writerOptions.FramesPerSecond = writerCase.FramesPerSecond;
+				writerOptions.StallMillis = writerCase.StallMillis;
+				writerOptions.StallIntervalSeconds = writerCase.StallIntervalSeconds;
+				writerOptions.PauseMillis = writerCase.PauseMillis;
+				writerOptions.PauseIntervalSeconds = writerCase.PauseIntervalSeconds;
+				writerOptions.IsAudioWrittenPerVideoFrame = isAudioWrittenPerVideoFrame;
+				AUDIO_PIPELINE_BENCHMARK_RESULT result;
+				HRESULT hr = RunAudioPipelineBenchmark(writerOptions, &result);
+				if (FAILED(hr)) {
+					fprintf(stderr, "Audio pipeline benchmark failed: hr = 0x%08x\n", (unsigned)hr);
+					return 1;
+				}
+				printf("  %-28s  %-17s  %7llu   %6u to %6u   %9.1f ms   %14llu   %12.4f ms   %7.1f ms\n",
+					writerCase.Name, isAudioWrittenPerVideoFrame ? "per video frame" : "writer thread", (unsigned long long)result.AudioWrites,
+					result.MinWriteFrames, result.MaxWriteFrames, result.MaxWriteIntervalMillis, (unsigned long long)result.TimestampGaps, result.TimestampErrorMillis, result.WrittenOffsetMillis);
+				if (isAudioWrittenPerVideoFrame) {
+					continue;
+				}
+				//On the writer thread, neither stalls nor the frame rate may change how audio is written.
+				double packetMillis = (double)AudioPacketizer::DefaultPacketFrames * 1000 / writerOptions.SampleRate;
+				if (result.MinWriteFrames != AudioPacketizer::DefaultPacketFrames || result.MaxWriteFrames != AudioPacketizer::DefaultPacketFrames) {
+					fprintf(stderr, "FAIL: %s: audio written in %u to %u frames, expected %u\n", writerCase.Name, result.MinWriteFrames, result.MaxWriteFrames, (unsigned)AudioPacketizer::DefaultPacketFrames);
+					exitCode = 1;
+				}
+				if (result.MaxWriteIntervalMillis > 2 * packetMillis) {
+					fprintf(stderr, "FAIL: %s: audio writes up to %.1f ms apart, the limit is %.1f ms\n", writerCase.Name, result.MaxWriteIntervalMillis, 2 * packetMillis);
+					exitCode = 1;
+				}
+				if (result.TimestampGaps > 0 || fabs(result.TimestampErrorMillis) > 0.001) {
+					fprintf(stderr, "FAIL: %s: %llu timestamp gaps, timestamps %.4f ms off\n", writerCase.Name, (unsigned long long)result.TimestampGaps, result.TimestampErrorMillis);
+					exitCode = 1;
+				}
+				//Audio missing for a pause is missing from what was delivered, but the timestamps must not fall behind for it.
+				if (writerCase.PauseMillis == 0 && fabs(result.FinalOffsetMillis) > maxOffsetMillis) {
+					fprintf(stderr, "FAIL: %s: audio ended %.2f ms from the video clock, the limit is %.2f ms\n", writerCase.Name, result.FinalOffsetMillis, maxOffsetMillis);
+					exitCode = 1;
+				}
+				if (fabs(result.WrittenOffsetMillis) > 2 * packetMillis) {
+					fprintf(stderr, "FAIL: %s: the audio timestamps ended %.2f ms from the video clock, the limit is %.1f ms\n", writerCase.Name, result.WrittenOffsetMillis, 2 * packetMillis);
+					exitCode = 1;
+				}
+			}
+		}
+		return exitCode;
+	}
+
+	if (isRingBenchmark) {
+		std::vector<RING_BUFFER_BENCHMARK_OPTIONS> cases;
+		RING_BUFFER_BENCHMARK_OPTIONS ringOptions;
+		//As fast as the two threads can go, with the producer waiting for room, then dropping what does not fit.
+		for (bool isLockedVector : { false, true }) {
+			ringOptions.IsLockedVector = isLockedVector;
+			cases.push_back(ringOptions);
+		}
+		ringOptions.IsLockedVector = false;
+		ringOptions.IsProducerWaiting = false;
+		ringOptions.Seconds = 60;
+		cases.push_back(ringOptions);
+		//At the pace of capture and of 30 fps reads, sped up.
+		ringOptions.Speed = 20;
+		ringOptions.Seconds = 40;
+		for (bool isLockedVector : { false, true }) {
+			ringOptions.IsLockedVector = isLockedVector;
+			cases.push_back(ringOptions);
+		}
+		int exitCode = 0;
+		printf("Audio ring buffer, %u Hz, %u byte frames, %u frame packets, %u frame reads, %u ms capacity\n", ringOptions.SampleRate, ringOptions.BlockAlign, ringOptions.PacketFrames, ringOptions.ReadFrames, ringOptions.CapacityMillis);
+		printf("  buffer                          throughput       write p99 / max       read p99 / max          dropped / missing frames   order   allocations\n");
+		for (const RING_BUFFER_BENCHMARK_OPTIONS &options : cases) {
+			RING_BUFFER_BENCHMARK_RESULT result;
+			HRESULT hr = RunRingBufferBenchmark(options, &result);
+			if (FAILED(hr)) {
+				fprintf(stderr, "Ring buffer benchmark failed: hr = 0x%08x\n", (unsigned)hr);
+				return 1;
+			}
+			PrintRingBufferBenchmarkResult(options, result);
+			if (result.OrderErrors > 0) {
+				fprintf(stderr, "FAIL: %llu frames read out of order or torn\n", (unsigned long long)result.OrderErrors);
+				exitCode = 1;
+			}
+			if (result.MissingFrames * options.BlockAlign != result.OverflowBytes) {
+				fprintf(stderr, "FAIL: %llu frames missing, but %llu bytes counted as overflow\n", (unsigned long long)result.MissingFrames, (unsigned long long)result.OverflowBytes);
+				exitCode = 1;
+			}
+			//Waiting for room, or reading at the pace of capture, the buffer never fills.
+			if ((options.IsProducerWaiting || options.Speed > 0) && result.MissingFrames > 0) {
+				fprintf(stderr, "FAIL: %llu frames dropped\n", (unsigned long long)result.MissingFrames);
+				exitCode = 1;
+			}
+			//The locked vector copies every read into a new vector, which is what the ring does away with.
+			if (!options.IsLockedVector && result.SteadyStateHeapAllocations > maxAllocations) {
+				fprintf(stderr, "FAIL: %llu heap allocations after warm up exceed the limit of %llu\n", (unsigned long long)result.SteadyStateHeapAllocations, (unsigned long long)maxAllocations);
+				exitCode = 1;
+			}
+		}
+		return exitCode;
+	}
+
+	if (isMixBenchmark) {
+		SimdLevel maxLevel = ResolveSimdLevel(audioOptions.Simd);
+		std::vector<MIXER_BENCHMARK_OPTIONS> cases;
+		for (bool isFloat : { true, false }) {
+			for (UINT32 inputCount : { 1u, 2u, 8u }) {
+				for (SimdLevel level : { SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2 }) {
+					if ((int)level <= (int)maxLevel) {
+						MIXER_BENCHMARK_OPTIONS mixOptions;
+						mixOptions.IsFloat = isFloat;
+						mixOptions.InputCount = inputCount;
+						mixOptions.Simd = level;
+						cases.push_back(mixOptions);
+					}
+				}
+			}
+		}
+		int exitCode = 0;
+		printf("Audio mixer, %u samples per call\n", cases.front().SampleCount);
+		for (const MIXER_BENCHMARK_OPTIONS &mixOptions : cases) {
+			MIXER_BENCHMARK_RESULT result;
+			HRESULT hr = RunMixerBenchmark(mixOptions, &result);
+			if (FAILED(hr)) {
+				fprintf(stderr, "Mixer benchmark failed: hr = 0x%08x\n", (unsigned)hr);
+				return 1;
+			}
+			PrintMixerBenchmarkResult(mixOptions, result);
+			if (result.MismatchSamples > 0 || result.ReferenceMismatchSamples > 0) {
+				fprintf(stderr, "FAIL: %llu samples differ from the scalar mix, and %llu from the mix in double\n", (unsigned long long)result.MismatchSamples, (unsigned long long)result.ReferenceMismatchSamples);
+				exitCode = 1;
+			}
+			if (result.ClipCountMismatches > 0 || result.OverrunSamples > 0) {
+				fprintf(stderr, "FAIL: %llu mixes counted clipping wrong, and %llu samples were written past the output\n", (unsigned long long)result.ClipCountMismatches, (unsigned long long)result.OverrunSamples);
+				exitCode = 1;
+			}
+			if (result.SteadyStateHeapAllocations > maxAllocations) {
+				fprintf(stderr, "FAIL: %llu heap allocations after warm up exceed the limit of %llu\n", (unsigned long long)result.SteadyStateHeapAllocations, (unsigned long long)maxAllocations);
+				exitCode = 1;
+			}
+		}
+		return exitCode;
+	}
+
+	if (isResampleBenchmark) {
+		std::vector<RESAMPLER_BENCHMARK_OPTIONS> cases;
+		RESAMPLER_BENCHMARK_OPTIONS resampleOptions;
+		resampleOptions.Simd = audioOptions.Simd;
+		for (AudioResamplerQuality quality : { AudioResamplerQuality::Low, AudioResamplerQuality::Medium, AudioResamplerQuality::High }) {
+			resampleOptions.Quality = quality;
+			cases.push_back(resampleOptions);
+		}
+		//The other rate pairs capture devices come with, at the quality LoopbackCapture uses.
+		resampleOptions.Quality = AudioResamplerQuality::Medium;
+		const UINT32 ratePairs[][3] = { { 48000, 44100, 2 }, { 96000, 48000, 2 }, { 48000, 16000, 1 }, { 16000, 48000, 1 } };
+		for (const auto &ratePair : ratePairs) {
+			resampleOptions.InputSampleRate = ratePair[0];
+			resampleOptions.OutputSampleRate = ratePair[1];
+			resampleOptions.Channels = ratePair[2];
+			cases.push_back(resampleOptions);
+		}
+		int exitCode = 0;
+		printf("Audio resampler, float, 10 ms chunks\n");
+		for (const RESAMPLER_BENCHMARK_OPTIONS &options : cases) {
+			RESAMPLER_BENCHMARK_RESULT result;
+			HRESULT hr = RunResamplerBenchmark(options, &result);
+			if (FAILED(hr)) {
+				fprintf(stderr, "Resampler benchmark failed: hr = 0x%08x\n", (unsigned)hr);
+				return 1;
+			}
+			PrintResamplerBenchmarkResult(options, result);
+			//Well under what each quality measures on every rate pair, so only a real loss of quality fails.
+			double minSnrDb = options.Quality == AudioResamplerQuality::Low ? 60 : options.Quality == AudioResamplerQuality::Medium ? 75 : 95;
+			if (result.MinSnrDb < minSnrDb) {
+				fprintf(stderr, "FAIL: SNR of %.1f dB at %.0f Hz is under the limit of %.0f dB\n", result.MinSnrDb, result.MinSnrHz, minSnrDb);
+				exitCode = 1;
+			}
+			if (result.PassbandRippleDb > 0.05) {
+				fprintf(stderr, "FAIL: passband ripple of %.4f dB exceeds the limit of 0.05 dB\n", result.PassbandRippleDb);
+				exitCode = 1;
+			}
+			if (result.SteadyStateHeapAllocations > maxAllocations) {
+				fprintf(stderr, "FAIL: %llu heap allocations after warm up exceed the limit of %llu\n", (unsigned long long)result.SteadyStateHeapAllocations, (unsigned long long)maxAllocations);
+				exitCode = 1;
+			}
+		}
+		return exitCode;
+	}
+
+	if (isDriftBenchmark) {
+		std::vector<DRIFT_BENCHMARK_OPTIONS> cases;
+		DRIFT_BENCHMARK_OPTIONS driftOptions;
+		driftOptions.FramesPerSecond = audioOptions.FramesPerSecond;
+		for (double driftPpm : { 500.0, -500.0, 0.0 }) {
+			driftOptions.DriftPpm = driftPpm;
+			cases.push_back(driftOptions);
+		}
+		//Resampled from 44.1 kHz, with packets arriving up to 3 ms late.
+		driftOptions.InputSampleRate = 44100;
+		driftOptions.Jitter100Nanos = 30000;
+		for (double driftPpm : { 500.0, -500.0 }) {
+			driftOptions.DriftPpm = driftPpm;
+			cases.push_back(driftOptions);
+		}
+		int exitCode = 0;
+		printf("Audio drift compensation, %.0f s at %u fps, %u ms target buffer\n", driftOptions.Seconds, driftOptions.FramesPerSecond, driftOptions.TargetBufferMillis);
+		for (const DRIFT_BENCHMARK_OPTIONS &options : cases) {
+			DRIFT_BENCHMARK_RESULT result;
+			HRESULT hr = RunDriftBenchmark(options, &result);
+			if (FAILED(hr)) {
+				fprintf(stderr, "Drift benchmark failed: hr = 0x%08x\n", (unsigned)hr);
+				return 1;
+			}
+			PrintDriftBenchmarkResult(options, result);
+			//The control loop settles within a couple of minutes, and keeps the fill near the target from then on.
+			if (result.ConvergenceSeconds > 240) {
+				fprintf(stderr, "FAIL: the drift estimate of %.1f ppm took until %.1f s to settle within %.0f ppm of %.0f ppm\n", result.FinalDriftPpm, result.ConvergenceSeconds, options.TolerancePpm, options.DriftPpm);
+				exitCode = 1;
+			}
+			if (result.MaxBufferedMillis > 2.0 * options.TargetBufferMillis || result.SettledFillErrorMillis > 5) {
+				fprintf(stderr, "FAIL: the buffer filled up to %.1f ms, and was %.2f ms off the %u ms target when settled\n", result.MaxBufferedMillis, result.SettledFillErrorMillis, options.TargetBufferMillis);
+				exitCode = 1;
+			}
+			if (result.MaxOffsetMillis > options.TargetBufferMillis + 10 || result.ResyncFrames > 0) {
+				fprintf(stderr, "FAIL: audio fell up to %.2f ms behind the media clock, and %llu frames were dropped to resync\n", result.MaxOffsetMillis, (unsigned long long)result.ResyncFrames);
+				exitCode = 1;
+			}
+		}
+		return exitCode;
+	}
+
+	if (isPacketQueueBenchmark) {
+		printf("Audio packet queue\n");
+		PACKET_QUEUE_BENCHMARK_RESULT result;
+		HRESULT hr = RunPacketQueueBenchmark(&result);
+		if (FAILED(hr)) {
+			fprintf(stderr, "Packet queue benchmark failed: hr = 0x%08x\n", (unsigned)hr);
+			return 1;
+		}
+		PrintPacketQueueBenchmarkResult(result);
+		for (const std::string &error : result.Errors) {
+			fprintf(stderr, "FAIL: %s\n", error.c_str());
+		}
+		return result.Errors.empty() ? 0 : 1;
+	}
+
+	if (isSampleFormatBenchmark) {
+		std::vector<SAMPLE_FORMAT_BENCHMARK_OPTIONS> cases;
+		SAMPLE_FORMAT_BENCHMARK_OPTIONS formatOptions;
+		formatOptions.Simd = audioOptions.Simd;
+		//A single device at unity gain takes the shortest float path, with no mix at all.
+		formatOptions.SourceCount = 1;
+		formatOptions.Gain = 1.0f;
+		cases.push_back(formatOptions);
+		formatOptions.Gain = 0.8f;
+		for (UINT32 sourceCount : { 1u, 2u, 4u }) {
+			formatOptions.SourceCount = sourceCount;
+			cases.push_back(formatOptions);
+		}
+		//Devices already at the output rate, so the resampler, which dominates the cost, is left out.
+		formatOptions.SourceCount = 2;
+		formatOptions.InputSampleRate = formatOptions.OutputSampleRate;
+		cases.push_back(formatOptions);
+		int exitCode = 0;
+		printf("Audio sample format, %.0f s in %u ms blocks, CPU time per second of audio\n", formatOptions.Seconds, formatOptions.BlockMillis);
+		for (const SAMPLE_FORMAT_BENCHMARK_OPTIONS &options : cases) {
+			SAMPLE_FORMAT_BENCHMARK_RESULT result;
+			HRESULT hr = RunSampleFormatBenchmark(options, &result);
+			if (FAILED(hr)) {
+				fprintf(stderr, "Sample format benchmark failed: hr = 0x%08x\n", (unsigned)hr);
+				return 1;
+			}
+			PrintSampleFormatBenchmarkResult(options, result);
+			if (result.SteadyStateHeapAllocations > maxAllocations) {
+				fprintf(stderr, "FAIL: %llu heap allocations after warm up exceed the limit of %llu\n", (unsigned long long)result.SteadyStateHeapAllocations, (unsigned long long)maxAllocations);
+				exitCode = 1;
+			}
+		}
+		return exitCode;
+	}
+
+	std::vector<UINT32> sourceCounts;
+	if (isGraphBenchmark) {
+		sourceCounts = { 1, 4, 16 };
+	}
+	else {
+		sourceCounts = { audioOptions.SourceCount };
+	}
+	int exitCode = 0;
+	std::vector<AUDIO_PIPELINE_BENCHMARK_RESULT> results;
+	for (UINT32 sourceCount : sourceCounts) {
+		audioOptions.SourceCount = sourceCount;
+		AUDIO_PIPELINE_BENCHMARK_RESULT result;
+		HRESULT hr = RunAudioPipelineBenchmark(audioOptions, &result);
+		if (FAILED(hr)) {
+			fprintf(stderr, "Audio pipeline benchmark failed: hr = 0x%08x\n", (unsigned)hr);
+			return 1;
+		}
+		PrintAudioPipelineBenchmarkResult(audioOptions, result);
+		results.push_back(result);
+
+		if (maxNanosPerSample > 0 && result.NanosPerSample > maxNanosPerSample) {
+			fprintf(stderr, "FAIL: %.2f ns/sample exceeds the limit of %.2f\n", result.NanosPerSample, maxNanosPerSample);
+			exitCode = 1;
+		}
+		if (result.SteadyStateBufferAllocations > maxAllocations || result.SteadyStateHeapAllocations > maxAllocations) {
+			fprintf(stderr, "FAIL: %llu buffer and %llu heap allocations after warm up exceed the limit of %llu\n",
+				(unsigned long long)result.SteadyStateBufferAllocations, (unsigned long long)result.SteadyStateHeapAllocations, (unsigned long long)maxAllocations);
+			exitCode = 1;
+		}
+		if (fabs(result.FinalOffsetMillis) > maxOffsetMillis) {
+			fprintf(stderr, "FAIL: audio ended %.2f ms from the video clock, the limit is %.2f ms\n", result.FinalOffsetMillis, maxOffsetMillis);
+			exitCode = 1;
+		}
+	}
+	if (results.size() > 1) {
+		printf("Audio graph scaling\n");
+		for (const AUDIO_PIPELINE_BENCHMARK_RESULT &result : results) {
+			printf("  %2zu sources      %8.2f ns/sample, %6.2f per source, frame p99 %8.2f us\n",
+				result.Sources, result.NanosPerSample, result.NanosPerSample / result.Sources, result.FrameNanos.P99 / 1000);
+		}
+	}
+	return exitCode;
+}
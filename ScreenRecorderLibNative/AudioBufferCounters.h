@@ -0,0 +1,45 @@
+#pragma once
+#include <windows.h>
+#include <vector>
+#include <sal.h>
+
+/// <summary>
+/// Counters of the work done to move audio from the capture devices to the encoder. Cumulative since recording started.
+/// </summary>
+struct AUDIO_BUFFER_COUNTERS {
+	//The number of audio frames (one per video frame) handed to the encoder.
+	UINT64 Frames;
+	//Heap allocations of audio sample memory.
+	UINT64 Allocations;
+	//Plain copies of sample data. Resampling and mixing are transforms, and are not counted.
+	UINT64 Copies;
+	UINT64 BytesCopied;
+	//Frames handed to the encoder as silence, without being mixed or written.
+	UINT64 SilentFrames;
+	//Time spent producing the audio frames, and the duration of audio produced, so the CPU cost per second of audio can be tracked.
+	UINT64 ProcessingHundredNanos;
+	UINT64 AudioHundredNanos;
+};
+
+/// <summary>
+/// Resizes a reusable sample buffer, and counts an allocation if its capacity has to grow.
+/// Capacity grows with headroom, so audio chunks that vary slightly in size, as with drift compensation or uneven frame times, do not reallocate each time they set a new high.
+/// </summary>
+inline void ResizeAudioBuffer(_Inout_ std::vector<BYTE> &buffer, _In_ size_t size, _Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters)
+{
+	if (size > buffer.capacity()) {
+		if (pCounters) {
+			pCounters->Allocations++;
+		}
+		buffer.reserve(size + size / 4);
+	}
+	buffer.resize(size);
+}
+
+inline void CountAudioCopy(_Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters, _In_ size_t cbData)
+{
+	if (pCounters && cbData > 0) {
+		pCounters->Copies++;
+		pCounters->BytesCopied += cbData;
+	}
+}
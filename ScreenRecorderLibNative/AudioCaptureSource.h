@@ -0,0 +1,31 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+
+//Packet flags, with the same values as the AUDCLNT_BUFFERFLAGS_ flags returned by IAudioCaptureClient::GetBuffer.
+#define AUDIO_CAPTURE_FLAG_DATA_DISCONTINUITY 0x1
+#define AUDIO_CAPTURE_FLAG_SILENT 0x2
+#define AUDIO_CAPTURE_FLAG_TIMESTAMP_ERROR 0x4
+
+/// <summary>
+/// A source of captured audio packets, with the same shape as IAudioCaptureClient, so the capture path can be driven by a WASAPI device
+/// or by a stand in, such as a generator or a file, on machines without audio hardware.
+/// Packets are interleaved 32 bit float, in the sample rate and channel count of the source.
+/// </summary>
+class IAudioCaptureSource
+{
+public:
+	virtual ~IAudioCaptureSource() {}
+	virtual UINT32 GetSampleRate() = 0;
+	virtual UINT32 GetChannels() = 0;
+	/// <summary>
+	/// Gets the number of frames in the next packet, or 0 if no packet is ready.
+	/// </summary>
+	virtual HRESULT GetNextPacketSize(_Out_ UINT32 *pNumFramesInNextPacket) = 0;
+	/// <summary>
+	/// Gets the next packet. The data stays valid until ReleaseBuffer is called.
+	/// The device position is in frames since the stream started, and the QPC position is the capture time of the first frame in 100 nanosecond units.
+	/// </summary>
+	virtual HRESULT GetBuffer(_Outptr_ BYTE **ppData, _Out_ UINT32 *pNumFramesToRead, _Out_ DWORD *pdwFlags, _Out_opt_ UINT64 *pu64DevicePosition, _Out_opt_ UINT64 *pu64QPCPosition) = 0;
+	virtual HRESULT ReleaseBuffer(_In_ UINT32 numFramesRead) = 0;
+};
@@ -0,0 +1,241 @@
+#include "AudioCaptureStream.h"
+#include <algorithm>
+#include <cmath>
+
+AudioCaptureStream::AudioCaptureStream() :
+	m_InputSampleRate(0),
+	m_InputChannels(0),
+	m_OutputSampleRate(0),
+	m_OutputChannels(0),
+	m_IsResampling(false),
+	m_IsDriftCompensated(false),
+	m_InputFrameRemainder(0),
+	m_IsFirstPacket(true),
+	m_NextDevicePosition(0),
+	m_ResyncCount(0),
+	m_ResyncFrames(0),
+	m_LatencyCount(0),
+	m_LatencySum(0),
+	m_LatencyLast(0),
+	m_LatencyMin(UINT64_MAX),
+	m_LatencyMax(0)
+{
+}
+
+AudioCaptureStream::~AudioCaptureStream()
+{
+}
+
+HRESULT AudioCaptureStream::Initialize(_In_ UINT32 inputSampleRate, _In_ UINT32 inputChannels, _In_ UINT32 outputSampleRate, _In_ UINT32 outputChannels, _In_ bool isResamplerEnabled, _In_ bool isDriftCompensated, _In_ UINT32 targetBufferMillis)
+{
+	if (inputSampleRate == 0 || inputChannels == 0) {
+		return E_INVALIDARG;
+	}
+	if (!isResamplerEnabled) {
+		outputSampleRate = inputSampleRate;
+		outputChannels = inputChannels;
+		isDriftCompensated = false;
+	}
+	if (outputSampleRate == 0 || outputChannels == 0) {
+		return E_INVALIDARG;
+	}
+	m_InputSampleRate = inputSampleRate;
+	m_InputChannels = inputChannels;
+	m_OutputSampleRate = outputSampleRate;
+	m_OutputChannels = outputChannels;
+	m_IsDriftCompensated = isDriftCompensated;
+	m_IsResampling = isDriftCompensated || inputSampleRate != outputSampleRate || inputChannels != outputChannels;
+	if (m_IsResampling) {
+		HRESULT hr = m_Resampler.Initialize(inputSampleRate, inputChannels, outputSampleRate, outputChannels, AudioResamplerQuality::Medium);
+		if (FAILED(hr)) {
+			return hr;
+		}
+	}
+	HRESULT hr = m_Packets.Initialize(inputSampleRate, (UINT32)InputFrameBytes(), (size_t)inputSampleRate * BufferSeconds, BufferSeconds * MaxPacketsPerSecond);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	m_DriftEstimator.Initialize(targetBufferMillis / 1000.0);
+	m_InputFrameRemainder = 0;
+	m_IsFirstPacket = true;
+	m_NextDevicePosition = 0;
+	m_ResyncCount = 0;
+	m_ResyncFrames = 0;
+	ResetLatency();
+	return S_OK;
+}
+
+HRESULT AudioCaptureStream::ReadPackets(_In_ IAudioCaptureSource *pSource, _Out_opt_ AUDIO_CAPTURE_PASS *pPass)
+{
+	AUDIO_CAPTURE_PASS pass{};
+	UINT32 nextPacketSize;
+	HRESULT hr;
+	for (hr = pSource->GetNextPacketSize(&nextPacketSize);
+		SUCCEEDED(hr) && nextPacketSize > 0;
+		hr = pSource->GetNextPacketSize(&nextPacketSize)) {
+		BYTE *pData;
+		UINT32 frames;
+		DWORD flags;
+		UINT64 devicePosition;
+		UINT64 qpcPosition;
+		hr = pSource->GetBuffer(&pData, &frames, &flags, &devicePosition, &qpcPosition);
+		if (FAILED(hr)) {
+			break;
+		}
+		if (frames == 0) {
+			pSource->ReleaseBuffer(0);
+			hr = E_UNEXPECTED;
+			break;
+		}
+		//The first packet of a stream commonly reports a spurious discontinuity.
+		if ((flags & AUDIO_CAPTURE_FLAG_DATA_DISCONTINUITY) != 0 && !m_IsFirstPacket && devicePosition > m_NextDevicePosition) {
+			pass.MissingFrames += devicePosition - m_NextDevicePosition;
+		}
+		//Silent packets may hold garbage, and are queued as silence. Packets are queued with their device position, and the reader fills any gap with silence where it occurred in the stream.
+		bool isSilent = (flags & AUDIO_CAPTURE_FLAG_SILENT) != 0;
+		bool isQueued = m_Packets.Write(pData, frames, devicePosition, qpcPosition, isSilent);
+		hr = pSource->ReleaseBuffer(frames);
+		if (FAILED(hr)) {
+			break;
+		}
+		if (!isQueued) {
+			pass.DroppedFrames += frames;
+		}
+		pass.Packets++;
+		pass.Frames += frames;
+		m_IsFirstPacket = false;
+		m_NextDevicePosition = devicePosition + frames;
+	}
+	if (pPass) {
+		*pPass = pass;
+	}
+	return hr;
+}
+
+void AudioCaptureStream::Read(_In_ UINT64 duration100Nanos, _Inout_ std::vector<BYTE> &buffer, _Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters, _Out_opt_ bool *pIsSilent)
+{
+	size_t offset = buffer.size();
+	double durationSeconds = duration100Nanos / 10000000.0;
+	size_t availableFrames = m_Packets.GetAvailableFrames();
+	size_t frameCount;
+	if (m_IsDriftCompensated) {
+		//Read more or fewer device frames than the duration calls for, as steered by the drift estimator, and let the resampler stretch them to the duration.
+		double correction = m_DriftEstimator.GetCorrection();
+		m_Resampler.SetRatioAdjustment(1.0 / (1.0 + correction) - 1.0);
+		double wantedFrames = m_InputSampleRate * durationSeconds * (1.0 + correction) + m_InputFrameRemainder;
+		frameCount = (size_t)(std::max)(0.0, wantedFrames);
+		m_InputFrameRemainder = wantedFrames - frameCount;
+	}
+	else {
+		frameCount = (size_t)ceil(m_InputSampleRate * durationSeconds);
+	}
+	frameCount = (std::min)(frameCount, availableFrames);
+
+	bool isResampling = m_IsResampling && frameCount > 0;
+	//When resampling, the captured audio is read into a reusable buffer and resampled into the caller's buffer. Otherwise it is read straight into the caller's buffer.
+	BYTE *pReadDest;
+	if (isResampling) {
+		ResizeAudioBuffer(m_ResamplerInputBuffer, frameCount * InputFrameBytes(), pCounters);
+		pReadDest = m_ResamplerInputBuffer.data();
+	}
+	else {
+		ResizeAudioBuffer(buffer, offset + frameCount * InputFrameBytes(), pCounters);
+		pReadDest = buffer.data() + offset;
+	}
+	bool isSilent = true;
+	if (frameCount > 0) {
+		frameCount = m_Packets.Read(pReadDest, frameCount, &isSilent);
+		CountAudioCopy(pCounters, frameCount * InputFrameBytes());
+	}
+	if (!isResampling) {
+		buffer.resize(offset + frameCount * InputFrameBytes());
+	}
+	if (m_IsDriftCompensated) {
+		UpdateDriftEstimate(availableFrames - frameCount, durationSeconds);
+	}
+	if (isResampling) {
+		size_t maxOutputFrames = m_Resampler.GetMaxOutputFrames(frameCount);
+		ResizeAudioBuffer(buffer, offset + maxOutputFrames * OutputFrameBytes(), pCounters);
+		float *pOutput = reinterpret_cast<float *>(buffer.data() + offset);
+		size_t outputFrames;
+		if (isSilent) {
+			outputFrames = m_Resampler.ProcessSilence(frameCount, pOutput, maxOutputFrames, &isSilent);
+		}
+		else {
+			outputFrames = m_Resampler.Process(reinterpret_cast<const float *>(m_ResamplerInputBuffer.data()), frameCount, pOutput, maxOutputFrames);
+		}
+		buffer.resize(offset + outputFrames * OutputFrameBytes());
+	}
+	if (pIsSilent) {
+		*pIsSilent = isSilent;
+	}
+}
+
+UINT32 AudioCaptureStream::GetTargetBufferMillis(_In_ UINT64 devicePeriod100Nanos, _In_ UINT64 wakeDelay100Nanos)
+{
+	return (UINT32)((devicePeriod100Nanos + wakeDelay100Nanos + 9999) / 10000) + JitterMarginMillis;
+}
+
+void AudioCaptureStream::MeasureLatency(_In_ UINT64 qpcNow)
+{
+	UINT64 qpcCaptured;
+	if (!m_Packets.GetReadTimestamp(&qpcCaptured)) {
+		return;
+	}
+	//The device clock and the performance counter are sampled separately, so a frame can appear to be taken a little before it was captured.
+	UINT64 latency = qpcNow > qpcCaptured ? qpcNow - qpcCaptured : 0;
+	m_LatencyLast.store(latency, std::memory_order_relaxed);
+	m_LatencySum.fetch_add(latency, std::memory_order_relaxed);
+	if (latency < m_LatencyMin.load(std::memory_order_relaxed)) {
+		m_LatencyMin.store(latency, std::memory_order_relaxed);
+	}
+	if (latency > m_LatencyMax.load(std::memory_order_relaxed)) {
+		m_LatencyMax.store(latency, std::memory_order_relaxed);
+	}
+	m_LatencyCount.fetch_add(1, std::memory_order_release);
+}
+
+AUDIO_LATENCY_STATS AudioCaptureStream::GetLatencyStats() const
+{
+	AUDIO_LATENCY_STATS stats{};
+	stats.Count = m_LatencyCount.load(std::memory_order_acquire);
+	if (stats.Count == 0) {
+		return stats;
+	}
+	stats.LastMillis = m_LatencyLast.load(std::memory_order_relaxed) / 10000.0;
+	stats.AverageMillis = m_LatencySum.load(std::memory_order_relaxed) / 10000.0 / stats.Count;
+	stats.MinMillis = m_LatencyMin.load(std::memory_order_relaxed) / 10000.0;
+	stats.MaxMillis = m_LatencyMax.load(std::memory_order_relaxed) / 10000.0;
+	return stats;
+}
+
+void AudioCaptureStream::Clear()
+{
+	m_Packets.Clear();
+	m_DriftEstimator.Resynchronize(0);
+	ResetLatency();
+}
+
+void AudioCaptureStream::ResetLatency()
+{
+	m_LatencyCount = 0;
+	m_LatencySum = 0;
+	m_LatencyLast = 0;
+	m_LatencyMin = UINT64_MAX;
+	m_LatencyMax = 0;
+}
+
+void AudioCaptureStream::UpdateDriftEstimate(_In_ size_t remainingFrames, _In_ double durationSeconds)
+{
+	double remainingSeconds = (double)remainingFrames / m_InputSampleRate;
+	double excessSeconds = remainingSeconds - m_DriftEstimator.GetTargetBufferedSeconds();
+	if (excessSeconds * 1000 > DriftResyncThresholdMillis) {
+		size_t skipped = m_Packets.Skip((size_t)(excessSeconds * m_InputSampleRate));
+		remainingSeconds -= (double)skipped / m_InputSampleRate;
+		m_DriftEstimator.Resynchronize(remainingSeconds);
+		m_ResyncCount.fetch_add(1, std::memory_order_relaxed);
+		m_ResyncFrames.fetch_add(skipped, std::memory_order_relaxed);
+		return;
+	}
+	m_DriftEstimator.Update(remainingSeconds, durationSeconds);
+}
@@ -0,0 +1,140 @@
+#pragma once
+#include <windows.h>
+#include <atomic>
+#include <vector>
+#include <sal.h>
+#include "AudioCaptureSource.h"
+#include "AudioPacketQueue.h"
+#include "AudioResampler.h"
+#include "AudioDriftEstimator.h"
+#include "AudioBufferCounters.h"
+
+/// <summary>
+/// What one call to AudioCaptureStream::ReadPackets took from the capture source.
+/// </summary>
+struct AUDIO_CAPTURE_PASS {
+	UINT32 Packets;
+	UINT32 Frames;
+	//Frames that did not fit in the packet queue and were dropped.
+	UINT32 DroppedFrames;
+	//Frames the source reported as lost with a discontinuity, which the reader fills with silence.
+	UINT64 MissingFrames;
+};
+
+/// <summary>
+/// The capture to mix latency of one capture: the time from when a device captured the first frame of a read to when the read took it.
+/// Covers the device buffer, the capture thread wakeups and the audio kept buffered for drift compensation.
+/// </summary>
+struct AUDIO_LATENCY_STATS {
+	//The number of reads measured.
+	UINT64 Count;
+	double LastMillis;
+	double AverageMillis;
+	double MinMillis;
+	double MaxMillis;
+};
+
+/// <summary>
+/// The capture device independent part of an audio capture: queues the packets of an IAudioCaptureSource as they arrive,
+/// and reads them back in media time sized chunks, resampled to the output format and locked to the media clock by drift compensation.
+/// ReadPackets is called by the capture thread and Read by the recorder thread. Neither blocks the other.
+/// </summary>
+class AudioCaptureStream
+{
+public:
+	AudioCaptureStream();
+	~AudioCaptureStream();
+	/// <summary>
+	/// Sets up the stream for 32 bit float input in the given format. The packet queue is sized here, so no allocations happen while capturing.
+	/// </summary>
+	/// <param name="isResamplerEnabled">If false, Read returns the input format as is, and drift compensation is disabled.</param>
+	/// <param name="isDriftCompensated">Steer the resampler ratio with a drift estimator, so the device is locked to the media clock.</param>
+	/// <param name="targetBufferMillis">How much captured audio the drift compensation keeps buffered after each read. Must cover the time between two wakeups of the capture thread.</param>
+	HRESULT Initialize(_In_ UINT32 inputSampleRate, _In_ UINT32 inputChannels, _In_ UINT32 outputSampleRate, _In_ UINT32 outputChannels, _In_ bool isResamplerEnabled, _In_ bool isDriftCompensated, _In_ UINT32 targetBufferMillis = DefaultTargetBufferMillis);
+	/// <summary>
+	/// Queues all packets the source has ready. Called by the capture thread each time it wakes up.
+	/// </summary>
+	HRESULT ReadPackets(_In_ IAudioCaptureSource *pSource, _Out_opt_ AUDIO_CAPTURE_PASS *pPass = nullptr);
+	/// <summary>
+	/// Appends the audio captured for the given duration to the end of buffer, as interleaved 32 bit float samples in the output format.
+	/// pIsSilent is set to true if the appended audio is known to be silence, i.e. it only came from silent packets or gaps.
+	/// </summary>
+	void Read(_In_ UINT64 duration100Nanos, _Inout_ std::vector<BYTE> &buffer, _Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters = nullptr, _Out_opt_ bool *pIsSilent = nullptr);
+	/// <summary>
+	/// Records the latency of the audio the next call to Read returns, from its capture to qpcNow, the performance counter time in 100 nanosecond units.
+	/// Must be called from the thread calling Read, right before it. Nothing is recorded if no audio is queued.
+	/// </summary>
+	void MeasureLatency(_In_ UINT64 qpcNow);
+	/// <summary>
+	/// The latency recorded by MeasureLatency since the stream was initialized or cleared. Safe to call from any thread.
+	/// </summary>
+	AUDIO_LATENCY_STATS GetLatencyStats() const;
+	/// <summary>
+	/// Discards all queued audio, and the latency recorded so far.
+	/// </summary>
+	void Clear();
+	inline AUDIO_DRIFT_STATS GetDriftStats() const { return m_DriftEstimator.GetStats(); }
+	/// <summary>
+	/// Gets the capture time of the first frame the next call to Read returns. Must be called from the thread calling Read.
+	/// </summary>
+	inline bool GetReadTimestamp(_Out_ UINT64 *pQpcPosition) { return m_Packets.GetReadTimestamp(pQpcPosition); }
+	inline UINT64 GetDroppedPacketCount() const { return m_Packets.GetDroppedPacketCount(); }
+	inline UINT64 GetDroppedFrames() const { return m_Packets.GetDroppedFrames(); }
+	/// <summary>
+	/// The number of times the reader fell so far behind that queued audio was dropped to catch up, and the frames dropped in total.
+	/// </summary>
+	inline UINT64 GetResyncCount() const { return m_ResyncCount.load(std::memory_order_relaxed); }
+	inline UINT64 GetResyncFrames() const { return m_ResyncFrames.load(std::memory_order_relaxed); }
+	inline UINT32 GetInputSampleRate() const { return m_InputSampleRate; }
+	inline UINT32 GetInputChannels() const { return m_InputChannels; }
+	inline UINT32 GetOutputSampleRate() const { return m_OutputSampleRate; }
+	inline UINT32 GetOutputChannels() const { return m_OutputChannels; }
+	inline bool IsResampling() const { return m_IsResampling; }
+	inline bool IsDriftCompensated() const { return m_IsDriftCompensated; }
+	//How much captured audio the drift compensation tries to keep buffered after each read, unless told otherwise. This absorbs the jitter of the device packets.
+	static const UINT32 DefaultTargetBufferMillis = 20;
+	/// <summary>
+	/// The amount of audio to keep buffered for a capture thread that collects packets of devicePeriod at most wakeDelay after they are ready:
+	/// enough to bridge the wait for the next packet, plus a margin for packet jitter. 0 wake delay is an event driven capture.
+	/// </summary>
+	static UINT32 GetTargetBufferMillis(_In_ UINT64 devicePeriod100Nanos, _In_ UINT64 wakeDelay100Nanos);
+private:
+	//Added to the target buffer for the jitter of the device packets. With a 10 ms device period and a timer waking every 5 ms, this makes up the default target.
+	static const UINT32 JitterMarginMillis = 5;
+	//How many seconds of audio the packet queue can hold before the capture thread starts dropping data.
+	static const UINT32 BufferSeconds = 5;
+	//Sizes the packet queue. Shared mode devices deliver one packet per device period, which is 10 ms by default and never below 1 ms.
+	static const UINT32 MaxPacketsPerSecond = 1000;
+	//If more audio than this is buffered beyond the target, e.g. after the recorder thread stalled, the excess is dropped instead of slowly drained.
+	static const UINT32 DriftResyncThresholdMillis = 500;
+
+	UINT32 m_InputSampleRate;
+	UINT32 m_InputChannels;
+	UINT32 m_OutputSampleRate;
+	UINT32 m_OutputChannels;
+	bool m_IsResampling;
+	bool m_IsDriftCompensated;
+
+	AudioPacketQueue m_Packets;
+	AudioResampler m_Resampler;
+	AudioDriftEstimator m_DriftEstimator;
+	std::vector<BYTE> m_ResamplerInputBuffer;
+	//Fractional input frames carried between reads, so the average read size matches the requested durations exactly.
+	double m_InputFrameRemainder;
+	//Written by the capture thread.
+	bool m_IsFirstPacket;
+	UINT64 m_NextDevicePosition;
+	std::atomic<UINT64> m_ResyncCount;
+	std::atomic<UINT64> m_ResyncFrames;
+	//Written by the reader in MeasureLatency. The latencies are in 100 nanosecond units.
+	std::atomic<UINT64> m_LatencyCount;
+	std::atomic<UINT64> m_LatencySum;
+	std::atomic<UINT64> m_LatencyLast;
+	std::atomic<UINT64> m_LatencyMin;
+	std::atomic<UINT64> m_LatencyMax;
+
+	inline size_t InputFrameBytes() const { return m_InputChannels * sizeof(float); }
+	inline size_t OutputFrameBytes() const { return m_OutputChannels * sizeof(float); }
+	void UpdateDriftEstimate(_In_ size_t remainingFrames, _In_ double durationSeconds);
+	void ResetLatency();
+};
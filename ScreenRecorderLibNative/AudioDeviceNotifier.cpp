@@ -0,0 +1,116 @@
+#include "AudioDeviceNotifier.h"
+#include <Shlwapi.h>
+#include "Log.h"
+#include "cleanup.h"
+
+AudioDeviceNotifier::AudioDeviceNotifier() :
+	m_nRefCount(0),
+	m_pEnumerator(nullptr),
+	m_ChangeCount(0),
+	m_DefaultRenderDeviceChangeCount(0),
+	m_DefaultCaptureDeviceChangeCount(0)
+{
+}
+
+AudioDeviceNotifier::~AudioDeviceNotifier()
+{
+	Unregister();
+}
+
+HRESULT AudioDeviceNotifier::Register()
+{
+	if (m_pEnumerator) {
+		return S_FALSE;
+	}
+	HRESULT hr = CoCreateInstance(
+		__uuidof(MMDeviceEnumerator), NULL, CLSCTX_ALL,
+		__uuidof(IMMDeviceEnumerator),
+		(void **)&m_pEnumerator
+	);
+	if (FAILED(hr)) {
+		LOG_ERROR(L"CoCreateInstance(IMMDeviceEnumerator) failed: hr = 0x%08x", hr);
+		return hr;
+	}
+	hr = m_pEnumerator->RegisterEndpointNotificationCallback(this);
+	if (FAILED(hr)) {
+		LOG_ERROR(L"IMMDeviceEnumerator::RegisterEndpointNotificationCallback failed: hr = 0x%08x", hr);
+		SafeRelease(&m_pEnumerator);
+		return hr;
+	}
+	return S_OK;
+}
+
+void AudioDeviceNotifier::Unregister()
+{
+	if (m_pEnumerator) {
+		m_pEnumerator->UnregisterEndpointNotificationCallback(this);
+		SafeRelease(&m_pEnumerator);
+	}
+}
+
+STDMETHODIMP AudioDeviceNotifier::OnDeviceStateChanged(_In_ LPCWSTR pwstrDeviceId, _In_ DWORD dwNewState)
+{
+	LOG_DEBUG(L"Audio device %ls changed state to 0x%08x", pwstrDeviceId, dwNewState);
+	m_ChangeCount.fetch_add(1, std::memory_order_release);
+	return S_OK;
+}
+
+STDMETHODIMP AudioDeviceNotifier::OnDeviceAdded(_In_ LPCWSTR pwstrDeviceId)
+{
+	LOG_DEBUG(L"Audio device %ls added", pwstrDeviceId);
+	m_ChangeCount.fetch_add(1, std::memory_order_release);
+	return S_OK;
+}
+
+STDMETHODIMP AudioDeviceNotifier::OnDeviceRemoved(_In_ LPCWSTR pwstrDeviceId)
+{
+	LOG_DEBUG(L"Audio device %ls removed", pwstrDeviceId);
+	m_ChangeCount.fetch_add(1, std::memory_order_release);
+	return S_OK;
+}
+
+STDMETHODIMP AudioDeviceNotifier::OnDefaultDeviceChanged(_In_ EDataFlow flow, _In_ ERole role, _In_opt_ LPCWSTR pwstrDefaultDeviceId)
+{
+	//The default devices are looked up for the console role, so the other roles are ignored.
+	if (role != eConsole) {
+		return S_OK;
+	}
+	LOG_DEBUG(L"Default audio %ls device changed to %ls", flow == eCapture ? L"input" : L"output", pwstrDefaultDeviceId ? pwstrDefaultDeviceId : L"none");
+	if (flow == eCapture) {
+		m_DefaultCaptureDeviceChangeCount.fetch_add(1, std::memory_order_release);
+	}
+	else {
+		m_DefaultRenderDeviceChangeCount.fetch_add(1, std::memory_order_release);
+	}
+	m_ChangeCount.fetch_add(1, std::memory_order_release);
+	return S_OK;
+}
+
+STDMETHODIMP AudioDeviceNotifier::OnPropertyValueChanged(_In_ LPCWSTR pwstrDeviceId, _In_ const PROPERTYKEY key)
+{
+	//Property changes are frequent and never need the capture to change.
+	return S_OK;
+}
+
+STDMETHODIMP AudioDeviceNotifier::QueryInterface(REFIID riid, void **ppv)
+{
+	static const QITAB qit[] = {
+		QITABENT(AudioDeviceNotifier, IMMNotificationClient),
+	{0}
+	};
+	return QISearch(this, qit, riid, ppv);
+}
+
+STDMETHODIMP_(ULONG) AudioDeviceNotifier::AddRef()
+{
+	return InterlockedIncrement(&m_nRefCount);
+}
+
+STDMETHODIMP_(ULONG) AudioDeviceNotifier::Release()
+{
+	ULONG refCount = InterlockedDecrement(&m_nRefCount);
+	if (refCount == 0) {
+		delete this;
+	}
+	return refCount;
+}
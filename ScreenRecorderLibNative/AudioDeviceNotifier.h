@@ -0,0 +1,51 @@
+#pragma once
+#include <windows.h>
+#include <mmdeviceapi.h>
+#include <atomic>
+
+/// <summary>
+/// Counts the audio endpoint changes Windows reports, such as devices being added, removed or made default,
+/// so the recorder can find out if a device changed by comparing a counter instead of querying the devices.
+/// The counters are updated on a system thread and can be read from any thread.
+/// </summary>
+class AudioDeviceNotifier : public IMMNotificationClient
+{
+public:
+	AudioDeviceNotifier();
+	/// <summary>
+	/// Starts listening for endpoint changes.
+	/// </summary>
+	HRESULT Register();
+	/// <summary>
+	/// Stops listening. Must be called before the last reference is released, as the device enumerator does not hold one.
+	/// </summary>
+	void Unregister();
+	/// <summary>
+	/// Incremented on every change to the audio endpoints, except property changes.
+	/// </summary>
+	inline UINT64 GetChangeCount() const { return m_ChangeCount.load(std::memory_order_acquire); }
+	/// <summary>
+	/// Incremented when the default console device for the given flow changes.
+	/// </summary>
+	inline UINT64 GetDefaultDeviceChangeCount(_In_ EDataFlow flow) const { return flow == eCapture ? m_DefaultCaptureDeviceChangeCount.load(std::memory_order_acquire) : m_DefaultRenderDeviceChangeCount.load(std::memory_order_acquire); }
+
+	// IMMNotificationClient methods
+	STDMETHODIMP OnDeviceStateChanged(_In_ LPCWSTR pwstrDeviceId, _In_ DWORD dwNewState);
+	STDMETHODIMP OnDeviceAdded(_In_ LPCWSTR pwstrDeviceId);
+	STDMETHODIMP OnDeviceRemoved(_In_ LPCWSTR pwstrDeviceId);
+	STDMETHODIMP OnDefaultDeviceChanged(_In_ EDataFlow flow, _In_ ERole role, _In_opt_ LPCWSTR pwstrDefaultDeviceId);
+	STDMETHODIMP OnPropertyValueChanged(_In_ LPCWSTR pwstrDeviceId, _In_ const PROPERTYKEY key);
+
+	// IUnknown methods
+	STDMETHODIMP QueryInterface(REFIID riid, void **ppv);
+	STDMETHODIMP_(ULONG) AddRef();
+	STDMETHODIMP_(ULONG) Release();
+private:
+	virtual ~AudioDeviceNotifier();
+
+	volatile long m_nRefCount;
+	IMMDeviceEnumerator *m_pEnumerator;
+	std::atomic<UINT64> m_ChangeCount;
+	std::atomic<UINT64> m_DefaultRenderDeviceChangeCount;
+	std::atomic<UINT64> m_DefaultCaptureDeviceChangeCount;
+};
@@ -0,0 +1,108 @@
+#include "AudioDriftEstimator.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+	//Natural frequency of the control loop in radians per second. The gains below make the loop critically damped,
+	//so a change in drift is tracked within a couple of minutes without overshooting, and packet jitter barely moves the correction.
+	const double LoopBandwidth = 0.05;
+	const double ProportionalGain = 2.0 * LoopBandwidth;
+	const double IntegralGain = LoopBandwidth * LoopBandwidth;
+	//Time constant of the buffer fill smoothing, in seconds.
+	const double FillSmoothingSeconds = 1.0;
+	//The correction is limited to 0.5%, which keeps the pitch change inaudible even while a large backlog is drained.
+	const double MaxCorrection = 0.005;
+}
+
+AudioDriftEstimator::AudioDriftEstimator() :
+	m_TargetBufferedSeconds(0),
+	m_MaxDrift(0),
+	m_SmoothedBufferedSeconds(0),
+	m_Integral(0),
+	m_Correction(0),
+	m_HasObservation(false),
+	m_PublishedDrift(0),
+	m_PublishedCorrection(0),
+	m_PublishedBufferedSeconds(0),
+	m_UpdateCount(0)
+{
+}
+
+AudioDriftEstimator::~AudioDriftEstimator()
+{
+}
+
+void AudioDriftEstimator::Initialize(_In_ double targetBufferedSeconds, _In_ double maxDriftPpm)
+{
+	m_TargetBufferedSeconds = (std::max)(0.0, targetBufferedSeconds);
+	m_MaxDrift = (std::min)((std::max)(0.0, maxDriftPpm / 1e6), MaxCorrection);
+	Reset();
+}
+
+void AudioDriftEstimator::Reset()
+{
+	m_SmoothedBufferedSeconds = 0;
+	m_Integral = 0;
+	m_Correction = 0;
+	m_HasObservation = false;
+	m_UpdateCount.store(0, std::memory_order_relaxed);
+	Publish();
+}
+
+void AudioDriftEstimator::Resynchronize(_In_ double bufferedSeconds)
+{
+	m_SmoothedBufferedSeconds = bufferedSeconds;
+	m_HasObservation = true;
+	m_Correction = (std::max)(-MaxCorrection, (std::min)(MaxCorrection, m_Integral + ProportionalGain * (bufferedSeconds - m_TargetBufferedSeconds)));
+	Publish();
+}
+
+double AudioDriftEstimator::Update(_In_ double bufferedSeconds, _In_ double elapsedSeconds)
+{
+	if (!(elapsedSeconds > 0)) {
+		return m_Correction;
+	}
+	if (!m_HasObservation) {
+		m_SmoothedBufferedSeconds = bufferedSeconds;
+		m_HasObservation = true;
+	}
+	else {
+		double alpha = 1.0 - exp(-elapsedSeconds / FillSmoothingSeconds);
+		m_SmoothedBufferedSeconds += alpha * (bufferedSeconds - m_SmoothedBufferedSeconds);
+	}
+	double error = m_SmoothedBufferedSeconds - m_TargetBufferedSeconds;
+	double integral = (std::max)(-m_MaxDrift, (std::min)(m_MaxDrift, m_Integral + IntegralGain * error * elapsedSeconds));
+	double correction = ProportionalGain * error + integral;
+	if (fabs(correction) > MaxCorrection) {
+		correction = correction > 0 ? MaxCorrection : -MaxCorrection;
+		//Stop integrating while saturated, unless the error pulls the integral back, so a long backlog does not wind it up.
+		if ((error > 0) != (m_Integral > 0)) {
+			m_Integral = integral;
+		}
+	}
+	else {
+		m_Integral = integral;
+	}
+	m_Correction = correction;
+	m_UpdateCount.store(m_UpdateCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	Publish();
+	return m_Correction;
+}
+
+void AudioDriftEstimator::Publish()
+{
+	m_PublishedDrift.store(m_Integral, std::memory_order_relaxed);
+	m_PublishedCorrection.store(m_Correction, std::memory_order_relaxed);
+	m_PublishedBufferedSeconds.store(m_SmoothedBufferedSeconds, std::memory_order_relaxed);
+}
+
+AUDIO_DRIFT_STATS AudioDriftEstimator::GetStats() const
+{
+	AUDIO_DRIFT_STATS stats{};
+	stats.DriftPpm = m_PublishedDrift.load(std::memory_order_relaxed) * 1e6;
+	stats.CorrectionPpm = m_PublishedCorrection.load(std::memory_order_relaxed) * 1e6;
+	stats.BufferedSeconds = m_PublishedBufferedSeconds.load(std::memory_order_relaxed);
+	stats.TargetBufferedSeconds = m_TargetBufferedSeconds;
+	stats.UpdateCount = m_UpdateCount.load(std::memory_order_relaxed);
+	return stats;
+}
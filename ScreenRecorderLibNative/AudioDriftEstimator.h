@@ -0,0 +1,72 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <sal.h>
+
+/// <summary>
+/// A snapshot of the clock drift estimate of one capture device.
+/// </summary>
+struct AUDIO_DRIFT_STATS {
+	//Estimated rate difference between the device clock and the media clock, in parts per million. Positive when the device runs fast.
+	double DriftPpm;
+	//The consumption rate correction currently applied, in parts per million. This is the drift estimate plus a term steering the buffer towards its target fill.
+	double CorrectionPpm;
+	//Smoothed amount of captured audio left in the buffer after each read, in seconds.
+	double BufferedSeconds;
+	//The buffer fill the estimator steers towards, in seconds.
+	double TargetBufferedSeconds;
+	//The number of observations since the estimator was reset.
+	uint64_t UpdateCount;
+};
+
+/// <summary>
+/// Estimates the rate difference between an audio capture device and the media clock from how the device buffer fill evolves over media time.
+/// The buffer fill is fed to a PI controller, whose output is the factor by which the consumer should speed up or slow down its reads to keep the fill at the target.
+/// Once settled, the integral part of the controller equals the clock drift.
+/// Update is meant to be called by a single thread. GetStats can be called from any thread.
+/// </summary>
+class AudioDriftEstimator
+{
+public:
+	AudioDriftEstimator();
+	~AudioDriftEstimator();
+	/// <summary>
+	/// Configures the estimator and resets its state.
+	/// </summary>
+	/// <param name="targetBufferedSeconds">The amount of audio that should be left in the buffer after each read. Should cover the jitter of the device packets.</param>
+	/// <param name="maxDriftPpm">The largest drift the estimator will track.</param>
+	void Initialize(_In_ double targetBufferedSeconds, _In_ double maxDriftPpm = 2000.0);
+	/// <summary>
+	/// Feeds one observation to the controller.
+	/// </summary>
+	/// <param name="bufferedSeconds">The amount of audio left in the buffer after a read.</param>
+	/// <param name="elapsedSeconds">The media time that passed since the previous observation.</param>
+	/// <returns>The new correction, see GetCorrection.</returns>
+	double Update(_In_ double bufferedSeconds, _In_ double elapsedSeconds);
+	/// <summary>
+	/// The relative rate correction to apply to the consumer. A value of 0.0001 means 100 ppm more device frames should be read per second of media time.
+	/// </summary>
+	inline double GetCorrection() const { return m_Correction; }
+	/// <summary>
+	/// Restarts the buffer fill smoothing from the given value, while keeping the drift estimate. Call after the buffer was cleared or data was discarded.
+	/// </summary>
+	void Resynchronize(_In_ double bufferedSeconds);
+	inline double GetTargetBufferedSeconds() const { return m_TargetBufferedSeconds; }
+	AUDIO_DRIFT_STATS GetStats() const;
+	void Reset();
+private:
+	double m_TargetBufferedSeconds;
+	double m_MaxDrift;
+	double m_SmoothedBufferedSeconds;
+	double m_Integral;
+	double m_Correction;
+	bool m_HasObservation;
+
+	//Published values for GetStats.
+	std::atomic<double> m_PublishedDrift;
+	std::atomic<double> m_PublishedCorrection;
+	std::atomic<double> m_PublishedBufferedSeconds;
+	std::atomic<uint64_t> m_UpdateCount;
+
+	void Publish();
+};
@@ -0,0 +1,444 @@
+#include "AudioGraph.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "AudioResampler.h"
+#include "AudioRingBuffer.h"
+
+namespace {
+	const UINT64 HundredNanosPerSecond = 10000000;
+	//Room in the delay line beyond the longest delay, so a frame can pass through in a few chunks.
+	const UINT32 DelayLineHeadroomMillis = 250;
+	//A source that keeps delivering more than the others builds up held audio. Past this much, the oldest is dropped.
+	const UINT32 MaxHeldMillis = 1000;
+}
+
+struct AudioGraph::AudioGraphNode {
+	UINT32 Id = 0;
+	IAudioGraphSource *pSource = nullptr;
+	AUDIO_GRAPH_SOURCE_OPTIONS Options;
+	//Audio in the graph format. The front ConsumedBytes were handed to the mix by the last call to Process, the rest is held for the next one.
+	std::vector<BYTE> Data;
+	size_t ConsumedBytes = 0;
+	//Everything past the first AudibleBytes of Data is known to be silence.
+	size_t AudibleBytes = 0;
+	bool IsSilent = true;
+	//Set if the source format differs from the graph format.
+	bool IsResampling = false;
+	AudioResampler Resampler;
+	std::vector<BYTE> ResamplerInput;
+	UINT32 SourceChannels = 0;
+	//The delay line, and the frame counts written to and read from it, used to tell if the audio leaving it is silent.
+	AudioRingBuffer DelayLine;
+	size_t DelayFrames = 0;
+	size_t AppliedDelayFrames = 0;
+	UINT64 DelayLineFramesIn = 0;
+	UINT64 DelayLineFramesOut = 0;
+	UINT64 DelayLineAudibleEnd = 0;
+	AudioLevelMeter Meter;
+	//The audio with the gain applied, when the node is output on its own rather than mixed.
+	std::vector<BYTE> GainData;
+};
+
+AudioGraph::AudioGraph() :
+	m_SampleRate(0),
+	m_Channels(0),
+	m_SimdLevel(SimdLevel::Auto),
+	m_NextId(1)
+{
+}
+
+AudioGraph::~AudioGraph()
+{
+}
+
+HRESULT AudioGraph::Initialize(_In_ UINT32 sampleRate, _In_ UINT32 channels, _In_ SimdLevel level)
+{
+	if (sampleRate == 0 || channels == 0) {
+		return E_INVALIDARG;
+	}
+	m_SampleRate = sampleRate;
+	m_Channels = channels;
+	m_SimdLevel = level;
+	m_Nodes.clear();
+	m_MixInputs.clear();
+	m_MixData.clear();
+	m_MixMeter.Initialize(sampleRate, channels, level);
+	return S_OK;
+}
+
+HRESULT AudioGraph::AddSource(_In_ IAudioGraphSource *pSource, _In_ UINT32 sampleRate, _In_ UINT32 channels, _In_ const AUDIO_GRAPH_SOURCE_OPTIONS &options, _Out_ UINT32 *pId)
+{
+	*pId = 0;
+	if (!pSource || sampleRate == 0 || channels == 0) {
+		return E_INVALIDARG;
+	}
+	if (m_SampleRate == 0) {
+		return E_UNEXPECTED;
+	}
+	std::unique_ptr<AudioGraphNode> pNode(new (std::nothrow) AudioGraphNode());
+	if (!pNode) {
+		return E_OUTOFMEMORY;
+	}
+	pNode->Id = m_NextId;
+	pNode->pSource = pSource;
+	pNode->SourceChannels = channels;
+	pNode->IsResampling = sampleRate != m_SampleRate || channels != m_Channels;
+	if (pNode->IsResampling) {
+		HRESULT hr = pNode->Resampler.Initialize(sampleRate, channels, m_SampleRate, m_Channels, AudioResamplerQuality::Medium, m_SimdLevel);
+		if (FAILED(hr)) {
+			return hr;
+		}
+	}
+	pNode->Meter.Initialize(m_SampleRate, m_Channels, m_SimdLevel);
+	pNode->Options = options;
+	pNode->Options.Delay100Nanos = 0;
+	AudioGraphNode *pAdded = pNode.get();
+	m_Nodes.push_back(std::move(pNode));
+	m_MixInputs.reserve(m_Nodes.size());
+	m_NextId++;
+	HRESULT hr = SetSourceDelay(pAdded->Id, options.Delay100Nanos);
+	if (FAILED(hr)) {
+		m_Nodes.pop_back();
+		return hr;
+	}
+	*pId = pAdded->Id;
+	return S_OK;
+}
+
+HRESULT AudioGraph::RemoveSource(_In_ UINT32 id)
+{
+	auto it = std::find_if(m_Nodes.begin(), m_Nodes.end(), [id](const std::unique_ptr<AudioGraphNode> &pNode) { return pNode->Id == id; });
+	if (it == m_Nodes.end()) {
+		return E_INVALIDARG;
+	}
+	m_Nodes.erase(it);
+	return S_OK;
+}
+
+HRESULT AudioGraph::ReplaceSource(_In_ UINT32 id, _In_ IAudioGraphSource *pSource, _In_ UINT32 sampleRate, _In_ UINT32 channels)
+{
+	if (!pSource || sampleRate == 0 || channels == 0) {
+		return E_INVALIDARG;
+	}
+	AudioGraphNode *pNode = FindNode(id);
+	if (!pNode) {
+		return E_INVALIDARG;
+	}
+	bool isResampling = sampleRate != m_SampleRate || channels != m_Channels;
+	if (isResampling) {
+		//Input the old source left in the resampler is dropped, it is a few frames at most.
+		HRESULT hr = pNode->Resampler.Initialize(sampleRate, channels, m_SampleRate, m_Channels, AudioResamplerQuality::Medium, m_SimdLevel);
+		if (FAILED(hr)) {
+			return hr;
+		}
+	}
+	pNode->ResamplerInput.clear();
+	pNode->IsResampling = isResampling;
+	pNode->SourceChannels = channels;
+	pNode->pSource = pSource;
+	return S_OK;
+}
+
+HRESULT AudioGraph::SetSourceGain(_In_ UINT32 id, _In_ float gain)
+{
+	AudioGraphNode *pNode = FindNode(id);
+	if (!pNode) {
+		return E_INVALIDARG;
+	}
+	pNode->Options.Gain = gain;
+	return S_OK;
+}
+
+HRESULT AudioGraph::SetSourceMuted(_In_ UINT32 id, _In_ bool isMuted)
+{
+	AudioGraphNode *pNode = FindNode(id);
+	if (!pNode) {
+		return E_INVALIDARG;
+	}
+	pNode->Options.IsMuted = isMuted;
+	return S_OK;
+}
+
+HRESULT AudioGraph::SetSourceDelay(_In_ UINT32 id, _In_ UINT64 delay100Nanos)
+{
+	AudioGraphNode *pNode = FindNode(id);
+	if (!pNode) {
+		return E_INVALIDARG;
+	}
+	if (delay100Nanos > (UINT64)MaxSourceDelayMillis * 10000) {
+		return E_INVALIDARG;
+	}
+	if (delay100Nanos > 0 && !pNode->DelayLine.IsInitialized()) {
+		size_t capacityFrames = (size_t)m_SampleRate * (MaxSourceDelayMillis + DelayLineHeadroomMillis) / 1000;
+		HRESULT hr = pNode->DelayLine.Initialize(capacityFrames * FrameBytes(), (UINT32)FrameBytes());
+		if (FAILED(hr)) {
+			return hr;
+		}
+	}
+	pNode->Options.Delay100Nanos = delay100Nanos;
+	pNode->DelayFrames = (size_t)(delay100Nanos * m_SampleRate / HundredNanosPerSecond);
+	return S_OK;
+}
+
+HRESULT AudioGraph::Process(_In_ UINT64 duration100Nanos, _Out_ AUDIO_GRAPH_OUTPUT *pOutput, _Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters)
+{
+	*pOutput = AUDIO_GRAPH_OUTPUT{};
+	pOutput->IsSilent = true;
+	if (m_SampleRate == 0) {
+		return E_UNEXPECTED;
+	}
+	size_t frames = PullSources(duration100Nanos, pCounters);
+	if (frames > 0) {
+		MixSources(frames, pOutput, pCounters);
+	}
+	return S_OK;
+}
+
+HRESULT AudioGraph::ProcessSources(_In_ UINT64 duration100Nanos, _In_reads_(sourceCount) const UINT32 *pIds, _In_ size_t sourceCount, _Out_writes_(sourceCount) AUDIO_GRAPH_OUTPUT *pSourceOutputs, _Out_opt_ AUDIO_GRAPH_OUTPUT *pMixOutput, _Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters)
+{
+	for (size_t i = 0; i < sourceCount; i++) {
+		pSourceOutputs[i] = AUDIO_GRAPH_OUTPUT{};
+		pSourceOutputs[i].IsSilent = true;
+	}
+	if (pMixOutput) {
+		*pMixOutput = AUDIO_GRAPH_OUTPUT{};
+		pMixOutput->IsSilent = true;
+	}
+	if (m_SampleRate == 0) {
+		return E_UNEXPECTED;
+	}
+	size_t frames = PullSources(duration100Nanos, pCounters);
+	if (frames == 0) {
+		return S_OK;
+	}
+	for (size_t i = 0; i < sourceCount; i++) {
+		GetSourceOutput(FindNode(pIds[i]), frames, &pSourceOutputs[i], pCounters);
+	}
+	if (pMixOutput) {
+		MixSources(frames, pMixOutput, pCounters);
+	}
+	return S_OK;
+}
+
+void AudioGraph::Clear()
+{
+	for (auto &pNode : m_Nodes) {
+		AudioGraphNode &node = *pNode;
+		node.Data.clear();
+		node.ConsumedBytes = 0;
+		node.AudibleBytes = 0;
+		node.IsSilent = true;
+		if (node.IsResampling) {
+			node.Resampler.Reset();
+		}
+		if (node.DelayLine.IsInitialized()) {
+			node.DelayLine.Clear();
+		}
+		node.AppliedDelayFrames = 0;
+		node.DelayLineFramesIn = 0;
+		node.DelayLineFramesOut = 0;
+		node.DelayLineAudibleEnd = 0;
+	}
+}
+
+AUDIO_LEVELS AudioGraph::GetSourceLevels(_In_ UINT32 id) const
+{
+	AudioGraphNode *pNode = FindNode(id);
+	return pNode ? pNode->Meter.GetLevels() : AUDIO_LEVELS{};
+}
+
+AudioGraph::AudioGraphNode *AudioGraph::FindNode(_In_ UINT32 id) const
+{
+	for (auto &pNode : m_Nodes) {
+		if (pNode->Id == id) {
+			return pNode.get();
+		}
+	}
+	return nullptr;
+}
+
+size_t AudioGraph::PullSources(_In_ UINT64 duration100Nanos, _Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters)
+{
+	//Read every source after the audio it held back last time, and find the length all sources that delivered anything can provide.
+	size_t length = SIZE_MAX;
+	for (auto &pNode : m_Nodes) {
+		ReadNode(*pNode, duration100Nanos, pCounters);
+		if (!pNode->Data.empty()) {
+			length = (std::min)(length, pNode->Data.size());
+		}
+	}
+	if (length == SIZE_MAX || length == 0) {
+		return 0;
+	}
+	size_t frames = length / FrameBytes();
+	length = frames * FrameBytes();
+	size_t sampleCount = frames * m_Channels;
+	size_t maxHeldBytes = (size_t)m_SampleRate * MaxHeldMillis / 1000 * FrameBytes();
+	for (auto &pNode : m_Nodes) {
+		AudioGraphNode &node = *pNode;
+		if (node.Data.empty()) {
+			continue;
+		}
+		//Anything past the common length is held for the next call.
+		node.ConsumedBytes = length;
+		size_t heldBytes = node.Data.size() - length;
+		if (heldBytes > maxHeldBytes) {
+			size_t droppedBytes = heldBytes - maxHeldBytes;
+			node.Data.erase(node.Data.begin() + length, node.Data.begin() + length + droppedBytes);
+			node.AudibleBytes = (std::min)(node.AudibleBytes, node.Data.size());
+		}
+		if (node.DelayFrames > 0 || node.AppliedDelayFrames > 0) {
+			DelayNode(node, frames);
+		}
+		if (node.IsSilent) {
+			node.Meter.ProcessSilence(sampleCount);
+		}
+		else {
+			node.Meter.Process(reinterpret_cast<const float *>(node.Data.data()), sampleCount);
+		}
+	}
+	return frames;
+}
+
+void AudioGraph::MixSources(_In_ size_t frames, _Out_ AUDIO_GRAPH_OUTPUT *pOutput, _Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters)
+{
+	size_t sampleCount = frames * m_Channels;
+	m_MixInputs.clear();
+	for (auto &pNode : m_Nodes) {
+		AudioGraphNode &node = *pNode;
+		//Silent and muted sources add nothing to the mix, nor do sources that have not delivered anything yet.
+		if (!node.Data.empty() && !node.IsSilent && !node.Options.IsMuted && node.Options.Gain != 0.0f) {
+			AUDIO_MIX_INPUT<float> input;
+			input.pSamples = reinterpret_cast<const float *>(node.Data.data());
+			input.SampleCount = sampleCount;
+			input.Gain = node.Options.Gain;
+			m_MixInputs.push_back(input);
+		}
+	}
+	pOutput->SampleCount = sampleCount;
+	pOutput->IsSilent = true;
+	if (m_MixInputs.empty()) {
+		m_MixMeter.ProcessSilence(sampleCount);
+		return;
+	}
+	//A single source at unity gain is passed on as is. Anything else is summed in one pass over all sources.
+	if (m_MixInputs.size() == 1 && m_MixInputs[0].Gain == 1.0f) {
+		pOutput->pSamples = m_MixInputs[0].pSamples;
+	}
+	else {
+		ResizeAudioBuffer(m_MixData, frames * FrameBytes(), pCounters);
+		float *pMix = reinterpret_cast<float *>(m_MixData.data());
+		AudioMixer::Mix(m_MixInputs.data(), m_MixInputs.size(), pMix, sampleCount, m_SimdLevel);
+		pOutput->pSamples = pMix;
+	}
+	pOutput->IsSilent = false;
+	m_MixMeter.Process(pOutput->pSamples, sampleCount);
+}
+
+void AudioGraph::GetSourceOutput(_In_opt_ AudioGraphNode *pNode, _In_ size_t frames, _Out_ AUDIO_GRAPH_OUTPUT *pOutput, _Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters)
+{
+	size_t sampleCount = frames * m_Channels;
+	pOutput->SampleCount = sampleCount;
+	pOutput->IsSilent = true;
+	if (!pNode || pNode->Data.empty() || pNode->IsSilent || pNode->Options.IsMuted || pNode->Options.Gain == 0.0f) {
+		return;
+	}
+	const float *pSamples = reinterpret_cast<const float *>(pNode->Data.data());
+	//At unity gain the node's own audio is handed out, so a track per source costs no copy. Otherwise the gain is applied in one pass.
+	if (pNode->Options.Gain != 1.0f) {
+		AUDIO_MIX_INPUT<float> input;
+		input.pSamples = pSamples;
+		input.SampleCount = sampleCount;
+		input.Gain = pNode->Options.Gain;
+		ResizeAudioBuffer(pNode->GainData, frames * FrameBytes(), pCounters);
+		float *pGained = reinterpret_cast<float *>(pNode->GainData.data());
+		AudioMixer::Mix(&input, 1, pGained, sampleCount, m_SimdLevel);
+		pSamples = pGained;
+	}
+	pOutput->pSamples = pSamples;
+	pOutput->IsSilent = false;
+}
+
+void AudioGraph::ReadNode(_Inout_ AudioGraphNode &node, _In_ UINT64 duration100Nanos, _Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters)
+{
+	//Drop what was mixed last time, so only the held audio is left at the front. This moves at most the held audio, and keeps the capacity.
+	if (node.ConsumedBytes > 0) {
+		node.Data.erase(node.Data.begin(), node.Data.begin() + node.ConsumedBytes);
+		if (!node.Data.empty()) {
+			CountAudioCopy(pCounters, node.Data.size());
+		}
+		node.AudibleBytes = node.AudibleBytes > node.ConsumedBytes ? node.AudibleBytes - node.ConsumedBytes : 0;
+		node.ConsumedBytes = 0;
+	}
+	bool isReadSilent = true;
+	if (!node.IsResampling) {
+		node.pSource->ReadAudio(duration100Nanos, node.Data, pCounters, &isReadSilent);
+	}
+	else {
+		node.ResamplerInput.clear();
+		node.pSource->ReadAudio(duration100Nanos, node.ResamplerInput, pCounters, &isReadSilent);
+		size_t inputFrames = node.ResamplerInput.size() / (node.SourceChannels * sizeof(float));
+		if (inputFrames > 0) {
+			size_t offset = node.Data.size();
+			size_t maxOutputFrames = node.Resampler.GetMaxOutputFrames(inputFrames);
+			ResizeAudioBuffer(node.Data, offset + maxOutputFrames * FrameBytes(), pCounters);
+			float *pOutput = reinterpret_cast<float *>(node.Data.data() + offset);
+			size_t outputFrames;
+			if (isReadSilent) {
+				outputFrames = node.Resampler.ProcessSilence(inputFrames, pOutput, maxOutputFrames, &isReadSilent);
+			}
+			else {
+				outputFrames = node.Resampler.Process(reinterpret_cast<const float *>(node.ResamplerInput.data()), inputFrames, pOutput, maxOutputFrames);
+			}
+			node.Data.resize(offset + outputFrames * FrameBytes());
+		}
+	}
+	if (!isReadSilent) {
+		node.AudibleBytes = node.Data.size();
+	}
+	node.IsSilent = node.AudibleBytes == 0;
+}
+
+void AudioGraph::DelayNode(_Inout_ AudioGraphNode &node, _In_ size_t frames)
+{
+	size_t frameBytes = FrameBytes();
+	//Move the applied delay to the setting: a longer delay pushes silence into the line, a shorter one drops the oldest audio in it.
+	if (node.DelayFrames > node.AppliedDelayFrames) {
+		size_t added = node.DelayLine.WriteSilence((node.DelayFrames - node.AppliedDelayFrames) * frameBytes) / frameBytes;
+		node.DelayLineFramesIn += added;
+		node.AppliedDelayFrames += added;
+	}
+	else if (node.DelayFrames < node.AppliedDelayFrames) {
+		size_t dropped = node.DelayLine.Skip((node.AppliedDelayFrames - node.DelayFrames) * frameBytes) / frameBytes;
+		node.DelayLineFramesOut += dropped;
+		node.AppliedDelayFrames -= dropped;
+	}
+	if (node.AppliedDelayFrames == 0) {
+		return;
+	}
+	//Push the frame through the line in place. The line always has room for the delay plus some headroom, so large frames go through in chunks.
+	BYTE *pData = node.Data.data();
+	bool isOutputSilent = true;
+	size_t remaining = frames;
+	while (remaining > 0) {
+		size_t chunk = (std::min)(remaining, node.DelayLine.GetFreeBytes() / frameBytes);
+		if (chunk == 0) {
+			break;
+		}
+		size_t chunkBytes = chunk * frameBytes;
+		node.DelayLine.Write(pData, chunkBytes);
+		node.DelayLineFramesIn += chunk;
+		if (!node.IsSilent) {
+			node.DelayLineAudibleEnd = node.DelayLineFramesIn;
+		}
+		if (node.DelayLineAudibleEnd > node.DelayLineFramesOut) {
+			isOutputSilent = false;
+		}
+		node.DelayLine.Read(pData, chunkBytes);
+		node.DelayLineFramesOut += chunk;
+		pData += chunkBytes;
+		remaining -= chunk;
+	}
+	node.IsSilent = isOutputSilent;
+}
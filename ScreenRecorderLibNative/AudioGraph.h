@@ -0,0 +1,143 @@
+#pragma once
+#include <windows.h>
+#include <memory>
+#include <vector>
+#include <sal.h>
+#include "AudioBufferCounters.h"
+#include "AudioLevelMeter.h"
+#include "AudioMixer.h"
+#include "Simd.util.h"
+
+/// <summary>
+/// A source of audio for an AudioGraph, such as a capture device.
+/// </summary>
+class IAudioGraphSource
+{
+public:
+	virtual ~IAudioGraphSource() {}
+	/// <summary>
+	/// Appends the audio for the given duration to the end of buffer, as interleaved 32 bit float samples in the format the source was added to the graph with.
+	/// pIsSilent is set to true if the appended audio is known to be silence.
+	/// </summary>
+	virtual void ReadAudio(_In_ UINT64 duration100Nanos, _Inout_ std::vector<BYTE> &buffer, _Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters, _Out_ bool *pIsSilent) = 0;
+};
+
+/// <summary>
+/// Settings of one source node in an AudioGraph. All of them can be changed while the graph is running.
+/// </summary>
+struct AUDIO_GRAPH_SOURCE_OPTIONS {
+	//Linear gain applied to the source when mixing.
+	float Gain = 1.0f;
+	//A muted source is still read and metered, so it stays in sync and its levels can be shown, but it is left out of the mix.
+	bool IsMuted = false;
+	//Delays the source relative to the others, e.g. to line a microphone up with a late camera. At most MaxSourceDelayMillis.
+	UINT64 Delay100Nanos = 0;
+};
+
+/// <summary>
+/// The audio the graph produced for one call to Process, or for one node in a call to ProcessSources.
+/// </summary>
+struct AUDIO_GRAPH_OUTPUT {
+	//Interleaved 32 bit float samples in the graph format. Valid until the next call to Process or Clear. nullptr if IsSilent is true.
+	const float *pSamples;
+	//The number of samples (not frames) produced. 0 if no source had any audio.
+	size_t SampleCount;
+	//True if all audible sources were silent or muted, in which case nothing was mixed. For the output of a single node, true if that node was silent or muted.
+	bool IsSilent;
+};
+
+/// <summary>
+/// Combines any number of audio sources into one stream. Each source node adapts the source to the graph format, and applies a delay, gain and mute,
+/// and a single mix node sums all nodes in one pass. The nodes can also be output one by one, e.g. to write a track per source, without mixing them.
+/// Each call to Process reads every source, lines them up to the same length and mixes them. Audio a source delivered beyond the shortest source
+/// is kept by its node and goes first on the next call, so no source drifts ahead of the others.
+/// The cost of Process grows linearly with the number of sources, and once the buffers have grown to the frame size, it does not allocate.
+/// Not thread safe, except for the level meters.
+/// </summary>
+class AudioGraph
+{
+public:
+	//The longest delay a source node can be set to.
+	static const UINT32 MaxSourceDelayMillis = 2000;
+
+	AudioGraph();
+	~AudioGraph();
+	/// <summary>
+	/// Sets the format of the mixed audio, and removes all sources.
+	/// </summary>
+	HRESULT Initialize(_In_ UINT32 sampleRate, _In_ UINT32 channels, _In_ SimdLevel level = SimdLevel::Auto);
+	/// <summary>
+	/// Adds a source node. If the source format differs from the graph format, the node resamples and up or downmixes it.
+	/// The graph does not take ownership of the source, which must stay alive until it is removed.
+	/// </summary>
+	/// <param name="pId">Receives the id of the node, used to change its settings or remove it.</param>
+	HRESULT AddSource(_In_ IAudioGraphSource *pSource, _In_ UINT32 sampleRate, _In_ UINT32 channels, _In_ const AUDIO_GRAPH_SOURCE_OPTIONS &options, _Out_ UINT32 *pId);
+	/// <summary>
+	/// Removes a source node, and drops any audio it held.
+	/// </summary>
+	HRESULT RemoveSource(_In_ UINT32 id);
+	/// <summary>
+	/// Points a node at another source, e.g. when a capture device is swapped while recording. The node keeps its gain, mute, delay, levels
+	/// and the audio it holds, so the mix carries on without a gap. The old source is not read again after this returns.
+	/// </summary>
+	HRESULT ReplaceSource(_In_ UINT32 id, _In_ IAudioGraphSource *pSource, _In_ UINT32 sampleRate, _In_ UINT32 channels);
+	HRESULT SetSourceGain(_In_ UINT32 id, _In_ float gain);
+	HRESULT SetSourceMuted(_In_ UINT32 id, _In_ bool isMuted);
+	/// <summary>
+	/// Sets the delay of a source. A longer delay inserts silence, a shorter one drops the audio held for the difference.
+	/// The delay line is allocated the first time a delay is set on the node.
+	/// </summary>
+	HRESULT SetSourceDelay(_In_ UINT32 id, _In_ UINT64 delay100Nanos);
+	/// <summary>
+	/// Reads the given duration of audio from all sources and mixes it. The output stays valid until the next call to Process or Clear.
+	/// </summary>
+	HRESULT Process(_In_ UINT64 duration100Nanos, _Out_ AUDIO_GRAPH_OUTPUT *pOutput, _Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters = nullptr);
+	/// <summary>
+	/// Reads the given duration of audio from all sources like Process, but returns the audio of the given nodes one by one, each with its gain and mute applied,
+	/// instead of mixing them. The mix is only made if pMixOutput is set. All outputs have the same length. An id of a node that does not exist gives silence,
+	/// so each output stays continuous while nodes come and go. The outputs stay valid until the next call to Process, ProcessSources or Clear.
+	/// </summary>
+	HRESULT ProcessSources(_In_ UINT64 duration100Nanos, _In_reads_(sourceCount) const UINT32 *pIds, _In_ size_t sourceCount, _Out_writes_(sourceCount) AUDIO_GRAPH_OUTPUT *pSourceOutputs, _Out_opt_ AUDIO_GRAPH_OUTPUT *pMixOutput, _Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters = nullptr);
+	/// <summary>
+	/// Drops all audio held by the nodes, e.g. when the sources were cleared. Delays are applied again from the next call to Process.
+	/// </summary>
+	void Clear();
+	/// <summary>
+	/// Levels of a source before its gain and mute are applied. Safe to call from any thread while the set of sources does not change.
+	/// </summary>
+	AUDIO_LEVELS GetSourceLevels(_In_ UINT32 id) const;
+	/// <summary>
+	/// Levels of the mixed audio returned by the last call to Process, or ProcessSources with a mix output. Safe to call from any thread.
+	/// </summary>
+	inline AUDIO_LEVELS GetMixedLevels() const { return m_MixMeter.GetLevels(); }
+	/// <summary>
+	/// The smoothed volume of the mixed audio, in 16 bit sample units.
+	/// </summary>
+	inline int GetMixedVolume() const { return m_MixMeter.GetVolume(); }
+	inline size_t GetSourceCount() const { return m_Nodes.size(); }
+	inline UINT32 GetSampleRate() const { return m_SampleRate; }
+	inline UINT32 GetChannels() const { return m_Channels; }
+private:
+	struct AudioGraphNode;
+
+	UINT32 m_SampleRate;
+	UINT32 m_Channels;
+	SimdLevel m_SimdLevel;
+	UINT32 m_NextId;
+	std::vector<std::unique_ptr<AudioGraphNode>> m_Nodes;
+	//Sized as nodes are added, so building the mix does not allocate.
+	std::vector<AUDIO_MIX_INPUT<float>> m_MixInputs;
+	std::vector<BYTE> m_MixData;
+	AudioLevelMeter m_MixMeter;
+
+	inline size_t FrameBytes() const { return m_Channels * sizeof(float); }
+	AudioGraphNode *FindNode(_In_ UINT32 id) const;
+	/// <summary>
+	/// Reads all sources and lines them up, and returns the number of frames every node that has audio now holds at the front of its data.
+	/// </summary>
+	size_t PullSources(_In_ UINT64 duration100Nanos, _Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters);
+	void MixSources(_In_ size_t frames, _Out_ AUDIO_GRAPH_OUTPUT *pOutput, _Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters);
+	void GetSourceOutput(_In_opt_ AudioGraphNode *pNode, _In_ size_t frames, _Out_ AUDIO_GRAPH_OUTPUT *pOutput, _Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters);
+	void ReadNode(_Inout_ AudioGraphNode &node, _In_ UINT64 duration100Nanos, _Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters);
+	void DelayNode(_Inout_ AudioGraphNode &node, _In_ size_t frames);
+};
@@ -0,0 +1,272 @@
+#include "AudioLevelMeter.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <thread>
+
+namespace {
+	struct BLOCK_STATS {
+		int Peak[AUDIO_METER_MAX_CHANNELS];
+		uint64_t SumOfSquares[AUDIO_METER_MAX_CHANNELS];
+	};
+
+	struct FLOAT_BLOCK_STATS {
+		float Peak[AUDIO_METER_MAX_CHANNELS];
+		double SumOfSquares[AUDIO_METER_MAX_CHANNELS];
+	};
+
+	void MeasureFloatScalar(const float *pSamples, size_t start, size_t end, uint32_t channels, FLOAT_BLOCK_STATS &stats) {
+		for (size_t i = start; i < end; i++) {
+			uint32_t channel = (uint32_t)(i % channels);
+			if (channel >= AUDIO_METER_MAX_CHANNELS) {
+				continue;
+			}
+			float value = pSamples[i];
+			stats.Peak[channel] = (std::max)(stats.Peak[channel], std::fabs(value));
+			stats.SumOfSquares[channel] += (double)value * value;
+		}
+	}
+
+	void MeasureScalar(const int16_t *pSamples, size_t start, size_t end, uint32_t channels, BLOCK_STATS &stats) {
+		for (size_t i = start; i < end; i++) {
+			uint32_t channel = (uint32_t)(i % channels);
+			if (channel >= AUDIO_METER_MAX_CHANNELS) {
+				continue;
+			}
+			int value = pSamples[i];
+			//The magnitude of the most negative sample is clamped, the same way the saturating SIMD path does it.
+			int magnitude = (std::min)(std::abs(value), 32767);
+			stats.Peak[channel] = (std::max)(stats.Peak[channel], magnitude);
+			stats.SumOfSquares[channel] += (uint64_t)(value * value);
+		}
+	}
+
+#if SIMD_X86
+	/// <summary>
+	/// Measures 8 samples at a time. Only valid for channel counts that divide 8, so every vector lane always holds the same channel.
+	/// Returns the number of samples processed.
+	/// </summary>
+	size_t MeasureSSE2(const int16_t *pSamples, size_t sampleCount, uint32_t channels, BLOCK_STATS &stats) {
+		size_t end = sampleCount & ~(size_t)7;
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i evenMask = _mm_set1_epi32(0x0000FFFF);
+		const __m128i oddMask = _mm_set1_epi32((int)0xFFFF0000);
+		__m128i peak = zero;
+		//Squares of samples 0,2 | 4,6 | 1,3 | 5,7 of each vector, widened to 64 bit so they cannot overflow.
+		__m128i sumEvenLo = zero, sumEvenHi = zero, sumOddLo = zero, sumOddHi = zero;
+		for (size_t i = 0; i < end; i += 8) {
+			__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pSamples + i));
+			__m128i magnitude = _mm_max_epi16(x, _mm_subs_epi16(zero, x));
+			peak = _mm_max_epi16(peak, magnitude);
+			__m128i squaresEven = _mm_madd_epi16(x, _mm_and_si128(x, evenMask));
+			__m128i squaresOdd = _mm_madd_epi16(x, _mm_and_si128(x, oddMask));
+			sumEvenLo = _mm_add_epi64(sumEvenLo, _mm_unpacklo_epi32(squaresEven, zero));
+			sumEvenHi = _mm_add_epi64(sumEvenHi, _mm_unpackhi_epi32(squaresEven, zero));
+			sumOddLo = _mm_add_epi64(sumOddLo, _mm_unpacklo_epi32(squaresOdd, zero));
+			sumOddHi = _mm_add_epi64(sumOddHi, _mm_unpackhi_epi32(squaresOdd, zero));
+		}
+		alignas(16) int16_t peaks[8];
+		alignas(16) uint64_t sums[8];
+		_mm_store_si128(reinterpret_cast<__m128i *>(peaks), peak);
+		_mm_store_si128(reinterpret_cast<__m128i *>(sums), sumEvenLo);
+		_mm_store_si128(reinterpret_cast<__m128i *>(sums + 2), sumEvenHi);
+		_mm_store_si128(reinterpret_cast<__m128i *>(sums + 4), sumOddLo);
+		_mm_store_si128(reinterpret_cast<__m128i *>(sums + 6), sumOddHi);
+		//Sample index within the vector for each entry in sums.
+		const int sumLanes[8] = { 0, 2, 4, 6, 1, 3, 5, 7 };
+		for (int lane = 0; lane < 8; lane++) {
+			uint32_t peakChannel = lane % channels;
+			stats.Peak[peakChannel] = (std::max)(stats.Peak[peakChannel], (int)peaks[lane]);
+			stats.SumOfSquares[sumLanes[lane] % channels] += sums[lane];
+		}
+		return end;
+	}
+
+	/// <summary>
+	/// Measures 8 float samples at a time. Only valid for channel counts that divide 4, so every vector lane always holds the same channel.
+	/// Returns the number of samples processed.
+	/// </summary>
+	size_t MeasureFloatSSE2(const float *pSamples, size_t sampleCount, uint32_t channels, FLOAT_BLOCK_STATS &stats) {
+		size_t end = sampleCount & ~(size_t)7;
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+		__m128 peak = _mm_setzero_ps();
+		//Squares are summed in float over one block, which is plenty of precision for a meter, and then added up in double.
+		__m128 sum0 = _mm_setzero_ps();
+		__m128 sum1 = _mm_setzero_ps();
+		for (size_t i = 0; i < end; i += 8) {
+			__m128 x0 = _mm_loadu_ps(pSamples + i);
+			__m128 x1 = _mm_loadu_ps(pSamples + i + 4);
+			peak = _mm_max_ps(peak, _mm_max_ps(_mm_and_ps(x0, absMask), _mm_and_ps(x1, absMask)));
+			sum0 = _mm_add_ps(sum0, _mm_mul_ps(x0, x0));
+			sum1 = _mm_add_ps(sum1, _mm_mul_ps(x1, x1));
+		}
+		alignas(16) float peaks[4];
+		alignas(16) float sums[4];
+		_mm_store_ps(peaks, peak);
+		_mm_store_ps(sums, _mm_add_ps(sum0, sum1));
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			uint32_t channel = lane % channels;
+			stats.Peak[channel] = (std::max)(stats.Peak[channel], peaks[lane]);
+			stats.SumOfSquares[channel] += sums[lane];
+		}
+		return end;
+	}
+#endif
+}
+
+AudioLevelMeter::AudioLevelMeter() :
+	m_SampleRate(0),
+	m_Channels(0),
+	m_SimdLevel(SimdLevel::Scalar),
+	m_SmoothedVolume(0),
+	m_Sequence(0),
+	m_Volume(0),
+	m_BlockCount(0)
+{
+	for (int c = 0; c < AUDIO_METER_MAX_CHANNELS; c++) {
+		m_Peak[c].store(0, std::memory_order_relaxed);
+		m_Rms[c].store(0, std::memory_order_relaxed);
+	}
+}
+
+AudioLevelMeter::~AudioLevelMeter()
+{
+}
+
+void AudioLevelMeter::Initialize(_In_ uint32_t sampleRate, _In_ uint32_t channels, _In_ SimdLevel level)
+{
+	m_SampleRate = sampleRate;
+	m_Channels = channels;
+	m_SimdLevel = ResolveSimdLevel(level);
+	Reset();
+}
+
+void AudioLevelMeter::Reset()
+{
+	uint32_t sequence = m_Sequence.load(std::memory_order_relaxed);
+	m_Sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	for (int c = 0; c < AUDIO_METER_MAX_CHANNELS; c++) {
+		m_Peak[c].store(0, std::memory_order_relaxed);
+		m_Rms[c].store(0, std::memory_order_relaxed);
+	}
+	m_Volume.store(0, std::memory_order_relaxed);
+	m_BlockCount.store(0, std::memory_order_relaxed);
+	m_Sequence.store(sequence + 2, std::memory_order_release);
+	m_SmoothedVolume = 0;
+}
+
+void AudioLevelMeter::Process(_In_reads_(sampleCount) const int16_t *pSamples, _In_ size_t sampleCount)
+{
+	if (m_Channels == 0 || m_SampleRate == 0) {
+		return;
+	}
+	size_t frames = sampleCount / m_Channels;
+	sampleCount = frames * m_Channels;
+	if (frames == 0) {
+		return;
+	}
+	BLOCK_STATS stats{};
+	size_t vectorEnd = 0;
+#if SIMD_X86
+	if (m_SimdLevel >= SimdLevel::SSE2 && 8 % m_Channels == 0) {
+		vectorEnd = MeasureSSE2(pSamples, sampleCount, m_Channels, stats);
+	}
+#endif
+	MeasureScalar(pSamples, vectorEnd, sampleCount, m_Channels, stats);
+	float peaks[AUDIO_METER_MAX_CHANNELS];
+	double sumOfSquares[AUDIO_METER_MAX_CHANNELS];
+	for (int c = 0; c < AUDIO_METER_MAX_CHANNELS; c++) {
+		peaks[c] = stats.Peak[c] / 32767.0f;
+		sumOfSquares[c] = stats.SumOfSquares[c] / (32768.0 * 32768.0);
+	}
+	Publish(peaks, sumOfSquares, frames);
+}
+
+void AudioLevelMeter::Process(_In_reads_(sampleCount) const float *pSamples, _In_ size_t sampleCount)
+{
+	if (m_Channels == 0 || m_SampleRate == 0) {
+		return;
+	}
+	size_t frames = sampleCount / m_Channels;
+	sampleCount = frames * m_Channels;
+	if (frames == 0) {
+		return;
+	}
+	FLOAT_BLOCK_STATS stats{};
+	size_t vectorEnd = 0;
+#if SIMD_X86
+	if (m_SimdLevel >= SimdLevel::SSE2 && 4 % m_Channels == 0) {
+		vectorEnd = MeasureFloatSSE2(pSamples, sampleCount, m_Channels, stats);
+	}
+#endif
+	MeasureFloatScalar(pSamples, vectorEnd, sampleCount, m_Channels, stats);
+	Publish(stats.Peak, stats.SumOfSquares, frames);
+}
+
+void AudioLevelMeter::ProcessSilence(_In_ size_t sampleCount)
+{
+	if (m_Channels == 0 || m_SampleRate == 0) {
+		return;
+	}
+	size_t frames = sampleCount / m_Channels;
+	if (frames == 0) {
+		return;
+	}
+	FLOAT_BLOCK_STATS stats{};
+	Publish(stats.Peak, stats.SumOfSquares, frames);
+}
+
+void AudioLevelMeter::Publish(_In_reads_(AUDIO_METER_MAX_CHANNELS) const float *pPeaks, _In_reads_(AUDIO_METER_MAX_CHANNELS) const double *pSumOfSquares, _In_ size_t frames)
+{
+	uint32_t meteredChannels = (std::min)(m_Channels, (uint32_t)AUDIO_METER_MAX_CHANNELS);
+	double totalSumOfSquares = 0;
+	for (uint32_t c = 0; c < meteredChannels; c++) {
+		totalSumOfSquares += pSumOfSquares[c];
+	}
+	//Instant attack, and a release of 5% per 2.5 ms window, matching the previous volume indicator behavior.
+	//The volume is kept in 16 bit sample units.
+	float overallRms = (float)(sqrt(totalSumOfSquares / ((double)frames * meteredChannels)) * 32768.0);
+	if (overallRms > m_SmoothedVolume) {
+		m_SmoothedVolume = overallRms;
+	}
+	else {
+		double windows = (double)frames / (std::max)(1u, m_SampleRate / 400);
+		float keep = (float)pow(0.95, windows);
+		m_SmoothedVolume = overallRms * (1.0f - keep) + m_SmoothedVolume * keep;
+	}
+
+	uint32_t sequence = m_Sequence.load(std::memory_order_relaxed);
+	m_Sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	for (uint32_t c = 0; c < meteredChannels; c++) {
+		m_Peak[c].store(pPeaks[c], std::memory_order_relaxed);
+		m_Rms[c].store((float)sqrt(pSumOfSquares[c] / frames), std::memory_order_relaxed);
+	}
+	m_Volume.store((int)m_SmoothedVolume, std::memory_order_relaxed);
+	m_BlockCount.store(m_BlockCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	m_Sequence.store(sequence + 2, std::memory_order_release);
+}
+
+AUDIO_LEVELS AudioLevelMeter::GetLevels() const
+{
+	AUDIO_LEVELS levels{};
+	while (true) {
+		uint32_t before = m_Sequence.load(std::memory_order_acquire);
+		if (before & 1) {
+			std::this_thread::yield();
+			continue;
+		}
+		levels.Channels = (std::min)(m_Channels, (uint32_t)AUDIO_METER_MAX_CHANNELS);
+		for (int c = 0; c < AUDIO_METER_MAX_CHANNELS; c++) {
+			levels.Peak[c] = m_Peak[c].load(std::memory_order_relaxed);
+			levels.Rms[c] = m_Rms[c].load(std::memory_order_relaxed);
+		}
+		levels.Volume = m_Volume.load(std::memory_order_relaxed);
+		levels.BlockCount = m_BlockCount.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (m_Sequence.load(std::memory_order_relaxed) == before) {
+			return levels;
+		}
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <sal.h>
+#include "Simd.util.h"
+
+#define AUDIO_METER_MAX_CHANNELS 8
+
+/// <summary>
+/// A snapshot of the audio levels of one stream.
+/// </summary>
+struct AUDIO_LEVELS {
+	uint32_t Channels;
+	//Highest absolute sample value in the last processed block per channel, where 1.0 is full scale. Float audio can exceed 1.0.
+	float Peak[AUDIO_METER_MAX_CHANNELS];
+	//Root mean square of the last processed block per channel, where 1.0 is full scale.
+	float Rms[AUDIO_METER_MAX_CHANNELS];
+	//Overall level in 16 bit sample units, with instant attack and slow release. Suitable for driving a volume indicator.
+	int Volume;
+	//The number of blocks processed since the meter was reset.
+	uint64_t BlockCount;
+};
+
+/// <summary>
+/// Computes per channel peak and RMS levels from interleaved 16 bit or 32 bit float PCM.
+/// Process is meant to be called by a single thread as audio is ingested. GetLevels can be called from any thread at any time,
+/// and returns a consistent snapshot of the last processed block without blocking the writer.
+/// </summary>
+class AudioLevelMeter
+{
+public:
+	AudioLevelMeter();
+	~AudioLevelMeter();
+	void Initialize(_In_ uint32_t sampleRate, _In_ uint32_t channels, _In_ SimdLevel level = SimdLevel::Auto);
+	/// <summary>
+	/// Measures a block of interleaved samples and publishes the result. Channels beyond AUDIO_METER_MAX_CHANNELS are ignored.
+	/// </summary>
+	void Process(_In_reads_(sampleCount) const int16_t *pSamples, _In_ size_t sampleCount);
+	void Process(_In_reads_(sampleCount) const float *pSamples, _In_ size_t sampleCount);
+	/// <summary>
+	/// Publishes the levels of a block of silence, without reading any samples. The volume decays the same as if zeros were processed.
+	/// </summary>
+	void ProcessSilence(_In_ size_t sampleCount);
+	/// <summary>
+	/// Returns the levels of the last processed block.
+	/// </summary>
+	AUDIO_LEVELS GetLevels() const;
+	/// <summary>
+	/// Returns the smoothed overall level of the last processed block.
+	/// </summary>
+	inline int GetVolume() const { return m_Volume.load(std::memory_order_relaxed); }
+	void Reset();
+private:
+	uint32_t m_SampleRate;
+	uint32_t m_Channels;
+	SimdLevel m_SimdLevel;
+	float m_SmoothedVolume;
+
+	//Published snapshot, guarded by a sequence counter. The counter is odd while the writer updates the values.
+	std::atomic<uint32_t> m_Sequence;
+	std::atomic<float> m_Peak[AUDIO_METER_MAX_CHANNELS];
+	std::atomic<float> m_Rms[AUDIO_METER_MAX_CHANNELS];
+	std::atomic<int> m_Volume;
+	std::atomic<uint64_t> m_BlockCount;
+
+	/// <summary>
+	/// Publishes the levels of a block from its per channel peaks and sums of squares, relative to full scale.
+	/// </summary>
+	void Publish(_In_reads_(AUDIO_METER_MAX_CHANNELS) const float *pPeaks, _In_reads_(AUDIO_METER_MAX_CHANNELS) const double *pSumOfSquares, _In_ size_t frames);
+};
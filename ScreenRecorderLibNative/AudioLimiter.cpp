@@ -0,0 +1,307 @@
+#include "AudioLimiter.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+	//Frames the gain envelope is computed for at a time. The unity fast path is decided per chunk.
+	const size_t ChunkFrames = 256;
+	//The released gain snaps to the held gain once it is within 0.01 dB, an inaudible step that the moving average smooths out anyway,
+	//so it gets back to exactly unity and the fast path can take over.
+	const float ReleaseSnap = 1e-3f;
+
+	float PeakScalar(const float *pSamples, size_t start, size_t end, float peak) {
+		for (size_t i = start; i < end; i++) {
+			peak = (std::max)(peak, std::fabs(pSamples[i]));
+		}
+		return peak;
+	}
+
+	void ApplyGainsScalar(const float *pInput, float *pOutput, const float *pGains, size_t startFrame, size_t endFrame, UINT32 channels) {
+		for (size_t frame = startFrame; frame < endFrame; frame++) {
+			float gain = pGains[frame];
+			for (UINT32 channel = 0; channel < channels; channel++) {
+				size_t i = frame * channels + channel;
+				pOutput[i] = pInput[i] * gain;
+			}
+		}
+	}
+
+#if SIMD_X86
+	float PeakSSE2(const float *pSamples, size_t end) {
+		const __m128 signMask = _mm_set1_ps(-0.0f);
+		__m128 peak = _mm_setzero_ps();
+		for (size_t i = 0; i < end; i += 4) {
+			peak = _mm_max_ps(peak, _mm_andnot_ps(signMask, _mm_loadu_ps(pSamples + i)));
+		}
+		peak = _mm_max_ps(peak, _mm_movehl_ps(peak, peak));
+		peak = _mm_max_ss(peak, _mm_shuffle_ps(peak, peak, 1));
+		return _mm_cvtss_f32(peak);
+	}
+
+	SIMD_TARGET_AVX2 float PeakAVX2(const float *pSamples, size_t end) {
+		const __m256 signMask = _mm256_set1_ps(-0.0f);
+		__m256 peak = _mm256_setzero_ps();
+		for (size_t i = 0; i < end; i += 8) {
+			peak = _mm256_max_ps(peak, _mm256_andnot_ps(signMask, _mm256_loadu_ps(pSamples + i)));
+		}
+		__m128 half = _mm_max_ps(_mm256_castps256_ps128(peak), _mm256_extractf128_ps(peak, 1));
+		_mm256_zeroupper();
+		half = _mm_max_ps(half, _mm_movehl_ps(half, half));
+		half = _mm_max_ss(half, _mm_shuffle_ps(half, half, 1));
+		return _mm_cvtss_f32(half);
+	}
+
+	/// <summary>
+	/// Applies one gain per frame to mono or stereo audio, four frames at a time. Returns the number of frames done.
+	/// </summary>
+	size_t ApplyGainsSSE2(const float *pInput, float *pOutput, const float *pGains, size_t frames, UINT32 channels) {
+		size_t end = frames & ~(size_t)3;
+		if (channels == 1) {
+			for (size_t i = 0; i < end; i += 4) {
+				_mm_storeu_ps(pOutput + i, _mm_mul_ps(_mm_loadu_ps(pInput + i), _mm_loadu_ps(pGains + i)));
+			}
+		}
+		else {
+			for (size_t frame = 0; frame < end; frame += 4) {
+				__m128 gains = _mm_loadu_ps(pGains + frame);
+				const float *pIn = pInput + frame * 2;
+				float *pOut = pOutput + frame * 2;
+				//g0 g0 g1 g1 and g2 g2 g3 g3, to match the interleaved left and right samples.
+				_mm_storeu_ps(pOut, _mm_mul_ps(_mm_loadu_ps(pIn), _mm_unpacklo_ps(gains, gains)));
+				_mm_storeu_ps(pOut + 4, _mm_mul_ps(_mm_loadu_ps(pIn + 4), _mm_unpackhi_ps(gains, gains)));
+			}
+		}
+		return end;
+	}
+
+	SIMD_TARGET_AVX2 size_t ApplyGainsAVX2(const float *pInput, float *pOutput, const float *pGains, size_t frames, UINT32 channels) {
+		size_t end = frames & ~(size_t)7;
+		if (channels == 1) {
+			for (size_t i = 0; i < end; i += 8) {
+				_mm256_storeu_ps(pOutput + i, _mm256_mul_ps(_mm256_loadu_ps(pInput + i), _mm256_loadu_ps(pGains + i)));
+			}
+		}
+		else {
+			for (size_t frame = 0; frame < end; frame += 8) {
+				__m256 gains = _mm256_loadu_ps(pGains + frame);
+				//unpack works within 128 bit lanes, so the halves are put back in frame order afterwards.
+				__m256 low = _mm256_unpacklo_ps(gains, gains);
+				__m256 high = _mm256_unpackhi_ps(gains, gains);
+				const float *pIn = pInput + frame * 2;
+				float *pOut = pOutput + frame * 2;
+				_mm256_storeu_ps(pOut, _mm256_mul_ps(_mm256_loadu_ps(pIn), _mm256_permute2f128_ps(low, high, 0x20)));
+				_mm256_storeu_ps(pOut + 8, _mm256_mul_ps(_mm256_loadu_ps(pIn + 8), _mm256_permute2f128_ps(low, high, 0x31)));
+			}
+		}
+		_mm256_zeroupper();
+		return end;
+	}
+#endif
+}
+
+AudioLimiter::AudioLimiter() :
+	m_Channels(0),
+	m_SimdLevel(SimdLevel::Scalar),
+	m_Ceiling(1.0f),
+	m_ReleaseCoefficient(1.0f),
+	m_LookaheadFrames(0),
+	m_HeldGainsBegin(0),
+	m_HeldGainsCount(0),
+	m_AverageWindowPosition(0),
+	m_AverageSum(0),
+	m_ReleasedGain(1.0f),
+	m_Frame(0),
+	m_UnityFrames(0),
+	m_SilentFrames(0),
+	m_Stats{}
+{
+}
+
+AudioLimiter::~AudioLimiter()
+{
+}
+
+HRESULT AudioLimiter::Initialize(_In_ UINT32 sampleRate, _In_ UINT32 channels, _In_ const AUDIO_LIMITER_OPTIONS &options, _In_ SimdLevel level)
+{
+	if (sampleRate == 0 || channels == 0 || options.LookaheadMillis > MaxLookaheadMillis || !(options.Ceiling > 0.0f)) {
+		return E_INVALIDARG;
+	}
+	m_Channels = channels;
+	m_SimdLevel = ResolveSimdLevel(level);
+	m_Ceiling = options.Ceiling;
+	m_ReleaseCoefficient = options.ReleaseMillis > 0 ? (float)(1.0 - std::exp(-1000.0 / ((double)options.ReleaseMillis * sampleRate))) : 1.0f;
+	m_LookaheadFrames = (size_t)sampleRate * options.LookaheadMillis / 1000;
+	size_t windowFrames = m_LookaheadFrames + 1;
+	m_Delay.assign((m_LookaheadFrames + ChunkFrames) * channels, 0.0f);
+	m_Gains.assign(ChunkFrames, 1.0f);
+	m_HeldGains.assign(windowFrames + 1, HELD_GAIN{});
+	m_HeldGainsBegin = 0;
+	m_HeldGainsCount = 0;
+	m_AverageWindow.assign(windowFrames, 1.0f);
+	m_AverageWindowPosition = 0;
+	m_AverageSum = (double)windowFrames;
+	m_ReleasedGain = 1.0f;
+	m_Frame = 0;
+	m_UnityFrames = windowFrames;
+	m_SilentFrames = m_LookaheadFrames;
+	m_Stats = AUDIO_LIMITER_STATS{};
+	return S_OK;
+}
+
+void AudioLimiter::Process(_In_reads_opt_(sampleCount) const float *pInput, _Out_writes_(sampleCount) float *pOutput, _In_ size_t sampleCount)
+{
+	if (m_Channels == 0) {
+		return;
+	}
+	size_t frames = sampleCount / m_Channels;
+	size_t delaySamples = m_LookaheadFrames * m_Channels;
+	for (size_t done = 0; done < frames;) {
+		size_t chunkFrames = (std::min)(ChunkFrames, frames - done);
+		size_t chunkSamples = chunkFrames * m_Channels;
+		//The chunk goes in behind the delay line first, so pOutput may overwrite the input it has already taken.
+		float *pChunk = m_Delay.data() + delaySamples;
+		float peak = 0;
+		if (pInput) {
+			memcpy(pChunk, pInput + done * m_Channels, chunkSamples * sizeof(float));
+			size_t vectorEnd = 0;
+#if SIMD_X86
+			switch (m_SimdLevel) {
+				case SimdLevel::AVX2:
+					vectorEnd = chunkSamples & ~(size_t)7;
+					peak = PeakAVX2(pChunk, vectorEnd);
+					break;
+				case SimdLevel::SSE2:
+					vectorEnd = chunkSamples & ~(size_t)3;
+					peak = PeakSSE2(pChunk, vectorEnd);
+					break;
+				default:
+					break;
+			}
+#endif
+			peak = PeakScalar(pChunk, vectorEnd, chunkSamples, peak);
+		}
+		else {
+			memset(pChunk, 0, chunkSamples * sizeof(float));
+		}
+		m_SilentFrames = peak == 0.0f ? m_SilentFrames + chunkFrames : 0;
+		m_Stats.Frames += chunkFrames;
+		m_Stats.MaxInputPeak = (std::max)(m_Stats.MaxInputPeak, peak);
+
+		float *pChunkOutput = pOutput + done * m_Channels;
+		if (IsUnity() && peak <= m_Ceiling) {
+			//Nothing to limit, in the chunk or still in the delay line.
+			memcpy(pChunkOutput, m_Delay.data(), chunkSamples * sizeof(float));
+			m_UnityFrames += chunkFrames;
+			m_Frame += chunkFrames;
+		}
+		else {
+			ComputeGains(pChunk, chunkFrames);
+			ApplyGains(m_Delay.data(), pChunkOutput, chunkFrames);
+		}
+		memmove(m_Delay.data(), m_Delay.data() + chunkSamples, delaySamples * sizeof(float));
+		done += chunkFrames;
+	}
+}
+
+void AudioLimiter::SkipSilence(_In_ size_t sampleCount)
+{
+	if (m_Channels == 0) {
+		return;
+	}
+	size_t frames = sampleCount / m_Channels;
+	m_SilentFrames += frames;
+	m_Stats.Frames += frames;
+	m_Frame += frames;
+	//The gain of silence does not matter, so it is taken as fully recovered.
+	if (!IsUnity()) {
+		m_HeldGainsCount = 0;
+		std::fill(m_AverageWindow.begin(), m_AverageWindow.end(), 1.0f);
+		m_AverageSum = (double)m_AverageWindow.size();
+		m_ReleasedGain = 1.0f;
+		m_UnityFrames = m_AverageWindow.size();
+	}
+	else {
+		m_UnityFrames += frames;
+	}
+}
+
+void AudioLimiter::ComputeGains(_In_reads_(frames * m_Channels) const float *pInput, _In_ size_t frames)
+{
+	const size_t windowFrames = m_AverageWindow.size();
+	const size_t heldCapacity = m_HeldGains.size();
+	float minGain = 1.0f;
+	for (size_t i = 0; i < frames; i++) {
+		const float *pFrame = pInput + i * m_Channels;
+		float peak = 0;
+		for (UINT32 channel = 0; channel < m_Channels; channel++) {
+			peak = (std::max)(peak, std::fabs(pFrame[channel]));
+		}
+		UINT64 frame = m_Frame++;
+		//The gain that brings this frame down to the ceiling, held as long as it is in the window, unless a lower one comes along.
+		if (peak > m_Ceiling) {
+			float required = m_Ceiling / peak;
+			m_Stats.OverCeilingFrames++;
+			while (m_HeldGainsCount > 0 && m_HeldGains[(m_HeldGainsBegin + m_HeldGainsCount - 1) % heldCapacity].Gain >= required) {
+				m_HeldGainsCount--;
+			}
+			m_HeldGains[(m_HeldGainsBegin + m_HeldGainsCount) % heldCapacity] = HELD_GAIN{ required, frame };
+			m_HeldGainsCount++;
+		}
+		while (m_HeldGainsCount > 0 && m_HeldGains[m_HeldGainsBegin].Frame + windowFrames <= frame) {
+			m_HeldGainsBegin = (m_HeldGainsBegin + 1) % heldCapacity;
+			m_HeldGainsCount--;
+		}
+		float held = m_HeldGainsCount > 0 ? m_HeldGains[m_HeldGainsBegin].Gain : 1.0f;
+		//Gain drops at once, and recovers with the release time.
+		if (held < m_ReleasedGain || held - m_ReleasedGain < ReleaseSnap) {
+			m_ReleasedGain = held;
+		}
+		else {
+			m_ReleasedGain += (held - m_ReleasedGain) * m_ReleaseCoefficient;
+		}
+		//The moving average turns the steps of the held gain into ramps as long as the window. The output is delayed by the window,
+		//so every average that applies to a peak only covers gains held for that peak or lower, and the peak stays under the ceiling.
+		m_AverageSum += m_ReleasedGain - m_AverageWindow[m_AverageWindowPosition];
+		m_AverageWindow[m_AverageWindowPosition] = m_ReleasedGain;
+		m_AverageWindowPosition = m_AverageWindowPosition + 1 == windowFrames ? 0 : m_AverageWindowPosition + 1;
+		m_UnityFrames = m_ReleasedGain == 1.0f ? m_UnityFrames + 1 : 0;
+		float gain;
+		if (IsUnity()) {
+			//Resets the rounding errors the running sum picked up.
+			m_AverageSum = (double)windowFrames;
+			gain = 1.0f;
+		}
+		else {
+			gain = (std::min)((float)(m_AverageSum / windowFrames), 1.0f);
+		}
+		if (gain < 1.0f) {
+			m_Stats.LimitedFrames++;
+			minGain = (std::min)(minGain, gain);
+		}
+		m_Gains[i] = gain;
+	}
+	if (minGain < 1.0f) {
+		m_Stats.MaxGainReductionDb = (std::max)(m_Stats.MaxGainReductionDb, -20.0f * std::log10(minGain));
+	}
+}
+
+void AudioLimiter::ApplyGains(_In_reads_(frames * m_Channels) const float *pInput, _Out_writes_(frames * m_Channels) float *pOutput, _In_ size_t frames)
+{
+	size_t vectorEnd = 0;
+#if SIMD_X86
+	if (m_Channels <= 2) {
+		switch (m_SimdLevel) {
+			case SimdLevel::AVX2:
+				vectorEnd = ApplyGainsAVX2(pInput, pOutput, m_Gains.data(), frames, m_Channels);
+				break;
+			case SimdLevel::SSE2:
+				vectorEnd = ApplyGainsSSE2(pInput, pOutput, m_Gains.data(), frames, m_Channels);
+				break;
+			default:
+				break;
+		}
+	}
+#endif
+	ApplyGainsScalar(pInput, pOutput, m_Gains.data(), vectorEnd, frames, m_Channels);
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <windows.h>
+#include <vector>
+#include <sal.h>
+#include "Simd.util.h"
+
+struct AUDIO_LIMITER_OPTIONS {
+	//The highest peak the limiter lets through, as a linear level where 1.0 is full scale. The default is -0.3 dBFS, which leaves room for dither.
+	float Ceiling = 0.966f;
+	//How far ahead the limiter looks for peaks. Gain is reduced gradually over this time before a peak, and the audio is delayed by as much.
+	//At most MaxLookaheadMillis.
+	UINT32 LookaheadMillis = 5;
+	//The time for the gain to recover by about two thirds once the peaks are gone.
+	UINT32 ReleaseMillis = 100;
+};
+
+struct AUDIO_LIMITER_STATS {
+	//Frames processed by the limiter, and those of them it reduced the gain on.
+	UINT64 Frames;
+	UINT64 LimitedFrames;
+	//Frames that had a peak above the ceiling on the way in, and would have clipped without the limiter.
+	UINT64 OverCeilingFrames;
+	//The largest gain reduction applied, in dB. 0 if the limiter never had to act.
+	float MaxGainReductionDb;
+	//The highest peak seen on the way in, as a linear level.
+	float MaxInputPeak;
+	//Samples that still clipped when converted for the encoder. Counted by whoever does the conversion, not by the limiter.
+	UINT64 ClippedSamples;
+};
+
+/// <summary>
+/// A streaming lookahead peak limiter, the last stage before the float audio is converted for the encoder.
+/// For each frame it works out the gain that keeps the frame under the ceiling, holds the lowest of those gains over the lookahead window,
+/// lets it recover with the release time, and smooths it with a moving average over the window. Because the audio is delayed by the window,
+/// the gain has ramped down by the time a peak comes out, so no sample exceeds the ceiling and there are no hard clipped edges.
+/// Peak detection and applying the gain are vectorized. While the audio stays below the ceiling and the gain is back to unity,
+/// the envelope is skipped and the limiter only delays the audio.
+/// </summary>
+class AudioLimiter
+{
+public:
+	//The longest lookahead, and so the longest delay, the limiter can be set to.
+	static const UINT32 MaxLookaheadMillis = 20;
+
+	AudioLimiter();
+	~AudioLimiter();
+	/// <summary>
+	/// Sets the format and settings, and clears the delay line and statistics.
+	/// </summary>
+	HRESULT Initialize(_In_ UINT32 sampleRate, _In_ UINT32 channels, _In_ const AUDIO_LIMITER_OPTIONS &options, _In_ SimdLevel level = SimdLevel::Auto);
+	/// <summary>
+	/// Limits sampleCount interleaved samples from pInput into pOutput, which may be the same buffer. The output lags the input by GetLatencyFrames.
+	/// A null pInput is taken as silence, which pushes the audio still in the delay line out.
+	/// </summary>
+	void Process(_In_reads_opt_(sampleCount) const float *pInput, _Out_writes_(sampleCount) float *pOutput, _In_ size_t sampleCount);
+	/// <summary>
+	/// Accounts for sampleCount samples of silence without producing them. Only valid while IsIdle returns true, when the output would be silence too.
+	/// </summary>
+	void SkipSilence(_In_ size_t sampleCount);
+	/// <summary>
+	/// True if the delay line only holds silence, so silent input would give silent output.
+	/// </summary>
+	inline bool IsIdle() const { return m_SilentFrames >= m_LookaheadFrames; }
+	inline size_t GetLatencyFrames() const { return m_LookaheadFrames; }
+	inline AUDIO_LIMITER_STATS GetStats() const { return m_Stats; }
+private:
+	struct HELD_GAIN {
+		float Gain;
+		UINT64 Frame;
+	};
+
+	UINT32 m_Channels;
+	SimdLevel m_SimdLevel;
+	float m_Ceiling;
+	float m_ReleaseCoefficient;
+	size_t m_LookaheadFrames;
+	//The delay line, followed by room for one chunk of input.
+	std::vector<float> m_Delay;
+	//The gain for each frame of the current chunk.
+	std::vector<float> m_Gains;
+	//Gains below unity still inside the lookahead window, ascending by frame and by gain, so the first is the lowest. A ring buffer of one window.
+	std::vector<HELD_GAIN> m_HeldGains;
+	size_t m_HeldGainsBegin;
+	size_t m_HeldGainsCount;
+	//The gains after the release, for the moving average over the window.
+	std::vector<float> m_AverageWindow;
+	size_t m_AverageWindowPosition;
+	double m_AverageSum;
+	float m_ReleasedGain;
+	UINT64 m_Frame;
+	//How many of the most recent frames had a released gain of exactly 1. Once the whole window has, the envelope is at unity.
+	size_t m_UnityFrames;
+	//How many of the most recent input frames were silence.
+	size_t m_SilentFrames;
+	AUDIO_LIMITER_STATS m_Stats;
+
+	inline bool IsUnity() const { return m_UnityFrames > m_LookaheadFrames; }
+	void ComputeGains(_In_reads_(frames * m_Channels) const float *pInput, _In_ size_t frames);
+	void ApplyGains(_In_reads_(frames * m_Channels) const float *pInput, _Out_writes_(frames * m_Channels) float *pOutput, _In_ size_t frames);
+};
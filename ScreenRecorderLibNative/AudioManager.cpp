@@ -2,152 +2,488 @@
 #include "cleanup.h"
 
 using namespace std;
+
+namespace {
+	//How long a capture may take to start before it is given up on.
+	const DWORD CaptureStartTimeoutMillis = 5000;
+	//How long to wait before trying again to start a capture that failed, e.g. because the device is missing.
+	const std::chrono::milliseconds CaptureRetryInterval(2000);
+}
+
 AudioManager::AudioManager() :
 	m_AudioOptions(nullptr),
-	m_IsCaptureEnabled(false)
+	m_CaptureEndedCount(0),
+	m_BufferCounters{},
+	m_IsLimiterEnabled(false),
+	m_ClippedSamples(0),
+	m_IsMixedTrackEnabled(true),
+	m_IsCaptureEnabled(false),
+	m_AppliedOptionsVersion(0),
+	m_AppliedDeviceChangeCount(0),
+	m_HasPendingCaptures(false),
+	m_NextRetryTime((std::chrono::steady_clock::time_point::max)())
 {
 	InitializeCriticalSection(&m_CriticalSection);
 }
 
 AudioManager::~AudioManager()
 {
+	if (m_DeviceNotifier) {
+		m_DeviceNotifier->Unregister();
+	}
 	DeleteCriticalSection(&m_CriticalSection);
 }
 
 HRESULT AudioManager::Initialize(_In_ std::shared_ptr<AUDIO_OPTIONS> &audioOptions)
 {
 	m_AudioOptions = audioOptions;
-	return ConfigureAudioCapture();
+	RETURN_ON_BAD_HR(m_Graph.Initialize(GetAudioOptions()->GetAudioSamplesPerSecond(), GetAudioOptions()->GetAudioChannels()));
+	m_IsLimiterEnabled = GetAudioOptions()->IsLimiterEnabled();
+	AUDIO_LIMITER_OPTIONS limiterOptions;
+	limiterOptions.LookaheadMillis = (std::min)(GetAudioOptions()->GetLimiterLookaheadMillis(), (UINT32)AudioLimiter::MaxLookaheadMillis);
+	m_IsMixedTrackEnabled = GetAudioOptions()->IsMixedAudioTrackEnabled();
+	std::vector<size_t> trackDevices = GetAudioOptions()->GetSeparateAudioTrackDevices();
+	if (m_IsMixedTrackEnabled) {
+		trackDevices.insert(trackDevices.begin(), MixedTrack);
+	}
+	m_Tracks.clear();
+	for (size_t deviceIndex : trackDevices) {
+		auto pTrack = make_unique<AUDIO_TRACK>();
+		pTrack->DeviceIndex = deviceIndex;
+		if (m_IsLimiterEnabled) {
+			RETURN_ON_BAD_HR(pTrack->Limiter.Initialize(GetAudioOptions()->GetAudioSamplesPerSecond(), GetAudioOptions()->GetAudioChannels(), limiterOptions));
+		}
+		m_Tracks.push_back(std::move(pTrack));
+	}
+	size_t deviceTrackCount = m_Tracks.size() - (m_IsMixedTrackEnabled ? 1 : 0);
+	m_DeviceTrackNodeIds.assign(deviceTrackCount, 0);
+	m_DeviceTrackOutputs.assign(deviceTrackCount, AUDIO_GRAPH_OUTPUT{});
+	m_ClippedSamples = 0;
+	m_CaptureDevices.clear();
+	if (!m_DeviceNotifier) {
+		m_DeviceNotifier = new (std::nothrow) AudioDeviceNotifier();
+		//Without notifications, captures still restart when they end, but do not follow the default device.
+		if (m_DeviceNotifier && FAILED(m_DeviceNotifier->Register())) {
+			LOG_WARN(L"Audio device changes will not be detected");
+		}
+	}
+	return ConfigureAudioCapture(true);
 }
 
 void AudioManager::ClearRecordedBytes()
 {
-	if (m_LoopbackCaptureOutputDevice)
-		m_LoopbackCaptureOutputDevice->ClearRecordedBytes();
-	if (m_LoopbackCaptureInputDevice)
-		m_LoopbackCaptureInputDevice->ClearRecordedBytes();
+	for (AUDIO_CAPTURE_DEVICE &device : m_CaptureDevices) {
+		if (device.Capture)
+			device.Capture->ClearRecordedBytes();
+	}
+	m_Graph.Clear();
 }
 
 HRESULT AudioManager::StartCapture() {
 	m_IsCaptureEnabled = true;
-	return ConfigureAudioCapture();
+	return ConfigureAudioCapture(true);
 }
 
 HRESULT AudioManager::StopCapture()
 {
+	AUDIO_BUFFER_COUNTERS counters = GetBufferCounters();
+	if (counters.Frames > 0) {
+		LOG_DEBUG(L"Audio buffers: %llu frames (%llu silent), %.2f allocations, %.2f copies and %.0f bytes copied per frame", counters.Frames, counters.SilentFrames, (double)counters.Allocations / counters.Frames, (double)counters.Copies / counters.Frames, (double)counters.BytesCopied / counters.Frames);
+		if (counters.AudioHundredNanos > 0) {
+			LOG_DEBUG(L"Audio processing: %.3f ms per second of audio", (double)counters.ProcessingHundredNanos / counters.AudioHundredNanos * 1000);
+		}
+	}
+	AUDIO_LIMITER_STATS limiterStats = GetLimiterStats();
+	if (limiterStats.OverCeilingFrames > 0 || limiterStats.ClippedSamples > 0) {
+		LOG_INFO(L"Audio peaks: %llu of %llu frames over the ceiling, up to %.1f dB reduced by the limiter on %llu frames, %llu samples clipped",
+			limiterStats.OverCeilingFrames, limiterStats.Frames, limiterStats.MaxGainReductionDb, limiterStats.LimitedFrames, limiterStats.ClippedSamples);
+	}
 	m_IsCaptureEnabled = false;
-	return ConfigureAudioCapture();
+	return ConfigureAudioCapture(true);
 }
 
-HRESULT AudioManager::ConfigureAudioCapture()
+HRESULT AudioManager::ConfigureAudioCapture(_In_ bool isBlocking)
 {
+	if (!m_AudioOptions) {
+		return S_FALSE;
+	}
+	//Read before the options, so a change made while configuring is picked up on the next frame.
+	m_AppliedOptionsVersion = GetAudioOptions()->GetChangeVersion();
+	m_AppliedDeviceChangeCount = GetDeviceChangeCount();
+	std::vector<std::wstring> deviceNames = GetCaptureDeviceNames();
+	//Additional input devices can come and go while recording. Their nodes are removed before the captures feeding them are stopped.
+	while (m_CaptureDevices.size() > deviceNames.size()) {
+		AUDIO_CAPTURE_DEVICE &device = m_CaptureDevices.back();
+		if (device.NodeId != 0) {
+			m_Graph.RemoveSource(device.NodeId);
+		}
+		LOG_DEBUG(L"Removed audio capture %ls", device.Tag.c_str());
+		m_CaptureDevices.pop_back();
+	}
+	while (m_CaptureDevices.size() < deviceNames.size()) {
+		AUDIO_CAPTURE_DEVICE device;
+		size_t index = m_CaptureDevices.size();
+		device.Flow = index == OutputDeviceIndex ? eRender : eCapture;
+		device.Tag = index == OutputDeviceIndex ? L"AudioOutputDevice" : index == InputDeviceIndex ? L"AudioInputDevice" : L"AudioInputDevice" + std::to_wstring(index);
+		m_CaptureDevices.push_back(std::move(device));
+	}
+
 	HRESULT hr = S_FALSE;
-	if (GetAudioOptions()->IsAudioEnabled() && GetAudioOptions()->IsOutputDeviceEnabled() && m_IsCaptureEnabled)
-	{
-		if (!m_LoopbackCaptureOutputDevice) {
-			m_LoopbackCaptureOutputDevice = make_unique<LoopbackCapture>(L"AudioOutputDevice");
-			LOG_DEBUG("Created audio capture AudioOutputDevice");
+	m_HasPendingCaptures = false;
+	m_NextRetryTime = (std::chrono::steady_clock::time_point::max)();
+	for (size_t i = 0; i < m_CaptureDevices.size(); i++) {
+		AUDIO_CAPTURE_DEVICE &device = m_CaptureDevices[i];
+		bool isEnabled = IsCaptureDeviceEnabled(i);
+		HRESULT deviceHr = ConfigureCaptureDevice(device, deviceNames[i], isEnabled, GetCaptureDeviceVolume(i), isBlocking);
+		if (deviceHr != S_FALSE) {
+			hr = deviceHr;
 		}
-		if (!m_LoopbackCaptureOutputDevice->IsCapturing()) {
-			hr = m_LoopbackCaptureOutputDevice->StartCapture(GetAudioOptions()->GetAudioSamplesPerSecond(), GetAudioOptions()->GetAudioChannels(), GetAudioOptions()->GetAudioOutputDevice(), eRender);
-			if (SUCCEEDED(hr)) {
-				LOG_DEBUG("Started audio capture on AudioOutputDevice");
-			}
+		if (device.PendingCapture) {
+			m_HasPendingCaptures = true;
 		}
-	}
-	else {
-		if (m_LoopbackCaptureOutputDevice && m_LoopbackCaptureOutputDevice->IsCapturing()) {
-			m_LoopbackCaptureOutputDevice->StopCapture();
-			LOG_DEBUG("Stopped audio capture on AudioOutputDevice");
+		else if (isEnabled && !(device.Capture && device.Capture->IsCapturing())) {
+			m_NextRetryTime = (std::min)(m_NextRetryTime, device.RetryTime);
 		}
 	}
+	return hr;
+}
 
-	if (GetAudioOptions()->IsAudioEnabled() && GetAudioOptions()->IsInputDeviceEnabled() && m_IsCaptureEnabled)
+HRESULT AudioManager::ConfigureCaptureDevice(_Inout_ AUDIO_CAPTURE_DEVICE &device, _In_ const std::wstring &deviceName, _In_ bool isEnabled, _In_ float volume, _In_ bool isBlocking)
+{
+	HRESULT hr = S_FALSE;
+	if (isEnabled)
 	{
-		if (!m_LoopbackCaptureInputDevice) {
-			m_LoopbackCaptureInputDevice = make_unique<LoopbackCapture>(L"AudioInputDevice");
-			LOG_DEBUG("Created audio capture AudioInputDevice");
+		if (device.PendingCapture) {
+			if (device.PendingDevice != deviceName) {
+				//The device was changed again before the last change took effect.
+				device.PendingCapture.reset();
+			}
+			else {
+				hr = CompletePendingCapture(device, isBlocking ? CaptureStartTimeoutMillis : 0);
+			}
 		}
-		if (!m_LoopbackCaptureInputDevice->IsCapturing()) {
-			hr = m_LoopbackCaptureInputDevice->StartCapture(GetAudioOptions()->GetAudioSamplesPerSecond(), GetAudioOptions()->GetAudioChannels(), GetAudioOptions()->GetAudioInputDevice(), eCapture);
+		if (!device.PendingCapture
+			&& IsCaptureRestartRequired(device, deviceName)
+			&& (isBlocking || std::chrono::steady_clock::now() >= device.RetryTime)) {
+			hr = BeginPendingCapture(device, deviceName);
 			if (SUCCEEDED(hr)) {
-				LOG_DEBUG("started audio capture on AudioInputDevice");
+				hr = CompletePendingCapture(device, isBlocking ? CaptureStartTimeoutMillis : 0);
 			}
 		}
 	}
 	else {
-		if (m_LoopbackCaptureInputDevice && m_LoopbackCaptureInputDevice->IsCapturing()) {
-			m_LoopbackCaptureInputDevice->StopCapture();
-			LOG_DEBUG("Stopped audio capture on AudioInputDevice");
+		device.PendingCapture.reset();
+		if (device.Capture && device.Capture->IsCapturing()) {
+			device.Capture->StopCapture();
+			LOG_DEBUG(L"Stopped audio capture on %ls", device.Tag.c_str());
 		}
 	}
+	if (device.NodeId != 0) {
+		//A volume of 0 mutes the node, so it is skipped when mixing instead of being mixed at zero gain.
+		m_Graph.SetSourceGain(device.NodeId, volume);
+		m_Graph.SetSourceMuted(device.NodeId, volume == 0.0f);
+	}
 	return hr;
 }
 
-std::vector<BYTE> AudioManager::GrabAudioFrame(_In_ UINT64 durationHundredNanos)
+HRESULT AudioManager::BeginPendingCapture(_Inout_ AUDIO_CAPTURE_DEVICE &device, _In_ const std::wstring &deviceName)
+{
+	auto pCapture = make_unique<LoopbackCapture>(device.Tag);
+	pCapture->SetCaptureEndedCallback([this]() { m_CaptureEndedCount.fetch_add(1, std::memory_order_release); });
+	AUDIO_CAPTURE_TIMING timing;
+	timing.BufferMillis = GetAudioOptions()->GetCaptureBufferMillis();
+	timing.WakeMode = GetAudioOptions()->GetCaptureWakeMode();
+	timing.WakeIntervalMillis = GetAudioOptions()->GetCaptureWakeIntervalMillis();
+	pCapture->SetCaptureTiming(timing);
+	device.PendingDevice = deviceName;
+	device.PendingDefaultDeviceChangeCount = GetDefaultDeviceChangeCount(device.Flow);
+	device.PendingStartTime = std::chrono::steady_clock::now();
+	HRESULT hr = pCapture->BeginStartCapture(GetAudioOptions()->GetAudioSamplesPerSecond(), GetAudioOptions()->GetAudioChannels(), deviceName, device.Flow);
+	if (FAILED(hr)) {
+		LOG_ERROR(L"Failed to start audio capture on %ls: hr = 0x%08x", device.Tag.c_str(), hr);
+		device.RetryTime = device.PendingStartTime + CaptureRetryInterval;
+		return hr;
+	}
+	device.PendingCapture = std::move(pCapture);
+	return S_OK;
+}
+
+HRESULT AudioManager::CompletePendingCapture(_Inout_ AUDIO_CAPTURE_DEVICE &device, _In_ DWORD timeoutMillis)
+{
+	HRESULT hr = device.PendingCapture->WaitForCaptureStarted(timeoutMillis);
+	auto now = std::chrono::steady_clock::now();
+	if (hr == S_FALSE) {
+		if (now - device.PendingStartTime < std::chrono::milliseconds(CaptureStartTimeoutMillis)) {
+			return S_FALSE;
+		}
+		LOG_ERROR(L"Timed out when starting audio capture on %ls", device.Tag.c_str());
+		hr = E_FAIL;
+	}
+	if (FAILED(hr)) {
+		device.PendingCapture.reset();
+		device.RetryTime = now + CaptureRetryInterval;
+		return hr;
+	}
+	//Audio captured while the old capture was still being mixed would be heard twice.
+	device.PendingCapture->ClearRecordedBytes();
+	UINT32 sampleRate = GetAudioOptions()->GetAudioSamplesPerSecond();
+	UINT32 channels = GetAudioOptions()->GetAudioChannels();
+	//The capture resamples to the output format itself, with drift compensation, so the node does not need to adapt it.
+	if (device.NodeId == 0) {
+		RETURN_ON_BAD_HR(m_Graph.AddSource(device.PendingCapture.get(), sampleRate, channels, AUDIO_GRAPH_SOURCE_OPTIONS{}, &device.NodeId));
+		LOG_DEBUG(L"Started audio capture on %ls", device.Tag.c_str());
+	}
+	else {
+		//The node keeps its settings and the audio it holds, so the mix carries on across the swap.
+		RETURN_ON_BAD_HR(m_Graph.ReplaceSource(device.NodeId, device.PendingCapture.get(), sampleRate, channels));
+		LOG_INFO(L"Swapped audio capture on %ls to %ls", device.Tag.c_str(), device.PendingDevice.empty() ? L"the default device" : device.PendingDevice.c_str());
+	}
+	device.Capture = std::move(device.PendingCapture);
+	device.Device = device.PendingDevice;
+	device.DefaultDeviceChangeCount = device.PendingDefaultDeviceChangeCount;
+	return S_OK;
+}
+
+bool AudioManager::IsCaptureRestartRequired(_In_ const AUDIO_CAPTURE_DEVICE &device, _In_ const std::wstring &deviceName)
+{
+	if (!device.Capture || !device.Capture->IsCapturing() || device.Device != deviceName) {
+		return true;
+	}
+	//A capture on the default device follows it when it changes.
+	return deviceName.empty() && device.DefaultDeviceChangeCount != GetDefaultDeviceChangeCount(device.Flow);
+}
+
+bool AudioManager::IsCaptureConfigurationOutdated()
+{
+	return GetAudioOptions()->GetChangeVersion() != m_AppliedOptionsVersion
+		|| GetDeviceChangeCount() != m_AppliedDeviceChangeCount
+		|| m_HasPendingCaptures
+		|| (m_NextRetryTime != (std::chrono::steady_clock::time_point::max)() && std::chrono::steady_clock::now() >= m_NextRetryTime);
+}
+
+std::vector<std::wstring> AudioManager::GetCaptureDeviceNames()
+{
+	std::vector<std::wstring> deviceNames = { GetAudioOptions()->GetAudioOutputDevice(), GetAudioOptions()->GetAudioInputDevice() };
+	std::vector<std::wstring> additionalInputDevices = GetAudioOptions()->GetAdditionalInputDevices();
+	deviceNames.insert(deviceNames.end(), additionalInputDevices.begin(), additionalInputDevices.end());
+	return deviceNames;
+}
+
+UINT64 AudioManager::GetDeviceChangeCount()
+{
+	UINT64 count = m_CaptureEndedCount.load(std::memory_order_acquire);
+	if (m_DeviceNotifier) {
+		count += m_DeviceNotifier->GetChangeCount();
+	}
+	return count;
+}
+
+UINT64 AudioManager::GetDefaultDeviceChangeCount(_In_ EDataFlow flow)
+{
+	return m_DeviceNotifier ? m_DeviceNotifier->GetDefaultDeviceChangeCount(flow) : 0;
+}
+
+bool AudioManager::IsCaptureDeviceEnabled(_In_ size_t index)
+{
+	if (!GetAudioOptions()->IsAudioEnabled() || !m_IsCaptureEnabled) {
+		return false;
+	}
+	return index == OutputDeviceIndex ? GetAudioOptions()->IsOutputDeviceEnabled() : GetAudioOptions()->IsInputDeviceEnabled();
+}
+
+float AudioManager::GetCaptureDeviceVolume(_In_ size_t index)
+{
+	return index == OutputDeviceIndex ? GetAudioOptions()->GetOutputVolume() : GetAudioOptions()->GetInputVolume();
+}
+
+HRESULT AudioManager::GrabAudioTracks(_In_ UINT64 durationHundredNanos, _In_ UINT32 trackCount, _Out_writes_(trackCount) CComPtr<IMFMediaBuffer> *pAudioBuffers)
 {
+	for (UINT32 i = 0; i < trackCount; i++) {
+		pAudioBuffers[i].Release();
+	}
 	EnterCriticalSection(&m_CriticalSection);
 	LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
-	if (m_AudioOptions) {
-		ConfigureAudioCapture();
-	}
-	if (m_LoopbackCaptureOutputDevice && m_LoopbackCaptureInputDevice) {
-
-		auto returnAudioOverflowToBuffer = [&](auto &outputDeviceData, auto &inputDeviceData) {
-			if (outputDeviceData.size() > 0 && inputDeviceData.size() > 0) {
-				if (outputDeviceData.size() > inputDeviceData.size()) {
-					auto diff = outputDeviceData.size() - inputDeviceData.size();
-					std::vector<BYTE> overflow(outputDeviceData.end() - diff, outputDeviceData.end());
-					outputDeviceData.resize(outputDeviceData.size() - diff);
-					m_LoopbackCaptureOutputDevice->ReturnAudioBytesToBuffer(overflow);
-				}
-				else if (inputDeviceData.size() > outputDeviceData.size()) {
-					auto diff = inputDeviceData.size() - outputDeviceData.size();
-					std::vector<BYTE> overflow(inputDeviceData.end() - diff, inputDeviceData.end());
-					inputDeviceData.resize(inputDeviceData.size() - diff);
-					m_LoopbackCaptureInputDevice->ReturnAudioBytesToBuffer(overflow);
-				}
-			}
-		};
+	//Comparing the option version and device change count is all a frame costs when nothing changed.
+	if (m_AudioOptions && IsCaptureConfigurationOutdated()) {
+		ConfigureAudioCapture(false);
+	}
+	auto processingStart = std::chrono::steady_clock::now();
+	//Captured audio is float from here on, and only converted to the 16 bit encoder format at the very end.
+	AUDIO_GRAPH_OUTPUT mix{};
+	size_t deviceTrackCount = m_DeviceTrackNodeIds.size();
+	if (deviceTrackCount == 0) {
+		RETURN_ON_BAD_HR(m_Graph.Process(durationHundredNanos, &mix, &m_BufferCounters));
+	}
+	else {
+		//Each device track gets the audio of its node as is. The devices are only mixed if the mix is written as well.
+		//A device without a node gets silence. A disabled device keeps its node, and its track goes silent because the stopped capture delivers nothing.
+		for (size_t i = 0; i < deviceTrackCount; i++) {
+			size_t deviceIndex = m_Tracks[m_Tracks.size() - deviceTrackCount + i]->DeviceIndex;
+			m_DeviceTrackNodeIds[i] = deviceIndex < m_CaptureDevices.size() ? m_CaptureDevices[deviceIndex].NodeId : 0;
+		}
+		RETURN_ON_BAD_HR(m_Graph.ProcessSources(durationHundredNanos, m_DeviceTrackNodeIds.data(), deviceTrackCount, m_DeviceTrackOutputs.data(), m_IsMixedTrackEnabled ? &mix : nullptr, &m_BufferCounters));
+	}
+	size_t sampleCount = m_IsMixedTrackEnabled ? mix.SampleCount : m_DeviceTrackOutputs[0].SampleCount;
+	if (sampleCount == 0) {
+		return S_OK;
+	}
+	bool isAllSilent = true;
+	UINT32 tracks = (std::min)(trackCount, (UINT32)m_Tracks.size());
+	for (UINT32 i = 0; i < tracks; i++) {
+		const AUDIO_GRAPH_OUTPUT &audio = m_IsMixedTrackEnabled && i == 0 ? mix : m_DeviceTrackOutputs[i - (m_IsMixedTrackEnabled ? 1 : 0)];
+		bool isSilent;
+		RETURN_ON_BAD_HR(ConvertTrackAudio(*m_Tracks[i], audio, pAudioBuffers[i], &isSilent));
+		isAllSilent = isAllSilent && isSilent;
+	}
+	m_BufferCounters.Frames++;
+	if (isAllSilent) {
+		m_BufferCounters.SilentFrames++;
+	}
+	CountAudioProcessingTime(processingStart, sampleCount);
+	return S_OK;
+}
 
-		std::vector<BYTE> outputDeviceData = m_LoopbackCaptureOutputDevice->GetRecordedBytes(durationHundredNanos);
-		std::vector<BYTE> inputDeviceData = m_LoopbackCaptureInputDevice->GetRecordedBytes(durationHundredNanos);
-		returnAudioOverflowToBuffer(outputDeviceData, inputDeviceData);
-		if (inputDeviceData.size() > 0 && outputDeviceData.size() && inputDeviceData.size() != outputDeviceData.size()) {
-			LOG_ERROR(L"Mixing audio byte arrays with differing sizes");
+HRESULT AudioManager::ConvertTrackAudio(_Inout_ AUDIO_TRACK &track, _In_ const AUDIO_GRAPH_OUTPUT &audio, _Out_ CComPtr<IMFMediaBuffer> &pAudioBuffer, _Out_ bool *pIsSilent)
+{
+	size_t sampleCount = audio.SampleCount;
+	const float *pSamples = audio.pSamples;
+	bool isSilent = audio.IsSilent;
+	if (m_IsLimiterEnabled) {
+		if (isSilent && track.Limiter.IsIdle()) {
+			track.Limiter.SkipSilence(sampleCount);
+		}
+		else {
+			//Silence still has to go through, to push out the audio left in the limiter's delay line.
+			ResizeAudioBuffer(track.LimitedSamples, sampleCount * sizeof(float), &m_BufferCounters);
+			float *pLimited = reinterpret_cast<float *>(track.LimitedSamples.data());
+			track.Limiter.Process(isSilent ? nullptr : pSamples, pLimited, sampleCount);
+			pSamples = pLimited;
+			isSilent = false;
 		}
+	}
+	*pIsSilent = isSilent;
+	DWORD byteCount = (DWORD)(sampleCount * sizeof(int16_t));
+	CComPtr<PooledMediaBuffer> pBuffer;
+	if (isSilent) {
+		//The track is silent, so the frame is handed on as a length over the shared zero page.
+		RETURN_ON_BAD_HR(m_BufferPool.GetSilenceBuffer(byteCount, &pBuffer));
+	}
+	else {
+		RETURN_ON_BAD_HR(m_BufferPool.GetBuffer(byteCount, &pBuffer));
+		//The one conversion to the encoder format, written straight into the buffer that is handed to the sink writer.
+		//Clipping is counted rather than logged, as a loud recording would clip on every frame. With the limiter on, nothing should clip.
+		m_ClippedSamples += m_SampleConverter.ConvertToInt16(pSamples, reinterpret_cast<int16_t *>(pBuffer->GetData()), sampleCount);
+	}
+	pAudioBuffer = pBuffer;
+	return S_OK;
+}
 
-		return std::move(MixAudio(outputDeviceData, inputDeviceData, GetAudioOptions()->GetOutputVolume(), GetAudioOptions()->GetInputVolume()));
+void AudioManager::CountAudioProcessingTime(_In_ std::chrono::steady_clock::time_point processingStart, _In_ size_t sampleCount)
+{
+	auto elapsed = std::chrono::steady_clock::now() - processingStart;
+	m_BufferCounters.ProcessingHundredNanos += (UINT64)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / 100;
+	UINT32 channels = GetAudioOptions()->GetAudioChannels();
+	UINT32 sampleRate = GetAudioOptions()->GetAudioSamplesPerSecond();
+	if (channels > 0 && sampleRate > 0) {
+		m_BufferCounters.AudioHundredNanos += (UINT64)sampleCount * 10000000 / channels / sampleRate;
 	}
-	else if (m_LoopbackCaptureOutputDevice)
-		return std::move(MixAudio(m_LoopbackCaptureOutputDevice->GetRecordedBytes(durationHundredNanos), std::vector<BYTE>(), GetAudioOptions()->GetOutputVolume(), 1.0));
-	else if (m_LoopbackCaptureInputDevice)
-		return std::move(MixAudio(std::vector<BYTE>(), m_LoopbackCaptureInputDevice->GetRecordedBytes(durationHundredNanos), 1.0, GetAudioOptions()->GetInputVolume()));
-	else
-		return std::vector<BYTE>();
 }
 
-std::vector<BYTE> AudioManager::MixAudio(_In_ std::vector<BYTE> const &first, _In_ std::vector<BYTE> const &second, _In_ float firstVolume, _In_ float secondVolume)
+AUDIO_BUFFER_COUNTERS AudioManager::GetBufferCounters()
 {
-	std::vector<BYTE> newvector(max(first.size(), second.size()));
-	bool clipped = false;
-	for (size_t i = 0; i < newvector.size(); i += 2) {
-		short firstSample = first.size() > i + 1 ? static_cast<short>(first[i] | first[i + 1] << 8) : 0;
-		short secondSample = second.size() > i + 1 ? static_cast<short>(second[i] | second[i + 1] << 8) : 0;
-		auto out = reinterpret_cast<short *>(&newvector[i]);
-		int mixedSample = int(round((firstSample)*firstVolume + (secondSample)*secondVolume));
-		if (mixedSample > MAXSHORT) {
-			clipped = true;
-			mixedSample = MAXSHORT;
+	EnterCriticalSection(&m_CriticalSection);
+	LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
+	AUDIO_BUFFER_COUNTERS counters = m_BufferCounters;
+	counters.Allocations += m_BufferPool.GetAllocationCount();
+	return counters;
+}
+
+AUDIO_LIMITER_STATS AudioManager::GetLimiterStats()
+{
+	EnterCriticalSection(&m_CriticalSection);
+	LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
+	AUDIO_LIMITER_STATS stats{};
+	if (m_IsLimiterEnabled) {
+		for (auto &pTrack : m_Tracks) {
+			AUDIO_LIMITER_STATS trackStats = pTrack->Limiter.GetStats();
+			stats.Frames += trackStats.Frames;
+			stats.LimitedFrames += trackStats.LimitedFrames;
+			stats.OverCeilingFrames += trackStats.OverCeilingFrames;
+			stats.MaxGainReductionDb = (std::max)(stats.MaxGainReductionDb, trackStats.MaxGainReductionDb);
+			stats.MaxInputPeak = (std::max)(stats.MaxInputPeak, trackStats.MaxInputPeak);
 		}
-		else if (mixedSample < -MAXSHORT) {
-			clipped = true;
-			mixedSample = -MAXSHORT;
+	}
+	stats.ClippedSamples = m_ClippedSamples;
+	return stats;
+}
+
+int AudioManager::GetCurrentVolume()
+{
+	if (m_IsMixedTrackEnabled) {
+		return m_Graph.GetMixedVolume();
+	}
+	//Nothing is mixed when every device has a track of its own, so the loudest device stands in for the mix.
+	EnterCriticalSection(&m_CriticalSection);
+	LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
+	int volume = 0;
+	for (UINT32 nodeId : m_DeviceTrackNodeIds) {
+		if (nodeId != 0) {
+			volume = (std::max)(volume, m_Graph.GetSourceLevels(nodeId).Volume);
 		}
-		*out = (short)mixedSample;
 	}
-	if (clipped) {
-		LOG_WARN("Audio clipped during mixing");
+	return volume;
+}
+
+AUDIO_LEVELS AudioManager::GetOutputDeviceLevels()
+{
+	EnterCriticalSection(&m_CriticalSection);
+	LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
+	return m_CaptureDevices.size() > OutputDeviceIndex ? m_Graph.GetSourceLevels(m_CaptureDevices[OutputDeviceIndex].NodeId) : AUDIO_LEVELS{};
+}
+
+AUDIO_LEVELS AudioManager::GetInputDeviceLevels()
+{
+	EnterCriticalSection(&m_CriticalSection);
+	LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
+	return m_CaptureDevices.size() > InputDeviceIndex ? m_Graph.GetSourceLevels(m_CaptureDevices[InputDeviceIndex].NodeId) : AUDIO_LEVELS{};
+}
+
+AUDIO_DRIFT_STATS AudioManager::GetOutputDeviceDriftStats()
+{
+	EnterCriticalSection(&m_CriticalSection);
+	LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
+	if (m_CaptureDevices.size() > OutputDeviceIndex && m_CaptureDevices[OutputDeviceIndex].Capture) {
+		return m_CaptureDevices[OutputDeviceIndex].Capture->GetDriftStats();
 	}
-	return newvector;
-}
\ No newline at end of file
+	return AUDIO_DRIFT_STATS{};
+}
+
+AUDIO_DRIFT_STATS AudioManager::GetInputDeviceDriftStats()
+{
+	EnterCriticalSection(&m_CriticalSection);
+	LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
+	if (m_CaptureDevices.size() > InputDeviceIndex && m_CaptureDevices[InputDeviceIndex].Capture) {
+		return m_CaptureDevices[InputDeviceIndex].Capture->GetDriftStats();
+	}
+	return AUDIO_DRIFT_STATS{};
+}
+
+AUDIO_LATENCY_STATS AudioManager::GetOutputDeviceLatencyStats()
+{
+	EnterCriticalSection(&m_CriticalSection);
+	LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
+	if (m_CaptureDevices.size() > OutputDeviceIndex && m_CaptureDevices[OutputDeviceIndex].Capture) {
+		return m_CaptureDevices[OutputDeviceIndex].Capture->GetLatencyStats();
+	}
+	return AUDIO_LATENCY_STATS{};
+}
+
+AUDIO_LATENCY_STATS AudioManager::GetInputDeviceLatencyStats()
+{
+	EnterCriticalSection(&m_CriticalSection);
+	LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
+	if (m_CaptureDevices.size() > InputDeviceIndex && m_CaptureDevices[InputDeviceIndex].Capture) {
+		return m_CaptureDevices[InputDeviceIndex].Capture->GetLatencyStats();
+	}
+	return AUDIO_LATENCY_STATS{};
+}
@@ -1,6 +1,16 @@
 #pragma once
 #include <vector>
+#include <chrono>
+#include <atomic>
+#include <atlbase.h>
 #include "LoopbackCapture.h"
+#include "AudioGraph.h"
+#include "AudioLevelMeter.h"
+#include "AudioSampleConverter.h"
+#include "AudioLimiter.h"
+#include "AudioBufferCounters.h"
+#include "MediaBufferPool.h"
+#include "AudioDeviceNotifier.h"
 #include "CommonTypes.h"
 class AudioManager
 {
@@ -11,16 +21,141 @@ public:
 	void ClearRecordedBytes();
 	HRESULT StartCapture();
 	HRESULT StopCapture();
-	std::vector<BYTE> GrabAudioFrame(_In_ UINT64 durationHundredNanos);
+	/// <summary>
+	/// Gets the audio for the given duration for each track of the recording as 16 bit PCM, in pooled buffers that can be passed directly to the sink writer.
+	/// The tracks are laid out as in AUDIO_OPTIONS when Initialize was called: the mix first if it is written, then each device with a track of its own.
+	/// All buffers are set to nullptr if there is no audio, and so are those of any tracks beyond that layout.
+	/// </summary>
+	HRESULT GrabAudioTracks(_In_ UINT64 durationHundredNanos, _In_ UINT32 trackCount, _Out_writes_(trackCount) CComPtr<IMFMediaBuffer> *pAudioBuffers);
+	/// <summary>
+	/// The number of tracks GrabAudioTracks returns audio for.
+	/// </summary>
+	inline UINT32 GetAudioTrackCount() const { return (UINT32)m_Tracks.size(); }
+	/// <summary>
+	/// Allocation and copy counts of the audio returned by GrabAudioTracks.
+	/// </summary>
+	AUDIO_BUFFER_COUNTERS GetBufferCounters();
+	/// <summary>
+	/// How often the audio went over full scale, and how much the limiter reduced it, over all tracks. Cumulative since recording started.
+	/// </summary>
+	AUDIO_LIMITER_STATS GetLimiterStats();
+	/// <summary>
+	/// Levels of the mixed audio returned by the last call to GrabAudioTracks, after volume adjustment, before conversion to 16 bit.
+	/// Not updated if the mix is not written to a track, as nothing is mixed then. Safe to call from any thread.
+	/// </summary>
+	inline AUDIO_LEVELS GetMixedLevels() const { return m_Graph.GetMixedLevels(); }
+	/// <summary>
+	/// Levels of the audio output device before volume adjustment. Safe to call from any thread.
+	/// </summary>
+	AUDIO_LEVELS GetOutputDeviceLevels();
+	/// <summary>
+	/// Levels of the audio input device before volume adjustment. Safe to call from any thread.
+	/// </summary>
+	AUDIO_LEVELS GetInputDeviceLevels();
+	/// <summary>
+	/// The smoothed volume of the mixed audio, in 16 bit sample units. If the mix is not written to a track, the volume of the loudest device is used.
+	/// </summary>
+	int GetCurrentVolume();
+	/// <summary>
+	/// Clock drift and buffer fill of the audio output device capture, relative to the media clock.
+	/// </summary>
+	AUDIO_DRIFT_STATS GetOutputDeviceDriftStats();
+	/// <summary>
+	/// Clock drift and buffer fill of the audio input device capture, relative to the media clock.
+	/// </summary>
+	AUDIO_DRIFT_STATS GetInputDeviceDriftStats();
+	/// <summary>
+	/// The time from the capture of audio on the output device to its mixing, i.e. the latency added by the capture buffer and wake strategy.
+	/// </summary>
+	AUDIO_LATENCY_STATS GetOutputDeviceLatencyStats();
+	/// <summary>
+	/// The time from the capture of audio on the input device to its mixing.
+	/// </summary>
+	AUDIO_LATENCY_STATS GetInputDeviceLatencyStats();
 private:
+	/// <summary>
+	/// One capture device, and the node it feeds in the audio graph once it has started.
+	/// </summary>
+	struct AUDIO_CAPTURE_DEVICE {
+		std::wstring Tag;
+		EDataFlow Flow = eRender;
+		//The device Capture runs on. Empty for the default device.
+		std::wstring Device;
+		std::unique_ptr<LoopbackCapture> Capture;
+		//Id of the node in the graph, 0 until a capture first started.
+		UINT32 NodeId = 0;
+		//The default device change count when Capture was started, to tell if a capture on the default device still runs on it.
+		UINT64 DefaultDeviceChangeCount = 0;
+		//A capture starting in the background to take over from Capture, so the graph keeps mixing the old one until the new one runs.
+		std::unique_ptr<LoopbackCapture> PendingCapture;
+		std::wstring PendingDevice;
+		UINT64 PendingDefaultDeviceChangeCount = 0;
+		std::chrono::steady_clock::time_point PendingStartTime;
+		//A capture that failed to start is not tried again before this time.
+		std::chrono::steady_clock::time_point RetryTime;
+	};
+	//The output device is always first, followed by the input device and any additional input devices.
+	static const size_t OutputDeviceIndex = 0;
+	static const size_t InputDeviceIndex = 1;
+	//The device index of the track holding the mix of all devices.
+	static const size_t MixedTrack = SIZE_MAX;
+	/// <summary>
+	/// One audio track of the recording. Each has its own limiter, as the limiter state follows a single stream.
+	/// </summary>
+	struct AUDIO_TRACK {
+		//Index of the capture device written to the track, or MixedTrack.
+		size_t DeviceIndex = MixedTrack;
+		AudioLimiter Limiter;
+		//The limited audio, in the graph format, reused between frames.
+		std::vector<BYTE> LimitedSamples;
+	};
+
 	CRITICAL_SECTION m_CriticalSection;
 	std::shared_ptr<AUDIO_OPTIONS> m_AudioOptions;
-	std::unique_ptr<LoopbackCapture> m_LoopbackCaptureOutputDevice;
-	std::unique_ptr<LoopbackCapture> m_LoopbackCaptureInputDevice;
+	CComPtr<AudioDeviceNotifier> m_DeviceNotifier;
+	//Incremented on the capture threads when a capture ends by itself. Declared before the devices, so it outlives them.
+	std::atomic<UINT64> m_CaptureEndedCount;
+	std::vector<AUDIO_CAPTURE_DEVICE> m_CaptureDevices;
+	AudioGraph m_Graph;
+	MediaBufferPool m_BufferPool;
+	AUDIO_BUFFER_COUNTERS m_BufferCounters;
+	AudioSampleConverter m_SampleConverter;
+	bool m_IsLimiterEnabled;
+	UINT64 m_ClippedSamples;
+	//The tracks are laid out once when initializing, as the sink writer can not add or remove streams while recording. The mixed track goes first.
+	std::vector<std::unique_ptr<AUDIO_TRACK>> m_Tracks;
+	bool m_IsMixedTrackEnabled;
+	//Node ids and graph outputs of the tracks with a device of their own, in track order. Sized with the tracks, so grabbing audio does not allocate.
+	std::vector<UINT32> m_DeviceTrackNodeIds;
+	std::vector<AUDIO_GRAPH_OUTPUT> m_DeviceTrackOutputs;
 
 	bool m_IsCaptureEnabled;
+	//The option version and device change count the captures were last configured for. GrabAudioTracks only reconfigures when they change.
+	UINT64 m_AppliedOptionsVersion;
+	UINT64 m_AppliedDeviceChangeCount;
+	//Set while a capture is starting in the background, so it is checked on every frame until it runs.
+	bool m_HasPendingCaptures;
+	//The earliest time a capture that failed to start is tried again.
+	std::chrono::steady_clock::time_point m_NextRetryTime;
+
 	AUDIO_OPTIONS *GetAudioOptions() { return m_AudioOptions.get(); }
-	HRESULT ConfigureAudioCapture();
-	std::vector<BYTE> MixAudio(_In_ std::vector<BYTE> const &first, _In_ std::vector<BYTE> const &second, _In_ float firstVolume, _In_ float secondVolume);
+	/// <summary>
+	/// Brings the captures in line with the options and the system devices. If isBlocking is set, waits for captures to start, otherwise they start in the background.
+	/// </summary>
+	HRESULT ConfigureAudioCapture(_In_ bool isBlocking);
+	HRESULT ConfigureCaptureDevice(_Inout_ AUDIO_CAPTURE_DEVICE &device, _In_ const std::wstring &deviceName, _In_ bool isEnabled, _In_ float volume, _In_ bool isBlocking);
+	HRESULT BeginPendingCapture(_Inout_ AUDIO_CAPTURE_DEVICE &device, _In_ const std::wstring &deviceName);
+	HRESULT CompletePendingCapture(_Inout_ AUDIO_CAPTURE_DEVICE &device, _In_ DWORD timeoutMillis);
+	bool IsCaptureRestartRequired(_In_ const AUDIO_CAPTURE_DEVICE &device, _In_ const std::wstring &deviceName);
+	bool IsCaptureConfigurationOutdated();
+	std::vector<std::wstring> GetCaptureDeviceNames();
+	UINT64 GetDeviceChangeCount();
+	UINT64 GetDefaultDeviceChangeCount(_In_ EDataFlow flow);
+	bool IsCaptureDeviceEnabled(_In_ size_t index);
+	float GetCaptureDeviceVolume(_In_ size_t index);
+	/// <summary>
+	/// Limits the audio of one track and converts it to the encoder format. pIsSilent is set if the track was silence, and handed on as such.
+	/// </summary>
+	HRESULT ConvertTrackAudio(_Inout_ AUDIO_TRACK &track, _In_ const AUDIO_GRAPH_OUTPUT &audio, _Out_ CComPtr<IMFMediaBuffer> &pAudioBuffer, _Out_ bool *pIsSilent);
+	void CountAudioProcessingTime(_In_ std::chrono::steady_clock::time_point processingStart, _In_ size_t sampleCount);
 };
-
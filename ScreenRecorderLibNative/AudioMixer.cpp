@@ -0,0 +1,216 @@
+#include "AudioMixer.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+	const float Int16Max = 32767.0f;
+	const float Int16Min = -32768.0f;
+	//Values at or beyond these limits round to a sample outside the 16 bit range.
+	const float Int16ClipHigh = 32767.5f;
+	const float Int16ClipLow = -32768.5f;
+
+	inline int PopCount4(int mask) {
+		static const int bits[16] = { 0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4 };
+		return bits[mask & 0xF];
+	}
+
+	/// <summary>
+	/// Returns the number of leading samples that every non-empty input has, capped to sampleCount.
+	/// </summary>
+	template <typename T>
+	size_t GetCommonLength(const AUDIO_MIX_INPUT<T> *pInputs, size_t inputCount, size_t sampleCount) {
+		size_t length = sampleCount;
+		for (size_t s = 0; s < inputCount; s++) {
+			if (pInputs[s].SampleCount > 0) {
+				length = (std::min)(length, pInputs[s].SampleCount);
+			}
+		}
+		return length;
+	}
+
+	size_t MixInt16Scalar(const AUDIO_MIX_INPUT<int16_t> *pInputs, size_t inputCount, int16_t *pOutput, size_t start, size_t end) {
+		size_t clipped = 0;
+		for (size_t i = start; i < end; i++) {
+			float acc = 0;
+			for (size_t s = 0; s < inputCount; s++) {
+				if (i < pInputs[s].SampleCount) {
+					acc += pInputs[s].pSamples[i] * pInputs[s].Gain;
+				}
+			}
+			if (acc >= Int16ClipHigh || acc < Int16ClipLow) {
+				clipped++;
+			}
+			pOutput[i] = (int16_t)std::lrintf((std::min)((std::max)(acc, Int16Min), Int16Max));
+		}
+		return clipped;
+	}
+
+	size_t MixFloatScalar(const AUDIO_MIX_INPUT<float> *pInputs, size_t inputCount, float *pOutput, size_t start, size_t end) {
+		size_t clipped = 0;
+		for (size_t i = start; i < end; i++) {
+			float acc = 0;
+			for (size_t s = 0; s < inputCount; s++) {
+				if (i < pInputs[s].SampleCount) {
+					acc += pInputs[s].pSamples[i] * pInputs[s].Gain;
+				}
+			}
+			if (acc > 1.0f || acc < -1.0f) {
+				clipped++;
+			}
+			pOutput[i] = acc;
+		}
+		return clipped;
+	}
+
+#if SIMD_X86
+	size_t MixInt16SSE2(const AUDIO_MIX_INPUT<int16_t> *pInputs, size_t inputCount, int16_t *pOutput, size_t end) {
+		const __m128 maxValue = _mm_set1_ps(Int16Max);
+		const __m128 minValue = _mm_set1_ps(Int16Min);
+		const __m128 clipHigh = _mm_set1_ps(Int16ClipHigh);
+		const __m128 clipLow = _mm_set1_ps(Int16ClipLow);
+		size_t clipped = 0;
+		for (size_t i = 0; i < end; i += 8) {
+			__m128 acc0 = _mm_setzero_ps();
+			__m128 acc1 = _mm_setzero_ps();
+			for (size_t s = 0; s < inputCount; s++) {
+				if (pInputs[s].SampleCount == 0) {
+					continue;
+				}
+				__m128 gain = _mm_set1_ps(pInputs[s].Gain);
+				__m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pInputs[s].pSamples + i));
+				//Sign extend to 32 bit by duplicating each sample into the high half and shifting it down.
+				__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+				__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16);
+				acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_cvtepi32_ps(lo), gain));
+				acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_cvtepi32_ps(hi), gain));
+			}
+			int clipMask0 = _mm_movemask_ps(_mm_or_ps(_mm_cmpge_ps(acc0, clipHigh), _mm_cmplt_ps(acc0, clipLow)));
+			int clipMask1 = _mm_movemask_ps(_mm_or_ps(_mm_cmpge_ps(acc1, clipHigh), _mm_cmplt_ps(acc1, clipLow)));
+			clipped += PopCount4(clipMask0) + PopCount4(clipMask1);
+			acc0 = _mm_min_ps(_mm_max_ps(acc0, minValue), maxValue);
+			acc1 = _mm_min_ps(_mm_max_ps(acc1, minValue), maxValue);
+			__m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(acc0), _mm_cvtps_epi32(acc1));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pOutput + i), packed);
+		}
+		return clipped;
+	}
+
+	size_t MixFloatSSE2(const AUDIO_MIX_INPUT<float> *pInputs, size_t inputCount, float *pOutput, size_t end) {
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 minusOne = _mm_set1_ps(-1.0f);
+		size_t clipped = 0;
+		for (size_t i = 0; i < end; i += 4) {
+			__m128 acc = _mm_setzero_ps();
+			for (size_t s = 0; s < inputCount; s++) {
+				if (pInputs[s].SampleCount == 0) {
+					continue;
+				}
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(pInputs[s].pSamples + i), _mm_set1_ps(pInputs[s].Gain)));
+			}
+			clipped += PopCount4(_mm_movemask_ps(_mm_or_ps(_mm_cmpgt_ps(acc, one), _mm_cmplt_ps(acc, minusOne))));
+			_mm_storeu_ps(pOutput + i, acc);
+		}
+		return clipped;
+	}
+
+	SIMD_TARGET_AVX2 size_t MixInt16AVX2(const AUDIO_MIX_INPUT<int16_t> *pInputs, size_t inputCount, int16_t *pOutput, size_t end) {
+		const __m256 maxValue = _mm256_set1_ps(Int16Max);
+		const __m256 minValue = _mm256_set1_ps(Int16Min);
+		const __m256 clipHigh = _mm256_set1_ps(Int16ClipHigh);
+		const __m256 clipLow = _mm256_set1_ps(Int16ClipLow);
+		size_t clipped = 0;
+		for (size_t i = 0; i < end; i += 16) {
+			__m256 acc0 = _mm256_setzero_ps();
+			__m256 acc1 = _mm256_setzero_ps();
+			for (size_t s = 0; s < inputCount; s++) {
+				if (pInputs[s].SampleCount == 0) {
+					continue;
+				}
+				__m256 gain = _mm256_set1_ps(pInputs[s].Gain);
+				const __m128i *pSrc = reinterpret_cast<const __m128i *>(pInputs[s].pSamples + i);
+				__m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(pSrc)));
+				__m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(pSrc + 1)));
+				acc0 = _mm256_fmadd_ps(lo, gain, acc0);
+				acc1 = _mm256_fmadd_ps(hi, gain, acc1);
+			}
+			int clipMask0 = _mm256_movemask_ps(_mm256_or_ps(_mm256_cmp_ps(acc0, clipHigh, _CMP_GE_OQ), _mm256_cmp_ps(acc0, clipLow, _CMP_LT_OQ)));
+			int clipMask1 = _mm256_movemask_ps(_mm256_or_ps(_mm256_cmp_ps(acc1, clipHigh, _CMP_GE_OQ), _mm256_cmp_ps(acc1, clipLow, _CMP_LT_OQ)));
+			clipped += PopCount4(clipMask0) + PopCount4(clipMask0 >> 4) + PopCount4(clipMask1) + PopCount4(clipMask1 >> 4);
+			acc0 = _mm256_min_ps(_mm256_max_ps(acc0, minValue), maxValue);
+			acc1 = _mm256_min_ps(_mm256_max_ps(acc1, minValue), maxValue);
+			//packs works within 128 bit lanes, so the 64 bit quarters are reordered afterwards to restore sample order.
+			__m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(acc0), _mm256_cvtps_epi32(acc1));
+			packed = _mm256_permute4x64_epi64(packed, 0xD8);
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(pOutput + i), packed);
+		}
+		_mm256_zeroupper();
+		return clipped;
+	}
+
+	SIMD_TARGET_AVX2 size_t MixFloatAVX2(const AUDIO_MIX_INPUT<float> *pInputs, size_t inputCount, float *pOutput, size_t end) {
+		const __m256 one = _mm256_set1_ps(1.0f);
+		const __m256 minusOne = _mm256_set1_ps(-1.0f);
+		size_t clipped = 0;
+		for (size_t i = 0; i < end; i += 8) {
+			__m256 acc = _mm256_setzero_ps();
+			for (size_t s = 0; s < inputCount; s++) {
+				if (pInputs[s].SampleCount == 0) {
+					continue;
+				}
+				acc = _mm256_fmadd_ps(_mm256_loadu_ps(pInputs[s].pSamples + i), _mm256_set1_ps(pInputs[s].Gain), acc);
+			}
+			int clipMask = _mm256_movemask_ps(_mm256_or_ps(_mm256_cmp_ps(acc, one, _CMP_GT_OQ), _mm256_cmp_ps(acc, minusOne, _CMP_LT_OQ)));
+			clipped += PopCount4(clipMask) + PopCount4(clipMask >> 4);
+			_mm256_storeu_ps(pOutput + i, acc);
+		}
+		_mm256_zeroupper();
+		return clipped;
+	}
+#endif
+}
+
+size_t AudioMixer::Mix(_In_reads_(inputCount) const AUDIO_MIX_INPUT<int16_t> *pInputs, _In_ size_t inputCount, _Out_writes_(sampleCount) int16_t *pOutput, _In_ size_t sampleCount, _In_ SimdLevel level)
+{
+	size_t commonLength = GetCommonLength(pInputs, inputCount, sampleCount);
+	size_t vectorEnd = 0;
+	size_t clipped = 0;
+#if SIMD_X86
+	switch (ResolveSimdLevel(level)) {
+		case SimdLevel::AVX2:
+			vectorEnd = commonLength & ~(size_t)15;
+			clipped += MixInt16AVX2(pInputs, inputCount, pOutput, vectorEnd);
+			break;
+		case SimdLevel::SSE2:
+			vectorEnd = commonLength & ~(size_t)7;
+			clipped += MixInt16SSE2(pInputs, inputCount, pOutput, vectorEnd);
+			break;
+		default:
+			break;
+	}
+#endif
+	clipped += MixInt16Scalar(pInputs, inputCount, pOutput, vectorEnd, sampleCount);
+	return clipped;
+}
+
+size_t AudioMixer::Mix(_In_reads_(inputCount) const AUDIO_MIX_INPUT<float> *pInputs, _In_ size_t inputCount, _Out_writes_(sampleCount) float *pOutput, _In_ size_t sampleCount, _In_ SimdLevel level)
+{
+	size_t commonLength = GetCommonLength(pInputs, inputCount, sampleCount);
+	size_t vectorEnd = 0;
+	size_t clipped = 0;
+#if SIMD_X86
+	switch (ResolveSimdLevel(level)) {
+		case SimdLevel::AVX2:
+			vectorEnd = commonLength & ~(size_t)7;
+			clipped += MixFloatAVX2(pInputs, inputCount, pOutput, vectorEnd);
+			break;
+		case SimdLevel::SSE2:
+			vectorEnd = commonLength & ~(size_t)3;
+			clipped += MixFloatSSE2(pInputs, inputCount, pOutput, vectorEnd);
+			break;
+		default:
+			break;
+	}
+#endif
+	clipped += MixFloatScalar(pInputs, inputCount, pOutput, vectorEnd, sampleCount);
+	return clipped;
+}
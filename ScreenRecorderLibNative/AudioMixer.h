@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <sal.h>
+#include "Simd.util.h"
+
+/// <summary>
+/// One input stream to the audio mixer.
+/// </summary>
+template <typename T>
+struct AUDIO_MIX_INPUT {
+	//Interleaved samples. May be nullptr if SampleCount is 0.
+	const T *pSamples;
+	//Number of samples (not frames) in pSamples. Inputs shorter than the output are treated as silence past their end.
+	size_t SampleCount;
+	//Linear gain applied to this input.
+	float Gain;
+};
+
+/// <summary>
+/// Mixes any number of PCM streams with per-input gain into a caller provided buffer in a single pass.
+/// Samples are accumulated in float. Integer output is saturated once when writing it, float output keeps any headroom above full scale.
+/// The output buffer may be the same as the sample buffer of any input.
+/// </summary>
+class AudioMixer
+{
+public:
+	/// <summary>
+	/// Mix 16 bit integer inputs. The result is saturated to the 16 bit range.
+	/// </summary>
+	/// <param name="pInputs">The inputs to mix.</param>
+	/// <param name="inputCount">The number of inputs.</param>
+	/// <param name="pOutput">The output buffer, with room for sampleCount samples.</param>
+	/// <param name="sampleCount">The number of samples to write to pOutput.</param>
+	/// <param name="level">The SIMD instruction set to use. Levels not supported by the CPU fall back to the best supported level.</param>
+	/// <returns>The number of output samples that were clipped.</returns>
+	static size_t Mix(_In_reads_(inputCount) const AUDIO_MIX_INPUT<int16_t> *pInputs, _In_ size_t inputCount, _Out_writes_(sampleCount) int16_t *pOutput, _In_ size_t sampleCount, _In_ SimdLevel level = SimdLevel::Auto);
+	/// <summary>
+	/// Mix 32 bit float inputs. The result is not clamped, so it can be converted or limited later without clipping at the mix.
+	/// </summary>
+	/// <returns>The number of output samples outside [-1.0, 1.0].</returns>
+	static size_t Mix(_In_reads_(inputCount) const AUDIO_MIX_INPUT<float> *pInputs, _In_ size_t inputCount, _Out_writes_(sampleCount) float *pOutput, _In_ size_t sampleCount, _In_ SimdLevel level = SimdLevel::Auto);
+};
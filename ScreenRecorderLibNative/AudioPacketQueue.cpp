@@ -0,0 +1,234 @@
+#include "AudioPacketQueue.h"
+#include <algorithm>
+#include <cstring>
+
+AudioPacketQueue::AudioPacketQueue() :
+	m_Packets(nullptr),
+	m_PacketMask(0),
+	m_SampleRate(0),
+	m_BlockAlign(1),
+	m_MaxGapFrames(0),
+	m_PacketWriteIndex(0),
+	m_WriteEndPosition(0),
+	m_DroppedPacketCount(0),
+	m_DroppedFrames(0),
+	m_PacketReadIndex(0),
+	m_ReadPosition(0),
+	m_IsReadPositionValid(false),
+	m_PacketOffset(0),
+	m_MaxPacketFrames(0),
+	m_GapFrames(0)
+{
+}
+
+AudioPacketQueue::~AudioPacketQueue()
+{
+}
+
+HRESULT AudioPacketQueue::Initialize(_In_ UINT32 sampleRate, _In_ UINT32 blockAlign, _In_ size_t capacityFrames, _In_ size_t maxPackets)
+{
+	if (sampleRate == 0 || blockAlign == 0 || capacityFrames == 0 || maxPackets == 0) {
+		return E_INVALIDARG;
+	}
+	HRESULT hr = m_Payload.Initialize(capacityFrames * blockAlign, blockAlign);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	size_t packetCapacity = 1;
+	while (packetCapacity < maxPackets) {
+		packetCapacity <<= 1;
+	}
+	if (packetCapacity != m_PacketMask + 1 || !m_Packets) {
+		m_Packets.reset(new (std::nothrow) AUDIO_PACKET[packetCapacity]);
+		if (!m_Packets) {
+			m_PacketMask = 0;
+			return E_OUTOFMEMORY;
+		}
+		m_PacketMask = packetCapacity - 1;
+	}
+	m_SampleRate = sampleRate;
+	m_BlockAlign = blockAlign;
+	m_MaxGapFrames = capacityFrames;
+	m_PacketWriteIndex.store(0, std::memory_order_relaxed);
+	m_PacketReadIndex.store(0, std::memory_order_relaxed);
+	m_WriteEndPosition.store(0, std::memory_order_relaxed);
+	m_DroppedPacketCount.store(0, std::memory_order_relaxed);
+	m_DroppedFrames.store(0, std::memory_order_relaxed);
+	m_ReadPosition = 0;
+	m_IsReadPositionValid = false;
+	m_PacketOffset = 0;
+	m_MaxPacketFrames = 0;
+	m_GapFrames = 0;
+	return S_OK;
+}
+
+bool AudioPacketQueue::Write(_In_reads_bytes_opt_(frames *GetBlockAlign()) const BYTE *pData, _In_ UINT32 frames, _In_ UINT64 devicePosition, _In_ UINT64 qpcPosition, _In_ bool isSilent)
+{
+	if (!m_Packets || frames == 0) {
+		return false;
+	}
+	isSilent = isSilent || pData == nullptr;
+	UINT64 writeIndex = m_PacketWriteIndex.load(std::memory_order_relaxed);
+	UINT64 readIndex = m_PacketReadIndex.load(std::memory_order_acquire);
+	size_t byteCount = (size_t)frames * m_BlockAlign;
+	//A packet is either queued whole or not at all, so a full queue shows up to the consumer as a gap at the right position.
+	if (writeIndex - readIndex > m_PacketMask || (!isSilent && m_Payload.GetFreeBytes() < byteCount)) {
+		m_DroppedPacketCount.fetch_add(1, std::memory_order_relaxed);
+		m_DroppedFrames.fetch_add(frames, std::memory_order_relaxed);
+		return false;
+	}
+	if (!isSilent) {
+		m_Payload.Write(pData, byteCount);
+	}
+	AUDIO_PACKET &packet = m_Packets[writeIndex & m_PacketMask];
+	packet.DevicePosition = devicePosition;
+	packet.QpcPosition = qpcPosition;
+	packet.Frames = frames;
+	packet.IsSilent = isSilent;
+	m_WriteEndPosition.store(devicePosition + frames, std::memory_order_relaxed);
+	m_PacketWriteIndex.store(writeIndex + 1, std::memory_order_release);
+	return true;
+}
+
+bool AudioPacketQueue::PeekPacket(_Out_ AUDIO_PACKET **ppPacket)
+{
+	*ppPacket = nullptr;
+	if (!m_Packets) {
+		return false;
+	}
+	UINT64 readIndex = m_PacketReadIndex.load(std::memory_order_relaxed);
+	if (readIndex == m_PacketWriteIndex.load(std::memory_order_acquire)) {
+		return false;
+	}
+	AUDIO_PACKET *pPacket = &m_Packets[readIndex & m_PacketMask];
+	UINT64 packetPosition = pPacket->DevicePosition + m_PacketOffset;
+	m_MaxPacketFrames = (std::max)(m_MaxPacketFrames, pPacket->Frames);
+	if (!m_IsReadPositionValid || packetPosition + m_MaxPacketFrames < m_ReadPosition) {
+		//Either the first packet, or the device position went backwards by more than a packet, e.g. because the device or the stream was reset. Start a new timeline at this packet.
+		//Anything closer is an overlap with audio already read, and is dropped.
+		m_ReadPosition = packetPosition;
+		m_IsReadPositionValid = true;
+	}
+	else if (packetPosition > m_ReadPosition + m_MaxGapFrames) {
+		//Gaps longer than the queue capacity are shortened, the same as if they had been written as silence to a full buffer.
+		m_ReadPosition = packetPosition - m_MaxGapFrames;
+	}
+	*ppPacket = pPacket;
+	return true;
+}
+
+void AudioPacketQueue::PopPacket()
+{
+	m_PacketOffset = 0;
+	m_PacketReadIndex.store(m_PacketReadIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+size_t AudioPacketQueue::Consume(_Out_writes_bytes_opt_(frames *GetBlockAlign()) BYTE *pDest, _In_ size_t frames, _Out_opt_ bool *pIsSilent)
+{
+	size_t consumed = 0;
+	bool isSilent = true;
+	AUDIO_PACKET *pPacket;
+	while (consumed < frames && PeekPacket(&pPacket)) {
+		BYTE *pFrameDest = pDest ? pDest + consumed * m_BlockAlign : nullptr;
+		UINT64 packetPosition = pPacket->DevicePosition + m_PacketOffset;
+		UINT32 packetRemaining = pPacket->Frames - m_PacketOffset;
+		if (packetPosition > m_ReadPosition) {
+			//Gap before the packet.
+			size_t count = (size_t)(std::min)((UINT64)(frames - consumed), packetPosition - m_ReadPosition);
+			if (pFrameDest) {
+				memset(pFrameDest, 0, count * m_BlockAlign);
+				m_GapFrames += count;
+			}
+			m_ReadPosition += count;
+			consumed += count;
+			continue;
+		}
+		UINT32 count;
+		if (packetPosition < m_ReadPosition) {
+			//The packet overlaps audio that was already read, so the overlapping part is dropped.
+			count = (UINT32)(std::min)((UINT64)packetRemaining, m_ReadPosition - packetPosition);
+			if (!pPacket->IsSilent) {
+				m_Payload.Skip((size_t)count * m_BlockAlign);
+			}
+		}
+		else {
+			count = (UINT32)(std::min)((size_t)packetRemaining, frames - consumed);
+			size_t byteCount = (size_t)count * m_BlockAlign;
+			if (pPacket->IsSilent) {
+				if (pFrameDest) {
+					memset(pFrameDest, 0, byteCount);
+				}
+			}
+			else if (pFrameDest) {
+				m_Payload.Read(pFrameDest, byteCount);
+				isSilent = false;
+			}
+			else {
+				m_Payload.Skip(byteCount);
+			}
+			m_ReadPosition += count;
+			consumed += count;
+		}
+		m_PacketOffset += count;
+		if (m_PacketOffset == pPacket->Frames) {
+			PopPacket();
+		}
+	}
+	if (pIsSilent) {
+		*pIsSilent = isSilent;
+	}
+	return consumed;
+}
+
+size_t AudioPacketQueue::Read(_Out_writes_bytes_(frames *GetBlockAlign()) BYTE *pDest, _In_ size_t frames, _Out_opt_ bool *pIsSilent)
+{
+	if (!pDest) {
+		return 0;
+	}
+	return Consume(pDest, frames, pIsSilent);
+}
+
+size_t AudioPacketQueue::Skip(_In_ size_t frames)
+{
+	return Consume(nullptr, frames, nullptr);
+}
+
+void AudioPacketQueue::Clear()
+{
+	if (!m_Packets) {
+		return;
+	}
+	UINT64 writeIndex = m_PacketWriteIndex.load(std::memory_order_acquire);
+	UINT64 readIndex = m_PacketReadIndex.load(std::memory_order_relaxed);
+	for (; readIndex < writeIndex; readIndex++) {
+		AUDIO_PACKET &packet = m_Packets[readIndex & m_PacketMask];
+		if (!packet.IsSilent) {
+			m_Payload.Skip((size_t)(packet.Frames - m_PacketOffset) * m_BlockAlign);
+		}
+		m_PacketOffset = 0;
+	}
+	m_PacketReadIndex.store(writeIndex, std::memory_order_release);
+	m_IsReadPositionValid = false;
+}
+
+size_t AudioPacketQueue::GetAvailableFrames()
+{
+	AUDIO_PACKET *pPacket;
+	if (!PeekPacket(&pPacket)) {
+		return 0;
+	}
+	UINT64 endPosition = m_WriteEndPosition.load(std::memory_order_relaxed);
+	return endPosition > m_ReadPosition ? (size_t)(endPosition - m_ReadPosition) : 0;
+}
+
+bool AudioPacketQueue::GetReadTimestamp(_Out_ UINT64 *pQpcPosition)
+{
+	*pQpcPosition = 0;
+	AUDIO_PACKET *pPacket;
+	if (!PeekPacket(&pPacket)) {
+		return false;
+	}
+	INT64 offsetFrames = (INT64)(m_ReadPosition - pPacket->DevicePosition);
+	*pQpcPosition = (UINT64)((INT64)pPacket->QpcPosition + offsetFrames * 10000000 / (INT64)m_SampleRate);
+	return true;
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include <windows.h>
+#include <atomic>
+#include <memory>
+#include "AudioRingBuffer.h"
+
+/// <summary>
+/// Describes one packet of captured audio.
+/// </summary>
+struct AUDIO_PACKET {
+	//Position of the first frame of the packet in the device stream, in frames.
+	UINT64 DevicePosition;
+	//Performance counter value at the time the first frame was recorded, in 100 nanosecond units.
+	UINT64 QpcPosition;
+	UINT32 Frames;
+	//Silent packets carry no payload, and are read back as zeros.
+	bool IsSilent;
+};
+
+/// <summary>
+/// Single-producer/single-consumer queue of timestamped audio packets, used to hand captured audio from the capture thread to the recorder thread.
+/// Packets are stored as they arrive, together with their device position. The consumer reads a continuous stream of frames, and fills gaps in the
+/// device positions, e.g. from discontinuities or dropped packets, with silence at the sample offset where they occurred.
+/// Silence is never written to the buffer, neither for silent packets nor for gaps. A device position that goes back by more than a packet, e.g. after a device reset, starts a new timeline.
+/// </summary>
+class AudioPacketQueue
+{
+public:
+	AudioPacketQueue();
+	~AudioPacketQueue();
+	/// <summary>
+	/// Allocates the buffer storage. Must not be called while a producer or consumer is using the queue.
+	/// </summary>
+	/// <param name="sampleRate">The sample rate of the audio, used to convert frame offsets to timestamps.</param>
+	/// <param name="blockAlign">The size in bytes of one audio frame.</param>
+	/// <param name="capacityFrames">The number of payload frames the queue can hold. This is also the longest gap that is filled with silence.</param>
+	/// <param name="maxPackets">The number of packets the queue can hold. Rounded up to the nearest power of two.</param>
+	HRESULT Initialize(_In_ UINT32 sampleRate, _In_ UINT32 blockAlign, _In_ size_t capacityFrames, _In_ size_t maxPackets);
+	/// <summary>
+	/// Producer side. Queues a packet. If the queue has no room for the whole packet, it is dropped, and the consumer will see a gap instead.
+	/// </summary>
+	/// <param name="pData">The packet payload. Ignored if isSilent is true.</param>
+	/// <returns>true if the packet was queued.</returns>
+	bool Write(_In_reads_bytes_opt_(frames *GetBlockAlign()) const BYTE *pData, _In_ UINT32 frames, _In_ UINT64 devicePosition, _In_ UINT64 qpcPosition, _In_ bool isSilent);
+	/// <summary>
+	/// Consumer side. Reads up to the given number of frames into pDest, with any gaps filled with silence. Returns the number of frames read.
+	/// pIsSilent is set to true if every frame read came from a gap or a silent packet.
+	/// </summary>
+	size_t Read(_Out_writes_bytes_(frames *GetBlockAlign()) BYTE *pDest, _In_ size_t frames, _Out_opt_ bool *pIsSilent = nullptr);
+	/// <summary>
+	/// Consumer side. Drops up to the given number of frames, and returns the number of frames dropped.
+	/// </summary>
+	size_t Skip(_In_ size_t frames);
+	/// <summary>
+	/// Consumer side. Drops all queued packets. The next packet written starts a new timeline.
+	/// </summary>
+	void Clear();
+	/// <summary>
+	/// Consumer side. The number of frames that can be read, including gaps before queued packets.
+	/// </summary>
+	size_t GetAvailableFrames();
+	/// <summary>
+	/// Consumer side. Gets the performance counter time, in 100 nanosecond units, at which the next frame to be read was recorded.
+	/// Returns false if there is nothing to read.
+	/// </summary>
+	bool GetReadTimestamp(_Out_ UINT64 *pQpcPosition);
+
+	inline UINT32 GetBlockAlign() const { return m_BlockAlign; }
+	inline bool IsInitialized() const { return m_Packets != nullptr; }
+	/// <summary>
+	/// The number of packets the producer dropped because the queue was full.
+	/// </summary>
+	inline UINT64 GetDroppedPacketCount() const { return m_DroppedPacketCount.load(std::memory_order_relaxed); }
+	/// <summary>
+	/// The number of frames the producer dropped because the queue was full.
+	/// </summary>
+	inline UINT64 GetDroppedFrames() const { return m_DroppedFrames.load(std::memory_order_relaxed); }
+	/// <summary>
+	/// The number of silent frames the consumer has inserted for gaps in the device positions.
+	/// </summary>
+	inline UINT64 GetGapFrames() const { return m_GapFrames; }
+private:
+	AudioRingBuffer m_Payload;
+	std::unique_ptr<AUDIO_PACKET[]> m_Packets;
+	size_t m_PacketMask;
+	UINT32 m_SampleRate;
+	UINT32 m_BlockAlign;
+	size_t m_MaxGapFrames;
+	alignas(64) std::atomic<UINT64> m_PacketWriteIndex;
+	//Device position just past the last queued packet. Only valid once a packet was queued.
+	std::atomic<UINT64> m_WriteEndPosition;
+	std::atomic<UINT64> m_DroppedPacketCount;
+	std::atomic<UINT64> m_DroppedFrames;
+	alignas(64) std::atomic<UINT64> m_PacketReadIndex;
+
+	//Consumer state.
+	//Device position of the next frame to be read.
+	UINT64 m_ReadPosition;
+	bool m_IsReadPositionValid;
+	//Frames already consumed from the packet at m_PacketReadIndex.
+	UINT32 m_PacketOffset;
+	//The longest packet read so far. A packet further behind the read position than this starts a new timeline.
+	UINT32 m_MaxPacketFrames;
+	UINT64 m_GapFrames;
+
+	bool PeekPacket(_Out_ AUDIO_PACKET **ppPacket);
+	void PopPacket();
+	size_t Consume(_Out_writes_bytes_opt_(frames *GetBlockAlign()) BYTE *pDest, _In_ size_t frames, _Out_opt_ bool *pIsSilent);
+};
@@ -0,0 +1,132 @@
+#include "AudioPacketizer.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+	const INT64 HundredNanosPerSecond = 10000000;
+}
+
+AudioPacketizer::AudioPacketizer() :
+	m_SampleRate(0),
+	m_BlockAlign(0),
+	m_PacketFrames(0),
+	m_StartTime(0),
+	m_ReadOffset(0),
+	m_ReadFrames(0)
+{
+}
+
+AudioPacketizer::~AudioPacketizer()
+{
+}
+
+HRESULT AudioPacketizer::Initialize(_In_ UINT32 sampleRate, _In_ UINT32 blockAlign, _In_ UINT32 packetFrames, _In_ INT64 startTime100Nanos)
+{
+	if (sampleRate == 0 || blockAlign == 0 || packetFrames == 0) {
+		return E_INVALIDARG;
+	}
+	m_SampleRate = sampleRate;
+	m_BlockAlign = blockAlign;
+	m_PacketFrames = packetFrames;
+	m_StartTime = startTime100Nanos;
+	m_Pending.clear();
+	//Room for a few packets, so writes of about a packet at a time never have to grow it.
+	m_Pending.reserve(GetPacketBytes() * 4);
+	m_ReadOffset = 0;
+	m_ReadFrames = 0;
+	return S_OK;
+}
+
+void AudioPacketizer::Write(_In_reads_bytes_(cbData) const BYTE *pData, _In_ size_t cbData)
+{
+	Append(pData, cbData);
+}
+
+void AudioPacketizer::WriteSilence(_In_ size_t cbData)
+{
+	Append(nullptr, cbData);
+}
+
+UINT64 AudioPacketizer::WriteSilenceUntil(_In_ INT64 time100Nanos, _In_ UINT64 maxLagFrames)
+{
+	if (m_SampleRate == 0 || time100Nanos <= m_StartTime) {
+		return 0;
+	}
+	UINT64 elapsed = (UINT64)(time100Nanos - m_StartTime);
+	UINT64 frames = elapsed / HundredNanosPerSecond * m_SampleRate + elapsed % HundredNanosPerSecond * m_SampleRate / HundredNanosPerSecond;
+	UINT64 writtenFrames = GetWrittenFrames();
+	if (frames <= writtenFrames + maxLagFrames) {
+		return 0;
+	}
+	Append(nullptr, (size_t)(frames - writtenFrames) * m_BlockAlign);
+	return frames - writtenFrames;
+}
+
+bool AudioPacketizer::ReadPacket(_Out_writes_bytes_(GetPacketBytes()) BYTE *pDest, _Out_ AUDIO_ENCODER_PACKET *pPacket)
+{
+	*pPacket = AUDIO_ENCODER_PACKET{};
+	if (GetPendingFrames() < m_PacketFrames) {
+		return false;
+	}
+	Consume(pDest, m_PacketFrames, pPacket);
+	return true;
+}
+
+bool AudioPacketizer::ReadPartialPacket(_Out_writes_bytes_(GetPacketBytes()) BYTE *pDest, _Out_ AUDIO_ENCODER_PACKET *pPacket)
+{
+	*pPacket = AUDIO_ENCODER_PACKET{};
+	size_t frames = GetPendingFrames();
+	if (frames == 0) {
+		return false;
+	}
+	Consume(pDest, (UINT32)(std::min)(frames, (size_t)m_PacketFrames), pPacket);
+	return true;
+}
+
+INT64 AudioPacketizer::GetFrameTime(_In_ UINT64 frame) const
+{
+	if (m_SampleRate == 0) {
+		return m_StartTime;
+	}
+	//Computed from the total frame count rather than by adding up packet durations, so rounding never accumulates.
+	return m_StartTime + (INT64)(frame / m_SampleRate * HundredNanosPerSecond + frame % m_SampleRate * HundredNanosPerSecond / m_SampleRate);
+}
+
+void AudioPacketizer::Append(_In_reads_bytes_opt_(cbData) const BYTE *pData, _In_ size_t cbData)
+{
+	if (m_BlockAlign == 0) {
+		return;
+	}
+	cbData -= cbData % m_BlockAlign;
+	if (cbData == 0) {
+		return;
+	}
+	//Move the unread audio to the front before growing, so the storage stays at the size of what is pending.
+	if (m_ReadOffset > 0) {
+		m_Pending.erase(m_Pending.begin(), m_Pending.begin() + m_ReadOffset);
+		m_ReadOffset = 0;
+	}
+	size_t offset = m_Pending.size();
+	m_Pending.resize(offset + cbData);
+	if (pData) {
+		memcpy(m_Pending.data() + offset, pData, cbData);
+	}
+	else {
+		memset(m_Pending.data() + offset, 0, cbData);
+	}
+}
+
+void AudioPacketizer::Consume(_Out_writes_bytes_(frames *m_BlockAlign) BYTE *pDest, _In_ UINT32 frames, _Out_ AUDIO_ENCODER_PACKET *pPacket)
+{
+	size_t cbData = (size_t)frames * m_BlockAlign;
+	memcpy(pDest, m_Pending.data() + m_ReadOffset, cbData);
+	m_ReadOffset += cbData;
+	if (m_ReadOffset == m_Pending.size()) {
+		m_Pending.clear();
+		m_ReadOffset = 0;
+	}
+	pPacket->Frames = frames;
+	pPacket->Timestamp100Nanos = GetFrameTime(m_ReadFrames);
+	m_ReadFrames += frames;
+	pPacket->Duration100Nanos = GetFrameTime(m_ReadFrames) - pPacket->Timestamp100Nanos;
+}
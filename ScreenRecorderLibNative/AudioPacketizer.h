@@ -0,0 +1,83 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include <vector>
+
+/// <summary>
+/// Describes one fixed size packet of encoder input.
+/// </summary>
+struct AUDIO_ENCODER_PACKET {
+	//Presentation time of the first frame, in 100 nanosecond units, counted from the number of frames written before it.
+	INT64 Timestamp100Nanos;
+	//The time until the next packet starts, in 100 nanosecond units.
+	INT64 Duration100Nanos;
+	UINT32 Frames;
+};
+
+/// <summary>
+/// Cuts the mixed audio, which arrives in chunks of any length, into packets of a fixed number of frames for the encoder.
+/// Timestamps come from the audio clock, i.e. the number of frames written since the start, so they are continuous no matter how
+/// irregularly the audio was written. Not thread safe, it is owned by the thread writing audio to the encoder.
+/// </summary>
+class AudioPacketizer
+{
+public:
+	//The number of frames in one AAC frame.
+	static const UINT32 DefaultPacketFrames = 1024;
+
+	AudioPacketizer();
+	~AudioPacketizer();
+	/// <summary>
+	/// Sets the format, and starts the timeline at startTime100Nanos. Any audio written before is dropped.
+	/// </summary>
+	HRESULT Initialize(_In_ UINT32 sampleRate, _In_ UINT32 blockAlign, _In_ UINT32 packetFrames = DefaultPacketFrames, _In_ INT64 startTime100Nanos = 0);
+	/// <summary>
+	/// Appends the whole frames in pData. A trailing partial frame is ignored.
+	/// </summary>
+	void Write(_In_reads_bytes_(cbData) const BYTE *pData, _In_ size_t cbData);
+	/// <summary>
+	/// Appends cbData bytes of silence.
+	/// </summary>
+	void WriteSilence(_In_ size_t cbData);
+	/// <summary>
+	/// Appends silence up to the given time if the audio written so far ends more than maxLagFrames before it, and returns the number of frames appended.
+	/// Keeps the audio clock from falling behind the media clock when less audio arrives than time passes, since every later timestamp is counted from the frames written.
+	/// </summary>
+	UINT64 WriteSilenceUntil(_In_ INT64 time100Nanos, _In_ UINT64 maxLagFrames);
+	/// <summary>
+	/// Copies the next full packet to pDest, which must hold GetPacketBytes() bytes. Returns false if less than a packet is pending.
+	/// </summary>
+	bool ReadPacket(_Out_writes_bytes_(GetPacketBytes()) BYTE *pDest, _Out_ AUDIO_ENCODER_PACKET *pPacket);
+	/// <summary>
+	/// Copies whatever is pending, less than a packet, to pDest, for the end of the recording. Returns false if nothing is pending.
+	/// </summary>
+	bool ReadPartialPacket(_Out_writes_bytes_(GetPacketBytes()) BYTE *pDest, _Out_ AUDIO_ENCODER_PACKET *pPacket);
+
+	inline size_t GetPacketBytes() const { return (size_t)m_PacketFrames * m_BlockAlign; }
+	inline UINT32 GetPacketFrames() const { return m_PacketFrames; }
+	inline size_t GetPendingFrames() const { return m_BlockAlign > 0 ? (m_Pending.size() - m_ReadOffset) / m_BlockAlign : 0; }
+	/// <summary>
+	/// The number of frames read out as packets since the start.
+	/// </summary>
+	inline UINT64 GetReadFrames() const { return m_ReadFrames; }
+	/// <summary>
+	/// The number of frames written since the start, i.e. the position of the audio clock.
+	/// </summary>
+	inline UINT64 GetWrittenFrames() const { return m_ReadFrames + GetPendingFrames(); }
+	/// <summary>
+	/// The timestamp of the given frame on the audio clock.
+	/// </summary>
+	INT64 GetFrameTime(_In_ UINT64 frame) const;
+private:
+	UINT32 m_SampleRate;
+	UINT32 m_BlockAlign;
+	UINT32 m_PacketFrames;
+	INT64 m_StartTime;
+	//Audio not yet read out, starting at m_ReadOffset. The storage is reused, so it only grows to the largest chunk written.
+	std::vector<BYTE> m_Pending;
+	size_t m_ReadOffset;
+	UINT64 m_ReadFrames;
+
+	void Append(_In_reads_bytes_opt_(cbData) const BYTE *pData, _In_ size_t cbData);
+	void Consume(_Out_writes_bytes_(frames *m_BlockAlign) BYTE *pDest, _In_ UINT32 frames, _Out_ AUDIO_ENCODER_PACKET *pPacket);
+};
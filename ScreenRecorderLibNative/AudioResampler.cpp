@@ -0,0 +1,387 @@
+#include "AudioResampler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+	//Input is fed through the filter in chunks of at most this many frames, which bounds the working buffer size.
+	const size_t MaxChunkFrames = 4096;
+	const uint32_t MaxTaps = 256;
+	const double Pi = 3.14159265358979323846;
+
+	struct QUALITY_PARAMETERS {
+		uint32_t Taps;
+		uint32_t Phases;
+		//Kaiser window shape. Higher values give better stopband rejection and a wider transition band.
+		double KaiserBeta;
+		//Filter cutoff as a fraction of the lower of the two Nyquist frequencies.
+		double Rolloff;
+	};
+
+	const QUALITY_PARAMETERS QualityParameters[] = {
+		{ 16, 64, 6.0, 0.85 },
+		{ 32, 128, 8.0, 0.91 },
+		{ 64, 256, 9.5, 0.95 }
+	};
+
+	//Zeroth order modified Bessel function of the first kind, used by the Kaiser window.
+	double BesselI0(double x) {
+		double sum = 1.0;
+		double term = 1.0;
+		double halfX = x / 2.0;
+		for (int k = 1; k < 50; k++) {
+			term *= (halfX / k) * (halfX / k);
+			sum += term;
+			if (term < sum * 1e-12) {
+				break;
+			}
+		}
+		return sum;
+	}
+
+	float DotProductScalar(const float *a, const float *b, size_t count) {
+		float sum = 0;
+		for (size_t i = 0; i < count; i++) {
+			sum += a[i] * b[i];
+		}
+		return sum;
+	}
+
+	inline float ToFloatSample(int16_t value) {
+		return value * (1.0f / 32768.0f);
+	}
+
+	inline float ToFloatSample(float value) {
+		return value;
+	}
+
+#if SIMD_X86
+	float DotProductSSE2(const float *a, const float *b, size_t count) {
+		__m128 sum0 = _mm_setzero_ps();
+		__m128 sum1 = _mm_setzero_ps();
+		for (size_t i = 0; i < count; i += 8) {
+			sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+			sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+		}
+		__m128 sum = _mm_add_ps(sum0, sum1);
+		sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+		sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+		return _mm_cvtss_f32(sum);
+	}
+
+	SIMD_TARGET_AVX2 float DotProductAVX2(const float *a, const float *b, size_t count) {
+		__m256 sum0 = _mm256_setzero_ps();
+		__m256 sum1 = _mm256_setzero_ps();
+		size_t i = 0;
+		for (; i + 16 <= count; i += 16) {
+			sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+			sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), sum1);
+		}
+		if (i < count) {
+			sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+		}
+		__m256 sum256 = _mm256_add_ps(sum0, sum1);
+		__m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum256), _mm256_extractf128_ps(sum256, 1));
+		sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+		sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+		_mm256_zeroupper();
+		return _mm_cvtss_f32(sum);
+	}
+#endif
+}
+
+AudioResampler::AudioResampler() :
+	m_InputSampleRate(0),
+	m_OutputSampleRate(0),
+	m_InputChannels(0),
+	m_OutputChannels(0),
+	m_ProcessingChannels(0),
+	m_Taps(0),
+	m_Phases(0),
+	m_RatioAdjustment(0),
+	m_Step(0),
+	m_Position(0),
+	m_BufferedFrames(0),
+	m_BufferCapacity(0),
+	m_AudibleFrames(0),
+	m_DotProduct(DotProductScalar)
+{
+}
+
+AudioResampler::~AudioResampler()
+{
+}
+
+HRESULT AudioResampler::Initialize(_In_ uint32_t inputSampleRate, _In_ uint32_t inputChannels, _In_ uint32_t outputSampleRate, _In_ uint32_t outputChannels, _In_ AudioResamplerQuality quality, _In_ SimdLevel level)
+{
+	if (inputSampleRate == 0 || outputSampleRate == 0 || inputChannels == 0 || outputChannels == 0) {
+		return E_INVALIDARG;
+	}
+	const QUALITY_PARAMETERS &params = QualityParameters[(int)quality];
+	m_InputSampleRate = inputSampleRate;
+	m_OutputSampleRate = outputSampleRate;
+	m_InputChannels = inputChannels;
+	m_OutputChannels = outputChannels;
+	m_ProcessingChannels = (std::min)(inputChannels, outputChannels);
+	m_Phases = params.Phases;
+
+	//When downsampling, the filter is widened by the ratio so the transition band stays the same relative to the output Nyquist frequency.
+	double bandwidth = (std::min)(1.0, (double)outputSampleRate / inputSampleRate);
+	uint32_t taps = (uint32_t)ceil(params.Taps / bandwidth);
+	m_Taps = (std::min)(MaxTaps, (taps + 7) & ~7u);
+	double cutoff = params.Rolloff * bandwidth;
+	double halfWidth = m_Taps / 2.0;
+	double besselBeta = BesselI0(params.KaiserBeta);
+
+	m_Coefficients.resize((size_t)(m_Phases + 1) * m_Taps);
+	for (uint32_t p = 0; p <= m_Phases; p++) {
+		float *pRow = &m_Coefficients[(size_t)p * m_Taps];
+		double fraction = (double)p / m_Phases;
+		double rowSum = 0;
+		for (uint32_t t = 0; t < m_Taps; t++) {
+			//Distance in input frames between tap t and the output position.
+			double distance = t + 1.0 - halfWidth - fraction;
+			double x = distance / halfWidth;
+			double window = fabs(x) >= 1.0 ? 0.0 : BesselI0(params.KaiserBeta * sqrt(1.0 - x * x)) / besselBeta;
+			double sinc = distance == 0 ? 1.0 : sin(Pi * cutoff * distance) / (Pi * cutoff * distance);
+			double value = cutoff * sinc * window;
+			pRow[t] = (float)value;
+			rowSum += value;
+		}
+		//Normalize each phase to unity gain at DC, so constant input gives constant output regardless of phase.
+		for (uint32_t t = 0; t < m_Taps; t++) {
+			pRow[t] = (float)(pRow[t] / rowSum);
+		}
+	}
+	m_FrameCoefficients.resize(m_Taps);
+	m_FrameOutput.resize(m_ProcessingChannels);
+	m_BufferCapacity = m_Taps + MaxChunkFrames;
+	m_Buffer.resize(m_BufferCapacity * m_ProcessingChannels);
+
+	m_DotProduct = DotProductScalar;
+#if SIMD_X86
+	switch (ResolveSimdLevel(level)) {
+		case SimdLevel::AVX2:
+			m_DotProduct = DotProductAVX2;
+			break;
+		case SimdLevel::SSE2:
+			m_DotProduct = DotProductSSE2;
+			break;
+		default:
+			break;
+	}
+#endif
+	m_RatioAdjustment = 0;
+	UpdateStep();
+	Reset();
+	return S_OK;
+}
+
+void AudioResampler::Reset()
+{
+	//The history is primed with silence, and the first output frame is placed on the first real input frame,
+	//so the output starts in sync with the input and the lookahead of half the filter length is held back instead.
+	size_t history = m_Taps > 0 ? m_Taps - 1 : 0;
+	std::fill(m_Buffer.begin(), m_Buffer.end(), 0.0f);
+	m_BufferedFrames = history;
+	m_AudibleFrames = 0;
+	m_Position = (uint64_t)(history + m_Taps / 2) << 32;
+}
+
+void AudioResampler::SetRatioAdjustment(_In_ double adjustment)
+{
+	m_RatioAdjustment = (std::max)(-0.05, (std::min)(0.05, adjustment));
+	UpdateStep();
+}
+
+void AudioResampler::UpdateStep()
+{
+	if (m_OutputSampleRate == 0) {
+		return;
+	}
+	double step = (double)m_InputSampleRate / ((double)m_OutputSampleRate * (1.0 + m_RatioAdjustment));
+	m_Step = (uint64_t)llround(step * 4294967296.0);
+}
+
+size_t AudioResampler::GetMaxOutputFrames(_In_ size_t inputFrames) const
+{
+	if (m_Step == 0) {
+		return 0;
+	}
+	return (size_t)(((uint64_t)(inputFrames + m_Taps) << 32) / m_Step) + 1;
+}
+
+size_t AudioResampler::Process(_In_reads_(inputFrames *GetInputChannels()) const int16_t *pInput, _In_ size_t inputFrames, _Out_writes_(maxOutputFrames *GetOutputChannels()) int16_t *pOutput, _In_ size_t maxOutputFrames)
+{
+	return ProcessSamples(pInput, inputFrames, pOutput, maxOutputFrames);
+}
+
+size_t AudioResampler::Process(_In_reads_(inputFrames *GetInputChannels()) const float *pInput, _In_ size_t inputFrames, _Out_writes_(maxOutputFrames *GetOutputChannels()) float *pOutput, _In_ size_t maxOutputFrames)
+{
+	return ProcessSamples(pInput, inputFrames, pOutput, maxOutputFrames);
+}
+
+size_t AudioResampler::ProcessSilence(_In_ size_t inputFrames, _Out_writes_(maxOutputFrames *GetOutputChannels()) int16_t *pOutput, _In_ size_t maxOutputFrames, _Out_opt_ bool *pIsOutputSilent)
+{
+	return ProcessSilenceSamples(inputFrames, pOutput, maxOutputFrames, pIsOutputSilent);
+}
+
+size_t AudioResampler::ProcessSilence(_In_ size_t inputFrames, _Out_writes_(maxOutputFrames *GetOutputChannels()) float *pOutput, _In_ size_t maxOutputFrames, _Out_opt_ bool *pIsOutputSilent)
+{
+	return ProcessSilenceSamples(inputFrames, pOutput, maxOutputFrames, pIsOutputSilent);
+}
+
+template <typename TInput, typename TOutput>
+size_t AudioResampler::ProcessSamples(_In_ const TInput *pInput, _In_ size_t inputFrames, _Out_ TOutput *pOutput, _In_ size_t maxOutputFrames)
+{
+	if (!IsInitialized()) {
+		return 0;
+	}
+	size_t written = 0;
+	size_t consumed = 0;
+	while (consumed < inputFrames) {
+		size_t chunk = (std::min)(m_BufferCapacity - m_BufferedFrames, inputFrames - consumed);
+		AppendInput(pInput + consumed * m_InputChannels, chunk);
+		consumed += chunk;
+		written += Drain(pOutput + written * m_OutputChannels, maxOutputFrames - written);
+	}
+	return written;
+}
+
+template <typename TOutput>
+size_t AudioResampler::ProcessSilenceSamples(_In_ size_t inputFrames, _Out_ TOutput *pOutput, _In_ size_t maxOutputFrames, _Out_opt_ bool *pIsOutputSilent)
+{
+	if (pIsOutputSilent) {
+		*pIsOutputSilent = true;
+	}
+	if (!IsInitialized()) {
+		return 0;
+	}
+	size_t written = 0;
+	size_t consumed = 0;
+	size_t filteredFrames = 0;
+	while (consumed < inputFrames) {
+		size_t chunk = (std::min)(m_BufferCapacity - m_BufferedFrames, inputFrames - consumed);
+		AppendSilence(chunk);
+		consumed += chunk;
+		size_t filtered;
+		written += Drain(pOutput + written * m_OutputChannels, maxOutputFrames - written, &filtered);
+		filteredFrames += filtered;
+	}
+	if (pIsOutputSilent) {
+		*pIsOutputSilent = filteredFrames == 0;
+	}
+	return written;
+}
+
+void AudioResampler::AppendSilence(_In_ size_t frames)
+{
+	//The space past the buffered frames holds stale samples from earlier moves, so it has to be cleared for the filter history.
+	for (uint32_t c = 0; c < m_ProcessingChannels; c++) {
+		float *pDest = &m_Buffer[c * m_BufferCapacity + m_BufferedFrames];
+		std::fill(pDest, pDest + frames, 0.0f);
+	}
+	m_BufferedFrames += frames;
+}
+
+template <typename TInput>
+void AudioResampler::AppendInput(_In_ const TInput *pInput, _In_ size_t frames)
+{
+	for (uint32_t c = 0; c < m_ProcessingChannels; c++) {
+		float *pDest = &m_Buffer[c * m_BufferCapacity + m_BufferedFrames];
+		if (m_InputChannels == m_ProcessingChannels) {
+			const TInput *pSrc = pInput + c;
+			for (size_t i = 0; i < frames; i++) {
+				pDest[i] = ToFloatSample(pSrc[i * m_InputChannels]);
+			}
+		}
+		else {
+			//Downmix by averaging every input channel that maps onto this output channel, e.g. all channels for mono,
+			//or even and odd channels for stereo.
+			uint32_t sourceCount = (m_InputChannels - c - 1) / m_ProcessingChannels + 1;
+			float channelScale = 1.0f / sourceCount;
+			for (size_t i = 0; i < frames; i++) {
+				const TInput *pFrame = pInput + i * m_InputChannels;
+				float sum = 0;
+				for (uint32_t j = c; j < m_InputChannels; j += m_ProcessingChannels) {
+					sum += ToFloatSample(pFrame[j]);
+				}
+				pDest[i] = sum * channelScale;
+			}
+		}
+	}
+	m_BufferedFrames += frames;
+	m_AudibleFrames = m_BufferedFrames;
+}
+
+template <typename TOutput>
+size_t AudioResampler::Drain(_Out_ TOutput *pOutput, _In_ size_t maxOutputFrames, _Out_opt_ size_t *pFilteredFrames)
+{
+	size_t written = 0;
+	size_t filtered = 0;
+	const float phaseFractionScale = 1.0f / 4294967296.0f;
+	while ((size_t)(m_Position >> 32) < m_BufferedFrames) {
+		if (written >= maxOutputFrames) {
+			m_Position += m_Step;
+			continue;
+		}
+		size_t index = (size_t)(m_Position >> 32);
+		size_t firstTap = index + 1 - m_Taps;
+		if (firstTap >= m_AudibleFrames) {
+			memset(pOutput + written * m_OutputChannels, 0, m_OutputChannels * sizeof(TOutput));
+			written++;
+			m_Position += m_Step;
+			continue;
+		}
+		uint64_t scaledPhase = (m_Position & 0xFFFFFFFF) * m_Phases;
+		uint32_t phase = (uint32_t)(scaledPhase >> 32);
+		float phaseFraction = (float)(scaledPhase & 0xFFFFFFFF) * phaseFractionScale;
+		const float *pRow0 = &m_Coefficients[(size_t)phase * m_Taps];
+		const float *pRow1 = pRow0 + m_Taps;
+		for (uint32_t t = 0; t < m_Taps; t++) {
+			m_FrameCoefficients[t] = pRow0[t] + phaseFraction * (pRow1[t] - pRow0[t]);
+		}
+		for (uint32_t c = 0; c < m_ProcessingChannels; c++) {
+			m_FrameOutput[c] = m_DotProduct(&m_Buffer[c * m_BufferCapacity + firstTap], m_FrameCoefficients.data(), m_Taps);
+		}
+		WriteOutputFrame(pOutput + written * m_OutputChannels);
+		written++;
+		filtered++;
+		m_Position += m_Step;
+	}
+
+	//Keep the frames the next output frame still needs as history, and move them to the start of the buffer.
+	size_t nextIndex = (size_t)(m_Position >> 32);
+	size_t discard = (std::min)(nextIndex + 1 - m_Taps, m_BufferedFrames);
+	if (discard > 0) {
+		size_t remaining = m_BufferedFrames - discard;
+		for (uint32_t c = 0; c < m_ProcessingChannels; c++) {
+			float *pChannel = &m_Buffer[c * m_BufferCapacity];
+			memmove(pChannel, pChannel + discard, remaining * sizeof(float));
+		}
+		m_BufferedFrames = remaining;
+		m_AudibleFrames = m_AudibleFrames > discard ? m_AudibleFrames - discard : 0;
+		m_Position -= (uint64_t)discard << 32;
+	}
+	if (pFilteredFrames) {
+		*pFilteredFrames = filtered;
+	}
+	return written;
+}
+
+void AudioResampler::WriteOutputFrame(_Out_ int16_t *pOutput)
+{
+	for (uint32_t c = 0; c < m_OutputChannels; c++) {
+		//Upmix by repeating the processed channels, e.g. mono to all channels.
+		float value = m_FrameOutput[c % m_ProcessingChannels] * 32768.0f;
+		value = (std::min)((std::max)(value, -32768.0f), 32767.0f);
+		pOutput[c] = (int16_t)lrintf(value);
+	}
+}
+
+void AudioResampler::WriteOutputFrame(_Out_ float *pOutput)
+{
+	for (uint32_t c = 0; c < m_OutputChannels; c++) {
+		pOutput[c] = m_FrameOutput[c % m_ProcessingChannels];
+	}
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <windows.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <sal.h>
+#include "Simd.util.h"
+
+enum class AudioResamplerQuality {
+	//16 taps, 64 filter phases. Lowest CPU use, audible aliasing on bright content.
+	Low = 0,
+	//32 taps, 128 filter phases.
+	Medium = 1,
+	//64 taps, 256 filter phases.
+	High = 2
+};
+
+/// <summary>
+/// Streaming windowed sinc resampler for interleaved 16 bit or 32 bit float PCM, with channel up/downmixing. The filter always runs in float.
+/// Float samples are full scale at [-1.0, 1.0], and are not clamped, so headroom above full scale is kept.
+/// The filter history and fractional position are kept between calls, so audio can be fed in chunks of any size without discontinuities.
+/// All buffers are allocated in Initialize, and Process does not allocate.
+/// The conversion ratio can be fine tuned while running with SetRatioAdjustment, e.g. to compensate for clock drift between devices.
+/// </summary>
+class AudioResampler
+{
+public:
+	AudioResampler();
+	~AudioResampler();
+	/// <summary>
+	/// Designs the filter bank and allocates buffers. Can be called again to reconfigure, which discards any buffered audio.
+	/// </summary>
+	HRESULT Initialize(_In_ uint32_t inputSampleRate, _In_ uint32_t inputChannels, _In_ uint32_t outputSampleRate, _In_ uint32_t outputChannels, _In_ AudioResamplerQuality quality = AudioResamplerQuality::Medium, _In_ SimdLevel level = SimdLevel::Auto);
+	/// <summary>
+	/// Resamples the interleaved input frames and writes interleaved output frames.
+	/// </summary>
+	/// <param name="pInput">Interleaved input samples.</param>
+	/// <param name="inputFrames">The number of input frames.</param>
+	/// <param name="pOutput">Interleaved output buffer.</param>
+	/// <param name="maxOutputFrames">The capacity of pOutput in frames. Use GetMaxOutputFrames to size it. If the buffer is too small, excess output is dropped.</param>
+	/// <returns>The number of frames written to pOutput.</returns>
+	size_t Process(_In_reads_(inputFrames *GetInputChannels()) const int16_t *pInput, _In_ size_t inputFrames, _Out_writes_(maxOutputFrames *GetOutputChannels()) int16_t *pOutput, _In_ size_t maxOutputFrames);
+	size_t Process(_In_reads_(inputFrames *GetInputChannels()) const float *pInput, _In_ size_t inputFrames, _Out_writes_(maxOutputFrames *GetOutputChannels()) float *pOutput, _In_ size_t maxOutputFrames);
+	/// <summary>
+	/// Same as Process with inputFrames frames of silence, without needing an input buffer. Output frames whose filter window holds only silence are written as zeros without filtering.
+	/// pIsOutputSilent is set to false if the output still holds the tail of earlier audio.
+	/// </summary>
+	size_t ProcessSilence(_In_ size_t inputFrames, _Out_writes_(maxOutputFrames *GetOutputChannels()) int16_t *pOutput, _In_ size_t maxOutputFrames, _Out_opt_ bool *pIsOutputSilent = nullptr);
+	size_t ProcessSilence(_In_ size_t inputFrames, _Out_writes_(maxOutputFrames *GetOutputChannels()) float *pOutput, _In_ size_t maxOutputFrames, _Out_opt_ bool *pIsOutputSilent = nullptr);
+	/// <summary>
+	/// Returns the largest number of frames Process can produce for the given number of input frames.
+	/// </summary>
+	size_t GetMaxOutputFrames(_In_ size_t inputFrames) const;
+	/// <summary>
+	/// Scales the conversion ratio by (1 + adjustment). Positive values produce more output frames per input frame. Limited to +-5%.
+	/// </summary>
+	void SetRatioAdjustment(_In_ double adjustment);
+	inline double GetRatioAdjustment() const { return m_RatioAdjustment; }
+	/// <summary>
+	/// Clears filter history and position, as if newly initialized.
+	/// </summary>
+	void Reset();
+
+	inline uint32_t GetInputChannels() const { return m_InputChannels; }
+	inline uint32_t GetOutputChannels() const { return m_OutputChannels; }
+	inline uint32_t GetInputSampleRate() const { return m_InputSampleRate; }
+	inline uint32_t GetOutputSampleRate() const { return m_OutputSampleRate; }
+	inline bool IsInitialized() const { return m_Taps > 0; }
+	/// <summary>
+	/// The delay introduced by the filter, in input frames.
+	/// </summary>
+	inline uint32_t GetLatencyFrames() const { return m_Taps / 2; }
+private:
+	typedef float(*DotProductFunction)(const float *, const float *, size_t);
+
+	uint32_t m_InputSampleRate;
+	uint32_t m_OutputSampleRate;
+	uint32_t m_InputChannels;
+	uint32_t m_OutputChannels;
+	//The channel count the filter runs at. This is the lower of the input and output channel counts, so mixing happens on the cheap side of the filter.
+	uint32_t m_ProcessingChannels;
+	uint32_t m_Taps;
+	uint32_t m_Phases;
+	double m_RatioAdjustment;
+	//Input position advance per output frame, in 32.32 fixed point input frames.
+	uint64_t m_Step;
+	//Position of the next output frame in the working buffer, in 32.32 fixed point input frames.
+	uint64_t m_Position;
+	//Number of frames, including history, in each channel of the working buffer.
+	size_t m_BufferedFrames;
+	size_t m_BufferCapacity;
+	//Number of frames at the start of the working buffer that may hold sound. Frames after this are known to be silent.
+	size_t m_AudibleFrames;
+	//(m_Phases + 1) rows of m_Taps coefficients. The extra row lets the last phase interpolate towards the next input frame.
+	std::vector<float> m_Coefficients;
+	//Coefficients interpolated for the current output frame.
+	std::vector<float> m_FrameCoefficients;
+	//Planar working buffer, one block of m_BufferCapacity frames per processing channel.
+	std::vector<float> m_Buffer;
+	std::vector<float> m_FrameOutput;
+	DotProductFunction m_DotProduct;
+
+	void UpdateStep();
+	template <typename TInput, typename TOutput>
+	size_t ProcessSamples(_In_ const TInput *pInput, _In_ size_t inputFrames, _Out_ TOutput *pOutput, _In_ size_t maxOutputFrames);
+	template <typename TOutput>
+	size_t ProcessSilenceSamples(_In_ size_t inputFrames, _Out_ TOutput *pOutput, _In_ size_t maxOutputFrames, _Out_opt_ bool *pIsOutputSilent);
+	template <typename TInput>
+	void AppendInput(_In_ const TInput *pInput, _In_ size_t frames);
+	void AppendSilence(_In_ size_t frames);
+	template <typename TOutput>
+	size_t Drain(_Out_ TOutput *pOutput, _In_ size_t maxOutputFrames, _Out_opt_ size_t *pFilteredFrames = nullptr);
+	void WriteOutputFrame(_Out_ int16_t *pOutput);
+	void WriteOutputFrame(_Out_ float *pOutput);
+};
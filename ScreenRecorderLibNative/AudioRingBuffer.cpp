@@ -0,0 +1,137 @@
+#include "AudioRingBuffer.h"
+#include <algorithm>
+
+AudioRingBuffer::AudioRingBuffer() :
+	m_Buffer(nullptr),
+	m_Capacity(0),
+	m_Mask(0),
+	m_BlockAlign(1),
+	m_WritePos(0),
+	m_ReadPos(0),
+	m_OverflowBytes(0),
+	m_OverflowCount(0)
+{
+}
+
+AudioRingBuffer::~AudioRingBuffer()
+{
+}
+
+HRESULT AudioRingBuffer::Initialize(_In_ size_t capacityBytes, _In_ UINT32 blockAlign)
+{
+	if (capacityBytes == 0 || blockAlign == 0) {
+		return E_INVALIDARG;
+	}
+	size_t capacity = 1;
+	while (capacity < capacityBytes) {
+		capacity <<= 1;
+	}
+	if (capacity != m_Capacity) {
+		m_Buffer.reset(new (std::nothrow) BYTE[capacity]);
+		if (!m_Buffer) {
+			m_Capacity = 0;
+			m_Mask = 0;
+			return E_OUTOFMEMORY;
+		}
+		m_Capacity = capacity;
+		m_Mask = capacity - 1;
+	}
+	m_BlockAlign = blockAlign;
+	m_WritePos.store(0, std::memory_order_relaxed);
+	m_ReadPos.store(0, std::memory_order_relaxed);
+	m_OverflowBytes.store(0, std::memory_order_relaxed);
+	m_OverflowCount.store(0, std::memory_order_relaxed);
+	return S_OK;
+}
+
+size_t AudioRingBuffer::ReserveWrite(_In_ size_t cbData, _Out_ UINT64 *pWritePos)
+{
+	UINT64 writePos = m_WritePos.load(std::memory_order_relaxed);
+	UINT64 readPos = m_ReadPos.load(std::memory_order_acquire);
+	size_t freeBytes = m_Capacity - (size_t)(writePos - readPos);
+	size_t toWrite = (std::min)(cbData, freeBytes);
+	toWrite -= toWrite % m_BlockAlign;
+	if (toWrite < cbData) {
+		m_OverflowBytes.fetch_add(cbData - toWrite, std::memory_order_relaxed);
+		m_OverflowCount.fetch_add(1, std::memory_order_relaxed);
+	}
+	*pWritePos = writePos;
+	return toWrite;
+}
+
+size_t AudioRingBuffer::Write(_In_reads_bytes_(cbData) const BYTE *pData, _In_ size_t cbData)
+{
+	if (!m_Buffer || cbData == 0) {
+		return 0;
+	}
+	UINT64 writePos;
+	size_t toWrite = ReserveWrite(cbData, &writePos);
+	size_t offset = (size_t)(writePos & m_Mask);
+	size_t firstChunk = (std::min)(toWrite, m_Capacity - offset);
+	memcpy(m_Buffer.get() + offset, pData, firstChunk);
+	if (toWrite > firstChunk) {
+		memcpy(m_Buffer.get(), pData + firstChunk, toWrite - firstChunk);
+	}
+	m_WritePos.store(writePos + toWrite, std::memory_order_release);
+	return toWrite;
+}
+
+size_t AudioRingBuffer::WriteSilence(_In_ size_t cbData)
+{
+	if (!m_Buffer || cbData == 0) {
+		return 0;
+	}
+	UINT64 writePos;
+	size_t toWrite = ReserveWrite(cbData, &writePos);
+	size_t offset = (size_t)(writePos & m_Mask);
+	size_t firstChunk = (std::min)(toWrite, m_Capacity - offset);
+	memset(m_Buffer.get() + offset, 0, firstChunk);
+	if (toWrite > firstChunk) {
+		memset(m_Buffer.get(), 0, toWrite - firstChunk);
+	}
+	m_WritePos.store(writePos + toWrite, std::memory_order_release);
+	return toWrite;
+}
+
+size_t AudioRingBuffer::Read(_Out_writes_bytes_(cbData) BYTE *pDest, _In_ size_t cbData)
+{
+	if (!m_Buffer || cbData == 0) {
+		return 0;
+	}
+	UINT64 readPos = m_ReadPos.load(std::memory_order_relaxed);
+	UINT64 writePos = m_WritePos.load(std::memory_order_acquire);
+	size_t toRead = (std::min)(cbData, (size_t)(writePos - readPos));
+	size_t offset = (size_t)(readPos & m_Mask);
+	size_t firstChunk = (std::min)(toRead, m_Capacity - offset);
+	memcpy(pDest, m_Buffer.get() + offset, firstChunk);
+	if (toRead > firstChunk) {
+		memcpy(pDest + firstChunk, m_Buffer.get(), toRead - firstChunk);
+	}
+	m_ReadPos.store(readPos + toRead, std::memory_order_release);
+	return toRead;
+}
+
+size_t AudioRingBuffer::Skip(_In_ size_t cbData)
+{
+	UINT64 readPos = m_ReadPos.load(std::memory_order_relaxed);
+	UINT64 writePos = m_WritePos.load(std::memory_order_acquire);
+	size_t toSkip = (std::min)(cbData, (size_t)(writePos - readPos));
+	toSkip -= toSkip % m_BlockAlign;
+	m_ReadPos.store(readPos + toSkip, std::memory_order_release);
+	return toSkip;
+}
+
+void AudioRingBuffer::Clear()
+{
+	m_ReadPos.store(m_WritePos.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+size_t AudioRingBuffer::GetAvailableBytes() const
+{
+	return (size_t)(m_WritePos.load(std::memory_order_acquire) - m_ReadPos.load(std::memory_order_acquire));
+}
+
+size_t AudioRingBuffer::GetFreeBytes() const
+{
+	return m_Capacity - GetAvailableBytes();
+}
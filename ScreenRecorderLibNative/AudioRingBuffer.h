@@ -0,0 +1,67 @@
+#pragma once
+#include <windows.h>
+#include <atomic>
+#include <memory>
+
+/// <summary>
+/// Fixed capacity single-producer/single-consumer byte ring buffer used to hand captured audio from the capture thread to the recorder thread.
+/// Write and Read are wait-free, and no locks are taken on either side. Only one thread may write and only one thread may read at any time.
+/// If the writer produces more data than there is free space for, the excess bytes are dropped and counted as overflow.
+/// </summary>
+class AudioRingBuffer
+{
+public:
+	AudioRingBuffer();
+	~AudioRingBuffer();
+	/// <summary>
+	/// Allocates the buffer storage. Must not be called while a producer or consumer is using the buffer.
+	/// </summary>
+	/// <param name="capacityBytes">The minimum capacity in bytes. It is rounded up to the nearest power of two.</param>
+	/// <param name="blockAlign">The size in bytes of one audio frame. Reads and writes are kept aligned to this size.</param>
+	HRESULT Initialize(_In_ size_t capacityBytes, _In_ UINT32 blockAlign);
+	/// <summary>
+	/// Producer side. Copies as many whole frames from pData as there is room for, and returns the number of bytes written.
+	/// </summary>
+	size_t Write(_In_reads_bytes_(cbData) const BYTE *pData, _In_ size_t cbData);
+	/// <summary>
+	/// Producer side. Writes cbData bytes of silence, and returns the number of bytes written.
+	/// </summary>
+	size_t WriteSilence(_In_ size_t cbData);
+	/// <summary>
+	/// Consumer side. Copies up to cbData bytes into pDest, and returns the number of bytes read.
+	/// </summary>
+	size_t Read(_Out_writes_bytes_(cbData) BYTE *pDest, _In_ size_t cbData);
+	/// <summary>
+	/// Consumer side. Drops up to cbData bytes from the read end of the buffer, and returns the number of bytes dropped.
+	/// </summary>
+	size_t Skip(_In_ size_t cbData);
+	/// <summary>
+	/// Consumer side. Drops all data currently in the buffer.
+	/// </summary>
+	void Clear();
+
+	size_t GetAvailableBytes() const;
+	size_t GetFreeBytes() const;
+	inline size_t GetCapacity() const { return m_Capacity; }
+	inline bool IsInitialized() const { return m_Buffer != nullptr; }
+	/// <summary>
+	/// The total number of bytes dropped by the producer because the buffer was full.
+	/// </summary>
+	inline UINT64 GetOverflowBytes() const { return m_OverflowBytes.load(std::memory_order_relaxed); }
+	/// <summary>
+	/// The number of writes that were truncated because the buffer was full.
+	/// </summary>
+	inline UINT64 GetOverflowCount() const { return m_OverflowCount.load(std::memory_order_relaxed); }
+private:
+	std::unique_ptr<BYTE[]> m_Buffer;
+	size_t m_Capacity;
+	size_t m_Mask;
+	UINT32 m_BlockAlign;
+	//Head and tail are kept on separate cache lines to avoid false sharing between producer and consumer.
+	alignas(64) std::atomic<UINT64> m_WritePos;
+	alignas(64) std::atomic<UINT64> m_ReadPos;
+	alignas(64) std::atomic<UINT64> m_OverflowBytes;
+	std::atomic<UINT64> m_OverflowCount;
+
+	size_t ReserveWrite(_In_ size_t cbData, _Out_ UINT64 *pWritePos);
+};
@@ -0,0 +1,178 @@
+#include "AudioSampleConverter.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+	const float Int16Scale = 32768.0f;
+	const float Int16Max = 32767.0f;
+	const float Int16Min = -32768.0f;
+	//Values at or beyond these limits round to a sample outside the 16 bit range.
+	const float Int16ClipHigh = 32767.5f;
+	const float Int16ClipLow = -32768.5f;
+	//Scales the difference of two 16 bit uniform random numbers to triangular noise of +-1 LSB.
+	const float DitherScale = 1.0f / 65536.0f;
+
+	inline int PopCount4(int mask) {
+		static const int bits[16] = { 0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4 };
+		return bits[mask & 0xF];
+	}
+
+	inline uint32_t NextRandom(uint32_t &state) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	/// <summary>
+	/// Triangular (TPDF) dither noise in LSB units, from the difference of the low and high halves of a random number.
+	/// </summary>
+	inline float NextDither(uint32_t &state) {
+		uint32_t random = NextRandom(state);
+		return ((int)(random & 0xFFFF) - (int)(random >> 16)) * DitherScale;
+	}
+
+	size_t ConvertScalar(const float *pInput, int16_t *pOutput, size_t start, size_t end, float scale, bool isDitherEnabled, uint32_t &state) {
+		size_t clipped = 0;
+		for (size_t i = start; i < end; i++) {
+			float value = pInput[i] * scale;
+			if (isDitherEnabled) {
+				value += NextDither(state);
+			}
+			if (value >= Int16ClipHigh || value < Int16ClipLow) {
+				clipped++;
+			}
+			pOutput[i] = (int16_t)std::lrintf((std::min)((std::max)(value, Int16Min), Int16Max));
+		}
+		return clipped;
+	}
+
+#if SIMD_X86
+	inline __m128i NextRandomSSE2(__m128i &state) {
+		state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+		state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+		state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+		return state;
+	}
+
+	inline __m128 NextDitherSSE2(__m128i &state) {
+		const __m128i lowMask = _mm_set1_epi32(0xFFFF);
+		__m128i random = NextRandomSSE2(state);
+		__m128i difference = _mm_sub_epi32(_mm_and_si128(random, lowMask), _mm_srli_epi32(random, 16));
+		return _mm_mul_ps(_mm_cvtepi32_ps(difference), _mm_set1_ps(DitherScale));
+	}
+
+	size_t ConvertSSE2(const float *pInput, int16_t *pOutput, size_t end, float scale, bool isDitherEnabled, uint32_t *pState) {
+		const __m128 scaleValue = _mm_set1_ps(scale);
+		const __m128 maxValue = _mm_set1_ps(Int16Max);
+		const __m128 minValue = _mm_set1_ps(Int16Min);
+		const __m128 clipHigh = _mm_set1_ps(Int16ClipHigh);
+		const __m128 clipLow = _mm_set1_ps(Int16ClipLow);
+		__m128i state = _mm_load_si128(reinterpret_cast<const __m128i *>(pState));
+		size_t clipped = 0;
+		for (size_t i = 0; i < end; i += 8) {
+			__m128 value0 = _mm_mul_ps(_mm_loadu_ps(pInput + i), scaleValue);
+			__m128 value1 = _mm_mul_ps(_mm_loadu_ps(pInput + i + 4), scaleValue);
+			if (isDitherEnabled) {
+				value0 = _mm_add_ps(value0, NextDitherSSE2(state));
+				value1 = _mm_add_ps(value1, NextDitherSSE2(state));
+			}
+			int clipMask0 = _mm_movemask_ps(_mm_or_ps(_mm_cmpge_ps(value0, clipHigh), _mm_cmplt_ps(value0, clipLow)));
+			int clipMask1 = _mm_movemask_ps(_mm_or_ps(_mm_cmpge_ps(value1, clipHigh), _mm_cmplt_ps(value1, clipLow)));
+			clipped += PopCount4(clipMask0) + PopCount4(clipMask1);
+			//Clamped before the conversion, because out of range floats convert to the most negative integer.
+			value0 = _mm_min_ps(_mm_max_ps(value0, minValue), maxValue);
+			value1 = _mm_min_ps(_mm_max_ps(value1, minValue), maxValue);
+			__m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(value0), _mm_cvtps_epi32(value1));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pOutput + i), packed);
+		}
+		_mm_store_si128(reinterpret_cast<__m128i *>(pState), state);
+		return clipped;
+	}
+
+	SIMD_TARGET_AVX2 inline __m256 NextDitherAVX2(__m256i &state) {
+		const __m256i lowMask = _mm256_set1_epi32(0xFFFF);
+		state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 13));
+		state = _mm256_xor_si256(state, _mm256_srli_epi32(state, 17));
+		state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 5));
+		__m256i difference = _mm256_sub_epi32(_mm256_and_si256(state, lowMask), _mm256_srli_epi32(state, 16));
+		return _mm256_mul_ps(_mm256_cvtepi32_ps(difference), _mm256_set1_ps(DitherScale));
+	}
+
+	SIMD_TARGET_AVX2 size_t ConvertAVX2(const float *pInput, int16_t *pOutput, size_t end, float scale, bool isDitherEnabled, uint32_t *pState) {
+		const __m256 scaleValue = _mm256_set1_ps(scale);
+		const __m256 maxValue = _mm256_set1_ps(Int16Max);
+		const __m256 minValue = _mm256_set1_ps(Int16Min);
+		const __m256 clipHigh = _mm256_set1_ps(Int16ClipHigh);
+		const __m256 clipLow = _mm256_set1_ps(Int16ClipLow);
+		__m256i state = _mm256_load_si256(reinterpret_cast<const __m256i *>(pState));
+		size_t clipped = 0;
+		for (size_t i = 0; i < end; i += 16) {
+			__m256 value0 = _mm256_mul_ps(_mm256_loadu_ps(pInput + i), scaleValue);
+			__m256 value1 = _mm256_mul_ps(_mm256_loadu_ps(pInput + i + 8), scaleValue);
+			if (isDitherEnabled) {
+				value0 = _mm256_add_ps(value0, NextDitherAVX2(state));
+				value1 = _mm256_add_ps(value1, NextDitherAVX2(state));
+			}
+			int clipMask0 = _mm256_movemask_ps(_mm256_or_ps(_mm256_cmp_ps(value0, clipHigh, _CMP_GE_OQ), _mm256_cmp_ps(value0, clipLow, _CMP_LT_OQ)));
+			int clipMask1 = _mm256_movemask_ps(_mm256_or_ps(_mm256_cmp_ps(value1, clipHigh, _CMP_GE_OQ), _mm256_cmp_ps(value1, clipLow, _CMP_LT_OQ)));
+			clipped += PopCount4(clipMask0) + PopCount4(clipMask0 >> 4) + PopCount4(clipMask1) + PopCount4(clipMask1 >> 4);
+			value0 = _mm256_min_ps(_mm256_max_ps(value0, minValue), maxValue);
+			value1 = _mm256_min_ps(_mm256_max_ps(value1, minValue), maxValue);
+			//packs works within 128 bit lanes, so the 64 bit quarters are reordered afterwards to restore sample order.
+			__m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(value0), _mm256_cvtps_epi32(value1));
+			packed = _mm256_permute4x64_epi64(packed, 0xD8);
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(pOutput + i), packed);
+		}
+		_mm256_store_si256(reinterpret_cast<__m256i *>(pState), state);
+		_mm256_zeroupper();
+		return clipped;
+	}
+#endif
+}
+
+AudioSampleConverter::AudioSampleConverter() :
+	m_DitherState{},
+	m_IsDitherEnabled(true),
+	m_SimdLevel(SimdLevel::Scalar)
+{
+	Initialize();
+}
+
+AudioSampleConverter::~AudioSampleConverter()
+{
+}
+
+void AudioSampleConverter::Initialize(_In_ bool isDitherEnabled, _In_ SimdLevel level)
+{
+	m_IsDitherEnabled = isDitherEnabled;
+	m_SimdLevel = ResolveSimdLevel(level);
+	//Any nonzero seed works for xorshift. Each lane gets a different one so the lanes are uncorrelated.
+	uint32_t seed = 0x9E3779B9;
+	for (int lane = 0; lane < 8; lane++) {
+		m_DitherState[lane] = NextRandom(seed);
+	}
+}
+
+size_t AudioSampleConverter::ConvertToInt16(_In_reads_(sampleCount) const float *pInput, _Out_writes_(sampleCount) int16_t *pOutput, _In_ size_t sampleCount)
+{
+	const float scale = Int16Scale;
+	size_t vectorEnd = 0;
+	size_t clipped = 0;
+#if SIMD_X86
+	switch (m_SimdLevel) {
+		case SimdLevel::AVX2:
+			vectorEnd = sampleCount & ~(size_t)15;
+			clipped += ConvertAVX2(pInput, pOutput, vectorEnd, scale, m_IsDitherEnabled, m_DitherState);
+			break;
+		case SimdLevel::SSE2:
+			vectorEnd = sampleCount & ~(size_t)7;
+			clipped += ConvertSSE2(pInput, pOutput, vectorEnd, scale, m_IsDitherEnabled, m_DitherState);
+			break;
+		default:
+			break;
+	}
+#endif
+	clipped += ConvertScalar(pInput, pOutput, vectorEnd, sampleCount, scale, m_IsDitherEnabled, m_DitherState[0]);
+	return clipped;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <sal.h>
+#include "Simd.util.h"
+
+/// <summary>
+/// Converts the internal 32 bit float audio to 16 bit PCM for the encoder, in a single pass with saturation and optional TPDF dither.
+/// Float samples are full scale at [-1.0, 1.0]. Samples outside that range are saturated and counted as clipped.
+/// The dither noise generator is kept between calls, so a stream can be converted in blocks of any size.
+/// </summary>
+class AudioSampleConverter
+{
+public:
+	AudioSampleConverter();
+	~AudioSampleConverter();
+	/// <summary>
+	/// Selects the SIMD level and seeds the dither noise generator.
+	/// </summary>
+	void Initialize(_In_ bool isDitherEnabled = true, _In_ SimdLevel level = SimdLevel::Auto);
+	/// <summary>
+	/// Converts sampleCount float samples to 16 bit samples.
+	/// </summary>
+	/// <returns>The number of samples that were clipped.</returns>
+	size_t ConvertToInt16(_In_reads_(sampleCount) const float *pInput, _Out_writes_(sampleCount) int16_t *pOutput, _In_ size_t sampleCount);
+	inline bool IsDitherEnabled() const { return m_IsDitherEnabled; }
+private:
+	//One xorshift32 generator per SIMD lane, so the vector paths can generate noise without any cross lane work.
+	alignas(32) uint32_t m_DitherState[8];
+	bool m_IsDitherEnabled;
+	SimdLevel m_SimdLevel;
+};
@@ -0,0 +1,202 @@
+#include "AudioWriter.h"
+#include "AudioManager.h"
+#include "OutputManager.h"
+#include "cleanup.h"
+#include <ppltasks.h>
+
+using namespace std;
+
+namespace {
+	const INT64 HundredNanosPerMillisecond = 10000;
+}
+
+struct AudioWriter::TaskWrapper {
+	Concurrency::task<void> m_WriteTask = concurrency::task_from_result();
+};
+
+AudioWriter::AudioWriter() :
+	m_TaskWrapperImpl(make_unique<TaskWrapper>()),
+	m_AudioManager(nullptr),
+	m_OutputManager(nullptr),
+	m_StopEvent(nullptr),
+	m_Result(S_OK),
+	m_Stats{},
+	m_BlockAlign(0),
+	m_GrabbedUntil(0),
+	m_LastWriteTime(0)
+{
+}
+
+AudioWriter::~AudioWriter()
+{
+	StopWriting();
+}
+
+HRESULT AudioWriter::StartWriting(_In_ AudioManager *pAudioManager, _In_ OutputManager *pOutputManager, _In_ UINT32 sampleRate, _In_ UINT32 channels, _In_ UINT32 bitsPerSample)
+{
+	if (m_StopEvent) {
+		return E_UNEXPECTED;
+	}
+	if (!pAudioManager || !pOutputManager) {
+		return E_INVALIDARG;
+	}
+	m_AudioManager = pAudioManager;
+	m_OutputManager = pOutputManager;
+	m_BlockAlign = channels * bitsPerSample / 8;
+	RETURN_ON_BAD_HR(m_OutputManager->GetMediaTimeStamp(&m_GrabbedUntil));
+	//One packetizer per track the output was created with. Should the AudioManager have laid out fewer tracks, the rest get silence.
+	UINT32 trackCount = m_OutputManager->GetAudioTrackCount();
+	if (trackCount == 0) {
+		return E_UNEXPECTED;
+	}
+	if (trackCount != m_AudioManager->GetAudioTrackCount()) {
+		LOG_WARN(L"The output has %u audio tracks, but %u are recorded", trackCount, m_AudioManager->GetAudioTrackCount());
+	}
+	m_Tracks.clear();
+	m_Tracks.resize(trackCount);
+	for (AUDIO_WRITER_TRACK &track : m_Tracks) {
+		RETURN_ON_BAD_HR(track.Packetizer.Initialize(sampleRate, m_BlockAlign, AudioPacketizer::DefaultPacketFrames, m_GrabbedUntil));
+	}
+	m_GrabbedBuffers.clear();
+	m_GrabbedBuffers.resize(trackCount);
+	m_LastWriteTime = m_GrabbedUntil;
+	m_Stats = AUDIO_WRITER_STATS{};
+	m_Result = S_OK;
+	m_StopEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+	if (nullptr == m_StopEvent) {
+		LOG_ERROR(L"CreateEvent failed: last error is %u", GetLastError());
+		return E_FAIL;
+	}
+	//Wake up once per packet. Anything recorded in between is written on the next pass, so oversleeping only delays the audio, it is never lost.
+	DWORD intervalMillis = (std::max)((DWORD)1, (DWORD)(AudioPacketizer::DefaultPacketFrames * 1000ULL / sampleRate));
+	m_TaskWrapperImpl->m_WriteTask = concurrency::create_task([this, intervalMillis]() {
+		HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED | COINIT_DISABLE_OLE1DDE);
+		bool isCoInitialized = SUCCEEDED(hr);
+		DWORD taskIndex = 0;
+		//Registered like the capture threads, so a busy video encode can not starve the audio.
+		HANDLE hTask = AvSetMmThreadCharacteristics(L"Audio", &taskIndex);
+		try {
+			while (SUCCEEDED(hr)) {
+				bool isStopping = WaitForSingleObjectEx(m_StopEvent, intervalMillis, FALSE) == WAIT_OBJECT_0;
+				hr = WriteRecordedAudio();
+				if (isStopping) {
+					for (UINT32 track = 0; SUCCEEDED(hr) && track < m_Tracks.size(); track++) {
+						hr = WritePackets(track, true);
+					}
+					break;
+				}
+			}
+		}
+		catch (const exception &e) {
+			LOG_ERROR(L"Exception in AudioWriter: %s", s2ws(e.what()).c_str());
+			hr = E_FAIL;
+		}
+		catch (...) {
+			LOG_ERROR(L"Exception in AudioWriter");
+			hr = E_FAIL;
+		}
+		if (FAILED(hr)) {
+			_com_error err(hr);
+			LOG_ERROR(L"Writing audio failed: %s", err.ErrorMessage());
+			m_Result = hr;
+		}
+		if (hTask) {
+			AvRevertMmThreadCharacteristics(hTask);
+		}
+		if (isCoInitialized) {
+			CoUninitialize();
+		}
+	});
+	return S_OK;
+}
+
+HRESULT AudioWriter::StopWriting()
+{
+	if (!m_StopEvent) {
+		return S_FALSE;
+	}
+	SetEvent(m_StopEvent);
+	try
+	{
+		m_TaskWrapperImpl->m_WriteTask.wait();
+	}
+	catch (const exception &e) {
+		LOG_ERROR(L"Exception in StopWriting: %s", s2ws(e.what()).c_str());
+	}
+	catch (...) {
+		LOG_ERROR(L"Exception in StopWriting");
+	}
+	CloseHandle(m_StopEvent);
+	m_StopEvent = nullptr;
+	LOG_DEBUG(L"Wrote %llu audio packets with %llu frames, %llu frames of silence padding, at most %.1f ms apart",
+		m_Stats.Packets, m_Stats.Frames, m_Stats.PaddedFrames, (double)m_Stats.MaxWriteInterval100Nanos / HundredNanosPerMillisecond);
+	return m_Result;
+}
+
+HRESULT AudioWriter::WriteRecordedAudio()
+{
+	if (m_OutputManager->isMediaClockPaused()) {
+		//The media clock stands still while paused, so nothing is written, and what is captured in the meantime is dropped.
+		m_AudioManager->ClearRecordedBytes();
+		return S_OK;
+	}
+	INT64 now;
+	RETURN_ON_BAD_HR(m_OutputManager->GetMediaTimeStamp(&now));
+	m_Stats.MaxWriteInterval100Nanos = (std::max)(m_Stats.MaxWriteInterval100Nanos, now - m_LastWriteTime);
+	m_LastWriteTime = now;
+	INT64 duration = now - m_GrabbedUntil;
+	if (duration <= 0) {
+		return S_OK;
+	}
+	m_GrabbedUntil = now;
+	RETURN_ON_BAD_HR(m_AudioManager->GrabAudioTracks(duration, (UINT32)m_GrabbedBuffers.size(), m_GrabbedBuffers.data()));
+	HRESULT hr = S_OK;
+	for (UINT32 track = 0; SUCCEEDED(hr) && track < m_Tracks.size(); track++) {
+		hr = WriteTrackAudio(track, m_GrabbedBuffers[track]);
+	}
+	//The pooled buffers go back to the pool as soon as they are copied.
+	for (auto &pBuffer : m_GrabbedBuffers) {
+		pBuffer.Release();
+	}
+	return hr;
+}
+
+HRESULT AudioWriter::WriteTrackAudio(_In_ UINT32 track, _In_opt_ IMFMediaBuffer *pAudioBuffer)
+{
+	AUDIO_WRITER_TRACK &writerTrack = m_Tracks[track];
+	DWORD audioByteCount = 0;
+	if (pAudioBuffer) {
+		RETURN_ON_BAD_HR(pAudioBuffer->GetCurrentLength(&audioByteCount));
+	}
+	if (audioByteCount > 0) {
+		BYTE *pData = nullptr;
+		RETURN_ON_BAD_HR(pAudioBuffer->Lock(&pData, nullptr, nullptr));
+		writerTrack.Packetizer.Write(pData, audioByteCount);
+		pAudioBuffer->Unlock();
+	}
+	/* The timestamps come from the frames written, so whenever the sources deliver less than the time that passed, e.g. because they are silent or
+	 * just late, the track falls behind the media clock. Once it is more than a packet behind, it is padded with silence up to the media clock.
+	 * Otherwise all later audio would play early against the video, and the sink writer would throttle video frames waiting for audio.
+	 * Audio that is just late is not padded, as it arrives on the next pass, and inserting silence would glitch. */
+	m_Stats.PaddedFrames += writerTrack.Packetizer.WriteSilenceUntil(m_GrabbedUntil, writerTrack.Packetizer.GetPacketFrames());
+	return WritePackets(track, false);
+}
+
+HRESULT AudioWriter::WritePackets(_In_ UINT32 track, _In_ bool isFinal)
+{
+	AudioPacketizer &packetizer = m_Tracks[track].Packetizer;
+	while (packetizer.GetPendingFrames() >= packetizer.GetPacketFrames()
+		|| (isFinal && packetizer.GetPendingFrames() > 0)) {
+		CComPtr<PooledMediaBuffer> pBuffer;
+		RETURN_ON_BAD_HR(m_BufferPool.GetBuffer((DWORD)packetizer.GetPacketBytes(), &pBuffer));
+		AUDIO_ENCODER_PACKET packet;
+		if (!packetizer.ReadPacket(pBuffer->GetData(), &packet)) {
+			packetizer.ReadPartialPacket(pBuffer->GetData(), &packet);
+		}
+		RETURN_ON_BAD_HR(pBuffer->SetCurrentLength(packet.Frames * m_BlockAlign));
+		RETURN_ON_BAD_HR(m_OutputManager->WriteAudioPacket(track, pBuffer, packet.Timestamp100Nanos, packet.Duration100Nanos));
+		m_Stats.Packets++;
+		m_Stats.Frames += packet.Frames;
+	}
+	return S_OK;
+}
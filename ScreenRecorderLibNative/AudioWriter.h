@@ -0,0 +1,78 @@
+#pragma once
+#include <windows.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <atlbase.h>
+#include "AudioPacketizer.h"
+#include "MediaBufferPool.h"
+
+class AudioManager;
+class OutputManager;
+
+struct AUDIO_WRITER_STATS {
+	//Packets and frames written, counted over all tracks.
+	UINT64 Packets;
+	UINT64 Frames;
+	//Frames of silence written because less audio was captured than time passed, counted over all tracks.
+	UINT64 PaddedFrames;
+	//The longest time between two passes writing audio, in 100 nanosecond units. Stays close to the packet duration unless the writer itself is starved.
+	INT64 MaxWriteInterval100Nanos;
+};
+
+/// <summary>
+/// Writes the recorded audio to the sink writer on its own thread, in packets of a fixed number of frames timestamped from the audio clock.
+/// The audio is taken from the AudioManager on the writer's own schedule, so neither a slow video encode nor a low frame rate delays or
+/// resizes the audio written. Every audio track of the output is cut into packets of its own, all from the same grab, so the tracks stay in step.
+/// </summary>
+class AudioWriter
+{
+public:
+	AudioWriter();
+	~AudioWriter();
+	/// <summary>
+	/// Starts the writer thread. Audio is written from the current media time on, to each audio track of the output. Both managers must outlive the writer, or StopWriting must be called first.
+	/// </summary>
+	HRESULT StartWriting(_In_ AudioManager *pAudioManager, _In_ OutputManager *pOutputManager, _In_ UINT32 sampleRate, _In_ UINT32 channels, _In_ UINT32 bitsPerSample);
+	/// <summary>
+	/// Writes the audio recorded up to the current media time, including a last partial packet, and stops the writer thread.
+	/// </summary>
+	HRESULT StopWriting();
+	/// <summary>
+	/// The error that stopped the writer thread, or S_OK while it runs. Safe to call from any thread.
+	/// </summary>
+	inline HRESULT GetResult() const { return m_Result; }
+	/// <summary>
+	/// Counts of the audio written. Only valid once StopWriting has returned.
+	/// </summary>
+	inline AUDIO_WRITER_STATS GetStats() const { return m_Stats; }
+private:
+	struct TaskWrapper;
+	std::unique_ptr<TaskWrapper> m_TaskWrapperImpl;
+	AudioManager *m_AudioManager;
+	OutputManager *m_OutputManager;
+	/// <summary>
+	/// The packets of one audio track being cut.
+	/// </summary>
+	struct AUDIO_WRITER_TRACK {
+		AudioPacketizer Packetizer;
+	};
+	std::vector<AUDIO_WRITER_TRACK> m_Tracks;
+	//The audio grabbed for each track on the last pass, reused so a pass does not allocate.
+	std::vector<CComPtr<IMFMediaBuffer>> m_GrabbedBuffers;
+	MediaBufferPool m_BufferPool;
+	HANDLE m_StopEvent;
+	std::atomic<HRESULT> m_Result;
+	AUDIO_WRITER_STATS m_Stats;
+	UINT32 m_BlockAlign;
+	//The media time the audio has been taken from the AudioManager up to.
+	INT64 m_GrabbedUntil;
+	INT64 m_LastWriteTime;
+
+	/// <summary>
+	/// Takes the audio recorded since the last pass, and writes all full packets.
+	/// </summary>
+	HRESULT WriteRecordedAudio();
+	HRESULT WriteTrackAudio(_In_ UINT32 track, _In_opt_ IMFMediaBuffer *pAudioBuffer);
+	HRESULT WritePackets(_In_ UINT32 track, _In_ bool isFinal);
+};
@@ -0,0 +1,89 @@
+#include "BufferedStreamWriter.h"
+#include <cstring>
+
+BufferedStreamWriter::BufferedStreamWriter() :
+	m_Stream(nullptr),
+	m_BufferedBytes(0),
+	m_Stats{}
+{
+}
+
+HRESULT BufferedStreamWriter::Initialize(_In_ IStream *pStream, _In_ UINT32 bufferBytes)
+{
+	if (!pStream) {
+		return E_INVALIDARG;
+	}
+	m_Stream = pStream;
+	m_Buffer.resize(bufferBytes);
+	m_BufferedBytes = 0;
+	m_Stats = BUFFERED_STREAM_WRITER_STATS{};
+	return S_OK;
+}
+
+HRESULT BufferedStreamWriter::Write(_In_reads_bytes_(cbData) const void *pData, _In_ DWORD cbData)
+{
+	if (!m_Stream) {
+		return E_UNEXPECTED;
+	}
+	if (cbData == 0) {
+		return S_OK;
+	}
+	HRESULT hr = S_OK;
+	if (cbData > m_Buffer.size() - m_BufferedBytes) {
+		hr = WriteBuffer();
+		if (FAILED(hr)) {
+			return hr;
+		}
+	}
+	if (cbData >= m_Buffer.size()) {
+		hr = WriteToStream(pData, cbData);
+	}
+	else {
+		memcpy(m_Buffer.data() + m_BufferedBytes, pData, cbData);
+		m_BufferedBytes += cbData;
+	}
+	if (SUCCEEDED(hr)) {
+		m_Stats.BytesWritten += cbData;
+	}
+	return hr;
+}
+
+HRESULT BufferedStreamWriter::Flush()
+{
+	if (!m_Stream) {
+		return E_UNEXPECTED;
+	}
+	m_Stats.Flushes++;
+	return WriteBuffer();
+}
+
+HRESULT BufferedStreamWriter::Commit()
+{
+	HRESULT hr = Flush();
+	if (FAILED(hr)) {
+		return hr;
+	}
+	m_Stats.Commits++;
+	return m_Stream->Commit(STGC_DEFAULT);
+}
+
+HRESULT BufferedStreamWriter::WriteBuffer()
+{
+	if (m_BufferedBytes == 0) {
+		return S_OK;
+	}
+	HRESULT hr = WriteToStream(m_Buffer.data(), m_BufferedBytes);
+	m_BufferedBytes = 0;
+	return hr;
+}
+
+HRESULT BufferedStreamWriter::WriteToStream(_In_reads_bytes_(cbData) const void *pData, _In_ DWORD cbData)
+{
+	ULONG written = 0;
+	HRESULT hr = m_Stream->Write(pData, cbData, &written);
+	if (SUCCEEDED(hr) && written != cbData) {
+		hr = STG_E_MEDIUMFULL;
+	}
+	m_Stats.StreamWrites++;
+	return hr;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <windows.h>
+#include <objidl.h>
+#include <sal.h>
+#include <vector>
+
+struct BUFFERED_STREAM_WRITER_STATS {
+	//The bytes handed to the writer, buffered or not.
+	UINT64 BytesWritten;
+	//The writes to the stream those bytes took.
+	UINT64 StreamWrites;
+	//The times the caller flushed the buffer, e.g. at the end of each fragment.
+	UINT64 Flushes;
+	//The times the stream was committed, which for a file waits for the disk.
+	UINT64 Commits;
+};
+
+/// <summary>
+/// Gathers small writes into a buffer and writes it to the stream in one go once it is full or flushed, so the stream sees a few large writes
+/// instead of one per box or sample. Writes too big for the buffer go straight to the stream, after what is already buffered.
+/// The stream is not referenced, and must stay valid until the last Flush has returned. Not thread safe.
+/// </summary>
+class BufferedStreamWriter
+{
+public:
+	BufferedStreamWriter();
+	/// <summary>
+	/// Starts writing to pStream at its current position. A buffer of 0 bytes writes everything straight to the stream.
+	/// </summary>
+	HRESULT Initialize(_In_ IStream *pStream, _In_ UINT32 bufferBytes);
+	HRESULT Write(_In_reads_bytes_(cbData) const void *pData, _In_ DWORD cbData);
+	/// <summary>
+	/// Writes what is buffered to the stream.
+	/// </summary>
+	HRESULT Flush();
+	/// <summary>
+	/// Flushes, and commits the stream, so what was written survives a crash of the process or the system.
+	/// </summary>
+	HRESULT Commit();
+	/// <summary>
+	/// The number of bytes written since Initialize, i.e. the position in the output the next write lands at.
+	/// </summary>
+	inline UINT64 GetPosition() const { return m_Stats.BytesWritten; }
+	inline UINT32 GetBufferedBytes() const { return m_BufferedBytes; }
+	inline BUFFERED_STREAM_WRITER_STATS GetStats() const { return m_Stats; }
+private:
+	IStream *m_Stream;
+	std::vector<BYTE> m_Buffer;
+	UINT32 m_BufferedBytes;
+	BUFFERED_STREAM_WRITER_STATS m_Stats;
+
+	HRESULT WriteBuffer();
+	HRESULT WriteToStream(_In_reads_bytes_(cbData) const void *pData, _In_ DWORD cbData);
+};
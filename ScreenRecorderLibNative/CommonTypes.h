@@ -14,6 +14,7 @@
 #include <optional>
 #include <wincodec.h>
 #include <chrono>
+#include <atomic>
 #include "util.h"
 #include <windows.h>
 #include <new>
@@ -181,7 +182,9 @@ enum class RecorderModeInternal {
 	Slideshow = 1,
 	///<summary>Create a single screenshot.</summary>
 	Screenshot = 2, 
-	Preview = 3
+	Preview = 3,
+	///<summary>Record only audio to a WAV file, without a D3D device or any screen capture.</summary>
+	Audio = 4
 };
 
 enum class TextureStretchMode {
@@ -207,6 +210,52 @@ enum class ContentAnchor {
 	BottomRight
 };
 
+enum class AudioTrackLayoutInternal {
+	///<summary>All audio devices mixed to a single track.</summary>
+	Mixed = 0,
+	///<summary>One track per audio device, not mixed.</summary>
+	Separate = 1,
+	///<summary>The mixed track first, followed by one track per audio device.</summary>
+	MixedAndSeparate = 2
+};
+
+enum class AudioCaptureWakeModeInternal {
+	///<summary>The capture thread wakes up on a timer and collects whatever the device has captured.</summary>
+	Timer = 0,
+	///<summary>The device wakes the capture thread when a packet is ready. Loopback captures fall back to the timer, as the device does not signal them reliably.</summary>
+	Event = 1
+};
+
+enum class VideoColorConversionModeInternal {
+	///<summary>Convert on the GPU when the video processor can, otherwise on the CPU.</summary>
+	Auto = 0,
+	///<summary>Always convert on the CPU, with SIMD instructions on several threads.</summary>
+	Cpu = 1,
+	///<summary>Always convert with the video processor media transform.</summary>
+	MediaTransform = 2
+};
+
+enum class VideoColorMatrixInternal {
+	BT601 = 0,
+	BT709 = 1
+};
+
+enum class FrameQueueFullPolicyInternal {
+	///<summary>Wait for the encoder to make room. No frame is lost, but the capture is held up.</summary>
+	Block = 0,
+	///<summary>Drop the oldest queued frame to make room for the new one.</summary>
+	DropOldest = 1,
+	///<summary>Drop the new frame.</summary>
+	DropNewest = 2
+};
+
+enum class Mp4MuxerInternal {
+	///<summary>The Media Foundation MPEG-4 sinks.</summary>
+	MediaFoundation = 0,
+	///<summary>FragmentedMp4Muxer, writing fragments of a set duration through a write buffer.</summary>
+	Native = 1
+};
+
 enum class RecordingSourceType {
 	Display,
 	Window,
@@ -433,6 +482,7 @@ protected:
 
 	std::wstring m_AudioOutputDevice = L"";
 	std::wstring m_AudioInputDevice = L"";
+	std::vector<std::wstring> m_AdditionalInputDevices;
 	bool m_IsAudioEnabled = false;
 	bool m_IsOutputDeviceEnabled = true;
 	bool m_IsInputDeviceEnabled = true;
@@ -440,19 +490,56 @@ protected:
 	UINT32 m_AudioChannels = 2; //Number of audio channels. 1,2 and 6 is supported. 6 only on windows 8 and up.
 	float m_OutputVolumeModifier = 1;
 	float m_InputVolumeModifier = 1;
+	bool m_IsLimiterEnabled = true; //Limit peaks of the mixed audio with a lookahead limiter, instead of clipping them when converting to 16 bit.
+	UINT32 m_LimiterLookaheadMillis = 5; //How far the limiter looks ahead, and so how much it delays the audio. At most 20 ms.
+	AudioTrackLayoutInternal m_AudioTrackLayout = AudioTrackLayoutInternal::Mixed; //The tracks are laid out for the devices enabled when recording starts.
+	UINT32 m_CaptureBufferMillis = 200; //Size of the device capture buffer. Audio is lost if the capture thread sleeps longer than this.
+	AudioCaptureWakeModeInternal m_CaptureWakeMode = AudioCaptureWakeModeInternal::Event;
+	UINT32 m_CaptureWakeIntervalMillis = 0; //Time between wakeups of a timer driven capture. 0 for half the device period.
+	//Incremented by every setter of an option that can change while recording, so the recorder only has to compare versions to see if anything changed.
+	std::atomic<UINT64> m_ChangeVersion{ 0 };
+	//Guards the device names, which can be swapped from another thread while recording.
+	CRITICAL_SECTION m_DeviceCriticalSection;
+	void NotifyChanged() { m_ChangeVersion.fetch_add(1, std::memory_order_release); }
+	template <typename T> void SetDeviceValue(T &target, const T &value) {
+		EnterCriticalSection(&m_DeviceCriticalSection);
+		target = value;
+		LeaveCriticalSection(&m_DeviceCriticalSection);
+		NotifyChanged();
+	}
+	template <typename T> T GetDeviceValue(const T &source) {
+		EnterCriticalSection(&m_DeviceCriticalSection);
+		T value = source;
+		LeaveCriticalSection(&m_DeviceCriticalSection);
+		return value;
+	}
 public:
-	void SetInputVolume(float volume) { m_InputVolumeModifier = volume; }
-	void SetOutputVolume(float volume) { m_OutputVolumeModifier = volume; }
+	AUDIO_OPTIONS() { InitializeCriticalSection(&m_DeviceCriticalSection); }
+	~AUDIO_OPTIONS() { DeleteCriticalSection(&m_DeviceCriticalSection); }
+	void SetInputVolume(float volume) { m_InputVolumeModifier = volume; NotifyChanged(); }
+	void SetOutputVolume(float volume) { m_OutputVolumeModifier = volume; NotifyChanged(); }
 	void SetAudioBitrate(UINT32 bitrate) { m_AudioBitrate = bitrate; }
 	void SetAudioChannels(UINT32 channels) { m_AudioChannels = channels; }
-	void SetOutputDevice(std::wstring string) { m_AudioOutputDevice = string; }
-	void SetInputDevice(std::wstring string) { m_AudioInputDevice = string; }
-	void SetAudioEnabled(bool value) { m_IsAudioEnabled = value; }
-	void SetOutputDeviceEnabled(bool value) { m_IsOutputDeviceEnabled = value; }
-	void SetInputDeviceEnabled(bool value) { m_IsInputDeviceEnabled = value; }
-
-	std::wstring GetAudioOutputDevice() { return m_AudioOutputDevice; }
-	std::wstring GetAudioInputDevice() { return m_AudioInputDevice; }
+	void SetLimiterEnabled(bool value) { m_IsLimiterEnabled = value; }
+	void SetLimiterLookaheadMillis(UINT32 millis) { m_LimiterLookaheadMillis = millis; }
+	void SetAudioTrackLayout(AudioTrackLayoutInternal layout) { m_AudioTrackLayout = layout; }
+	void SetCaptureBufferMillis(UINT32 millis) { m_CaptureBufferMillis = millis; }
+	void SetCaptureWakeMode(AudioCaptureWakeModeInternal mode) { m_CaptureWakeMode = mode; }
+	void SetCaptureWakeIntervalMillis(UINT32 millis) { m_CaptureWakeIntervalMillis = millis; }
+	void SetOutputDevice(std::wstring string) { SetDeviceValue(m_AudioOutputDevice, string); }
+	void SetInputDevice(std::wstring string) { SetDeviceValue(m_AudioInputDevice, string); }
+	void SetAdditionalInputDevices(std::vector<std::wstring> devices) { SetDeviceValue(m_AdditionalInputDevices, devices); }
+	void SetAudioEnabled(bool value) { m_IsAudioEnabled = value; NotifyChanged(); }
+	void SetOutputDeviceEnabled(bool value) { m_IsOutputDeviceEnabled = value; NotifyChanged(); }
+	void SetInputDeviceEnabled(bool value) { m_IsInputDeviceEnabled = value; NotifyChanged(); }
+
+	std::wstring GetAudioOutputDevice() { return GetDeviceValue(m_AudioOutputDevice); }
+	std::wstring GetAudioInputDevice() { return GetDeviceValue(m_AudioInputDevice); }
+	std::vector<std::wstring> GetAdditionalInputDevices() { return GetDeviceValue(m_AdditionalInputDevices); }
+	/// <summary>
+	/// Changes whenever an option that can be changed while recording is set. Cheap enough to check every frame.
+	/// </summary>
+	UINT64 GetChangeVersion() const { return m_ChangeVersion.load(std::memory_order_acquire); }
 	bool IsAudioEnabled() { return m_IsAudioEnabled; }
 	UINT32 GetAudioBitrate() { return m_AudioBitrate; }
 	UINT32 GetAudioChannels() { return m_AudioChannels; }
@@ -460,6 +547,44 @@ public:
 	float GetInputVolume() { return m_InputVolumeModifier; }
 	bool IsOutputDeviceEnabled() { return m_IsOutputDeviceEnabled; }
 	bool IsInputDeviceEnabled() { return m_IsInputDeviceEnabled; }
+	bool IsLimiterEnabled() { return m_IsLimiterEnabled; }
+	UINT32 GetLimiterLookaheadMillis() { return m_LimiterLookaheadMillis; }
+	AudioTrackLayoutInternal GetAudioTrackLayout() { return m_AudioTrackLayout; }
+	UINT32 GetCaptureBufferMillis() { return m_CaptureBufferMillis; }
+	AudioCaptureWakeModeInternal GetCaptureWakeMode() { return m_CaptureWakeMode; }
+	UINT32 GetCaptureWakeIntervalMillis() { return m_CaptureWakeIntervalMillis; }
+	/// <summary>
+	/// Indexes of the audio devices written to a track of their own, in device order: 0 is the output device, 1 the input device, and 2 and up the additional input devices.
+	/// Empty if the layout is Mixed.
+	/// </summary>
+	std::vector<size_t> GetSeparateAudioTrackDevices() {
+		std::vector<size_t> devices;
+		if (m_AudioTrackLayout == AudioTrackLayoutInternal::Mixed) {
+			return devices;
+		}
+		if (m_IsOutputDeviceEnabled) {
+			devices.push_back(0);
+		}
+		if (m_IsInputDeviceEnabled) {
+			size_t inputDeviceCount = 1 + GetAdditionalInputDevices().size();
+			for (size_t i = 0; i < inputDeviceCount; i++) {
+				devices.push_back(1 + i);
+			}
+		}
+		return devices;
+	}
+	/// <summary>
+	/// True if the mix of all devices is written to a track, which then is the first audio track. With no devices to give a track of their own, the mix is always written.
+	/// </summary>
+	bool IsMixedAudioTrackEnabled() {
+		return m_AudioTrackLayout != AudioTrackLayoutInternal::Separate || GetSeparateAudioTrackDevices().empty();
+	}
+	UINT32 GetAudioTrackCount() {
+		if (!m_IsAudioEnabled) {
+			return 0;
+		}
+		return (UINT32)GetSeparateAudioTrackDevices().size() + (IsMixedAudioTrackEnabled() ? 1 : 0);
+	}
 	GUID GetAudioEncoderFormat() { return AUDIO_ENCODING_FORMAT; }
 	UINT32 GetAudioBitsPerSample() { return AUDIO_BITS_PER_SAMPLE; }
 	UINT32 GetAudioSamplesPerSecond() { return AUDIO_SAMPLES_PER_SECOND; }
@@ -513,6 +638,24 @@ protected:
 	bool m_IsHardwareEncodingEnabled = true;
 	UINT32 m_VideoBitrateControlMode = eAVEncCommonRateControlMode_Quality;
 	UINT32 m_EncoderProfile = eAVEncH264VProfile_High;
+	VideoColorConversionModeInternal m_ColorConversionMode = VideoColorConversionModeInternal::Auto;
+	VideoColorMatrixInternal m_ColorMatrix = VideoColorMatrixInternal::BT709;
+	bool m_IsFullRangeColorEnabled = false;
+	UINT32 m_FrameQueueLength = 4;//Frames waiting to be encoded. 0 encodes on the capture thread.
+	FrameQueueFullPolicyInternal m_FrameQueueFullPolicy = FrameQueueFullPolicyInternal::Block;
+	bool m_IsUnchangedFrameSkippingEnabled = false;
+	UINT32 m_MaxUnchangedFrameDurationMillis = 1000;//The longest a frame is shown for while nothing changes, before it is written again.
+	Mp4MuxerInternal m_Mp4Muxer = Mp4MuxerInternal::MediaFoundation;
+	UINT32 m_FragmentDurationMillis = 1000;//The duration of the fragments of the native muxer, which also sets the keyframe interval.
+	UINT32 m_MuxerWriteBufferSize = 1024 * 1024;//The write buffer of the native muxer, in bytes. 0 writes every box straight to the output.
+	UINT32 m_ChunkDurationMillis = 0;//The duration of the chunks the native muxer writes a fragment in. 0 writes a fragment at a time.
+	UINT32 m_SegmentDurationMillis = 0;//The native muxer starts a new file once a segment lasts this long. 0 for no limit.
+	UINT64 m_SegmentSize = 0;//The native muxer starts a new file once a segment has grown to this many bytes. 0 for no limit.
+	bool m_IsCrashSafeEnabled = false;//The native muxer commits the output to disk periodically, and writes a recovery journal next to it.
+	UINT32 m_CrashSafeSyncIntervalMillis = 1000;//The recording time between commits of a crash safe recording. 0 commits every chunk.
+	bool m_IsInstantReplayEnabled = false;//The native muxer keeps the last seconds of the recording in memory, to be saved on request.
+	UINT32 m_InstantReplayDurationMillis = 60000;//How much of the recording the instant replay keeps.
+	UINT64 m_InstantReplayMaxMemory = 256 * 1024 * 1024;//The memory the instant replay takes, in bytes. A shorter window is kept if the recording does not fit.
 public:
 	void SetVideoFps(UINT32 fps) { m_VideoFps = fps; }
 	void SetVideoBitrate(UINT32 bitrate) { m_VideoBitrate = bitrate; }
@@ -525,6 +668,24 @@ public:
 	void SetLowLatencyModeEnabled(bool value) { m_IsLowLatencyModeEnabled = value; }
 	void SetVideoBitrateMode(UINT32 bitrateMode) { m_VideoBitrateControlMode = bitrateMode; }
 	void SetEncoderProfile(UINT32 profile) { m_EncoderProfile = profile; }
+	void SetColorConversionMode(VideoColorConversionModeInternal mode) { m_ColorConversionMode = mode; }
+	void SetColorMatrix(VideoColorMatrixInternal matrix) { m_ColorMatrix = matrix; }
+	void SetFullRangeColorEnabled(bool value) { m_IsFullRangeColorEnabled = value; }
+	void SetFrameQueueLength(UINT32 length) { m_FrameQueueLength = length; }
+	void SetFrameQueueFullPolicy(FrameQueueFullPolicyInternal policy) { m_FrameQueueFullPolicy = policy; }
+	void SetUnchangedFrameSkippingEnabled(bool value) { m_IsUnchangedFrameSkippingEnabled = value; }
+	void SetMaxUnchangedFrameDurationMillis(UINT32 millis) { m_MaxUnchangedFrameDurationMillis = millis; }
+	void SetMp4Muxer(Mp4MuxerInternal muxer) { m_Mp4Muxer = muxer; }
+	void SetFragmentDurationMillis(UINT32 millis) { m_FragmentDurationMillis = millis; }
+	void SetMuxerWriteBufferSize(UINT32 size) { m_MuxerWriteBufferSize = size; }
+	void SetChunkDurationMillis(UINT32 millis) { m_ChunkDurationMillis = millis; }
+	void SetSegmentDurationMillis(UINT32 millis) { m_SegmentDurationMillis = millis; }
+	void SetSegmentSize(UINT64 size) { m_SegmentSize = size; }
+	void SetCrashSafeEnabled(bool value) { m_IsCrashSafeEnabled = value; }
+	void SetCrashSafeSyncIntervalMillis(UINT32 millis) { m_CrashSafeSyncIntervalMillis = millis; }
+	void SetInstantReplayEnabled(bool value) { m_IsInstantReplayEnabled = value; }
+	void SetInstantReplayDurationMillis(UINT32 millis) { m_InstantReplayDurationMillis = millis; }
+	void SetInstantReplayMaxMemory(UINT64 size) { m_InstantReplayMaxMemory = size; }
 
 	UINT32 GetVideoFps() { return m_VideoFps; }
 	UINT32 GetVideoBitrate() { return m_VideoBitrate; }
@@ -537,6 +698,24 @@ public:
 	bool GetIsLowLatencyModeEnabled() { return m_IsLowLatencyModeEnabled; }
 	UINT32 GetVideoBitrateMode() { return m_VideoBitrateControlMode; }
 	UINT32 GetEncoderProfile() { return m_EncoderProfile; }
+	VideoColorConversionModeInternal GetColorConversionMode() { return m_ColorConversionMode; }
+	VideoColorMatrixInternal GetColorMatrix() { return m_ColorMatrix; }
+	bool GetIsFullRangeColorEnabled() { return m_IsFullRangeColorEnabled; }
+	UINT32 GetFrameQueueLength() { return m_FrameQueueLength; }
+	FrameQueueFullPolicyInternal GetFrameQueueFullPolicy() { return m_FrameQueueFullPolicy; }
+	bool GetIsUnchangedFrameSkippingEnabled() { return m_IsUnchangedFrameSkippingEnabled; }
+	UINT32 GetMaxUnchangedFrameDurationMillis() { return m_MaxUnchangedFrameDurationMillis; }
+	Mp4MuxerInternal GetMp4Muxer() { return m_Mp4Muxer; }
+	UINT32 GetFragmentDurationMillis() { return m_FragmentDurationMillis; }
+	UINT32 GetMuxerWriteBufferSize() { return m_MuxerWriteBufferSize; }
+	UINT32 GetChunkDurationMillis() { return m_ChunkDurationMillis; }
+	UINT32 GetSegmentDurationMillis() { return m_SegmentDurationMillis; }
+	UINT64 GetSegmentSize() { return m_SegmentSize; }
+	bool GetIsCrashSafeEnabled() { return m_IsCrashSafeEnabled; }
+	UINT32 GetCrashSafeSyncIntervalMillis() { return m_CrashSafeSyncIntervalMillis; }
+	bool GetIsInstantReplayEnabled() { return m_IsInstantReplayEnabled; }
+	UINT32 GetInstantReplayDurationMillis() { return m_InstantReplayDurationMillis; }
+	UINT64 GetInstantReplayMaxMemory() { return m_InstantReplayMaxMemory; }
 
 	virtual GUID GetVideoEncoderFormat() abstract;
 	virtual std::wstring GetVideoExtension() {
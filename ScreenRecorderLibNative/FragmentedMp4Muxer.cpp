@@ -0,0 +1,1138 @@
+#include "FragmentedMp4Muxer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace {
+	const INT64 HundredNanosPerSecond = 10000000;
+	//A fragment that no video keyframe comes along to cut is cut anyway once it lasts this many times the fragment duration, to bound the memory it holds.
+	const INT64 MaxFragmentDurationFactor = 4;
+	//Room for the random access entries of an hour of one second fragments, so the index does not grow while recording.
+	const size_t ReservedRandomAccessEntries = 3600;
+	//Room in the sample buffers for fragments of this many times the expected size, so a fragment bigger than the ones before rarely has to grow them.
+	const INT64 ReservedFragmentFactor = 2;
+	const UINT64 MaxReservedFragmentBytes = 64 * 1024 * 1024;
+	const INT64 ReservedVideoSamplesPerSecond = 60;
+	const UINT32 AacFrameSamples = 1024;
+	const UINT32 MovieTimescale = 1000;
+
+	//The sample flags of a sync sample, which depends on no other, and of a sample that depends on others and is not a sync sample.
+	const UINT32 SyncSampleFlags = 0x02000000;
+	const UINT32 NonSyncSampleFlags = 0x01010000;
+	const UINT32 DefaultBaseIsMoof = 0x020000;
+	const UINT32 TrunDataOffsetPresent = 0x000001;
+	const UINT32 TrunSampleDurationPresent = 0x000100;
+	const UINT32 TrunSampleSizePresent = 0x000200;
+	const UINT32 TrunSampleFlagsPresent = 0x000400;
+	const UINT32 TrunSampleCompositionTimeOffsetsPresent = 0x000800;
+
+	const BYTE H264NalSps = 7;
+	const BYTE H264NalPps = 8;
+	const BYTE H264NalAud = 9;
+	const BYTE HevcNalVps = 32;
+	const BYTE HevcNalSps = 33;
+	const BYTE HevcNalPps = 34;
+	const BYTE HevcNalAud = 35;
+
+	const UINT32 AacSampleRates[] = { 96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350 };
+	const UINT32 AacObjectTypeLc = 2;
+
+	/// <summary>
+	/// Appends big endian values and boxes to a byte vector. A box is begun with its type, and its size is filled in when it ends.
+	/// </summary>
+	class BoxWriter {
+	public:
+		BoxWriter(_Inout_ std::vector<BYTE> &bytes) : m_Bytes(bytes) {}
+		void U8(_In_ UINT32 value) { m_Bytes.push_back((BYTE)value); }
+		void U16(_In_ UINT32 value) { U8(value >> 8); U8(value); }
+		void U24(_In_ UINT32 value) { U8(value >> 16); U16(value & 0xFFFF); }
+		void U32(_In_ UINT32 value) { U16(value >> 16); U16(value & 0xFFFF); }
+		void U64(_In_ UINT64 value) { U32((UINT32)(value >> 32)); U32((UINT32)value); }
+		void Bytes(_In_reads_bytes_(size) const void *pData, _In_ size_t size) { m_Bytes.insert(m_Bytes.end(), (const BYTE *)pData, (const BYTE *)pData + size); }
+		void Bytes(_In_ const std::vector<BYTE> &data) { m_Bytes.insert(m_Bytes.end(), data.begin(), data.end()); }
+		void Zeros(_In_ size_t count) { m_Bytes.insert(m_Bytes.end(), count, 0); }
+		size_t Begin(_In_z_ const char *type)
+		{
+			size_t start = m_Bytes.size();
+			U32(0);
+			Bytes(type, 4);
+			return start;
+		}
+		size_t BeginFull(_In_z_ const char *type, _In_ BYTE version, _In_ UINT32 flags)
+		{
+			size_t start = Begin(type);
+			U32(((UINT32)version << 24) | flags);
+			return start;
+		}
+		void End(_In_ size_t start) { PatchU32(start, (UINT32)(m_Bytes.size() - start)); }
+		void PatchU32(_In_ size_t position, _In_ UINT32 value)
+		{
+			for (int i = 0; i < 4; i++) {
+				m_Bytes[position + i] = (BYTE)(value >> (24 - 8 * i));
+			}
+		}
+		size_t Size() const { return m_Bytes.size(); }
+	private:
+		std::vector<BYTE> &m_Bytes;
+	};
+
+	/// <summary>
+	/// Reads the bits and Exp-Golomb codes of a parameter set. Reading past the end yields zeros.
+	/// </summary>
+	class BitReader {
+	public:
+		BitReader(_In_ const std::vector<BYTE> &bytes, _In_ size_t startByte) : m_Bytes(bytes), m_Bit(startByte * 8) {}
+		UINT32 Bit()
+		{
+			if (m_Bit >= m_Bytes.size() * 8) {
+				return 0;
+			}
+			UINT32 bit = (m_Bytes[m_Bit / 8] >> (7 - m_Bit % 8)) & 1;
+			m_Bit++;
+			return bit;
+		}
+		UINT32 Bits(_In_ int count)
+		{
+			UINT32 value = 0;
+			for (int i = 0; i < count; i++) {
+				value = (value << 1) | Bit();
+			}
+			return value;
+		}
+		void Skip(_In_ size_t count) { m_Bit += count; }
+		UINT32 Golomb()
+		{
+			int zeros = 0;
+			while (Bit() == 0 && zeros < 31 && m_Bit < m_Bytes.size() * 8) {
+				zeros++;
+			}
+			return ((1u << zeros) - 1) + Bits(zeros);
+		}
+	private:
+		const std::vector<BYTE> &m_Bytes;
+		size_t m_Bit;
+	};
+
+	/// <summary>
+	/// Removes the emulation prevention bytes of a NAL unit, i.e. the 3 of every 00 00 03.
+	/// </summary>
+	std::vector<BYTE> ToRbsp(_In_ const std::vector<BYTE> &nal)
+	{
+		std::vector<BYTE> rbsp;
+		rbsp.reserve(nal.size());
+		int zeros = 0;
+		for (BYTE b : nal) {
+			if (zeros >= 2 && b == 3) {
+				zeros = 0;
+				continue;
+			}
+			zeros = b == 0 ? zeros + 1 : 0;
+			rbsp.push_back(b);
+		}
+		return rbsp;
+	}
+
+	/// <summary>
+	/// Finds the next NAL unit in Annex B data, starting the search at *pPosition. Trailing zeros in front of the next start code are left off.
+	/// </summary>
+	bool NextNalUnit(_In_reads_bytes_(size) const BYTE *pData, _In_ size_t size, _Inout_ size_t *pPosition, _Out_ const BYTE **ppNal, _Out_ size_t *pNalSize)
+	{
+		auto FindStartCode = [pData, size](size_t from) {
+			size_t i = from;
+			while (i + 2 < size) {
+				if (pData[i + 2] > 1) {
+					i += 3;
+				}
+				else if (pData[i + 2] == 1 && pData[i + 1] == 0 && pData[i] == 0) {
+					return i;
+				}
+				else {
+					i++;
+				}
+			}
+			return size;
+		};
+		size_t start = FindStartCode(*pPosition);
+		if (start >= size) {
+			*pPosition = size;
+			return false;
+		}
+		start += 3;
+		size_t end = FindStartCode(start);
+		*pPosition = end;
+		while (end > start && pData[end - 1] == 0) {
+			end--;
+		}
+		*ppNal = pData + start;
+		*pNalSize = end - start;
+		return true;
+	}
+
+	INT64 ToTimescale(_In_ INT64 time100Nanos, _In_ UINT32 timescale)
+	{
+		if (timescale == HundredNanosPerSecond) {
+			return time100Nanos;
+		}
+		return (time100Nanos * timescale + HundredNanosPerSecond / 2) / HundredNanosPerSecond;
+	}
+
+	std::vector<BYTE> MakeAudioSpecificConfig(_In_ UINT32 sampleRate, _In_ UINT32 channels)
+	{
+		UINT32 frequencyIndex = 15;
+		for (UINT32 i = 0; i < ARRAYSIZE(AacSampleRates); i++) {
+			if (AacSampleRates[i] == sampleRate) {
+				frequencyIndex = i;
+				break;
+			}
+		}
+		//Channel configuration 7 is 7.1, i.e. 8 channels.
+		UINT32 channelConfiguration = channels == 8 ? 7 : (std::min)(channels, (UINT32)6);
+		UINT64 bits = AacObjectTypeLc;
+		int bitCount = 5;
+		bits = (bits << 4) | frequencyIndex;
+		bitCount += 4;
+		if (frequencyIndex == 15) {
+			bits = (bits << 24) | (sampleRate & 0xFFFFFF);
+			bitCount += 24;
+		}
+		//The channel configuration, followed by the frame length, core coder and extension flags, all 0.
+		bits = (bits << 7) | ((UINT64)channelConfiguration << 3);
+		bitCount += 7;
+		std::vector<BYTE> config;
+		for (int shift = bitCount - 8; shift >= 0; shift -= 8) {
+			config.push_back((BYTE)(bits >> shift));
+		}
+		return config;
+	}
+
+	void WriteMatrix(_Inout_ BoxWriter &box)
+	{
+		const UINT32 unity[] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+		for (UINT32 value : unity) {
+			box.U32(value);
+		}
+	}
+
+	void WriteAvcConfiguration(_Inout_ BoxWriter &box, _In_ const std::vector<BYTE> &sps, _In_ const std::vector<BYTE> &pps)
+	{
+		size_t avcC = box.Begin("avcC");
+		box.U8(1);
+		//Profile, profile compatibility and level, as in the SPS.
+		box.Bytes(sps.data() + 1, 3);
+		//NAL units are behind a 4 byte length.
+		box.U8(0xFC | 3);
+		box.U8(0xE0 | 1);
+		box.U16((UINT32)sps.size());
+		box.Bytes(sps);
+		box.U8(1);
+		box.U16((UINT32)pps.size());
+		box.Bytes(pps);
+		BYTE profile = sps[1];
+		if (profile == 100 || profile == 110 || profile == 122 || profile == 144) {
+			std::vector<BYTE> rbsp = ToRbsp(sps);
+			BitReader reader(rbsp, 4);
+			reader.Golomb();
+			UINT32 chromaFormat = reader.Golomb();
+			if (chromaFormat == 3) {
+				reader.Skip(1);
+			}
+			UINT32 bitDepthLumaMinus8 = reader.Golomb();
+			UINT32 bitDepthChromaMinus8 = reader.Golomb();
+			box.U8(0xFC | (chromaFormat & 3));
+			box.U8(0xF8 | (bitDepthLumaMinus8 & 7));
+			box.U8(0xF8 | (bitDepthChromaMinus8 & 7));
+			box.U8(0);
+		}
+		box.End(avcC);
+	}
+
+	void WriteHevcConfiguration(_Inout_ BoxWriter &box, _In_ const std::vector<BYTE> &vps, _In_ const std::vector<BYTE> &sps, _In_ const std::vector<BYTE> &pps)
+	{
+		//The SPS starts with the 2 byte NAL unit header, the sub layer count, and the 12 bytes of the general profile, tier and level, which the configuration repeats.
+		std::vector<BYTE> rbsp = ToRbsp(sps);
+		rbsp.resize((std::max)(rbsp.size(), (size_t)15));
+		UINT32 maxSubLayersMinus1 = (rbsp[2] >> 1) & 7;
+		UINT32 temporalIdNesting = rbsp[2] & 1;
+		BitReader reader(rbsp, 15);
+		bool isSubLayerProfilePresent[8] = {};
+		bool isSubLayerLevelPresent[8] = {};
+		for (UINT32 i = 0; i < maxSubLayersMinus1; i++) {
+			isSubLayerProfilePresent[i] = reader.Bit() != 0;
+			isSubLayerLevelPresent[i] = reader.Bit() != 0;
+		}
+		if (maxSubLayersMinus1 > 0) {
+			reader.Skip(2 * (8 - maxSubLayersMinus1));
+		}
+		for (UINT32 i = 0; i < maxSubLayersMinus1; i++) {
+			reader.Skip((isSubLayerProfilePresent[i] ? 88 : 0) + (isSubLayerLevelPresent[i] ? 8 : 0));
+		}
+		reader.Golomb();
+		UINT32 chromaFormat = reader.Golomb();
+		if (chromaFormat == 3) {
+			reader.Skip(1);
+		}
+		reader.Golomb();
+		reader.Golomb();
+		if (reader.Bit()) {
+			for (int i = 0; i < 4; i++) {
+				reader.Golomb();
+			}
+		}
+		UINT32 bitDepthLumaMinus8 = reader.Golomb();
+		UINT32 bitDepthChromaMinus8 = reader.Golomb();
+
+		size_t hvcC = box.Begin("hvcC");
+		box.U8(1);
+		box.Bytes(rbsp.data() + 3, 12);
+		//No minimum spatial segmentation and unknown parallelism.
+		box.U16(0xF000);
+		box.U8(0xFC);
+		box.U8(0xFC | (chromaFormat & 3));
+		box.U8(0xF8 | (bitDepthLumaMinus8 & 7));
+		box.U8(0xF8 | (bitDepthChromaMinus8 & 7));
+		//Unknown frame rate, the temporal layers of the SPS, and NAL units behind a 4 byte length.
+		box.U16(0);
+		box.U8(((maxSubLayersMinus1 + 1) << 3) | (temporalIdNesting << 2) | 3);
+		const std::pair<BYTE, const std::vector<BYTE> *> arrays[] = { { HevcNalVps, &vps }, { HevcNalSps, &sps }, { HevcNalPps, &pps } };
+		box.U8(ARRAYSIZE(arrays));
+		for (const auto &nalArray : arrays) {
+			//Complete arrays, i.e. no parameter sets in the samples.
+			box.U8(0x80 | nalArray.first);
+			box.U16(1);
+			box.U16((UINT32)nalArray.second->size());
+			box.Bytes(*nalArray.second);
+		}
+		box.End(hvcC);
+	}
+
+	void WriteElementaryStreamDescriptor(_Inout_ BoxWriter &box, _In_ UINT32 trackId, _In_ UINT32 bitrate, _In_ const std::vector<BYTE> &audioSpecificConfig)
+	{
+		const BYTE ObjectTypeAac = 0x40;
+		const BYTE StreamTypeAudio = 0x05;
+		UINT32 decoderSpecificInfoLength = (UINT32)audioSpecificConfig.size();
+		UINT32 decoderConfigLength = 13 + 2 + decoderSpecificInfoLength;
+		UINT32 esLength = 3 + 2 + decoderConfigLength + 3;
+		size_t esds = box.BeginFull("esds", 0, 0);
+		box.U8(0x03);
+		box.U8(esLength);
+		box.U16(trackId);
+		box.U8(0);
+		box.U8(0x04);
+		box.U8(decoderConfigLength);
+		box.U8(ObjectTypeAac);
+		box.U8((StreamTypeAudio << 2) | 1);
+		box.U24(0);
+		box.U32(bitrate);
+		box.U32(bitrate);
+		box.U8(0x05);
+		box.U8(decoderSpecificInfoLength);
+		box.Bytes(audioSpecificConfig);
+		//The SL configuration predefined for MP4 files.
+		box.U8(0x06);
+		box.U8(1);
+		box.U8(2);
+		box.End(esds);
+	}
+}
+
+FragmentedMp4Muxer::FragmentedMp4Muxer() :
+	m_Options{},
+	m_SequenceNumber(0),
+	m_IsInitialized(false),
+	m_IsInitSegmentWritten(false),
+	m_IsFinalized(false),
+	m_FragmentStartPos(0),
+	m_FragmentOffset(0),
+	m_HasFragmentStarted(false),
+	m_ChunkStartPos(0),
+	m_HasChunkStarted(false),
+	m_IsFragmentStartChunk(false),
+	m_SegmentNumber(1),
+	m_SegmentStartPos(0),
+	m_SegmentOriginPos(0),
+	m_HasSegmentStarted(false),
+	m_SegmentStartStats{},
+	m_PreviousSegmentsWriter{},
+	m_Stats{},
+	m_LastCommitPos(0)
+{
+}
+
+FragmentedMp4Muxer::~FragmentedMp4Muxer()
+{
+}
+
+HRESULT FragmentedMp4Muxer::Initialize(_In_ IStream *pStream, _In_ const MP4_MUXER_OPTIONS &options)
+{
+	if (!pStream || options.FragmentDuration100Nanos <= 0 || options.ChunkDuration100Nanos < 0 || options.SegmentDuration100Nanos < 0) {
+		return E_INVALIDARG;
+	}
+	if ((options.SegmentDuration100Nanos > 0 || options.SegmentBytes > 0) && !options.OpenSegmentStream) {
+		return E_INVALIDARG;
+	}
+	HRESULT hr = m_Writer.Initialize(pStream, options.WriteBufferBytes);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	m_Options = options;
+	m_Tracks.clear();
+	m_Box.clear();
+	m_SequenceNumber = 0;
+	m_IsInitialized = true;
+	m_IsInitSegmentWritten = false;
+	m_IsFinalized = false;
+	m_FragmentStartPos = 0;
+	m_FragmentOffset = 0;
+	m_HasFragmentStarted = false;
+	m_ChunkStartPos = 0;
+	m_HasChunkStarted = false;
+	m_IsFragmentStartChunk = false;
+	m_SegmentNumber = 1;
+	m_SegmentStartPos = 0;
+	m_SegmentOriginPos = 0;
+	m_HasSegmentStarted = false;
+	m_SegmentStartStats = MP4_MUXER_STATS{};
+	m_PreviousSegmentsWriter = BUFFERED_STREAM_WRITER_STATS{};
+	m_Stats = MP4_MUXER_STATS{};
+	m_Journal = Mp4RecoveryJournal();
+	m_LastCommitPos = 0;
+	return OpenJournal();
+}
+
+HRESULT FragmentedMp4Muxer::AddTrack(_In_ const MP4_MUXER_TRACK &config, _Out_opt_ UINT32 *pTrackIndex)
+{
+	if (!m_IsInitialized || m_IsFinalized || m_Stats.Samples > 0 || m_HasFragmentStarted) {
+		return E_UNEXPECTED;
+	}
+	bool isVideo = config.Codec != Mp4Codec::AAC;
+	if (isVideo ? (config.Width == 0 || config.Height == 0) : (config.SampleRate == 0 || config.Channels == 0)) {
+		return E_INVALIDARG;
+	}
+	TRACK track{};
+	track.Config = config;
+	track.Timescale = isVideo ? VideoTimescale : config.SampleRate;
+	if (isVideo) {
+		size_t position = 0;
+		const BYTE *pNal;
+		size_t nalSize;
+		while (NextNalUnit(config.CodecPrivateData.data(), config.CodecPrivateData.size(), &position, &pNal, &nalSize)) {
+			if (nalSize == 0) {
+				continue;
+			}
+			bool isHevc = config.Codec == Mp4Codec::HEVC;
+			BYTE type = isHevc ? (pNal[0] >> 1) & 0x3F : pNal[0] & 0x1F;
+			std::vector<BYTE> *pParameterSet = nullptr;
+			if (type == (isHevc ? HevcNalSps : H264NalSps)) {
+				pParameterSet = &track.Sps;
+			}
+			else if (type == (isHevc ? HevcNalPps : H264NalPps)) {
+				pParameterSet = &track.Pps;
+			}
+			else if (isHevc && type == HevcNalVps) {
+				pParameterSet = &track.Vps;
+			}
+			if (pParameterSet && pParameterSet->empty()) {
+				pParameterSet->assign(pNal, pNal + nalSize);
+			}
+		}
+	}
+	else if (track.Config.CodecPrivateData.empty()) {
+		track.Config.CodecPrivateData = MakeAudioSpecificConfig(config.SampleRate, config.Channels);
+	}
+	track.RandomAccess.reserve(ReservedRandomAccessEntries);
+	INT64 reservedDuration = m_Options.FragmentDuration100Nanos * ReservedFragmentFactor;
+	INT64 samplesPerSecond = isVideo ? ReservedVideoSamplesPerSecond : config.SampleRate / AacFrameSamples + 1;
+	track.Samples.reserve((size_t)(samplesPerSecond * reservedDuration / HundredNanosPerSecond + 1));
+	if (config.Bitrate > 0) {
+		track.Data.reserve((size_t)(std::min)((UINT64)config.Bitrate / 8 * reservedDuration / HundredNanosPerSecond, MaxReservedFragmentBytes));
+	}
+	m_Tracks.push_back(std::move(track));
+	if (pTrackIndex) {
+		*pTrackIndex = (UINT32)(m_Tracks.size() - 1);
+	}
+	return S_OK;
+}
+
+HRESULT FragmentedMp4Muxer::WriteSample(_In_ UINT32 trackIndex, _In_ const MP4_MUXER_SAMPLE &sample)
+{
+	if (!m_IsInitialized || m_IsFinalized) {
+		return E_UNEXPECTED;
+	}
+	if (trackIndex >= m_Tracks.size() || !sample.pData || sample.Size == 0) {
+		return E_INVALIDARG;
+	}
+	TRACK &track = m_Tracks[trackIndex];
+	bool isVideo = IsVideo(track);
+	INT64 decodeTime = ToTimescale((std::max)(sample.DecodePos, (INT64)0), track.Timescale);
+	//The sample before lasts until this one starts, so a frame left out extends the one before, before the fragment can be cut after it.
+	if (!track.Samples.empty() && decodeTime > track.LastDecodeTime) {
+		track.Samples.back().Duration = (UINT32)(std::min)(decodeTime - track.LastDecodeTime, (INT64)MAXUINT32);
+		track.EndDecodeTime = decodeTime;
+	}
+	if (m_HasFragmentStarted && AreTracksConfigured()) {
+		INT64 elapsed = sample.DecodePos - m_FragmentStartPos;
+		//Chunks are cut at video frames, so the last frame of a chunk lasts until the next one, and the tracks have no gaps at the cuts.
+		bool isChunkCutPoint = HasVideoTrack() ? isVideo : true;
+		bool isFragmentCutPoint = isChunkCutPoint && (!isVideo || sample.IsKeyFrame);
+		bool isFragmentEnd = (elapsed >= m_Options.FragmentDuration100Nanos && isFragmentCutPoint)
+			|| elapsed >= m_Options.FragmentDuration100Nanos * MaxFragmentDurationFactor;
+		bool isChunkEnd = m_Options.ChunkDuration100Nanos > 0 && m_HasChunkStarted && isChunkCutPoint
+			&& sample.DecodePos - m_ChunkStartPos >= m_Options.ChunkDuration100Nanos;
+		//Segments are cut on keyframes only, so every segment can be played on its own.
+		bool isSegmentEnd = false;
+		if (IsSegmented() && m_HasSegmentStarted && isFragmentCutPoint) {
+			UINT64 segmentBytes = m_Writer.GetPosition();
+			for (const TRACK &pendingTrack : m_Tracks) {
+				segmentBytes += pendingTrack.Data.size();
+			}
+			isSegmentEnd = (m_Options.SegmentDuration100Nanos > 0 && sample.DecodePos - m_SegmentStartPos >= m_Options.SegmentDuration100Nanos)
+				|| (m_Options.SegmentBytes > 0 && segmentBytes >= m_Options.SegmentBytes);
+		}
+		if (isSegmentEnd || isFragmentEnd || isChunkEnd) {
+			HRESULT hr = isSegmentEnd ? SwitchSegment() : WriteChunk(isFragmentEnd);
+			if (FAILED(hr)) {
+				return hr;
+			}
+		}
+	}
+
+	size_t dataStart = track.Data.size();
+	if (isVideo) {
+		//Nothing can be decoded before a keyframe with the parameter sets.
+		if (!track.HasSamples && !sample.IsKeyFrame) {
+			m_Stats.DroppedSamples++;
+			return S_FALSE;
+		}
+		HRESULT hr = AppendVideoSample(track, sample);
+		if (hr != S_OK) {
+			return hr;
+		}
+		if (!track.HasSamples && !IsTrackConfigured(track)) {
+			track.Data.resize(dataStart);
+			m_Stats.DroppedSamples++;
+			return S_FALSE;
+		}
+	}
+	else {
+		track.Data.insert(track.Data.end(), sample.pData, sample.pData + sample.Size);
+	}
+
+	//Samples of a track do not overlap. One that starts before the last one ended is moved back to where it ended.
+	if (track.HasSamples) {
+		decodeTime = (std::max)(decodeTime, track.EndDecodeTime);
+	}
+	INT64 endTime = ToTimescale((std::max)(sample.DecodePos + sample.Duration, (INT64)0), track.Timescale);
+	FRAGMENT_SAMPLE fragmentSample;
+	fragmentSample.Size = (UINT32)(track.Data.size() - dataStart);
+	fragmentSample.Duration = (UINT32)(std::max)(endTime - ToTimescale((std::max)(sample.DecodePos, (INT64)0), track.Timescale), (INT64)0);
+	fragmentSample.Flags = !isVideo || sample.IsKeyFrame ? SyncSampleFlags : NonSyncSampleFlags;
+	fragmentSample.CompositionOffset = (INT32)(ToTimescale((std::max)(sample.StartPos, (INT64)0), track.Timescale) - decodeTime);
+	if (track.Samples.empty()) {
+		track.ChunkDecodeTime = decodeTime;
+	}
+	if (!track.HasFragmentSamples) {
+		track.FragmentDecodeTime = decodeTime;
+	}
+	track.Samples.push_back(fragmentSample);
+	track.LastDecodeTime = decodeTime;
+	track.EndDecodeTime = decodeTime + fragmentSample.Duration;
+	track.HasSamples = true;
+	track.HasFragmentSamples = true;
+	if (!m_HasChunkStarted) {
+		m_HasChunkStarted = true;
+		m_ChunkStartPos = sample.DecodePos;
+		m_IsFragmentStartChunk = !m_HasFragmentStarted;
+	}
+	if (!m_HasFragmentStarted) {
+		m_HasFragmentStarted = true;
+		m_FragmentStartPos = sample.DecodePos;
+	}
+	if (!m_HasSegmentStarted) {
+		m_HasSegmentStarted = true;
+		m_SegmentStartPos = sample.DecodePos;
+	}
+	m_Stats.Samples++;
+	return S_OK;
+}
+
+HRESULT FragmentedMp4Muxer::Finalize()
+{
+	if (!m_IsInitialized || m_IsFinalized) {
+		return E_UNEXPECTED;
+	}
+	m_IsFinalized = true;
+	if (!AreTracksConfigured()) {
+		//Without the parameter sets of every video track there is no moov to write.
+		return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+	}
+	auto start = std::chrono::steady_clock::now();
+	MP4_MUXER_SEGMENT segment;
+	HRESULT hr = EndSegment(&segment);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	m_Stats.Segments++;
+	if (m_Options.OnSegmentWritten) {
+		segment.SwitchDuration100Nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / 100;
+		m_Options.OnSegmentWritten(segment);
+	}
+	return S_OK;
+}
+
+MP4_MUXER_STATS FragmentedMp4Muxer::GetStats() const
+{
+	MP4_MUXER_STATS stats = m_Stats;
+	stats.Writer = m_Writer.GetStats();
+	stats.Writer.BytesWritten += m_PreviousSegmentsWriter.BytesWritten;
+	stats.Writer.StreamWrites += m_PreviousSegmentsWriter.StreamWrites;
+	stats.Writer.Flushes += m_PreviousSegmentsWriter.Flushes;
+	stats.Writer.Commits += m_PreviousSegmentsWriter.Commits;
+	return stats;
+}
+
+bool FragmentedMp4Muxer::IsVideo(_In_ const TRACK &track)
+{
+	return track.Config.Codec != Mp4Codec::AAC;
+}
+
+bool FragmentedMp4Muxer::IsTrackConfigured(_In_ const TRACK &track)
+{
+	switch (track.Config.Codec)
+	{
+	case Mp4Codec::H264:
+		return track.Sps.size() >= 4 && !track.Pps.empty();
+	case Mp4Codec::HEVC:
+		return !track.Vps.empty() && track.Sps.size() >= 15 && !track.Pps.empty();
+	default:
+		return !track.Config.CodecPrivateData.empty();
+	}
+}
+
+bool FragmentedMp4Muxer::HasVideoTrack() const
+{
+	return std::any_of(m_Tracks.begin(), m_Tracks.end(), [](const TRACK &track) { return IsVideo(track); });
+}
+
+bool FragmentedMp4Muxer::IsSegmented() const
+{
+	return m_Options.SegmentDuration100Nanos > 0 || m_Options.SegmentBytes > 0;
+}
+
+bool FragmentedMp4Muxer::AreTracksConfigured() const
+{
+	return std::all_of(m_Tracks.begin(), m_Tracks.end(), [](const TRACK &track) { return IsTrackConfigured(track); });
+}
+
+HRESULT FragmentedMp4Muxer::AppendVideoSample(_Inout_ TRACK &track, _In_ const MP4_MUXER_SAMPLE &sample)
+{
+	bool isHevc = track.Config.Codec == Mp4Codec::HEVC;
+	size_t dataStart = track.Data.size();
+	size_t position = 0;
+	const BYTE *pNal;
+	size_t nalSize;
+	bool hasNalUnits = false;
+	while (NextNalUnit(sample.pData, sample.Size, &position, &pNal, &nalSize)) {
+		hasNalUnits = true;
+		if (nalSize == 0) {
+			continue;
+		}
+		BYTE type = isHevc ? (pNal[0] >> 1) & 0x3F : pNal[0] & 0x1F;
+		if (type == (isHevc ? HevcNalAud : H264NalAud)) {
+			continue;
+		}
+		std::vector<BYTE> *pParameterSet = nullptr;
+		if (type == (isHevc ? HevcNalSps : H264NalSps)) {
+			pParameterSet = &track.Sps;
+		}
+		else if (type == (isHevc ? HevcNalPps : H264NalPps)) {
+			pParameterSet = &track.Pps;
+		}
+		else if (isHevc && type == HevcNalVps) {
+			pParameterSet = &track.Vps;
+		}
+		if (pParameterSet) {
+			if (pParameterSet->empty() && !m_IsInitSegmentWritten) {
+				pParameterSet->assign(pNal, pNal + nalSize);
+				continue;
+			}
+			//A parameter set that differs from the one in the sample entry stays in the sample, where the decoder picks it up.
+			if (pParameterSet->size() == nalSize && memcmp(pParameterSet->data(), pNal, nalSize) == 0) {
+				continue;
+			}
+		}
+		BYTE length[4] = { (BYTE)(nalSize >> 24), (BYTE)(nalSize >> 16), (BYTE)(nalSize >> 8), (BYTE)nalSize };
+		track.Data.insert(track.Data.end(), length, length + 4);
+		track.Data.insert(track.Data.end(), pNal, pNal + nalSize);
+	}
+	if (!hasNalUnits) {
+		return E_INVALIDARG;
+	}
+	return track.Data.size() > dataStart ? S_OK : S_FALSE;
+}
+
+HRESULT FragmentedMp4Muxer::WriteInitSegment()
+{
+	if (m_IsInitSegmentWritten) {
+		return S_OK;
+	}
+	bool hasH264 = std::any_of(m_Tracks.begin(), m_Tracks.end(), [](const TRACK &track) { return track.Config.Codec == Mp4Codec::H264; });
+	m_Box.clear();
+	BoxWriter box(m_Box);
+	size_t ftyp = box.Begin("ftyp");
+	box.Bytes("iso6", 4);
+	box.U32(0);
+	box.Bytes("iso6isommp41", 12);
+	if (hasH264) {
+		box.Bytes("avc1", 4);
+	}
+	box.End(ftyp);
+
+	size_t moov = box.Begin("moov");
+	size_t mvhd = box.BeginFull("mvhd", 0, 0);
+	//Creation and modification time, timescale, and a duration left open, as the fragments carry the samples.
+	box.U32(0);
+	box.U32(0);
+	box.U32(MovieTimescale);
+	box.U32(0);
+	box.U32(0x00010000);
+	box.U16(0x0100);
+	box.Zeros(10);
+	WriteMatrix(box);
+	box.Zeros(24);
+	box.U32((UINT32)m_Tracks.size() + 1);
+	box.End(mvhd);
+
+	for (UINT32 i = 0; i < m_Tracks.size(); i++) {
+		const TRACK &track = m_Tracks[i];
+		const MP4_MUXER_TRACK &config = track.Config;
+		bool isVideo = IsVideo(track);
+		UINT32 trackId = i + 1;
+		size_t trak = box.Begin("trak");
+		//Enabled and in the movie.
+		size_t tkhd = box.BeginFull("tkhd", 0, 3);
+		box.U32(0);
+		box.U32(0);
+		box.U32(trackId);
+		box.U32(0);
+		box.U32(0);
+		box.Zeros(8);
+		box.U16(0);
+		box.U16(0);
+		box.U16(isVideo ? 0 : 0x0100);
+		box.U16(0);
+		WriteMatrix(box);
+		box.U32(isVideo ? config.Width << 16 : 0);
+		box.U32(isVideo ? config.Height << 16 : 0);
+		box.End(tkhd);
+
+		size_t mdia = box.Begin("mdia");
+		size_t mdhd = box.BeginFull("mdhd", 0, 0);
+		box.U32(0);
+		box.U32(0);
+		box.U32(track.Timescale);
+		box.U32(0);
+		//The packed ISO 639 code of 'und'.
+		box.U16(0x55C4);
+		box.U16(0);
+		box.End(mdhd);
+		size_t hdlr = box.BeginFull("hdlr", 0, 0);
+		box.U32(0);
+		box.Bytes(isVideo ? "vide" : "soun", 4);
+		box.Zeros(12);
+		const char *handlerName = isVideo ? "VideoHandler" : "SoundHandler";
+		box.Bytes(handlerName, strlen(handlerName) + 1);
+		box.End(hdlr);
+
+		size_t minf = box.Begin("minf");
+		if (isVideo) {
+			size_t vmhd = box.BeginFull("vmhd", 0, 1);
+			box.Zeros(8);
+			box.End(vmhd);
+		}
+		else {
+			size_t smhd = box.BeginFull("smhd", 0, 0);
+			box.Zeros(4);
+			box.End(smhd);
+		}
+		size_t dinf = box.Begin("dinf");
+		size_t dref = box.BeginFull("dref", 0, 0);
+		box.U32(1);
+		//The data is in this file.
+		size_t url = box.BeginFull("url ", 0, 1);
+		box.End(url);
+		box.End(dref);
+		box.End(dinf);
+
+		size_t stbl = box.Begin("stbl");
+		size_t stsd = box.BeginFull("stsd", 0, 0);
+		box.U32(1);
+		if (isVideo) {
+			size_t entry = box.Begin(config.Codec == Mp4Codec::HEVC ? "hvc1" : "avc1");
+			box.Zeros(6);
+			box.U16(1);
+			box.Zeros(16);
+			box.U16(config.Width);
+			box.U16(config.Height);
+			//72 dpi
+			box.U32(0x00480000);
+			box.U32(0x00480000);
+			box.U32(0);
+			box.U16(1);
+			box.Zeros(32);
+			box.U16(0x0018);
+			box.U16(0xFFFF);
+			if (config.Codec == Mp4Codec::HEVC) {
+				WriteHevcConfiguration(box, track.Vps, track.Sps, track.Pps);
+			}
+			else {
+				WriteAvcConfiguration(box, track.Sps, track.Pps);
+			}
+			box.End(entry);
+		}
+		else {
+			size_t entry = box.Begin("mp4a");
+			box.Zeros(6);
+			box.U16(1);
+			box.Zeros(8);
+			box.U16(config.Channels);
+			box.U16(16);
+			box.U32(0);
+			box.U32(config.SampleRate <= 0xFFFF ? config.SampleRate << 16 : 0);
+			WriteElementaryStreamDescriptor(box, trackId, config.Bitrate, config.CodecPrivateData);
+			box.End(entry);
+		}
+		box.End(stsd);
+		//The sample tables are empty, the samples are all in the fragments.
+		for (const char *table : { "stts", "stsc", "stco" }) {
+			size_t emptyTable = box.BeginFull(table, 0, 0);
+			box.U32(0);
+			box.End(emptyTable);
+		}
+		size_t stsz = box.BeginFull("stsz", 0, 0);
+		box.U32(0);
+		box.U32(0);
+		box.End(stsz);
+		box.End(stbl);
+		box.End(minf);
+		box.End(mdia);
+		box.End(trak);
+	}
+
+	size_t mvex = box.Begin("mvex");
+	for (UINT32 i = 0; i < m_Tracks.size(); i++) {
+		size_t trex = box.BeginFull("trex", 0, 0);
+		box.U32(i + 1);
+		box.U32(1);
+		box.U32(0);
+		box.U32(0);
+		box.U32(0);
+		box.End(trex);
+	}
+	box.End(mvex);
+	box.End(moov);
+
+	HRESULT hr = m_Writer.Write(m_Box.data(), (DWORD)m_Box.size());
+	if (SUCCEEDED(hr) && m_Journal.IsInitialized()) {
+		hr = AppendJournalRecord(Mp4JournalRecordType::InitSegment, 0, m_Box.size(), Crc32(0, m_Box.data(), m_Box.size()));
+	}
+	if (FAILED(hr)) {
+		return hr;
+	}
+	m_IsInitSegmentWritten = true;
+	return S_OK;
+}
+
+HRESULT FragmentedMp4Muxer::WriteChunk(_In_ bool isFragmentEnd)
+{
+	HRESULT hr = WriteInitSegment();
+	if (FAILED(hr)) {
+		return hr;
+	}
+	if (m_HasChunkStarted) {
+		hr = WriteChunkBoxes();
+	}
+	if (SUCCEEDED(hr) && isFragmentEnd) {
+		INT64 fragmentDuration = 0;
+		for (TRACK &track : m_Tracks) {
+			if (track.HasFragmentSamples) {
+				fragmentDuration = (std::max)(fragmentDuration, (track.EndDecodeTime - track.FragmentDecodeTime) * HundredNanosPerSecond / track.Timescale);
+			}
+			track.HasFragmentSamples = false;
+		}
+		m_HasFragmentStarted = false;
+		m_Stats.Fragments++;
+		m_Stats.MaxFragmentBytes = (std::max)(m_Stats.MaxFragmentBytes, m_Writer.GetPosition() - m_FragmentOffset);
+		m_Stats.MaxFragmentDuration100Nanos = (std::max)(m_Stats.MaxFragmentDuration100Nanos, fragmentDuration);
+	}
+	return hr;
+}
+
+HRESULT FragmentedMp4Muxer::WriteChunkBoxes()
+{
+	UINT64 moofOffset = m_Writer.GetPosition();
+	if (m_IsFragmentStartChunk) {
+		m_FragmentOffset = moofOffset;
+	}
+	m_Box.clear();
+	BoxWriter box(m_Box);
+	size_t moof = box.Begin("moof");
+	size_t mfhd = box.BeginFull("mfhd", 0, 0);
+	box.U32(++m_SequenceNumber);
+	box.End(mfhd);
+	UINT64 mdatPayloadBytes = 0;
+	INT64 chunkDuration = 0;
+	BYTE trafNumber = 0;
+	for (UINT32 i = 0; i < m_Tracks.size(); i++) {
+		TRACK &track = m_Tracks[i];
+		if (track.Samples.empty()) {
+			continue;
+		}
+		trafNumber++;
+		bool hasCompositionOffsets = std::any_of(track.Samples.begin(), track.Samples.end(), [](const FRAGMENT_SAMPLE &sample) { return sample.CompositionOffset != 0; });
+		size_t traf = box.Begin("traf");
+		size_t tfhd = box.BeginFull("tfhd", 0, DefaultBaseIsMoof);
+		box.U32(i + 1);
+		box.End(tfhd);
+		size_t tfdt = box.BeginFull("tfdt", 1, 0);
+		box.U64((UINT64)(track.ChunkDecodeTime - track.SegmentOriginDecodeTime));
+		box.End(tfdt);
+		//Version 1 has signed composition offsets, for frames shown before they are decoded.
+		UINT32 trunFlags = TrunDataOffsetPresent | TrunSampleDurationPresent | TrunSampleSizePresent | TrunSampleFlagsPresent;
+		if (hasCompositionOffsets) {
+			trunFlags |= TrunSampleCompositionTimeOffsetsPresent;
+		}
+		size_t trun = box.BeginFull("trun", hasCompositionOffsets ? 1 : 0, trunFlags);
+		box.U32((UINT32)track.Samples.size());
+		track.DataOffsetPosition = box.Size();
+		box.U32(0);
+		for (const FRAGMENT_SAMPLE &sample : track.Samples) {
+			box.U32(sample.Duration);
+			box.U32(sample.Size);
+			box.U32(sample.Flags);
+			if (hasCompositionOffsets) {
+				box.U32((UINT32)sample.CompositionOffset);
+			}
+		}
+		box.End(trun);
+		box.End(traf);
+		mdatPayloadBytes += track.Data.size();
+		chunkDuration = (std::max)(chunkDuration, (track.EndDecodeTime - track.ChunkDecodeTime) * HundredNanosPerSecond / track.Timescale);
+		//Players join at fragments, so the chunks after the first of a fragment are left out of the index, even where they start on an audio sync sample.
+		if (m_IsFragmentStartChunk && track.Samples.front().Flags == SyncSampleFlags) {
+			track.RandomAccess.push_back(RANDOM_ACCESS_ENTRY{ track.ChunkDecodeTime - track.SegmentOriginDecodeTime, moofOffset, trafNumber });
+		}
+	}
+	box.End(moof);
+
+	//The track runs point into the mdat behind the moof, one after the other.
+	bool isLargeMdat = mdatPayloadBytes + 8 > MAXUINT32;
+	UINT64 mdatHeaderBytes = isLargeMdat ? 16 : 8;
+	UINT64 dataOffset = box.Size() + mdatHeaderBytes;
+	for (TRACK &track : m_Tracks) {
+		if (!track.Samples.empty()) {
+			box.PatchU32(track.DataOffsetPosition, (UINT32)dataOffset);
+			dataOffset += track.Data.size();
+		}
+	}
+	if (isLargeMdat) {
+		box.U32(1);
+		box.Bytes("mdat", 4);
+		box.U64(mdatPayloadBytes + 16);
+	}
+	else {
+		box.U32((UINT32)(mdatPayloadBytes + 8));
+		box.Bytes("mdat", 4);
+	}
+	HRESULT hr = m_Writer.Write(m_Box.data(), (DWORD)m_Box.size());
+	UINT32 checksum = m_Journal.IsInitialized() ? Crc32(0, m_Box.data(), m_Box.size()) : 0;
+	for (TRACK &track : m_Tracks) {
+		if (SUCCEEDED(hr) && !track.Data.empty()) {
+			hr = m_Writer.Write(track.Data.data(), (DWORD)track.Data.size());
+			if (m_Journal.IsInitialized()) {
+				checksum = Crc32(checksum, track.Data.data(), track.Data.size());
+			}
+		}
+		track.Samples.clear();
+		track.Data.clear();
+	}
+	if (SUCCEEDED(hr)) {
+		hr = m_Writer.Flush();
+	}
+	if (SUCCEEDED(hr) && m_Journal.IsInitialized()) {
+		hr = AppendJournalRecord(Mp4JournalRecordType::Chunk, moofOffset, m_Writer.GetPosition() - moofOffset, checksum);
+	}
+	INT64 chunkEndPos = m_ChunkStartPos + chunkDuration;
+	if (SUCCEEDED(hr) && m_Options.CommitInterval100Nanos >= 0 && chunkEndPos - m_LastCommitPos >= m_Options.CommitInterval100Nanos) {
+		hr = Commit();
+		m_LastCommitPos = chunkEndPos;
+	}
+	m_HasChunkStarted = false;
+	m_Stats.Chunks++;
+	if (SUCCEEDED(hr) && m_Options.OnChunkWritten) {
+		MP4_MUXER_CHUNK chunk;
+		chunk.SegmentNumber = m_SegmentNumber;
+		chunk.SequenceNumber = m_SequenceNumber;
+		chunk.Offset = moofOffset;
+		chunk.Bytes = m_Writer.GetPosition() - moofOffset;
+		chunk.StartPos = m_ChunkStartPos;
+		chunk.Duration = chunkDuration;
+		chunk.IsFragmentStart = m_IsFragmentStartChunk;
+		m_Options.OnChunkWritten(chunk);
+	}
+	return hr;
+}
+
+HRESULT FragmentedMp4Muxer::WriteRandomAccessIndex()
+{
+	m_Box.clear();
+	BoxWriter box(m_Box);
+	size_t mfra = box.Begin("mfra");
+	for (UINT32 i = 0; i < m_Tracks.size(); i++) {
+		const TRACK &track = m_Tracks[i];
+		size_t tfra = box.BeginFull("tfra", 1, 0);
+		box.U32(i + 1);
+		//The traf, trun and sample numbers take a byte each.
+		box.U32(0);
+		box.U32((UINT32)track.RandomAccess.size());
+		for (const RANDOM_ACCESS_ENTRY &entry : track.RandomAccess) {
+			box.U64((UINT64)entry.Time);
+			box.U64(entry.MoofOffset);
+			box.U8(entry.TrafNumber);
+			box.U8(1);
+			box.U8(1);
+		}
+		box.End(tfra);
+	}
+	size_t mfro = box.BeginFull("mfro", 0, 0);
+	box.U32((UINT32)(box.Size() - mfra + 4));
+	box.End(mfro);
+	box.End(mfra);
+	UINT64 offset = m_Writer.GetPosition();
+	HRESULT hr = m_Writer.Write(m_Box.data(), (DWORD)m_Box.size());
+	if (SUCCEEDED(hr) && m_Journal.IsInitialized()) {
+		hr = AppendJournalRecord(Mp4JournalRecordType::Index, offset, m_Box.size(), Crc32(0, m_Box.data(), m_Box.size()));
+	}
+	return hr;
+}
+
+HRESULT FragmentedMp4Muxer::OpenJournal()
+{
+	if (!m_Options.OpenJournalStream) {
+		return S_OK;
+	}
+	IStream *pStream = nullptr;
+	HRESULT hr = m_Options.OpenJournalStream(m_SegmentNumber, &pStream);
+	if (SUCCEEDED(hr) && !pStream) {
+		hr = E_POINTER;
+	}
+	if (FAILED(hr)) {
+		return hr;
+	}
+	return m_Journal.Initialize(pStream);
+}
+
+HRESULT FragmentedMp4Muxer::AppendJournalRecord(_In_ Mp4JournalRecordType type, _In_ UINT64 offset, _In_ UINT64 bytes, _In_ UINT32 checksum)
+{
+	MP4_JOURNAL_RECORD record;
+	record.Type = type;
+	record.SequenceNumber = type == Mp4JournalRecordType::Chunk ? m_SequenceNumber : 0;
+	record.Offset = offset;
+	record.Bytes = bytes;
+	record.Checksum = checksum;
+	HRESULT hr = m_Journal.Append(record);
+	if (SUCCEEDED(hr)) {
+		m_Stats.JournalBytes += Mp4JournalRecordBytes;
+	}
+	return hr;
+}
+
+HRESULT FragmentedMp4Muxer::Commit()
+{
+	//The journal goes after the output, so a record that is durable mostly describes data that is too.
+	HRESULT hr = m_Writer.Commit();
+	if (SUCCEEDED(hr) && m_Journal.IsInitialized()) {
+		hr = m_Journal.Commit();
+	}
+	return hr;
+}
+
+HRESULT FragmentedMp4Muxer::EndSegment(_Out_ MP4_MUXER_SEGMENT *pSegment)
+{
+	*pSegment = MP4_MUXER_SEGMENT{};
+	HRESULT hr = m_HasFragmentStarted ? WriteChunk(true) : WriteInitSegment();
+	if (SUCCEEDED(hr) && m_Stats.Chunks > m_SegmentStartStats.Chunks) {
+		hr = WriteRandomAccessIndex();
+	}
+	if (SUCCEEDED(hr)) {
+		hr = m_Options.CommitInterval100Nanos >= 0 ? Commit() : m_Writer.Flush();
+	}
+	INT64 endPos = m_SegmentOriginPos;
+	for (const TRACK &track : m_Tracks) {
+		if (track.HasSamples) {
+			endPos = (std::max)(endPos, track.EndDecodeTime * HundredNanosPerSecond / track.Timescale);
+		}
+	}
+	pSegment->Number = m_SegmentNumber;
+	pSegment->StartPos = m_SegmentOriginPos;
+	pSegment->Duration = endPos - m_SegmentOriginPos;
+	pSegment->Bytes = m_Writer.GetPosition();
+	pSegment->Samples = m_Stats.Samples - m_SegmentStartStats.Samples;
+	pSegment->Fragments = m_Stats.Fragments - m_SegmentStartStats.Fragments;
+	pSegment->DroppedSamples = m_Stats.DroppedSamples - m_SegmentStartStats.DroppedSamples;
+	return hr;
+}
+
+HRESULT FragmentedMp4Muxer::SwitchSegment()
+{
+	auto start = std::chrono::steady_clock::now();
+	MP4_MUXER_SEGMENT segment;
+	HRESULT hr = EndSegment(&segment);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	IStream *pStream = nullptr;
+	hr = m_Options.OpenSegmentStream(m_SegmentNumber + 1, &pStream);
+	if (SUCCEEDED(hr) && !pStream) {
+		hr = E_POINTER;
+	}
+	if (FAILED(hr)) {
+		return hr;
+	}
+	BUFFERED_STREAM_WRITER_STATS writerStats = m_Writer.GetStats();
+	m_PreviousSegmentsWriter.BytesWritten += writerStats.BytesWritten;
+	m_PreviousSegmentsWriter.StreamWrites += writerStats.StreamWrites;
+	m_PreviousSegmentsWriter.Flushes += writerStats.Flushes;
+	m_PreviousSegmentsWriter.Commits += writerStats.Commits;
+	hr = m_Writer.Initialize(pStream, m_Options.WriteBufferBytes);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	//The next segment starts where the track that ended first ended. Every track goes on where it ended, and none starts before time 0 of the segment.
+	INT64 originPos = MAXINT64;
+	for (const TRACK &track : m_Tracks) {
+		if (track.HasSamples) {
+			originPos = (std::min)(originPos, track.EndDecodeTime * HundredNanosPerSecond / track.Timescale);
+		}
+	}
+	for (TRACK &track : m_Tracks) {
+		track.SegmentOriginDecodeTime = ToTimescale(originPos, track.Timescale);
+		track.RandomAccess.clear();
+	}
+	m_SegmentNumber++;
+	hr = OpenJournal();
+	if (FAILED(hr)) {
+		return hr;
+	}
+	m_SegmentOriginPos = originPos;
+	m_SegmentStartPos = originPos;
+	m_SequenceNumber = 0;
+	m_IsInitSegmentWritten = false;
+	m_Stats.Segments++;
+	segment.SwitchDuration100Nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / 100;
+	m_Stats.MaxSegmentSwitch100Nanos = (std::max)(m_Stats.MaxSegmentSwitch100Nanos, segment.SwitchDuration100Nanos);
+	m_SegmentStartStats = m_Stats;
+	if (m_Options.OnSegmentWritten) {
+		m_Options.OnSegmentWritten(segment);
+	}
+	return S_OK;
+}
@@ -0,0 +1,256 @@
+#pragma once
+#include <windows.h>
+#include <objidl.h>
+#include <sal.h>
+#include <functional>
+#include <vector>
+#include "BufferedStreamWriter.h"
+#include "Mp4Recovery.h"
+
+enum class Mp4Codec {
+	H264,
+	HEVC,
+	AAC
+};
+
+struct MP4_MUXER_TRACK {
+	Mp4Codec Codec = Mp4Codec::H264;
+	//The frame size of a video track.
+	UINT32 Width = 0;
+	UINT32 Height = 0;
+	//The format of an audio track.
+	UINT32 SampleRate = 0;
+	UINT32 Channels = 0;
+	//The average bitrate in bits per second, if known. Only used to describe the track.
+	UINT32 Bitrate = 0;
+	//The decoder configuration. For video, the parameter sets in Annex B format, as in MF_MT_MPEG_SEQUENCE_HEADER. If left empty, they are taken from the first keyframe.
+	//For audio, the AudioSpecificConfig. If left empty, the one for AAC LC in the sample rate and channels of the track is used.
+	std::vector<BYTE> CodecPrivateData;
+};
+
+struct MP4_MUXER_CHUNK {
+	//The segment the chunk is in, counting from 1, and the sequence number of the moof in the segment, counting from 1.
+	UINT32 SegmentNumber;
+	UINT32 SequenceNumber;
+	//Where the moof and mdat are in the stream of the segment. Everything before Offset + Bytes, the init segment included, is written when the chunk is reported.
+	UINT64 Offset;
+	UINT64 Bytes;
+	//The decode time of the first sample on the timeline of the recording, and how long the chunk lasts, in 100 nanosecond units.
+	INT64 StartPos;
+	INT64 Duration;
+	//Whether the chunk starts a fragment, which starts with a video keyframe where a player can join, unless no keyframe came for MaxFragmentDurationFactor fragment durations.
+	bool IsFragmentStart;
+};
+
+struct MP4_MUXER_SEGMENT {
+	//The number of the segment, counting from 1.
+	UINT32 Number;
+	//Where the segment starts on the timeline of the recording, which is time 0 in the segment, and how long its longest track lasts, in 100 nanosecond units.
+	//The tracks of a segment start where they ended in the segment before, so the segments follow each other with no gap and no overlap.
+	INT64 StartPos;
+	INT64 Duration;
+	UINT64 Bytes;
+	UINT64 Samples;
+	UINT64 Fragments;
+	//Samples left out of the segment, i.e. video before the first keyframe. The segments after the first start on a keyframe, and leave nothing out.
+	UINT64 DroppedSamples;
+	//How long ending the segment, and opening the stream of the next one, held up the muxer, in 100 nanosecond units. For the last segment, how long Finalize took.
+	INT64 SwitchDuration100Nanos;
+};
+
+struct MP4_MUXER_OPTIONS {
+	//Samples are gathered into a fragment until it lasts this long, and the fragment is cut at the next video keyframe.
+	INT64 FragmentDuration100Nanos = 10000000;
+	//Fragments are written out in chunks of this duration, a moof and mdat each, as the chunks of CMAF low latency streaming. A chunk is cut at any video frame,
+	//so it goes out without waiting for a keyframe, and only the first chunk of a fragment starts with one. 0 writes each fragment as one moof and mdat.
+	INT64 ChunkDuration100Nanos = 0;
+	//The size of the buffer in front of the stream. 0 writes each box and track run straight to the stream.
+	UINT32 WriteBufferBytes = 1024 * 1024;
+	//Called when a chunk, or a whole fragment, has been flushed to the stream, on the thread writing the samples. Should return quickly, as the muxer waits for it.
+	std::function<void(_In_ const MP4_MUXER_CHUNK &chunk)> OnChunkWritten;
+	//The output is split into segments, each a complete file, once a segment lasts this long or has grown to this many bytes. 0 for neither writes a single file.
+	//A segment ends at the first fragment cut on a video keyframe after it is due, so it may last longer, or grow larger, by up to a fragment.
+	INT64 SegmentDuration100Nanos = 0;
+	UINT64 SegmentBytes = 0;
+	//Opens the stream of the next segment, counting from 2, as the first is the stream the muxer is initialized with. Required for segments.
+	//Called once the segment before is complete and flushed, so its stream can be closed. The stream is not referenced, and must stay valid until the next segment is opened, or Finalize has returned.
+	std::function<HRESULT(_In_ UINT32 segmentNumber, _Outptr_ IStream **ppStream)> OpenSegmentStream;
+	//Called when a segment is complete, once the stream of the next one is opened, and for the last segment on Finalize.
+	std::function<void(_In_ const MP4_MUXER_SEGMENT &segment)> OnSegmentWritten;
+	//Commits the stream, so what was written survives a crash of the system and not only of the process, at the end of the first chunk that ends this long after the last commit,
+	//and at the end of each segment. 0 commits every chunk. A commit waits for the disk, so a longer interval bounds its cost, and the recording time a power loss can take. -1 never commits.
+	INT64 CommitInterval100Nanos = -1;
+	//Opens the recovery journal of a segment, counting from 1, which RecoverFragmentedMp4 checks the segment against. Optional, for crash safe recordings.
+	//Called on Initialize and once the stream of the segment is opened. The stream is not referenced, and must stay valid until the journal of the next segment is opened, or Finalize has returned.
+	std::function<HRESULT(_In_ UINT32 segmentNumber, _Outptr_ IStream **ppStream)> OpenJournalStream;
+};
+
+struct MP4_MUXER_SAMPLE {
+	//An access unit, in Annex B format for video, i.e. NAL units behind start codes, as the Media Foundation encoders produce them. Raw AAC for audio.
+	const BYTE *pData;
+	UINT32 Size;
+	//The presentation time and duration, in 100 nanosecond units.
+	INT64 StartPos;
+	INT64 Duration;
+	//The decode time, which differs from StartPos for frames that are reordered by the encoder.
+	INT64 DecodePos;
+	bool IsKeyFrame;
+};
+
+struct MP4_MUXER_STATS {
+	UINT64 Fragments;
+	//The moof and mdat pairs written, the same as Fragments unless fragments are written in chunks.
+	UINT64 Chunks;
+	//The segments completed, and the longest it took to switch from one to the next, in 100 nanosecond units.
+	UINT64 Segments;
+	INT64 MaxSegmentSwitch100Nanos;
+	UINT64 Samples;
+	//Video samples dropped because they came before the first keyframe with parameter sets, and can not be decoded.
+	UINT64 DroppedSamples;
+	//The largest fragment, all of its moof and mdat boxes together, and the longest, in 100 nanosecond units.
+	UINT64 MaxFragmentBytes;
+	INT64 MaxFragmentDuration100Nanos;
+	//The writes to the streams of all segments, and the bytes of their journals.
+	BUFFERED_STREAM_WRITER_STATS Writer;
+	UINT64 JournalBytes;
+};
+
+/// <summary>
+/// Writes encoded H.264 or HEVC video and AAC audio to a fragmented MP4 (ISO BMFF) stream. The init segment (ftyp and moov) goes out once
+/// the decoder configuration of every track is known, followed by a moof and mdat per fragment, and an mfra index on Finalize.
+/// Every fragment, or chunk of a fragment, is flushed to the stream as soon as it is cut, so a reader, or a recording that ends abnormally, always finds whole fragments.
+/// The output can be split into segments, each a complete file with its own init segment and index, without a gap or an overlap between them.
+/// With periodic commits and a recovery journal, RecoverFragmentedMp4 rebuilds a playable file from what reached the disk before a crash.
+/// Sample buffers are reused from fragment to fragment, so writing does not allocate once the fragments have reached their usual size.
+/// Not thread safe.
+/// </summary>
+class FragmentedMp4Muxer
+{
+public:
+	//Video tracks are timed in the 100 nanosecond units of the input, audio tracks in samples.
+	static const UINT32 VideoTimescale = 10000000;
+
+	FragmentedMp4Muxer();
+	~FragmentedMp4Muxer();
+	/// <summary>
+	/// Starts writing to pStream, which should be at its start. The stream is not referenced, and must stay valid until Finalize has returned.
+	/// </summary>
+	HRESULT Initialize(_In_ IStream *pStream, _In_ const MP4_MUXER_OPTIONS &options);
+	/// <summary>
+	/// Adds a track. All tracks must be added before the first sample is written. The track index is the order the tracks were added in.
+	/// </summary>
+	HRESULT AddTrack(_In_ const MP4_MUXER_TRACK &track, _Out_opt_ UINT32 *pTrackIndex);
+	/// <summary>
+	/// Adds a sample to the current fragment of a track, after cutting the fragment, or the chunk, if it is due. Samples of a track must come in decode order.
+	/// A sample is shown until the next sample of its track starts, so a gap left by a skipped frame extends the frame before.
+	/// </summary>
+	HRESULT WriteSample(_In_ UINT32 trackIndex, _In_ const MP4_MUXER_SAMPLE &sample);
+	/// <summary>
+	/// Writes the current fragment and the index, and flushes the stream. Ends the last segment. Nothing can be written after.
+	/// </summary>
+	HRESULT Finalize();
+	inline bool IsInitSegmentWritten() const { return m_IsInitSegmentWritten; }
+	MP4_MUXER_STATS GetStats() const;
+private:
+	struct FRAGMENT_SAMPLE {
+		UINT32 Duration;
+		UINT32 Size;
+		UINT32 Flags;
+		INT32 CompositionOffset;
+	};
+	struct RANDOM_ACCESS_ENTRY {
+		INT64 Time;
+		UINT64 MoofOffset;
+		//The position of the traf of the track in the moof, counting from 1.
+		BYTE TrafNumber;
+	};
+	struct TRACK {
+		MP4_MUXER_TRACK Config;
+		UINT32 Timescale;
+		//The parameter sets of a video track, without start codes. HEVC has a VPS in front of the SPS.
+		std::vector<BYTE> Vps;
+		std::vector<BYTE> Sps;
+		std::vector<BYTE> Pps;
+		//The samples of the current chunk, and their data as it goes into the mdat.
+		std::vector<FRAGMENT_SAMPLE> Samples;
+		std::vector<BYTE> Data;
+		//The decode time of the first sample in the current fragment and chunk, of the last sample written, and of the end of the last sample, in the timescale of the track.
+		INT64 FragmentDecodeTime;
+		INT64 ChunkDecodeTime;
+		INT64 LastDecodeTime;
+		INT64 EndDecodeTime;
+		//Whether any sample of the track was written, in this fragment or before, and in this fragment.
+		bool HasSamples;
+		bool HasFragmentSamples;
+		//Where the data offset of the track run goes in the moof being built.
+		size_t DataOffsetPosition;
+		//Time 0 of the current segment, in the timescale of the track. Decode times are written relative to it.
+		INT64 SegmentOriginDecodeTime;
+		std::vector<RANDOM_ACCESS_ENTRY> RandomAccess;
+	};
+	BufferedStreamWriter m_Writer;
+	MP4_MUXER_OPTIONS m_Options;
+	std::vector<TRACK> m_Tracks;
+	//The moof of the fragment being written, built here before it goes out.
+	std::vector<BYTE> m_Box;
+	UINT32 m_SequenceNumber;
+	bool m_IsInitialized;
+	bool m_IsInitSegmentWritten;
+	bool m_IsFinalized;
+	//Where the current fragment starts, in 100 nanosecond units and in the stream, and whether it has any sample.
+	INT64 m_FragmentStartPos;
+	UINT64 m_FragmentOffset;
+	bool m_HasFragmentStarted;
+	//Where the current chunk starts, whether it has any sample, and whether it is the first chunk of the fragment.
+	INT64 m_ChunkStartPos;
+	bool m_HasChunkStarted;
+	bool m_IsFragmentStartChunk;
+	//The current segment, counting from 1, and where it starts on the timeline of the recording: where it is cut, and its time 0, which is 0 for the first.
+	UINT32 m_SegmentNumber;
+	INT64 m_SegmentStartPos;
+	INT64 m_SegmentOriginPos;
+	bool m_HasSegmentStarted;
+	//The stats as of the start of the current segment, and the writes to the streams of the segments before.
+	MP4_MUXER_STATS m_SegmentStartStats;
+	BUFFERED_STREAM_WRITER_STATS m_PreviousSegmentsWriter;
+	MP4_MUXER_STATS m_Stats;
+	//The journal of the current segment, if any, and where on the timeline of the recording the last commit was.
+	Mp4RecoveryJournal m_Journal;
+	INT64 m_LastCommitPos;
+
+	static bool IsVideo(_In_ const TRACK &track);
+	static bool IsTrackConfigured(_In_ const TRACK &track);
+	bool HasVideoTrack() const;
+	bool IsSegmented() const;
+	bool AreTracksConfigured() const;
+	/// <summary>
+	/// Appends a video access unit to the data of the track, with each NAL unit behind its length instead of a start code. Access unit delimiters,
+	/// and parameter sets that are in the sample entry, are left out. Parameter sets are taken for the sample entry if the track has none yet.
+	/// Returns S_FALSE, without appending anything, if nothing but parameter sets is left.
+	/// </summary>
+	HRESULT AppendVideoSample(_Inout_ TRACK &track, _In_ const MP4_MUXER_SAMPLE &sample);
+	HRESULT WriteInitSegment();
+	/// <summary>
+	/// Writes the samples gathered since the last cut as a moof and mdat, and ends the fragment if isFragmentEnd is set.
+	/// </summary>
+	HRESULT WriteChunk(_In_ bool isFragmentEnd);
+	HRESULT WriteChunkBoxes();
+	HRESULT WriteRandomAccessIndex();
+	/// <summary>
+	/// Opens the journal of the current segment, if the options ask for one.
+	/// </summary>
+	HRESULT OpenJournal();
+	HRESULT AppendJournalRecord(_In_ Mp4JournalRecordType type, _In_ UINT64 offset, _In_ UINT64 bytes, _In_ UINT32 checksum);
+	/// <summary>
+	/// Commits the stream of the segment, and then its journal.
+	/// </summary>
+	HRESULT Commit();
+	/// <summary>
+	/// Writes the current fragment and the index, and flushes the segment, and fills in what is known of it but how long the switch took.
+	/// </summary>
+	HRESULT EndSegment(_Out_ MP4_MUXER_SEGMENT *pSegment);
+	/// <summary>
+	/// Ends the current segment, and goes on in the stream of the next one, with its time 0 where the earliest track ended.
+	/// </summary>
+	HRESULT SwitchSegment();
+};
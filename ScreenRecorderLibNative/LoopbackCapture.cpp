@@ -1,9 +1,103 @@
 //https://github.com/mvaneerde/blog/tree/master/loopback-capture
 #include "Cleanup.h"
 #include "LoopbackCapture.h"
-#include <mutex>
 #include <ppltasks.h> 
+#include <optional>
 using namespace std;
+
+//Set to TRUE to resample with the Media Foundation resampler MFT instead of the built in AudioResampler.
+#define USE_MF_RESAMPLER FALSE
+//Set to TRUE to lock each capture device to the media clock, by steering the ratio of the built in AudioResampler with an AudioDriftEstimator.
+//Has no effect if USE_MF_RESAMPLER is TRUE.
+#define USE_DRIFT_COMPENSATION TRUE
+
+static_assert(AUDIO_CAPTURE_FLAG_DATA_DISCONTINUITY == AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY
+	&& AUDIO_CAPTURE_FLAG_SILENT == AUDCLNT_BUFFERFLAGS_SILENT
+	&& AUDIO_CAPTURE_FLAG_TIMESTAMP_ERROR == AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR, "Capture source flags must match the WASAPI buffer flags");
+
+namespace {
+	/// <summary>
+	/// The performance counter in 100 nanosecond units, the clock WASAPI timestamps captured packets with.
+	/// </summary>
+	UINT64 GetQpc100Nanos()
+	{
+		static const LONGLONG frequency = []() { LARGE_INTEGER f; QueryPerformanceFrequency(&f); return f.QuadPart; }();
+		LARGE_INTEGER counter;
+		QueryPerformanceCounter(&counter);
+		//Split, so the multiplication does not overflow.
+		return (UINT64)(counter.QuadPart / frequency * 10000000 + counter.QuadPart % frequency * 10000000 / frequency);
+	}
+
+	/// <summary>
+	/// Feeds the packets of a WASAPI capture client to an AudioCaptureStream, logging any failures and packet flags.
+	/// </summary>
+	class WasapiCaptureSource : public IAudioCaptureSource
+	{
+	public:
+		WasapiCaptureSource(_In_ IAudioCaptureClient *pCaptureClient, _In_ WAVEFORMATEX *pwfx, _In_ std::wstring tag) :
+			m_pCaptureClient(pCaptureClient),
+			m_SampleRate(pwfx->nSamplesPerSec),
+			m_Channels(pwfx->nChannels),
+			m_Tag(tag),
+			m_Pass(0),
+			m_Frames(0),
+			m_IsFirstPacket(true)
+		{
+		}
+		UINT32 GetSampleRate() override { return m_SampleRate; }
+		UINT32 GetChannels() override { return m_Channels; }
+		HRESULT GetNextPacketSize(_Out_ UINT32 *pNumFramesInNextPacket) override
+		{
+			HRESULT hr = m_pCaptureClient->GetNextPacketSize(pNumFramesInNextPacket);
+			if (FAILED(hr)) {
+				LOG_ERROR(L"IAudioCaptureClient::GetNextPacketSize failed on pass %u after %llu frames on %ls: hr = 0x%08x", m_Pass, m_Frames, m_Tag.c_str(), hr);
+			}
+			return hr;
+		}
+		HRESULT GetBuffer(_Outptr_ BYTE **ppData, _Out_ UINT32 *pNumFramesToRead, _Out_ DWORD *pdwFlags, _Out_opt_ UINT64 *pu64DevicePosition, _Out_opt_ UINT64 *pu64QPCPosition) override
+		{
+			HRESULT hr = m_pCaptureClient->GetBuffer(ppData, pNumFramesToRead, pdwFlags, pu64DevicePosition, pu64QPCPosition);
+			if (FAILED(hr)) {
+				LOG_ERROR(L"IAudioCaptureClient::GetBuffer failed on pass %u after %llu frames on %ls: hr = 0x%08x", m_Pass, m_Frames, m_Tag.c_str(), hr);
+				return hr;
+			}
+			DWORD dwFlags = *pdwFlags;
+			if ((dwFlags & AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY) != 0 && m_IsFirstPacket) {
+				LOG_DEBUG(L"Probably spurious glitch reported on first packet on %ls", m_Tag.c_str());
+			}
+			else if (0 != dwFlags) {
+				//Silent packets are replaced with silence as according to https://docs.microsoft.com/en-us/windows/win32/coreaudio/capturing-a-stream
+				LOG_DEBUG(L"IAudioCaptureClient::GetBuffer set flags to 0x%08x on pass %u after %llu frames on %ls", dwFlags, m_Pass, m_Frames, m_Tag.c_str());
+			}
+			if (0 == *pNumFramesToRead) {
+				LOG_ERROR(L"IAudioCaptureClient::GetBuffer said to read 0 frames on pass %u after %llu frames on %ls", m_Pass, m_Frames, m_Tag.c_str());
+			}
+			return hr;
+		}
+		HRESULT ReleaseBuffer(_In_ UINT32 numFramesRead) override
+		{
+			HRESULT hr = m_pCaptureClient->ReleaseBuffer(numFramesRead);
+			if (FAILED(hr)) {
+				LOG_ERROR(L"IAudioCaptureClient::ReleaseBuffer failed on pass %u after %llu frames on %ls: hr = 0x%08x", m_Pass, m_Frames, m_Tag.c_str(), hr);
+				return hr;
+			}
+			m_Frames += numFramesRead;
+			m_IsFirstPacket = false;
+			return hr;
+		}
+		inline void SetPass(_In_ UINT32 pass) { m_Pass = pass; }
+		inline UINT64 GetFrames() const { return m_Frames; }
+	private:
+		IAudioCaptureClient *m_pCaptureClient;
+		UINT32 m_SampleRate;
+		UINT32 m_Channels;
+		std::wstring m_Tag;
+		UINT32 m_Pass;
+		UINT64 m_Frames;
+		bool m_IsFirstPacket;
+	};
+}
+
 LoopbackCapture::LoopbackCapture(_In_opt_ std::wstring tag) :
 	m_TaskWrapperImpl(make_unique<TaskWrapper>())
 {
@@ -17,14 +111,12 @@ LoopbackCapture::~LoopbackCapture()
 }
 
 struct LoopbackCapture::TaskWrapper {
-	std::mutex m_Mutex;
 	Concurrency::task<void> m_CaptureTask = concurrency::task_from_result();
 };
 
 HRESULT LoopbackCapture::StartLoopbackCapture(
 	IMMDevice *pMMDevice,
 	HMMIO hFile,
-	bool bInt16,
 	HANDLE hStartedEvent,
 	HANDLE hStopEvent,
 	EDataFlow flow,
@@ -66,40 +158,41 @@ HRESULT LoopbackCapture::StartLoopbackCapture(
 	}
 	CoTaskMemFreeOnExit freeMixFormat(pwfx);
 
-	if (bInt16) {
-		// coerce int-16 wave format
-		// can do this in-place since we're not changing the size of the format
-		// also, the engine will auto-convert from float to int for us
-		switch (pwfx->wFormatTag) {
-			case WAVE_FORMAT_IEEE_FLOAT:
-				pwfx->wFormatTag = WAVE_FORMAT_PCM;
-				pwfx->wBitsPerSample = 16;
+	// coerce 32 bit float wave format, which is what the audio engine mixes in, so the shared mode mix format normally already is float.
+	// can do this in-place since neither format is larger than the other
+	// the engine will auto-convert from int to float for us if needed
+	switch (pwfx->wFormatTag) {
+		case WAVE_FORMAT_IEEE_FLOAT:
+			break;
+
+		case WAVE_FORMAT_PCM:
+			pwfx->wFormatTag = WAVE_FORMAT_IEEE_FLOAT;
+			pwfx->wBitsPerSample = 32;
+			pwfx->nBlockAlign = pwfx->nChannels * pwfx->wBitsPerSample / 8;
+			pwfx->nAvgBytesPerSec = pwfx->nBlockAlign * pwfx->nSamplesPerSec;
+			break;
+
+		case WAVE_FORMAT_EXTENSIBLE:
+		{
+			// naked scope for case-local variable
+			PWAVEFORMATEXTENSIBLE pEx = reinterpret_cast<PWAVEFORMATEXTENSIBLE>(pwfx);
+			if (IsEqualGUID(KSDATAFORMAT_SUBTYPE_PCM, pEx->SubFormat)) {
+				pEx->SubFormat = KSDATAFORMAT_SUBTYPE_IEEE_FLOAT;
+				pEx->Samples.wValidBitsPerSample = 32;
+				pwfx->wBitsPerSample = 32;
 				pwfx->nBlockAlign = pwfx->nChannels * pwfx->wBitsPerSample / 8;
 				pwfx->nAvgBytesPerSec = pwfx->nBlockAlign * pwfx->nSamplesPerSec;
-				break;
-
-			case WAVE_FORMAT_EXTENSIBLE:
-			{
-				// naked scope for case-local variable
-				PWAVEFORMATEXTENSIBLE pEx = reinterpret_cast<PWAVEFORMATEXTENSIBLE>(pwfx);
-				if (IsEqualGUID(KSDATAFORMAT_SUBTYPE_IEEE_FLOAT, pEx->SubFormat)) {
-					pEx->SubFormat = KSDATAFORMAT_SUBTYPE_PCM;
-					pEx->Samples.wValidBitsPerSample = 16;
-					pwfx->wBitsPerSample = 16;
-					pwfx->nBlockAlign = pwfx->nChannels * pwfx->wBitsPerSample / 8;
-					pwfx->nAvgBytesPerSec = pwfx->nBlockAlign * pwfx->nSamplesPerSec;
-				}
-				else {
-					LOG_ERROR(L"%s", L"Don't know how to coerce mix format to int-16");
-					return E_UNEXPECTED;
-				}
 			}
-			break;
-
-			default:
-				LOG_ERROR(L"Don't know how to coerce WAVEFORMATEX with wFormatTag = 0x%08x to int-16", pwfx->wFormatTag);
+			else if (!IsEqualGUID(KSDATAFORMAT_SUBTYPE_IEEE_FLOAT, pEx->SubFormat)) {
+				LOG_ERROR(L"%s", L"Don't know how to coerce mix format to float-32");
 				return E_UNEXPECTED;
+			}
 		}
+		break;
+
+		default:
+			LOG_ERROR(L"Don't know how to coerce WAVEFORMATEX with wFormatTag = 0x%08x to float-32", pwfx->wFormatTag);
+			return E_UNEXPECTED;
 	}
 	UINT32 outputSampleRate;
 	// set resampler options
@@ -119,72 +212,106 @@ HRESULT LoopbackCapture::StartLoopbackCapture(
 		}
 	}
 
+	// keep the reader out while the formats, the resampler and the stream are set up for this device.
+	m_IsStreamReady = false;
+	while (m_IsStreamInUse) {
+		std::this_thread::yield();
+	}
 	m_InputFormat.nChannels = pwfx->nChannels;
 	m_InputFormat.bits = pwfx->wBitsPerSample;
 	m_InputFormat.sampleRate = pwfx->nSamplesPerSec;
 	m_InputFormat.dwChannelMask = 0;
 	m_InputFormat.validBitsPerSample = pwfx->wBitsPerSample;
-	m_InputFormat.sampleFormat = WWMFBitFormatType::WWMFBitFormatInt;
+	m_InputFormat.sampleFormat = WWMFBitFormatType::WWMFBitFormatFloat;
 
 	m_OutputFormat = m_InputFormat;
 	m_OutputFormat.sampleRate = outputSampleRate;
 	m_OutputFormat.nChannels = channels;
 
-	// initialize resampler if input sample rate or channels are different from output.
-	if (requiresResampling()) {
+	// initialize resampler if input sample rate or channels are different from output, or if it is needed to compensate for clock drift.
+	if (requiresResampling() || isDriftCompensated()) {
 		LOG_DEBUG("Resampler created for %ls", m_Tag.c_str());
 		LOG_DEBUG("Resampler (bits): %u -> %u", m_InputFormat.bits, m_OutputFormat.bits);
 		LOG_DEBUG("Resampler (channels): %u -> %u", m_InputFormat.nChannels, m_OutputFormat.nChannels);
 		LOG_DEBUG("Resampler (sampleFormat): %i -> %i", m_InputFormat.sampleFormat, m_OutputFormat.sampleFormat);
 		LOG_DEBUG("Resampler (sampleRate): %lu -> %lu", m_InputFormat.sampleRate, m_OutputFormat.sampleRate);
 		LOG_DEBUG("Resampler (validBitsPerSample): %u -> %u", m_InputFormat.validBitsPerSample, m_OutputFormat.validBitsPerSample);
+#if USE_MF_RESAMPLER
 		m_Resampler.Initialize(m_InputFormat, m_OutputFormat, 60);
+#endif
 	}
 	else
 	{
 		LOG_DEBUG("No resampling nescessary");
 	}
+	// event driven capture only works for capture devices, see below.
+	bool isEventDriven = m_Timing.WakeMode == AudioCaptureWakeModeInternal::Event && flow == eCapture;
+	REFERENCE_TIME hnsWakeInterval;
+	if (isEventDriven) {
+		hnsWakeInterval = hnsDefaultDevicePeriod;
+	}
+	else if (m_Timing.WakeIntervalMillis > 0) {
+		hnsWakeInterval = (REFERENCE_TIME)m_Timing.WakeIntervalMillis * 10000;
+	}
+	else {
+		hnsWakeInterval = hnsDefaultDevicePeriod / 2;
+	}
+	hnsWakeInterval = (std::max)(hnsWakeInterval, (REFERENCE_TIME)10000);
+	// the buffer must hold what is captured between two wakeups, with room for one to come late.
+	REFERENCE_TIME hnsBufferDuration = (std::max)((REFERENCE_TIME)m_Timing.BufferMillis * 10000, 2 * hnsWakeInterval);
+	// the drift compensation must keep enough audio buffered to bridge the wait for the next packet, or reads run dry before it is collected.
+	UINT32 targetBufferMillis = AudioCaptureStream::GetTargetBufferMillis(hnsDefaultDevicePeriod, isEventDriven ? 0 : hnsWakeInterval);
+	LOG_DEBUG(L"Audio capture on %ls wakes up %ls every %.1f ms, with a %.0f ms buffer and %u ms kept for drift compensation", m_Tag.c_str(),
+		isEventDriven ? L"on device events" : L"on a timer", hnsWakeInterval / 10000.0, hnsBufferDuration / 10000.0, targetBufferMillis);
+
+	// once set up, the stream is only touched by this thread as producer and by GetRecordedBytes as consumer, so no locking is needed.
+	// with the MF resampler, the stream hands over the captured format as is and GetRecordedBytes resamples it.
+	hr = m_Stream.Initialize(m_InputFormat.sampleRate, m_InputFormat.nChannels, m_OutputFormat.sampleRate, m_OutputFormat.nChannels, !USE_MF_RESAMPLER, isDriftCompensated(), targetBufferMillis);
+	if (FAILED(hr)) {
+		LOG_ERROR(L"Failed to initialize audio capture stream on %ls: hr = 0x%08x", m_Tag.c_str(), hr);
+		return hr;
+	}
+	m_IsStreamReady = true;
+	m_LastReportedOverflowCount = 0;
+	m_LastReportedResyncCount = 0;
 
-	// create a periodic waitable timer
-	HANDLE hWakeUp = CreateWaitableTimer(NULL, FALSE, NULL);
+	// create the handle the capture loop waits on: an event the device sets when a packet is ready, or a periodic waitable timer.
+	HANDLE hWakeUp = isEventDriven ? CreateEvent(NULL, FALSE, FALSE, NULL) : CreateWaitableTimer(NULL, FALSE, NULL);
 	if (NULL == hWakeUp) {
 		DWORD dwErr = GetLastError();
-		LOG_ERROR(L"CreateWaitableTimer failed: last error = %u", dwErr);
+		LOG_ERROR(L"%ls failed: last error = %u", isEventDriven ? L"CreateEvent" : L"CreateWaitableTimer", dwErr);
 		return HRESULT_FROM_WIN32(dwErr);
 	}
 	CloseHandleOnExit closeWakeUp(hWakeUp);
 
-	UINT32 nBlockAlign = pwfx->nBlockAlign;
-	UINT32 nFrames = 0;
-	long audioClientBufferMillis = 200;
-	long audioClientBuffer100Nanos = audioClientBufferMillis * 10000;
-
-	int bufferFrameCount = int(ceil(pwfx->nSamplesPerSec * audioClientBufferMillis / 1000));
-	int bufferByteCount = bufferFrameCount * nBlockAlign;
-	BYTE *bufferData = new BYTE[bufferByteCount]{ 0 };
-	DeleteArrayOnExit deleteBufferData(bufferData);
-
 	// call IAudioClient::Initialize
 	// note that AUDCLNT_STREAMFLAGS_LOOPBACK and AUDCLNT_STREAMFLAGS_EVENTCALLBACK
 	// do not work together...
 	// the "data ready" event never gets set
-	// so we're going to do a timer-driven loop
+	// so loopback captures always use a timer-driven loop
 	switch (flow)
 	{
 		case eRender:
-			hr = pAudioClient->Initialize(AUDCLNT_SHAREMODE_SHARED, AUDCLNT_STREAMFLAGS_LOOPBACK, audioClientBuffer100Nanos, 0, pwfx, 0);
+			hr = pAudioClient->Initialize(AUDCLNT_SHAREMODE_SHARED, AUDCLNT_STREAMFLAGS_LOOPBACK, hnsBufferDuration, 0, pwfx, 0);
 			break;
 		case eCapture:
-			hr = pAudioClient->Initialize(AUDCLNT_SHAREMODE_SHARED, 0, audioClientBuffer100Nanos, 0, pwfx, 0);
+			hr = pAudioClient->Initialize(AUDCLNT_SHAREMODE_SHARED, isEventDriven ? AUDCLNT_STREAMFLAGS_EVENTCALLBACK : 0, hnsBufferDuration, 0, pwfx, 0);
 			break;
 		default:
-			hr = pAudioClient->Initialize(AUDCLNT_SHAREMODE_SHARED, AUDCLNT_STREAMFLAGS_LOOPBACK, audioClientBuffer100Nanos, 0, pwfx, 0);
+			hr = pAudioClient->Initialize(AUDCLNT_SHAREMODE_SHARED, AUDCLNT_STREAMFLAGS_LOOPBACK, hnsBufferDuration, 0, pwfx, 0);
 			break;
 	}
 	if (FAILED(hr)) {
 		LOG_ERROR(L"IAudioClient::Initialize failed on %ls: hr = 0x%08x", m_Tag.c_str(), hr);
 		return hr;
 	}
+	if (isEventDriven) {
+		hr = pAudioClient->SetEventHandle(hWakeUp);
+		if (FAILED(hr)) {
+			LOG_ERROR(L"IAudioClient::SetEventHandle failed on %ls: hr = 0x%08x", m_Tag.c_str(), hr);
+			return hr;
+		}
+	}
 
 	// activate an IAudioCaptureClient
 	IAudioCaptureClient *pAudioCaptureClient = nullptr;
@@ -197,6 +324,7 @@ HRESULT LoopbackCapture::StartLoopbackCapture(
 		return hr;
 	}
 	ReleaseOnExit releaseAudioCaptureClient(pAudioCaptureClient);
+	WasapiCaptureSource captureSource(pAudioCaptureClient, pwfx, m_Tag);
 
 	// register with MMCSS
 	DWORD nTaskIndex = 0;
@@ -209,21 +337,24 @@ HRESULT LoopbackCapture::StartLoopbackCapture(
 	AvRevertMmThreadCharacteristicsOnExit unregisterMmcss(hTask);
 
 	// set the waitable timer
-	LARGE_INTEGER liFirstFire{};
-	liFirstFire.QuadPart = -hnsDefaultDevicePeriod / 2; // negative means relative time
-	LONG lTimeBetweenFires = (LONG)hnsDefaultDevicePeriod / 2 / (10 * 1000); // convert to milliseconds
-	BOOL bOK = SetWaitableTimer(
-		hWakeUp,
-		&liFirstFire,
-		lTimeBetweenFires,
-		NULL, NULL, FALSE
-	);
-	if (!bOK) {
-		DWORD dwErr = GetLastError();
-		LOG_ERROR(L"SetWaitableTimer failed on %ls: last error = %u", m_Tag.c_str(), dwErr);
-		return HRESULT_FROM_WIN32(dwErr);
+	std::optional<CancelWaitableTimerOnExit> cancelWakeUp;
+	if (!isEventDriven) {
+		LARGE_INTEGER liFirstFire{};
+		liFirstFire.QuadPart = -hnsWakeInterval; // negative means relative time
+		LONG lTimeBetweenFires = (LONG)(hnsWakeInterval / (10 * 1000)); // convert to milliseconds
+		BOOL bOK = SetWaitableTimer(
+			hWakeUp,
+			&liFirstFire,
+			lTimeBetweenFires,
+			NULL, NULL, FALSE
+		);
+		if (!bOK) {
+			DWORD dwErr = GetLastError();
+			LOG_ERROR(L"SetWaitableTimer failed on %ls: last error = %u", m_Tag.c_str(), dwErr);
+			return HRESULT_FROM_WIN32(dwErr);
+		}
+		cancelWakeUp.emplace(hWakeUp);
 	}
-	CancelWaitableTimerOnExit cancelWakeUp(hWakeUp);
 
 	// call IAudioClient::Start
 	hr = pAudioClient->Start();
@@ -233,96 +364,26 @@ HRESULT LoopbackCapture::StartLoopbackCapture(
 	}
 	AudioClientStopOnExit stopAudioClient(pAudioClient);
 
+	m_IsCapturing = true;
 	SetEvent(hStartedEvent);
 	// loopback capture loop
 	HANDLE waitArray[2] = { hStopEvent, hWakeUp };
 	DWORD dwWaitResult;
 
 	bool bDone = false;
-	bool bFirstPacket = true;
-	UINT64 nLastDevicePosition = 0;
 	for (UINT32 nPasses = 0; !bDone; nPasses++) {
 		// drain data while it is available
-		UINT32 nNextPacketSize;
-		for (
-			hr = pAudioCaptureClient->GetNextPacketSize(&nNextPacketSize);
-			SUCCEEDED(hr) && nNextPacketSize > 0;
-			hr = pAudioCaptureClient->GetNextPacketSize(&nNextPacketSize)
-			) {
-			// get the captured data
-			BYTE *pData;
-			UINT32 nNumFramesToRead;
-			DWORD dwFlags;
-			UINT64 nDevicePosition;
-
-			hr = pAudioCaptureClient->GetBuffer(
-				&pData,
-				&nNumFramesToRead,
-				&dwFlags,
-				&nDevicePosition,
-				NULL
-			);
-			if (FAILED(hr)) {
-				LOG_ERROR(L"IAudioCaptureClient::GetBuffer failed on pass %u after %u frames on %ls: hr = 0x%08x", nPasses, nFrames, m_Tag.c_str(), hr);
-				bDone = true;
-				continue; // exits loop
-			}
-			bool isDiscontinuity = false;
-			if ((dwFlags & (AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY)) != 0) {
-				if (bFirstPacket) {
-					LOG_DEBUG(L"Probably spurious glitch reported on first packet on %ls", m_Tag.c_str());
-				}
-				else {
-					LOG_DEBUG(L"IAudioCaptureClient::GetBuffer set flags to 0x%08x on pass %u after %u frames on %ls", dwFlags, nPasses, nFrames, m_Tag.c_str());
-					isDiscontinuity = true;
-				}
-			}
-			else if ((dwFlags & AUDCLNT_BUFFERFLAGS_SILENT) != 0) {
-				//Captured data should be replaced with silence as according to https://docs.microsoft.com/en-us/windows/win32/coreaudio/capturing-a-stream
-				LOG_DEBUG(L"IAudioCaptureClient::GetBuffer set flags to 0x%08x on pass %u after %u frames on %ls", dwFlags, nPasses, nFrames, m_Tag.c_str());
-				memset(pData, 0, sizeof(pData));
-			}
-			else if (0 != dwFlags) {
-				LOG_DEBUG(L"IAudioCaptureClient::GetBuffer set flags to 0x%08x on pass %u after %u frames on %ls", dwFlags, nPasses, nFrames, m_Tag.c_str());
-			}
-
-			if (0 == nNumFramesToRead) {
-				LOG_ERROR(L"IAudioCaptureClient::GetBuffer said to read 0 frames on pass %u after %u frames on %ls", nPasses, nFrames, m_Tag.c_str());
-				hr = E_UNEXPECTED;
-				bDone = true;
-				continue; // exits loop
-			}
-
-			UINT32 size = nNumFramesToRead * nBlockAlign;
-			memcpy_s(bufferData, bufferByteCount, pData, size);
-
-			hr = pAudioCaptureClient->ReleaseBuffer(nNumFramesToRead);
-			if (FAILED(hr)) {
-				LOG_ERROR(L"IAudioCaptureClient::ReleaseBuffer failed on pass %u after %u frames on %ls: hr = 0x%08x", nPasses, nFrames, m_Tag.c_str(), hr);
-				bDone = true;
-				continue; // exits loop
-			}
-
-#pragma prefast(suppress: __WARNING_INCORRECT_ANNOTATION, "IAudioCaptureClient::GetBuffer SAL annotation implies a 1-byte buffer")
-			const std::lock_guard<std::mutex> lock(m_TaskWrapperImpl->m_Mutex);
-			if (m_RecordedBytes.size() == 0)
-				m_RecordedBytes.reserve(size);
-			m_RecordedBytes.insert(m_RecordedBytes.end(), &bufferData[0], &bufferData[size]);
-			//This should reduce glitching if there is discontinuity in the audio stream.
-			if (isDiscontinuity) {
-				UINT64 frameDiff = nDevicePosition - nLastDevicePosition;
-				if (frameDiff != nNumFramesToRead) {
-					m_RecordedBytes.insert(m_RecordedBytes.begin(), (size_t)(frameDiff * nBlockAlign), 0);
-					LOG_DEBUG(L"Discontinuity detected, padded audio bytes with %d bytes of silence on %ls", frameDiff, m_Tag.c_str());
-				}
-			}
-			nFrames += nNumFramesToRead;
-			bFirstPacket = false;
-			nLastDevicePosition = nDevicePosition;
+		AUDIO_CAPTURE_PASS pass;
+		captureSource.SetPass(nPasses);
+		hr = m_Stream.ReadPackets(&captureSource, &pass);
+		if (pass.MissingFrames > 0) {
+			LOG_DEBUG(L"Discontinuity detected, %llu frames missing on %ls", pass.MissingFrames, m_Tag.c_str());
+		}
+		if (pass.DroppedFrames > 0) {
+			LOG_TRACE(L"Audio packet queue full on %ls, dropped %u frames", m_Tag.c_str(), pass.DroppedFrames);
 		}
-
 		if (FAILED(hr)) {
-			LOG_ERROR(L"IAudioCaptureClient::GetNextPacketSize failed on pass %u after %u frames on %ls: hr = 0x%08x", nPasses, nFrames, m_Tag.c_str(), hr);
+			LOG_ERROR(L"Reading audio packets failed on pass %u after %llu frames on %ls: hr = 0x%08x", nPasses, captureSource.GetFrames(), m_Tag.c_str(), hr);
 			bDone = true;
 			continue; // exits loop
 		}
@@ -333,64 +394,106 @@ FALSE, 5000
 );
 
 		if (WAIT_OBJECT_0 == dwWaitResult) {
-			LOG_DEBUG(L"Received stop event after %u passes and %u frames on %ls", nPasses, nFrames, m_Tag.c_str());
+			LOG_DEBUG(L"Received stop event after %u passes and %llu frames on %ls", nPasses, captureSource.GetFrames(), m_Tag.c_str());
 			bDone = true;
 		}
 		else if (WAIT_TIMEOUT == dwWaitResult) {
-			LOG_ERROR(L"WaitForMultipleObjects timeout on pass %u after %u frames on %ls", dwWaitResult, nPasses, nFrames, m_Tag.c_str());
+			LOG_ERROR(L"WaitForMultipleObjects timeout on pass %u after %llu frames on %ls", nPasses, captureSource.GetFrames(), m_Tag.c_str());
 			hr = E_UNEXPECTED;
 			bDone = true;
 		}
 		else if (WAIT_OBJECT_0 + 1 != dwWaitResult) {
-			LOG_ERROR(L"Unexpected WaitForMultipleObjects return value %u on pass %u after %u frames on %ls", dwWaitResult, nPasses, nFrames, m_Tag.c_str());
+			LOG_ERROR(L"Unexpected WaitForMultipleObjects return value %u on pass %u after %llu frames on %ls", dwWaitResult, nPasses, captureSource.GetFrames(), m_Tag.c_str());
 			hr = E_UNEXPECTED;
 			bDone = true;
 		}
 	} // capture loop
 	return hr;
 }
-std::vector<BYTE> LoopbackCapture::PeakRecordedBytes()
+void LoopbackCapture::GetRecordedBytes(UINT64 duration100Nanos, std::vector<BYTE> &recordedBytes, AUDIO_BUFFER_COUNTERS *pCounters, bool *pIsSilent)
 {
-	return m_RecordedBytes;
+	recordedBytes.clear();
+	bool isSilent;
+	ReadAudio(duration100Nanos, recordedBytes, pCounters, &isSilent);
+	if (pIsSilent) {
+		*pIsSilent = isSilent;
+	}
 }
 
-std::vector<BYTE> LoopbackCapture::GetRecordedBytes(UINT64 duration100Nanos)
+void LoopbackCapture::ReadAudio(_In_ UINT64 duration100Nanos, _Inout_ std::vector<BYTE> &recordedBytes, _Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters, _Out_ bool *pIsSilent)
 {
-	int frameCount = int(ceil(m_InputFormat.sampleRate * HundredNanosToSeconds(duration100Nanos)));
-
-	std::vector<BYTE> newvector;
-	size_t byteCount;
-	{
-		const std::lock_guard<std::mutex> lock(m_TaskWrapperImpl->m_Mutex);
-		byteCount = min((frameCount * m_InputFormat.FrameBytes()), m_RecordedBytes.size());
-		newvector = std::vector<BYTE>(m_RecordedBytes.begin(), m_RecordedBytes.begin() + byteCount);
-		m_RecordedBytes.erase(m_RecordedBytes.begin(), m_RecordedBytes.begin() + byteCount);
-		LOG_TRACE(L"Got %d bytes from LoopbackCapture %ls. %d bytes remaining", newvector.size(), m_Tag.c_str(), m_RecordedBytes.size());
+	bool isSilent = m_OverflowBytes.empty() || m_IsOverflowSilent;
+	//Audio handed back by the previous caller goes first. The buffer keeps its capacity between calls, so it is only allocated while warming up.
+	size_t start = recordedBytes.size();
+	ResizeAudioBuffer(recordedBytes, start + m_OverflowBytes.size(), pCounters);
+	if (m_OverflowBytes.size() > 0) {
+		memcpy(recordedBytes.data() + start, m_OverflowBytes.data(), m_OverflowBytes.size());
+		CountAudioCopy(pCounters, m_OverflowBytes.size());
+		m_OverflowBytes.clear();
 	}
-	// convert audio
+	size_t offset = recordedBytes.size();
+	//Nothing is read while the capture thread sets the stream up for a new device.
+	if (!BeginStreamRead()) {
+		*pIsSilent = isSilent;
+		return;
+	}
+	bool isReadSilent;
+	m_Stream.MeasureLatency(GetQpc100Nanos());
+#if USE_MF_RESAMPLER
+	m_ResamplerInputBuffer.clear();
+	m_Stream.Read(duration100Nanos, m_ResamplerInputBuffer, pCounters, &isReadSilent);
+	size_t byteCount = m_ResamplerInputBuffer.size();
 	if (requiresResampling() && byteCount > 0) {
 		WWMFSampleData sampleData;
-		HRESULT hr = m_Resampler.Resample(newvector.data(), (DWORD)newvector.size(), &sampleData);
+		HRESULT hr = m_Resampler.Resample(m_ResamplerInputBuffer.data(), (DWORD)byteCount, &sampleData);
 		if (SUCCEEDED(hr)) {
 			LOG_TRACE(L"Resampled audio from %dch %uhz to %dch %uhz", m_InputFormat.nChannels, m_InputFormat.sampleRate, m_OutputFormat.nChannels, m_OutputFormat.sampleRate);
 		}
 		else {
 			LOG_ERROR(L"Resampling of audio failed: hr = 0x%08x", hr);
 		}
-		newvector.clear();
-		newvector.insert(newvector.end(), &sampleData.data[0], &sampleData.data[sampleData.bytes]);
+		ResizeAudioBuffer(recordedBytes, offset + sampleData.bytes, pCounters);
+		if (sampleData.bytes > 0) {
+			memcpy(recordedBytes.data() + offset, sampleData.data, sampleData.bytes);
+			CountAudioCopy(pCounters, sampleData.bytes);
+		}
 		sampleData.Release();
+		//The resampler MFT may still be ringing out earlier audio.
+		isReadSilent = false;
 	}
-	if (m_OverflowBytes.size() > 0) {
-		newvector.insert(newvector.begin(), m_OverflowBytes.begin(), m_OverflowBytes.end());
-		m_OverflowBytes.clear();
+	else {
+		ResizeAudioBuffer(recordedBytes, offset + byteCount, pCounters);
+		if (byteCount > 0) {
+			memcpy(recordedBytes.data() + offset, m_ResamplerInputBuffer.data(), byteCount);
+			CountAudioCopy(pCounters, byteCount);
+		}
 	}
-
-	return newvector;
+#else
+	m_Stream.Read(duration100Nanos, recordedBytes, pCounters, &isReadSilent);
+	size_t byteCount = recordedBytes.size() - offset;
+#endif
+	EndStreamRead();
+	isSilent = isSilent && isReadSilent;
+	LOG_TRACE(L"Got %d bytes from LoopbackCapture %ls", byteCount, m_Tag.c_str());
+	ReportDroppedAudio();
+	*pIsSilent = isSilent;
 }
 
 HRESULT LoopbackCapture::StartCapture(UINT32 sampleRate, UINT32 audioChannels, std::wstring device, EDataFlow flow)
 {
+	RETURN_ON_BAD_HR(BeginStartCapture(sampleRate, audioChannels, device, flow));
+	HRESULT hr = WaitForCaptureStarted(5000);
+	if (hr == S_FALSE) {
+		LOG_ERROR(L"Timed out when starting capture");
+		hr = E_FAIL;
+	}
+	return hr;
+}
+
+HRESULT LoopbackCapture::BeginStartCapture(UINT32 sampleRate, UINT32 audioChannels, std::wstring device, EDataFlow flow)
+{
+	//A capture that failed or timed out must be fully stopped before its events are replaced.
+	StopCapture();
 	HRESULT hr = E_FAIL;
 	bool isDeviceEmpty = device.empty();
 	LPCWSTR argv[3] = { L"", L"--device", device.c_str() };
@@ -402,21 +505,25 @@ HRESULT LoopbackCapture::StartCapture(UINT32 sampleRate, UINT32 audioChannels, s
 			LOG_ERROR(L"CreateEvent failed: last error is %u", GetLastError());
 			return E_FAIL;
 		}
-
-		m_CaptureStopEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+		//Manual reset, so it stays set once the capture has ended, however often the caller waits for the start.
+		m_CaptureStopEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
 		if (nullptr == m_CaptureStopEvent) {
 			LOG_ERROR(L"CreateEvent failed: last error is %u", GetLastError());
 			return E_FAIL;
 		}
 
 		IMMDevice *device = prefs.m_pMMDevice;
+		//The task may still be activating the device when prefs goes out of scope.
+		if (device) {
+			device->AddRef();
+		}
 		auto file = prefs.m_hFile;
 		m_TaskWrapperImpl->m_CaptureTask = concurrency::create_task([this, flow, sampleRate, audioChannels, device, file]() {
+			ReleaseOnExit releaseDevice(device);
 			HRESULT hr = E_FAIL;
 			try {
-				StartLoopbackCapture(device,
+				hr = StartLoopbackCapture(device,
 					file,
-					true,
 					m_CaptureStartedEvent,
 					m_CaptureStopEvent,
 					flow,
@@ -429,55 +536,110 @@ HRESULT LoopbackCapture::StartCapture(UINT32 sampleRate, UINT32 audioChannels, s
 			catch (...) {
 				LOG_ERROR(L"Exception in LoopbackCapture");
 			}
-			if (FAILED(hr))
-			{
-				SetEvent(m_CaptureStopEvent);
+			bool wasCapturing = m_IsCapturing.exchange(false);
+			bool isStopRequested = WaitForSingleObject(m_CaptureStopEvent, 0) == WAIT_OBJECT_0;
+			SetEvent(m_CaptureStopEvent);
+			if (wasCapturing && !isStopRequested) {
+				//E.g. the device was unplugged or disabled.
+				LOG_WARN(L"Audio capture on %ls ended unexpectedly: hr = 0x%08x", m_Tag.c_str(), hr);
+				if (m_CaptureEndedCallback) {
+					m_CaptureEndedCallback();
+				}
 			}
-			m_IsCapturing = false;
-			CloseHandle(m_CaptureStopEvent);
-			CloseHandle(m_CaptureStartedEvent);
 		});
-		HANDLE events[2] = { m_CaptureStartedEvent ,m_CaptureStopEvent };
-		DWORD dwWaitResult = WaitForMultipleObjects(ARRAYSIZE(events), events, false, 5000);
-		if (dwWaitResult == WAIT_OBJECT_0) {
-			hr = S_OK;
-			m_IsCapturing = true;
-		}
-		else if (dwWaitResult == WAIT_OBJECT_0 + 1) {
-			LOG_ERROR(L"Received stop event when starting capture");
-			hr = E_FAIL;
-		}
-		else if (dwWaitResult == WAIT_TIMEOUT) {
-			LOG_ERROR(L"Timed out when starting capture");
-			hr = E_FAIL;
-		}
+		hr = S_OK;
 	}
 	return hr;
 }
 
+HRESULT LoopbackCapture::WaitForCaptureStarted(DWORD timeoutMillis)
+{
+	if (m_IsCapturing) {
+		return S_OK;
+	}
+	if (nullptr == m_CaptureStartedEvent) {
+		return E_UNEXPECTED;
+	}
+	HANDLE events[2] = { m_CaptureStartedEvent ,m_CaptureStopEvent };
+	DWORD dwWaitResult = WaitForMultipleObjects(ARRAYSIZE(events), events, false, timeoutMillis);
+	if (dwWaitResult == WAIT_OBJECT_0) {
+		//The capture may have already ended again.
+		return m_IsCapturing ? S_OK : E_FAIL;
+	}
+	else if (dwWaitResult == WAIT_OBJECT_0 + 1) {
+		LOG_ERROR(L"Received stop event when starting capture");
+		return E_FAIL;
+	}
+	else if (dwWaitResult == WAIT_TIMEOUT) {
+		return S_FALSE;
+	}
+	return E_FAIL;
+}
+
 HRESULT LoopbackCapture::StopCapture()
 {
-	SetEvent(m_CaptureStopEvent);
+	AUDIO_DRIFT_STATS driftStats = m_Stream.GetDriftStats();
+	if (m_IsCapturing && driftStats.UpdateCount > 0) {
+		LOG_INFO(L"Audio clock drift on %ls estimated at %.1f ppm, %.1f ms buffered", m_Tag.c_str(), driftStats.DriftPpm, driftStats.BufferedSeconds * 1000);
+	}
+	AUDIO_LATENCY_STATS latencyStats = m_Stream.GetLatencyStats();
+	if (m_IsCapturing && latencyStats.Count > 0) {
+		LOG_INFO(L"Audio capture to mix latency on %ls: %.1f ms average, %.1f ms min, %.1f ms max", m_Tag.c_str(), latencyStats.AverageMillis, latencyStats.MinMillis, latencyStats.MaxMillis);
+	}
+	if (m_CaptureStopEvent) {
+		SetEvent(m_CaptureStopEvent);
+	}
+	HRESULT hr = S_OK;
 	try
 	{
 		m_TaskWrapperImpl->m_CaptureTask.wait();
 	}
 	catch (const exception &e) {
 		LOG_ERROR(L"Exception in StopCapture: %s", s2ws(e.what()).c_str());
-		return E_FAIL;
+		hr = E_FAIL;
 	}
 	catch (...) {
 		LOG_ERROR(L"Exception in StopCapture");
 	}
-	return S_OK;
+	m_IsCapturing = false;
+	//The events are only closed once the capture task is done with them.
+	if (m_CaptureStopEvent) {
+		CloseHandle(m_CaptureStopEvent);
+		m_CaptureStopEvent = nullptr;
+	}
+	if (m_CaptureStartedEvent) {
+		CloseHandle(m_CaptureStartedEvent);
+		m_CaptureStartedEvent = nullptr;
+	}
+	return hr;
 }
 
-void LoopbackCapture::ReturnAudioBytesToBuffer(std::vector<BYTE> bytes)
+void LoopbackCapture::ReturnAudioBytesToBuffer(const BYTE *pData, size_t cbData, bool isSilent)
 {
-	m_OverflowBytes.swap(bytes);
+	m_OverflowBytes.assign(pData, pData + cbData);
+	m_IsOverflowSilent = isSilent;
 	LOG_TRACE(L"Returned %d bytes to buffer in LoopbackCapture %ls", m_OverflowBytes.size(), m_Tag.c_str());
 }
 
+void LoopbackCapture::ReportDroppedAudio()
+{
+	UINT64 overflowCount = m_Stream.GetDroppedPacketCount();
+	if (overflowCount != m_LastReportedOverflowCount) {
+		LOG_WARN(L"Audio packet queue overflowed %llu times on %ls, %llu frames dropped in total", overflowCount - m_LastReportedOverflowCount, m_Tag.c_str(), m_Stream.GetDroppedFrames());
+		m_LastReportedOverflowCount = overflowCount;
+	}
+	UINT64 resyncCount = m_Stream.GetResyncCount();
+	if (resyncCount != m_LastReportedResyncCount) {
+		LOG_WARN(L"Audio capture on %ls fell behind, %llu frames dropped in total to catch up", m_Tag.c_str(), m_Stream.GetResyncFrames());
+		m_LastReportedResyncCount = resyncCount;
+	}
+}
+
+bool LoopbackCapture::isDriftCompensated()
+{
+	return USE_DRIFT_COMPENSATION && !USE_MF_RESAMPLER;
+}
+
 bool LoopbackCapture::requiresResampling()
 {
 	return m_InputFormat.sampleRate != m_OutputFormat.sampleRate
@@ -490,6 +652,34 @@ bool LoopbackCapture::IsCapturing() {
 
 void LoopbackCapture::ClearRecordedBytes()
 {
-	const std::lock_guard<std::mutex> lock(m_TaskWrapperImpl->m_Mutex);
-	m_RecordedBytes.clear();
+	if (BeginStreamRead()) {
+		m_Stream.Clear();
+		EndStreamRead();
+	}
+}
+
+bool LoopbackCapture::GetRecordedBytesTimestamp(_Out_ UINT64 *pQpcPosition)
+{
+	if (!BeginStreamRead()) {
+		return false;
+	}
+	bool hasTimestamp = m_Stream.GetReadTimestamp(pQpcPosition);
+	EndStreamRead();
+	return hasTimestamp;
+}
+
+bool LoopbackCapture::BeginStreamRead()
+{
+	//Both flags are sequentially consistent, so either this sees the stream is not ready, or the capture thread sees it in use and waits.
+	m_IsStreamInUse = true;
+	if (!m_IsStreamReady) {
+		m_IsStreamInUse = false;
+		return false;
+	}
+	return true;
+}
+
+void LoopbackCapture::EndStreamRead()
+{
+	m_IsStreamInUse = false;
 }
\ No newline at end of file
@@ -4,9 +4,15 @@
 #include <avrt.h>
 #include <mmdeviceapi.h>
 #include "WWMFResampler.h"
+#include "AudioCaptureStream.h"
+#include "AudioGraph.h"
+#include "AudioBufferCounters.h"
 #include "AudioPrefs.h"
 #include "Log.h"
+#include "CommonTypes.h"
 #include <thread>
+#include <atomic>
+#include <functional>
 #include <stdio.h>
 #include <audioclient.h>
 #include <vector>
@@ -14,7 +20,18 @@
 #pragma comment(lib, "ole32.lib")
 #pragma comment(lib, "winmm.lib")
 
-class LoopbackCapture
+/// <summary>
+/// How a capture buffers audio on the device and wakes up to collect it.
+/// </summary>
+struct AUDIO_CAPTURE_TIMING {
+	//The size of the device capture buffer. It is made at least twice the wake interval, so one late wakeup loses nothing.
+	UINT32 BufferMillis = 200;
+	AudioCaptureWakeModeInternal WakeMode = AudioCaptureWakeModeInternal::Event;
+	//Time between wakeups when capturing on the timer. 0 for half the device period.
+	UINT32 WakeIntervalMillis = 0;
+};
+
+class LoopbackCapture : public IAudioGraphSource
 {
 public:
 	LoopbackCapture(_In_opt_ std::wstring tag = L"");
@@ -24,35 +41,94 @@ public:
 	HRESULT StartLoopbackCapture(
 		IMMDevice *pMMDevice,
 		HMMIO hFile,
-		bool bInt16,
 		HANDLE hStartedEvent,
 		HANDLE hStopEvent,
 		EDataFlow flow,
 		UINT32 samplerate,
 		UINT32 channels
 	);
-	std::vector<BYTE> PeakRecordedBytes();
-	std::vector<BYTE> GetRecordedBytes(UINT64 duration100Nanos);
+	/// <summary>
+	/// Replaces the content of recordedBytes with the audio captured for the given duration, converted to the output format.
+	/// Audio is captured and returned as interleaved 32 bit float samples, so nothing is rounded or clipped before the final conversion for the encoder.
+	/// The buffer is reused between calls, so pass the same one each time to avoid allocations.
+	/// pIsSilent is set to true if the returned audio is known to be silence, i.e. it only came from silent packets or gaps.
+	/// </summary>
+	void GetRecordedBytes(UINT64 duration100Nanos, std::vector<BYTE> &recordedBytes, AUDIO_BUFFER_COUNTERS *pCounters = nullptr, bool *pIsSilent = nullptr);
+	/// <summary>
+	/// Same as GetRecordedBytes, but appends to the end of recordedBytes, so the capture can feed an AudioGraph.
+	/// </summary>
+	void ReadAudio(_In_ UINT64 duration100Nanos, _Inout_ std::vector<BYTE> &recordedBytes, _Inout_opt_ AUDIO_BUFFER_COUNTERS *pCounters, _Out_ bool *pIsSilent) override;
 	HRESULT StartCapture(UINT32 audioChannels, std::wstring device, EDataFlow flow) { return StartCapture(0, audioChannels, device, flow); }
 	HRESULT StartCapture(UINT32 sampleRate, UINT32 audioChannels, std::wstring device, EDataFlow flow);
+	/// <summary>
+	/// Starts capturing in the background without waiting for the device to start, so a device can be swapped in while recording goes on.
+	/// Poll WaitForCaptureStarted to find out when it runs.
+	/// </summary>
+	HRESULT BeginStartCapture(UINT32 sampleRate, UINT32 audioChannels, std::wstring device, EDataFlow flow);
+	/// <summary>
+	/// Waits for a capture begun with BeginStartCapture to start. Returns S_OK once it runs, S_FALSE if it is still starting after timeoutMillis,
+	/// and an error if it failed to start.
+	/// </summary>
+	HRESULT WaitForCaptureStarted(DWORD timeoutMillis);
 	HRESULT StopCapture();
-	void ReturnAudioBytesToBuffer(std::vector<BYTE> bytes);
+	/// <summary>
+	/// Sets a function called on the capture thread when the capture ends without StopCapture being called, e.g. because the device was removed.
+	/// Must be set before the capture is started.
+	/// </summary>
+	inline void SetCaptureEndedCallback(_In_ std::function<void()> callback) { m_CaptureEndedCallback = callback; }
+	/// <summary>
+	/// Sets the buffer size and wake strategy of the capture. Must be set before the capture is started.
+	/// </summary>
+	inline void SetCaptureTiming(_In_ const AUDIO_CAPTURE_TIMING &timing) { m_Timing = timing; }
+	/// <summary>
+	/// Puts audio taken with GetRecordedBytes back, so the next call returns it first.
+	/// isSilent should be what GetRecordedBytes reported for it, so silence stays known as silence.
+	/// </summary>
+	void ReturnAudioBytesToBuffer(const BYTE *pData, size_t cbData, bool isSilent = false);
+	/// <summary>
+	/// The estimated clock drift of this device relative to the media clock, and the fill of the captured audio buffer.
+	/// </summary>
+	inline AUDIO_DRIFT_STATS GetDriftStats() const { return m_Stream.GetDriftStats(); }
+	/// <summary>
+	/// The time from the capture of audio to its mixing, measured on every call to GetRecordedBytes.
+	/// </summary>
+	inline AUDIO_LATENCY_STATS GetLatencyStats() const { return m_Stream.GetLatencyStats(); }
+	/// <summary>
+	/// Gets the performance counter time, in 100 nanosecond units, at which the first frame the next call to GetRecordedBytes returns was captured.
+	/// Must be called from the thread calling GetRecordedBytes. Returns false if no audio is buffered.
+	/// </summary>
+	bool GetRecordedBytesTimestamp(_Out_ UINT64 *pQpcPosition);
 
 private:
 	struct TaskWrapper;
 	std::unique_ptr<TaskWrapper> m_TaskWrapperImpl;
 
-	bool m_IsCapturing = false;
+	std::atomic<bool> m_IsCapturing{ false };
+	std::function<void()> m_CaptureEndedCallback;
+	AUDIO_CAPTURE_TIMING m_Timing;
 	std::vector<BYTE> m_OverflowBytes = {};
-	std::vector<BYTE> m_RecordedBytes = {};
+	bool m_IsOverflowSilent = false;
+	//Captured audio, queued by the capture thread and read by GetRecordedBytes.
+	AudioCaptureStream m_Stream;
+	//The capture thread sets the stream up again for each device it starts on, while the reader may still be taking what the previous one captured.
+	//The reader only enters the stream while it is ready, and the capture thread waits for a read in progress to leave it before setting it up.
+	std::atomic<bool> m_IsStreamReady{ false };
+	std::atomic<bool> m_IsStreamInUse{ false };
+	UINT64 m_LastReportedOverflowCount = 0;
+	UINT64 m_LastReportedResyncCount = 0;
 	std::wstring m_Tag;
 	HANDLE m_CaptureStartedEvent = nullptr;
 	HANDLE m_CaptureStopEvent = nullptr;
 
 	WWMFResampler m_Resampler;
+	std::vector<BYTE> m_ResamplerInputBuffer = {};
 	WWMFPcmFormat m_InputFormat;
 	WWMFPcmFormat m_OutputFormat;
 
 	bool requiresResampling();
+	bool isDriftCompensated();
+	void ReportDroppedAudio();
+	bool BeginStreamRead();
+	void EndStreamRead();
 };
 
@@ -0,0 +1,221 @@
+#include "MediaBufferPool.h"
+#include <algorithm>
+#include <mutex>
+
+namespace {
+	//Buffer sizes are rounded up to this, so frames of slightly different lengths can share buffers.
+	const DWORD BufferGranularity = 4096;
+	//Buffers returned beyond this many idle ones are freed.
+	const size_t MaxIdleBuffers = 16;
+}
+
+struct PooledMediaBuffer::POOL_STATE {
+	std::mutex Mutex;
+	std::vector<PooledMediaBuffer *> IdleBuffers;
+	std::vector<PooledMediaBuffer *> IdleSilenceBuffers;
+	std::shared_ptr<BYTE> ZeroPage;
+	DWORD ZeroPageSize = 0;
+	bool IsClosed = false;
+	std::atomic<UINT64> AllocationCount{ 0 };
+
+	//Takes back a buffer whose reference count dropped to zero. Returns false if the buffer should be deleted instead.
+	bool Recycle(_In_ PooledMediaBuffer *pBuffer) {
+		const std::lock_guard<std::mutex> lock(Mutex);
+		auto &idleBuffers = pBuffer->IsSilence() ? IdleSilenceBuffers : IdleBuffers;
+		if (IsClosed || idleBuffers.size() >= MaxIdleBuffers) {
+			return false;
+		}
+		idleBuffers.push_back(pBuffer);
+		return true;
+	}
+};
+
+PooledMediaBuffer::PooledMediaBuffer(_In_ std::shared_ptr<POOL_STATE> pool, _In_ DWORD capacity) :
+	m_nRefCount(0),
+	m_Pool(pool),
+	m_Data(capacity > 0 ? new (std::nothrow) BYTE[capacity] : nullptr),
+	m_SharedData(nullptr),
+	m_pData(m_Data.get()),
+	m_Capacity(capacity),
+	m_CurrentLength(0)
+{
+}
+
+PooledMediaBuffer::~PooledMediaBuffer()
+{
+}
+
+STDMETHODIMP PooledMediaBuffer::Lock(_Outptr_result_bytebuffer_to_(*pcbMaxLength, *pcbCurrentLength) BYTE **ppbBuffer, _Out_opt_ DWORD *pcbMaxLength, _Out_opt_ DWORD *pcbCurrentLength)
+{
+	if (ppbBuffer == nullptr) {
+		return E_POINTER;
+	}
+	*ppbBuffer = m_pData;
+	if (pcbMaxLength) {
+		*pcbMaxLength = m_Capacity;
+	}
+	if (pcbCurrentLength) {
+		*pcbCurrentLength = m_CurrentLength;
+	}
+	return S_OK;
+}
+
+STDMETHODIMP PooledMediaBuffer::Unlock()
+{
+	return S_OK;
+}
+
+STDMETHODIMP PooledMediaBuffer::GetCurrentLength(_Out_ DWORD *pcbCurrentLength)
+{
+	if (pcbCurrentLength == nullptr) {
+		return E_POINTER;
+	}
+	*pcbCurrentLength = m_CurrentLength;
+	return S_OK;
+}
+
+STDMETHODIMP PooledMediaBuffer::SetCurrentLength(DWORD cbCurrentLength)
+{
+	if (cbCurrentLength > m_Capacity) {
+		return E_INVALIDARG;
+	}
+	m_CurrentLength = cbCurrentLength;
+	return S_OK;
+}
+
+STDMETHODIMP PooledMediaBuffer::GetMaxLength(_Out_ DWORD *pcbMaxLength)
+{
+	if (pcbMaxLength == nullptr) {
+		return E_POINTER;
+	}
+	*pcbMaxLength = m_Capacity;
+	return S_OK;
+}
+
+STDMETHODIMP PooledMediaBuffer::QueryInterface(REFIID riid, void **ppv)
+{
+	static const QITAB qit[] = {
+		QITABENT(PooledMediaBuffer, IMFMediaBuffer),
+	{0}
+	};
+	return QISearch(this, qit, riid, ppv);
+}
+
+STDMETHODIMP_(ULONG) PooledMediaBuffer::AddRef()
+{
+	return InterlockedIncrement(&m_nRefCount);
+}
+
+STDMETHODIMP_(ULONG) PooledMediaBuffer::Release()
+{
+	ULONG refCount = InterlockedDecrement(&m_nRefCount);
+	if (refCount == 0) {
+		if (!m_Pool->Recycle(this)) {
+			delete this;
+		}
+	}
+	return refCount;
+}
+
+MediaBufferPool::MediaBufferPool() :
+	m_State(std::make_shared<PooledMediaBuffer::POOL_STATE>())
+{
+}
+
+MediaBufferPool::~MediaBufferPool()
+{
+	std::vector<PooledMediaBuffer *> idleBuffers;
+	{
+		const std::lock_guard<std::mutex> lock(m_State->Mutex);
+		m_State->IsClosed = true;
+		idleBuffers.swap(m_State->IdleBuffers);
+		idleBuffers.insert(idleBuffers.end(), m_State->IdleSilenceBuffers.begin(), m_State->IdleSilenceBuffers.end());
+		m_State->IdleSilenceBuffers.clear();
+	}
+	//Buffers still held elsewhere, e.g. by the sink writer, delete themselves when released.
+	for (PooledMediaBuffer *pBuffer : idleBuffers) {
+		delete pBuffer;
+	}
+}
+
+HRESULT MediaBufferPool::GetBuffer(_In_ DWORD cbSize, _Outptr_ PooledMediaBuffer **ppBuffer)
+{
+	if (ppBuffer == nullptr) {
+		return E_POINTER;
+	}
+	*ppBuffer = nullptr;
+	PooledMediaBuffer *pBuffer = nullptr;
+	{
+		const std::lock_guard<std::mutex> lock(m_State->Mutex);
+		auto &idleBuffers = m_State->IdleBuffers;
+		for (auto it = idleBuffers.begin(); it != idleBuffers.end(); it++) {
+			if ((*it)->m_Capacity >= cbSize) {
+				pBuffer = *it;
+				idleBuffers.erase(it);
+				break;
+			}
+		}
+	}
+	if (!pBuffer) {
+		DWORD capacity = (std::max)(BufferGranularity, (cbSize + BufferGranularity - 1) / BufferGranularity * BufferGranularity);
+		pBuffer = new (std::nothrow) PooledMediaBuffer(m_State, capacity);
+		if (!pBuffer || !pBuffer->m_Data) {
+			delete pBuffer;
+			return E_OUTOFMEMORY;
+		}
+		m_State->AllocationCount.fetch_add(1, std::memory_order_relaxed);
+	}
+	pBuffer->m_CurrentLength = cbSize;
+	pBuffer->AddRef();
+	*ppBuffer = pBuffer;
+	return S_OK;
+}
+
+HRESULT MediaBufferPool::GetSilenceBuffer(_In_ DWORD cbSize, _Outptr_ PooledMediaBuffer **ppBuffer)
+{
+	if (ppBuffer == nullptr) {
+		return E_POINTER;
+	}
+	*ppBuffer = nullptr;
+	PooledMediaBuffer *pBuffer = nullptr;
+	std::shared_ptr<BYTE> zeroPage;
+	DWORD zeroPageSize;
+	{
+		const std::lock_guard<std::mutex> lock(m_State->Mutex);
+		if (m_State->ZeroPageSize < cbSize) {
+			//Buffers handed out earlier keep the smaller page alive until they are released.
+			DWORD size = (cbSize + BufferGranularity - 1) / BufferGranularity * BufferGranularity;
+			BYTE *pPage = new (std::nothrow) BYTE[size]();
+			if (!pPage) {
+				return E_OUTOFMEMORY;
+			}
+			m_State->ZeroPage = std::shared_ptr<BYTE>(pPage, std::default_delete<BYTE[]>());
+			m_State->ZeroPageSize = size;
+			m_State->AllocationCount.fetch_add(1, std::memory_order_relaxed);
+		}
+		zeroPage = m_State->ZeroPage;
+		zeroPageSize = m_State->ZeroPageSize;
+		if (!m_State->IdleSilenceBuffers.empty()) {
+			pBuffer = m_State->IdleSilenceBuffers.back();
+			m_State->IdleSilenceBuffers.pop_back();
+		}
+	}
+	if (!pBuffer) {
+		pBuffer = new (std::nothrow) PooledMediaBuffer(m_State, 0);
+		if (!pBuffer) {
+			return E_OUTOFMEMORY;
+		}
+	}
+	pBuffer->m_SharedData = zeroPage;
+	pBuffer->m_pData = zeroPage.get();
+	pBuffer->m_Capacity = zeroPageSize;
+	pBuffer->m_CurrentLength = cbSize;
+	pBuffer->AddRef();
+	*ppBuffer = pBuffer;
+	return S_OK;
+}
+
+UINT64 MediaBufferPool::GetAllocationCount() const
+{
+	return m_State->AllocationCount.load(std::memory_order_relaxed);
+}
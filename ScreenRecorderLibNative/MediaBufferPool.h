@@ -0,0 +1,75 @@
+#pragma once
+#include <windows.h>
+#include <mfapi.h>
+#include <mfidl.h>
+#include <Shlwapi.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+class MediaBufferPool;
+
+/// <summary>
+/// IMFMediaBuffer over memory owned by a MediaBufferPool. When the last reference is released, the buffer goes back to the pool instead of being freed,
+/// so the sink writer can hold on to it for as long as it needs while the recorder keeps reusing the memory once it is done.
+/// Audio silence buffers all point into one shared page of zeros, so silence costs no memory or writes, only a length.
+/// </summary>
+class PooledMediaBuffer : public IMFMediaBuffer
+{
+public:
+	// IMFMediaBuffer methods
+	STDMETHODIMP Lock(_Outptr_result_bytebuffer_to_(*pcbMaxLength, *pcbCurrentLength) BYTE **ppbBuffer, _Out_opt_ DWORD *pcbMaxLength, _Out_opt_ DWORD *pcbCurrentLength);
+	STDMETHODIMP Unlock();
+	STDMETHODIMP GetCurrentLength(_Out_ DWORD *pcbCurrentLength);
+	STDMETHODIMP SetCurrentLength(DWORD cbCurrentLength);
+	STDMETHODIMP GetMaxLength(_Out_ DWORD *pcbMaxLength);
+
+	// IUnknown methods
+	STDMETHODIMP QueryInterface(REFIID riid, void **ppv);
+	STDMETHODIMP_(ULONG) AddRef();
+	STDMETHODIMP_(ULONG) Release();
+
+	/// <summary>
+	/// Direct access to the sample memory, for the code filling the buffer before it is handed out. Must not be written to for silence buffers.
+	/// </summary>
+	inline BYTE *GetData() { return m_pData; }
+	inline bool IsSilence() const { return m_SharedData != nullptr; }
+private:
+	friend class MediaBufferPool;
+	struct POOL_STATE;
+	PooledMediaBuffer(_In_ std::shared_ptr<POOL_STATE> pool, _In_ DWORD capacity);
+	virtual ~PooledMediaBuffer();
+
+	volatile long m_nRefCount;
+	std::shared_ptr<POOL_STATE> m_Pool;
+	std::unique_ptr<BYTE[]> m_Data;
+	//The shared zero page, for silence buffers.
+	std::shared_ptr<BYTE> m_SharedData;
+	BYTE *m_pData;
+	DWORD m_Capacity;
+	DWORD m_CurrentLength;
+};
+
+/// <summary>
+/// Hands out reusable media sample buffers, for audio and for converted video frames. Buffers can be released from any thread, also after the pool itself is destroyed.
+/// </summary>
+class MediaBufferPool
+{
+public:
+	MediaBufferPool();
+	~MediaBufferPool();
+	/// <summary>
+	/// Gets a buffer that can hold at least cbSize bytes, with its current length set to cbSize.
+	/// </summary>
+	HRESULT GetBuffer(_In_ DWORD cbSize, _Outptr_ PooledMediaBuffer **ppBuffer);
+	/// <summary>
+	/// Gets a read-only buffer of cbSize bytes of silence, backed by the shared zero page.
+	/// </summary>
+	HRESULT GetSilenceBuffer(_In_ DWORD cbSize, _Outptr_ PooledMediaBuffer **ppBuffer);
+	/// <summary>
+	/// The number of buffers allocated since the pool was created. Once recording has warmed up this should stop growing.
+	/// </summary>
+	UINT64 GetAllocationCount() const;
+private:
+	std::shared_ptr<PooledMediaBuffer::POOL_STATE> m_State;
+};
@@ -0,0 +1,651 @@
+#include "Mp4MuxerSink.h"
+#include "util.h"
+
+namespace {
+	//MF_MT_USER_DATA of an AAC type is the HEAACWAVEINFO after its WAVEFORMATEX: the payload type, profile and reserved fields, then the AudioSpecificConfig.
+	const UINT32 HeAacWaveInfoBytes = 12;
+
+	HRESULT GetBlob(_In_ IMFMediaType *pMediaType, _In_ REFGUID key, _Out_ std::vector<BYTE> *pData)
+	{
+		pData->clear();
+		UINT32 size = 0;
+		if (FAILED(pMediaType->GetBlobSize(key, &size)) || size == 0) {
+			return S_FALSE;
+		}
+		pData->resize(size);
+		return pMediaType->GetBlob(key, pData->data(), size, nullptr);
+	}
+}
+
+Mp4MuxerStreamSink::Mp4MuxerStreamSink(_In_ Mp4MuxerSink *pSink, _In_ DWORD identifier) :
+	m_nRefCount(1),
+	m_Sink(pSink),
+	m_Identifier(identifier),
+	m_EventQueue(nullptr),
+	m_MediaType(nullptr),
+	m_IsShutdown(false)
+{
+	m_Sink->AddRef();
+}
+
+Mp4MuxerStreamSink::~Mp4MuxerStreamSink()
+{
+	m_Sink->Release();
+}
+
+HRESULT Mp4MuxerStreamSink::Initialize(_In_ IMFMediaType *pMediaType)
+{
+	m_MediaType = pMediaType;
+	return MFCreateEventQueue(&m_EventQueue);
+}
+
+void Mp4MuxerStreamSink::Shutdown()
+{
+	m_IsShutdown = true;
+	if (m_EventQueue) {
+		m_EventQueue->Shutdown();
+	}
+}
+
+HRESULT Mp4MuxerStreamSink::QueueStreamEvent(_In_ MediaEventType eventType, _In_ HRESULT hrStatus, _In_opt_ const PROPVARIANT *pValue)
+{
+	return QueueEvent(eventType, GUID_NULL, hrStatus, pValue);
+}
+
+STDMETHODIMP Mp4MuxerStreamSink::GetMediaSink(_Outptr_ IMFMediaSink **ppMediaSink)
+{
+	if (m_IsShutdown) {
+		return MF_E_STREAMSINK_REMOVED;
+	}
+	*ppMediaSink = static_cast<IMFFinalizableMediaSink *>(m_Sink);
+	(*ppMediaSink)->AddRef();
+	return S_OK;
+}
+
+STDMETHODIMP Mp4MuxerStreamSink::GetIdentifier(_Out_ DWORD *pdwIdentifier)
+{
+	if (m_IsShutdown) {
+		return MF_E_STREAMSINK_REMOVED;
+	}
+	*pdwIdentifier = m_Identifier;
+	return S_OK;
+}
+
+STDMETHODIMP Mp4MuxerStreamSink::GetMediaTypeHandler(_Outptr_ IMFMediaTypeHandler **ppHandler)
+{
+	if (m_IsShutdown) {
+		return MF_E_STREAMSINK_REMOVED;
+	}
+	*ppHandler = this;
+	AddRef();
+	return S_OK;
+}
+
+STDMETHODIMP Mp4MuxerStreamSink::ProcessSample(_In_ IMFSample *pSample)
+{
+	if (m_IsShutdown) {
+		return MF_E_STREAMSINK_REMOVED;
+	}
+	RETURN_ON_BAD_HR(m_Sink->WriteSample(m_Identifier, pSample));
+	//The sample is in the muxer, so the next one can come right away.
+	return QueueStreamEvent(MEStreamSinkRequestSample, S_OK, nullptr);
+}
+
+STDMETHODIMP Mp4MuxerStreamSink::PlaceMarker(_In_ MFSTREAMSINK_MARKER_TYPE eMarkerType, _In_ const PROPVARIANT *pvarMarkerValue, _In_ const PROPVARIANT *pvarContextValue)
+{
+	if (m_IsShutdown) {
+		return MF_E_STREAMSINK_REMOVED;
+	}
+	//Samples are muxed as they arrive, so every sample before the marker is already done with.
+	return QueueStreamEvent(MEStreamSinkMarker, S_OK, pvarContextValue);
+}
+
+STDMETHODIMP Mp4MuxerStreamSink::Flush()
+{
+	if (m_IsShutdown) {
+		return MF_E_STREAMSINK_REMOVED;
+	}
+	return S_OK;
+}
+
+STDMETHODIMP Mp4MuxerStreamSink::GetEvent(_In_ DWORD dwFlags, _Outptr_ IMFMediaEvent **ppEvent)
+{
+	if (m_IsShutdown) {
+		return MF_E_SHUTDOWN;
+	}
+	return m_EventQueue->GetEvent(dwFlags, ppEvent);
+}
+
+STDMETHODIMP Mp4MuxerStreamSink::BeginGetEvent(_In_ IMFAsyncCallback *pCallback, _In_opt_ IUnknown *punkState)
+{
+	if (m_IsShutdown) {
+		return MF_E_SHUTDOWN;
+	}
+	return m_EventQueue->BeginGetEvent(pCallback, punkState);
+}
+
+STDMETHODIMP Mp4MuxerStreamSink::EndGetEvent(_In_ IMFAsyncResult *pResult, _Outptr_ IMFMediaEvent **ppEvent)
+{
+	if (m_IsShutdown) {
+		return MF_E_SHUTDOWN;
+	}
+	return m_EventQueue->EndGetEvent(pResult, ppEvent);
+}
+
+STDMETHODIMP Mp4MuxerStreamSink::QueueEvent(_In_ MediaEventType met, _In_ REFGUID guidExtendedType, _In_ HRESULT hrStatus, _In_opt_ const PROPVARIANT *pvValue)
+{
+	if (m_IsShutdown) {
+		return MF_E_SHUTDOWN;
+	}
+	return m_EventQueue->QueueEventParamVar(met, guidExtendedType, hrStatus, pvValue);
+}
+
+STDMETHODIMP Mp4MuxerStreamSink::IsMediaTypeSupported(_In_ IMFMediaType *pMediaType, _Outptr_opt_result_maybenull_ IMFMediaType **ppMediaType)
+{
+	if (ppMediaType) {
+		*ppMediaType = nullptr;
+	}
+	if (m_IsShutdown) {
+		return MF_E_STREAMSINK_REMOVED;
+	}
+	//The muxer takes the codec the stream was created with, in any frame size or sample rate, as those are read when the track is added.
+	GUID majorType, subtype, currentMajorType, currentSubtype;
+	RETURN_ON_BAD_HR(pMediaType->GetGUID(MF_MT_MAJOR_TYPE, &majorType));
+	RETURN_ON_BAD_HR(pMediaType->GetGUID(MF_MT_SUBTYPE, &subtype));
+	RETURN_ON_BAD_HR(m_MediaType->GetGUID(MF_MT_MAJOR_TYPE, &currentMajorType));
+	RETURN_ON_BAD_HR(m_MediaType->GetGUID(MF_MT_SUBTYPE, &currentSubtype));
+	if (majorType != currentMajorType || subtype != currentSubtype) {
+		return MF_E_INVALIDMEDIATYPE;
+	}
+	return S_OK;
+}
+
+STDMETHODIMP Mp4MuxerStreamSink::GetMediaTypeCount(_Out_ DWORD *pdwTypeCount)
+{
+	if (m_IsShutdown) {
+		return MF_E_STREAMSINK_REMOVED;
+	}
+	*pdwTypeCount = 1;
+	return S_OK;
+}
+
+STDMETHODIMP Mp4MuxerStreamSink::GetMediaTypeByIndex(_In_ DWORD dwIndex, _Outptr_ IMFMediaType **ppType)
+{
+	if (m_IsShutdown) {
+		return MF_E_STREAMSINK_REMOVED;
+	}
+	if (dwIndex > 0) {
+		return MF_E_NO_MORE_TYPES;
+	}
+	return GetCurrentMediaType(ppType);
+}
+
+STDMETHODIMP Mp4MuxerStreamSink::SetCurrentMediaType(_In_ IMFMediaType *pMediaType)
+{
+	RETURN_ON_BAD_HR(IsMediaTypeSupported(pMediaType, nullptr));
+	//The sink writer sets the type before it starts writing, e.g. with the sequence header of the encoder, so this does not race with the samples.
+	m_MediaType = pMediaType;
+	return S_OK;
+}
+
+STDMETHODIMP Mp4MuxerStreamSink::GetCurrentMediaType(_Outptr_ IMFMediaType **ppMediaType)
+{
+	if (m_IsShutdown) {
+		return MF_E_STREAMSINK_REMOVED;
+	}
+	*ppMediaType = m_MediaType;
+	(*ppMediaType)->AddRef();
+	return S_OK;
+}
+
+STDMETHODIMP Mp4MuxerStreamSink::GetMajorType(_Out_ GUID *pguidMajorType)
+{
+	if (m_IsShutdown) {
+		return MF_E_STREAMSINK_REMOVED;
+	}
+	return m_MediaType->GetGUID(MF_MT_MAJOR_TYPE, pguidMajorType);
+}
+
+STDMETHODIMP Mp4MuxerStreamSink::QueryInterface(REFIID riid, void **ppv)
+{
+	static const QITAB qit[] = {
+		QITABENT(Mp4MuxerStreamSink, IMFStreamSink),
+		QITABENT(Mp4MuxerStreamSink, IMFMediaEventGenerator),
+		QITABENT(Mp4MuxerStreamSink, IMFMediaTypeHandler),
+	{0}
+	};
+	return QISearch(this, qit, riid, ppv);
+}
+
+STDMETHODIMP_(ULONG) Mp4MuxerStreamSink::AddRef()
+{
+	return InterlockedIncrement(&m_nRefCount);
+}
+
+STDMETHODIMP_(ULONG) Mp4MuxerStreamSink::Release()
+{
+	ULONG refCount = InterlockedDecrement(&m_nRefCount);
+	if (refCount == 0) {
+		delete this;
+	}
+	return refCount;
+}
+
+Mp4MuxerSink::Mp4MuxerSink() :
+	m_nRefCount(1),
+	m_ByteStream(nullptr),
+	m_Stream(nullptr),
+	m_CreateSegmentByteStream(nullptr),
+	m_PresentationClock(nullptr),
+	m_StreamSinks{},
+	m_Muxer{},
+	m_TrackIndexes{},
+	m_ReplayBuffer(nullptr),
+	m_ReplayTrackIndexes{},
+	m_AreTracksAdded(false),
+	m_IsShutdown(false)
+{
+	InitializeCriticalSection(&m_Lock);
+}
+
+Mp4MuxerSink::~Mp4MuxerSink()
+{
+	DeleteCriticalSection(&m_Lock);
+}
+
+HRESULT Mp4MuxerSink::CreateInstance(
+	_In_ IMFByteStream *pByteStream,
+	_In_ const MP4_MUXER_OPTIONS &options,
+	_In_opt_ std::function<HRESULT(_In_ UINT32 segmentNumber, _Outptr_ IMFByteStream **ppByteStream)> createSegmentByteStream,
+	_In_ IMFMediaType *pVideoMediaType,
+	_In_opt_ IMFMediaType *pAudioMediaType,
+	_In_ UINT32 audioTrackCount,
+	_In_opt_ std::shared_ptr<ReplayBuffer> pReplayBuffer,
+	_Outptr_ IMFMediaSink **ppSink)
+{
+	*ppSink = nullptr;
+	Mp4MuxerSink *pSink = new Mp4MuxerSink();
+	pSink->m_ReplayBuffer = pReplayBuffer;
+	HRESULT hr = pSink->Initialize(pByteStream, options, createSegmentByteStream, pVideoMediaType, pAudioMediaType, audioTrackCount);
+	if (FAILED(hr)) {
+		pSink->Shutdown();
+		pSink->Release();
+		return hr;
+	}
+	*ppSink = pSink;
+	return S_OK;
+}
+
+HRESULT Mp4MuxerSink::Initialize(_In_ IMFByteStream *pByteStream, _In_ const MP4_MUXER_OPTIONS &options, _In_opt_ std::function<HRESULT(_In_ UINT32 segmentNumber, _Outptr_ IMFByteStream **ppByteStream)> createSegmentByteStream, _In_ IMFMediaType *pVideoMediaType, _In_opt_ IMFMediaType *pAudioMediaType, _In_ UINT32 audioTrackCount)
+{
+	m_ByteStream = pByteStream;
+	RETURN_ON_BAD_HR(MFCreateStreamOnMFByteStream(pByteStream, &m_Stream));
+	MP4_MUXER_OPTIONS muxerOptions = options;
+	m_CreateSegmentByteStream = createSegmentByteStream;
+	if (m_CreateSegmentByteStream) {
+		muxerOptions.OpenSegmentStream = [this](UINT32 segmentNumber, IStream **ppStream) {
+			return OpenSegmentStream(segmentNumber, ppStream);
+		};
+	}
+	RETURN_ON_BAD_HR(m_Muxer.Initialize(m_Stream, muxerOptions));
+	UINT32 streamCount = 1 + (pAudioMediaType ? (std::max)(audioTrackCount, (UINT32)1) : 0);
+	for (DWORD streamId = 0; streamId < streamCount; streamId++) {
+		Mp4MuxerStreamSink *pStreamSink = new Mp4MuxerStreamSink(this, streamId);
+		m_StreamSinks.push_back(pStreamSink);
+		RETURN_ON_BAD_HR(pStreamSink->Initialize(streamId == 0 ? pVideoMediaType : pAudioMediaType));
+	}
+	return S_OK;
+}
+
+HRESULT Mp4MuxerSink::OpenSegmentStream(_In_ UINT32 segmentNumber, _Outptr_ IStream **ppStream)
+{
+	*ppStream = nullptr;
+	CComPtr<IMFByteStream> pByteStream = nullptr;
+	RETURN_ON_BAD_HR(m_CreateSegmentByteStream(segmentNumber, &pByteStream));
+	CComPtr<IStream> pStream = nullptr;
+	RETURN_ON_BAD_HR(MFCreateStreamOnMFByteStream(pByteStream, &pStream));
+	//The segment before is complete, so its file is closed right away, and can be read while the recording goes on.
+	m_Stream.Release();
+	LOG_ON_BAD_HR(m_ByteStream->Close());
+	m_ByteStream = pByteStream;
+	m_Stream = pStream;
+	*ppStream = m_Stream;
+	return S_OK;
+}
+
+HRESULT Mp4MuxerSink::GetTrackConfig(_In_ IMFMediaType *pMediaType, _Out_ MP4_MUXER_TRACK *pTrack)
+{
+	*pTrack = MP4_MUXER_TRACK{};
+	GUID majorType, subtype;
+	RETURN_ON_BAD_HR(pMediaType->GetGUID(MF_MT_MAJOR_TYPE, &majorType));
+	RETURN_ON_BAD_HR(pMediaType->GetGUID(MF_MT_SUBTYPE, &subtype));
+	if (majorType == MFMediaType_Video) {
+		if (subtype == MFVideoFormat_H264) {
+			pTrack->Codec = Mp4Codec::H264;
+		}
+		else if (subtype == MFVideoFormat_HEVC) {
+			pTrack->Codec = Mp4Codec::HEVC;
+		}
+		else {
+			return MF_E_INVALIDMEDIATYPE;
+		}
+		RETURN_ON_BAD_HR(MFGetAttributeSize(pMediaType, MF_MT_FRAME_SIZE, &pTrack->Width, &pTrack->Height));
+		pTrack->Bitrate = MFGetAttributeUINT32(pMediaType, MF_MT_AVG_BITRATE, 0);
+		//Encoders that do not set the sequence header on their output type put the parameter sets in the first keyframe, where the muxer finds them.
+		RETURN_ON_BAD_HR(GetBlob(pMediaType, MF_MT_MPEG_SEQUENCE_HEADER, &pTrack->CodecPrivateData));
+	}
+	else if (majorType == MFMediaType_Audio && subtype == MFAudioFormat_AAC) {
+		pTrack->Codec = Mp4Codec::AAC;
+		RETURN_ON_BAD_HR(pMediaType->GetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, &pTrack->SampleRate));
+		RETURN_ON_BAD_HR(pMediaType->GetUINT32(MF_MT_AUDIO_NUM_CHANNELS, &pTrack->Channels));
+		pTrack->Bitrate = MFGetAttributeUINT32(pMediaType, MF_MT_AUDIO_AVG_BYTES_PER_SECOND, 0) * 8;
+		std::vector<BYTE> userData;
+		RETURN_ON_BAD_HR(GetBlob(pMediaType, MF_MT_USER_DATA, &userData));
+		if (userData.size() > HeAacWaveInfoBytes) {
+			pTrack->CodecPrivateData.assign(userData.begin() + HeAacWaveInfoBytes, userData.end());
+		}
+	}
+	else {
+		return MF_E_INVALIDMEDIATYPE;
+	}
+	return S_OK;
+}
+
+HRESULT Mp4MuxerSink::AddTracks()
+{
+	m_TrackIndexes.resize(m_StreamSinks.size());
+	for (size_t i = 0; i < m_StreamSinks.size(); i++) {
+		CComPtr<IMFMediaType> pMediaType = nullptr;
+		RETURN_ON_BAD_HR(m_StreamSinks[i]->GetCurrentMediaType(&pMediaType));
+		MP4_MUXER_TRACK track;
+		RETURN_ON_BAD_HR(GetTrackConfig(pMediaType, &track));
+		RETURN_ON_BAD_HR(m_Muxer.AddTrack(track, &m_TrackIndexes[i]));
+		if (m_ReplayBuffer) {
+			m_ReplayTrackIndexes.resize(m_StreamSinks.size());
+			HRESULT hr = m_ReplayBuffer->AddTrack(track, &m_ReplayTrackIndexes[i]);
+			if (FAILED(hr)) {
+				LOG_WARN(L"Failed to add a track to the instant replay buffer, the recording goes on without it: hr = 0x%08x", hr);
+				m_ReplayBuffer.reset();
+			}
+		}
+	}
+	m_AreTracksAdded = true;
+	return S_OK;
+}
+
+HRESULT Mp4MuxerSink::WriteSample(_In_ DWORD streamId, _In_ IMFSample *pSample)
+{
+	CComPtr<IMFMediaBuffer> pBuffer = nullptr;
+	RETURN_ON_BAD_HR(pSample->ConvertToContiguousBuffer(&pBuffer));
+	MP4_MUXER_SAMPLE sample{};
+	RETURN_ON_BAD_HR(pSample->GetSampleTime(&sample.StartPos));
+	if (FAILED(pSample->GetSampleDuration(&sample.Duration))) {
+		sample.Duration = 0;
+	}
+	sample.IsKeyFrame = MFGetAttributeUINT32(pSample, MFSampleExtension_CleanPoint, FALSE) != FALSE;
+	//Encoders that reorder frames set the decode time. Without it, the frames are in presentation order.
+	UINT64 decodePos = 0;
+	sample.DecodePos = SUCCEEDED(pSample->GetUINT64(MFSampleExtension_DecodeTimestamp, &decodePos)) ? (INT64)decodePos : sample.StartPos;
+
+	EnterCriticalSection(&m_Lock);
+	HRESULT hr = m_IsShutdown ? MF_E_SHUTDOWN : S_OK;
+	if (SUCCEEDED(hr) && !m_AreTracksAdded) {
+		hr = AddTracks();
+	}
+	if (SUCCEEDED(hr) && streamId >= m_TrackIndexes.size()) {
+		hr = MF_E_INVALIDSTREAMNUMBER;
+	}
+	BYTE *pData = nullptr;
+	DWORD length = 0;
+	if (SUCCEEDED(hr)) {
+		hr = pBuffer->Lock(&pData, nullptr, &length);
+	}
+	if (SUCCEEDED(hr)) {
+		sample.pData = pData;
+		sample.Size = length;
+		hr = m_Muxer.WriteSample(m_TrackIndexes[streamId], sample);
+		if (SUCCEEDED(hr) && m_ReplayBuffer) {
+			HRESULT replayHr = m_ReplayBuffer->WriteSample(m_ReplayTrackIndexes[streamId], sample);
+			if (FAILED(replayHr)) {
+				LOG_WARN(L"Failed to write to the instant replay buffer, the recording goes on without it: hr = 0x%08x", replayHr);
+				m_ReplayBuffer.reset();
+			}
+		}
+		pBuffer->Unlock();
+	}
+	LeaveCriticalSection(&m_Lock);
+	return hr;
+}
+
+STDMETHODIMP Mp4MuxerSink::GetCharacteristics(_Out_ DWORD *pdwCharacteristics)
+{
+	if (m_IsShutdown) {
+		return MF_E_SHUTDOWN;
+	}
+	*pdwCharacteristics = MEDIASINK_FIXED_STREAMS | MEDIASINK_RATELESS;
+	return S_OK;
+}
+
+STDMETHODIMP Mp4MuxerSink::AddStreamSink(_In_ DWORD dwStreamSinkIdentifier, _In_opt_ IMFMediaType *pMediaType, _Outptr_ IMFStreamSink **ppStreamSink)
+{
+	return MF_E_STREAMSINKS_FIXED;
+}
+
+STDMETHODIMP Mp4MuxerSink::RemoveStreamSink(_In_ DWORD dwStreamSinkIdentifier)
+{
+	return MF_E_STREAMSINKS_FIXED;
+}
+
+STDMETHODIMP Mp4MuxerSink::GetStreamSinkCount(_Out_ DWORD *pcStreamSinkCount)
+{
+	EnterCriticalSection(&m_Lock);
+	HRESULT hr = m_IsShutdown ? MF_E_SHUTDOWN : S_OK;
+	if (SUCCEEDED(hr)) {
+		*pcStreamSinkCount = (DWORD)m_StreamSinks.size();
+	}
+	LeaveCriticalSection(&m_Lock);
+	return hr;
+}
+
+STDMETHODIMP Mp4MuxerSink::GetStreamSinkByIndex(_In_ DWORD dwIndex, _Outptr_ IMFStreamSink **ppStreamSink)
+{
+	EnterCriticalSection(&m_Lock);
+	HRESULT hr = m_IsShutdown ? MF_E_SHUTDOWN : S_OK;
+	if (SUCCEEDED(hr) && dwIndex >= m_StreamSinks.size()) {
+		hr = MF_E_INVALIDINDEX;
+	}
+	if (SUCCEEDED(hr)) {
+		*ppStreamSink = m_StreamSinks[dwIndex];
+		(*ppStreamSink)->AddRef();
+	}
+	LeaveCriticalSection(&m_Lock);
+	return hr;
+}
+
+STDMETHODIMP Mp4MuxerSink::GetStreamSinkById(_In_ DWORD dwStreamSinkIdentifier, _Outptr_ IMFStreamSink **ppStreamSink)
+{
+	//The stream ids are the indexes of the streams.
+	HRESULT hr = GetStreamSinkByIndex(dwStreamSinkIdentifier, ppStreamSink);
+	return hr == MF_E_INVALIDINDEX ? MF_E_INVALIDSTREAMNUMBER : hr;
+}
+
+STDMETHODIMP Mp4MuxerSink::SetPresentationClock(_In_opt_ IMFPresentationClock *pPresentationClock)
+{
+	EnterCriticalSection(&m_Lock);
+	HRESULT hr = m_IsShutdown ? MF_E_SHUTDOWN : S_OK;
+	if (SUCCEEDED(hr) && m_PresentationClock) {
+		hr = m_PresentationClock->RemoveClockStateSink(this);
+	}
+	if (SUCCEEDED(hr) && pPresentationClock) {
+		hr = pPresentationClock->AddClockStateSink(this);
+	}
+	if (SUCCEEDED(hr)) {
+		m_PresentationClock = pPresentationClock;
+	}
+	LeaveCriticalSection(&m_Lock);
+	return hr;
+}
+
+STDMETHODIMP Mp4MuxerSink::GetPresentationClock(_Outptr_ IMFPresentationClock **ppPresentationClock)
+{
+	EnterCriticalSection(&m_Lock);
+	HRESULT hr = m_IsShutdown ? MF_E_SHUTDOWN : S_OK;
+	if (SUCCEEDED(hr) && !m_PresentationClock) {
+		hr = MF_E_NO_CLOCK;
+	}
+	if (SUCCEEDED(hr)) {
+		*ppPresentationClock = m_PresentationClock;
+		(*ppPresentationClock)->AddRef();
+	}
+	LeaveCriticalSection(&m_Lock);
+	return hr;
+}
+
+STDMETHODIMP Mp4MuxerSink::Shutdown()
+{
+	EnterCriticalSection(&m_Lock);
+	if (m_IsShutdown) {
+		LeaveCriticalSection(&m_Lock);
+		return MF_E_SHUTDOWN;
+	}
+	m_IsShutdown = true;
+	std::vector<Mp4MuxerStreamSink *> streamSinks;
+	streamSinks.swap(m_StreamSinks);
+	if (m_PresentationClock) {
+		m_PresentationClock->RemoveClockStateSink(this);
+		m_PresentationClock.Release();
+	}
+	m_Stream.Release();
+	m_ByteStream.Release();
+	LeaveCriticalSection(&m_Lock);
+	//The streams are released outside the lock, as they release the sink when they go.
+	for (Mp4MuxerStreamSink *pStreamSink : streamSinks) {
+		pStreamSink->Shutdown();
+		pStreamSink->Release();
+	}
+	return S_OK;
+}
+
+STDMETHODIMP Mp4MuxerSink::BeginFinalize(_In_ IMFAsyncCallback *pCallback, _In_opt_ IUnknown *punkState)
+{
+	EnterCriticalSection(&m_Lock);
+	HRESULT hr = m_IsShutdown ? MF_E_SHUTDOWN : S_OK;
+	if (SUCCEEDED(hr)) {
+		//The muxer writes what is left synchronously, so the finalize is complete by the time the callback is invoked.
+		hr = m_Muxer.Finalize();
+		MP4_MUXER_STATS stats = m_Muxer.GetStats();
+		LOG_INFO(L"Muxed %llu samples in %llu fragments of %llu chunks in %llu segments, with %llu writes of %llu bytes to the output. Dropped %llu samples before the first keyframe. The longest segment switch took %lld us. Committed %llu times, with %llu bytes of journal.",
+			stats.Samples, stats.Fragments, stats.Chunks, stats.Segments, stats.Writer.StreamWrites, stats.Writer.BytesWritten, stats.DroppedSamples, stats.MaxSegmentSwitch100Nanos / 10, stats.Writer.Commits, stats.JournalBytes);
+		if (m_ReplayBuffer) {
+			REPLAY_BUFFER_STATS replayStats = m_ReplayBuffer->GetStats();
+			LOG_INFO(L"The instant replay buffer holds %llu samples of %llu bytes over %lld ms, in %llu bytes of memory. Let go of %llu samples and dropped %llu. Saved %llu times, %llu cut short.",
+				replayStats.Samples, replayStats.Bytes, replayStats.Duration / 10000, replayStats.MemoryBytes, replayStats.EvictedSamples, replayStats.DroppedSamples, replayStats.Saves, replayStats.TruncatedSaves);
+		}
+	}
+	if (SUCCEEDED(hr)) {
+		//Closing the byte stream releases the file, so it can be read as soon as the recording is finalized.
+		m_Stream.Release();
+		hr = m_ByteStream->Close();
+	}
+	LeaveCriticalSection(&m_Lock);
+	if (hr == MF_E_SHUTDOWN) {
+		return hr;
+	}
+	CComPtr<IMFAsyncResult> pResult = nullptr;
+	RETURN_ON_BAD_HR(MFCreateAsyncResult(nullptr, pCallback, punkState, &pResult));
+	RETURN_ON_BAD_HR(pResult->SetStatus(hr));
+	return MFInvokeCallback(pResult);
+}
+
+STDMETHODIMP Mp4MuxerSink::EndFinalize(_In_ IMFAsyncResult *pResult)
+{
+	if (!pResult) {
+		return E_INVALIDARG;
+	}
+	return pResult->GetStatus();
+}
+
+STDMETHODIMP Mp4MuxerSink::OnClockStart(_In_ MFTIME hnsSystemTime, _In_ LONGLONG llClockStartOffset)
+{
+	EnterCriticalSection(&m_Lock);
+	HRESULT hr = m_IsShutdown ? MF_E_SHUTDOWN : S_OK;
+	for (Mp4MuxerStreamSink *pStreamSink : m_StreamSinks) {
+		if (SUCCEEDED(hr)) {
+			hr = pStreamSink->QueueStreamEvent(MEStreamSinkStarted, S_OK, nullptr);
+		}
+		if (SUCCEEDED(hr)) {
+			hr = pStreamSink->QueueStreamEvent(MEStreamSinkRequestSample, S_OK, nullptr);
+		}
+	}
+	LeaveCriticalSection(&m_Lock);
+	return hr;
+}
+
+STDMETHODIMP Mp4MuxerSink::OnClockStop(_In_ MFTIME hnsSystemTime)
+{
+	EnterCriticalSection(&m_Lock);
+	HRESULT hr = m_IsShutdown ? MF_E_SHUTDOWN : S_OK;
+	for (Mp4MuxerStreamSink *pStreamSink : m_StreamSinks) {
+		if (SUCCEEDED(hr)) {
+			hr = pStreamSink->QueueStreamEvent(MEStreamSinkStopped, S_OK, nullptr);
+		}
+	}
+	LeaveCriticalSection(&m_Lock);
+	return hr;
+}
+
+STDMETHODIMP Mp4MuxerSink::OnClockPause(_In_ MFTIME hnsSystemTime)
+{
+	EnterCriticalSection(&m_Lock);
+	HRESULT hr = m_IsShutdown ? MF_E_SHUTDOWN : S_OK;
+	for (Mp4MuxerStreamSink *pStreamSink : m_StreamSinks) {
+		if (SUCCEEDED(hr)) {
+			hr = pStreamSink->QueueStreamEvent(MEStreamSinkPaused, S_OK, nullptr);
+		}
+	}
+	LeaveCriticalSection(&m_Lock);
+	return hr;
+}
+
+STDMETHODIMP Mp4MuxerSink::OnClockRestart(_In_ MFTIME hnsSystemTime)
+{
+	EnterCriticalSection(&m_Lock);
+	HRESULT hr = m_IsShutdown ? MF_E_SHUTDOWN : S_OK;
+	for (Mp4MuxerStreamSink *pStreamSink : m_StreamSinks) {
+		if (SUCCEEDED(hr)) {
+			hr = pStreamSink->QueueStreamEvent(MEStreamSinkStarted, S_OK, nullptr);
+		}
+	}
+	LeaveCriticalSection(&m_Lock);
+	return hr;
+}
+
+STDMETHODIMP Mp4MuxerSink::OnClockSetRate(_In_ MFTIME hnsSystemTime, _In_ float flRate)
+{
+	return S_OK;
+}
+
+STDMETHODIMP Mp4MuxerSink::QueryInterface(REFIID riid, void **ppv)
+{
+	static const QITAB qit[] = {
+		QITABENT(Mp4MuxerSink, IMFFinalizableMediaSink),
+		QITABENT(Mp4MuxerSink, IMFMediaSink),
+		QITABENT(Mp4MuxerSink, IMFClockStateSink),
+	{0}
+	};
+	return QISearch(this, qit, riid, ppv);
+}
+
+STDMETHODIMP_(ULONG) Mp4MuxerSink::AddRef()
+{
+	return InterlockedIncrement(&m_nRefCount);
+}
+
+STDMETHODIMP_(ULONG) Mp4MuxerSink::Release()
+{
+	ULONG refCount = InterlockedDecrement(&m_nRefCount);
+	if (refCount == 0) {
+		delete this;
+	}
+	return refCount;
+}
@@ -0,0 +1,144 @@
+#pragma once
+#include <mfapi.h>
+#include <mfidl.h>
+#include <Shlwapi.h>
+#include <atlbase.h>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "FragmentedMp4Muxer.h"
+#include "ReplayBuffer.h"
+
+class Mp4MuxerSink;
+
+/// <summary>
+/// A stream of Mp4MuxerSink, i.e. a track of the file. Takes the encoded samples the sink writer delivers, and asks for the next one as soon as a sample is muxed.
+/// </summary>
+class Mp4MuxerStreamSink : public IMFStreamSink, public IMFMediaTypeHandler {
+public:
+	Mp4MuxerStreamSink(_In_ Mp4MuxerSink *pSink, _In_ DWORD identifier);
+	virtual ~Mp4MuxerStreamSink();
+	HRESULT Initialize(_In_ IMFMediaType *pMediaType);
+	void Shutdown();
+	HRESULT QueueStreamEvent(_In_ MediaEventType eventType, _In_ HRESULT hrStatus, _In_opt_ const PROPVARIANT *pValue);
+
+	// IMFStreamSink methods
+	STDMETHODIMP GetMediaSink(_Outptr_ IMFMediaSink **ppMediaSink);
+	STDMETHODIMP GetIdentifier(_Out_ DWORD *pdwIdentifier);
+	STDMETHODIMP GetMediaTypeHandler(_Outptr_ IMFMediaTypeHandler **ppHandler);
+	STDMETHODIMP ProcessSample(_In_ IMFSample *pSample);
+	STDMETHODIMP PlaceMarker(_In_ MFSTREAMSINK_MARKER_TYPE eMarkerType, _In_ const PROPVARIANT *pvarMarkerValue, _In_ const PROPVARIANT *pvarContextValue);
+	STDMETHODIMP Flush();
+
+	// IMFMediaEventGenerator methods
+	STDMETHODIMP GetEvent(_In_ DWORD dwFlags, _Outptr_ IMFMediaEvent **ppEvent);
+	STDMETHODIMP BeginGetEvent(_In_ IMFAsyncCallback *pCallback, _In_opt_ IUnknown *punkState);
+	STDMETHODIMP EndGetEvent(_In_ IMFAsyncResult *pResult, _Outptr_ IMFMediaEvent **ppEvent);
+	STDMETHODIMP QueueEvent(_In_ MediaEventType met, _In_ REFGUID guidExtendedType, _In_ HRESULT hrStatus, _In_opt_ const PROPVARIANT *pvValue);
+
+	// IMFMediaTypeHandler methods
+	STDMETHODIMP IsMediaTypeSupported(_In_ IMFMediaType *pMediaType, _Outptr_opt_result_maybenull_ IMFMediaType **ppMediaType);
+	STDMETHODIMP GetMediaTypeCount(_Out_ DWORD *pdwTypeCount);
+	STDMETHODIMP GetMediaTypeByIndex(_In_ DWORD dwIndex, _Outptr_ IMFMediaType **ppType);
+	STDMETHODIMP SetCurrentMediaType(_In_ IMFMediaType *pMediaType);
+	STDMETHODIMP GetCurrentMediaType(_Outptr_ IMFMediaType **ppMediaType);
+	STDMETHODIMP GetMajorType(_Out_ GUID *pguidMajorType);
+
+	// IUnknown methods
+	STDMETHODIMP QueryInterface(REFIID riid, void **ppv);
+	STDMETHODIMP_(ULONG) AddRef();
+	STDMETHODIMP_(ULONG) Release();
+private:
+	volatile long m_nRefCount;
+	//The sink is referenced for the life of the stream. The sink releases its streams on Shutdown, which breaks the reference cycle.
+	//A plain pointer, as the sink has more than one IUnknown base for CComPtr to convert to.
+	Mp4MuxerSink *m_Sink;
+	DWORD m_Identifier;
+	CComPtr<IMFMediaEventQueue> m_EventQueue;
+	CComPtr<IMFMediaType> m_MediaType;
+	bool m_IsShutdown;
+};
+
+/// <summary>
+/// A Media Foundation media sink that writes the encoded video and audio the sink writer delivers with FragmentedMp4Muxer,
+/// instead of the MPEG-4 sinks of Media Foundation. Has a fixed set of streams: the video stream 0, and an audio stream for every audio track after it.
+/// The byte stream is written through the muxer's write buffer, a fragment at a time. With segments, the sink opens the byte stream of each segment
+/// after the first, and closes the one before as soon as it is complete. With a replay buffer, every sample is kept in it as well, for an instant replay.
+/// </summary>
+class Mp4MuxerSink : public IMFFinalizableMediaSink, public IMFClockStateSink {
+public:
+	/// <summary>
+	/// Creates a sink writing to pByteStream, with the encoded media types of the tracks, as for MFCreateFMPEG4MediaSink. pAudioMediaType may be null for a video without audio.
+	/// createSegmentByteStream creates the byte stream of each segment after the first, and is required if the options split the output into segments.
+	/// pReplayBuffer, if set, is given the tracks and samples of the file too. It must be initialized, with no tracks yet.
+	/// </summary>
+	static HRESULT CreateInstance(
+		_In_ IMFByteStream *pByteStream,
+		_In_ const MP4_MUXER_OPTIONS &options,
+		_In_opt_ std::function<HRESULT(_In_ UINT32 segmentNumber, _Outptr_ IMFByteStream **ppByteStream)> createSegmentByteStream,
+		_In_ IMFMediaType *pVideoMediaType,
+		_In_opt_ IMFMediaType *pAudioMediaType,
+		_In_ UINT32 audioTrackCount,
+		_In_opt_ std::shared_ptr<ReplayBuffer> pReplayBuffer,
+		_Outptr_ IMFMediaSink **ppSink);
+	/// <summary>
+	/// Muxes a sample of a stream, and copies it into the replay buffer. The tracks are added to the muxer on the first sample, from the current media types of the streams.
+	/// </summary>
+	HRESULT WriteSample(_In_ DWORD streamId, _In_ IMFSample *pSample);
+
+	// IMFMediaSink methods
+	STDMETHODIMP GetCharacteristics(_Out_ DWORD *pdwCharacteristics);
+	STDMETHODIMP AddStreamSink(_In_ DWORD dwStreamSinkIdentifier, _In_opt_ IMFMediaType *pMediaType, _Outptr_ IMFStreamSink **ppStreamSink);
+	STDMETHODIMP RemoveStreamSink(_In_ DWORD dwStreamSinkIdentifier);
+	STDMETHODIMP GetStreamSinkCount(_Out_ DWORD *pcStreamSinkCount);
+	STDMETHODIMP GetStreamSinkByIndex(_In_ DWORD dwIndex, _Outptr_ IMFStreamSink **ppStreamSink);
+	STDMETHODIMP GetStreamSinkById(_In_ DWORD dwStreamSinkIdentifier, _Outptr_ IMFStreamSink **ppStreamSink);
+	STDMETHODIMP SetPresentationClock(_In_opt_ IMFPresentationClock *pPresentationClock);
+	STDMETHODIMP GetPresentationClock(_Outptr_ IMFPresentationClock **ppPresentationClock);
+	STDMETHODIMP Shutdown();
+
+	// IMFFinalizableMediaSink methods
+	STDMETHODIMP BeginFinalize(_In_ IMFAsyncCallback *pCallback, _In_opt_ IUnknown *punkState);
+	STDMETHODIMP EndFinalize(_In_ IMFAsyncResult *pResult);
+
+	// IMFClockStateSink methods
+	STDMETHODIMP OnClockStart(_In_ MFTIME hnsSystemTime, _In_ LONGLONG llClockStartOffset);
+	STDMETHODIMP OnClockStop(_In_ MFTIME hnsSystemTime);
+	STDMETHODIMP OnClockPause(_In_ MFTIME hnsSystemTime);
+	STDMETHODIMP OnClockRestart(_In_ MFTIME hnsSystemTime);
+	STDMETHODIMP OnClockSetRate(_In_ MFTIME hnsSystemTime, _In_ float flRate);
+
+	// IUnknown methods
+	STDMETHODIMP QueryInterface(REFIID riid, void **ppv);
+	STDMETHODIMP_(ULONG) AddRef();
+	STDMETHODIMP_(ULONG) Release();
+private:
+	Mp4MuxerSink();
+	virtual ~Mp4MuxerSink();
+	HRESULT Initialize(_In_ IMFByteStream *pByteStream, _In_ const MP4_MUXER_OPTIONS &options, _In_opt_ std::function<HRESULT(_In_ UINT32 segmentNumber, _Outptr_ IMFByteStream **ppByteStream)> createSegmentByteStream, _In_ IMFMediaType *pVideoMediaType, _In_opt_ IMFMediaType *pAudioMediaType, _In_ UINT32 audioTrackCount);
+	HRESULT AddTracks();
+	/// <summary>
+	/// Opens the byte stream of the next segment for the muxer, and closes the one of the segment before, which the muxer has flushed. Called by the muxer with the lock held.
+	/// </summary>
+	HRESULT OpenSegmentStream(_In_ UINT32 segmentNumber, _Outptr_ IStream **ppStream);
+	static HRESULT GetTrackConfig(_In_ IMFMediaType *pMediaType, _Out_ MP4_MUXER_TRACK *pTrack);
+
+	volatile long m_nRefCount;
+	//Guards the muxer and the state of the sink. Samples of different streams arrive on different threads.
+	CRITICAL_SECTION m_Lock;
+	//The byte stream of the current segment, and the stream over it the muxer writes to.
+	CComPtr<IMFByteStream> m_ByteStream;
+	CComPtr<IStream> m_Stream;
+	std::function<HRESULT(_In_ UINT32 segmentNumber, _Outptr_ IMFByteStream **ppByteStream)> m_CreateSegmentByteStream;
+	CComPtr<IMFPresentationClock> m_PresentationClock;
+	//The streams, by stream id, referenced until Shutdown.
+	std::vector<Mp4MuxerStreamSink *> m_StreamSinks;
+	FragmentedMp4Muxer m_Muxer;
+	//The muxer track of each stream, by stream id.
+	std::vector<UINT32> m_TrackIndexes;
+	//Keeps the last seconds of the file in memory, if set, with its track of each stream, by stream id. Let go of if it fails, as the file goes on without it.
+	std::shared_ptr<ReplayBuffer> m_ReplayBuffer;
+	std::vector<UINT32> m_ReplayTrackIndexes;
+	bool m_AreTracksAdded;
+	bool m_IsShutdown;
+};
@@ -0,0 +1,776 @@
+#include "Mp4Recovery.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace {
+	const INT64 HundredNanosPerSecond = 10000000;
+	//"SRJ1", the start of every journal record.
+	const UINT32 JournalRecordMagic = 0x314A5253;
+	//The moof of a chunk is a few kilobytes. Anything this large is damage, not a moof.
+	const UINT64 MaxMoofBytes = 16 * 1024 * 1024;
+	const size_t CopyBufferBytes = 1024 * 1024;
+	const UINT32 SampleIsNonSync = 0x00010000;
+
+	const UINT32 TfhdBaseDataOffsetPresent = 0x000001;
+	const UINT32 TfhdSampleDescriptionIndexPresent = 0x000002;
+	const UINT32 TfhdDefaultSampleDurationPresent = 0x000008;
+	const UINT32 TfhdDefaultSampleSizePresent = 0x000010;
+	const UINT32 TfhdDefaultSampleFlagsPresent = 0x000020;
+	const UINT32 TrunDataOffsetPresent = 0x000001;
+	const UINT32 TrunFirstSampleFlagsPresent = 0x000004;
+	const UINT32 TrunSampleDurationPresent = 0x000100;
+	const UINT32 TrunSampleSizePresent = 0x000200;
+	const UINT32 TrunSampleFlagsPresent = 0x000400;
+	const UINT32 TrunSampleCompositionTimeOffsetsPresent = 0x000800;
+
+	/// <summary>
+	/// The tables of CRC-32 by slicing, 8 bytes at a time. Entries[k][b] is the CRC of byte b followed by k zero bytes.
+	/// </summary>
+	struct CRC_TABLE {
+		UINT32 Entries[8][256];
+		CRC_TABLE()
+		{
+			for (UINT32 i = 0; i < 256; i++) {
+				UINT32 crc = i;
+				for (int bit = 0; bit < 8; bit++) {
+					crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+				}
+				Entries[0][i] = crc;
+			}
+			for (UINT32 i = 0; i < 256; i++) {
+				for (int k = 1; k < 8; k++) {
+					Entries[k][i] = (Entries[k - 1][i] >> 8) ^ Entries[0][Entries[k - 1][i] & 0xFF];
+				}
+			}
+		}
+	};
+
+	const CRC_TABLE &GetCrcTable()
+	{
+		static const CRC_TABLE table;
+		return table;
+	}
+
+	UINT32 ReadU32(_In_ const BYTE *p)
+	{
+		return ((UINT32)p[0] << 24) | ((UINT32)p[1] << 16) | ((UINT32)p[2] << 8) | p[3];
+	}
+
+	UINT64 ReadU64(_In_ const BYTE *p)
+	{
+		return ((UINT64)ReadU32(p) << 32) | ReadU32(p + 4);
+	}
+
+	void AppendU32(_Inout_ std::vector<BYTE> &data, _In_ UINT32 value)
+	{
+		BYTE bytes[4] = { (BYTE)(value >> 24), (BYTE)(value >> 16), (BYTE)(value >> 8), (BYTE)value };
+		data.insert(data.end(), bytes, bytes + 4);
+	}
+
+	void AppendU64(_Inout_ std::vector<BYTE> &data, _In_ UINT64 value)
+	{
+		AppendU32(data, (UINT32)(value >> 32));
+		AppendU32(data, (UINT32)value);
+	}
+
+	void PatchU32(_Inout_ std::vector<BYTE> &data, _In_ size_t position, _In_ UINT32 value)
+	{
+		data[position] = (BYTE)(value >> 24);
+		data[position + 1] = (BYTE)(value >> 16);
+		data[position + 2] = (BYTE)(value >> 8);
+		data[position + 3] = (BYTE)value;
+	}
+
+	HRESULT SeekTo(_In_ IStream *pStream, _In_ UINT64 position)
+	{
+		LARGE_INTEGER move;
+		move.QuadPart = (LONGLONG)position;
+		return pStream->Seek(move, STREAM_SEEK_SET, nullptr);
+	}
+
+	/// <summary>
+	/// Reads cb bytes at position. Returns S_FALSE if the stream ends before.
+	/// </summary>
+	HRESULT ReadAt(_In_ IStream *pStream, _In_ UINT64 position, _Out_writes_bytes_(cb) void *pData, _In_ ULONG cb)
+	{
+		HRESULT hr = SeekTo(pStream, position);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		ULONG read = 0;
+		hr = pStream->Read(pData, cb, &read);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		return read == cb ? S_OK : S_FALSE;
+	}
+
+	HRESULT WriteAll(_In_ IStream *pStream, _In_reads_bytes_(cb) const void *pData, _In_ ULONG cb)
+	{
+		ULONG written = 0;
+		HRESULT hr = pStream->Write(pData, cb, &written);
+		if (SUCCEEDED(hr) && written != cb) {
+			hr = STG_E_MEDIUMFULL;
+		}
+		return hr;
+	}
+
+	struct BOX_HEADER {
+		char Type[4];
+		UINT64 Bytes;
+	};
+
+	/// <summary>
+	/// Reads the header of the box at offset. Returns S_FALSE if there is no whole box there, i.e. it is cut off by the end of the input, or its size is damaged.
+	/// </summary>
+	HRESULT ReadBoxHeader(_In_ IStream *pInput, _In_ UINT64 offset, _In_ UINT64 inputBytes, _Out_ BOX_HEADER *pHeader)
+	{
+		*pHeader = BOX_HEADER{};
+		BYTE header[16];
+		if (offset + 8 > inputBytes) {
+			return S_FALSE;
+		}
+		HRESULT hr = ReadAt(pInput, offset, header, 8);
+		if (hr != S_OK) {
+			return hr;
+		}
+		memcpy(pHeader->Type, header + 4, 4);
+		UINT64 bytes = ReadU32(header);
+		UINT64 headerBytes = 8;
+		if (bytes == 1) {
+			if (offset + 16 > inputBytes) {
+				return S_FALSE;
+			}
+			hr = ReadAt(pInput, offset + 8, header + 8, 8);
+			if (hr != S_OK) {
+				return hr;
+			}
+			bytes = ReadU64(header + 8);
+			headerBytes = 16;
+		}
+		//A size of 0, for a box that lasts to the end of the file, is not written by the muxer. It is what a file extended with zeros by a power loss reads as.
+		if (bytes < headerBytes || bytes > inputBytes - offset) {
+			return S_FALSE;
+		}
+		pHeader->Bytes = bytes;
+		return S_OK;
+	}
+
+	bool IsType(_In_ const char *type, _In_z_ const char *expected)
+	{
+		return memcmp(type, expected, 4) == 0;
+	}
+
+	struct MEMORY_BOX {
+		const char *Type;
+		size_t PayloadStart;
+		size_t End;
+	};
+
+	/// <summary>
+	/// Reads the box at position of a buffer, and moves position past it. Returns false at the end, or if the box does not fit.
+	/// </summary>
+	bool NextBox(_In_ const BYTE *pData, _Inout_ size_t *pPosition, _In_ size_t end, _Out_ MEMORY_BOX *pBox)
+	{
+		size_t position = *pPosition;
+		if (end < position + 8) {
+			return false;
+		}
+		UINT64 bytes = ReadU32(pData + position);
+		size_t headerBytes = 8;
+		if (bytes == 1) {
+			if (end < position + 16) {
+				return false;
+			}
+			bytes = ReadU64(pData + position + 8);
+			headerBytes = 16;
+		}
+		if (bytes < headerBytes || bytes > end - position) {
+			return false;
+		}
+		pBox->Type = reinterpret_cast<const char *>(pData + position + 4);
+		pBox->PayloadStart = position + headerBytes;
+		pBox->End = position + (size_t)bytes;
+		*pPosition = pBox->End;
+		return true;
+	}
+
+	struct RANDOM_ACCESS_ENTRY {
+		INT64 Time;
+		UINT64 MoofOffset;
+		BYTE TrafNumber;
+	};
+
+	struct RECOVERY_TRACK {
+		UINT32 TrackId;
+		UINT32 Timescale;
+		UINT32 DefaultDuration;
+		UINT32 DefaultSize;
+		UINT32 DefaultFlags;
+		INT64 EndDecodeTime;
+		std::vector<RANDOM_ACCESS_ENTRY> RandomAccess;
+	};
+
+	/// <summary>
+	/// What a traf of a moof adds to its track, applied once the chunk is recovered.
+	/// </summary>
+	struct TRAF_INFO {
+		size_t TrackIndex;
+		BYTE TrafNumber;
+		bool HasDecodeTime;
+		INT64 DecodeTime;
+		INT64 EndDecodeTime;
+		bool IsFirstSampleSync;
+	};
+
+	/// <summary>
+	/// Finds the tracks of the moov, with their timescales and the defaults of their trex boxes.
+	/// </summary>
+	bool ParseMoov(_In_ const BYTE *pData, _In_ size_t start, _In_ size_t end, _Out_ std::vector<RECOVERY_TRACK> *pTracks)
+	{
+		pTracks->clear();
+		MEMORY_BOX box;
+		std::vector<RECOVERY_TRACK> trexDefaults;
+		for (size_t position = start; NextBox(pData, &position, end, &box);) {
+			if (IsType(box.Type, "trak")) {
+				RECOVERY_TRACK track{};
+				MEMORY_BOX child;
+				for (size_t trakPosition = box.PayloadStart; NextBox(pData, &trakPosition, box.End, &child);) {
+					if (IsType(child.Type, "tkhd") && child.End - child.PayloadStart >= 32) {
+						bool isVersion1 = pData[child.PayloadStart] == 1;
+						track.TrackId = ReadU32(pData + child.PayloadStart + (isVersion1 ? 20 : 12));
+					}
+					else if (IsType(child.Type, "mdia")) {
+						MEMORY_BOX mdhd;
+						for (size_t mdiaPosition = child.PayloadStart; NextBox(pData, &mdiaPosition, child.End, &mdhd);) {
+							if (IsType(mdhd.Type, "mdhd") && mdhd.End - mdhd.PayloadStart >= 24) {
+								bool isVersion1 = pData[mdhd.PayloadStart] == 1;
+								track.Timescale = ReadU32(pData + mdhd.PayloadStart + (isVersion1 ? 20 : 12));
+							}
+						}
+					}
+				}
+				if (track.TrackId == 0 || track.Timescale == 0) {
+					return false;
+				}
+				pTracks->push_back(track);
+			}
+			else if (IsType(box.Type, "mvex")) {
+				MEMORY_BOX trex;
+				for (size_t mvexPosition = box.PayloadStart; NextBox(pData, &mvexPosition, box.End, &trex);) {
+					if (IsType(trex.Type, "trex") && trex.End - trex.PayloadStart >= 24) {
+						RECOVERY_TRACK defaults{};
+						defaults.TrackId = ReadU32(pData + trex.PayloadStart + 4);
+						defaults.DefaultDuration = ReadU32(pData + trex.PayloadStart + 12);
+						defaults.DefaultSize = ReadU32(pData + trex.PayloadStart + 16);
+						defaults.DefaultFlags = ReadU32(pData + trex.PayloadStart + 20);
+						trexDefaults.push_back(defaults);
+					}
+				}
+			}
+		}
+		for (RECOVERY_TRACK &track : *pTracks) {
+			for (const RECOVERY_TRACK &defaults : trexDefaults) {
+				if (defaults.TrackId == track.TrackId) {
+					track.DefaultDuration = defaults.DefaultDuration;
+					track.DefaultSize = defaults.DefaultSize;
+					track.DefaultFlags = defaults.DefaultFlags;
+				}
+			}
+		}
+		return !pTracks->empty();
+	}
+
+	/// <summary>
+	/// Checks that a moof is whole and consistent with its mdat: it has an mfhd, every traf is of a track of the moov, and the track runs add up to the mdat.
+	/// </summary>
+	bool ParseMoof(_In_ const BYTE *pData, _In_ size_t size, _In_ UINT64 mdatPayloadBytes, _In_ const std::vector<RECOVERY_TRACK> &tracks, _Out_ std::vector<TRAF_INFO> *pTrafs)
+	{
+		pTrafs->clear();
+		MEMORY_BOX moof;
+		size_t position = 0;
+		if (!NextBox(pData, &position, size, &moof) || !IsType(moof.Type, "moof")) {
+			return false;
+		}
+		bool hasMfhd = false;
+		UINT64 sampleBytes = 0;
+		BYTE trafNumber = 0;
+		MEMORY_BOX box;
+		for (size_t moofPosition = moof.PayloadStart; NextBox(pData, &moofPosition, moof.End, &box);) {
+			if (IsType(box.Type, "mfhd")) {
+				hasMfhd = true;
+				continue;
+			}
+			if (!IsType(box.Type, "traf")) {
+				continue;
+			}
+			TRAF_INFO traf{};
+			traf.TrafNumber = ++trafNumber;
+			const RECOVERY_TRACK *pTrack = nullptr;
+			UINT32 defaultDuration = 0, defaultSize = 0, defaultFlags = 0;
+			INT64 duration = 0;
+			bool isFirstRun = true;
+			MEMORY_BOX child;
+			for (size_t trafPosition = box.PayloadStart; NextBox(pData, &trafPosition, box.End, &child);) {
+				const BYTE *p = pData + child.PayloadStart;
+				const BYTE *pEnd = pData + child.End;
+				if (pEnd - p < 4) {
+					return false;
+				}
+				UINT32 flags = ReadU32(p) & 0xFFFFFF;
+				bool isVersion1 = p[0] == 1;
+				p += 4;
+				if (IsType(child.Type, "tfhd")) {
+					if (pEnd - p < 4) {
+						return false;
+					}
+					UINT32 trackId = ReadU32(p);
+					p += 4;
+					for (size_t i = 0; i < tracks.size(); i++) {
+						if (tracks[i].TrackId == trackId) {
+							pTrack = &tracks[i];
+							traf.TrackIndex = i;
+						}
+					}
+					if (!pTrack) {
+						return false;
+					}
+					defaultDuration = pTrack->DefaultDuration;
+					defaultSize = pTrack->DefaultSize;
+					defaultFlags = pTrack->DefaultFlags;
+					size_t fieldsBytes = ((flags & TfhdBaseDataOffsetPresent) ? 8 : 0) + ((flags & TfhdSampleDescriptionIndexPresent) ? 4 : 0)
+						+ ((flags & TfhdDefaultSampleDurationPresent) ? 4 : 0) + ((flags & TfhdDefaultSampleSizePresent) ? 4 : 0) + ((flags & TfhdDefaultSampleFlagsPresent) ? 4 : 0);
+					if ((size_t)(pEnd - p) < fieldsBytes) {
+						return false;
+					}
+					p += ((flags & TfhdBaseDataOffsetPresent) ? 8 : 0) + ((flags & TfhdSampleDescriptionIndexPresent) ? 4 : 0);
+					if (flags & TfhdDefaultSampleDurationPresent) {
+						defaultDuration = ReadU32(p);
+						p += 4;
+					}
+					if (flags & TfhdDefaultSampleSizePresent) {
+						defaultSize = ReadU32(p);
+						p += 4;
+					}
+					if (flags & TfhdDefaultSampleFlagsPresent) {
+						defaultFlags = ReadU32(p);
+					}
+				}
+				else if (IsType(child.Type, "tfdt")) {
+					if (pEnd - p < (isVersion1 ? 8 : 4)) {
+						return false;
+					}
+					traf.HasDecodeTime = true;
+					traf.DecodeTime = isVersion1 ? (INT64)ReadU64(p) : ReadU32(p);
+				}
+				else if (IsType(child.Type, "trun")) {
+					if (!pTrack || pEnd - p < 4) {
+						return false;
+					}
+					UINT32 sampleCount = ReadU32(p);
+					p += 4;
+					UINT32 firstSampleFlags = defaultFlags;
+					bool hasFirstSampleFlags = false;
+					if (flags & TrunDataOffsetPresent) {
+						p += 4;
+					}
+					if (flags & TrunFirstSampleFlagsPresent) {
+						if (pEnd - p < 4) {
+							return false;
+						}
+						firstSampleFlags = ReadU32(p);
+						hasFirstSampleFlags = true;
+						p += 4;
+					}
+					size_t sampleFieldBytes = ((flags & TrunSampleDurationPresent) ? 4 : 0) + ((flags & TrunSampleSizePresent) ? 4 : 0)
+						+ ((flags & TrunSampleFlagsPresent) ? 4 : 0) + ((flags & TrunSampleCompositionTimeOffsetsPresent) ? 4 : 0);
+					if (p > pEnd || (UINT64)(pEnd - p) < (UINT64)sampleFieldBytes * sampleCount) {
+						return false;
+					}
+					for (UINT32 i = 0; i < sampleCount; i++) {
+						UINT32 sampleDuration = defaultDuration;
+						UINT32 sampleSize = defaultSize;
+						UINT32 sampleFlags = i == 0 && hasFirstSampleFlags ? firstSampleFlags : defaultFlags;
+						if (flags & TrunSampleDurationPresent) {
+							sampleDuration = ReadU32(p);
+							p += 4;
+						}
+						if (flags & TrunSampleSizePresent) {
+							sampleSize = ReadU32(p);
+							p += 4;
+						}
+						if (flags & TrunSampleFlagsPresent) {
+							if (!(i == 0 && hasFirstSampleFlags)) {
+								sampleFlags = ReadU32(p);
+							}
+							p += 4;
+						}
+						if (flags & TrunSampleCompositionTimeOffsetsPresent) {
+							p += 4;
+						}
+						if (i == 0 && isFirstRun) {
+							traf.IsFirstSampleSync = (sampleFlags & SampleIsNonSync) == 0;
+						}
+						duration += sampleDuration;
+						sampleBytes += sampleSize;
+					}
+					isFirstRun = false;
+				}
+			}
+			if (!pTrack) {
+				return false;
+			}
+			traf.EndDecodeTime = traf.DecodeTime + duration;
+			pTrafs->push_back(traf);
+		}
+		//The muxer puts the samples of every track run into the mdat behind the moof, one after the other, and nothing else.
+		return hasMfhd && !pTrafs->empty() && sampleBytes == mdatPayloadBytes;
+	}
+
+	HRESULT WriteRandomAccessIndex(_In_ IStream *pOutput, _In_ const std::vector<RECOVERY_TRACK> &tracks, _Out_ UINT64 *pBytes)
+	{
+		std::vector<BYTE> mfra;
+		AppendU32(mfra, 0);
+		mfra.insert(mfra.end(), { 'm', 'f', 'r', 'a' });
+		for (const RECOVERY_TRACK &track : tracks) {
+			size_t tfra = mfra.size();
+			AppendU32(mfra, 0);
+			mfra.insert(mfra.end(), { 't', 'f', 'r', 'a', 1, 0, 0, 0 });
+			AppendU32(mfra, track.TrackId);
+			//The traf, trun and sample numbers take a byte each.
+			AppendU32(mfra, 0);
+			AppendU32(mfra, (UINT32)track.RandomAccess.size());
+			for (const RANDOM_ACCESS_ENTRY &entry : track.RandomAccess) {
+				AppendU64(mfra, (UINT64)entry.Time);
+				AppendU64(mfra, entry.MoofOffset);
+				mfra.insert(mfra.end(), { entry.TrafNumber, 1, 1 });
+			}
+			PatchU32(mfra, tfra, (UINT32)(mfra.size() - tfra));
+		}
+		AppendU32(mfra, 16);
+		mfra.insert(mfra.end(), { 'm', 'f', 'r', 'o', 0, 0, 0, 0 });
+		AppendU32(mfra, (UINT32)mfra.size() + 4);
+		PatchU32(mfra, 0, (UINT32)mfra.size());
+		*pBytes = mfra.size();
+		return WriteAll(pOutput, mfra.data(), (ULONG)mfra.size());
+	}
+
+	/// <summary>
+	/// Reads the records of a journal up to the first one that is cut off or damaged.
+	/// </summary>
+	HRESULT ReadJournal(_In_ IStream *pJournal, _Out_ std::vector<MP4_JOURNAL_RECORD> *pRecords)
+	{
+		pRecords->clear();
+		HRESULT hr = SeekTo(pJournal, 0);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		BYTE record[Mp4JournalRecordBytes];
+		while (true) {
+			ULONG read = 0;
+			hr = pJournal->Read(record, (ULONG)Mp4JournalRecordBytes, &read);
+			if (FAILED(hr)) {
+				return hr;
+			}
+			if (read != Mp4JournalRecordBytes) {
+				return S_OK;
+			}
+			UINT32 magic, recordChecksum;
+			memcpy(&magic, record, 4);
+			memcpy(&recordChecksum, record + 32, 4);
+			if (magic != JournalRecordMagic || recordChecksum != Crc32(0, record, 32)) {
+				return S_OK;
+			}
+			MP4_JOURNAL_RECORD journalRecord;
+			memcpy(&journalRecord.Type, record + 4, 4);
+			memcpy(&journalRecord.SequenceNumber, record + 8, 4);
+			memcpy(&journalRecord.Checksum, record + 12, 4);
+			memcpy(&journalRecord.Offset, record + 16, 8);
+			memcpy(&journalRecord.Bytes, record + 24, 8);
+			pRecords->push_back(journalRecord);
+		}
+	}
+
+	/// <summary>
+	/// Copies bytes of the input to the end of the output through buffer, and continues the checksum of what was copied.
+	/// </summary>
+	HRESULT CopyBytes(_In_ IStream *pInput, _In_ UINT64 offset, _In_ UINT64 bytes, _In_ IStream *pOutput, _Inout_ std::vector<BYTE> &buffer, _Inout_ UINT32 *pChecksum)
+	{
+		HRESULT hr = SeekTo(pInput, offset);
+		while (SUCCEEDED(hr) && bytes > 0) {
+			ULONG cb = (ULONG)(std::min)(bytes, (UINT64)buffer.size());
+			ULONG read = 0;
+			hr = pInput->Read(buffer.data(), cb, &read);
+			if (SUCCEEDED(hr) && read != cb) {
+				hr = HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+			}
+			if (SUCCEEDED(hr)) {
+				*pChecksum = Crc32(*pChecksum, buffer.data(), cb);
+				hr = WriteAll(pOutput, buffer.data(), cb);
+			}
+			bytes -= cb;
+		}
+		return hr;
+	}
+
+	/// <summary>
+	/// Drops what was copied to the output past size, e.g. a chunk that does not match its checksum.
+	/// </summary>
+	HRESULT TruncateOutput(_In_ IStream *pOutput, _In_ UINT64 size)
+	{
+		ULARGE_INTEGER newSize;
+		newSize.QuadPart = size;
+		HRESULT hr = pOutput->SetSize(newSize);
+		if (SUCCEEDED(hr)) {
+			hr = SeekTo(pOutput, size);
+		}
+		return hr;
+	}
+}
+
+UINT32 Crc32(_In_ UINT32 crc, _In_reads_bytes_(size) const void *pData, _In_ size_t size)
+{
+	const CRC_TABLE &table = GetCrcTable();
+	const BYTE *p = static_cast<const BYTE *>(pData);
+	crc = ~crc;
+	//The output is checksummed as it is written, so this runs over every byte of a recording.
+	for (; size >= 8; size -= 8, p += 8) {
+		UINT32 low = crc ^ ((UINT32)p[0] | (UINT32)p[1] << 8 | (UINT32)p[2] << 16 | (UINT32)p[3] << 24);
+		crc = table.Entries[7][low & 0xFF] ^ table.Entries[6][(low >> 8) & 0xFF] ^ table.Entries[5][(low >> 16) & 0xFF] ^ table.Entries[4][low >> 24]
+			^ table.Entries[3][p[4]] ^ table.Entries[2][p[5]] ^ table.Entries[1][p[6]] ^ table.Entries[0][p[7]];
+	}
+	for (; size > 0; size--, p++) {
+		crc = table.Entries[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+Mp4RecoveryJournal::Mp4RecoveryJournal() :
+	m_Stream(nullptr),
+	m_BytesWritten(0)
+{
+}
+
+HRESULT Mp4RecoveryJournal::Initialize(_In_ IStream *pStream)
+{
+	if (!pStream) {
+		return E_INVALIDARG;
+	}
+	m_Stream = pStream;
+	m_BytesWritten = 0;
+	return S_OK;
+}
+
+HRESULT Mp4RecoveryJournal::Append(_In_ const MP4_JOURNAL_RECORD &record)
+{
+	if (!m_Stream) {
+		return E_UNEXPECTED;
+	}
+	//Little endian, as the journal is only read back on the machine that wrote it.
+	BYTE data[Mp4JournalRecordBytes] = {};
+	memcpy(data, &JournalRecordMagic, 4);
+	memcpy(data + 4, &record.Type, 4);
+	memcpy(data + 8, &record.SequenceNumber, 4);
+	memcpy(data + 12, &record.Checksum, 4);
+	memcpy(data + 16, &record.Offset, 8);
+	memcpy(data + 24, &record.Bytes, 8);
+	UINT32 recordChecksum = Crc32(0, data, 32);
+	memcpy(data + 32, &recordChecksum, 4);
+	HRESULT hr = WriteAll(m_Stream, data, (ULONG)sizeof(data));
+	if (SUCCEEDED(hr)) {
+		m_BytesWritten += sizeof(data);
+	}
+	return hr;
+}
+
+HRESULT Mp4RecoveryJournal::Commit()
+{
+	if (!m_Stream) {
+		return E_UNEXPECTED;
+	}
+	return m_Stream->Commit(STGC_DEFAULT);
+}
+
+HRESULT RecoverFragmentedMp4(_In_ IStream *pInput, _In_opt_ IStream *pJournal, _In_ IStream *pOutput, _Out_ MP4_RECOVERY_RESULT *pResult)
+{
+	*pResult = MP4_RECOVERY_RESULT{};
+	if (!pInput || !pOutput) {
+		return E_INVALIDARG;
+	}
+	LARGE_INTEGER zero{};
+	ULARGE_INTEGER end{};
+	HRESULT hr = pInput->Seek(zero, STREAM_SEEK_END, &end);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	UINT64 inputBytes = end.QuadPart;
+	pResult->InputBytes = inputBytes;
+	std::vector<MP4_JOURNAL_RECORD> records;
+	if (pJournal) {
+		hr = ReadJournal(pJournal, &records);
+		if (FAILED(hr)) {
+			return hr;
+		}
+	}
+
+	//The init segment is the ftyp and the moov, without which nothing else can be played.
+	BOX_HEADER ftyp, moov;
+	hr = ReadBoxHeader(pInput, 0, inputBytes, &ftyp);
+	if (hr == S_OK && IsType(ftyp.Type, "ftyp")) {
+		hr = ReadBoxHeader(pInput, ftyp.Bytes, inputBytes, &moov);
+	}
+	if (FAILED(hr)) {
+		return hr;
+	}
+	if (hr != S_OK || !IsType(ftyp.Type, "ftyp") || !IsType(moov.Type, "moov") || ftyp.Bytes + moov.Bytes > MaxMoofBytes) {
+		return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+	}
+	UINT64 initBytes = ftyp.Bytes + moov.Bytes;
+	std::vector<BYTE> init((size_t)initBytes);
+	hr = ReadAt(pInput, 0, init.data(), (ULONG)init.size());
+	if (FAILED(hr)) {
+		return hr;
+	}
+	std::vector<RECOVERY_TRACK> tracks;
+	if (hr != S_OK || !ParseMoov(init.data(), (size_t)ftyp.Bytes + 8, init.size(), &tracks)) {
+		return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+	}
+	//A journal is of this output if it starts with the init segment as it is in the output. One of the same size that differs
+	//is taken as a damaged init segment, e.g. one that is zero filled after a power loss, as the boxes alone can not tell.
+	bool isInitJournaled = !records.empty() && records[0].Type == Mp4JournalRecordType::InitSegment && records[0].Offset == 0 && records[0].Bytes == initBytes;
+	if (isInitJournaled && records[0].Checksum != Crc32(0, init.data(), init.size())) {
+		return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+	}
+	pResult->IsJournalUsed = isInitJournaled;
+
+	hr = SeekTo(pOutput, 0);
+	if (SUCCEEDED(hr)) {
+		hr = TruncateOutput(pOutput, 0);
+	}
+	if (SUCCEEDED(hr)) {
+		hr = WriteAll(pOutput, init.data(), (ULONG)init.size());
+	}
+	if (FAILED(hr)) {
+		return hr;
+	}
+	std::vector<BYTE> buffer(CopyBufferBytes);
+	std::vector<BYTE> moofData;
+	std::vector<TRAF_INFO> trafs;
+	UINT64 position = initBytes;
+	for (size_t recordIndex = 1;; recordIndex++) {
+		const MP4_JOURNAL_RECORD *pRecord = nullptr;
+		if (pResult->IsJournalUsed) {
+			if (recordIndex >= records.size() || records[recordIndex].Offset != position) {
+				break;
+			}
+			pRecord = &records[recordIndex];
+		}
+		BOX_HEADER box;
+		hr = ReadBoxHeader(pInput, position, inputBytes, &box);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		if (hr != S_OK) {
+			break;
+		}
+		//The index of a complete output is copied as it is, as it is right for the chunks before it.
+		if (IsType(box.Type, "mfra")) {
+			if (pRecord && (pRecord->Type != Mp4JournalRecordType::Index || pRecord->Bytes != box.Bytes)) {
+				break;
+			}
+			UINT32 checksum = 0;
+			hr = CopyBytes(pInput, position, box.Bytes, pOutput, buffer, &checksum);
+			if (FAILED(hr)) {
+				return hr;
+			}
+			if (pRecord ? checksum != pRecord->Checksum : position + box.Bytes != inputBytes) {
+				hr = TruncateOutput(pOutput, position);
+				if (FAILED(hr)) {
+					return hr;
+				}
+				break;
+			}
+			position += box.Bytes;
+			pResult->IsComplete = true;
+			break;
+		}
+		BOX_HEADER mdat;
+		if (!IsType(box.Type, "moof") || box.Bytes > MaxMoofBytes) {
+			break;
+		}
+		hr = ReadBoxHeader(pInput, position + box.Bytes, inputBytes, &mdat);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		if (hr != S_OK || !IsType(mdat.Type, "mdat")) {
+			break;
+		}
+		UINT64 chunkBytes = box.Bytes + mdat.Bytes;
+		if (pRecord && (pRecord->Type != Mp4JournalRecordType::Chunk || pRecord->Bytes != chunkBytes)) {
+			break;
+		}
+		moofData.resize((size_t)box.Bytes);
+		hr = ReadAt(pInput, position, moofData.data(), (ULONG)moofData.size());
+		if (FAILED(hr)) {
+			return hr;
+		}
+		UINT64 mdatHeaderBytes = 8;
+		if (moofData.size() + 8 <= (size_t)chunkBytes) {
+			BYTE mdatHeader[4];
+			hr = ReadAt(pInput, position + box.Bytes, mdatHeader, 4);
+			if (FAILED(hr)) {
+				return hr;
+			}
+			mdatHeaderBytes = ReadU32(mdatHeader) == 1 ? 16 : 8;
+		}
+		if (!ParseMoof(moofData.data(), moofData.size(), mdat.Bytes - mdatHeaderBytes, tracks, &trafs)) {
+			break;
+		}
+		UINT32 checksum = 0;
+		hr = CopyBytes(pInput, position, chunkBytes, pOutput, buffer, &checksum);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		//Bytes that never reached the disk read as zeros, or as whatever was there before, which only the checksum tells apart.
+		if (pRecord && checksum != pRecord->Checksum) {
+			hr = TruncateOutput(pOutput, position);
+			if (FAILED(hr)) {
+				return hr;
+			}
+			break;
+		}
+		//Players join at moof boxes where every track starts on a sync sample, i.e. at fragments, as the muxer indexes them.
+		bool isRandomAccessPoint = true;
+		for (const TRAF_INFO &traf : trafs) {
+			isRandomAccessPoint = isRandomAccessPoint && traf.IsFirstSampleSync && traf.HasDecodeTime;
+		}
+		for (const TRAF_INFO &traf : trafs) {
+			RECOVERY_TRACK &track = tracks[traf.TrackIndex];
+			track.EndDecodeTime = (std::max)(track.EndDecodeTime, traf.EndDecodeTime);
+			if (isRandomAccessPoint) {
+				track.RandomAccess.push_back(RANDOM_ACCESS_ENTRY{ traf.DecodeTime, position, traf.TrafNumber });
+			}
+		}
+		position += chunkBytes;
+		pResult->Chunks++;
+	}
+	UINT64 outputBytes = position;
+	if (!pResult->IsComplete) {
+		UINT64 indexBytes = 0;
+		hr = WriteRandomAccessIndex(pOutput, tracks, &indexBytes);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		outputBytes += indexBytes;
+	}
+	hr = pOutput->Commit(STGC_DEFAULT);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	pResult->RecoveredBytes = outputBytes;
+	for (const RECOVERY_TRACK &track : tracks) {
+		pResult->Duration = (std::max)(pResult->Duration, track.EndDecodeTime * HundredNanosPerSecond / track.Timescale);
+	}
+	return S_OK;
+}
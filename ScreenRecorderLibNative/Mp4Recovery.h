@@ -0,0 +1,74 @@
+#pragma once
+#include <windows.h>
+#include <objidl.h>
+#include <sal.h>
+
+enum class Mp4JournalRecordType : UINT32 {
+	//The ftyp and moov at the start of the output.
+	InitSegment = 1,
+	//A moof and mdat pair, a fragment or a chunk of one.
+	Chunk = 2,
+	//The mfra at the end, written by Finalize. The output is complete once it is durable.
+	Index = 3
+};
+
+//The size of a record in the journal.
+const UINT32 Mp4JournalRecordBytes = 40;
+
+struct MP4_JOURNAL_RECORD {
+	Mp4JournalRecordType Type;
+	//The sequence number of the moof of a chunk, 0 for the other records.
+	UINT32 SequenceNumber;
+	//Where the boxes are in the output, and a CRC-32 of their bytes.
+	UINT64 Offset;
+	UINT64 Bytes;
+	UINT32 Checksum;
+};
+
+struct MP4_RECOVERY_RESULT {
+	//Whether the journal was read, and belongs to the output. Without it, the output is recovered from its boxes alone, which can not tell data that never reached the disk from data that did.
+	bool IsJournalUsed;
+	//Whether the output was complete, with the index Finalize writes, so nothing was lost.
+	bool IsComplete;
+	UINT64 InputBytes;
+	UINT64 RecoveredBytes;
+	//The moof and mdat pairs recovered.
+	UINT64 Chunks;
+	//How long the longest track of the recovered file lasts, in 100 nanosecond units.
+	INT64 Duration;
+};
+
+/// <summary>
+/// CRC-32, as in zlib, continued from crc. Start with 0.
+/// </summary>
+UINT32 Crc32(_In_ UINT32 crc, _In_reads_bytes_(size) const void *pData, _In_ size_t size);
+
+/// <summary>
+/// Writes the recovery journal of a fragmented MP4 output: a fixed size record, with a checksum of its own, for every part of the output once it is flushed.
+/// A record only says what was written. It is recovered if the output holds the bytes it describes, so records may reach the disk before or after the output.
+/// The stream is not referenced, and must stay valid until the last Commit has returned. Not thread safe.
+/// </summary>
+class Mp4RecoveryJournal
+{
+public:
+	Mp4RecoveryJournal();
+	HRESULT Initialize(_In_ IStream *pStream);
+	HRESULT Append(_In_ const MP4_JOURNAL_RECORD &record);
+	/// <summary>
+	/// Commits the stream, which flushes a file to disk.
+	/// </summary>
+	HRESULT Commit();
+	inline bool IsInitialized() const { return m_Stream != nullptr; }
+	inline UINT64 GetBytesWritten() const { return m_BytesWritten; }
+private:
+	IStream *m_Stream;
+	UINT64 m_BytesWritten;
+};
+
+/// <summary>
+/// Rebuilds a playable fragmented MP4 file from an output of FragmentedMp4Muxer that was not finalized, e.g. after a crash or a power loss, into pOutput.
+/// Keeps the init segment and every whole moof and mdat pair up to the first that is missing or damaged, and writes an mfra index for them.
+/// With the journal, every part is checked against the checksum it was written with. Without it, or if the journal is of another file, the boxes are checked
+/// for consistency only. A complete output is copied as it is. Fails with ERROR_INVALID_DATA if not even the init segment is there.
+/// </summary>
+HRESULT RecoverFragmentedMp4(_In_ IStream *pInput, _In_opt_ IStream *pJournal, _In_ IStream *pOutput, _Out_ MP4_RECOVERY_RESULT *pResult);
@@ -1,8 +1,11 @@
 #include "OutputManager.h"
 #include "screengrab.h"
+#include "Mp4MuxerSink.h"
 #include <ppltasks.h> 
 #include <concrt.h>
 #include <filesystem>
+#include <Shlwapi.h>
+#pragma comment(lib, "Shlwapi.lib")
 using namespace std;
 using namespace concurrency;
 using namespace DirectX;
@@ -24,10 +27,8 @@ OutputManager::OutputManager() :
 	m_SnapshotOptions(nullptr),
 	m_OutputOptions(nullptr),
 	m_VideoStreamIndex(0),
-	m_AudioStreamIndex(0),
 	m_OutputFolder(L""),
 	m_OutputFullPath(L""),
-	m_LastFrameHadAudio(false),
 	m_RenderedFrameCount(0),
 	m_MediaTransform(nullptr),
 	m_RTV(nullptr),
@@ -42,7 +43,6 @@ OutputManager::OutputManager() :
 	m_NeedsResize(false),
 	m_InputLayout(nullptr),
 	m_BlendState(nullptr),
-	m_PtrInfo(nullptr),
 	m_DeviceManager(nullptr),
 	m_ResetToken(0)
 {
@@ -83,7 +83,8 @@ HRESULT OutputManager::Initialize(
 	m_AudioOptions = pAudioOptions;
 	m_SnapshotOptions = pSnapshotOptions;
 	m_OutputOptions = pOutputOptions;
-	if (!m_DeviceManager) {
+	//Audio only recordings have no D3D device, and only need the media clock.
+	if (pDevice && !m_DeviceManager) {
 		RETURN_ON_BAD_HR(MFCreateDXGIDeviceManager(&m_ResetToken, &m_DeviceManager));
 	}
 	
@@ -94,7 +95,9 @@ HRESULT OutputManager::Initialize(
 		RETURN_ON_BAD_HR(MFCreatePresentationClock(&m_PresentationClock));
 		RETURN_ON_BAD_HR(m_PresentationClock->SetTimeSource(m_TimeSrc));
 	}
-	RETURN_ON_BAD_HR(m_DeviceManager->ResetDevice(pDevice, m_ResetToken));
+	if (pDevice) {
+		RETURN_ON_BAD_HR(m_DeviceManager->ResetDevice(pDevice, m_ResetToken));
+	}
 	return S_OK;
 }
 
@@ -125,7 +128,11 @@ HRESULT OutputManager::BeginRecording(_In_ std::wstring outputPath, _In_ SIZE vi
 			RETURN_ON_BAD_HR(MFCreateFile(MF_ACCESSMODE_READWRITE, MF_OPENMODE_FAIL_IF_EXIST, MF_FILEFLAGS_NONE, outputPath.c_str(), &mfByteStream));
 		}
 		
-		RETURN_ON_BAD_HR(hr = InitializeVideoSinkWriter(mfByteStream, inputMediaFrameRect, videoOutputFrameSize, DXGI_MODE_ROTATION_UNSPECIFIED, m_CallBack, &m_SinkWriter, &m_VideoStreamIndex, &m_AudioStreamIndex));
+		RETURN_ON_BAD_HR(hr = InitializeVideoSinkWriter(mfByteStream, inputMediaFrameRect, videoOutputFrameSize, DXGI_MODE_ROTATION_UNSPECIFIED, m_CallBack, &m_SinkWriter, &m_VideoStreamIndex, &m_AudioStreamIndexes));
+	}
+	else if (GetOutputOptions()->GetRecorderMode() == RecorderModeInternal::Audio) {
+		RETURN_ON_BAD_HR(hr = SHCreateStreamOnFileEx(outputPath.c_str(), STGM_WRITE | STGM_SHARE_DENY_WRITE | STGM_FAILIFTHERE, FILE_ATTRIBUTE_NORMAL, TRUE, nullptr, &m_WavFileStream));
+		RETURN_ON_BAD_HR(hr = InitializeWavWriter(m_WavFileStream));
 	}
 	StartMediaClock();
 	LOG_DEBUG("Sink Writer initialized");
@@ -149,13 +156,64 @@ HRESULT OutputManager::BeginRecording(_In_ IStream *pStream, _In_ SIZE videoOutp
 			m_CallBack = new (std::nothrow)CMFSinkWriterCallback(m_FinalizeEvent, nullptr);
 		}
 		RECT inputMediaFrameRect = RECT{ 0,0,videoOutputFrameSize.cx,videoOutputFrameSize.cy };
-		RETURN_ON_BAD_HR(hr = InitializeVideoSinkWriter(mfByteStream, inputMediaFrameRect, videoOutputFrameSize, DXGI_MODE_ROTATION_UNSPECIFIED, m_CallBack, &m_SinkWriter, &m_VideoStreamIndex, &m_AudioStreamIndex));
+		RETURN_ON_BAD_HR(hr = InitializeVideoSinkWriter(mfByteStream, inputMediaFrameRect, videoOutputFrameSize, DXGI_MODE_ROTATION_UNSPECIFIED, m_CallBack, &m_SinkWriter, &m_VideoStreamIndex, &m_AudioStreamIndexes));
+	}
+	else if (GetOutputOptions()->GetRecorderMode() == RecorderModeInternal::Audio) {
+		RETURN_ON_BAD_HR(hr = InitializeWavWriter(pStream));
 	}
 	StartMediaClock();
 	LOG_DEBUG("Sink Writer initialized");
 	return hr;
 }
 
+std::wstring OutputManager::GetSegmentFilePath(_In_ UINT32 segmentNumber)
+{
+	if (segmentNumber <= 1) {
+		return m_OutputFullPath;
+	}
+	std::filesystem::path filePath = m_OutputFullPath;
+	wchar_t suffix[16];
+	swprintf_s(suffix, L"-%03u", segmentNumber);
+	filePath.replace_filename(filePath.stem().wstring() + suffix + filePath.extension().wstring());
+	return filePath.wstring();
+}
+
+HRESULT OutputManager::OpenJournalStream(_In_ UINT32 segmentNumber, _Outptr_ IStream **ppStream)
+{
+	*ppStream = nullptr;
+	DeleteJournal();
+	std::wstring journalFilePath = GetSegmentFilePath(segmentNumber) + L".journal";
+	RETURN_ON_BAD_HR(SHCreateStreamOnFileEx(journalFilePath.c_str(), STGM_WRITE | STGM_SHARE_DENY_WRITE | STGM_CREATE, FILE_ATTRIBUTE_NORMAL, TRUE, nullptr, &m_JournalStream));
+	m_JournalFilePath = journalFilePath;
+	*ppStream = m_JournalStream;
+	return S_OK;
+}
+
+void OutputManager::DeleteJournal()
+{
+	if (!m_JournalStream) {
+		return;
+	}
+	m_JournalStream.Release();
+	if (!DeleteFileW(m_JournalFilePath.c_str())) {
+		LOG_WARN(L"Failed to delete recovery journal %ls", m_JournalFilePath.c_str());
+	}
+	m_JournalFilePath.clear();
+}
+
+HRESULT OutputManager::InitializeWavWriter(_In_ IStream *pStream)
+{
+	m_WavWriter = make_unique<WavWriter>();
+	RETURN_ON_BAD_HR(m_WavWriter->Initialize(pStream, GetAudioOptions()->GetAudioSamplesPerSecond(), GetAudioOptions()->GetAudioChannels(), GetAudioOptions()->GetAudioBitsPerSample()));
+	//A WAV file holds a single track. With a track per device, that is the first track, i.e. the mix if it is written.
+	m_AudioStreamIndexes.assign(1, 0);
+	if (GetAudioOptions()->GetAudioTrackCount() > 1) {
+		LOG_WARN(L"Audio only recordings hold a single track, only the first of %u audio tracks is written", GetAudioOptions()->GetAudioTrackCount());
+	}
+	LOG_DEBUG(L"WAV writer initialized");
+	return S_OK;
+}
+
 HRESULT OutputManager::FinalizeRecording()
 {
 	LOG_INFO("Cleaning up resources");
@@ -185,8 +243,16 @@ HRESULT OutputManager::FinalizeRecording()
 			}
 		}
 		m_SinkWriter = nullptr;
+		//A finalized file is complete, so its journal is of no more use. One that failed to finalize keeps it, to be recovered.
+		if (SUCCEEDED(finalizeResult)) {
+			DeleteJournal();
+		}
+		else {
+			m_JournalStream.Release();
+		}
 		
-		if (!m_OutputFullPath.empty()) {
+		//The native muxer closes the file when it is finalized, so there is nothing to wait for.
+		if (!m_OutputFullPath.empty() && GetEncoderOptions()->GetMp4Muxer() != Mp4MuxerInternal::Native) {
 			bool isFileAvailable = false;
 			for (int i = 0; i < 10; i++) {
 				isFileAvailable = IsFileAvailableForReading(m_OutputFullPath);
@@ -204,6 +270,19 @@ HRESULT OutputManager::FinalizeRecording()
 			}
 		}
 	}
+	if (m_WavWriter) {
+		finalizeResult = m_WavWriter->Finalize();
+		if (FAILED(finalizeResult)) {
+			LOG_ERROR("Failed to finalize WAV file");
+		}
+		else if (finalizeResult == S_FALSE) {
+			LOG_WARN("The WAV output stream can not seek, so the header was left without sizes");
+			finalizeResult = S_OK;
+		}
+		LOG_DEBUG(L"Wrote %llu frames to WAV file", m_WavWriter->GetWrittenFrames());
+		m_WavWriter.reset();
+		m_WavFileStream.Release();
+	}
 	StopMediaClock();
 	return finalizeResult;
 }
@@ -215,8 +294,10 @@ HRESULT OutputManager::RenderFrame(_In_ FrameWriteModel &model) {
 	MeasureExecutionTime measure(L"RenderFrame");
 	auto recorderMode = GetOutputOptions()->GetRecorderMode();
 	bool isPreviewOnly = GetOutputOptions()->GetIsPreviewOnly();
-	if (m_PtrInfo && m_PtrInfo->Visible && m_PtrInfo->PtrShapeBuffer != nullptr) {
-		DUPL_RETURN ret = DrawMouse(m_PtrInfo, model.Frame);
+	//The pointer and the device come with the frame, as frames may be rendered on the VideoFrameWriter thread while the next one is captured.
+	device_id = model.DeviceId;
+	if (model.PtrInfo && model.PtrInfo->Visible && model.PtrInfo->PtrShapeBuffer != nullptr) {
+		DUPL_RETURN ret = DrawMouse(model.PtrInfo, model.Frame);
 		if (ret != DUPL_RETURN_SUCCESS) {
 			LOG_ERROR(L"Error drawing mouse pointer");
 			//We just log the error and continue if the mouse pointer failed to draw. If there is an error with DXGI, it will be handled on the next call to AcquireNextFrame.
@@ -256,45 +337,14 @@ HRESULT OutputManager::RenderFrame(_In_ FrameWriteModel &model) {
 		WriteFrameToImage(m_SharedSurf, L"D:\\test\\shared.png");*/
 		model.Duration = model.Duration;
 
+		//Audio is written separately by the AudioWriter thread, so a slow encode here does not hold it up.
 		hr = WriteFrameToVideo(model.StartPos, model.Duration, m_VideoStreamIndex, model.Frame);
-		bool wroteAudioSample = false;
 		if (FAILED(hr)) {
 			_com_error err(hr);
 			LOG_ERROR(L"Writing of video frame with start pos %lld ms failed: %s", (HundredNanosToMillis(model.StartPos)), err.ErrorMessage());
 			return hr;//Stop recording if we fail
 		}
-		bool paddedAudio = false;
-
-		/* If the audio pCaptureInstance returns no data, i.e. the source is silent, we need to pad the PCM stream with zeros to give the media sink silence as input.
-		 * If we don't, the sink writer will begin throttling video frames because it expects audio samples to be delivered, and think they are delayed.
-		 * We ignore every instance where the last frame had audio, due to sometimes very short frame durations due to mouse cursor changes have zero audio length,
-		 * and inserting silence between two frames that has audio leads to glitching. */
-		if (GetAudioOptions()->IsAudioEnabled() && model.Audio.size() == 0 && model.Duration > 0) {
-			if (!m_LastFrameHadAudio) {
-				int frameCount = int(ceil(GetAudioOptions()->GetAudioSamplesPerSecond() * HundredNanosToMillis(model.Duration) / 1000));
-				int byteCount = frameCount * (GetAudioOptions()->GetAudioBitsPerSample() / 8) * GetAudioOptions()->GetAudioChannels();
-				model.Audio.insert(model.Audio.end(), byteCount, 0);
-				paddedAudio = true;
-			}
-			m_LastFrameHadAudio = false;
-		}
-		else {
-			m_LastFrameHadAudio = true;
-		}
-
-		if (model.Audio.size() > 0) {
-			hr = WriteAudioSamplesToVideo(model.StartPos, model.Duration, m_AudioStreamIndex, &(model.Audio)[0], (DWORD)model.Audio.size());
-			if (FAILED(hr)) {
-				_com_error err(hr);
-				LOG_ERROR(L"Writing of audio sample with start pos %lld ms failed: %s", (HundredNanosToMillis(model.StartPos)), err.ErrorMessage());
-				return hr;//Stop recording if we fail
-			}
-			else {
-				wroteAudioSample = true;
-			}
-		}
-		auto frameInfoStr = wroteAudioSample ? (paddedAudio ? L"video sample and audio padding" : L"video and audio sample") : L"video sample";
-		LOG_TRACE(L"Wrote %s with duration %.2f ms", frameInfoStr, HundredNanosToMillisDouble(model.Duration));
+		LOG_TRACE(L"Wrote video sample with duration %.2f ms", HundredNanosToMillisDouble(model.Duration));
 	}
 	else if (recorderMode == RecorderModeInternal::Slideshow) {
 		wstring	path = m_OutputFolder + L"\\" + to_wstring(m_RenderedFrameCount) + GetSnapshotOptions()->GetImageExtension();
@@ -347,37 +397,6 @@ HRESULT OutputManager::RenderFrame(_In_ FrameWriteModel &model) {
 			DUPL_RETURN Ret = UpdateApplicationWindow(NULL, &Occluded);
 		}
 		hr = S_OK;
-
-		bool paddedAudio = false;
-		bool wroteAudioSample = false;
-		/* If the audio pCaptureInstance returns no data, i.e. the source is silent, we need to pad the PCM stream with zeros to give the media sink silence as input.
-		 * If we don't, the sink writer will begin throttling video frames because it expects audio samples to be delivered, and think they are delayed.
-		 * We ignore every instance where the last frame had audio, due to sometimes very short frame durations due to mouse cursor changes have zero audio length,
-		 * and inserting silence between two frames that has audio leads to glitching. */
-		if (GetAudioOptions()->IsAudioEnabled() && model.Audio.size() == 0 && model.Duration > 0) {
-			if (!m_LastFrameHadAudio) {
-				int frameCount = int(ceil(GetAudioOptions()->GetAudioSamplesPerSecond() * HundredNanosToMillis(model.Duration) / 1000));
-				int byteCount = frameCount * (GetAudioOptions()->GetAudioBitsPerSample() / 8) * GetAudioOptions()->GetAudioChannels();
-				model.Audio.insert(model.Audio.end(), byteCount, 0);
-				paddedAudio = true;
-			}
-			m_LastFrameHadAudio = false;
-		}
-		else {
-			m_LastFrameHadAudio = true;
-		}
-
-		if (model.Audio.size() > 0) {
-			hr = WriteAudioSamplesToVideo(model.StartPos, model.Duration, m_AudioStreamIndex, &(model.Audio)[0], (DWORD)model.Audio.size(), false);
-			if (FAILED(hr)) {
-				_com_error err(hr);
-				LOG_ERROR(L"Writing of audio sample with start pos %lld ms failed: %s", (HundredNanosToMillis(model.StartPos)), err.ErrorMessage());
-				return hr;//Stop recording if we fail
-			}
-			else {
-				wroteAudioSample = true;
-			}
-		}
 	}
 	model.Frame.Release();
 	m_RenderedFrameCount++;
@@ -471,7 +490,8 @@ HRESULT OutputManager::ConfigureOutputMediaTypes(
 	RETURN_ON_BAD_HR(pVideoMediaType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
 	RETURN_ON_BAD_HR(pVideoMediaType->SetUINT32(MF_MT_MPEG2_PROFILE, GetEncoderOptions()->GetEncoderProfile()));
 	RETURN_ON_BAD_HR(pVideoMediaType->SetUINT32(MF_MT_VIDEO_PRIMARIES, MFVideoPrimaries_BT709));
-	RETURN_ON_BAD_HR(pVideoMediaType->SetUINT32(MF_MT_YUV_MATRIX, MFVideoTransferMatrix_BT709));
+	RETURN_ON_BAD_HR(pVideoMediaType->SetUINT32(MF_MT_YUV_MATRIX, GetYuvMatrix()));
+	RETURN_ON_BAD_HR(pVideoMediaType->SetUINT32(MF_MT_VIDEO_NOMINAL_RANGE, GetYuvNominalRange()));
 	RETURN_ON_BAD_HR(pVideoMediaType->SetUINT32(MF_MT_TRANSFER_FUNCTION, MFVideoTransFunc_709));
 	RETURN_ON_BAD_HR(MFSetAttributeSize(pVideoMediaType, MF_MT_FRAME_SIZE, destWidth, destHeight));
 	RETURN_ON_BAD_HR(MFSetAttributeRatio(pVideoMediaType, MF_MT_FRAME_RATE, GetEncoderOptions()->GetVideoFps(), 1));
@@ -517,7 +537,7 @@ HRESULT OutputManager::ConfigureInputMediaTypes(
 	RETURN_ON_BAD_HR(pVideoMediaType->SetUINT32(MF_MT_VIDEO_ROTATION, rotationFormat));
 	RETURN_ON_BAD_HR(pVideoMediaType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
 	RETURN_ON_BAD_HR(pVideoMediaType->SetUINT32(MF_MT_VIDEO_PRIMARIES, MFVideoPrimaries_BT709));
-	RETURN_ON_BAD_HR(pVideoMediaType->SetUINT32(MF_MT_YUV_MATRIX, MFVideoTransferMatrix_BT709));
+	RETURN_ON_BAD_HR(pVideoMediaType->SetUINT32(MF_MT_YUV_MATRIX, GetYuvMatrix()));
 	RETURN_ON_BAD_HR(pVideoMediaType->SetUINT32(MF_MT_TRANSFER_FUNCTION, MFVideoTransFunc_709));
 	RETURN_ON_BAD_HR(MFSetAttributeSize(pVideoMediaType, MF_MT_FRAME_SIZE, sourceWidth, sourceHeight));
 	if (!GetEncoderOptions()->GetIsFixedFramerate() && !GetEncoderOptions()->GetIsFragmentedMp4Enabled()) {
@@ -551,11 +571,11 @@ HRESULT OutputManager::InitializeVideoSinkWriter(
 	_In_ IMFSinkWriterCallback *pCallback,
 	_Outptr_ IMFSinkWriter **ppWriter,
 	_Out_ DWORD *pVideoStreamIndex,
-	_Out_ DWORD *pAudioStreamIndex)
+	_Out_ std::vector<DWORD> *pAudioStreamIndexes)
 {
 	*ppWriter = nullptr;
 	*pVideoStreamIndex = 0;
-	*pAudioStreamIndex = 0;
+	pAudioStreamIndexes->clear();
 
 	CComPtr<IMFSinkWriter>        pSinkWriter = nullptr;
 	CComPtr<IMFMediaType>         pVideoMediaTypeOut = nullptr;
@@ -592,14 +612,16 @@ HRESULT OutputManager::InitializeVideoSinkWriter(
 	//The source samples have the format ARGB32, but the video encoders need the input to be a YUV format, so we convert ARGB32->NV12->H264/HEVC
 	CopyMediaType(pVideoMediaTypeIn, &pVideoMediaTypeIntermediate);
 	RETURN_ON_BAD_HR(pVideoMediaTypeIntermediate->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_NV12));
+	//The range applies to the YUV formats only, the ARGB32 input is always full range.
+	RETURN_ON_BAD_HR(pVideoMediaTypeIntermediate->SetUINT32(MF_MT_VIDEO_NOMINAL_RANGE, GetYuvNominalRange()));
 	CopyMediaType(pVideoMediaTypeIntermediate, &pVideoMediaTypeTransform);
 	pVideoMediaTypeTransform->DeleteItem(MF_MT_FRAME_RATE);
 
 	RETURN_ON_BAD_HR(CreateIMFTransform(videoStreamIndex, pVideoMediaTypeIn, pVideoMediaTypeTransform, &m_MediaTransform));
 
 	CComPtr<IMFAttributes> pTransformAttributes;
+	UINT32 d3d11Aware = 0;
 	if (SUCCEEDED(m_MediaTransform->GetAttributes(&pTransformAttributes))) {
-		UINT32 d3d11Aware = 0;
 		pTransformAttributes->GetUINT32(MF_SA_D3D11_AWARE, &d3d11Aware);
 		if (d3d11Aware > 0) {
 			HRESULT hr = m_MediaTransform->ProcessMessage(MFT_MESSAGE_SET_D3D_MANAGER, reinterpret_cast<ULONG_PTR>(m_DeviceManager.p));
@@ -607,18 +629,104 @@ HRESULT OutputManager::InitializeVideoSinkWriter(
 		}
 	}
 
+	//A video processor that is not D3D11 aware converts in software, reading each frame back from the GPU and allocating a buffer for every output.
+	//The CPU converter does the same work with SIMD on several threads, into pooled buffers. The media transform is kept for frames the converter does not take.
+	m_ColorConverter.reset();
+	m_StagingTexture.Release();
+	VideoColorConversionModeInternal conversionMode = GetEncoderOptions()->GetColorConversionMode();
+	bool isCpuConversion = conversionMode == VideoColorConversionModeInternal::Cpu || (conversionMode == VideoColorConversionModeInternal::Auto && d3d11Aware == 0);
+	//NV12 frames of odd sizes have no agreed upon layout in memory, so those are left to the media transform.
+	if (isCpuConversion && sourceWidth % 2 == 0 && sourceHeight % 2 == 0) {
+		VIDEO_COLOR_CONVERTER_OPTIONS converterOptions;
+		converterOptions.Matrix = GetEncoderOptions()->GetColorMatrix() == VideoColorMatrixInternal::BT601 ? VideoColorMatrix::BT601 : VideoColorMatrix::BT709;
+		converterOptions.IsFullRange = GetEncoderOptions()->GetIsFullRangeColorEnabled();
+		converterOptions.Layout = VideoPlaneLayout::NV12;
+		m_ColorConverter = std::make_unique<VideoColorConverter>();
+		RETURN_ON_BAD_HR(m_ColorConverter->Initialize(sourceWidth, sourceHeight, converterOptions));
+		LOG_INFO(L"Converting video frames to NV12 on the CPU, on %u threads", m_ColorConverter->GetThreadCount());
+	}
+
 	//Creates a streaming writer
 	CComPtr<IMFMediaSink> pMp4StreamSink = nullptr;
-	if (GetEncoderOptions()->GetIsFragmentedMp4Enabled()) {
+	bool isNativeMuxer = GetEncoderOptions()->GetMp4Muxer() == Mp4MuxerInternal::Native;
+	UINT32 audioTrackCount = pAudioMediaTypeOut ? (std::max)(GetAudioOptions()->GetAudioTrackCount(), (UINT32)1) : 0;
+	bool isSegmented = GetEncoderOptions()->GetSegmentDurationMillis() > 0 || GetEncoderOptions()->GetSegmentSize() > 0;
+	//Segments are files next to the output file, so a recording to a stream, or a preview to a temporary file, is written whole.
+	if (isSegmented && (!isNativeMuxer || m_OutputFullPath.empty() || m_OutStream || GetOutputOptions()->GetIsPreviewOnly())) {
+		LOG_WARN(L"Segments are only written by the native muxer to a file path, the recording is written to a single output");
+		isSegmented = false;
+	}
+	//The Media Foundation sinks write the index of a file only when it is finalized, so what they leave behind after a crash can not be recovered.
+	if (GetEncoderOptions()->GetIsCrashSafeEnabled() && !isNativeMuxer) {
+		LOG_WARN(L"Crash safe recordings are only written by the native muxer, the option is ignored");
+	}
+	//The replay buffer takes the encoded samples as the native muxer gets them. The Media Foundation sinks hand none of them out.
+	if (m_ReplayBuffer && !isNativeMuxer) {
+		LOG_WARN(L"Instant replay is only kept by the native muxer, the option is ignored");
+	}
+	if (isNativeMuxer) {
+		MP4_MUXER_OPTIONS muxerOptions;
+		muxerOptions.FragmentDuration100Nanos = (INT64)(std::max)(GetEncoderOptions()->GetFragmentDurationMillis(), (UINT32)1) * 10000;
+		muxerOptions.WriteBufferBytes = GetEncoderOptions()->GetMuxerWriteBufferSize();
+		muxerOptions.ChunkDuration100Nanos = (INT64)GetEncoderOptions()->GetChunkDurationMillis() * 10000;
+		muxerOptions.OnChunkWritten = m_ChunkWrittenCallback;
+		std::function<HRESULT(UINT32, IMFByteStream **)> createSegmentByteStream = nullptr;
+		if (isSegmented) {
+			muxerOptions.SegmentDuration100Nanos = (INT64)GetEncoderOptions()->GetSegmentDurationMillis() * 10000;
+			muxerOptions.SegmentBytes = GetEncoderOptions()->GetSegmentSize();
+			createSegmentByteStream = [this](UINT32 segmentNumber, IMFByteStream **ppByteStream) {
+				return MFCreateFile(MF_ACCESSMODE_READWRITE, MF_OPENMODE_FAIL_IF_EXIST, MF_FILEFLAGS_NONE, GetSegmentFilePath(segmentNumber).c_str(), ppByteStream);
+			};
+			if (m_SegmentWrittenCallback) {
+				muxerOptions.OnSegmentWritten = [this](const MP4_MUXER_SEGMENT &segment) {
+					m_SegmentWrittenCallback(segment, GetSegmentFilePath(segment.Number));
+				};
+			}
+			LOG_INFO(L"Splitting the recording into segments of %u ms or %llu bytes", GetEncoderOptions()->GetSegmentDurationMillis(), GetEncoderOptions()->GetSegmentSize());
+		}
+		if (GetEncoderOptions()->GetIsCrashSafeEnabled()) {
+			muxerOptions.CommitInterval100Nanos = (INT64)GetEncoderOptions()->GetCrashSafeSyncIntervalMillis() * 10000;
+			//The journal is a file next to the output. A stream is committed, and can be recovered from its boxes alone.
+			if (!m_OutputFullPath.empty() && !m_OutStream && !GetOutputOptions()->GetIsPreviewOnly()) {
+				muxerOptions.OpenJournalStream = [this](UINT32 segmentNumber, IStream **ppStream) {
+					return OpenJournalStream(segmentNumber, ppStream);
+				};
+			}
+			else {
+				LOG_INFO(L"No recovery journal is written for a recording to a stream");
+			}
+			LOG_INFO(L"Crash safe recording, committing the output every %u ms", GetEncoderOptions()->GetCrashSafeSyncIntervalMillis());
+		}
+		if (m_ReplayBuffer) {
+			LOG_INFO(L"Keeping the last %u ms of the recording in up to %llu bytes of memory for instant replay", GetEncoderOptions()->GetInstantReplayDurationMillis(), GetEncoderOptions()->GetInstantReplayMaxMemory());
+		}
+		//The native sink has a stream for every audio track from the start.
+		RETURN_ON_BAD_HR(Mp4MuxerSink::CreateInstance(pOutStream, muxerOptions, createSegmentByteStream, pVideoMediaTypeOut, pAudioMediaTypeOut, audioTrackCount, m_ReplayBuffer, &pMp4StreamSink));
+		LOG_INFO(L"Writing fragments of %u ms in chunks of %u ms with the native muxer, through a %u byte write buffer", GetEncoderOptions()->GetFragmentDurationMillis(), GetEncoderOptions()->GetChunkDurationMillis(), muxerOptions.WriteBufferBytes);
+	}
+	else if (GetEncoderOptions()->GetIsFragmentedMp4Enabled()) {
 		RETURN_ON_BAD_HR(MFCreateFMPEG4MediaSink(pOutStream, pVideoMediaTypeOut, pAudioMediaTypeOut, &pMp4StreamSink));
 	}
 	else {
 		RETURN_ON_BAD_HR(MFCreateMPEG4MediaSink(pOutStream, pVideoMediaTypeOut, pAudioMediaTypeOut, &pMp4StreamSink));
 	}
+	//The sink is created with the first audio track. Every further track, e.g. one per audio device, is another stream of the same format.
+	std::vector<DWORD> audioStreamIndexes;
+	if (pAudioMediaTypeOut) {
+		for (UINT32 track = 0; track < audioTrackCount; track++) {
+			DWORD streamIndex = audioStreamIndex + track;
+			if (track > 0 && !isNativeMuxer) {
+				CComPtr<IMFStreamSink> pAudioStreamSink = nullptr;
+				RETURN_ON_BAD_HR(pMp4StreamSink->AddStreamSink(streamIndex, pAudioMediaTypeOut, &pAudioStreamSink));
+			}
+			audioStreamIndexes.push_back(streamIndex);
+		}
+		LOG_DEBUG(L"Writing %u audio tracks", audioTrackCount);
+	}
 	pAudioMediaTypeOut.Release();
 
 	RETURN_ON_BAD_HR(MFCreateAttributes(&pAttributes, 7));
-	RETURN_ON_BAD_HR(pAttributes->SetGUID(MF_TRANSCODE_CONTAINERTYPE, GetEncoderOptions()->GetIsFragmentedMp4Enabled() ? MFTranscodeContainerType_FMPEG4 : MFTranscodeContainerType_MPEG4));
+	RETURN_ON_BAD_HR(pAttributes->SetGUID(MF_TRANSCODE_CONTAINERTYPE, isNativeMuxer || GetEncoderOptions()->GetIsFragmentedMp4Enabled() ? MFTranscodeContainerType_FMPEG4 : MFTranscodeContainerType_MPEG4));
 	RETURN_ON_BAD_HR(pAttributes->SetUINT32(MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS, GetEncoderOptions()->GetIsHardwareEncodingEnabled()));
 	RETURN_ON_BAD_HR(pAttributes->SetUINT32(MF_MPEG4SINK_MOOV_BEFORE_MDAT, GetEncoderOptions()->GetIsFastStartEnabled()));
 	RETURN_ON_BAD_HR(pAttributes->SetUINT32(MF_LOW_LATENCY, GetEncoderOptions()->GetIsLowLatencyModeEnabled()));
@@ -638,8 +746,8 @@ HRESULT OutputManager::InitializeVideoSinkWriter(
 		LogMediaType(pVideoMediaTypeOut);
 
 	RETURN_ON_BAD_HR(pSinkWriter->SetInputMediaType(videoStreamIndex, USE_NV12_CONVERTER ? pVideoMediaTypeIntermediate : pVideoMediaTypeIn, nullptr));
-	if (pAudioMediaTypeIn) {
-		RETURN_ON_BAD_HR(pSinkWriter->SetInputMediaType(audioStreamIndex, pAudioMediaTypeIn, nullptr));
+	for (DWORD streamIndex : audioStreamIndexes) {
+		RETURN_ON_BAD_HR(pSinkWriter->SetInputMediaType(streamIndex, pAudioMediaTypeIn, nullptr));
 	}
 
 	auto SetAttributeU32([](_Inout_ CComPtr<ICodecAPI> &codec, _In_ const GUID &guid, _In_ UINT32 value)
@@ -661,6 +769,11 @@ HRESULT OutputManager::InitializeVideoSinkWriter(
 			default:
 				break;
 		}
+		if (isNativeMuxer) {
+			//A fragment is cut on the first keyframe after its duration, so a keyframe every fragment duration keeps the fragments close to it.
+			UINT32 gopSize = (UINT32)(((UINT64)GetEncoderOptions()->GetVideoFps() * GetEncoderOptions()->GetFragmentDurationMillis() + 999) / 1000);
+			LOG_ON_BAD_HR(SetAttributeU32(encoder, CODECAPI_AVEncMPVGOPSize, (std::max)(gopSize, (UINT32)1)));
+		}
 	}
 
 	// Tell the sink writer to start accepting data.
@@ -670,12 +783,25 @@ HRESULT OutputManager::InitializeVideoSinkWriter(
 	*ppWriter = pSinkWriter;
 	(*ppWriter)->AddRef();
 	*pVideoStreamIndex = videoStreamIndex;
-	*pAudioStreamIndex = audioStreamIndex;
+	*pAudioStreamIndexes = audioStreamIndexes;
 	return S_OK;
 }
 
 HRESULT OutputManager::WriteFrameToVideo(_In_ INT64 frameStartPos, _In_ INT64 frameDuration, _In_ DWORD streamIndex, _In_ ID3D11Texture2D *pAcquiredDesktopImage)
 {
+	if (m_ColorConverter) {
+		CComPtr<IMFMediaBuffer> pConvertedBuffer = nullptr;
+		HRESULT hr = ConvertFrameOnCpu(pAcquiredDesktopImage, &pConvertedBuffer);
+		RETURN_ON_BAD_HR(hr);
+		if (hr == S_OK) {
+			CComPtr<IMFSample> pConvertedSample = nullptr;
+			RETURN_ON_BAD_HR(MFCreateSample(&pConvertedSample));
+			RETURN_ON_BAD_HR(pConvertedSample->AddBuffer(pConvertedBuffer));
+			RETURN_ON_BAD_HR(pConvertedSample->SetSampleTime(frameStartPos));
+			RETURN_ON_BAD_HR(pConvertedSample->SetSampleDuration(frameDuration));
+			return m_SinkWriter->WriteSample(streamIndex, pConvertedSample);
+		}
+	}
 	IMFMediaBuffer *pMediaBuffer;
 	HRESULT hr = MFCreateDXGISurfaceBuffer(__uuidof(ID3D11Texture2D), pAcquiredDesktopImage, 0, FALSE, &pMediaBuffer);
 	IMF2DBuffer *p2DBuffer;
@@ -777,50 +903,79 @@ HRESULT OutputManager::WriteFrameToVideo(_In_ INT64 frameStartPos, _In_ INT64 fr
 	return hr;
 }
 
-HRESULT OutputManager::WriteAudioSamplesToVideo(_In_ INT64 frameStartPos, _In_ INT64 frameDuration, _In_ DWORD streamIndex, _In_ BYTE *pSrc, _In_ DWORD cbData, _In_ bool shouldWrite)
+HRESULT OutputManager::ConvertFrameOnCpu(_In_ ID3D11Texture2D *pFrame, _Outptr_result_maybenull_ IMFMediaBuffer **ppBuffer)
 {
-	IMFMediaBuffer *pBuffer = nullptr;
-	BYTE *pData = nullptr;
-	// Create the media buffer.
-	HRESULT hr = MFCreateMemoryBuffer(
-		cbData,   // Amount of memory to allocate, in bytes.
-		&pBuffer
-	);
-	//once in awhile, things get behind and we get an out of memory error when trying to create the buffer
-	//so, just check, wait and try again if necessary
-	int counter = 0;
-	while (!SUCCEEDED(hr) && counter++ < 100) {
-		Sleep(10);
-		hr = MFCreateMemoryBuffer(cbData, &pBuffer);
-	}
-	// Lock the buffer to get a pointer to the memory.
-	if (SUCCEEDED(hr))
-	{
-		hr = pBuffer->Lock(&pData, nullptr, nullptr);
-	}
+	*ppBuffer = nullptr;
+	D3D11_TEXTURE2D_DESC frameDesc;
+	pFrame->GetDesc(&frameDesc);
+	if (frameDesc.Format != DXGI_FORMAT_B8G8R8A8_UNORM || frameDesc.SampleDesc.Count != 1
+		|| frameDesc.Width != m_ColorConverter->GetWidth() || frameDesc.Height != m_ColorConverter->GetHeight()) {
+		return S_FALSE;
+	}
+	if (!m_StagingTexture) {
+		D3D11_TEXTURE2D_DESC stagingDesc = frameDesc;
+		stagingDesc.MipLevels = 1;
+		stagingDesc.ArraySize = 1;
+		stagingDesc.Usage = D3D11_USAGE_STAGING;
+		stagingDesc.BindFlags = 0;
+		stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		stagingDesc.MiscFlags = 0;
+		RETURN_ON_BAD_HR(m_Device->CreateTexture2D(&stagingDesc, nullptr, &m_StagingTexture));
+	}
+	m_DeviceContext->CopySubresourceRegion(m_StagingTexture, 0, 0, 0, 0, pFrame, 0, nullptr);
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	RETURN_ON_BAD_HR(m_DeviceContext->Map(m_StagingTexture, 0, D3D11_MAP_READ, 0, &mapped));
+	CComPtr<PooledMediaBuffer> pBuffer = nullptr;
+	HRESULT hr = m_VideoBufferPool.GetBuffer(m_ColorConverter->GetFrameBytes(), &pBuffer);
+	if (SUCCEEDED(hr)) {
+		hr = m_ColorConverter->Convert(static_cast<const BYTE *>(mapped.pData), mapped.RowPitch, pBuffer->GetData());
+	}
+	m_DeviceContext->Unmap(m_StagingTexture, 0);
+	RETURN_ON_BAD_HR(hr);
+	*ppBuffer = pBuffer.Detach();
+	return S_OK;
+}
 
-	if (SUCCEEDED(hr))
-	{
-		memcpy_s(pData, cbData, pSrc, cbData);
-	}
+UINT32 OutputManager::GetYuvMatrix()
+{
+	return GetEncoderOptions()->GetColorMatrix() == VideoColorMatrixInternal::BT601 ? MFVideoTransferMatrix_BT601 : MFVideoTransferMatrix_BT709;
+}
 
-	// Update the current length.
-	if (SUCCEEDED(hr))
-	{
-		hr = pBuffer->SetCurrentLength(cbData);
-	}
+UINT32 OutputManager::GetYuvNominalRange()
+{
+	return GetEncoderOptions()->GetIsFullRangeColorEnabled() ? MFNominalRange_0_255 : MFNominalRange_16_235;
+}
 
-	// Unlock the buffer.
-	if (pData)
-	{
-		hr = pBuffer->Unlock();
+HRESULT OutputManager::WriteAudioPacket(_In_ UINT32 track, _In_ IMFMediaBuffer *pBuffer, _In_ INT64 startPos, _In_ INT64 duration)
+{
+	//m_CriticalSection is not taken, as it is held for as long as a video frame takes to render and encode.
+	//The sink writer serializes the samples written to it from different threads.
+	if (!m_SinkWriter && !m_WavWriter) {
+		return E_UNEXPECTED;
 	}
-
-	IMFSample *pSample;
-	if (SUCCEEDED(hr))
-	{
-		hr = MFCreateSample(&pSample);
+	if (track >= m_AudioStreamIndexes.size()) {
+		return E_INVALIDARG;
 	}
+	HRESULT hr;
+	if (m_WavWriter) {
+		//The WAV file has no timestamps. The packets are back to back, with silence where nothing was captured.
+		hr = WriteAudioSamplesToWav(pBuffer);
+	}
+	else {
+		hr = WriteAudioSamplesToVideo(startPos, duration, m_AudioStreamIndexes[track], pBuffer);
+	}
+	if (FAILED(hr)) {
+		_com_error err(hr);
+		LOG_ERROR(L"Writing of audio sample on track %u with start pos %lld ms failed: %s", track, (HundredNanosToMillis(startPos)), err.ErrorMessage());
+	}
+	return hr;
+}
+
+HRESULT OutputManager::WriteAudioSamplesToVideo(_In_ INT64 frameStartPos, _In_ INT64 frameDuration, _In_ DWORD streamIndex, _In_ IMFMediaBuffer *pBuffer)
+{
+	//The buffer already holds the samples, so it is attached to the sample as is.
+	IMFSample *pSample = nullptr;
+	HRESULT hr = MFCreateSample(&pSample);
 	if (SUCCEEDED(hr))
 	{
 		hr = pSample->AddBuffer(pBuffer);
@@ -835,53 +990,22 @@ HRESULT OutputManager::WriteAudioSamplesToVideo(_In_ INT64 frameStartPos, _In_ I
 		INT64 duration = frameDuration;
 		hr = pSample->SetSampleDuration(duration);
 	}
-	if (SUCCEEDED(hr) && shouldWrite)
+	if (SUCCEEDED(hr))
 	{
 		// Send the sample to the Sink Writer.
 		hr = m_SinkWriter->WriteSample(streamIndex, pSample);
 	}
-	SafeRelease(&pBuffer);
-
-	DWORD pcbCurrentLength;
-	DWORD pcbMaxLength;
-	BYTE *ppbBuffer;
-	hr = pSample->ConvertToContiguousBuffer(&pBuffer);
-	hr = pBuffer->Lock(&ppbBuffer, &pcbMaxLength, &pcbCurrentLength);
-
-	int dataPerVolumeCalculation = GetAudioOptions()->GetAudioSamplesPerSecond() / 400;
-	int audioDataPoints = 0;
-	int audioMagnitude = 0;
-	short *b = (short *)ppbBuffer;
-
-	for (int i = 0; i < pcbCurrentLength / 2; i++)
-	{
-		if (b[i] == SHRT_MIN)
-			audioMagnitude += SHRT_MAX;
-		else
-			audioMagnitude += std::abs(b[i]);
-
-		audioDataPoints++;
-
-		if (audioDataPoints == dataPerVolumeCalculation)
-		{
-			audioDataPoints = 0;
-			int currentVolume = ((audioMagnitude) / dataPerVolumeCalculation);
-			if (currentVolume > CurrentAudioVolume)
-			{
-				CurrentAudioVolume = (int)(currentVolume);
-			}
-			else
-			{
-				CurrentAudioVolume = (int)(currentVolume * 0.05 + CurrentAudioVolume * 0.95);
-			}
-			audioMagnitude = 0;
-		}
-	}
+	SafeRelease(&pSample);
+	return hr;
+}
 
+HRESULT OutputManager::WriteAudioSamplesToWav(_In_ IMFMediaBuffer *pBuffer)
+{
+	BYTE *pData = nullptr;
+	DWORD cbData = 0;
+	RETURN_ON_BAD_HR(pBuffer->Lock(&pData, nullptr, &cbData));
+	HRESULT hr = m_WavWriter->Write(pData, cbData);
 	pBuffer->Unlock();
-
-	SafeRelease(&pSample);
-	SafeRelease(&pBuffer);
 	return hr;
 }
 
@@ -1495,11 +1619,6 @@ void OutputManager::CleanRefs()
 	}
 }
 
-void OutputManager::SetDeviceId(std::wstring id)
-{
-	device_id = id;
-}
-
 //
 // Process both masked and monochrome pointers
 //
@@ -1921,9 +2040,4 @@ DUPL_RETURN OutputManager::DrawMouse(_In_ PTR_INFO *PtrInfo, _Inout_ ID3D11Textu
 	}
 
 	return DUPL_RETURN_SUCCESS;
-}
-
-void OutputManager::SetMousePtrInfo(_In_ PTR_INFO *PtrInfo)
-{
-	m_PtrInfo = PtrInfo;
 }
\ No newline at end of file
@@ -6,6 +6,11 @@
 #include "CMFSinkWriterCallback.h"
 #include "cleanup.h"
 #include "fifo_map.h"
+#include "WavWriter.h"
+#include "VideoColorConverter.h"
+#include "MediaBufferPool.h"
+#include "FragmentedMp4Muxer.h"
+#include "ReplayBuffer.h"
 #include <mfreadwrite.h>
 
 struct FrameWriteModel
@@ -14,10 +19,12 @@ struct FrameWriteModel
 	INT64 StartPos;
 	//Duration of the frame, in 100 nanosecond units.
 	INT64 Duration;
-	//The audio sample bytes for this frame.
-	std::vector<BYTE> Audio;
 	//The frame texture.
 	CComPtr<ID3D11Texture2D> Frame;
+	//The mouse pointer as of when the frame was captured, or nullptr if there is none yet.
+	PTR_INFO *PtrInfo;
+	//The ID of the source the frame was captured from.
+	std::wstring DeviceId;
 };
 
 class OutputManager
@@ -37,6 +44,26 @@ public:
 	HRESULT BeginRecording(_In_ IStream *pStream, _In_ SIZE videoOutputFrameSize);
 	HRESULT FinalizeRecording();
 	HRESULT RenderFrame(_In_ FrameWriteModel &model);
+	/// <summary>
+	/// Writes a packet of audio to one of the audio tracks of the sink writer, or to the WAV file of an audio only recording. Called from the AudioWriter thread, so it does not wait for a video frame being rendered.
+	/// </summary>
+	HRESULT WriteAudioPacket(_In_ UINT32 track, _In_ IMFMediaBuffer *pBuffer, _In_ INT64 startPos, _In_ INT64 duration);
+	/// <summary>
+	/// The number of audio tracks in the recording, set when recording begins.
+	/// </summary>
+	inline UINT32 GetAudioTrackCount() { return (UINT32)m_AudioStreamIndexes.size(); }
+	/// <summary>
+	/// Sets a function to call for every chunk the native muxer writes to the output, on the thread of the sink writer. Set before recording begins.
+	/// </summary>
+	inline void SetChunkWrittenCallback(_In_opt_ std::function<void(_In_ const MP4_MUXER_CHUNK &chunk)> callback) { m_ChunkWrittenCallback = callback; }
+	/// <summary>
+	/// Sets a function to call for every segment file the native muxer completes, with the path of the file, on the thread of the sink writer. Set before recording begins.
+	/// </summary>
+	inline void SetSegmentWrittenCallback(_In_opt_ std::function<void(_In_ const MP4_MUXER_SEGMENT &segment, _In_ const std::wstring &filePath)> callback) { m_SegmentWrittenCallback = callback; }
+	/// <summary>
+	/// Sets the buffer the native muxer keeps the last seconds of the recording in, for an instant replay. Set before recording begins.
+	/// </summary>
+	inline void SetReplayBuffer(_In_opt_ std::shared_ptr<ReplayBuffer> pReplayBuffer) { m_ReplayBuffer = pReplayBuffer; }
 	void WriteTextureToImageAsync(_In_ ID3D11Texture2D *pAcquiredDesktopImage, _In_ std::wstring filePath, _In_opt_ std::function<void(HRESULT)> onCompletion = nullptr);
 	inline nlohmann::fifo_map<std::wstring, int> GetFrameDelays() { return m_FrameDelays; }
 	inline UINT64 GetRenderedFrameCount() { return m_RenderedFrameCount; }
@@ -50,13 +77,10 @@ public:
 	HANDLE OutputManager::GetSharedHandle();
 	void OutputManager::CleanRefs();
 	void OutputManager::WindowResize();
-	void OutputManager::SetDeviceId(std::wstring id);
-	int CurrentAudioVolume = 0;
 	void OutputManager::SetRenderingParamerters(ID3D11VertexShader* vertexShader, ID3D11PixelShader* pixelShader, ID3D11SamplerState* samplerLinear);
 	HRESULT WriteFrameToImage(_In_ ID3D11Texture2D *pAcquiredDesktopImage, _In_ std::wstring filePath);
 	DUPL_RETURN OutputManager::ProcessMonoMask(bool IsMono, _Inout_ PTR_INFO *PtrInfo, _Out_ INT *PtrWidth, _Out_ INT *PtrHeight, _Out_ INT *PtrLeft, _Out_ INT *PtrTop, _Outptr_result_bytebuffer_(*PtrHeight **PtrWidth *BPP) BYTE **InitBuffer, _Out_ D3D11_BOX *Box, _In_ ID3D11Texture2D *pBgTexture);
 	DUPL_RETURN OutputManager::DrawMouse(_In_ PTR_INFO *PtrInfo, _Inout_ ID3D11Texture2D *pBgTexture);
-	void OutputManager::SetMousePtrInfo(_In_ PTR_INFO *PtrInfo);
 	HRESULT StartMediaClock();
 	HRESULT ResumeMediaClock();
 	HRESULT PauseMediaClock();
@@ -77,20 +101,36 @@ private:
 	std::shared_ptr<OUTPUT_OPTIONS> m_OutputOptions;
 
 	nlohmann::fifo_map<std::wstring, int> m_FrameDelays;
+	std::function<void(_In_ const MP4_MUXER_CHUNK &chunk)> m_ChunkWrittenCallback;
+	std::function<void(_In_ const MP4_MUXER_SEGMENT &segment, _In_ const std::wstring &filePath)> m_SegmentWrittenCallback;
+	std::shared_ptr<ReplayBuffer> m_ReplayBuffer;
 
 	CComPtr<IMFSinkWriter> m_SinkWriter;
 	CComPtr<IMFMediaSink> m_Sink;
 	CComPtr<IMFSinkWriterCallback> m_CallBack;
 	CComPtr<IMFTransform> m_MediaTransform;
+	//Converts the video frames to NV12 on the CPU in place of m_MediaTransform, when set.
+	std::unique_ptr<VideoColorConverter> m_ColorConverter;
+	//The frames are copied off the GPU into this texture for the color converter.
+	CComPtr<ID3D11Texture2D> m_StagingTexture;
+	//The converted frames handed to the sink writer.
+	MediaBufferPool m_VideoBufferPool;
 	CComPtr<IMFDXGIDeviceManager> m_DeviceManager;
 	UINT m_ResetToken;
 	IStream *m_OutStream;
 	DWORD m_VideoStreamIndex;
-	DWORD m_AudioStreamIndex;
+	//The sink writer stream of each audio track. Audio only recordings have the single track of the WAV file.
+	std::vector<DWORD> m_AudioStreamIndexes;
+	//Writes audio only recordings, in place of the sink writer.
+	std::unique_ptr<WavWriter> m_WavWriter;
+	//The file of an audio only recording written to a path.
+	CComPtr<IStream> m_WavFileStream;
+	//The recovery journal of the current segment of a crash safe recording, and its path.
+	CComPtr<IStream> m_JournalStream;
+	std::wstring m_JournalFilePath;
 	HANDLE m_FinalizeEvent;
 	std::wstring m_OutputFolder;
 	std::wstring m_OutputFullPath;
-	bool m_LastFrameHadAudio;
 	UINT64 m_RenderedFrameCount;
 	std::chrono::steady_clock::time_point m_PreviousSnapshotTaken;
 	CRITICAL_SECTION m_CriticalSection;
@@ -102,11 +142,35 @@ private:
 
 	HRESULT ConfigureOutputMediaTypes(_In_ UINT destWidth, _In_ UINT destHeight, _Outptr_ IMFMediaType **pVideoMediaTypeOut, _Outptr_result_maybenull_ IMFMediaType **pAudioMediaTypeOut);
 	HRESULT ConfigureInputMediaTypes(_In_ UINT sourceWidth, _In_ UINT sourceHeight, _In_ MFVideoRotationFormat rotationFormat, _In_ IMFMediaType *pVideoMediaTypeOut, _Outptr_ IMFMediaType **pVideoMediaTypeIn, _Outptr_result_maybenull_ IMFMediaType **pAudioMediaTypeIn);
-	HRESULT InitializeVideoSinkWriter(_In_ IMFByteStream *pOutStream, _In_ RECT sourceRect, _In_ SIZE outputFrameSize, _In_ DXGI_MODE_ROTATION rotation, _In_ IMFSinkWriterCallback *pCallback, _Outptr_ IMFSinkWriter **ppWriter, _Out_ DWORD *pVideoStreamIndex, _Out_ DWORD *pAudioStreamIndex);
+	/// <summary>
+	/// Starts the WAV file of an audio only recording on pStream, in the format of the audio options.
+	/// </summary>
+	HRESULT InitializeWavWriter(_In_ IStream *pStream);
+	/// <summary>
+	/// The file of a segment of a recording split by the native muxer. The first is the output path, the ones after have the number of the segment added to the name.
+	/// </summary>
+	std::wstring GetSegmentFilePath(_In_ UINT32 segmentNumber);
+	/// <summary>
+	/// Creates the recovery journal of a segment of a crash safe recording, next to the file of the segment, and deletes the journal of the segment before, which is complete.
+	/// </summary>
+	HRESULT OpenJournalStream(_In_ UINT32 segmentNumber, _Outptr_ IStream **ppStream);
+	/// <summary>
+	/// Closes and deletes the journal of the last segment, once the recording is finalized and there is nothing left to recover.
+	/// </summary>
+	void DeleteJournal();
+	HRESULT InitializeVideoSinkWriter(_In_ IMFByteStream *pOutStream, _In_ RECT sourceRect, _In_ SIZE outputFrameSize, _In_ DXGI_MODE_ROTATION rotation, _In_ IMFSinkWriterCallback *pCallback, _Outptr_ IMFSinkWriter **ppWriter, _Out_ DWORD *pVideoStreamIndex, _Out_ std::vector<DWORD> *pAudioStreamIndexes);
 	HRESULT WriteFrameToVideo(_In_ INT64 frameStartPos, _In_ INT64 frameDuration, _In_ DWORD streamIndex, _In_ ID3D11Texture2D *pAcquiredDesktopImage);
+	/// <summary>
+	/// Converts a frame to NV12 with the color converter, into a pooled buffer. Returns S_FALSE without a buffer if the frame is not in the format and size the converter was set up for.
+	/// </summary>
+	HRESULT ConvertFrameOnCpu(_In_ ID3D11Texture2D *pFrame, _Outptr_result_maybenull_ IMFMediaBuffer **ppBuffer);
+	//The MF_MT_YUV_MATRIX and MF_MT_VIDEO_NOMINAL_RANGE of the encoder options.
+	UINT32 GetYuvMatrix();
+	UINT32 GetYuvNominalRange();
 	//HRESULT WriteFrameToImage(_In_ ID3D11Texture2D *pAcquiredDesktopImage, _In_ std::wstring filePath);
 	HRESULT WriteFrameToImage(_In_ ID3D11Texture2D *pAcquiredDesktopImage, _In_ IStream *pStream);
-	HRESULT WriteAudioSamplesToVideo(_In_ INT64 frameStartPos, _In_ INT64 frameDuration, _In_ DWORD streamIndex, _In_ BYTE *pSrc, _In_ DWORD cbData, _In_ bool shouldWrite = true);
+	HRESULT WriteAudioSamplesToVideo(_In_ INT64 frameStartPos, _In_ INT64 frameDuration, _In_ DWORD streamIndex, _In_ IMFMediaBuffer *pBuffer);
+	HRESULT WriteAudioSamplesToWav(_In_ IMFMediaBuffer *pBuffer);
 	UINT32 m_ScaledWidth = 0;
 	UINT32 m_ScaledHeight = 0;
 	HWND m_WindowHandle;
@@ -125,7 +189,6 @@ private:
 	UINT PreviousWindowHeight;
 	std::wstring device_id;
 	ID3D11BlendState *m_BlendState;
-	PTR_INFO *m_PtrInfo;
 	//IDXGIKeyedMutex *m_KeyMutex; 
 };
 
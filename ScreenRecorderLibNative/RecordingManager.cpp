@@ -18,6 +18,9 @@
 #include "AudioPrefs.h"
 #include <evr.h>
 #include "OutputManager.h"
+#include "AudioWriter.h"
+#include "VideoFrameWriter.h"
+#include "UnchangedFrameFilter.h"
 #include "Resizer.h"
 
 #pragma comment(lib, "strmiids.lib")
@@ -68,6 +71,11 @@ D3D_FEATURE_LEVEL m_FeatureLevels[] =
 	D3D_FEATURE_LEVEL_9_1
 };
 
+namespace {
+	//How often an audio only recording checks the audio writer for errors and reports the volume.
+	const unsigned int AudioOnlyPollMillis = 33;
+}
+
 struct RecordingManager::TaskWrapper {
 	Concurrency::task<void> m_RecordTask = concurrency::task_from_result();
 	Concurrency::cancellation_token_source m_RecordTaskCts;
@@ -80,8 +88,11 @@ RecordingManager::RecordingManager() :
 	RecordingSnapshotCreatedCallback(nullptr),
 	RecordingStatusChangedCallback(nullptr),
 	RecordingFrameNumberChangedCallback(nullptr),
+	RecordingChunkWrittenCallback(nullptr),
+	RecordingSegmentWrittenCallback(nullptr),
 	m_TextureManager(nullptr),
 	m_OutputManager(nullptr),
+	m_ReplayBuffer(nullptr),
 	m_EncoderOptions(new H264_ENCODER_OPTIONS()),
 	m_AudioOptions(new AUDIO_OPTIONS),
 	m_MouseOptions(new MOUSE_OPTIONS),
@@ -171,6 +182,13 @@ HRESULT RecordingManager::ConfigureOutputDir(_In_ std::wstring path) {
 				m_SnapshotOptions->SetSnapshotDirectory(m_OutputFullPath.substr(0, m_OutputFullPath.find_last_of(L".")));
 			}
 		}
+		else if (recorderMode == RecorderModeInternal::Audio) {
+			LPWSTR pStrExtension = PathFindExtension(path.c_str());
+			if (pStrExtension == nullptr || pStrExtension[0] == 0)
+			{
+				m_OutputFullPath = m_OutputFolder + L"\\" + s2ws(CurrentTimeToFormattedString()) + L".wav";
+			}
+		}
 	}
 	if (!m_SnapshotOptions->GetSnapshotsDirectory().empty()) {
 		std::error_code ec;
@@ -226,28 +244,64 @@ HRESULT RecordingManager::BeginRecording(_In_opt_ std::wstring path, _In_opt_ IS
 	m_EncoderResult = S_FALSE;
 	RETURN_ON_BAD_HR(ConfigureOutputDir(path));
 
-	if (m_RecordingSources.size() == 0) {
+	bool isAudioOnly = GetOutputOptions()->GetRecorderMode() == RecorderModeInternal::Audio;
+	if (m_RecordingSources.size() == 0 && !isAudioOnly) {
 		std::wstring error = L"No valid recording sources found in recorder parameters.";
 		LOG_ERROR("%ls", error.c_str());
 		if (RecordingFailedCallback != nullptr)
 			RecordingFailedCallback(error, L"");
 		return S_FALSE;
 	}
+	//The replay of the recording before is let go of here, so it can be saved until now.
+	m_ReplayBuffer.reset();
+	//Nothing is encoded in preview mode, so there is nothing to keep.
+	if (GetEncoderOptions()->GetIsInstantReplayEnabled() && GetOutputOptions()->GetRecorderMode() == RecorderModeInternal::Video && !GetOutputOptions()->GetIsPreviewOnly()) {
+		REPLAY_BUFFER_OPTIONS replayOptions;
+		replayOptions.Duration100Nanos = MillisToHundredNanos((std::max)(GetEncoderOptions()->GetInstantReplayDurationMillis(), (UINT32)1));
+		replayOptions.MaxBytes = GetEncoderOptions()->GetInstantReplayMaxMemory();
+		std::shared_ptr<ReplayBuffer> pReplayBuffer = std::make_shared<ReplayBuffer>();
+		HRESULT hr = pReplayBuffer->Initialize(replayOptions);
+		if (SUCCEEDED(hr)) {
+			m_ReplayBuffer = pReplayBuffer;
+		}
+		else {
+			LOG_ERROR(L"Failed to set up the instant replay buffer of %llu bytes, recording without it: hr = 0x%08x", replayOptions.MaxBytes, hr);
+		}
+	}
 	m_TaskWrapperImpl->m_RecordTaskCts = cancellation_token_source();
-	m_TaskWrapperImpl->m_RecordTask = concurrency::create_task([this, stream]() {
+	m_TaskWrapperImpl->m_RecordTask = concurrency::create_task([this, stream, isAudioOnly]() {
 		LOG_INFO(L"Starting recording task");
 	m_IsRecording = true;
 	REC_RESULT result{};
 	HRESULT hr = CoInitializeEx(nullptr, COINITBASE_MULTITHREADED | COINIT_DISABLE_OLE1DDE);
 	RETURN_RESULT_ON_BAD_HR(hr, L"CoInitializeEx failed");
-	RETURN_RESULT_ON_BAD_HR(hr = InitializeDx(nullptr, &m_DxResources), L"Failed to initialize DirectX");
-
-	m_TextureManager = make_unique<TextureManager>();
-	m_TextureManager->Initialize(m_DxResources.Context, m_DxResources.Device);
-	m_OutputManager = make_unique<OutputManager>();
-	m_OutputManager->Initialize(m_DxResources.Context, m_DxResources.Device, GetEncoderOptions(), GetAudioOptions(), GetSnapshotOptions(), GetOutputOptions());
+	if (isAudioOnly) {
+		//Audio only recordings need neither a D3D device nor any textures, only the media clock of the output manager.
+		m_OutputManager = make_unique<OutputManager>();
+		RETURN_RESULT_ON_BAD_HR(hr = m_OutputManager->Initialize(nullptr, nullptr, GetEncoderOptions(), GetAudioOptions(), GetSnapshotOptions(), GetOutputOptions()), L"Failed to initialize output manager");
+		result = StartAudioRecorderLoop(stream);
+	}
+	else {
+		RETURN_RESULT_ON_BAD_HR(hr = InitializeDx(nullptr, &m_DxResources), L"Failed to initialize DirectX");
+
+		m_TextureManager = make_unique<TextureManager>();
+		m_TextureManager->Initialize(m_DxResources.Context, m_DxResources.Device);
+		m_OutputManager = make_unique<OutputManager>();
+		m_OutputManager->Initialize(m_DxResources.Context, m_DxResources.Device, GetEncoderOptions(), GetAudioOptions(), GetSnapshotOptions(), GetOutputOptions());
+		m_OutputManager->SetChunkWrittenCallback([this](const MP4_MUXER_CHUNK &chunk) {
+			if (RecordingChunkWrittenCallback != nullptr && !m_IsDestructing) {
+				RecordingChunkWrittenCallback(chunk.SegmentNumber, chunk.SequenceNumber, chunk.Offset, chunk.Bytes, chunk.StartPos, chunk.Duration, chunk.IsFragmentStart);
+			}
+		});
+		m_OutputManager->SetSegmentWrittenCallback([this](const MP4_MUXER_SEGMENT &segment, const std::wstring &filePath) {
+			if (RecordingSegmentWrittenCallback != nullptr && !m_IsDestructing) {
+				RecordingSegmentWrittenCallback(segment.Number, filePath, segment.StartPos, segment.Duration, segment.Bytes, segment.SwitchDuration100Nanos, segment.DroppedSamples);
+			}
+		});
+		m_OutputManager->SetReplayBuffer(m_ReplayBuffer);
 
-	result = StartRecorderLoop(m_RecordingSources, m_Overlays, stream);
+		result = StartRecorderLoop(m_RecordingSources, m_Overlays, stream);
+	}
 	if (RecordingStatusChangedCallback != nullptr && !m_IsDestructing && !GetOutputOptions()->GetIsPreviewOnly()) {
 		RecordingStatusChangedCallback(STATUS_FINALIZING);
 	}
@@ -310,6 +364,40 @@ void RecordingManager::ResumeRecording() {
 	}
 }
 
+HRESULT RecordingManager::SaveReplay(_In_opt_ std::wstring path, _In_opt_ IStream *stream, _Out_ REPLAY_SAVE_RESULT *pResult) {
+	*pResult = REPLAY_SAVE_RESULT{};
+	std::shared_ptr<ReplayBuffer> pReplayBuffer = m_ReplayBuffer;
+	if (!pReplayBuffer) {
+		LOG_WARN(L"No instant replay is kept, there is nothing to save");
+		return E_NOT_VALID_STATE;
+	}
+	if (path.empty() == (stream == nullptr)) {
+		return E_INVALIDARG;
+	}
+	CComPtr<IStream> pStream = stream;
+	if (!path.empty()) {
+		RETURN_ON_BAD_HR(SHCreateStreamOnFileEx(path.c_str(), STGM_WRITE | STGM_SHARE_DENY_WRITE | STGM_FAILIFTHERE, FILE_ATTRIBUTE_NORMAL, TRUE, nullptr, &pStream));
+	}
+	//The replay is muxed in fragments of the recording.
+	MP4_MUXER_OPTIONS muxerOptions;
+	muxerOptions.FragmentDuration100Nanos = MillisToHundredNanos((std::max)(GetEncoderOptions()->GetFragmentDurationMillis(), (UINT32)1));
+	muxerOptions.WriteBufferBytes = GetEncoderOptions()->GetMuxerWriteBufferSize();
+	HRESULT hr = pReplayBuffer->Save(pStream, muxerOptions, pResult);
+	pStream.Release();
+	if (FAILED(hr)) {
+		LOG_ERROR(L"Failed to save the instant replay: hr = 0x%08x", hr);
+		if (!path.empty()) {
+			DeleteFileW(path.c_str());
+		}
+		return hr;
+	}
+	LOG_INFO(L"Saved %lld ms of instant replay, %llu samples in %llu bytes", pResult->Duration / 10000, pResult->Samples, pResult->Bytes);
+	if (pResult->IsTruncated) {
+		LOG_WARN(L"The instant replay save was cut short, as the recording needed the memory of what it had still to copy");
+	}
+	return S_OK;
+}
+
 bool RecordingManager::SetExcludeFromCapture(HWND hwnd, bool isExcluded) {
 	// The API call causes ugly black window on older builds of Windows, so skip if the contract is down-level. 
 	if (winrt::Windows::Foundation::Metadata::ApiInformation::IsApiContractPresent(L"Windows.Foundation.UniversalApiContract", 9))
@@ -464,6 +552,22 @@ REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_
 		RETURN_RESULT_ON_BAD_HR(hr = m_OutputManager->BeginRecording(m_OutputFullPath, videoOutputFrameSize), L"Failed to initialize video sink writer");
 	}
 	pAudioManager->ClearRecordedBytes();
+	//Declared after the audio manager, so it stops writing before the audio manager goes away on any early return.
+	std::unique_ptr<AudioWriter> pAudioWriter = make_unique<AudioWriter>();
+	if (recorderMode == RecorderModeInternal::Video && !GetOutputOptions()->GetIsPreviewOnly() && GetAudioOptions()->IsAudioEnabled()) {
+		RETURN_RESULT_ON_BAD_HR(hr = pAudioWriter->StartWriting(pAudioManager.get(), m_OutputManager.get(),
+			GetAudioOptions()->GetAudioSamplesPerSecond(), GetAudioOptions()->GetAudioChannels(), GetAudioOptions()->GetAudioBitsPerSample()), L"Failed to start audio writer");
+	}
+	//Declared after the audio writer, so it stops rendering frames before the audio writer stops on any early return.
+	std::unique_ptr<VideoFrameWriter> pVideoWriter = make_unique<VideoFrameWriter>();
+	auto StartVideoWriter([&]()->HRESULT {
+		if (recorderMode != RecorderModeInternal::Video || GetEncoderOptions()->GetFrameQueueLength() == 0) {
+			//Frames are rendered on this thread.
+			return S_FALSE;
+		}
+		return pVideoWriter->StartWriting(m_OutputManager.get(), GetEncoderOptions()->GetFrameQueueLength(), static_cast<FrameQueueFullPolicy>(GetEncoderOptions()->GetFrameQueueFullPolicy()));
+	});
+	RETURN_RESULT_ON_BAD_HR(hr = StartVideoWriter(), L"Failed to start video writer");
 
 	std::chrono::steady_clock::time_point previousSnapshotTaken = (std::chrono::steady_clock::time_point::min)();
 	double videoFrameDurationMillis = 0;
@@ -482,7 +586,17 @@ REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_
 	INT64 minimumTimeForDelay100Nanons = 5000;//0.5ms
 	DWORD maxFrameLengthMillis = (DWORD)HundredNanosToMillis(m_MaxFrameLength100Nanos);
 	DynamicWait DynamicWait;
-	INT64 totalDiff = 0;
+	UnchangedFrameFilter unchangedFrameFilter;
+	UINT32 maxUnchangedFrameDurationMillis = GetEncoderOptions()->GetMaxUnchangedFrameDurationMillis();
+	UINT32 chunkDurationMillis = GetEncoderOptions()->GetChunkDurationMillis();
+	if (GetEncoderOptions()->GetMp4Muxer() == Mp4MuxerInternal::Native && chunkDurationMillis > 0 && maxUnchangedFrameDurationMillis > chunkDurationMillis) {
+		//Chunks are cut on video frames, so a frame held back while nothing changes would hold back the chunk, and the audio in it, for as long.
+		maxUnchangedFrameDurationMillis = chunkDurationMillis;
+		LOG_INFO(L"Limiting the duration of unchanged frames to the chunk duration of %u ms", chunkDurationMillis);
+	}
+	unchangedFrameFilter.Initialize(GetEncoderOptions()->GetIsUnchangedFrameSkippingEnabled(), MillisToHundredNanos(maxUnchangedFrameDurationMillis));
+	//The pointer as of the frame written last, to tell if it has moved since.
+	LONGLONG lastWrittenPointerTimeStamp = 0;
 
 	auto IsTimeToTakeSnapshot([&]()
 	{
@@ -493,7 +607,7 @@ REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_
 
 	auto ShouldSkipDelay([&](CAPTURED_FRAME capturedFrame)
 	{
-		if (m_OutputManager->GetRenderedFrameCount() == 0) {
+		if (frameNr == 0) {
 			return true;
 		}
 
@@ -540,37 +654,30 @@ REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_
 					LOG_ERROR("Error saving video snapshot: %ls", err.ErrorMessage());
 				}
 			}
-			//m_OutputManager->WriteFrameToImage(pTextureToRender, L"D:\\test\\beforemodel.png");
-			if (pPtrInfo) {
-				m_OutputManager->SetMousePtrInfo(pPtrInfo);
+
+			//Audio is written by the audio writer on its own timeline, so the video frames keep the timestamps of the media clock.
+			RETURN_ON_BAD_HR(renderHr = m_EncoderResult = pAudioWriter->GetResult());
+			if (pVideoWriter->IsWriting()) {
+				//The frame is copied and queued, and rendered on the writer thread. S_FALSE if the queue was full and a frame was dropped.
+				RETURN_ON_BAD_HR(renderHr = m_EncoderResult = pVideoWriter->WriteFrame(pTextureToRender, lastFrameStartPos100Nanos, duration100Nanos, pPtrInfo, sources[0]->ID));
 			}
-			//m_OutputManager->WriteFrameToImage(pTextureToRender, L"D:\\test\\aftermodel.png");
-
-			INT64 diff = 0;
-			auto audioBytes = pAudioManager->GrabAudioFrame(duration100Nanos);
-			if (audioBytes.size() > 0) {
-				INT64 frameCount = audioBytes.size() / (INT64)((GetAudioOptions()->GetAudioBitsPerSample() / 8) * GetAudioOptions()->GetAudioChannels());
-				INT64 newDuration = (frameCount * 10 * 1000 * 1000) / GetAudioOptions()->GetAudioSamplesPerSecond();
-				diff = newDuration - duration100Nanos;
+			else {
+				FrameWriteModel model{};
+				model.Frame = pTextureToRender;
+				model.Duration = duration100Nanos;
+				model.StartPos = lastFrameStartPos100Nanos;
+				model.PtrInfo = pPtrInfo;
+				model.DeviceId = sources[0]->ID;
+				RETURN_ON_BAD_HR(renderHr = m_EncoderResult = m_OutputManager->RenderFrame(model));
 			}
-
-			FrameWriteModel model{};
-			model.Frame = pTextureToRender;
-			model.Duration = duration100Nanos + diff;
-			model.StartPos = lastFrameStartPos100Nanos + totalDiff;
-			model.Audio = audioBytes;
-			m_OutputManager->SetDeviceId(sources[0]->ID);
-
-			RETURN_ON_BAD_HR(renderHr = m_EncoderResult = m_OutputManager->RenderFrame(model));
 			frameNr++;
-			totalDiff += diff;
 			if (RecordingFrameNumberChangedCallback != nullptr && !m_IsDestructing) {
 				INT64 timestamp = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
-				RecordingFrameNumberChangedCallback(frameNr, timestamp);
+				RecordingFrameNumberChangedCallback(frameNr, timestamp, (int)pVideoWriter->GetQueueDepth(), (int)pVideoWriter->GetDroppedFrameCount());
 			}
 			if (AudioRecordingVolumeChangedCallback != nullptr)
 			{
-				AudioRecordingVolumeChangedCallback(m_OutputManager->CurrentAudioVolume);
+				AudioRecordingVolumeChangedCallback(pAudioManager->GetCurrentVolume());
 			}
 			havePrematureFrame = false;
 			lastFrameStartPos100Nanos += duration100Nanos;
@@ -623,6 +730,12 @@ REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_
 
 						//Recreate D3D resources if needed
 						if (SUCCEEDED(hr) && result->IsDeviceError) {
+							//The queued frames were copied on the stale device, and the writer must not render while the output manager is reinitialized.
+							HRESULT videoWriterHr = pVideoWriter->StopWriting(true);
+							if (FAILED(videoWriterHr)) {
+								_com_error err(videoWriterHr);
+								LOG_WARN(L"Video writer stopped with an error on a device error: %s", err.ErrorMessage());
+							}
 							//Release texture created on the stale device
 							if (pPreviousFrameCopy) {
 								pPreviousFrameCopy.Release();
@@ -640,6 +753,15 @@ REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_
 							if (SUCCEEDED(hr)) {
 								hr = m_OutputManager->Initialize(m_DxResources.Context, m_DxResources.Device, GetEncoderOptions(), GetAudioOptions(), GetSnapshotOptions(), GetOutputOptions());
 							}
+							unchangedFrameFilter.Reset();
+						}
+						if (SUCCEEDED(hr) && pVideoWriter->IsWriting()) {
+							//Write out the queued frames, so nothing captured by the old capture manager is rendered once it is gone.
+							HRESULT videoWriterHr = pVideoWriter->StopWriting();
+							if (FAILED(videoWriterHr)) {
+								_com_error err(videoWriterHr);
+								LOG_WARN(L"Video writer stopped with an error on a recoverable error: %s", err.ErrorMessage());
+							}
 						}
 						//Recreate capture manager and restart capture
 						if (SUCCEEDED(hr)) {
@@ -658,6 +780,9 @@ REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_
 							hr = InitializeRects(pCapture->GetOutputSize(), &videoInputFrameRect, nullptr);
 							LOG_TRACE(L"Reinitialized input frame rect: [%d,%d,%d,%d]", videoInputFrameRect.left, videoInputFrameRect.top, videoInputFrameRect.right, videoInputFrameRect.bottom);
 						}
+						if (SUCCEEDED(hr) && !pVideoWriter->IsWriting()) {
+							hr = StartVideoWriter();
+						}
 
 						pPtrInfo = nullptr;
 						if (FAILED(hr)) {
@@ -684,8 +809,6 @@ REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_
 		if (m_OutputManager->isMediaClockPaused()) {
 			wait(10);
 			previousSnapshotTaken = steady_clock::now();
-			if (pAudioManager)
-				pAudioManager->ClearRecordedBytes();
 			continue;
 		}
 		
@@ -775,6 +898,21 @@ REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_
 			RETURN_RESULT_ON_BAD_HR(hr, L"");
 		}
 
+		if (recorderMode == RecorderModeInternal::Video) {
+			//A frame with no updates to the screen, the overlays or the pointer is left out, and the frame written last stays on screen for its time.
+			bool isFrameChanged = (SUCCEEDED(hr) && (capturedFrame.FrameUpdateCount > 0 || capturedFrame.OverlayUpdateCount > 0))
+				|| havePrematureFrame
+				|| (pPtrInfo && GetMouseOptions()->IsMousePointerEnabled() && pPtrInfo->LastTimeStamp.QuadPart != lastWrittenPointerTimeStamp)
+				|| (GetSnapshotOptions()->IsSnapshotWithVideoEnabled() && IsTimeToTakeSnapshot());
+			if (unchangedFrameFilter.ShouldSkipFrame(isFrameChanged, lastFrameStartPos100Nanos, durationSinceLastFrame100Nanos)) {
+				lastFrameStartPos100Nanos += durationSinceLastFrame100Nanos;
+				continue;
+			}
+			if (pPtrInfo) {
+				lastWrittenPointerTimeStamp = pPtrInfo->LastTimeStamp.QuadPart;
+			}
+		}
+
 		if (!pCurrentFrameCopy && !pPreviousFrameCopy) {
 			m_TextureManager->CreateTexture(videoOutputFrameSize.cx, videoOutputFrameSize.cy, &pCurrentFrameCopy, 0, D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE);
 		}
@@ -822,6 +960,69 @@ REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_
 		INT64 duration = timestamp - lastFrameStartPos100Nanos;
 		RETURN_RESULT_ON_BAD_HR(hr = PrepareAndRenderFrame(pPreviousFrameCopy, duration, sources[0]->SourcePath), L"Failed to render frame");
 	}
+	if (unchangedFrameFilter.IsEnabled()) {
+		UNCHANGED_FRAME_FILTER_STATS filterStats = unchangedFrameFilter.GetStats();
+		LOG_DEBUG(L"Skipped %llu unchanged video frames and repeated %llu, frames were shown for up to %.1f ms", filterStats.SkippedFrames, filterStats.RepeatedFrames, HundredNanosToMillisDouble(filterStats.MaxFrameDuration100Nanos));
+	}
+	//Renders the frames still queued.
+	HRESULT videoWriterHr = pVideoWriter->StopWriting();
+	if (FAILED(videoWriterHr)) {
+		m_EncoderResult = videoWriterHr;
+	}
+	RETURN_RESULT_ON_BAD_HR(videoWriterHr, L"Failed to write video");
+	HRESULT audioWriterHr = pAudioWriter->StopWriting();
+	if (FAILED(audioWriterHr)) {
+		m_EncoderResult = audioWriterHr;
+	}
+	RETURN_RESULT_ON_BAD_HR(audioWriterHr, L"Failed to write audio");
+	return CAPTURE_RESULT(hr);
+}
+
+REC_RESULT RecordingManager::StartAudioRecorderLoop(_In_opt_ IStream *pStream)
+{
+	HRESULT hr = S_OK;
+	if (!GetAudioOptions()->IsAudioEnabled()) {
+		return CAPTURE_RESULT(E_INVALIDARG, L"Audio only recording requires audio to be enabled");
+	}
+	//Unlike a video recording, which goes on without audio if the capture fails, there is nothing to record here without it.
+	std::unique_ptr<AudioManager> pAudioManager = make_unique<AudioManager>();
+	RETURN_RESULT_ON_BAD_HR(hr = pAudioManager->Initialize(GetAudioOptions()), L"Failed to initialize audio capture");
+	RETURN_RESULT_ON_BAD_HR(hr = pAudioManager->StartCapture(), L"Failed to start audio capture");
+	if (pStream) {
+		RETURN_RESULT_ON_BAD_HR(hr = m_OutputManager->BeginRecording(pStream, SIZE{}), L"Failed to initialize WAV writer");
+	}
+	else {
+		RETURN_RESULT_ON_BAD_HR(hr = m_OutputManager->BeginRecording(m_OutputFullPath, SIZE{}), L"Failed to initialize WAV writer");
+	}
+	pAudioManager->ClearRecordedBytes();
+	//Declared after the audio manager, so it stops writing before the audio manager goes away on any early return.
+	std::unique_ptr<AudioWriter> pAudioWriter = make_unique<AudioWriter>();
+	RETURN_RESULT_ON_BAD_HR(hr = pAudioWriter->StartWriting(pAudioManager.get(), m_OutputManager.get(),
+		GetAudioOptions()->GetAudioSamplesPerSecond(), GetAudioOptions()->GetAudioChannels(), GetAudioOptions()->GetAudioBitsPerSample()), L"Failed to start audio writer");
+	if (RecordingStatusChangedCallback != nullptr) {
+		RecordingStatusChangedCallback(STATUS_RECORDING);
+		LOG_DEBUG("Changed Recording Status to Recording");
+	}
+
+	//The audio writer paces itself, so this thread only watches for errors and reports the volume, at about the rate video frames would.
+	cancellation_token token = m_TaskWrapperImpl->m_RecordTaskCts.get_token();
+	while (!token.is_canceled()) {
+		if (FAILED(hr = m_EncoderResult = pAudioWriter->GetResult())) {
+			break;
+		}
+		if (AudioRecordingVolumeChangedCallback != nullptr && !m_OutputManager->isMediaClockPaused()) {
+			AudioRecordingVolumeChangedCallback(pAudioManager->GetCurrentVolume());
+		}
+		wait(AudioOnlyPollMillis);
+	}
+	if (token.is_canceled()) {
+		LOG_DEBUG("Recording task was cancelled");
+	}
+	HRESULT audioWriterHr = pAudioWriter->StopWriting();
+	if (FAILED(audioWriterHr)) {
+		m_EncoderResult = audioWriterHr;
+	}
+	RETURN_RESULT_ON_BAD_HR(audioWriterHr, L"Failed to write audio");
 	return CAPTURE_RESULT(hr);
 }
 
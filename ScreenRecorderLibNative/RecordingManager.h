@@ -9,9 +9,11 @@ typedef void(__stdcall *CallbackCompleteFunction)(std::wstring, nlohmann::fifo_m
 typedef void(__stdcall *CallbackStatusChangedFunction)(int);
 typedef void(__stdcall *CallbackErrorFunction)(std::wstring, std::wstring);
 typedef void(__stdcall *CallbackSnapshotFunction)(std::wstring);
-typedef void(__stdcall *CallbackFrameNumberChangedFunction)(int, INT64);
+typedef void(__stdcall *CallbackFrameNumberChangedFunction)(int, INT64, int, int);
 typedef void(__stdcall *CallbackAudioVolumeChangedFunction)(int);
 typedef void(__stdcall *CallbackRawFrameUpdateFunction)(BYTE[], long, long);
+typedef void(__stdcall *CallbackChunkWrittenFunction)(UINT32, UINT32, UINT64, UINT64, INT64, INT64, bool);
+typedef void(__stdcall *CallbackSegmentWrittenFunction)(UINT32, std::wstring, INT64, INT64, UINT64, INT64, UINT64);
 
 #define STATUS_IDLE 0
 #define STATUS_RECORDING 1
@@ -33,12 +35,19 @@ public:
 	CallbackFrameNumberChangedFunction RecordingFrameNumberChangedCallback;
 	CallbackAudioVolumeChangedFunction AudioRecordingVolumeChangedCallback;
 	CallbackRawFrameUpdateFunction RawFrameUpdateCallback;
+	CallbackChunkWrittenFunction RecordingChunkWrittenCallback;
+	CallbackSegmentWrittenFunction RecordingSegmentWrittenCallback;
 	HRESULT BeginRecording(_In_opt_ std::wstring path);
 	HRESULT BeginRecording(_In_opt_ std::wstring path, _In_opt_ IStream *stream);
 	HRESULT BeginRecording(_In_opt_ IStream *stream);
 	void EndRecording();
 	void PauseRecording();
 	void ResumeRecording();
+	/// <summary>
+	/// Saves what the instant replay keeps, the last seconds of the recording, to a new file at path, or to stream if there is no path, while the recording goes on.
+	/// The replay of a recording can still be saved once it has ended, until the next one begins. Fails with E_NOT_VALID_STATE if there is no replay to save.
+	/// </summary>
+	HRESULT SaveReplay(_In_opt_ std::wstring path, _In_opt_ IStream *stream, _Out_ REPLAY_SAVE_RESULT *pResult);
 
 	bool IsRecording() { return m_IsRecording; }
 
@@ -108,6 +117,8 @@ private:
 
 	std::unique_ptr<TextureManager> m_TextureManager;
 	std::unique_ptr<OutputManager> m_OutputManager;
+	//The instant replay of the current recording, or of the last one once it has ended.
+	std::shared_ptr<ReplayBuffer> m_ReplayBuffer;
 	HRESULT m_EncoderResult = E_FAIL;
 	HRESULT m_MfStartupResult = E_FAIL;
 	std::wstring m_OutputFolder = L"";
@@ -127,6 +138,10 @@ private:
 	bool CheckDependencies(_Out_ std::wstring *error);
 	HRESULT ConfigureOutputDir(_In_ std::wstring path);
 	REC_RESULT StartRecorderLoop(_In_ const std::vector<RECORDING_SOURCE *> &sources, _In_ const std::vector<RECORDING_OVERLAY *> &overlays, _In_opt_ IStream *pStream);
+	/// <summary>
+	/// Records audio only, to a WAV file. Only the audio capture, mix and writer run, paced by the audio writer thread, and nothing of the video pipeline is created.
+	/// </summary>
+	REC_RESULT StartAudioRecorderLoop(_In_opt_ IStream *pStream);
 
 	/// <summary>
 	/// Creates adjusted source and output rects from a recording frame rect. The source rect is normalized to start on [0,0], and the output is adjusted for any cropping.
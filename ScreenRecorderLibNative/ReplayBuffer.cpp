@@ -0,0 +1,384 @@
+#include "ReplayBuffer.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+namespace {
+	const INT64 HundredNanosPerSecond = 10000000;
+	//The sample table is sized for this many samples per second of the window if the options leave it to the buffer, e.g. 60 fps video with 48 kHz AAC takes 107.
+	const UINT64 TableSamplesPerSecond = 256;
+	const UINT64 MaxTableSamples = 16 * 1024 * 1024;
+	//A save copies the window out this many bytes at a time, so a sample being written waits no longer than a copy of this size.
+	const size_t SaveBatchBytes = 1024 * 1024;
+	//The place of a save that is not going on.
+	const UINT64 NoSaveSequence = UINT64_MAX;
+
+	struct REPLAY_ENTRY {
+		//Where the data of the sample is in the byte ring.
+		UINT64 Offset;
+		UINT32 Size;
+		UINT32 TrackIndex;
+		INT64 StartPos;
+		INT64 DecodePos;
+		INT64 Duration;
+		bool IsKeyFrame;
+	};
+}
+
+struct ReplayBuffer::STATE {
+	mutable std::mutex Mutex;
+	//Held by a save from start to end, so saves are done one at a time.
+	std::mutex SaveMutex;
+	REPLAY_BUFFER_OPTIONS Options;
+	bool IsInitialized = false;
+	std::vector<MP4_MUXER_TRACK> Tracks;
+	std::vector<bool> IsVideoTrack;
+	bool HasVideoTrack = false;
+	//The byte ring. The live data runs from ReadOffset to WriteOffset, or, once the writes have wrapped around to the start, from ReadOffset to the end of the last sample
+	//that fit before the end of the ring, and on from the start to WriteOffset.
+	std::unique_ptr<BYTE[]> Data;
+	UINT64 DataCapacity = 0;
+	UINT64 ReadOffset = 0;
+	UINT64 WriteOffset = 0;
+	bool IsWrapped = false;
+	//The samples of the window, by sequence number, from FirstSequence up to NextSequence, in a table of TableCapacity entries.
+	std::vector<REPLAY_ENTRY> Entries;
+	UINT32 TableCapacity = 0;
+	UINT64 FirstSequence = 0;
+	UINT64 NextSequence = 0;
+	//The sequence numbers of the samples a group of pictures starts on, oldest first, from FirstSyncPoint up to NextSyncPoint, in a table of TableCapacity entries.
+	//The window always starts on the first of them.
+	std::vector<UINT64> SyncPoints;
+	UINT64 FirstSyncPoint = 0;
+	UINT64 NextSyncPoint = 0;
+	UINT64 LiveBytes = 0;
+	//The end of the latest sample in the window, in decode time.
+	INT64 EndPos = 0;
+	//Set when a video frame is lost, as the frames after it can not be decoded until the next keyframe.
+	bool IsWaitingForKeyFrame = false;
+	//The first sample the save going on has still to copy. The window is not shortened for its duration past it.
+	UINT64 SaveSequence = NoSaveSequence;
+	REPLAY_BUFFER_STATS Stats{};
+
+	inline bool IsEmpty() const { return FirstSequence == NextSequence; }
+	inline REPLAY_ENTRY &GetEntry(_In_ UINT64 sequence) { return Entries[(size_t)(sequence % TableCapacity)]; }
+	inline UINT64 GetSyncPoint(_In_ UINT64 index) const { return SyncPoints[(size_t)(index % TableCapacity)]; }
+
+	/// <summary>
+	/// Finds room for a sample in the byte ring, after the latest sample, or at the start of the ring if it does not fit before the end. Returns false if there is none.
+	/// </summary>
+	bool Allocate(_In_ UINT32 size, _Out_ UINT64 *pOffset)
+	{
+		*pOffset = 0;
+		if (IsEmpty()) {
+			ReadOffset = 0;
+			WriteOffset = 0;
+			IsWrapped = false;
+		}
+		if (!IsWrapped) {
+			if (WriteOffset + size <= DataCapacity) {
+				*pOffset = WriteOffset;
+			}
+			else if (size <= ReadOffset) {
+				IsWrapped = true;
+			}
+			else {
+				return false;
+			}
+		}
+		else if (WriteOffset + size <= ReadOffset) {
+			*pOffset = WriteOffset;
+		}
+		else {
+			return false;
+		}
+		WriteOffset = *pOffset + size;
+		return true;
+	}
+
+	/// <summary>
+	/// Lets go of the group of pictures the window starts on, so it starts on the next one, or is empty if there is none.
+	/// </summary>
+	void EvictOldestGroup()
+	{
+		FirstSyncPoint++;
+		UINT64 endSequence = FirstSyncPoint < NextSyncPoint ? GetSyncPoint(FirstSyncPoint) : NextSequence;
+		for (; FirstSequence < endSequence; FirstSequence++) {
+			LiveBytes -= GetEntry(FirstSequence).Size;
+			Stats.EvictedSamples++;
+		}
+		if (IsEmpty()) {
+			return;
+		}
+		UINT64 readOffset = GetEntry(FirstSequence).Offset;
+		if (readOffset < ReadOffset) {
+			//The reads have wrapped around to the start of the ring too.
+			IsWrapped = false;
+		}
+		ReadOffset = readOffset;
+	}
+};
+
+ReplayBuffer::ReplayBuffer() :
+	m_State(std::make_unique<STATE>())
+{
+}
+
+ReplayBuffer::~ReplayBuffer()
+{
+}
+
+HRESULT ReplayBuffer::Initialize(_In_ const REPLAY_BUFFER_OPTIONS &options)
+{
+	if (options.Duration100Nanos <= 0) {
+		return E_INVALIDARG;
+	}
+	UINT64 tableCapacity = options.MaxSamples;
+	if (tableCapacity == 0) {
+		tableCapacity = (std::min)(((UINT64)options.Duration100Nanos / HundredNanosPerSecond + 1) * TableSamplesPerSecond, MaxTableSamples);
+	}
+	//The sample table may take no more than half of the memory, the rest is for the data of the samples.
+	UINT64 tableBytes = tableCapacity * (sizeof(REPLAY_ENTRY) + sizeof(UINT64));
+	if (options.MaxBytes < tableBytes * 2) {
+		return E_INVALIDARG;
+	}
+	std::lock_guard<std::mutex> lock(m_State->Mutex);
+	STATE &state = *m_State;
+	state.DataCapacity = options.MaxBytes - tableBytes;
+	//The data is left uninitialized, so its pages are only touched as the ring fills.
+	state.Data.reset(new (std::nothrow) BYTE[(size_t)state.DataCapacity]);
+	if (!state.Data) {
+		state.IsInitialized = false;
+		return E_OUTOFMEMORY;
+	}
+	state.Options = options;
+	state.TableCapacity = (UINT32)tableCapacity;
+	state.Entries.assign((size_t)tableCapacity, REPLAY_ENTRY{});
+	state.SyncPoints.assign((size_t)tableCapacity, 0);
+	state.Tracks.clear();
+	state.IsVideoTrack.clear();
+	state.HasVideoTrack = false;
+	state.ReadOffset = 0;
+	state.WriteOffset = 0;
+	state.IsWrapped = false;
+	state.FirstSequence = 0;
+	state.NextSequence = 0;
+	state.FirstSyncPoint = 0;
+	state.NextSyncPoint = 0;
+	state.LiveBytes = 0;
+	state.EndPos = 0;
+	state.IsWaitingForKeyFrame = false;
+	state.SaveSequence = NoSaveSequence;
+	state.Stats = REPLAY_BUFFER_STATS{};
+	state.Stats.MemoryBytes = state.DataCapacity + tableBytes;
+	state.IsInitialized = true;
+	return S_OK;
+}
+
+HRESULT ReplayBuffer::AddTrack(_In_ const MP4_MUXER_TRACK &track, _Out_opt_ UINT32 *pTrackIndex)
+{
+	std::lock_guard<std::mutex> lock(m_State->Mutex);
+	STATE &state = *m_State;
+	if (!state.IsInitialized || state.NextSequence > 0 || state.Stats.DroppedSamples > 0) {
+		return E_UNEXPECTED;
+	}
+	bool isVideo = track.Codec == Mp4Codec::H264 || track.Codec == Mp4Codec::HEVC;
+	state.Tracks.push_back(track);
+	state.IsVideoTrack.push_back(isVideo);
+	state.HasVideoTrack = state.HasVideoTrack || isVideo;
+	if (pTrackIndex) {
+		*pTrackIndex = (UINT32)(state.Tracks.size() - 1);
+	}
+	return S_OK;
+}
+
+HRESULT ReplayBuffer::WriteSample(_In_ UINT32 trackIndex, _In_ const MP4_MUXER_SAMPLE &sample)
+{
+	std::lock_guard<std::mutex> lock(m_State->Mutex);
+	STATE &state = *m_State;
+	if (!state.IsInitialized) {
+		return E_UNEXPECTED;
+	}
+	if (trackIndex >= state.Tracks.size() || (!sample.pData && sample.Size > 0)) {
+		return E_INVALIDARG;
+	}
+	bool isVideo = state.IsVideoTrack[trackIndex];
+	//A group of pictures starts on a video keyframe. Without video, every sample is one.
+	bool isSyncPoint = isVideo ? sample.IsKeyFrame : !state.HasVideoTrack;
+	if (isVideo && isSyncPoint) {
+		state.IsWaitingForKeyFrame = false;
+	}
+	bool isDropped = (state.IsEmpty() && !isSyncPoint) || (isVideo && state.IsWaitingForKeyFrame) || sample.Size > state.DataCapacity;
+	UINT64 offset = 0;
+	//Lets go of the oldest groups of pictures until the sample fits, which may take the whole window, and the sample with it if the window can not start on it.
+	while (!isDropped && (state.NextSequence - state.FirstSequence >= state.TableCapacity || !state.Allocate(sample.Size, &offset))) {
+		state.EvictOldestGroup();
+		isDropped = state.IsEmpty() && !isSyncPoint;
+	}
+	if (isDropped) {
+		if (isVideo) {
+			state.IsWaitingForKeyFrame = true;
+		}
+		state.Stats.DroppedSamples++;
+		return S_FALSE;
+	}
+	if (sample.Size > 0) {
+		memcpy(state.Data.get() + offset, sample.pData, sample.Size);
+	}
+	REPLAY_ENTRY &entry = state.GetEntry(state.NextSequence);
+	entry.Offset = offset;
+	entry.Size = sample.Size;
+	entry.TrackIndex = trackIndex;
+	entry.StartPos = sample.StartPos;
+	entry.DecodePos = sample.DecodePos;
+	entry.Duration = sample.Duration;
+	entry.IsKeyFrame = sample.IsKeyFrame;
+	INT64 endPos = sample.DecodePos + (std::max)(sample.Duration, (INT64)0);
+	state.EndPos = state.IsEmpty() ? endPos : (std::max)(state.EndPos, endPos);
+	if (isSyncPoint) {
+		state.SyncPoints[(size_t)(state.NextSyncPoint++ % state.TableCapacity)] = state.NextSequence;
+	}
+	state.NextSequence++;
+	state.LiveBytes += sample.Size;
+
+	//Lets go of the oldest group of pictures once the window lasts long enough without it, unless a save has still to copy it.
+	while (state.NextSyncPoint - state.FirstSyncPoint >= 2) {
+		UINT64 secondSyncPoint = state.GetSyncPoint(state.FirstSyncPoint + 1);
+		if (state.EndPos - state.GetEntry(secondSyncPoint).DecodePos < state.Options.Duration100Nanos || secondSyncPoint > state.SaveSequence) {
+			break;
+		}
+		state.EvictOldestGroup();
+	}
+	return S_OK;
+}
+
+HRESULT ReplayBuffer::Save(_In_ IStream *pStream, _In_ const MP4_MUXER_OPTIONS &options, _Out_ REPLAY_SAVE_RESULT *pResult)
+{
+	*pResult = REPLAY_SAVE_RESULT{};
+	if (!pStream) {
+		return E_INVALIDARG;
+	}
+	std::lock_guard<std::mutex> saveLock(m_State->SaveMutex);
+	STATE &state = *m_State;
+	HRESULT hr = S_OK;
+	FragmentedMp4Muxer muxer;
+	std::vector<MP4_MUXER_TRACK> tracks;
+	std::vector<REPLAY_ENTRY> batch;
+	std::vector<BYTE> batchData;
+	batchData.reserve(SaveBatchBytes * 2);
+	bool isStarted = false;
+	bool isMuxerInitialized = false;
+	UINT64 nextSequence = 0;
+	UINT64 endSequence = 0;
+	INT64 originPos = 0;
+	INT64 endPos = 0;
+	while (SUCCEEDED(hr)) {
+		batch.clear();
+		batchData.clear();
+		{
+			std::lock_guard<std::mutex> lock(state.Mutex);
+			if (!isStarted) {
+				if (!state.IsInitialized) {
+					hr = E_UNEXPECTED;
+					break;
+				}
+				if (state.IsEmpty()) {
+					hr = E_NOT_VALID_STATE;
+					break;
+				}
+				//The window as it is now is saved. Samples written from here on are not. The last save may have kept it from being shortened,
+				//so it is saved from the group of pictures it would start on without that, and lasts no more than a group of pictures longer than asked.
+				UINT64 syncPoint = state.FirstSyncPoint;
+				while (syncPoint + 1 < state.NextSyncPoint && state.EndPos - state.GetEntry(state.GetSyncPoint(syncPoint + 1)).DecodePos >= state.Options.Duration100Nanos) {
+					syncPoint++;
+				}
+				nextSequence = state.GetSyncPoint(syncPoint);
+				endSequence = state.NextSequence;
+				//Time 0 of the file is where the earliest track starts in the window.
+				std::vector<bool> isTrackStarted(state.Tracks.size(), false);
+				size_t startedTracks = 0;
+				originPos = INT64_MAX;
+				for (UINT64 sequence = nextSequence; sequence < endSequence && startedTracks < state.Tracks.size(); sequence++) {
+					const REPLAY_ENTRY &entry = state.GetEntry(sequence);
+					if (!isTrackStarted[entry.TrackIndex]) {
+						isTrackStarted[entry.TrackIndex] = true;
+						startedTracks++;
+						originPos = (std::min)(originPos, (std::min)(entry.DecodePos, entry.StartPos));
+					}
+				}
+				tracks = state.Tracks;
+				state.Stats.Saves++;
+				isStarted = true;
+			}
+			else if (state.FirstSequence > nextSequence) {
+				pResult->IsTruncated = true;
+				break;
+			}
+			for (; nextSequence < endSequence && batchData.size() < SaveBatchBytes; nextSequence++) {
+				const REPLAY_ENTRY &entry = state.GetEntry(nextSequence);
+				batch.push_back(entry);
+				batch.back().Offset = batchData.size();
+				batchData.insert(batchData.end(), state.Data.get() + entry.Offset, state.Data.get() + entry.Offset + entry.Size);
+			}
+			state.SaveSequence = nextSequence < endSequence ? nextSequence : NoSaveSequence;
+			state.Stats.MaxSaveBatchBytes = (std::max)(state.Stats.MaxSaveBatchBytes, (UINT64)batchData.size());
+		}
+		if (!isMuxerInitialized) {
+			isMuxerInitialized = true;
+			MP4_MUXER_OPTIONS muxerOptions = options;
+			muxerOptions.SegmentDuration100Nanos = 0;
+			muxerOptions.SegmentBytes = 0;
+			hr = muxer.Initialize(pStream, muxerOptions);
+			for (size_t i = 0; i < tracks.size() && SUCCEEDED(hr); i++) {
+				hr = muxer.AddTrack(tracks[i], nullptr);
+			}
+		}
+		for (size_t i = 0; i < batch.size() && SUCCEEDED(hr); i++) {
+			const REPLAY_ENTRY &entry = batch[i];
+			MP4_MUXER_SAMPLE sample;
+			sample.pData = batchData.data() + entry.Offset;
+			sample.Size = entry.Size;
+			sample.StartPos = entry.StartPos - originPos;
+			sample.DecodePos = entry.DecodePos - originPos;
+			sample.Duration = entry.Duration;
+			sample.IsKeyFrame = entry.IsKeyFrame;
+			hr = muxer.WriteSample(entry.TrackIndex, sample);
+			endPos = (std::max)(endPos, sample.DecodePos + (std::max)(sample.Duration, (INT64)0));
+		}
+		if (nextSequence >= endSequence) {
+			break;
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(state.Mutex);
+		state.SaveSequence = NoSaveSequence;
+		if (pResult->IsTruncated) {
+			state.Stats.TruncatedSaves++;
+		}
+	}
+	if (FAILED(hr)) {
+		return hr;
+	}
+	hr = muxer.Finalize();
+	if (FAILED(hr)) {
+		return hr;
+	}
+	MP4_MUXER_STATS stats = muxer.GetStats();
+	pResult->Samples = stats.Samples;
+	pResult->Bytes = stats.Writer.BytesWritten;
+	pResult->StartPos = originPos;
+	pResult->Duration = endPos;
+	return S_OK;
+}
+
+REPLAY_BUFFER_STATS ReplayBuffer::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(m_State->Mutex);
+	STATE &state = *m_State;
+	REPLAY_BUFFER_STATS stats = state.Stats;
+	stats.Samples = state.NextSequence - state.FirstSequence;
+	stats.Bytes = state.LiveBytes;
+	stats.Duration = state.IsEmpty() ? 0 : state.EndPos - state.GetEntry(state.FirstSequence).DecodePos;
+	return stats;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <windows.h>
+#include <objidl.h>
+#include <sal.h>
+#include <memory>
+#include <vector>
+#include "FragmentedMp4Muxer.h"
+
+struct REPLAY_BUFFER_OPTIONS {
+	//The window kept: the oldest group of pictures is let go once what is left without it still lasts this long, in 100 nanosecond units.
+	INT64 Duration100Nanos = 600000000;
+	//All the memory the buffer takes, the sample table included. Allocated on Initialize, and touched as the buffer fills.
+	//Once full, the oldest groups of pictures are let go to make room, so the window can be shorter than Duration100Nanos.
+	UINT64 MaxBytes = 256 * 1024 * 1024;
+	//The samples the table holds. 0 sizes it for Duration100Nanos at up to 256 samples per second, video and audio together.
+	UINT32 MaxSamples = 0;
+};
+
+struct REPLAY_BUFFER_STATS {
+	//What the window holds, and how long it lasts, from the keyframe it starts on to the end of the newest sample, in 100 nanosecond units.
+	UINT64 Samples;
+	UINT64 Bytes;
+	INT64 Duration;
+	//The memory the buffer took on Initialize.
+	UINT64 MemoryBytes;
+	//Samples let go from the front of the window.
+	UINT64 EvictedSamples;
+	//Samples never stored: the ones before a keyframe to start the window on, and ones larger than the whole buffer.
+	UINT64 DroppedSamples;
+	UINT64 Saves;
+	//Saves cut short, because the samples they had still to copy were let go to make room for new ones.
+	UINT64 TruncatedSaves;
+	//The most bytes a save copied out at once, which is what it can hold up writing a sample for.
+	UINT64 MaxSaveBatchBytes;
+};
+
+struct REPLAY_SAVE_RESULT {
+	UINT64 Samples;
+	UINT64 Bytes;
+	//Where the saved window started on the timeline of the recording, which is time 0 in the file, and how long it lasts, in 100 nanosecond units.
+	INT64 StartPos;
+	INT64 Duration;
+	//Whether the save ended before the end of the window, because the samples it had still to copy were let go to make room for new ones.
+	bool IsTruncated;
+};
+
+/// <summary>
+/// Keeps the last seconds of a recording in memory, as the encoded samples muxed with FragmentedMp4Muxer, so they can be saved to a file on request,
+/// e.g. for an instant replay. The samples go into a byte ring and a table of a fixed size, both allocated on Initialize, so writing a sample does not allocate.
+/// The window always starts on a video keyframe, and is let go a group of pictures at a time, from the front.
+/// A sample is written while a save is going on, and never waits for it: the save copies the window out in batches, and holds on to nothing but its place in it.
+/// While it does, the window is not shortened for its duration, only to make room, which cuts the save short if it reaches what the save has still to copy.
+/// Thread safe.
+/// </summary>
+class ReplayBuffer
+{
+public:
+	ReplayBuffer();
+	~ReplayBuffer();
+	HRESULT Initialize(_In_ const REPLAY_BUFFER_OPTIONS &options);
+	/// <summary>
+	/// Adds a track, as for FragmentedMp4Muxer::AddTrack. All tracks must be added before the first sample is written.
+	/// </summary>
+	HRESULT AddTrack(_In_ const MP4_MUXER_TRACK &track, _Out_opt_ UINT32 *pTrackIndex);
+	/// <summary>
+	/// Copies a sample into the buffer, as for FragmentedMp4Muxer::WriteSample, and lets go of what the window no longer needs.
+	/// Returns S_FALSE if the sample was dropped, because the window waits for a keyframe to start on, or the sample is larger than the whole buffer.
+	/// </summary>
+	HRESULT WriteSample(_In_ UINT32 trackIndex, _In_ const MP4_MUXER_SAMPLE &sample);
+	/// <summary>
+	/// Muxes the window as it is now into pStream, as a fragmented MP4 file with its start at time 0, while samples go on being written.
+	/// A window a save kept from being shortened is saved from where it would start without that.
+	/// The options are of the muxer writing the file, and should not split it into segments. Saves are done one at a time.
+	/// Fails with E_NOT_VALID_STATE if there is nothing to save yet.
+	/// </summary>
+	HRESULT Save(_In_ IStream *pStream, _In_ const MP4_MUXER_OPTIONS &options, _Out_ REPLAY_SAVE_RESULT *pResult);
+	REPLAY_BUFFER_STATS GetStats() const;
+private:
+	struct STATE;
+	std::unique_ptr<STATE> m_State;
+};
@@ -0,0 +1,54 @@
+#include "Simd.util.h"
+#if SIMD_X86 && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static SimdLevel DetectSimdLevel()
+{
+#if SIMD_X86
+#if defined(_MSC_VER)
+	int cpuInfo[4]{};
+	__cpuid(cpuInfo, 0);
+	int maxLeaf = cpuInfo[0];
+	__cpuid(cpuInfo, 1);
+	bool hasSse2 = (cpuInfo[3] & (1 << 26)) != 0;
+	bool hasOsxsave = (cpuInfo[2] & (1 << 27)) != 0;
+	bool hasAvx = (cpuInfo[2] & (1 << 28)) != 0;
+	bool hasFma = (cpuInfo[2] & (1 << 12)) != 0;
+	bool hasAvx2 = false;
+	if (maxLeaf >= 7) {
+		__cpuidex(cpuInfo, 7, 0);
+		hasAvx2 = (cpuInfo[1] & (1 << 5)) != 0;
+	}
+	//The OS must save the YMM registers on context switches for AVX to be usable.
+	bool osSupportsYmm = hasOsxsave && (_xgetbv(0) & 0x6) == 0x6;
+	if (hasAvx && hasAvx2 && hasFma && osSupportsYmm) {
+		return SimdLevel::AVX2;
+	}
+	return hasSse2 ? SimdLevel::SSE2 : SimdLevel::Scalar;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		return SimdLevel::AVX2;
+	}
+	return __builtin_cpu_supports("sse2") ? SimdLevel::SSE2 : SimdLevel::Scalar;
+#endif
+#else
+	return SimdLevel::Scalar;
+#endif
+}
+
+SimdLevel GetSupportedSimdLevel()
+{
+	static const SimdLevel level = DetectSimdLevel();
+	return level;
+}
+
+SimdLevel ResolveSimdLevel(SimdLevel requested)
+{
+	SimdLevel supported = GetSupportedSimdLevel();
+	if (requested == SimdLevel::Auto || (int)requested > (int)supported) {
+		return supported;
+	}
+	return requested;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#else
+#define SIMD_X86 0
+#endif
+
+//MSVC allows AVX2 intrinsics in any function, other compilers need the target attribute on the function using them.
+#if SIMD_X86 && !defined(_MSC_VER)
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define SIMD_TARGET_AVX2
+#endif
+
+enum class SimdLevel {
+	Scalar = 0,
+	SSE2 = 1,
+	AVX2 = 2,
+	/// <summary>
+	/// Use the highest level supported by the CPU.
+	/// </summary>
+	Auto = 100
+};
+
+/// <summary>
+/// Returns the highest SIMD instruction set that is supported by both the CPU and the operating system. The result is cached after the first call.
+/// </summary>
+SimdLevel GetSupportedSimdLevel();
+
+/// <summary>
+/// Resolves SimdLevel::Auto to the supported level, and lowers any requested level the CPU does not support.
+/// </summary>
+SimdLevel ResolveSimdLevel(SimdLevel requested);
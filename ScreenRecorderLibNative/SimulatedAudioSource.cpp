@@ -0,0 +1,339 @@
+#include "SimulatedAudioSource.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace {
+	const double Pi = 3.14159265358979323846;
+
+	inline UINT32 ReadUInt32(_In_reads_(4) const BYTE *pData)
+	{
+		return (UINT32)pData[0] | ((UINT32)pData[1] << 8) | ((UINT32)pData[2] << 16) | ((UINT32)pData[3] << 24);
+	}
+
+	inline UINT16 ReadUInt16(_In_reads_(2) const BYTE *pData)
+	{
+		return (UINT16)(pData[0] | (pData[1] << 8));
+	}
+}
+
+SimulatedAudioSource::SimulatedAudioSource() :
+	m_Options{},
+	m_PacketFrames(0),
+	m_Clock(0),
+	m_PacketIndex(0),
+	m_PacketReadyTime(0),
+	m_LostFrames(0),
+	m_IsDiscontinuity(false),
+	m_IsBufferHeld(false),
+	m_IsPacketRendered(false),
+	m_IsPacketSilent(false),
+	m_RandomState(1)
+{
+}
+
+SimulatedAudioSource::~SimulatedAudioSource()
+{
+}
+
+HRESULT SimulatedAudioSource::InitializeTiming(_In_ const SIMULATED_CAPTURE_OPTIONS &options)
+{
+	if (options.SampleRate == 0 || options.Channels == 0 || options.PacketDuration100Nanos == 0 || options.DriftPpm <= -1000000) {
+		return E_INVALIDARG;
+	}
+	m_Options = options;
+	m_PacketFrames = (std::max)(1u, (UINT32)llround((double)options.SampleRate * options.PacketDuration100Nanos / 10000000.0));
+	m_Packet.assign((size_t)m_PacketFrames * options.Channels, 0.0f);
+	//Xorshift needs a nonzero state.
+	m_RandomState = options.Seed != 0 ? options.Seed : 1;
+	m_Clock = 0;
+	m_PacketIndex = 0;
+	m_LostFrames = 0;
+	m_IsDiscontinuity = false;
+	m_IsBufferHeld = false;
+	m_IsPacketRendered = false;
+	m_PacketReadyTime = GetPacketReadyTime(0);
+	return S_OK;
+}
+
+void SimulatedAudioSource::AdvanceClock(_In_ UINT64 hundredNanos)
+{
+	m_Clock += hundredNanos;
+}
+
+HRESULT SimulatedAudioSource::GetNextPacketSize(_Out_ UINT32 *pNumFramesInNextPacket)
+{
+	*pNumFramesInNextPacket = 0;
+	if (m_PacketFrames == 0) {
+		return E_UNEXPECTED;
+	}
+	//Lost packets are rendered and thrown away, so the signal continues after the gap as it would on a real device.
+	while (m_Options.DiscontinuityInterval > 0
+		&& m_Clock >= m_PacketReadyTime
+		&& (m_PacketIndex + 1) % m_Options.DiscontinuityInterval == 0) {
+		bool isSilent;
+		Render(m_Packet.data(), m_PacketFrames, &isSilent);
+		m_LostFrames += m_PacketFrames;
+		m_IsDiscontinuity = true;
+		NextPacket();
+	}
+	if (m_Clock >= m_PacketReadyTime) {
+		*pNumFramesInNextPacket = m_PacketFrames;
+	}
+	return S_OK;
+}
+
+HRESULT SimulatedAudioSource::GetBuffer(_Outptr_ BYTE **ppData, _Out_ UINT32 *pNumFramesToRead, _Out_ DWORD *pdwFlags, _Out_opt_ UINT64 *pu64DevicePosition, _Out_opt_ UINT64 *pu64QPCPosition)
+{
+	*ppData = nullptr;
+	*pNumFramesToRead = 0;
+	*pdwFlags = 0;
+	if (m_IsBufferHeld) {
+		return E_UNEXPECTED;
+	}
+	UINT32 frames;
+	HRESULT hr = GetNextPacketSize(&frames);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	if (frames == 0) {
+		return E_UNEXPECTED;
+	}
+	if (!m_IsPacketRendered) {
+		Render(m_Packet.data(), frames, &m_IsPacketSilent);
+		m_IsPacketRendered = true;
+	}
+	DWORD flags = 0;
+	if (m_IsPacketSilent) {
+		flags |= AUDIO_CAPTURE_FLAG_SILENT;
+	}
+	if (m_IsDiscontinuity) {
+		flags |= AUDIO_CAPTURE_FLAG_DATA_DISCONTINUITY;
+	}
+	*ppData = reinterpret_cast<BYTE *>(m_Packet.data());
+	*pNumFramesToRead = frames;
+	*pdwFlags = flags;
+	if (pu64DevicePosition) {
+		*pu64DevicePosition = m_PacketIndex * m_PacketFrames;
+	}
+	if (pu64QPCPosition) {
+		*pu64QPCPosition = m_PacketIndex > 0 ? GetPacketEndTime(m_PacketIndex - 1) : 0;
+	}
+	m_IsBufferHeld = true;
+	return S_OK;
+}
+
+HRESULT SimulatedAudioSource::ReleaseBuffer(_In_ UINT32 numFramesRead)
+{
+	if (!m_IsBufferHeld) {
+		return E_UNEXPECTED;
+	}
+	m_IsBufferHeld = false;
+	//As with WASAPI, releasing 0 frames leaves the packet to be read again.
+	if (numFramesRead > 0) {
+		m_IsDiscontinuity = false;
+		NextPacket();
+	}
+	return S_OK;
+}
+
+UINT32 SimulatedAudioSource::NextRandom()
+{
+	m_RandomState ^= m_RandomState << 13;
+	m_RandomState ^= m_RandomState >> 17;
+	m_RandomState ^= m_RandomState << 5;
+	return m_RandomState;
+}
+
+UINT64 SimulatedAudioSource::GetPacketEndTime(_In_ UINT64 packetIndex) const
+{
+	double deviceRate = m_Options.SampleRate * (1.0 + m_Options.DriftPpm / 1000000.0);
+	double endTime = (packetIndex + 1) * (double)m_PacketFrames / deviceRate * 10000000.0;
+	if (m_Options.PauseInterval100Nanos > 0) {
+		//Every pause that began before the packet started delays it.
+		double startTime = packetIndex * (double)m_PacketFrames / deviceRate * 10000000.0;
+		endTime += (double)((UINT64)startTime / m_Options.PauseInterval100Nanos * m_Options.Pause100Nanos);
+	}
+	return (UINT64)llround(endTime);
+}
+
+UINT64 SimulatedAudioSource::GetPacketReadyTime(_In_ UINT64 packetIndex)
+{
+	UINT64 readyTime = GetPacketEndTime(packetIndex);
+	if (m_Options.Jitter100Nanos > 0) {
+		readyTime += NextRandom() % m_Options.Jitter100Nanos;
+	}
+	return readyTime;
+}
+
+void SimulatedAudioSource::NextPacket()
+{
+	m_PacketIndex++;
+	m_IsPacketRendered = false;
+	//A device never delivers packets out of order, so a late packet holds back the ones after it.
+	m_PacketReadyTime = (std::max)(m_PacketReadyTime, GetPacketReadyTime(m_PacketIndex));
+}
+
+SyntheticAudioSource::SyntheticAudioSource() :
+	m_Signal(SyntheticAudioSignal::Silence),
+	m_Amplitude(0),
+	m_PhaseIncrement(0),
+	m_Phase(0)
+{
+}
+
+SyntheticAudioSource::~SyntheticAudioSource()
+{
+}
+
+HRESULT SyntheticAudioSource::Initialize(_In_ const SIMULATED_CAPTURE_OPTIONS &options, _In_ SyntheticAudioSignal signal, _In_ float amplitude, _In_ float frequency)
+{
+	HRESULT hr = InitializeTiming(options);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	m_Signal = signal;
+	m_Amplitude = amplitude;
+	m_PhaseIncrement = 2.0 * Pi * frequency / options.SampleRate;
+	m_Phase = 0;
+	return S_OK;
+}
+
+void SyntheticAudioSource::Render(_Out_writes_(frames *GetChannels()) float *pDest, _In_ UINT32 frames, _Out_ bool *pIsSilent)
+{
+	UINT32 channels = GetChannels();
+	switch (m_Signal) {
+		case SyntheticAudioSignal::Sine:
+			for (UINT32 frame = 0; frame < frames; frame++) {
+				for (UINT32 channel = 0; channel < channels; channel++) {
+					pDest[frame * channels + channel] = m_Amplitude * (float)sin(m_Phase + channel * Pi / 2);
+				}
+				m_Phase += m_PhaseIncrement;
+			}
+			m_Phase = fmod(m_Phase, 2.0 * Pi);
+			*pIsSilent = m_Amplitude == 0;
+			break;
+		case SyntheticAudioSignal::Noise:
+			for (size_t i = 0; i < (size_t)frames * channels; i++) {
+				pDest[i] = m_Amplitude * ((float)NextRandom() / 2147483648.0f - 1.0f);
+			}
+			*pIsSilent = m_Amplitude == 0;
+			break;
+		default:
+			memset(pDest, 0, (size_t)frames * channels * sizeof(float));
+			*pIsSilent = true;
+			break;
+	}
+}
+
+WavFileAudioSource::WavFileAudioSource() :
+	m_ReadFrame(0)
+{
+}
+
+WavFileAudioSource::~WavFileAudioSource()
+{
+}
+
+HRESULT WavFileAudioSource::Initialize(_In_ const std::wstring &path, _In_ SIMULATED_CAPTURE_OPTIONS options)
+{
+	HRESULT hr = Load(path, &options.SampleRate, &options.Channels);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	m_ReadFrame = 0;
+	return InitializeTiming(options);
+}
+
+HRESULT WavFileAudioSource::Load(_In_ const std::wstring &path, _Out_ UINT32 *pSampleRate, _Out_ UINT32 *pChannels)
+{
+	*pSampleRate = 0;
+	*pChannels = 0;
+	std::ifstream file(std::filesystem::path(path), std::ios::binary);
+	if (!file) {
+		return E_FAIL;
+	}
+	std::vector<BYTE> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if (data.size() < 12 || memcmp(data.data(), "RIFF", 4) != 0 || memcmp(data.data() + 8, "WAVE", 4) != 0) {
+		return E_INVALIDARG;
+	}
+	UINT16 formatTag = 0;
+	UINT16 channels = 0;
+	UINT32 sampleRate = 0;
+	UINT16 bitsPerSample = 0;
+	const BYTE *pSampleData = nullptr;
+	size_t sampleDataBytes = 0;
+	for (size_t offset = 12; offset + 8 <= data.size();) {
+		const BYTE *pChunk = data.data() + offset;
+		size_t chunkBytes = (std::min)((size_t)ReadUInt32(pChunk + 4), data.size() - offset - 8);
+		if (memcmp(pChunk, "fmt ", 4) == 0 && chunkBytes >= 16) {
+			formatTag = ReadUInt16(pChunk + 8);
+			channels = ReadUInt16(pChunk + 10);
+			sampleRate = ReadUInt32(pChunk + 12);
+			bitsPerSample = ReadUInt16(pChunk + 22);
+			//WAVE_FORMAT_EXTENSIBLE keeps the actual format tag in the first two bytes of the sub format GUID.
+			if (formatTag == 0xFFFE && chunkBytes >= 40) {
+				formatTag = ReadUInt16(pChunk + 32);
+			}
+		}
+		else if (memcmp(pChunk, "data", 4) == 0) {
+			pSampleData = pChunk + 8;
+			sampleDataBytes = chunkBytes;
+		}
+		//Chunks are padded to an even size.
+		offset += 8 + chunkBytes + (chunkBytes & 1);
+	}
+	bool isPcm = formatTag == 1 && (bitsPerSample == 16 || bitsPerSample == 24 || bitsPerSample == 32);
+	bool isFloat = formatTag == 3 && bitsPerSample == 32;
+	if ((!isPcm && !isFloat) || channels == 0 || sampleRate == 0 || pSampleData == nullptr) {
+		return E_INVALIDARG;
+	}
+	size_t bytesPerSample = bitsPerSample / 8;
+	size_t frameCount = sampleDataBytes / (bytesPerSample * channels);
+	if (frameCount == 0) {
+		return E_INVALIDARG;
+	}
+	m_Samples.resize(frameCount * channels);
+	for (size_t i = 0; i < m_Samples.size(); i++) {
+		const BYTE *pSample = pSampleData + i * bytesPerSample;
+		float value;
+		if (isFloat) {
+			memcpy(&value, pSample, sizeof(float));
+		}
+		else if (bitsPerSample == 16) {
+			value = (int16_t)ReadUInt16(pSample) / 32768.0f;
+		}
+		else if (bitsPerSample == 24) {
+			//Shifted into the top of a 32 bit integer to sign extend it.
+			int32_t sample = (int32_t)(((UINT32)pSample[0] << 8) | ((UINT32)pSample[1] << 16) | ((UINT32)pSample[2] << 24));
+			value = sample / 2147483648.0f;
+		}
+		else {
+			value = (int32_t)ReadUInt32(pSample) / 2147483648.0f;
+		}
+		m_Samples[i] = value;
+	}
+	*pSampleRate = sampleRate;
+	*pChannels = channels;
+	return S_OK;
+}
+
+void WavFileAudioSource::Render(_Out_writes_(frames *GetChannels()) float *pDest, _In_ UINT32 frames, _Out_ bool *pIsSilent)
+{
+	UINT32 channels = GetChannels();
+	size_t fileFrames = m_Samples.size() / channels;
+	bool isSilent = true;
+	for (UINT32 written = 0; written < frames;) {
+		size_t count = (std::min)((size_t)(frames - written), fileFrames - m_ReadFrame);
+		const float *pSource = m_Samples.data() + m_ReadFrame * channels;
+		memcpy(pDest + (size_t)written * channels, pSource, count * channels * sizeof(float));
+		for (size_t i = 0; i < count * channels && isSilent; i++) {
+			isSilent = pSource[i] == 0;
+		}
+		written += (UINT32)count;
+		m_ReadFrame = (m_ReadFrame + count) % fileFrames;
+	}
+	*pIsSilent = isSilent;
+}
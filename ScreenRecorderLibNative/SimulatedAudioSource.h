@@ -0,0 +1,131 @@
+#pragma once
+#include <windows.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sal.h>
+#include "AudioCaptureSource.h"
+
+/// <summary>
+/// The timing of the packets of a simulated capture device.
+/// </summary>
+struct SIMULATED_CAPTURE_OPTIONS {
+	UINT32 SampleRate = 48000;
+	UINT32 Channels = 2;
+	//Time between packets. Shared mode WASAPI streams deliver one packet per device period, which is 10 ms by default.
+	UINT64 PacketDuration100Nanos = 100000;
+	//How much faster the device clock runs than the simulated clock, in parts per million. Negative if it runs slower.
+	double DriftPpm = 0;
+	//Each packet becomes ready up to this much later than the end of the audio it holds, so a reader polling the source sees zero or several packets at a time.
+	UINT64 Jitter100Nanos = 0;
+	//If not 0, every Nth packet is lost and the packet after it is flagged as a discontinuity.
+	UINT32 DiscontinuityInterval = 0;
+	//If not 0, the device stops delivering packets for Pause100Nanos after every PauseInterval100Nanos of audio, as a loopback device does while nothing plays.
+	//Its clock stands still in the meantime, so the device positions go on where they stopped.
+	UINT64 PauseInterval100Nanos = 0;
+	UINT64 Pause100Nanos = 0;
+	//Seed for the jitter, and for the signal of generators that use random numbers.
+	UINT32 Seed = 1;
+};
+
+/// <summary>
+/// A capture device stand in, driven by a simulated clock instead of audio hardware.
+/// Packets become ready as AdvanceClock moves the clock past their end, with the drift, jitter and discontinuities set in the options.
+/// Derived classes render the signal. Not thread safe.
+/// </summary>
+class SimulatedAudioSource : public IAudioCaptureSource
+{
+public:
+	SimulatedAudioSource();
+	virtual ~SimulatedAudioSource();
+	/// <summary>
+	/// Advances the simulated clock. Packets that became ready by the new time can then be read.
+	/// </summary>
+	void AdvanceClock(_In_ UINT64 hundredNanos);
+	inline UINT64 GetClock() const { return m_Clock; }
+	inline UINT32 GetPacketFrames() const { return m_PacketFrames; }
+	/// <summary>
+	/// The simulated time at which the next packet becomes ready, i.e. when a device would signal an event driven capture.
+	/// </summary>
+	inline UINT64 GetNextPacketReadyTime() const { return m_PacketReadyTime; }
+	/// <summary>
+	/// The number of frames lost to simulated discontinuities.
+	/// </summary>
+	inline UINT64 GetLostFrames() const { return m_LostFrames; }
+
+	UINT32 GetSampleRate() override { return m_Options.SampleRate; }
+	UINT32 GetChannels() override { return m_Options.Channels; }
+	HRESULT GetNextPacketSize(_Out_ UINT32 *pNumFramesInNextPacket) override;
+	HRESULT GetBuffer(_Outptr_ BYTE **ppData, _Out_ UINT32 *pNumFramesToRead, _Out_ DWORD *pdwFlags, _Out_opt_ UINT64 *pu64DevicePosition, _Out_opt_ UINT64 *pu64QPCPosition) override;
+	HRESULT ReleaseBuffer(_In_ UINT32 numFramesRead) override;
+protected:
+	HRESULT InitializeTiming(_In_ const SIMULATED_CAPTURE_OPTIONS &options);
+	/// <summary>
+	/// Renders the next frames of the signal as interleaved float. Sets pIsSilent to true if the frames are all zero.
+	/// </summary>
+	virtual void Render(_Out_writes_(frames *GetChannels()) float *pDest, _In_ UINT32 frames, _Out_ bool *pIsSilent) = 0;
+	UINT32 NextRandom();
+private:
+	SIMULATED_CAPTURE_OPTIONS m_Options;
+	UINT32 m_PacketFrames;
+	UINT64 m_Clock;
+	UINT64 m_PacketIndex;
+	UINT64 m_PacketReadyTime;
+	UINT64 m_LostFrames;
+	bool m_IsDiscontinuity;
+	bool m_IsBufferHeld;
+	//The packet is rendered once, so a packet released with 0 frames is read again unchanged.
+	bool m_IsPacketRendered;
+	bool m_IsPacketSilent;
+	UINT32 m_RandomState;
+	std::vector<float> m_Packet;
+
+	UINT64 GetPacketEndTime(_In_ UINT64 packetIndex) const;
+	UINT64 GetPacketReadyTime(_In_ UINT64 packetIndex);
+	void NextPacket();
+};
+
+enum class SyntheticAudioSignal {
+	Silence,
+	Sine,
+	Noise
+};
+
+/// <summary>
+/// A simulated capture device that generates silence, a sine tone or white noise.
+/// Silence is delivered as packets flagged silent, the same way WASAPI loopback capture reports an idle output device.
+/// </summary>
+class SyntheticAudioSource : public SimulatedAudioSource
+{
+public:
+	SyntheticAudioSource();
+	~SyntheticAudioSource();
+	/// <param name="amplitude">Peak level of the signal, where 1.0 is full scale.</param>
+	/// <param name="frequency">The frequency of the sine tone in Hz. Each channel is shifted in phase, so channels are distinguishable.</param>
+	HRESULT Initialize(_In_ const SIMULATED_CAPTURE_OPTIONS &options, _In_ SyntheticAudioSignal signal, _In_ float amplitude = 0.5f, _In_ float frequency = 440.0f);
+protected:
+	void Render(_Out_writes_(frames *GetChannels()) float *pDest, _In_ UINT32 frames, _Out_ bool *pIsSilent) override;
+private:
+	SyntheticAudioSignal m_Signal;
+	float m_Amplitude;
+	double m_PhaseIncrement;
+	double m_Phase;
+};
+
+/// <summary>
+/// A simulated capture device that plays a WAV file in a loop. 16, 24 and 32 bit integer PCM and 32 bit float files are supported.
+/// The sample rate and channel count of the file replace those in the options.
+/// </summary>
+class WavFileAudioSource : public SimulatedAudioSource
+{
+public:
+	WavFileAudioSource();
+	~WavFileAudioSource();
+	HRESULT Initialize(_In_ const std::wstring &path, _In_ SIMULATED_CAPTURE_OPTIONS options);
+protected:
+	void Render(_Out_writes_(frames *GetChannels()) float *pDest, _In_ UINT32 frames, _Out_ bool *pIsSilent) override;
+private:
+	std::vector<float> m_Samples;
+	size_t m_ReadFrame;
+	HRESULT Load(_In_ const std::wstring &path, _Out_ UINT32 *pSampleRate, _Out_ UINT32 *pChannels);
+};
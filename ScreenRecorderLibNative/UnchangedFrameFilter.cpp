@@ -0,0 +1,49 @@
+#include "UnchangedFrameFilter.h"
+#include <algorithm>
+
+UnchangedFrameFilter::UnchangedFrameFilter() :
+	m_IsEnabled(false),
+	m_MaxFrameDuration100Nanos(0),
+	m_HasWrittenFrame(false),
+	m_LastWrittenStartPos(0),
+	m_Stats{}
+{
+}
+
+void UnchangedFrameFilter::Initialize(_In_ bool isEnabled, _In_ INT64 maxFrameDuration100Nanos)
+{
+	m_IsEnabled = isEnabled && maxFrameDuration100Nanos > 0;
+	m_MaxFrameDuration100Nanos = maxFrameDuration100Nanos;
+	m_Stats = UNCHANGED_FRAME_FILTER_STATS{};
+	Reset();
+}
+
+bool UnchangedFrameFilter::ShouldSkipFrame(_In_ bool isChanged, _In_ INT64 startPos, _In_ INT64 duration)
+{
+	if (m_IsEnabled && !isChanged && m_HasWrittenFrame) {
+		//How long the frame written last would be shown for if this one is left out.
+		if (startPos + duration - m_LastWrittenStartPos <= m_MaxFrameDuration100Nanos) {
+			m_Stats.SkippedFrames++;
+			return true;
+		}
+		m_Stats.RepeatedFrames++;
+	}
+	OnFrameWritten(startPos);
+	return false;
+}
+
+void UnchangedFrameFilter::Reset()
+{
+	m_HasWrittenFrame = false;
+}
+
+void UnchangedFrameFilter::OnFrameWritten(_In_ INT64 startPos)
+{
+	if (m_HasWrittenFrame) {
+		//The frame before is shown until this one starts, whatever duration it was written with.
+		m_Stats.MaxFrameDuration100Nanos = (std::max)(m_Stats.MaxFrameDuration100Nanos, startPos - m_LastWrittenStartPos);
+	}
+	m_HasWrittenFrame = true;
+	m_LastWrittenStartPos = startPos;
+	m_Stats.WrittenFrames++;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+
+struct UNCHANGED_FRAME_FILTER_STATS {
+	UINT64 WrittenFrames;
+	//Frames skipped because nothing changed since the frame before.
+	UINT64 SkippedFrames;
+	//Unchanged frames written anyway, because the frame last written had been shown for the longest time allowed.
+	UINT64 RepeatedFrames;
+	//The longest time a written frame was shown for, in 100 nanosecond units.
+	INT64 MaxFrameDuration100Nanos;
+};
+
+/// <summary>
+/// Decides which of the frames due to be written carry nothing new and can be left out of the video. The frame written last then stays on screen
+/// until the next frame written, as the container takes the duration of a sample from the timestamp of the next one. A frame is only skipped as
+/// long as the frame written last would not be shown for longer than the maximum duration, so an unchanged screen still gets a frame at a
+/// steady cadence, which keeps the encoder producing keyframes and the video seekable.
+/// </summary>
+class UnchangedFrameFilter
+{
+public:
+	UnchangedFrameFilter();
+	/// <summary>
+	/// Sets up the filter. If not enabled, every frame is written, for a video with a constant frame rate.
+	/// </summary>
+	void Initialize(_In_ bool isEnabled, _In_ INT64 maxFrameDuration100Nanos);
+	/// <summary>
+	/// Called for each frame due to be written, lasting from startPos for duration. Returns true if the frame can be skipped, in which case
+	/// it must not be written, but its time must still be taken from the timeline, so the next frame starts after it.
+	/// </summary>
+	bool ShouldSkipFrame(_In_ bool isChanged, _In_ INT64 startPos, _In_ INT64 duration);
+	/// <summary>
+	/// Makes the next frame be written, as after a reinitialized capture.
+	/// </summary>
+	void Reset();
+	inline bool IsEnabled() const { return m_IsEnabled; }
+	inline UNCHANGED_FRAME_FILTER_STATS GetStats() const { return m_Stats; }
+private:
+	bool m_IsEnabled;
+	INT64 m_MaxFrameDuration100Nanos;
+	bool m_HasWrittenFrame;
+	INT64 m_LastWrittenStartPos;
+	UNCHANGED_FRAME_FILTER_STATS m_Stats;
+
+	void OnFrameWritten(_In_ INT64 startPos);
+};
@@ -0,0 +1,420 @@
+#include "VideoColorConverter.h"
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace {
+	//The luma is scaled by 2^14. The chroma is computed from the sum of four pixels, which adds another factor of 4.
+	const int LumaShift = 14;
+	const int ChromaShift = LumaShift + 2;
+	const INT32 ChromaOffset = (128 << ChromaShift) + (1 << (ChromaShift - 1));
+	//Without a thread count given, up to this many threads convert a frame, leaving the other cores to the capture and the encoder.
+	const UINT32 MaxDefaultThreads = 4;
+	//Stripes are not made shorter than this, so small frames are not spread over threads that would spend more time waking up than converting.
+	const UINT32 MinStripeRows = 64;
+
+	inline BYTE Clamp(_In_ INT32 value)
+	{
+		return (BYTE)(std::min)((std::max)(value, 0), 255);
+	}
+
+	inline BYTE ComputeLuma(_In_ const BYTE *pPixel, _In_ const VIDEO_COLOR_COEFFICIENTS &coefficients)
+	{
+		INT32 sum = coefficients.Luma[0] * pPixel[0] + coefficients.Luma[1] * pPixel[1] + coefficients.Luma[2] * pPixel[2] + coefficients.LumaOffset;
+		return Clamp(sum >> LumaShift);
+	}
+
+	inline BYTE ComputeChroma(_In_ const INT16 *pCoefficients, _In_ const INT32 *pSums)
+	{
+		return Clamp((pCoefficients[0] * pSums[0] + pCoefficients[1] * pSums[1] + pCoefficients[2] * pSums[2] + ChromaOffset) >> ChromaShift);
+	}
+
+	/// <summary>
+	/// Converts the pixels from start up to width of a pair of rows. An odd last column is treated as a column pair of two equal columns.
+	/// </summary>
+	void ConvertRowPairScalar(const BYTE *pSource0, const BYTE *pSource1, BYTE *pLuma0, BYTE *pLuma1, BYTE *pU, BYTE *pV, UINT32 chromaStep, UINT32 start, UINT32 width, const VIDEO_COLOR_COEFFICIENTS &coefficients)
+	{
+		for (UINT32 x = start; x < width; x += 2) {
+			UINT32 x1 = (std::min)(x + 1, width - 1);
+			const BYTE *pPixels[4] = { pSource0 + 4 * x, pSource0 + 4 * x1, pSource1 + 4 * x, pSource1 + 4 * x1 };
+			pLuma0[x] = ComputeLuma(pPixels[0], coefficients);
+			pLuma0[x1] = ComputeLuma(pPixels[1], coefficients);
+			pLuma1[x] = ComputeLuma(pPixels[2], coefficients);
+			pLuma1[x1] = ComputeLuma(pPixels[3], coefficients);
+			INT32 sums[3];
+			for (int component = 0; component < 3; component++) {
+				sums[component] = pPixels[0][component] + pPixels[1][component] + pPixels[2][component] + pPixels[3][component];
+			}
+			UINT32 chroma = (x / 2) * chromaStep;
+			pU[chroma] = ComputeChroma(coefficients.U, sums);
+			pV[chroma] = ComputeChroma(coefficients.V, sums);
+		}
+	}
+
+#if SIMD_X86
+	/// <summary>
+	/// Applies the coefficients to 4 pixels of 16 bit components, 2 in each of a and b, and returns the 4 sums in order.
+	/// </summary>
+	inline __m128i WeightedSumsSSE2(__m128i a, __m128i b, __m128i coefficients)
+	{
+		//madd leaves blue + green and red + alpha of each pixel side by side, so even and odd lanes are added up.
+		__m128 productsA = _mm_castsi128_ps(_mm_madd_epi16(a, coefficients));
+		__m128 productsB = _mm_castsi128_ps(_mm_madd_epi16(b, coefficients));
+		__m128 evens = _mm_shuffle_ps(productsA, productsB, _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 odds = _mm_shuffle_ps(productsA, productsB, _MM_SHUFFLE(3, 1, 3, 1));
+		return _mm_add_epi32(_mm_castps_si128(evens), _mm_castps_si128(odds));
+	}
+
+	/// <summary>
+	/// Converts 16 pixels per pass, of a pair of rows, up to end.
+	/// </summary>
+	void ConvertRowPairSSE2(const BYTE *pSource0, const BYTE *pSource1, BYTE *pLuma0, BYTE *pLuma1, BYTE *pU, BYTE *pV, bool isInterleaved, UINT32 end, const VIDEO_COLOR_COEFFICIENTS &coefficients)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i lumaCoefficients = _mm_setr_epi16(coefficients.Luma[0], coefficients.Luma[1], coefficients.Luma[2], 0, coefficients.Luma[0], coefficients.Luma[1], coefficients.Luma[2], 0);
+		const __m128i uCoefficients = _mm_setr_epi16(coefficients.U[0], coefficients.U[1], coefficients.U[2], 0, coefficients.U[0], coefficients.U[1], coefficients.U[2], 0);
+		const __m128i vCoefficients = _mm_setr_epi16(coefficients.V[0], coefficients.V[1], coefficients.V[2], 0, coefficients.V[0], coefficients.V[1], coefficients.V[2], 0);
+		const __m128i lumaOffset = _mm_set1_epi32(coefficients.LumaOffset);
+		const __m128i chromaOffset = _mm_set1_epi32(ChromaOffset);
+		for (UINT32 x = 0; x < end; x += 16) {
+			__m128i luma0[4];
+			__m128i luma1[4];
+			__m128i chromaSums[4];
+			for (int group = 0; group < 4; group++) {
+				__m128i pixels0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pSource0 + 4 * x + 16 * group));
+				__m128i pixels1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pSource1 + 4 * x + 16 * group));
+				__m128i low0 = _mm_unpacklo_epi8(pixels0, zero);
+				__m128i high0 = _mm_unpackhi_epi8(pixels0, zero);
+				__m128i low1 = _mm_unpacklo_epi8(pixels1, zero);
+				__m128i high1 = _mm_unpackhi_epi8(pixels1, zero);
+				luma0[group] = _mm_srai_epi32(_mm_add_epi32(WeightedSumsSSE2(low0, high0, lumaCoefficients), lumaOffset), LumaShift);
+				luma1[group] = _mm_srai_epi32(_mm_add_epi32(WeightedSumsSSE2(low1, high1, lumaCoefficients), lumaOffset), LumaShift);
+				//Sums of the two rows, then of the two pixels of each column pair, give the 2 chroma blocks of the group.
+				__m128i low = _mm_add_epi16(low0, low1);
+				__m128i high = _mm_add_epi16(high0, high1);
+				chromaSums[group] = _mm_add_epi16(_mm_unpacklo_epi64(low, high), _mm_unpackhi_epi64(low, high));
+			}
+			__m128i lumaBytes0 = _mm_packus_epi16(_mm_packs_epi32(luma0[0], luma0[1]), _mm_packs_epi32(luma0[2], luma0[3]));
+			__m128i lumaBytes1 = _mm_packus_epi16(_mm_packs_epi32(luma1[0], luma1[1]), _mm_packs_epi32(luma1[2], luma1[3]));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pLuma0 + x), lumaBytes0);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pLuma1 + x), lumaBytes1);
+
+			__m128i u = _mm_packs_epi32(
+				_mm_srai_epi32(_mm_add_epi32(WeightedSumsSSE2(chromaSums[0], chromaSums[1], uCoefficients), chromaOffset), ChromaShift),
+				_mm_srai_epi32(_mm_add_epi32(WeightedSumsSSE2(chromaSums[2], chromaSums[3], uCoefficients), chromaOffset), ChromaShift));
+			__m128i v = _mm_packs_epi32(
+				_mm_srai_epi32(_mm_add_epi32(WeightedSumsSSE2(chromaSums[0], chromaSums[1], vCoefficients), chromaOffset), ChromaShift),
+				_mm_srai_epi32(_mm_add_epi32(WeightedSumsSSE2(chromaSums[2], chromaSums[3], vCoefficients), chromaOffset), ChromaShift));
+			if (isInterleaved) {
+				__m128i uv = _mm_packus_epi16(_mm_unpacklo_epi16(u, v), _mm_unpackhi_epi16(u, v));
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(pU + x), uv);
+			}
+			else {
+				__m128i uv = _mm_packus_epi16(u, v);
+				_mm_storel_epi64(reinterpret_cast<__m128i *>(pU + x / 2), uv);
+				_mm_storel_epi64(reinterpret_cast<__m128i *>(pV + x / 2), _mm_srli_si128(uv, 8));
+			}
+		}
+	}
+
+	/// <summary>
+	/// Applies the coefficients to 8 pixels of 16 bit components, and returns the 8 sums. Works within 128 bit lanes, so the result holds
+	/// pixels 0-3 of a and b in the low lane and pixels 4-7 in the high lane, as a holds pixels 0, 1, 4 and 5 and b pixels 2, 3, 6 and 7.
+	/// </summary>
+	SIMD_TARGET_AVX2 inline __m256i WeightedSumsAVX2(__m256i a, __m256i b, __m256i coefficients)
+	{
+		__m256 productsA = _mm256_castsi256_ps(_mm256_madd_epi16(a, coefficients));
+		__m256 productsB = _mm256_castsi256_ps(_mm256_madd_epi16(b, coefficients));
+		__m256 evens = _mm256_shuffle_ps(productsA, productsB, _MM_SHUFFLE(2, 0, 2, 0));
+		__m256 odds = _mm256_shuffle_ps(productsA, productsB, _MM_SHUFFLE(3, 1, 3, 1));
+		return _mm256_add_epi32(_mm256_castps_si256(evens), _mm256_castps_si256(odds));
+	}
+
+	/// <summary>
+	/// The 16 values of one chroma component of a pass, as 16 bit values in order.
+	/// </summary>
+	SIMD_TARGET_AVX2 inline __m256i ChromaAVX2(const __m256i *pChromaSums, __m256i coefficients)
+	{
+		const __m256i chromaOffset = _mm256_set1_epi32(ChromaOffset);
+		//Each pair of groups gives blocks 0, 1, 4 and 5 in the low lane and 2, 3, 6 and 7 in the high lane, put in order by swapping the middle quarters.
+		__m256i low = _mm256_srai_epi32(_mm256_add_epi32(WeightedSumsAVX2(pChromaSums[0], pChromaSums[1], coefficients), chromaOffset), ChromaShift);
+		__m256i high = _mm256_srai_epi32(_mm256_add_epi32(WeightedSumsAVX2(pChromaSums[2], pChromaSums[3], coefficients), chromaOffset), ChromaShift);
+		low = _mm256_permute4x64_epi64(low, 0xD8);
+		high = _mm256_permute4x64_epi64(high, 0xD8);
+		return _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xD8);
+	}
+
+	/// <summary>
+	/// Converts 32 pixels per pass, of a pair of rows, up to end.
+	/// </summary>
+	SIMD_TARGET_AVX2 void ConvertRowPairAVX2(const BYTE *pSource0, const BYTE *pSource1, BYTE *pLuma0, BYTE *pLuma1, BYTE *pU, BYTE *pV, bool isInterleaved, UINT32 end, const VIDEO_COLOR_COEFFICIENTS &coefficients)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i lumaCoefficients = _mm256_setr_epi16(
+			coefficients.Luma[0], coefficients.Luma[1], coefficients.Luma[2], 0, coefficients.Luma[0], coefficients.Luma[1], coefficients.Luma[2], 0,
+			coefficients.Luma[0], coefficients.Luma[1], coefficients.Luma[2], 0, coefficients.Luma[0], coefficients.Luma[1], coefficients.Luma[2], 0);
+		const __m256i uCoefficients = _mm256_setr_epi16(
+			coefficients.U[0], coefficients.U[1], coefficients.U[2], 0, coefficients.U[0], coefficients.U[1], coefficients.U[2], 0,
+			coefficients.U[0], coefficients.U[1], coefficients.U[2], 0, coefficients.U[0], coefficients.U[1], coefficients.U[2], 0);
+		const __m256i vCoefficients = _mm256_setr_epi16(
+			coefficients.V[0], coefficients.V[1], coefficients.V[2], 0, coefficients.V[0], coefficients.V[1], coefficients.V[2], 0,
+			coefficients.V[0], coefficients.V[1], coefficients.V[2], 0, coefficients.V[0], coefficients.V[1], coefficients.V[2], 0);
+		const __m256i lumaOffset = _mm256_set1_epi32(coefficients.LumaOffset);
+		//packs and packus work within lanes, which leaves the luma of the pass in this order of 4 pixel blocks.
+		const __m256i lumaOrder = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+		for (UINT32 x = 0; x < end; x += 32) {
+			__m256i luma0[4];
+			__m256i luma1[4];
+			__m256i chromaSums[4];
+			for (int group = 0; group < 4; group++) {
+				__m256i pixels0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pSource0 + 4 * x + 32 * group));
+				__m256i pixels1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pSource1 + 4 * x + 32 * group));
+				__m256i low0 = _mm256_unpacklo_epi8(pixels0, zero);
+				__m256i high0 = _mm256_unpackhi_epi8(pixels0, zero);
+				__m256i low1 = _mm256_unpacklo_epi8(pixels1, zero);
+				__m256i high1 = _mm256_unpackhi_epi8(pixels1, zero);
+				luma0[group] = _mm256_srai_epi32(_mm256_add_epi32(WeightedSumsAVX2(low0, high0, lumaCoefficients), lumaOffset), LumaShift);
+				luma1[group] = _mm256_srai_epi32(_mm256_add_epi32(WeightedSumsAVX2(low1, high1, lumaCoefficients), lumaOffset), LumaShift);
+				__m256i low = _mm256_add_epi16(low0, low1);
+				__m256i high = _mm256_add_epi16(high0, high1);
+				chromaSums[group] = _mm256_add_epi16(_mm256_unpacklo_epi64(low, high), _mm256_unpackhi_epi64(low, high));
+			}
+			__m256i lumaBytes0 = _mm256_packus_epi16(_mm256_packs_epi32(luma0[0], luma0[1]), _mm256_packs_epi32(luma0[2], luma0[3]));
+			__m256i lumaBytes1 = _mm256_packus_epi16(_mm256_packs_epi32(luma1[0], luma1[1]), _mm256_packs_epi32(luma1[2], luma1[3]));
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(pLuma0 + x), _mm256_permutevar8x32_epi32(lumaBytes0, lumaOrder));
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(pLuma1 + x), _mm256_permutevar8x32_epi32(lumaBytes1, lumaOrder));
+
+			__m256i u = ChromaAVX2(chromaSums, uCoefficients);
+			__m256i v = ChromaAVX2(chromaSums, vCoefficients);
+			if (isInterleaved) {
+				__m256i uv = _mm256_packus_epi16(_mm256_unpacklo_epi16(u, v), _mm256_unpackhi_epi16(u, v));
+				_mm256_storeu_si256(reinterpret_cast<__m256i *>(pU + x), uv);
+			}
+			else {
+				__m256i uv = _mm256_permute4x64_epi64(_mm256_packus_epi16(u, v), 0xD8);
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(pU + x / 2), _mm256_castsi256_si128(uv));
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(pV + x / 2), _mm256_extracti128_si256(uv, 1));
+			}
+		}
+		_mm256_zeroupper();
+	}
+#endif
+
+	VIDEO_COLOR_COEFFICIENTS ComputeCoefficients(_In_ VideoColorMatrix matrix, _In_ bool isFullRange)
+	{
+		double kr = matrix == VideoColorMatrix::BT601 ? 0.299 : 0.2126;
+		double kb = matrix == VideoColorMatrix::BT601 ? 0.114 : 0.0722;
+		double scale = 1 << LumaShift;
+		double lumaScale = (isFullRange ? 255.0 : 219.0) / 255.0 * scale;
+		double chromaScale = (isFullRange ? 255.0 : 224.0) / 255.0 * scale;
+		VIDEO_COLOR_COEFFICIENTS coefficients{};
+		coefficients.Luma[0] = (INT16)lround(kb * lumaScale);
+		coefficients.Luma[2] = (INT16)lround(kr * lumaScale);
+		//Green takes the rounding, so the coefficients add up exactly and white ends up at the top of the range.
+		coefficients.Luma[1] = (INT16)(lround(lumaScale) - coefficients.Luma[0] - coefficients.Luma[2]);
+		coefficients.U[0] = (INT16)lround(0.5 * chromaScale);
+		coefficients.U[2] = (INT16)lround(-kr / (2 * (1 - kb)) * chromaScale);
+		//Likewise for the chroma, whose coefficients add up to zero so that grays have none.
+		coefficients.U[1] = (INT16)(-coefficients.U[0] - coefficients.U[2]);
+		coefficients.V[2] = (INT16)lround(0.5 * chromaScale);
+		coefficients.V[0] = (INT16)lround(-kb / (2 * (1 - kr)) * chromaScale);
+		coefficients.V[1] = (INT16)(-coefficients.V[0] - coefficients.V[2]);
+		coefficients.LumaOffset = ((isFullRange ? 0 : 16) << LumaShift) + (1 << (LumaShift - 1));
+		return coefficients;
+	}
+}
+
+struct VideoColorConverter::WORKERS {
+	std::vector<std::thread> Threads;
+	std::mutex Mutex;
+	std::condition_variable WorkReady;
+	std::condition_variable WorkDone;
+	//Counts the frames handed to the workers, so each worker knows when there is a new one.
+	UINT64 Frame = 0;
+	UINT32 PendingStripes = 0;
+	bool IsStopping = false;
+	const BYTE *pSource = nullptr;
+	UINT32 SourceStride = 0;
+	BYTE *pDest = nullptr;
+};
+
+VideoColorConverter::VideoColorConverter() :
+	m_Workers(nullptr),
+	m_Width(0),
+	m_Height(0),
+	m_Options{},
+	m_SimdLevel(SimdLevel::Scalar),
+	m_Coefficients{},
+	m_StripeCount(1),
+	m_StripeRows(0)
+{
+}
+
+VideoColorConverter::~VideoColorConverter()
+{
+	StopWorkers();
+}
+
+HRESULT VideoColorConverter::Initialize(_In_ UINT32 width, _In_ UINT32 height, _In_ const VIDEO_COLOR_CONVERTER_OPTIONS &options, _In_ SimdLevel level)
+{
+	//The frame must fit a 32 bit size, and a BGRA row must be addressable with 32 bit offsets.
+	if (width == 0 || height == 0 || width > 0x3FFFFFFF / 4 || (UINT64)width * height * 3 / 2 + width + height > 0xFFFFFFFFULL) {
+		return E_INVALIDARG;
+	}
+	StopWorkers();
+	m_Width = width;
+	m_Height = height;
+	m_Options = options;
+	m_SimdLevel = ResolveSimdLevel(level);
+	m_Coefficients = ComputeCoefficients(options.Matrix, options.IsFullRange);
+
+	UINT32 threads = options.Threads;
+	if (threads == 0) {
+		threads = (std::min)((std::max)(std::thread::hardware_concurrency() / 2, 1u), MaxDefaultThreads);
+	}
+	UINT32 rowPairs = (height + 1) / 2;
+	m_StripeCount = (std::max)((std::min)(threads, (height + MinStripeRows - 1) / MinStripeRows), 1u);
+	m_StripeRows = (rowPairs + m_StripeCount - 1) / m_StripeCount * 2;
+	//Rounding the stripes up to whole row pairs can leave the last ones empty.
+	m_StripeCount = (height + m_StripeRows - 1) / m_StripeRows;
+	if (m_StripeCount > 1) {
+		m_Workers = std::make_unique<WORKERS>();
+		try {
+			for (UINT32 stripe = 1; stripe < m_StripeCount; stripe++) {
+				m_Workers->Threads.emplace_back([this, stripe]() {
+					WORKERS &workers = *m_Workers;
+					UINT64 frame = 0;
+					while (true) {
+						std::unique_lock<std::mutex> lock(workers.Mutex);
+						workers.WorkReady.wait(lock, [&]() { return workers.IsStopping || workers.Frame != frame; });
+						if (workers.IsStopping) {
+							return;
+						}
+						frame = workers.Frame;
+						const BYTE *pSource = workers.pSource;
+						UINT32 sourceStride = workers.SourceStride;
+						BYTE *pDest = workers.pDest;
+						lock.unlock();
+						ConvertStripe(pSource, sourceStride, pDest, stripe);
+						lock.lock();
+						if (--workers.PendingStripes == 0) {
+							workers.WorkDone.notify_one();
+						}
+					}
+				});
+			}
+		}
+		catch (const std::system_error &) {
+			//Without all the threads, the frame is converted on the calling thread alone.
+			StopWorkers();
+			m_StripeCount = 1;
+			m_StripeRows = rowPairs * 2;
+		}
+	}
+	return S_OK;
+}
+
+HRESULT VideoColorConverter::Convert(_In_ const BYTE *pSource, _In_ UINT32 sourceStride, _Out_writes_bytes_(GetFrameBytes()) BYTE *pDest)
+{
+	if (m_Width == 0) {
+		return E_UNEXPECTED;
+	}
+	if (!pSource || !pDest || sourceStride < m_Width * 4) {
+		return E_INVALIDARG;
+	}
+	if (!m_Workers) {
+		ConvertRows(pSource, sourceStride, pDest, 0, m_Height);
+		return S_OK;
+	}
+	WORKERS &workers = *m_Workers;
+	{
+		const std::lock_guard<std::mutex> lock(workers.Mutex);
+		workers.pSource = pSource;
+		workers.SourceStride = sourceStride;
+		workers.pDest = pDest;
+		workers.PendingStripes = m_StripeCount - 1;
+		workers.Frame++;
+	}
+	workers.WorkReady.notify_all();
+	ConvertStripe(pSource, sourceStride, pDest, 0);
+	std::unique_lock<std::mutex> lock(workers.Mutex);
+	workers.WorkDone.wait(lock, [&]() { return workers.PendingStripes == 0; });
+	return S_OK;
+}
+
+UINT32 VideoColorConverter::GetFrameBytes(_In_ UINT32 width, _In_ UINT32 height)
+{
+	return width * height + 2 * ((width + 1) / 2) * ((height + 1) / 2);
+}
+
+void VideoColorConverter::ConvertStripe(_In_ const BYTE *pSource, _In_ UINT32 sourceStride, _Inout_ BYTE *pDest, _In_ UINT32 stripe) const
+{
+	UINT32 startRow = stripe * m_StripeRows;
+	ConvertRows(pSource, sourceStride, pDest, startRow, (std::min)(startRow + m_StripeRows, m_Height));
+}
+
+void VideoColorConverter::ConvertRows(_In_ const BYTE *pSource, _In_ UINT32 sourceStride, _Inout_ BYTE *pDest, _In_ UINT32 startRow, _In_ UINT32 endRow) const
+{
+	const UINT32 chromaWidth = (m_Width + 1) / 2;
+	const bool isInterleaved = m_Options.Layout == VideoPlaneLayout::NV12;
+	const UINT32 chromaStep = isInterleaved ? 2 : 1;
+	const UINT32 chromaStride = chromaWidth * chromaStep;
+	BYTE *pUPlane = pDest + (size_t)m_Width * m_Height;
+	BYTE *pVPlane = isInterleaved ? pUPlane + 1 : pUPlane + (size_t)chromaWidth * ((m_Height + 1) / 2);
+	UINT32 vectorEnd = 0;
+#if SIMD_X86
+	switch (m_SimdLevel) {
+		case SimdLevel::AVX2:
+			vectorEnd = m_Width & ~31u;
+			break;
+		case SimdLevel::SSE2:
+			vectorEnd = m_Width & ~15u;
+			break;
+		default:
+			break;
+	}
+#endif
+	for (UINT32 row = startRow; row < endRow; row += 2) {
+		//An odd last row is converted as a pair of two equal rows, written to the same place.
+		UINT32 row1 = (std::min)(row + 1, m_Height - 1);
+		const BYTE *pSource0 = pSource + (size_t)row * sourceStride;
+		const BYTE *pSource1 = pSource + (size_t)row1 * sourceStride;
+		BYTE *pLuma0 = pDest + (size_t)row * m_Width;
+		BYTE *pLuma1 = pDest + (size_t)row1 * m_Width;
+		BYTE *pU = pUPlane + (size_t)(row / 2) * chromaStride;
+		BYTE *pV = pVPlane + (size_t)(row / 2) * chromaStride;
+#if SIMD_X86
+		switch (m_SimdLevel) {
+			case SimdLevel::AVX2:
+				ConvertRowPairAVX2(pSource0, pSource1, pLuma0, pLuma1, pU, pV, isInterleaved, vectorEnd, m_Coefficients);
+				break;
+			case SimdLevel::SSE2:
+				ConvertRowPairSSE2(pSource0, pSource1, pLuma0, pLuma1, pU, pV, isInterleaved, vectorEnd, m_Coefficients);
+				break;
+			default:
+				break;
+		}
+#endif
+		ConvertRowPairScalar(pSource0, pSource1, pLuma0, pLuma1, pU, pV, chromaStep, vectorEnd, m_Width, m_Coefficients);
+	}
+}
+
+void VideoColorConverter::StopWorkers()
+{
+	if (!m_Workers) {
+		return;
+	}
+	{
+		const std::lock_guard<std::mutex> lock(m_Workers->Mutex);
+		m_Workers->IsStopping = true;
+	}
+	m_Workers->WorkReady.notify_all();
+	for (std::thread &thread : m_Workers->Threads) {
+		thread.join();
+	}
+	m_Workers.reset();
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include <memory>
+#include "Simd.util.h"
+
+enum class VideoColorMatrix {
+	BT601 = 0,
+	BT709 = 1
+};
+
+enum class VideoPlaneLayout {
+	/// <summary>
+	/// The luma plane followed by one plane of interleaved U and V, as the Media Foundation encoders take it.
+	/// </summary>
+	NV12 = 0,
+	/// <summary>
+	/// The luma plane followed by a U and a V plane.
+	/// </summary>
+	I420 = 1
+};
+
+struct VIDEO_COLOR_CONVERTER_OPTIONS {
+	VideoColorMatrix Matrix = VideoColorMatrix::BT709;
+	//Full range puts black at 0 and white at 255. Limited (studio) range puts them at 16 and 235, which is what players assume when the range is not signaled.
+	bool IsFullRange = false;
+	VideoPlaneLayout Layout = VideoPlaneLayout::NV12;
+	//The number of threads converting a frame, including the calling thread. 0 picks one from the number of cores.
+	UINT32 Threads = 0;
+};
+
+/// <summary>
+/// The conversion in fixed point. Each component is the sum of the blue, green and red values times their coefficient, plus the offset, shifted down.
+/// </summary>
+struct VIDEO_COLOR_COEFFICIENTS {
+	//Blue, green and red, in the order of the bytes of a BGRA pixel.
+	INT16 Luma[3];
+	INT16 U[3];
+	INT16 V[3];
+	//The black level and rounding of the luma, already scaled up.
+	INT32 LumaOffset;
+};
+
+/// <summary>
+/// Converts BGRA frames to 4:2:0 YUV on the CPU, in one pass over the source. The luma is computed per pixel and the chroma from the average of each 2x2 block.
+/// Frames are cut into stripes of rows that are converted in parallel, by worker threads kept between frames and the calling thread.
+/// All SIMD levels and thread counts produce exactly the same output. Convert must not be called from more than one thread at a time.
+/// </summary>
+class VideoColorConverter
+{
+public:
+	VideoColorConverter();
+	~VideoColorConverter();
+	/// <summary>
+	/// Sets up the conversion of width x height frames and starts the worker threads. Odd sizes are supported, the last column and row then make up chroma blocks of their own.
+	/// </summary>
+	HRESULT Initialize(_In_ UINT32 width, _In_ UINT32 height, _In_ const VIDEO_COLOR_CONVERTER_OPTIONS &options, _In_ SimdLevel level = SimdLevel::Auto);
+	/// <summary>
+	/// Converts a frame of BGRA pixels, sourceStride bytes apart row to row, into pDest. The planes are written back to back with no padding between rows, taking GetFrameBytes bytes.
+	/// </summary>
+	HRESULT Convert(_In_ const BYTE *pSource, _In_ UINT32 sourceStride, _Out_writes_bytes_(GetFrameBytes()) BYTE *pDest);
+	/// <summary>
+	/// The size of a converted frame of width x height pixels.
+	/// </summary>
+	static UINT32 GetFrameBytes(_In_ UINT32 width, _In_ UINT32 height);
+	inline UINT32 GetFrameBytes() const { return GetFrameBytes(m_Width, m_Height); }
+	inline UINT32 GetWidth() const { return m_Width; }
+	inline UINT32 GetHeight() const { return m_Height; }
+	inline UINT32 GetThreadCount() const { return m_StripeCount; }
+	inline SimdLevel GetSimdLevel() const { return m_SimdLevel; }
+	inline const VIDEO_COLOR_COEFFICIENTS &GetCoefficients() const { return m_Coefficients; }
+private:
+	struct WORKERS;
+	std::unique_ptr<WORKERS> m_Workers;
+	UINT32 m_Width;
+	UINT32 m_Height;
+	VIDEO_COLOR_CONVERTER_OPTIONS m_Options;
+	SimdLevel m_SimdLevel;
+	VIDEO_COLOR_COEFFICIENTS m_Coefficients;
+	UINT32 m_StripeCount;
+	//The height of a stripe in rows, always even so that no chroma row is shared between stripes.
+	UINT32 m_StripeRows;
+
+	/// <summary>
+	/// Converts the rows from startRow up to endRow. startRow must be even.
+	/// </summary>
+	void ConvertRows(_In_ const BYTE *pSource, _In_ UINT32 sourceStride, _Inout_ BYTE *pDest, _In_ UINT32 startRow, _In_ UINT32 endRow) const;
+	void ConvertStripe(_In_ const BYTE *pSource, _In_ UINT32 sourceStride, _Inout_ BYTE *pDest, _In_ UINT32 stripe) const;
+	void StopWorkers();
+};
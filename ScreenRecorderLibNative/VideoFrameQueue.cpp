@@ -0,0 +1,186 @@
+#include "VideoFrameQueue.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+struct VideoFrameQueue::STATE {
+	mutable std::mutex Mutex;
+	//Signaled when a frame is queued, and when the queue is stopped.
+	std::condition_variable FrameQueued;
+	//Signaled when a frame is taken off the queue, and when the queue is stopped.
+	std::condition_variable RoomMade;
+	//The queued frames, in a ring of Capacity entries starting at Head.
+	std::vector<VIDEO_FRAME_QUEUE_ENTRY> Entries;
+	UINT32 Head = 0;
+	UINT32 Depth = 0;
+	//The slots neither queued, being filled nor being written.
+	std::vector<UINT32> FreeSlots;
+	//The time of frames dropped from the front of the queue with no frame left behind them to take it over. Given to the next frame pushed.
+	bool HasCarry = false;
+	INT64 CarryStartPos = 0;
+	INT64 CarryDuration = 0;
+	bool IsStopped = false;
+	VIDEO_FRAME_QUEUE_STATS Stats{};
+};
+
+VideoFrameQueue::VideoFrameQueue() :
+	m_State(std::make_unique<STATE>()),
+	m_Capacity(0),
+	m_Policy(FrameQueueFullPolicy::Block)
+{
+}
+
+VideoFrameQueue::~VideoFrameQueue()
+{
+}
+
+HRESULT VideoFrameQueue::Initialize(_In_ UINT32 capacity, _In_ FrameQueueFullPolicy policy)
+{
+	if (capacity == 0) {
+		return E_INVALIDARG;
+	}
+	std::lock_guard<std::mutex> lock(m_State->Mutex);
+	m_Capacity = capacity;
+	m_Policy = policy;
+	m_State->Entries.assign(capacity, VIDEO_FRAME_QUEUE_ENTRY{});
+	m_State->Head = 0;
+	m_State->Depth = 0;
+	m_State->FreeSlots.clear();
+	m_State->FreeSlots.reserve(GetSlotCount());
+	for (UINT32 slot = GetSlotCount(); slot > 0; slot--) {
+		m_State->FreeSlots.push_back(slot - 1);
+	}
+	m_State->HasCarry = false;
+	m_State->IsStopped = false;
+	m_State->Stats = VIDEO_FRAME_QUEUE_STATS{};
+	return S_OK;
+}
+
+HRESULT VideoFrameQueue::AcquireSlot(_In_ INT64 startPos, _In_ INT64 duration, _Out_ UINT32 *pSlot)
+{
+	*pSlot = 0;
+	std::unique_lock<std::mutex> lock(m_State->Mutex);
+	STATE &state = *m_State;
+	if (state.Entries.empty()) {
+		return E_UNEXPECTED;
+	}
+	if (state.Depth >= m_Capacity) {
+		switch (m_Policy)
+		{
+		case FrameQueueFullPolicy::DropNewest: {
+			//The last queued frame stays on screen for the time of the dropped one.
+			VIDEO_FRAME_QUEUE_ENTRY &last = state.Entries[(state.Head + state.Depth - 1) % m_Capacity];
+			last.Duration = startPos + duration - last.StartPos;
+			state.Stats.DroppedNewestFrames++;
+			return S_FALSE;
+		}
+		case FrameQueueFullPolicy::DropOldest: {
+			//The slot of the dropped frame is reused for the new one, and the frame after it starts in its place.
+			VIDEO_FRAME_QUEUE_ENTRY dropped = state.Entries[state.Head];
+			state.Head = (state.Head + 1) % m_Capacity;
+			state.Depth--;
+			if (state.Depth > 0) {
+				VIDEO_FRAME_QUEUE_ENTRY &next = state.Entries[state.Head];
+				next.Duration += next.StartPos - dropped.StartPos;
+				next.StartPos = dropped.StartPos;
+			}
+			else if (!state.HasCarry) {
+				state.HasCarry = true;
+				state.CarryStartPos = dropped.StartPos;
+			}
+			state.Stats.DroppedOldestFrames++;
+			*pSlot = dropped.Slot;
+			return S_OK;
+		}
+		default: {
+			auto start = std::chrono::steady_clock::now();
+			state.RoomMade.wait(lock, [&]() { return state.IsStopped || state.Depth < m_Capacity; });
+			state.Stats.BlockedCount++;
+			state.Stats.Blocked100Nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / 100;
+			if (state.Depth >= m_Capacity) {
+				return E_ABORT;
+			}
+			break;
+		}
+		}
+	}
+	if (state.FreeSlots.empty()) {
+		//Can only happen if a slot is pushed or released twice.
+		return E_UNEXPECTED;
+	}
+	*pSlot = state.FreeSlots.back();
+	state.FreeSlots.pop_back();
+	return S_OK;
+}
+
+void VideoFrameQueue::Push(_In_ const VIDEO_FRAME_QUEUE_ENTRY &entry)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_State->Mutex);
+		STATE &state = *m_State;
+		VIDEO_FRAME_QUEUE_ENTRY &queued = state.Entries[(state.Head + state.Depth) % m_Capacity];
+		queued = entry;
+		if (state.HasCarry) {
+			queued.Duration += queued.StartPos - state.CarryStartPos;
+			queued.StartPos = state.CarryStartPos;
+			state.HasCarry = false;
+		}
+		state.Depth++;
+		state.Stats.QueuedFrames++;
+		state.Stats.MaxDepth = (std::max)(state.Stats.MaxDepth, state.Depth);
+	}
+	m_State->FrameQueued.notify_one();
+}
+
+bool VideoFrameQueue::Pop(_In_ DWORD timeoutMillis, _Out_ VIDEO_FRAME_QUEUE_ENTRY *pEntry)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_State->Mutex);
+		STATE &state = *m_State;
+		if (!state.FrameQueued.wait_for(lock, std::chrono::milliseconds(timeoutMillis), [&]() { return state.IsStopped || state.Depth > 0; })
+			|| state.Depth == 0) {
+			return false;
+		}
+		*pEntry = state.Entries[state.Head];
+		state.Head = (state.Head + 1) % m_Capacity;
+		state.Depth--;
+	}
+	m_State->RoomMade.notify_one();
+	return true;
+}
+
+void VideoFrameQueue::ReleaseSlot(_In_ UINT32 slot)
+{
+	std::lock_guard<std::mutex> lock(m_State->Mutex);
+	m_State->FreeSlots.push_back(slot);
+}
+
+void VideoFrameQueue::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_State->Mutex);
+		m_State->IsStopped = true;
+	}
+	m_State->FrameQueued.notify_all();
+	m_State->RoomMade.notify_all();
+}
+
+UINT32 VideoFrameQueue::GetDepth() const
+{
+	std::lock_guard<std::mutex> lock(m_State->Mutex);
+	return m_State->Depth;
+}
+
+UINT64 VideoFrameQueue::GetDroppedFrameCount() const
+{
+	std::lock_guard<std::mutex> lock(m_State->Mutex);
+	return m_State->Stats.DroppedOldestFrames + m_State->Stats.DroppedNewestFrames;
+}
+
+VIDEO_FRAME_QUEUE_STATS VideoFrameQueue::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(m_State->Mutex);
+	return m_State->Stats;
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <windows.h>
+#include <sal.h>
+#include <memory>
+
+enum class FrameQueueFullPolicy {
+	/// <summary>
+	/// The new frame waits until the writer makes room. No frame is lost, but the capture is held up for as long.
+	/// </summary>
+	Block = 0,
+	/// <summary>
+	/// The oldest queued frame is dropped to make room for the new one.
+	/// </summary>
+	DropOldest = 1,
+	/// <summary>
+	/// The new frame is dropped.
+	/// </summary>
+	DropNewest = 2
+};
+
+struct VIDEO_FRAME_QUEUE_ENTRY {
+	//The slot of the pool the frame was copied into.
+	UINT32 Slot;
+	//Timestamp of the start of the frame, in 100 nanosecond units.
+	INT64 StartPos;
+	//Duration of the frame, in 100 nanosecond units.
+	INT64 Duration;
+};
+
+struct VIDEO_FRAME_QUEUE_STATS {
+	//Frames queued, not counting the ones dropped before they were queued.
+	UINT64 QueuedFrames;
+	//Frames dropped from the front of a full queue to make room for a new one.
+	UINT64 DroppedOldestFrames;
+	//New frames dropped because the queue was full.
+	UINT64 DroppedNewestFrames;
+	//The most frames waiting in the queue at once.
+	UINT32 MaxDepth;
+	//Times the capture thread had to wait for the queue to make room, and the total time waited, in 100 nanosecond units.
+	UINT64 BlockedCount;
+	INT64 Blocked100Nanos;
+};
+
+/// <summary>
+/// A bounded queue of frames between the capture thread and the video writer thread. The frames live in a fixed pool of slots
+/// owned by the caller, so the queue only hands out slot numbers and nothing is allocated per frame. There is one producer and one consumer.
+/// When the queue is full, a new frame waits for room, replaces the oldest queued frame, or is dropped, as set by the policy.
+/// A dropped frame is folded into a neighbouring frame, so the timeline of the frames that are written has no gaps.
+/// </summary>
+class VideoFrameQueue
+{
+public:
+	VideoFrameQueue();
+	~VideoFrameQueue();
+	/// <summary>
+	/// Sets up a queue of up to capacity frames. The pool needs GetSlotCount slots, for the frames queued or being filled and the one being written.
+	/// </summary>
+	HRESULT Initialize(_In_ UINT32 capacity, _In_ FrameQueueFullPolicy policy);
+	/// <summary>
+	/// Called by the producer to get a free slot to copy a frame into. Returns S_FALSE with no slot if the queue is full and the policy drops the new frame,
+	/// in which case the frame is folded into the last queued frame. Returns E_ABORT if the queue was stopped while waiting for room.
+	/// </summary>
+	HRESULT AcquireSlot(_In_ INT64 startPos, _In_ INT64 duration, _Out_ UINT32 *pSlot);
+	/// <summary>
+	/// Called by the producer to queue the frame copied into the slot from AcquireSlot.
+	/// </summary>
+	void Push(_In_ const VIDEO_FRAME_QUEUE_ENTRY &entry);
+	/// <summary>
+	/// Called by the consumer to take the oldest queued frame, waiting up to timeoutMillis for one. Returns false if there is none, in which case
+	/// the queue is either empty or stopped and empty. The slot stays in use until passed to ReleaseSlot.
+	/// </summary>
+	bool Pop(_In_ DWORD timeoutMillis, _Out_ VIDEO_FRAME_QUEUE_ENTRY *pEntry);
+	/// <summary>
+	/// Called by the consumer when it is done with the slot of a popped frame.
+	/// </summary>
+	void ReleaseSlot(_In_ UINT32 slot);
+	/// <summary>
+	/// Wakes up a producer waiting for room and a consumer waiting for frames. Frames already queued can still be popped.
+	/// </summary>
+	void Stop();
+	inline UINT32 GetCapacity() const { return m_Capacity; }
+	inline UINT32 GetSlotCount() const { return m_Capacity + 1; }
+	/// <summary>
+	/// The frames waiting in the queue. Safe to call from any thread.
+	/// </summary>
+	UINT32 GetDepth() const;
+	/// <summary>
+	/// The frames dropped so far, by either drop policy. Safe to call from any thread.
+	/// </summary>
+	UINT64 GetDroppedFrameCount() const;
+	VIDEO_FRAME_QUEUE_STATS GetStats() const;
+private:
+	struct STATE;
+	std::unique_ptr<STATE> m_State;
+	UINT32 m_Capacity;
+	FrameQueueFullPolicy m_Policy;
+};
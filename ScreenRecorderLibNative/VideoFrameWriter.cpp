@@ -0,0 +1,215 @@
+#include "VideoFrameWriter.h"
+#include "OutputManager.h"
+#include "cleanup.h"
+#include <ppltasks.h>
+
+using namespace std;
+
+namespace {
+	//How often the writer thread looks for the stop event while the queue is empty.
+	const DWORD StopPollMillis = 100;
+}
+
+struct VideoFrameWriter::TaskWrapper {
+	Concurrency::task<void> m_WriteTask = concurrency::task_from_result();
+};
+
+VideoFrameWriter::VideoFrameWriter() :
+	m_TaskWrapperImpl(make_unique<TaskWrapper>()),
+	m_OutputManager(nullptr),
+	m_StopEvent(nullptr),
+	m_IsDiscarding(false),
+	m_Result(S_OK),
+	m_Stats{},
+	m_PreviousDroppedFrames(0)
+{
+}
+
+VideoFrameWriter::~VideoFrameWriter()
+{
+	StopWriting(true);
+}
+
+HRESULT VideoFrameWriter::StartWriting(_In_ OutputManager *pOutputManager, _In_ UINT32 queueLength, _In_ FrameQueueFullPolicy policy)
+{
+	if (m_StopEvent) {
+		return E_UNEXPECTED;
+	}
+	if (!pOutputManager) {
+		return E_INVALIDARG;
+	}
+	m_OutputManager = pOutputManager;
+	m_PreviousDroppedFrames += m_Queue.GetDroppedFrameCount();
+	RETURN_ON_BAD_HR(m_Queue.Initialize(queueLength, policy));
+	m_Textures.clear();
+	m_Textures.resize(m_Queue.GetSlotCount());
+	m_PtrInfos.assign(m_Queue.GetSlotCount(), PTR_INFO());
+	m_PtrShapeBuffers.clear();
+	m_PtrShapeBuffers.resize(m_Queue.GetSlotCount());
+	m_DeviceIds.resize(m_Queue.GetSlotCount());
+	m_Stats = VIDEO_FRAME_WRITER_STATS{};
+	m_IsDiscarding = false;
+	m_Result = S_OK;
+	m_StopEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+	if (nullptr == m_StopEvent) {
+		LOG_ERROR(L"CreateEvent failed: last error is %u", GetLastError());
+		return E_FAIL;
+	}
+	m_TaskWrapperImpl->m_WriteTask = concurrency::create_task([this]() {
+		HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED | COINIT_DISABLE_OLE1DDE);
+		bool isCoInitialized = SUCCEEDED(hr);
+		try {
+			while (SUCCEEDED(hr)) {
+				VIDEO_FRAME_QUEUE_ENTRY entry;
+				if (!m_Queue.Pop(StopPollMillis, &entry)) {
+					//The queue is only ever empty and stopped once the stop event is set.
+					if (WaitForSingleObjectEx(m_StopEvent, 0, FALSE) == WAIT_OBJECT_0) {
+						break;
+					}
+					continue;
+				}
+				if (m_IsDiscarding) {
+					m_Stats.DiscardedFrames++;
+				}
+				else {
+					hr = RenderQueuedFrame(entry);
+				}
+				m_Queue.ReleaseSlot(entry.Slot);
+			}
+		}
+		catch (const exception &e) {
+			LOG_ERROR(L"Exception in VideoFrameWriter: %s", s2ws(e.what()).c_str());
+			hr = E_FAIL;
+		}
+		catch (...) {
+			LOG_ERROR(L"Exception in VideoFrameWriter");
+			hr = E_FAIL;
+		}
+		if (FAILED(hr)) {
+			_com_error err(hr);
+			LOG_ERROR(L"Writing video failed: %s", err.ErrorMessage());
+			m_Result = hr;
+			//Wakes up the capture thread if it is waiting for room in the queue, so it picks up the error.
+			m_Queue.Stop();
+		}
+		if (isCoInitialized) {
+			CoUninitialize();
+		}
+	});
+	return S_OK;
+}
+
+HRESULT VideoFrameWriter::WriteFrame(_In_ ID3D11Texture2D *pFrame, _In_ INT64 startPos, _In_ INT64 duration, _In_opt_ PTR_INFO *pPtrInfo, _In_ const std::wstring &deviceId)
+{
+	if (!m_StopEvent) {
+		return E_UNEXPECTED;
+	}
+	HRESULT hr = m_Result;
+	RETURN_ON_BAD_HR(hr);
+	UINT32 slot;
+	hr = m_Queue.AcquireSlot(startPos, duration, &slot);
+	if (hr == E_ABORT) {
+		//The writer thread failed while the frame waited for room.
+		HRESULT writerHr = m_Result;
+		return FAILED(writerHr) ? writerHr : hr;
+	}
+	RETURN_ON_BAD_HR(hr);
+	if (hr == S_FALSE) {
+		LOG_TRACE(L"Dropped video frame with start pos %lld ms, the frame queue is full", HundredNanosToMillis(startPos));
+		return S_FALSE;
+	}
+	hr = CopyFrameToSlot(pFrame, slot);
+	if (FAILED(hr)) {
+		m_Queue.ReleaseSlot(slot);
+		return hr;
+	}
+	//The slot is not seen by the writer thread until it is pushed.
+	PTR_INFO &ptrInfo = m_PtrInfos[slot];
+	ptrInfo = PTR_INFO();
+	if (pPtrInfo && pPtrInfo->Visible && pPtrInfo->PtrShapeBuffer) {
+		std::vector<BYTE> &shapeBuffer = m_PtrShapeBuffers[slot];
+		shapeBuffer.assign(pPtrInfo->PtrShapeBuffer, pPtrInfo->PtrShapeBuffer + pPtrInfo->BufferSize);
+		ptrInfo = *pPtrInfo;
+		ptrInfo.PtrShapeBuffer = shapeBuffer.data();
+	}
+	m_DeviceIds[slot] = deviceId;
+	VIDEO_FRAME_QUEUE_ENTRY entry{};
+	entry.Slot = slot;
+	entry.StartPos = startPos;
+	entry.Duration = duration;
+	m_Queue.Push(entry);
+	return S_OK;
+}
+
+HRESULT VideoFrameWriter::StopWriting(_In_ bool isDiscardingQueuedFrames)
+{
+	if (!m_StopEvent) {
+		return S_FALSE;
+	}
+	m_IsDiscarding = isDiscardingQueuedFrames;
+	SetEvent(m_StopEvent);
+	m_Queue.Stop();
+	try
+	{
+		m_TaskWrapperImpl->m_WriteTask.wait();
+	}
+	catch (const exception &e) {
+		LOG_ERROR(L"Exception in StopWriting: %s", s2ws(e.what()).c_str());
+	}
+	catch (...) {
+		LOG_ERROR(L"Exception in StopWriting");
+	}
+	CloseHandle(m_StopEvent);
+	m_StopEvent = nullptr;
+	m_Textures.clear();
+	m_Stats.Queue = m_Queue.GetStats();
+	LOG_DEBUG(L"Wrote %llu video frames, dropped %llu oldest and %llu newest frames, discarded %llu. At most %u frames queued, capture waited %llu times for %.1f ms in total, the slowest frame took %.1f ms",
+		m_Stats.WrittenFrames, m_Stats.Queue.DroppedOldestFrames, m_Stats.Queue.DroppedNewestFrames, m_Stats.DiscardedFrames, m_Stats.Queue.MaxDepth,
+		m_Stats.Queue.BlockedCount, HundredNanosToMillisDouble(m_Stats.Queue.Blocked100Nanos), HundredNanosToMillisDouble(m_Stats.MaxWriteDuration100Nanos));
+	return m_Result;
+}
+
+HRESULT VideoFrameWriter::CopyFrameToSlot(_In_ ID3D11Texture2D *pFrame, _In_ UINT32 slot)
+{
+	D3D11_TEXTURE2D_DESC desc;
+	pFrame->GetDesc(&desc);
+	CComPtr<ID3D11Device> pDevice;
+	pFrame->GetDevice(&pDevice);
+	CComPtr<ID3D11Texture2D> &pSlotTexture = m_Textures[slot];
+	if (pSlotTexture) {
+		D3D11_TEXTURE2D_DESC slotDesc;
+		pSlotTexture->GetDesc(&slotDesc);
+		CComPtr<ID3D11Device> pSlotDevice;
+		pSlotTexture->GetDevice(&pSlotDevice);
+		if (slotDesc.Width != desc.Width
+			|| slotDesc.Height != desc.Height
+			|| slotDesc.Format != desc.Format
+			|| slotDesc.BindFlags != desc.BindFlags
+			|| pSlotDevice != pDevice) {
+			pSlotTexture.Release();
+		}
+	}
+	if (!pSlotTexture) {
+		RETURN_ON_BAD_HR(pDevice->CreateTexture2D(&desc, nullptr, &pSlotTexture));
+	}
+	CComPtr<ID3D11DeviceContext> pContext;
+	pDevice->GetImmediateContext(&pContext);
+	pContext->CopyResource(pSlotTexture, pFrame);
+	return S_OK;
+}
+
+HRESULT VideoFrameWriter::RenderQueuedFrame(_In_ const VIDEO_FRAME_QUEUE_ENTRY &entry)
+{
+	FrameWriteModel model{};
+	model.Frame = m_Textures[entry.Slot];
+	model.StartPos = entry.StartPos;
+	model.Duration = entry.Duration;
+	model.PtrInfo = &m_PtrInfos[entry.Slot];
+	model.DeviceId = m_DeviceIds[entry.Slot];
+	auto start = chrono::steady_clock::now();
+	RETURN_ON_BAD_HR(m_OutputManager->RenderFrame(model));
+	INT64 duration100Nanos = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count() / 100;
+	m_Stats.MaxWriteDuration100Nanos = (std::max)(m_Stats.MaxWriteDuration100Nanos, duration100Nanos);
+	m_Stats.WrittenFrames++;
+	return S_OK;
+}
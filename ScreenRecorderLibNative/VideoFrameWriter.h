@@ -0,0 +1,85 @@
+#pragma once
+#include <windows.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <atlbase.h>
+#include <d3d11.h>
+#include "VideoFrameQueue.h"
+#include "CommonTypes.h"
+
+class OutputManager;
+
+struct VIDEO_FRAME_WRITER_STATS {
+	VIDEO_FRAME_QUEUE_STATS Queue;
+	//Frames handed to the OutputManager.
+	UINT64 WrittenFrames;
+	//Frames still queued when the writer was stopped without writing them.
+	UINT64 DiscardedFrames;
+	//The longest time the OutputManager took to render a frame, in 100 nanosecond units.
+	INT64 MaxWriteDuration100Nanos;
+};
+
+/// <summary>
+/// Renders the video frames to the OutputManager on its own thread, so a slow encode does not hold up the capture or skew its pacing.
+/// Frames are copied on the GPU into a pool of textures and queued. The queue is bounded, and what happens to a frame that finds it full is set by the policy.
+/// </summary>
+class VideoFrameWriter
+{
+public:
+	VideoFrameWriter();
+	~VideoFrameWriter();
+	/// <summary>
+	/// Starts the writer thread with a queue of queueLength frames. The OutputManager must outlive the writer, or StopWriting must be called first.
+	/// </summary>
+	HRESULT StartWriting(_In_ OutputManager *pOutputManager, _In_ UINT32 queueLength, _In_ FrameQueueFullPolicy policy);
+	/// <summary>
+	/// Copies the frame and queues it to be rendered, along with the mouse pointer and the source it was captured with. Returns S_FALSE if the frame was dropped,
+	/// and the error of the writer thread if it has failed. The frame and the mouse pointer are copied, so both can change as soon as this returns.
+	/// </summary>
+	HRESULT WriteFrame(_In_ ID3D11Texture2D *pFrame, _In_ INT64 startPos, _In_ INT64 duration, _In_opt_ PTR_INFO *pPtrInfo, _In_ const std::wstring &deviceId);
+	/// <summary>
+	/// Stops the writer thread once the queued frames are written, or right after the frame being written if isDiscardingQueuedFrames is set.
+	/// Queued frames must be discarded before the D3D device they were copied on is released.
+	/// </summary>
+	HRESULT StopWriting(_In_ bool isDiscardingQueuedFrames = false);
+	/// <summary>
+	/// The error that stopped the writer thread, or S_OK while it runs. Safe to call from any thread.
+	/// </summary>
+	inline HRESULT GetResult() const { return m_Result; }
+	inline bool IsWriting() const { return m_StopEvent != nullptr; }
+	/// <summary>
+	/// The frames waiting to be rendered.
+	/// </summary>
+	inline UINT32 GetQueueDepth() const { return m_Queue.GetDepth(); }
+	/// <summary>
+	/// The frames dropped by the queue since the first call to StartWriting.
+	/// </summary>
+	inline UINT64 GetDroppedFrameCount() const { return m_PreviousDroppedFrames + m_Queue.GetDroppedFrameCount(); }
+	/// <summary>
+	/// Counts of the frames written and dropped. Only valid once StopWriting has returned.
+	/// </summary>
+	inline VIDEO_FRAME_WRITER_STATS GetStats() const { return m_Stats; }
+private:
+	struct TaskWrapper;
+	std::unique_ptr<TaskWrapper> m_TaskWrapperImpl;
+	OutputManager *m_OutputManager;
+	VideoFrameQueue m_Queue;
+	//The pooled copies of the frames, one per slot of the queue. Created on the first frame that uses a slot, and again if the frames change size, format or device.
+	std::vector<CComPtr<ID3D11Texture2D>> m_Textures;
+	//What else the frame in each slot is rendered with. Copied per slot, so nothing the capture threads change or free after the frame is queued is seen by the writer thread.
+	std::vector<PTR_INFO> m_PtrInfos;
+	//The copies of the pointer shapes, which the PtrShapeBuffer of each slot in m_PtrInfos points into.
+	std::vector<std::vector<BYTE>> m_PtrShapeBuffers;
+	std::vector<std::wstring> m_DeviceIds;
+	HANDLE m_StopEvent;
+	std::atomic<bool> m_IsDiscarding;
+	std::atomic<HRESULT> m_Result;
+	VIDEO_FRAME_WRITER_STATS m_Stats;
+	//Frames dropped by the queue before the writer was last restarted.
+	UINT64 m_PreviousDroppedFrames;
+
+	HRESULT CopyFrameToSlot(_In_ ID3D11Texture2D *pFrame, _In_ UINT32 slot);
+	HRESULT RenderQueuedFrame(_In_ const VIDEO_FRAME_QUEUE_ENTRY &entry);
+};
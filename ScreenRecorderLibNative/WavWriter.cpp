@@ -0,0 +1,143 @@
+#include "WavWriter.h"
+#include <cstring>
+
+namespace {
+	const UINT16 WaveFormatPcm = 1;
+	//What the sizes in the header are left at until Finalize fills them in. Players read up to the end of the stream when they see it.
+	const UINT32 OpenSize = 0xFFFFFFFF;
+	const UINT64 RiffSizeOffset = 4;
+	const UINT64 DataSizeOffset = 40;
+	//The RIFF size counts everything after its own field, i.e. the header minus 8 bytes, plus the audio.
+	const UINT64 MaxDataBytes = 0xFFFFFFFFULL - (WavWriter::HeaderBytes - 8);
+
+	void WriteUInt16(_Out_writes_bytes_(2) BYTE *pDest, _In_ UINT16 value)
+	{
+		pDest[0] = (BYTE)value;
+		pDest[1] = (BYTE)(value >> 8);
+	}
+
+	void WriteUInt32(_Out_writes_bytes_(4) BYTE *pDest, _In_ UINT32 value)
+	{
+		for (int i = 0; i < 4; i++) {
+			pDest[i] = (BYTE)(value >> (8 * i));
+		}
+	}
+
+	HRESULT SeekTo(_In_ IStream *pStream, _In_ UINT64 position)
+	{
+		LARGE_INTEGER move;
+		move.QuadPart = (LONGLONG)position;
+		return pStream->Seek(move, STREAM_SEEK_SET, nullptr);
+	}
+}
+
+WavWriter::WavWriter() :
+	m_Stream(nullptr),
+	m_HeaderPosition(0),
+	m_BlockAlign(0),
+	m_DataBytes(0),
+	m_IsFinalized(false)
+{
+}
+
+WavWriter::~WavWriter()
+{
+}
+
+HRESULT WavWriter::Initialize(_In_ IStream *pStream, _In_ UINT32 sampleRate, _In_ UINT32 channels, _In_ UINT32 bitsPerSample)
+{
+	if (!pStream || sampleRate == 0 || channels == 0 || channels > 0xFFFF || bitsPerSample == 0 || bitsPerSample % 8 != 0 || bitsPerSample > 32) {
+		return E_INVALIDARG;
+	}
+	m_Stream = pStream;
+	m_BlockAlign = channels * bitsPerSample / 8;
+	m_DataBytes = 0;
+	m_IsFinalized = false;
+	//The header is patched relative to where it started, so a stream that already holds data keeps it.
+	LARGE_INTEGER noMove{};
+	ULARGE_INTEGER position{};
+	m_HeaderPosition = SUCCEEDED(m_Stream->Seek(noMove, STREAM_SEEK_CUR, &position)) ? position.QuadPart : 0;
+
+	BYTE header[HeaderBytes];
+	memcpy(header, "RIFF", 4);
+	WriteUInt32(header + 4, OpenSize);
+	memcpy(header + 8, "WAVE", 4);
+	memcpy(header + 12, "fmt ", 4);
+	WriteUInt32(header + 16, 16);
+	WriteUInt16(header + 20, WaveFormatPcm);
+	WriteUInt16(header + 22, (UINT16)channels);
+	WriteUInt32(header + 24, sampleRate);
+	WriteUInt32(header + 28, sampleRate * m_BlockAlign);
+	WriteUInt16(header + 32, (UINT16)m_BlockAlign);
+	WriteUInt16(header + 34, (UINT16)bitsPerSample);
+	memcpy(header + 36, "data", 4);
+	WriteUInt32(header + 40, OpenSize);
+	return WriteToStream(header, HeaderBytes);
+}
+
+HRESULT WavWriter::Write(_In_reads_bytes_(cbData) const BYTE *pData, _In_ DWORD cbData)
+{
+	if (!m_Stream || m_IsFinalized) {
+		return E_UNEXPECTED;
+	}
+	if (cbData == 0) {
+		return S_OK;
+	}
+	//Room is kept for the pad byte of an odd sized data chunk.
+	if (m_DataBytes + cbData + (cbData & 1) > MaxDataBytes) {
+		return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+	}
+	HRESULT hr = WriteToStream(pData, cbData);
+	if (SUCCEEDED(hr)) {
+		m_DataBytes += cbData;
+	}
+	return hr;
+}
+
+HRESULT WavWriter::Finalize()
+{
+	if (!m_Stream || m_IsFinalized) {
+		return E_UNEXPECTED;
+	}
+	m_IsFinalized = true;
+	//Chunks are padded to an even size.
+	if (m_DataBytes & 1) {
+		BYTE pad = 0;
+		HRESULT hr = WriteToStream(&pad, 1);
+		if (FAILED(hr)) {
+			return hr;
+		}
+	}
+	UINT64 endPosition = m_HeaderPosition + HeaderBytes + m_DataBytes + (m_DataBytes & 1);
+	//A stream that can not seek, such as a pipe, keeps the open sizes.
+	if (FAILED(WriteSizeAt(m_HeaderPosition + RiffSizeOffset, (UINT32)(endPosition - m_HeaderPosition - 8)))) {
+		SeekTo(m_Stream, endPosition);
+		return S_FALSE;
+	}
+	HRESULT hr = WriteSizeAt(m_HeaderPosition + DataSizeOffset, (UINT32)m_DataBytes);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	return SeekTo(m_Stream, endPosition);
+}
+
+HRESULT WavWriter::WriteToStream(_In_reads_bytes_(cbData) const void *pData, _In_ DWORD cbData)
+{
+	ULONG written = 0;
+	HRESULT hr = m_Stream->Write(pData, cbData, &written);
+	if (SUCCEEDED(hr) && written != cbData) {
+		hr = STG_E_MEDIUMFULL;
+	}
+	return hr;
+}
+
+HRESULT WavWriter::WriteSizeAt(_In_ UINT64 position, _In_ UINT32 size)
+{
+	HRESULT hr = SeekTo(m_Stream, position);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	BYTE bytes[4];
+	WriteUInt32(bytes, size);
+	return WriteToStream(bytes, sizeof(bytes));
+}
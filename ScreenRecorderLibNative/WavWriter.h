@@ -0,0 +1,42 @@
+#pragma once
+#include <windows.h>
+#include <objidl.h>
+#include <sal.h>
+
+/// <summary>
+/// Writes PCM audio to a RIFF WAVE stream, the container of audio only recordings. The header goes out first with the sizes left open,
+/// and Finalize fills them in if the stream can seek, so a recording that is never finalized still plays up to where it ends. Not thread safe.
+/// </summary>
+class WavWriter
+{
+public:
+	//The RIFF, fmt and data chunk headers, in front of the audio.
+	static const DWORD HeaderBytes = 44;
+
+	WavWriter();
+	~WavWriter();
+	/// <summary>
+	/// Writes the header to pStream, at its current position. The stream is not referenced, and must stay valid until Finalize has returned.
+	/// </summary>
+	HRESULT Initialize(_In_ IStream *pStream, _In_ UINT32 sampleRate, _In_ UINT32 channels, _In_ UINT32 bitsPerSample);
+	/// <summary>
+	/// Appends the audio in pData. Fails without writing anything once the audio would outgrow the 32 bit sizes of the header.
+	/// </summary>
+	HRESULT Write(_In_reads_bytes_(cbData) const BYTE *pData, _In_ DWORD cbData);
+	/// <summary>
+	/// Fills in the sizes in the header, and leaves the stream positioned after the audio. Returns S_FALSE if the stream can not seek, and the sizes stay open.
+	/// </summary>
+	HRESULT Finalize();
+	inline UINT64 GetDataBytes() const { return m_DataBytes; }
+	inline UINT64 GetWrittenFrames() const { return m_BlockAlign > 0 ? m_DataBytes / m_BlockAlign : 0; }
+private:
+	IStream *m_Stream;
+	//Where the header starts in the stream.
+	UINT64 m_HeaderPosition;
+	UINT32 m_BlockAlign;
+	UINT64 m_DataBytes;
+	bool m_IsFinalized;
+
+	HRESULT WriteToStream(_In_reads_bytes_(cbData) const void *pData, _In_ DWORD cbData);
+	HRESULT WriteSizeAt(_In_ UINT64 position, _In_ UINT32 size);
+};
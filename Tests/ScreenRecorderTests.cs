@@ -40,6 +40,23 @@ namespace ScreenRecorderLib
             }
         }
 
+        /// <summary>
+        /// Reads a field MediaInfoWrapper does not expose, such as matrix_coefficients or colour_range, from the first video stream.
+        /// </summary>
+        private static string GetVideoStreamInfo(string filePath, string parameter)
+        {
+            var mediaInfo = new MediaInfo.MediaInfo();
+            try
+            {
+                mediaInfo.Open(filePath);
+                return mediaInfo.Get(StreamKind.Video, 0, parameter);
+            }
+            finally
+            {
+                mediaInfo.Close();
+            }
+        }
+
         private static IEnumerable<object[]> GetVideoEncoders()
         {
             yield return new object[] { new H264VideoEncoder() };
@@ -457,7 +474,10 @@ namespace ScreenRecorderLib
         }
 
         [TestMethod]
-        public void RecordingWithAudioInput()
+        [DataRow(VideoColorConversionMode.Cpu, VideoColorMatrix.BT709, false)]
+        [DataRow(VideoColorConversionMode.Cpu, VideoColorMatrix.BT601, true)]
+        [DataRow(VideoColorConversionMode.MediaTransform, VideoColorMatrix.BT709, false)]
+        public void ColorConversion(VideoColorConversionMode mode, VideoColorMatrix matrix, bool isFullRange)
         {
             string filePath = Path.Combine(GetTempPath(), Path.ChangeExtension(Path.GetRandomFileName(), ".mp4"));
             try
@@ -465,7 +485,7 @@ namespace ScreenRecorderLib
                 using (var outStream = File.Open(filePath, FileMode.Create, FileAccess.ReadWrite, FileShare.Read))
                 {
                     RecorderOptions options = new RecorderOptions();
-                    options.AudioOptions = new AudioOptions { IsAudioEnabled = true, IsInputDeviceEnabled = true };
+                    options.VideoEncoderOptions = new VideoEncoderOptions { ColorConversionMode = mode, ColorMatrix = matrix, IsFullRangeColorEnabled = isFullRange };
                     using (var rec = Recorder.CreateRecorder(options))
                     {
                         string error = "";
@@ -501,7 +521,12 @@ namespace ScreenRecorderLib
                         Assert.IsTrue(isComplete);
                         Assert.AreNotEqual(outStream.Length, 0);
                         var mediaInfo = new MediaInfoWrapper(filePath);
-                        Assert.IsTrue(mediaInfo.AudioStreams.Count > 0);
+                        Assert.IsTrue(mediaInfo.Format == "MPEG-4");
+                        Assert.IsTrue(mediaInfo.VideoStreams.Count > 0);
+                        Assert.IsTrue(rec.CurrentFrameNumber > 0);
+                        //The matrix and range the frames were converted with are signalled in the stream, so players decode the colors the same way.
+                        Assert.AreEqual(matrix == VideoColorMatrix.BT601 ? "BT.601" : "BT.709", GetVideoStreamInfo(filePath, "matrix_coefficients"));
+                        Assert.AreEqual(isFullRange ? "Full" : "Limited", GetVideoStreamInfo(filePath, "colour_range"));
                     }
                 }
             }
@@ -512,7 +537,11 @@ namespace ScreenRecorderLib
         }
 
         [TestMethod]
-        public void RecordingWithAudioMixing()
+        [DataRow(0, FrameQueueFullPolicy.Block)]
+        [DataRow(4, FrameQueueFullPolicy.Block)]
+        [DataRow(1, FrameQueueFullPolicy.DropOldest)]
+        [DataRow(1, FrameQueueFullPolicy.DropNewest)]
+        public void FrameQueue(int queueLength, FrameQueueFullPolicy policy)
         {
             string filePath = Path.Combine(GetTempPath(), Path.ChangeExtension(Path.GetRandomFileName(), ".mp4"));
             try
@@ -520,14 +549,22 @@ namespace ScreenRecorderLib
                 using (var outStream = File.Open(filePath, FileMode.Create, FileAccess.ReadWrite, FileShare.Read))
                 {
                     RecorderOptions options = new RecorderOptions();
-                    options.AudioOptions = new AudioOptions { IsAudioEnabled = true, IsInputDeviceEnabled = true, IsOutputDeviceEnabled = true };
+                    options.VideoEncoderOptions = new VideoEncoderOptions { IsFixedFramerate = true, Framerate = 30, FrameQueueLength = queueLength, FrameQueueFullPolicy = policy };
                     using (var rec = Recorder.CreateRecorder(options))
                     {
                         string error = "";
                         bool isError = false;
                         bool isComplete = false;
+                        int maxQueuedFrames = 0;
+                        int droppedFrames = 0;
                         ManualResetEvent finalizeResetEvent = new ManualResetEvent(false);
                         ManualResetEvent recordingResetEvent = new ManualResetEvent(false);
+                        ManualResetEvent recordingStartedEvent = new ManualResetEvent(false);
+                        rec.OnFrameRecorded += (s, args) =>
+                        {
+                            maxQueuedFrames = Math.Max(maxQueuedFrames, args.QueuedFrames);
+                            droppedFrames = args.DroppedFrames;
+                        };
                         rec.OnRecordingComplete += (s, args) =>
                         {
                             isComplete = true;
@@ -544,22 +581,895 @@ namespace ScreenRecorderLib
                         {
                             if (args.Status == RecorderStatus.Recording)
                             {
-                                recordingResetEvent.Set();
+                                recordingStartedEvent.Set();
                             }
                         };
+                        int durationMillis = 3000;
+                        Stopwatch sw = Stopwatch.StartNew();
                         rec.Record(outStream);
-                        recordingResetEvent.WaitOne(DefaultMaxRecordingLengthMillis);
+                        recordingStartedEvent.WaitOne(3000);
+                        recordingResetEvent.WaitOne(durationMillis);
+                        rec.Stop();
+                        long recordingMillis = sw.ElapsedMilliseconds;
+                        finalizeResetEvent.WaitOne(5000);
+                        outStream.Flush();
+                        Assert.IsFalse(isError, error);
+                        Assert.IsTrue(isComplete);
+                        Assert.AreNotEqual(outStream.Length, 0);
+                        var mediaInfo = new MediaInfoWrapper(filePath);
+                        Assert.IsTrue(mediaInfo.Format == "MPEG-4");
+                        Assert.IsTrue(mediaInfo.VideoStreams.Count > 0);
+                        //The queue keeps the capture at the frame rate whatever the encoder does, and the frames that are encoded span the whole recording.
+                        int estimatedFrameCount = (int)Math.Floor(options.VideoEncoderOptions.Framerate * ((double)durationMillis / 1000));
+                        Assert.IsTrue(Math.Abs(rec.CurrentFrameNumber - estimatedFrameCount) <= 2, "Recorder framenumber {0} not equal to estimated frame number {1}", rec.CurrentFrameNumber, estimatedFrameCount);
+                        double videoMillis = mediaInfo.VideoStreams[0].Duration.TotalMilliseconds;
+                        Assert.IsTrue(videoMillis >= durationMillis - 200 && videoMillis <= recordingMillis + 200, "video length {0} ms does not match recording time {1} ms", videoMillis, durationMillis);
+                        Assert.IsTrue(maxQueuedFrames <= queueLength);
+                        if (policy == FrameQueueFullPolicy.Block)
+                        {
+                            Assert.AreEqual(0, droppedFrames);
+                        }
+                        else
+                        {
+                            Assert.IsTrue(droppedFrames < rec.CurrentFrameNumber, "{0} of {1} frames dropped", droppedFrames, rec.CurrentFrameNumber);
+                        }
+                    }
+                }
+            }
+            finally
+            {
+                File.Delete(filePath);
+            }
+        }
+
+        [TestMethod]
+        [DynamicData(nameof(GetVideoEncoders), DynamicDataSourceType.Method)]
+        public void NativeMp4Muxer(IVideoEncoder encoder)
+        {
+            string filePath = Path.Combine(GetTempPath(), Path.ChangeExtension(Path.GetRandomFileName(), ".mp4"));
+            try
+            {
+                using (var outStream = File.Open(filePath, FileMode.Create, FileAccess.ReadWrite, FileShare.Read))
+                {
+                    RecorderOptions options = new RecorderOptions();
+                    options.VideoEncoderOptions = new VideoEncoderOptions { Encoder = encoder, Mp4Muxer = Mp4Muxer.Native, FragmentDurationMillis = 500 };
+                    options.AudioOptions = new AudioOptions { IsAudioEnabled = true, IsOutputDeviceEnabled = true };
+                    using (var rec = Recorder.CreateRecorder(options))
+                    {
+                        string error = "";
+                        bool isError = false;
+                        bool isComplete = false;
+                        ManualResetEvent finalizeResetEvent = new ManualResetEvent(false);
+                        ManualResetEvent recordingResetEvent = new ManualResetEvent(false);
+                        ManualResetEvent recordingStartedEvent = new ManualResetEvent(false);
+                        rec.OnRecordingComplete += (s, args) =>
+                        {
+                            isComplete = true;
+                            finalizeResetEvent.Set();
+                        };
+                        rec.OnRecordingFailed += (s, args) =>
+                        {
+                            isError = true;
+                            error = args.Error;
+                            finalizeResetEvent.Set();
+                            recordingResetEvent.Set();
+                        };
+                        rec.OnStatusChanged += (s, args) =>
+                        {
+                            if (args.Status == RecorderStatus.Recording)
+                            {
+                                recordingStartedEvent.Set();
+                            }
+                        };
+                        int durationMillis = 3000;
+                        Stopwatch sw = Stopwatch.StartNew();
+                        rec.Record(outStream);
+                        recordingStartedEvent.WaitOne(3000);
+                        recordingResetEvent.WaitOne(durationMillis);
                         rec.Stop();
+                        long recordingMillis = sw.ElapsedMilliseconds;
                         finalizeResetEvent.WaitOne(5000);
                         outStream.Flush();
                         Assert.IsFalse(isError, error);
                         Assert.IsTrue(isComplete);
                         Assert.AreNotEqual(outStream.Length, 0);
                         var mediaInfo = new MediaInfoWrapper(filePath);
+                        Assert.IsTrue(mediaInfo.Format == "MPEG-4");
+                        Assert.IsTrue(mediaInfo.VideoStreams.Count > 0);
+                        Assert.IsTrue(mediaInfo.AudioStreams.Count > 0);
+                        //Both tracks run for the whole recording.
+                        double videoMillis = mediaInfo.VideoStreams[0].Duration.TotalMilliseconds;
+                        double audioMillis = mediaInfo.AudioStreams[0].Duration.TotalMilliseconds;
+                        Assert.IsTrue(videoMillis >= durationMillis - 200 && videoMillis <= recordingMillis + 200, "video length {0} ms does not match recording time {1} ms", videoMillis, durationMillis);
+                        Assert.IsTrue(audioMillis >= durationMillis - 300 && audioMillis <= recordingMillis + 300, "audio length {0} ms does not match recording time {1} ms", audioMillis, durationMillis);
+                    }
+                }
+            }
+            finally
+            {
+                File.Delete(filePath);
+            }
+        }
+
+        [TestMethod]
+        public void NativeMp4MuxerChunks()
+        {
+            string filePath = Path.Combine(GetTempPath(), Path.ChangeExtension(Path.GetRandomFileName(), ".mp4"));
+            try
+            {
+                using (var outStream = File.Open(filePath, FileMode.Create, FileAccess.ReadWrite, FileShare.Read))
+                {
+                    RecorderOptions options = new RecorderOptions();
+                    options.VideoEncoderOptions = new VideoEncoderOptions { Mp4Muxer = Mp4Muxer.Native, FragmentDurationMillis = 1000, ChunkDurationMillis = 200 };
+                    options.AudioOptions = new AudioOptions { IsAudioEnabled = true, IsOutputDeviceEnabled = true };
+                    using (var rec = Recorder.CreateRecorder(options))
+                    {
+                        string error = "";
+                        bool isError = false;
+                        bool isComplete = false;
+                        var chunks = new List<ChunkWrittenEventArgs>();
+                        ManualResetEvent finalizeResetEvent = new ManualResetEvent(false);
+                        ManualResetEvent recordingResetEvent = new ManualResetEvent(false);
+                        ManualResetEvent recordingStartedEvent = new ManualResetEvent(false);
+                        rec.OnChunkWritten += (s, args) =>
+                        {
+                            lock (chunks)
+                            {
+                                chunks.Add(args);
+                            }
+                        };
+                        rec.OnRecordingComplete += (s, args) =>
+                        {
+                            isComplete = true;
+                            finalizeResetEvent.Set();
+                        };
+                        rec.OnRecordingFailed += (s, args) =>
+                        {
+                            isError = true;
+                            error = args.Error;
+                            finalizeResetEvent.Set();
+                            recordingResetEvent.Set();
+                        };
+                        rec.OnStatusChanged += (s, args) =>
+                        {
+                            if (args.Status == RecorderStatus.Recording)
+                            {
+                                recordingStartedEvent.Set();
+                            }
+                        };
+                        int durationMillis = 3000;
+                        Stopwatch sw = Stopwatch.StartNew();
+                        rec.Record(outStream);
+                        recordingStartedEvent.WaitOne(3000);
+                        recordingResetEvent.WaitOne(durationMillis);
+                        rec.Stop();
+                        long recordingMillis = sw.ElapsedMilliseconds;
+                        finalizeResetEvent.WaitOne(5000);
+                        outStream.Flush();
+                        Assert.IsFalse(isError, error);
+                        Assert.IsTrue(isComplete);
+                        lock (chunks)
+                        {
+                            //Chunks follow each other in the file, and a fragment of 1 s has more than one chunk of 200 ms.
+                            Assert.IsTrue(chunks.Count > 1);
+                            Assert.IsTrue(chunks[0].IsFragmentStart);
+                            Assert.IsTrue(chunks.Count > chunks.Count(c => c.IsFragmentStart));
+                            for (int i = 1; i < chunks.Count; i++)
+                            {
+                                Assert.AreEqual(chunks[i - 1].SequenceNumber + 1, chunks[i].SequenceNumber);
+                                Assert.AreEqual(chunks[i - 1].Offset + chunks[i - 1].Size, chunks[i].Offset);
+                                Assert.IsTrue(chunks[i].StartTime > chunks[i - 1].StartTime);
+                            }
+                            Assert.IsTrue(chunks[chunks.Count - 1].Offset + chunks[chunks.Count - 1].Size <= outStream.Length);
+                            //Together the chunks hold the whole recording.
+                            TimeSpan chunksEnd = chunks[chunks.Count - 1].StartTime + chunks[chunks.Count - 1].Duration;
+                            Assert.IsTrue(chunksEnd.TotalMilliseconds >= durationMillis - 200 && chunksEnd.TotalMilliseconds <= recordingMillis + 200, "chunks end at {0} ms, the recording took {1} ms", chunksEnd.TotalMilliseconds, durationMillis);
+                        }
+                        var mediaInfo = new MediaInfoWrapper(filePath);
+                        Assert.IsTrue(mediaInfo.Format == "MPEG-4");
+                        Assert.IsTrue(mediaInfo.VideoStreams.Count > 0);
                         Assert.IsTrue(mediaInfo.AudioStreams.Count > 0);
+                        double videoMillis = mediaInfo.VideoStreams[0].Duration.TotalMilliseconds;
+                        Assert.IsTrue(videoMillis >= durationMillis - 200 && videoMillis <= recordingMillis + 200, "video length {0} ms does not match recording time {1} ms", videoMillis, durationMillis);
+                    }
+                }
+            }
+            finally
+            {
+                File.Delete(filePath);
+            }
+        }
+
+        [TestMethod]
+        public void NativeMp4MuxerSegments()
+        {
+            string filePath = Path.Combine(GetTempPath(), Path.ChangeExtension(Path.GetRandomFileName(), ".mp4"));
+            var segments = new List<SegmentWrittenEventArgs>();
+            try
+            {
+                RecorderOptions options = new RecorderOptions();
+                options.VideoEncoderOptions = new VideoEncoderOptions { Mp4Muxer = Mp4Muxer.Native, FragmentDurationMillis = 500, SegmentDurationMillis = 1000 };
+                options.AudioOptions = new AudioOptions { IsAudioEnabled = true, IsOutputDeviceEnabled = true };
+                using (var rec = Recorder.CreateRecorder(options))
+                {
+                    string error = "";
+                    bool isError = false;
+                    bool isComplete = false;
+                    ManualResetEvent finalizeResetEvent = new ManualResetEvent(false);
+                    ManualResetEvent recordingResetEvent = new ManualResetEvent(false);
+                    ManualResetEvent recordingStartedEvent = new ManualResetEvent(false);
+                    rec.OnSegmentWritten += (s, args) =>
+                    {
+                        lock (segments)
+                        {
+                            segments.Add(args);
+                        }
+                    };
+                    rec.OnRecordingComplete += (s, args) =>
+                    {
+                        isComplete = true;
+                        finalizeResetEvent.Set();
+                    };
+                    rec.OnRecordingFailed += (s, args) =>
+                    {
+                        isError = true;
+                        error = args.Error;
+                        finalizeResetEvent.Set();
+                        recordingResetEvent.Set();
+                    };
+                    rec.OnStatusChanged += (s, args) =>
+                    {
+                        if (args.Status == RecorderStatus.Recording)
+                        {
+                            recordingStartedEvent.Set();
+                        }
+                    };
+                    int durationMillis = 3000;
+                    Stopwatch sw = Stopwatch.StartNew();
+                    rec.Record(filePath);
+                    recordingStartedEvent.WaitOne(3000);
+                    recordingResetEvent.WaitOne(durationMillis);
+                    rec.Stop();
+                    long recordingMillis = sw.ElapsedMilliseconds;
+                    finalizeResetEvent.WaitOne(5000);
+                    Assert.IsFalse(isError, error);
+                    Assert.IsTrue(isComplete);
+                    lock (segments)
+                    {
+                        //Every segment is a file of its own that plays on its own, starting where the one before ended.
+                        Assert.IsTrue(segments.Count > 1);
+                        //Segments are only switched on a keyframe once the segment duration has passed, and the last one ends with the recording.
+                        TimeSpan segmentsEnd = segments[segments.Count - 1].StartTime + segments[segments.Count - 1].Duration;
+                        Assert.IsTrue(segmentsEnd.TotalMilliseconds >= durationMillis - 200 && segmentsEnd.TotalMilliseconds <= recordingMillis + 200, "segments end at {0} ms, the recording took {1} ms", segmentsEnd.TotalMilliseconds, durationMillis);
+                        Assert.AreEqual(filePath, segments[0].FilePath);
+                        for (int i = 0; i < segments.Count; i++)
+                        {
+                            Assert.AreEqual(i + 1, segments[i].SegmentNumber);
+                            if (i < segments.Count - 1)
+                            {
+                                Assert.IsTrue(segments[i].Duration.TotalMilliseconds >= options.VideoEncoderOptions.SegmentDurationMillis - 50, "segment {0} is {1} ms long", segments[i].SegmentNumber, segments[i].Duration.TotalMilliseconds);
+                            }
+                            Assert.IsTrue(File.Exists(segments[i].FilePath));
+                            Assert.AreEqual(segments[i].Size, new FileInfo(segments[i].FilePath).Length);
+                            if (i > 0)
+                            {
+                                Assert.AreEqual(0, segments[i].DroppedFrames);
+                                Assert.IsTrue(Math.Abs((segments[i - 1].StartTime + segments[i - 1].Duration - segments[i].StartTime).TotalMilliseconds) < 50);
+                            }
+                            var mediaInfo = new MediaInfoWrapper(segments[i].FilePath);
+                            Assert.IsTrue(mediaInfo.Format == "MPEG-4");
+                            Assert.IsTrue(mediaInfo.VideoStreams.Count > 0);
+                            double videoMillis = mediaInfo.VideoStreams[0].Duration.TotalMilliseconds;
+                            Assert.IsTrue(Math.Abs(videoMillis - segments[i].Duration.TotalMilliseconds) <= 200, "segment {0} plays for {1} ms, {2} ms were reported", segments[i].SegmentNumber, videoMillis, segments[i].Duration.TotalMilliseconds);
+                        }
+                    }
+                }
+            }
+            finally
+            {
+                File.Delete(filePath);
+                lock (segments)
+                {
+                    foreach (var segment in segments)
+                    {
+                        File.Delete(segment.FilePath);
                     }
                 }
             }
+        }
+
+        [TestMethod]
+        public void NativeMp4MuxerRecovery()
+        {
+            string filePath = Path.Combine(GetTempPath(), Path.ChangeExtension(Path.GetRandomFileName(), ".mp4"));
+            string truncatedFilePath = Path.ChangeExtension(filePath, ".truncated.mp4");
+            string recoveredFilePath = Path.ChangeExtension(filePath, ".recovered.mp4");
+            try
+            {
+                RecorderOptions options = new RecorderOptions();
+                options.VideoEncoderOptions = new VideoEncoderOptions { Mp4Muxer = Mp4Muxer.Native, FragmentDurationMillis = 500, IsCrashSafeEnabled = true, CrashSafeSyncIntervalMillis = 0 };
+                options.AudioOptions = new AudioOptions { IsAudioEnabled = true, IsOutputDeviceEnabled = true };
+                using (var rec = Recorder.CreateRecorder(options))
+                {
+                    string error = "";
+                    bool isError = false;
+                    bool isComplete = false;
+                    ManualResetEvent finalizeResetEvent = new ManualResetEvent(false);
+                    ManualResetEvent recordingResetEvent = new ManualResetEvent(false);
+                    ManualResetEvent recordingStartedEvent = new ManualResetEvent(false);
+                    rec.OnRecordingComplete += (s, args) =>
+                    {
+                        isComplete = true;
+                        finalizeResetEvent.Set();
+                    };
+                    rec.OnRecordingFailed += (s, args) =>
+                    {
+                        isError = true;
+                        error = args.Error;
+                        finalizeResetEvent.Set();
+                        recordingResetEvent.Set();
+                    };
+                    rec.OnStatusChanged += (s, args) =>
+                    {
+                        if (args.Status == RecorderStatus.Recording)
+                        {
+                            recordingStartedEvent.Set();
+                        }
+                    };
+                    rec.Record(filePath);
+                    recordingStartedEvent.WaitOne(3000);
+                    recordingResetEvent.WaitOne(3000);
+                    rec.Stop();
+                    finalizeResetEvent.WaitOne(5000);
+                    Assert.IsFalse(isError, error);
+                    Assert.IsTrue(isComplete);
+                }
+                //The journal of a finished recording is deleted, and the recording recovers as it is.
+                Assert.IsFalse(File.Exists(filePath + ".journal"));
+                RecoveryResult result = Recorder.RecoverRecording(filePath, recoveredFilePath);
+                Assert.IsTrue(result.IsSuccessful, result.Error);
+                Assert.IsTrue(result.IsComplete);
+                Assert.AreEqual(new FileInfo(filePath).Length, result.Size);
+                TimeSpan recordingDuration = new MediaInfoWrapper(filePath).VideoStreams[0].Duration;
+                Assert.IsTrue(Math.Abs((result.Duration - recordingDuration).TotalMilliseconds) <= 200, "recovered {0} ms of a {1} ms recording", result.Duration.TotalMilliseconds, recordingDuration.TotalMilliseconds);
+                Assert.IsTrue(Math.Abs((new MediaInfoWrapper(recoveredFilePath).VideoStreams[0].Duration - recordingDuration).TotalMilliseconds) <= 200);
+
+                //A recording cut off anywhere recovers to a playable file with the fragments before the cut.
+                byte[] data = File.ReadAllBytes(filePath);
+                int previousChunks = 0;
+                TimeSpan previousDuration = TimeSpan.Zero;
+                foreach (double fraction in new[] { 0.4, 0.7, 0.99 })
+                {
+                    File.WriteAllBytes(truncatedFilePath, data.Take((int)(data.Length * fraction)).ToArray());
+                    result = Recorder.RecoverRecording(truncatedFilePath, recoveredFilePath);
+                    Assert.IsTrue(result.IsSuccessful, result.Error);
+                    Assert.IsFalse(result.IsComplete);
+                    Assert.IsTrue(result.Chunks > 0);
+                    Assert.IsTrue(result.Chunks >= previousChunks);
+                    Assert.IsTrue(result.Size <= data.Length);
+                    Assert.IsTrue(result.Duration >= previousDuration && result.Duration <= recordingDuration, "recovered {0} ms of a {1} ms recording", result.Duration.TotalMilliseconds, recordingDuration.TotalMilliseconds);
+                    previousChunks = result.Chunks;
+                    previousDuration = result.Duration;
+                    var mediaInfo = new MediaInfoWrapper(recoveredFilePath);
+                    Assert.IsTrue(mediaInfo.Format == "MPEG-4");
+                    Assert.IsTrue(mediaInfo.VideoStreams.Count > 0);
+                    Assert.IsTrue(Math.Abs(mediaInfo.VideoStreams[0].Duration.TotalMilliseconds - result.Duration.TotalMilliseconds) <= 200, "recovered file plays for {0} ms, {1} ms were reported", mediaInfo.VideoStreams[0].Duration.TotalMilliseconds, result.Duration.TotalMilliseconds);
+                }
+            }
+            finally
+            {
+                File.Delete(filePath);
+                File.Delete(truncatedFilePath);
+                File.Delete(recoveredFilePath);
+            }
+        }
+
+        [TestMethod]
+        public void InstantReplay()
+        {
+            string filePath = Path.Combine(GetTempPath(), Path.ChangeExtension(Path.GetRandomFileName(), ".mp4"));
+            string replayFilePath = Path.ChangeExtension(filePath, ".replay.mp4");
+            try
+            {
+                RecorderOptions options = new RecorderOptions();
+                options.VideoEncoderOptions = new VideoEncoderOptions { Mp4Muxer = Mp4Muxer.Native, IsInstantReplayEnabled = true, InstantReplayDurationMillis = 2000 };
+                options.AudioOptions = new AudioOptions { IsAudioEnabled = true, IsOutputDeviceEnabled = true };
+                ReplaySaveResult savedResult;
+                using (var rec = Recorder.CreateRecorder(options))
+                {
+                    string error = "";
+                    bool isError = false;
+                    bool isComplete = false;
+                    ManualResetEvent finalizeResetEvent = new ManualResetEvent(false);
+                    ManualResetEvent recordingResetEvent = new ManualResetEvent(false);
+                    ManualResetEvent recordingStartedEvent = new ManualResetEvent(false);
+                    rec.OnRecordingComplete += (s, args) =>
+                    {
+                        isComplete = true;
+                        finalizeResetEvent.Set();
+                    };
+                    rec.OnRecordingFailed += (s, args) =>
+                    {
+                        isError = true;
+                        error = args.Error;
+                        finalizeResetEvent.Set();
+                        recordingResetEvent.Set();
+                    };
+                    rec.OnStatusChanged += (s, args) =>
+                    {
+                        if (args.Status == RecorderStatus.Recording)
+                        {
+                            recordingStartedEvent.Set();
+                        }
+                    };
+                    rec.Record(filePath);
+                    recordingStartedEvent.WaitOne(3000);
+                    recordingResetEvent.WaitOne(4000);
+                    //Saved while the recording goes on, the replay holds about the last InstantReplayDurationMillis, from a keyframe.
+                    ReplaySaveResult result = rec.SaveReplay(replayFilePath);
+                    savedResult = result;
+                    Assert.IsTrue(result.IsSuccessful, result.Error);
+                    Assert.IsFalse(result.IsTruncated);
+                    Assert.AreEqual(new FileInfo(replayFilePath).Length, result.Size);
+                    Assert.IsTrue(result.Duration.TotalMilliseconds >= 1000);
+                    Assert.IsTrue(result.Duration.TotalMilliseconds <= options.VideoEncoderOptions.InstantReplayDurationMillis + options.VideoEncoderOptions.FragmentDurationMillis + 100, "replay of {0} ms", result.Duration.TotalMilliseconds);
+                    Assert.IsTrue(result.StartTime.TotalMilliseconds > 0);
+                    //A save does not overwrite a file.
+                    Assert.IsFalse(rec.SaveReplay(replayFilePath).IsSuccessful);
+                    using (var replayStream = new MemoryStream())
+                    {
+                        result = rec.SaveReplay(replayStream);
+                        Assert.IsTrue(result.IsSuccessful, result.Error);
+                        Assert.AreEqual(replayStream.Length, result.Size);
+                    }
+                    rec.Stop();
+                    finalizeResetEvent.WaitOne(5000);
+                    Assert.IsFalse(isError, error);
+                    Assert.IsTrue(isComplete);
+                    //The replay of a finished recording can still be saved.
+                    using (var replayStream = new MemoryStream())
+                    {
+                        result = rec.SaveReplay(replayStream);
+                        Assert.IsTrue(result.IsSuccessful, result.Error);
+                    }
+                }
+                Assert.IsTrue(new FileInfo(filePath).Length > 0);
+                var mediaInfo = new MediaInfoWrapper(replayFilePath);
+                Assert.IsTrue(mediaInfo.Format == "MPEG-4");
+                Assert.IsTrue(mediaInfo.VideoStreams.Count > 0);
+                Assert.IsTrue(mediaInfo.AudioStreams.Count > 0);
+                //The saved file plays for as long as reported, with audio alongside.
+                double videoMillis = mediaInfo.VideoStreams[0].Duration.TotalMilliseconds;
+                double audioMillis = mediaInfo.AudioStreams[0].Duration.TotalMilliseconds;
+                Assert.IsTrue(Math.Abs(videoMillis - savedResult.Duration.TotalMilliseconds) <= 200, "replay plays for {0} ms, {1} ms were reported", videoMillis, savedResult.Duration.TotalMilliseconds);
+                Assert.IsTrue(Math.Abs(audioMillis - videoMillis) <= 300, "replay audio of {0} ms, video of {1} ms", audioMillis, videoMillis);
+            }
+            finally
+            {
+                File.Delete(filePath);
+                File.Delete(replayFilePath);
+            }
+        }
+
+        [TestMethod]
+        [DataRow(true, 1000)]
+        [DataRow(true, 100)]
+        [DataRow(false, 1000)]
+        public void UnchangedFrameSkipping(bool isEnabled, int maxUnchangedFrameDurationMillis)
+        {
+            string filePath = Path.Combine(GetTempPath(), Path.ChangeExtension(Path.GetRandomFileName(), ".mp4"));
+            try
+            {
+                using (var outStream = File.Open(filePath, FileMode.Create, FileAccess.ReadWrite, FileShare.Read))
+                {
+                    RecorderOptions options = new RecorderOptions();
+                    options.VideoEncoderOptions = new VideoEncoderOptions { IsFixedFramerate = true, Framerate = 30, IsUnchangedFrameSkippingEnabled = isEnabled, MaxUnchangedFrameDurationMillis = maxUnchangedFrameDurationMillis };
+                    using (var rec = Recorder.CreateRecorder(options))
+                    {
+                        string error = "";
+                        bool isError = false;
+                        bool isComplete = false;
+                        ManualResetEvent finalizeResetEvent = new ManualResetEvent(false);
+                        ManualResetEvent recordingResetEvent = new ManualResetEvent(false);
+                        ManualResetEvent recordingStartedEvent = new ManualResetEvent(false);
+                        rec.OnRecordingComplete += (s, args) =>
+                        {
+                            isComplete = true;
+                            finalizeResetEvent.Set();
+                        };
+                        rec.OnRecordingFailed += (s, args) =>
+                        {
+                            isError = true;
+                            error = args.Error;
+                            finalizeResetEvent.Set();
+                            recordingResetEvent.Set();
+                        };
+                        rec.OnStatusChanged += (s, args) =>
+                        {
+                            if (args.Status == RecorderStatus.Recording)
+                            {
+                                recordingStartedEvent.Set();
+                            }
+                        };
+                        int durationMillis = 3000;
+                        Stopwatch sw = Stopwatch.StartNew();
+                        rec.Record(outStream);
+                        recordingStartedEvent.WaitOne(3000);
+                        recordingResetEvent.WaitOne(durationMillis);
+                        rec.Stop();
+                        long recordingMillis = sw.ElapsedMilliseconds;
+                        finalizeResetEvent.WaitOne(5000);
+                        outStream.Flush();
+                        Assert.IsFalse(isError, error);
+                        Assert.IsTrue(isComplete);
+                        Assert.AreNotEqual(outStream.Length, 0);
+                        var mediaInfo = new MediaInfoWrapper(filePath);
+                        Assert.IsTrue(mediaInfo.Format == "MPEG-4");
+                        Assert.IsTrue(mediaInfo.VideoStreams.Count > 0);
+                        //Skipped frames stretch the one before them, so the video still spans the whole recording.
+                        double videoMillis = mediaInfo.VideoStreams[0].Duration.TotalMilliseconds;
+                        Assert.IsTrue(videoMillis >= durationMillis - 200 && videoMillis <= recordingMillis + 200, "video length {0} ms does not match recording time {1} ms", videoMillis, durationMillis);
+                        int estimatedFrameCount = (int)Math.Floor(options.VideoEncoderOptions.Framerate * ((double)durationMillis / 1000));
+                        if (isEnabled)
+                        {
+                            //A mostly static desktop skips most frames, but still writes one at least every MaxUnchangedFrameDurationMillis.
+                            Assert.IsTrue(rec.CurrentFrameNumber < estimatedFrameCount, "Recorder framenumber {0} not below the estimated frame number {1}", rec.CurrentFrameNumber, estimatedFrameCount);
+                            Assert.IsTrue(rec.CurrentFrameNumber >= durationMillis / maxUnchangedFrameDurationMillis - 2, "Recorder framenumber {0} below one frame every {1} ms", rec.CurrentFrameNumber, maxUnchangedFrameDurationMillis);
+                        }
+                        else
+                        {
+                            Assert.IsTrue(Math.Abs(rec.CurrentFrameNumber - estimatedFrameCount) <= 2, "Recorder framenumber {0} not equal to estimated frame number {1}", rec.CurrentFrameNumber, estimatedFrameCount);
+                        }
+                    }
+                }
+            }
+            finally
+            {
+                File.Delete(filePath);
+            }
+        }
+
+        [TestMethod]
+        public void RecordingWithAudioInput()
+        {
+            string filePath = Path.Combine(GetTempPath(), Path.ChangeExtension(Path.GetRandomFileName(), ".mp4"));
+            try
+            {
+                using (var outStream = File.Open(filePath, FileMode.Create, FileAccess.ReadWrite, FileShare.Read))
+                {
+                    RecorderOptions options = new RecorderOptions();
+                    options.AudioOptions = new AudioOptions { IsAudioEnabled = true, IsInputDeviceEnabled = true };
+                    using (var rec = Recorder.CreateRecorder(options))
+                    {
+                        string error = "";
+                        bool isError = false;
+                        bool isComplete = false;
+                        ManualResetEvent finalizeResetEvent = new ManualResetEvent(false);
+                        ManualResetEvent recordingResetEvent = new ManualResetEvent(false);
+                        rec.OnRecordingComplete += (s, args) =>
+                        {
+                            isComplete = true;
+                            finalizeResetEvent.Set();
+                        };
+                        rec.OnRecordingFailed += (s, args) =>
+                        {
+                            isError = true;
+                            error = args.Error;
+                            finalizeResetEvent.Set();
+                            recordingResetEvent.Set();
+                        };
+                        rec.OnStatusChanged += (s, args) =>
+                        {
+                            if (args.Status == RecorderStatus.Recording)
+                            {
+                                recordingResetEvent.Set();
+                            }
+                        };
+                        rec.Record(outStream);
+                        recordingResetEvent.WaitOne(DefaultMaxRecordingLengthMillis);
+                        rec.Stop();
+                        finalizeResetEvent.WaitOne(5000);
+                        outStream.Flush();
+                        Assert.IsFalse(isError, error);
+                        Assert.IsTrue(isComplete);
+                        Assert.AreNotEqual(outStream.Length, 0);
+                        var mediaInfo = new MediaInfoWrapper(filePath);
+                        Assert.IsTrue(mediaInfo.AudioStreams.Count > 0);
+                    }
+                }
+            }
+            finally
+            {
+                File.Delete(filePath);
+            }
+        }
+
+        [TestMethod]
+        public void RecordingWithAudioMixing()
+        {
+            string filePath = Path.Combine(GetTempPath(), Path.ChangeExtension(Path.GetRandomFileName(), ".mp4"));
+            try
+            {
+                using (var outStream = File.Open(filePath, FileMode.Create, FileAccess.ReadWrite, FileShare.Read))
+                {
+                    RecorderOptions options = new RecorderOptions();
+                    options.AudioOptions = new AudioOptions { IsAudioEnabled = true, IsInputDeviceEnabled = true, IsOutputDeviceEnabled = true };
+                    using (var rec = Recorder.CreateRecorder(options))
+                    {
+                        string error = "";
+                        bool isError = false;
+                        bool isComplete = false;
+                        ManualResetEvent finalizeResetEvent = new ManualResetEvent(false);
+                        ManualResetEvent recordingResetEvent = new ManualResetEvent(false);
+                        rec.OnRecordingComplete += (s, args) =>
+                        {
+                            isComplete = true;
+                            finalizeResetEvent.Set();
+                        };
+                        rec.OnRecordingFailed += (s, args) =>
+                        {
+                            isError = true;
+                            error = args.Error;
+                            finalizeResetEvent.Set();
+                            recordingResetEvent.Set();
+                        };
+                        rec.OnStatusChanged += (s, args) =>
+                        {
+                            if (args.Status == RecorderStatus.Recording)
+                            {
+                                recordingResetEvent.Set();
+                            }
+                        };
+                        rec.Record(outStream);
+                        recordingResetEvent.WaitOne(DefaultMaxRecordingLengthMillis);
+                        rec.Stop();
+                        finalizeResetEvent.WaitOne(5000);
+                        outStream.Flush();
+                        Assert.IsFalse(isError, error);
+                        Assert.IsTrue(isComplete);
+                        Assert.AreNotEqual(outStream.Length, 0);
+                        var mediaInfo = new MediaInfoWrapper(filePath);
+                        Assert.IsTrue(mediaInfo.AudioStreams.Count > 0);
+                    }
+                }
+            }
+            finally
+            {
+                File.Delete(filePath);
+            }
+        }
+
+        [TestMethod]
+        public void RecordingWithAudioDeviceSwap()
+        {
+            var outputDevices = Recorder.GetSystemAudioDevices(AudioDeviceSource.OutputDevices);
+            if (outputDevices.Count == 0)
+            {
+                Assert.Inconclusive("No audio output device to swap to");
+            }
+            string filePath = Path.Combine(GetTempPath(), Path.ChangeExtension(Path.GetRandomFileName(), ".mp4"));
+            try
+            {
+                RecorderOptions options = new RecorderOptions();
+                options.AudioOptions = new AudioOptions { IsAudioEnabled = true, IsOutputDeviceEnabled = true };
+                using (var rec = Recorder.CreateRecorder(options))
+                {
+                    string error = "";
+                    bool isError = false;
+                    bool isComplete = false;
+                    ManualResetEvent finalizeResetEvent = new ManualResetEvent(false);
+                    ManualResetEvent recordingResetEvent = new ManualResetEvent(false);
+                    rec.OnRecordingComplete += (s, args) =>
+                    {
+                        isComplete = true;
+                        finalizeResetEvent.Set();
+                    };
+                    rec.OnRecordingFailed += (s, args) =>
+                    {
+                        isError = true;
+                        error = args.Error;
+                        finalizeResetEvent.Set();
+                        recordingResetEvent.Set();
+                    };
+                    rec.OnStatusChanged += (s, args) =>
+                    {
+                        if (args.Status == RecorderStatus.Recording)
+                        {
+                            recordingResetEvent.Set();
+                        }
+                    };
+                    rec.Record(filePath);
+                    recordingResetEvent.WaitOne(DefaultMaxRecordingLengthMillis);
+                    rec.GetDynamicOptionsBuilder()
+                        .SetDynamicAudioOptions(new DynamicAudioOptions { AudioOutputDevice = outputDevices[0].DeviceName })
+                        .Apply();
+                    Thread.Sleep(1000);
+                    rec.Stop();
+                    finalizeResetEvent.WaitOne(5000);
+
+                    Assert.IsFalse(isError, error);
+                    Assert.IsTrue(isComplete);
+                    var mediaInfo = new MediaInfoWrapper(filePath);
+                    Assert.IsTrue(mediaInfo.AudioStreams.Count > 0);
+                    Assert.IsTrue(mediaInfo.AudioStreams[0].Duration.TotalMilliseconds > 500);
+                }
+            }
+            finally
+            {
+                File.Delete(filePath);
+            }
+        }
+
+        [TestMethod]
+        public void RecordingWithSeparateAudioTracks()
+        {
+            string filePath = Path.Combine(GetTempPath(), Path.ChangeExtension(Path.GetRandomFileName(), ".mp4"));
+            try
+            {
+                RecorderOptions options = new RecorderOptions();
+                options.AudioOptions = new AudioOptions { IsAudioEnabled = true, IsInputDeviceEnabled = true, IsOutputDeviceEnabled = true, TrackLayout = AudioTrackLayout.MixedAndSeparate };
+                using (var rec = Recorder.CreateRecorder(options))
+                {
+                    string error = "";
+                    bool isError = false;
+                    bool isComplete = false;
+                    ManualResetEvent finalizeResetEvent = new ManualResetEvent(false);
+                    ManualResetEvent recordingResetEvent = new ManualResetEvent(false);
+                    rec.OnRecordingComplete += (s, args) =>
+                    {
+                        isComplete = true;
+                        finalizeResetEvent.Set();
+                    };
+                    rec.OnRecordingFailed += (s, args) =>
+                    {
+                        isError = true;
+                        error = args.Error;
+                        finalizeResetEvent.Set();
+                        recordingResetEvent.Set();
+                    };
+                    rec.OnStatusChanged += (s, args) =>
+                    {
+                        if (args.Status == RecorderStatus.Recording)
+                        {
+                            recordingResetEvent.Set();
+                        }
+                    };
+                    rec.Record(filePath);
+                    recordingResetEvent.WaitOne(DefaultMaxRecordingLengthMillis);
+                    Thread.Sleep(1000);
+                    rec.Stop();
+                    finalizeResetEvent.WaitOne(5000);
+
+                    Assert.IsFalse(isError, error);
+                    Assert.IsTrue(isComplete);
+                    //The mixed track, then one for the output device and one for the input device. A missing device is recorded as silence.
+                    var mediaInfo = new MediaInfoWrapper(filePath);
+                    Assert.AreEqual(3, mediaInfo.AudioStreams.Count);
+                    foreach (var audioStream in mediaInfo.AudioStreams)
+                    {
+                        Assert.IsTrue(audioStream.Duration.TotalMilliseconds > 500);
+                    }
+                }
+            }
+            finally
+            {
+                File.Delete(filePath);
+            }
+        }
+
+        [TestMethod]
+        public void RecordingAudioOnlyToWav()
+        {
+            string filePath = Path.Combine(GetTempPath(), Path.ChangeExtension(Path.GetRandomFileName(), ".wav"));
+            try
+            {
+                RecorderOptions options = new RecorderOptions();
+                options.OutputOptions = new OutputOptions { RecorderMode = RecorderMode.Audio };
+                options.AudioOptions = new AudioOptions { IsAudioEnabled = true, IsInputDeviceEnabled = true, IsOutputDeviceEnabled = true };
+                using (var rec = Recorder.CreateRecorder(options))
+                {
+                    string error = "";
+                    bool isError = false;
+                    bool isComplete = false;
+                    ManualResetEvent finalizeResetEvent = new ManualResetEvent(false);
+                    ManualResetEvent recordingResetEvent = new ManualResetEvent(false);
+                    rec.OnRecordingComplete += (s, args) =>
+                    {
+                        isComplete = true;
+                        finalizeResetEvent.Set();
+                    };
+                    rec.OnRecordingFailed += (s, args) =>
+                    {
+                        isError = true;
+                        error = args.Error;
+                        finalizeResetEvent.Set();
+                        recordingResetEvent.Set();
+                    };
+                    rec.OnStatusChanged += (s, args) =>
+                    {
+                        if (args.Status == RecorderStatus.Recording)
+                        {
+                            recordingResetEvent.Set();
+                        }
+                    };
+                    rec.Record(filePath);
+                    recordingResetEvent.WaitOne(DefaultMaxRecordingLengthMillis);
+                    Thread.Sleep(1000);
+                    rec.Stop();
+                    finalizeResetEvent.WaitOne(5000);
+
+                    Assert.IsFalse(isError, error);
+                    Assert.IsTrue(isComplete);
+                    var mediaInfo = new MediaInfoWrapper(filePath);
+                    Assert.AreEqual("Wave", mediaInfo.Format);
+                    Assert.AreEqual(0, mediaInfo.VideoStreams.Count);
+                    Assert.AreEqual(1, mediaInfo.AudioStreams.Count);
+                    Assert.IsTrue(mediaInfo.AudioStreams[0].Duration.TotalMilliseconds > 500);
+                }
+            }
+            finally
+            {
+                File.Delete(filePath);
+            }
+        }
+
+        [TestMethod]
+        public void RecordingAudioWithTimerCaptureWakeups()
+        {
+            string filePath = Path.Combine(GetTempPath(), Path.ChangeExtension(Path.GetRandomFileName(), ".wav"));
+            try
+            {
+                RecorderOptions options = new RecorderOptions();
+                options.OutputOptions = new OutputOptions { RecorderMode = RecorderMode.Audio };
+                //A buffer shorter than the wake interval is raised to cover it, so nothing is lost between wakeups.
+                options.AudioOptions = new AudioOptions
+                {
+                    IsAudioEnabled = true,
+                    IsInputDeviceEnabled = true,
+                    IsOutputDeviceEnabled = true,
+                    CaptureWakeMode = AudioCaptureWakeMode.Timer,
+                    CaptureWakeIntervalMillis = 50,
+                    CaptureBufferMillis = 20
+                };
+                using (var rec = Recorder.CreateRecorder(options))
+                {
+                    string error = "";
+                    bool isError = false;
+                    bool isComplete = false;
+                    ManualResetEvent finalizeResetEvent = new ManualResetEvent(false);
+                    ManualResetEvent recordingResetEvent = new ManualResetEvent(false);
+                    rec.OnRecordingComplete += (s, args) =>
+                    {
+                        isComplete = true;
+                        finalizeResetEvent.Set();
+                    };
+                    rec.OnRecordingFailed += (s, args) =>
+                    {
+                        isError = true;
+                        error = args.Error;
+                        finalizeResetEvent.Set();
+                        recordingResetEvent.Set();
+                    };
+                    rec.OnStatusChanged += (s, args) =>
+                    {
+                        if (args.Status == RecorderStatus.Recording)
+                        {
+                            recordingResetEvent.Set();
+                        }
+                    };
+                    rec.Record(filePath);
+                    recordingResetEvent.WaitOne(DefaultMaxRecordingLengthMillis);
+                    Thread.Sleep(1000);
+                    rec.Stop();
+                    finalizeResetEvent.WaitOne(5000);
+
+                    Assert.IsFalse(isError, error);
+                    Assert.IsTrue(isComplete);
+                    var mediaInfo = new MediaInfoWrapper(filePath);
+                    Assert.AreEqual(1, mediaInfo.AudioStreams.Count);
+                    Assert.IsTrue(mediaInfo.AudioStreams[0].Duration.TotalMilliseconds > 500);
+                }
+            }
             finally
             {
                 File.Delete(filePath);